@@ -49,6 +49,8 @@ extern void pfkey_sadump (struct sadb_msg *);
 extern void pfkey_sadump_withports (struct sadb_msg *);
 extern void pfkey_spdump (struct sadb_msg *);
 extern void pfkey_spdump_withports (struct sadb_msg *);
+extern void pfkey_sadump_json (struct sadb_msg *);
+extern void pfkey_spdump_json (struct sadb_msg *);
 
 struct sockaddr_storage;
 struct sadb_alg;
@@ -78,6 +80,7 @@ void ipsec_hexdump (const void *, int);
 const char *ipsec_strerror (void);
 void kdebug_sadb (struct sadb_msg *);
 ipsec_policy_t ipsec_set_policy (__ipsec_const char *, int);
+int ipsec_set_policy_cache (int);
 int  ipsec_get_policylen (ipsec_policy_t);
 char *ipsec_dump_policy (ipsec_policy_t, __ipsec_const char *);
 
@@ -133,6 +136,8 @@ int pfkey_send_spdsetidx (int, struct sockaddr_storage *, u_int,
 int pfkey_send_spdflush (int);
 int pfkey_send_spddump (int);
 
+int pfkey_set_emulator (const char *);
+void pfkey_set_send_hook (void (*)(struct sadb_msg *));
 int pfkey_open (void);
 void pfkey_close (void);
 void pfkey_close_sock(int);
@@ -140,6 +145,9 @@ struct sadb_msg *pfkey_recv (int);
 int pfkey_send (int, struct sadb_msg *, int);
 int pfkey_align (struct sadb_msg *, caddr_t *);
 int pfkey_check (caddr_t *);
+int pfkey_parse (struct sadb_msg *, size_t, caddr_t *);
+void pfkey_sadump_parsed (caddr_t *, int);
+void pfkey_sadump_json_parsed (caddr_t *);
 int pfkey_send_getsastats (int, u_int32_t, u_int64_t [], u_int32_t, u_int8_t, struct sastat [], u_int32_t);
 
 #ifndef __SYSDEP_SA_LEN__
@@ -36,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <net/pfkeyv2.h>
 #include <sys/sysctl.h>
 #include <netinet/in.h>
@@ -94,6 +95,9 @@ static caddr_t pfkey_set_natt_port (caddr_t, caddr_t, u_int, u_int16_t);
 #ifdef SADB_X_EXT_NAT_T_FRAG
 static caddr_t pfkey_set_natt_frag (caddr_t, caddr_t, u_int, u_int16_t);
 #endif
+static int pfkey_check_msg (struct sadb_msg *);
+static int pfkey_check_addrs (caddr_t *);
+static size_t pfkey_ext_minlen (u_int);
 
 /*
  * make and search supported algorithm structure.
@@ -1634,6 +1638,95 @@ pfkey_send_x5(int so, u_int type, u_int32_t spid)
 	return len;
 }
 
+/*
+ * path of a userspace PF_KEY stand-in, used instead of the kernel when set.
+ */
+static char *pfkey_emulator = NULL;
+static u_int pfkey_emulator_socks = 0;
+
+/*
+ * make pfkey_open() talk to a PF_KEY stand-in listening on a UNIX datagram
+ * socket at path instead of the kernel.  NULL selects the kernel again.
+ * OUT:
+ *	-1: fail.
+ *	 0: success.
+ */
+int
+pfkey_set_emulator(const char *path)
+{
+	char *p = NULL;
+
+	if (path != NULL) {
+		if (strlen(path) + sizeof(".4294967295.4294967295") >
+		    sizeof(((struct sockaddr_un *)0)->sun_path)) {
+			__ipsec_set_strerror(strerror(ENAMETOOLONG));
+			return -1;
+		}
+		if ((p = strdup(path)) == NULL) {
+			__ipsec_set_strerror(strerror(errno));
+			return -1;
+		}
+	}
+	free(pfkey_emulator);
+	pfkey_emulator = p;
+
+	__ipsec_errcode = EIPSEC_NO_ERROR;
+	return 0;
+}
+
+/*
+ * function called with every message pfkey_send() has sent, e.g. to
+ * time requests until their reply comes back.  NULL removes it.
+ */
+static void (*pfkey_send_hook)(struct sadb_msg *) = NULL;
+
+void
+pfkey_set_send_hook(void (*hook)(struct sadb_msg *))
+{
+	pfkey_send_hook = hook;
+}
+
+/*
+ * open a datagram socket to the PF_KEY stand-in.  each socket is bound to
+ * its own path next to the stand-in's, so that replies and broadcasts can
+ * be addressed to it.
+ */
+static int
+pfkey_open_emulator(void)
+{
+	struct sockaddr_un local, remote;
+	int so;
+	int bufsiz = 233016;
+
+	memset(&remote, 0, sizeof(remote));
+	remote.sun_family = AF_UNIX;
+	snprintf(remote.sun_path, sizeof(remote.sun_path), "%s", pfkey_emulator);
+	memset(&local, 0, sizeof(local));
+	local.sun_family = AF_UNIX;
+	snprintf(local.sun_path, sizeof(local.sun_path), "%s.%d.%u",
+		pfkey_emulator, (int)getpid(), pfkey_emulator_socks++);
+
+	if ((so = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+		__ipsec_set_strerror(strerror(errno));
+		return -1;
+	}
+	(void)unlink(local.sun_path);
+	if (bind(so, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+	    connect(so, (struct sockaddr *)&remote, sizeof(remote)) < 0) {
+		__ipsec_set_strerror(strerror(errno));
+		(void)unlink(local.sun_path);
+		(void)close(so);
+		return -1;
+	}
+
+	/* on a UNIX datagram socket this also bounds the message size */
+	setsockopt(so, SOL_SOCKET, SO_SNDBUF, &bufsiz, sizeof(bufsiz));
+	setsockopt(so, SOL_SOCKET, SO_RCVBUF, &bufsiz, sizeof(bufsiz));
+
+	__ipsec_errcode = EIPSEC_NO_ERROR;
+	return so;
+}
+
 /*
  * open a socket.
  * OUT:
@@ -1650,6 +1743,9 @@ pfkey_open()
 	size_t	oldmaxsize = sizeof(oldmax);
 	unsigned long newmax = newbufk * (1024 + 128);
 
+	if (pfkey_emulator != NULL)
+		return pfkey_open_emulator();
+
 	if ((so = socket(PF_KEY, SOCK_RAW, PF_KEY_V2)) < 0) {
 		__ipsec_set_strerror(strerror(errno));
 		return -1;
@@ -1683,6 +1779,14 @@ pfkey_open()
 void
 pfkey_close_sock(int so)
 {
+	struct sockaddr_un local;
+	socklen_t len = sizeof(local);
+
+	/* remove the path a PF_KEY stand-in socket is bound to */
+	if (pfkey_emulator != NULL &&
+	    getsockname(so, (struct sockaddr *)&local, &len) == 0 &&
+	    local.sun_family == AF_UNIX && local.sun_path[0] != '\0')
+		(void)unlink(local.sun_path);
 	(void)close(so);
 
 	__ipsec_errcode = EIPSEC_NO_ERROR;
@@ -1763,6 +1867,8 @@ pfkey_send(int so, struct sadb_msg *msg, int len)
 		__ipsec_set_strerror(strerror(errno));
 		return -1;
 	}
+	if (pfkey_send_hook != NULL)
+		(*pfkey_send_hook)(msg);
 
 	__ipsec_errcode = EIPSEC_NO_ERROR;
 	return len;
@@ -1898,16 +2004,25 @@ pfkey_align(struct sadb_msg *msg, caddr_t *mhp)
 int
 pfkey_check(caddr_t * mhp)
 {
-	struct sadb_msg *msg;
-
 	/* validity check */
 	if (mhp == NULL || mhp[0] == NULL) {
 		__ipsec_errcode = EIPSEC_INVAL_ARGUMENT;
 		return -1;
 	}
 
-	msg = (void *)mhp[0];
+	if (pfkey_check_msg((void *)mhp[0]) || pfkey_check_addrs(mhp))
+		return -1;
 
+	__ipsec_errcode = EIPSEC_NO_ERROR;
+	return 0;
+}
+
+/*
+ * the checks of pfkey_check() on the base header.
+ */
+static int
+pfkey_check_msg(struct sadb_msg *msg)
+{
 	/* check version */
 	if (msg->sadb_msg_version != PF_KEY_V2) {
 		__ipsec_errcode = EIPSEC_INVAL_VERSION;
@@ -1976,6 +2091,15 @@ pfkey_check(caddr_t * mhp)
 		return -1;
 	}
 
+	return 0;
+}
+
+/*
+ * the checks of pfkey_check() on the source and destination addresses.
+ */
+static int
+pfkey_check_addrs(caddr_t *mhp)
+{
 	/* check field of upper layer protocol and address family */
 	if (mhp[SADB_EXT_ADDRESS_SRC] != NULL
 	 && mhp[SADB_EXT_ADDRESS_DST] != NULL) {
@@ -2010,6 +2134,240 @@ pfkey_check(caddr_t * mhp)
 		 */
 	}
 
+	return 0;
+}
+
+/*
+ * the smallest valid length of an extension, or 0 if the type is unknown.
+ */
+static size_t
+pfkey_ext_minlen(u_int type)
+{
+	switch (type) {
+	case SADB_EXT_SA:
+		return sizeof(struct sadb_sa);
+	case SADB_EXT_LIFETIME_CURRENT:
+	case SADB_EXT_LIFETIME_HARD:
+	case SADB_EXT_LIFETIME_SOFT:
+		return sizeof(struct sadb_lifetime);
+	case SADB_EXT_ADDRESS_SRC:
+	case SADB_EXT_ADDRESS_DST:
+	case SADB_EXT_ADDRESS_PROXY:
+#ifdef SADB_X_EXT_NAT_T_TYPE
+	case SADB_X_EXT_NAT_T_OA:
+#endif
+	case SADB_X_EXT_ADDR_RANGE_SRC_START:
+	case SADB_X_EXT_ADDR_RANGE_SRC_END:
+	case SADB_X_EXT_ADDR_RANGE_DST_START:
+	case SADB_X_EXT_ADDR_RANGE_DST_END:
+		return sizeof(struct sadb_address) + sizeof(struct sockaddr_in);
+	case SADB_EXT_KEY_AUTH:
+	case SADB_EXT_KEY_ENCRYPT:
+		return sizeof(struct sadb_key);
+	case SADB_EXT_IDENTITY_SRC:
+	case SADB_EXT_IDENTITY_DST:
+		return sizeof(struct sadb_ident);
+	case SADB_EXT_SENSITIVITY:
+		return sizeof(struct sadb_sens);
+	case SADB_EXT_PROPOSAL:
+		return sizeof(struct sadb_prop);
+	case SADB_EXT_SUPPORTED_AUTH:
+	case SADB_EXT_SUPPORTED_ENCRYPT:
+		return sizeof(struct sadb_supported);
+	case SADB_EXT_SPIRANGE:
+		return sizeof(struct sadb_spirange);
+	case SADB_X_EXT_POLICY:
+		return sizeof(struct sadb_x_policy);
+	case SADB_X_EXT_SA2:
+		return sizeof(struct sadb_x_sa2);
+	case SADB_EXT_SESSION_ID:
+		return sizeof(struct sadb_session_id);
+	case SADB_EXT_SASTAT:
+		return sizeof(struct sadb_sastat);
+#ifdef SADB_X_EXT_NAT_T_TYPE
+	case SADB_X_EXT_NAT_T_TYPE:
+		return sizeof(struct sadb_x_nat_t_type);
+	case SADB_X_EXT_NAT_T_SPORT:
+	case SADB_X_EXT_NAT_T_DPORT:
+		return sizeof(struct sadb_x_nat_t_port);
+#endif
+#ifdef SADB_X_EXT_TAG
+	case SADB_X_EXT_TAG:
+		return sizeof(struct sadb_x_tag);
+#endif
+#ifdef SADB_X_EXT_PACKET
+	case SADB_X_EXT_PACKET:
+		return sizeof(struct sadb_ext);
+#endif
+	case SADB_X_EXT_IPSECIF:
+		return sizeof(struct sadb_x_ipsecif);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * pfkey_align() and pfkey_check() in a single walk of the extensions:
+ * every check is made on an extension as it is reached, and nothing is
+ * looked at again afterwards.  Each extension is also checked against
+ * the size of its type, address extensions must hold a whole IPv4 or
+ * IPv6 address and keys must fit in theirs.  A successful reply must
+ * carry the extensions its type needs.
+ * mhp points into the message, which is not copied.
+ * IN:	msg: pointer to message buffer.
+ *	len: bytes available at msg; the message may be shorter.
+ *	mhp: pointer to the buffer initialized like below:
+ *		caddr_t mhp[SADB_EXT_MAX + 1];
+ * OUT:	-1: invalid.
+ *	 0: valid.
+ */
+int
+pfkey_parse(struct sadb_msg *msg, size_t len, caddr_t *mhp)
+{
+	struct sadb_ext *ext;
+	struct sadb_address *addr, *other;
+	struct sockaddr *sa;
+	caddr_t p, ep;
+	size_t extlen, minlen;
+
+	if (msg == NULL || mhp == NULL) {
+		__ipsec_errcode = EIPSEC_INVAL_ARGUMENT;
+		return -1;
+	}
+
+	memset(mhp, 0, sizeof(caddr_t) * (SADB_EXT_MAX + 1));
+	mhp[0] = (void *)msg;
+
+	if (len < sizeof(*msg) ||
+	    PFKEY_UNUNIT64(msg->sadb_msg_len) < sizeof(*msg) ||
+	    PFKEY_UNUNIT64(msg->sadb_msg_len) > len) {
+		__ipsec_errcode = EIPSEC_INVAL_SADBMSG;
+		return -1;
+	}
+	if (pfkey_check_msg(msg))
+		return -1;
+
+	p = (void *)msg;
+	ep = p + PFKEY_UNUNIT64(msg->sadb_msg_len);
+	for (p += sizeof(*msg); p < ep; p += extlen) {
+		ext = (void *)p;
+		if (ep - p < sizeof(*ext)) {
+			__ipsec_errcode = EIPSEC_INVAL_SADBMSG;
+			return -1;
+		}
+		extlen = PFKEY_EXTLEN(ext);
+		if (extlen < sizeof(*ext) || ep - p < extlen) {
+			__ipsec_errcode = EIPSEC_INVAL_SADBMSG;
+			return -1;
+		}
+		if (ext->sadb_ext_type > SADB_EXT_MAX ||
+		    (minlen = pfkey_ext_minlen(ext->sadb_ext_type)) == 0 ||
+		    mhp[ext->sadb_ext_type] != NULL) {
+			__ipsec_errcode = EIPSEC_INVAL_EXTTYPE;
+			return -1;
+		}
+		if (extlen < minlen) {
+			__ipsec_errcode = EIPSEC_INVAL_EXTLEN;
+			return -1;
+		}
+
+		switch (ext->sadb_ext_type) {
+		case SADB_EXT_ADDRESS_SRC:
+		case SADB_EXT_ADDRESS_DST:
+		case SADB_EXT_ADDRESS_PROXY:
+#ifdef SADB_X_EXT_NAT_T_TYPE
+		case SADB_X_EXT_NAT_T_OA:
+#endif
+		case SADB_X_EXT_ADDR_RANGE_SRC_START:
+		case SADB_X_EXT_ADDR_RANGE_SRC_END:
+		case SADB_X_EXT_ADDR_RANGE_DST_START:
+		case SADB_X_EXT_ADDR_RANGE_DST_END:
+			addr = (void *)ext;
+			sa = PFKEY_ADDR_SADDR(addr);
+			switch (sa->sa_family) {
+			case AF_INET:
+				minlen = sizeof(struct sockaddr_in);
+				break;
+			case AF_INET6:
+				minlen = sizeof(struct sockaddr_in6);
+				break;
+			default:
+				__ipsec_errcode = EIPSEC_INVAL_FAMILY;
+				return -1;
+			}
+			if (sysdep_sa_len(sa) < minlen ||
+			    extlen - sizeof(*addr) < sysdep_sa_len(sa)) {
+				__ipsec_errcode = EIPSEC_INVAL_EXTLEN;
+				return -1;
+			}
+
+			/* pfkey_check_addrs(), once both ends are in */
+			other = NULL;
+			if (ext->sadb_ext_type == SADB_EXT_ADDRESS_SRC)
+				other = (void *)mhp[SADB_EXT_ADDRESS_DST];
+			else if (ext->sadb_ext_type == SADB_EXT_ADDRESS_DST)
+				other = (void *)mhp[SADB_EXT_ADDRESS_SRC];
+			if (other == NULL)
+				break;
+			if (addr->sadb_address_proto !=
+			    other->sadb_address_proto) {
+				__ipsec_errcode = EIPSEC_PROTO_MISMATCH;
+				return -1;
+			}
+			if (sa->sa_family != PFKEY_ADDR_SADDR(other)->sa_family) {
+				__ipsec_errcode = EIPSEC_FAMILY_MISMATCH;
+				return -1;
+			}
+			break;
+		case SADB_EXT_KEY_AUTH:
+		case SADB_EXT_KEY_ENCRYPT:
+			if (extlen - sizeof(struct sadb_key) <
+			    (((struct sadb_key *)(void *)ext)->sadb_key_bits + 7) / 8) {
+				__ipsec_errcode = EIPSEC_INVAL_KEYLEN;
+				return -1;
+			}
+			break;
+		}
+
+		mhp[ext->sadb_ext_type] = (void *)ext;
+	}
+
+	/* what each successful message carries */
+	if (msg->sadb_msg_errno == 0) {
+		switch (msg->sadb_msg_type) {
+		case SADB_GETSPI:
+		case SADB_UPDATE:
+		case SADB_ADD:
+		case SADB_GET:
+		case SADB_EXPIRE:
+		case SADB_DUMP:
+			if (mhp[SADB_EXT_SA] == NULL) {
+				__ipsec_errcode = EIPSEC_NO_EXTENSION;
+				return -1;
+			}
+			/*FALLTHROUGH*/
+		case SADB_DELETE:
+		case SADB_ACQUIRE:
+			if (mhp[SADB_EXT_ADDRESS_SRC] == NULL ||
+			    mhp[SADB_EXT_ADDRESS_DST] == NULL) {
+				__ipsec_errcode = EIPSEC_NO_EXTENSION;
+				return -1;
+			}
+			break;
+		case SADB_X_SPDADD:
+		case SADB_X_SPDUPDATE:
+		case SADB_X_SPDDELETE:
+		case SADB_X_SPDGET:
+		case SADB_X_SPDDUMP:
+		case SADB_X_SPDEXPIRE:
+			if (mhp[SADB_X_EXT_POLICY] == NULL) {
+				__ipsec_errcode = EIPSEC_NO_EXTENSION;
+				return -1;
+			}
+			break;
+		}
+	}
+
 	__ipsec_errcode = EIPSEC_NO_ERROR;
 	return 0;
 }
@@ -105,20 +105,30 @@ do { \
 		printf("%u ", (num)); \
 } while (/*CONSTCOND*/0)
 
+/* length of a fixed-size name field, NUL-terminated or not */
+#define FIELDLEN(f)	((int)strnlen((f), sizeof(f)))
+
 static char *str_ipaddr (struct sockaddr *);
 static char *str_ipport (struct sockaddr *);
 static char *str_prefport (u_int, u_int, u_int, u_int);
 static void str_upperspec (u_int, u_int, u_int);
 static char *str_time (time_t);
 static void str_lifetime_byte (struct sadb_lifetime *, char *);
-static void pfkey_sadump1 (struct sadb_msg *, int);
+static void pfkey_sadump1 (caddr_t *, int);
 static void pfkey_spdump1 (struct sadb_msg *, int);
+static void json_str (const char *, const char *);
+static void json_strn (const char *, const char *, size_t);
+static void json_addr (const char *, struct sadb_address *);
+static void json_lifetime (const char *, struct sadb_lifetime *);
+static void json_ipsecif (struct sadb_x_ipsecif *);
 
 struct val2str {
 	int val;
 	const char *str;
 };
 
+static const char *str_v2s (struct val2str *, u_int);
+
 /*
  * Must to be re-written about following strings.
  */
@@ -216,22 +226,47 @@ void
 pfkey_sadump(m)
 	struct sadb_msg *m;
 {
-	pfkey_sadump1(m, 0);
+	caddr_t mhp[SADB_EXT_MAX + 1];
+
+	pfkey_sadump_parsed(pfkey_parse(m, PFKEY_UNUNIT64(m->sadb_msg_len),
+	    mhp) == 0 ? mhp : NULL, 0);
 }
 
 void
 pfkey_sadump_withports(m)
 	struct sadb_msg *m;
 {
-	pfkey_sadump1(m, 1);
+	caddr_t mhp[SADB_EXT_MAX + 1];
+
+	pfkey_sadump_parsed(pfkey_parse(m, PFKEY_UNUNIT64(m->sadb_msg_len),
+	    mhp) == 0 ? mhp : NULL, 1);
 }
 
+/*
+ * pfkey_sadump() of a message the caller has already run through
+ * pfkey_parse(), so that it isn't walked again.  mhp is NULL if that
+ * failed: the error is printed instead.
+ */
 void
-pfkey_sadump1(m, withports)
-	struct sadb_msg *m;
+pfkey_sadump_parsed(mhp, withports)
+	caddr_t *mhp;
 	int withports;
 {
-	caddr_t mhp[SADB_EXT_MAX + 1];
+	/* check pfkey message. */
+	if (mhp == NULL) {
+		printf("%s\n", ipsec_strerror());
+		return;
+	}
+
+	pfkey_sadump1(mhp, withports);
+}
+
+static void
+pfkey_sadump1(mhp, withports)
+	caddr_t *mhp;
+	int withports;
+{
+	struct sadb_msg *m;
 	struct sadb_sa *m_sa;
 	struct sadb_x_sa2 *m_sa2;
 	struct sadb_lifetime *m_lftc, *m_lfth, *m_lfts;
@@ -254,16 +289,7 @@ pfkey_sadump1(m, withports)
 	struct sadb_x_ipsecif *m_ipif = NULL;
 	struct sockaddr *sa;
 
-	/* check pfkey message. */
-	if (pfkey_align(m, mhp)) {
-		printf("%s\n", ipsec_strerror());
-		return;
-	}
-	if (pfkey_check(mhp)) {
-		printf("%s\n", ipsec_strerror());
-		return;
-	}
-
+	m = (void *)mhp[0];
 	m_sa = (void *)mhp[SADB_EXT_SA];
 	m_sa2 = (void *)mhp[SADB_X_EXT_SA2];
 	m_lftc = (void *)mhp[SADB_EXT_LIFETIME_CURRENT];
@@ -402,11 +428,17 @@ pfkey_sadump1(m, withports)
 	if (m_ipif) {
 		printf("\t");
 		if (m_ipif->sadb_x_ipsecif_internal_if[0])
-			printf("internal_if: %s  ", m_ipif->sadb_x_ipsecif_internal_if);
+			printf("internal_if: %.*s  ",
+			    FIELDLEN(m_ipif->sadb_x_ipsecif_internal_if),
+			    m_ipif->sadb_x_ipsecif_internal_if);
 		if (m_ipif->sadb_x_ipsecif_outgoing_if[0])
-			printf("outgoing_if: %s  ", m_ipif->sadb_x_ipsecif_outgoing_if);
+			printf("outgoing_if: %.*s  ",
+			    FIELDLEN(m_ipif->sadb_x_ipsecif_outgoing_if),
+			    m_ipif->sadb_x_ipsecif_outgoing_if);
 		if (m_ipif->sadb_x_ipsecif_ipsec_if[0])
-			printf("ipsec_if: %s  ", m_ipif->sadb_x_ipsecif_ipsec_if);
+			printf("ipsec_if: %.*s  ",
+			    FIELDLEN(m_ipif->sadb_x_ipsecif_ipsec_if),
+			    m_ipif->sadb_x_ipsecif_ipsec_if);
 		printf("disabled: %d\n", m_ipif->sadb_x_ipsecif_init_disabled);
 	}
 
@@ -523,11 +555,7 @@ int withports;
 	u_int16_t sport = 0, dport = 0;
     
 	/* check pfkey message. */
-	if (pfkey_align(m, mhp)) {
-		printf("%s\n", ipsec_strerror());
-		return;
-	}
-	if (pfkey_check(mhp)) {
+	if (pfkey_parse(m, PFKEY_UNUNIT64(m->sadb_msg_len), mhp)) {
 		printf("%s\n", ipsec_strerror());
 		return;
 	}
@@ -616,7 +644,8 @@ int withports;
 	}
 #ifdef SADB_X_EXT_TAG
 	else if (m_tag)
-		printf("tagged \"%s\" ", m_tag->sadb_x_tag_name);
+		printf("tagged \"%.*s\" ", FIELDLEN(m_tag->sadb_x_tag_name),
+		    m_tag->sadb_x_tag_name);
 #endif
 	else
 		printf("(no selector, probably per-socket policy) ");
@@ -660,11 +689,17 @@ int withports;
 	if (m_ipif) {
 		printf("\t");
 		if (m_ipif->sadb_x_ipsecif_internal_if[0])
-			printf("internal_if: %s  ", m_ipif->sadb_x_ipsecif_internal_if);
+			printf("internal_if: %.*s  ",
+			    FIELDLEN(m_ipif->sadb_x_ipsecif_internal_if),
+			    m_ipif->sadb_x_ipsecif_internal_if);
 		if (m_ipif->sadb_x_ipsecif_outgoing_if[0])
-			printf("outgoing_if: %s  ", m_ipif->sadb_x_ipsecif_outgoing_if);
+			printf("outgoing_if: %.*s  ",
+			    FIELDLEN(m_ipif->sadb_x_ipsecif_outgoing_if),
+			    m_ipif->sadb_x_ipsecif_outgoing_if);
 		if (m_ipif->sadb_x_ipsecif_ipsec_if[0])
-			printf("ipsec_if: %s  ", m_ipif->sadb_x_ipsecif_ipsec_if);
+			printf("ipsec_if: %.*s  ",
+			    FIELDLEN(m_ipif->sadb_x_ipsecif_ipsec_if),
+			    m_ipif->sadb_x_ipsecif_ipsec_if);
 		printf("disabled: %d\n", m_ipif->sadb_x_ipsecif_init_disabled);
 	}
 
@@ -679,6 +714,277 @@ int withports;
 	return;
 }
 
+/*
+ * dump SADB_MSG as a single line of JSON, for scripts.
+ * Keys are left out.  Records that fail to parse come out as
+ * {"error": ...} so that every input message still has its line.
+ */
+void
+pfkey_sadump_json(m)
+	struct sadb_msg *m;
+{
+	caddr_t mhp[SADB_EXT_MAX + 1];
+
+	pfkey_sadump_json_parsed(pfkey_parse(m,
+	    PFKEY_UNUNIT64(m->sadb_msg_len), mhp) == 0 ? mhp : NULL);
+}
+
+/*
+ * pfkey_sadump_json() of a message already run through pfkey_parse();
+ * mhp is NULL if that failed.
+ */
+void
+pfkey_sadump_json_parsed(mhp)
+	caddr_t *mhp;
+{
+	struct sadb_msg *m;
+	struct sadb_sa *m_sa;
+	struct sadb_x_sa2 *m_sa2;
+	struct sadb_lifetime *m_lftc, *m_lfth, *m_lfts;
+	struct sadb_address *m_saddr, *m_daddr;
+#ifdef SADB_X_EXT_NAT_T_TYPE
+	struct sadb_x_nat_t_type *natt_type;
+	struct sadb_x_nat_t_port *natt_sport, *natt_dport;
+#endif
+	const char *satype;
+
+	if (mhp == NULL) {
+		printf("{\"type\":\"sa\"");
+		json_str("error", ipsec_strerror());
+		printf("}\n");
+		return;
+	}
+
+	m = (void *)mhp[0];
+	m_sa = (void *)mhp[SADB_EXT_SA];
+	m_sa2 = (void *)mhp[SADB_X_EXT_SA2];
+	m_lftc = (void *)mhp[SADB_EXT_LIFETIME_CURRENT];
+	m_lfth = (void *)mhp[SADB_EXT_LIFETIME_HARD];
+	m_lfts = (void *)mhp[SADB_EXT_LIFETIME_SOFT];
+	m_saddr = (void *)mhp[SADB_EXT_ADDRESS_SRC];
+	m_daddr = (void *)mhp[SADB_EXT_ADDRESS_DST];
+
+	printf("{\"type\":\"sa\"");
+	if (m_saddr == NULL || m_daddr == NULL || m_sa == NULL || m_sa2 == NULL) {
+		json_str("error", "incomplete SA message");
+		printf("}\n");
+		return;
+	}
+	json_addr("src", m_saddr);
+	json_addr("dst", m_daddr);
+
+	if (m->sadb_msg_satype < sizeof(str_satype) / sizeof(str_satype[0]))
+		satype = str_satype[m->sadb_msg_satype];
+	else
+		satype = "unknown";
+	json_str("satype", satype);
+	if (m_sa2->sadb_x_sa2_mode < sizeof(str_mode) / sizeof(str_mode[0]))
+		json_str("mode", str_mode[m_sa2->sadb_x_sa2_mode]);
+	else
+		printf(",\"mode\":%u", m_sa2->sadb_x_sa2_mode);
+	printf(",\"spi\":%u,\"reqid\":%u",
+		(u_int32_t)ntohl(m_sa->sadb_sa_spi),
+		(u_int32_t)m_sa2->sadb_x_sa2_reqid);
+
+#ifdef SADB_X_EXT_NAT_T_TYPE
+	natt_type = (void *)mhp[SADB_X_EXT_NAT_T_TYPE];
+	natt_sport = (void *)mhp[SADB_X_EXT_NAT_T_SPORT];
+	natt_dport = (void *)mhp[SADB_X_EXT_NAT_T_DPORT];
+	if (natt_type && natt_type->sadb_x_nat_t_type_type) {
+		printf(",\"natt_sport\":%u,\"natt_dport\":%u",
+			natt_sport ? ntohs(natt_sport->sadb_x_nat_t_port_port) : 0,
+			natt_dport ? ntohs(natt_dport->sadb_x_nat_t_port_port) : 0);
+	}
+#endif
+
+	if (m->sadb_msg_satype == SADB_X_SATYPE_IPCOMP)
+		json_str("comp", str_v2s(str_alg_comp, m_sa->sadb_sa_encrypt));
+	else if (m->sadb_msg_satype == SADB_SATYPE_ESP)
+		json_str("enc", str_v2s(str_alg_enc, m_sa->sadb_sa_encrypt));
+	if (mhp[SADB_EXT_KEY_AUTH] != NULL)
+		json_str("auth", str_v2s(str_alg_auth, m_sa->sadb_sa_auth));
+
+	if (m_sa->sadb_sa_state < sizeof(str_state) / sizeof(str_state[0]))
+		json_str("state", str_state[m_sa->sadb_sa_state]);
+	else
+		printf(",\"state\":%u", m_sa->sadb_sa_state);
+	printf(",\"seq\":%u,\"replay\":%u,\"flags\":%u",
+		m_sa2->sadb_x_sa2_sequence,
+		m_sa->sadb_sa_replay,
+		m_sa->sadb_sa_flags);
+
+	json_lifetime("current", m_lftc);
+	json_lifetime("hard", m_lfth);
+	json_lifetime("soft", m_lfts);
+	json_ipsecif((void *)mhp[SADB_X_EXT_IPSECIF]);
+
+	printf(",\"pid\":%lu,\"refcnt\":%u}\n",
+		(u_long)m->sadb_msg_pid, m->sadb_msg_reserved);
+}
+
+void
+pfkey_spdump_json(m)
+	struct sadb_msg *m;
+{
+	caddr_t mhp[SADB_EXT_MAX + 1];
+	struct sadb_address *m_saddr, *m_daddr;
+	struct sadb_x_policy *m_xpl;
+#ifdef SADB_X_EXT_TAG
+	struct sadb_x_tag *m_tag;
+#endif
+	char *d_xpl;
+
+	if (pfkey_parse(m, PFKEY_UNUNIT64(m->sadb_msg_len), mhp)) {
+		printf("{\"type\":\"sp\"");
+		json_str("error", ipsec_strerror());
+		printf("}\n");
+		return;
+	}
+
+	m_saddr = (void *)mhp[SADB_EXT_ADDRESS_SRC];
+	m_daddr = (void *)mhp[SADB_EXT_ADDRESS_DST];
+	m_xpl = (void *)mhp[SADB_X_EXT_POLICY];
+
+	printf("{\"type\":\"sp\"");
+	if (m_xpl == NULL) {
+		json_str("error", "no X_POLICY extension");
+		printf("}\n");
+		return;
+	}
+	if (mhp[SADB_X_EXT_ADDR_RANGE_SRC_START] != NULL) {
+		json_addr("src_start", (void *)mhp[SADB_X_EXT_ADDR_RANGE_SRC_START]);
+		json_addr("src_end", (void *)mhp[SADB_X_EXT_ADDR_RANGE_SRC_END]);
+	} else if (m_saddr != NULL)
+		json_addr("src", m_saddr);
+	if (mhp[SADB_X_EXT_ADDR_RANGE_DST_START] != NULL) {
+		json_addr("dst_start", (void *)mhp[SADB_X_EXT_ADDR_RANGE_DST_START]);
+		json_addr("dst_end", (void *)mhp[SADB_X_EXT_ADDR_RANGE_DST_END]);
+	} else if (m_daddr != NULL)
+		json_addr("dst", m_daddr);
+	if (m_saddr != NULL)
+		printf(",\"proto\":%u", m_saddr->sadb_address_proto);
+#ifdef SADB_X_EXT_TAG
+	if ((m_tag = (void *)mhp[SADB_X_EXT_TAG]) != NULL)
+		json_strn("tag", m_tag->sadb_x_tag_name, sizeof(m_tag->sadb_x_tag_name));
+#endif
+
+	/* direction, action and requests, as setkey takes them */
+	d_xpl = ipsec_dump_policy((ipsec_policy_t)m_xpl, " ");
+	if (d_xpl != NULL) {
+		json_str("policy", d_xpl);
+		free(d_xpl);
+	} else
+		json_str("policy_error", ipsec_strerror());
+
+	json_lifetime("current", (void *)mhp[SADB_EXT_LIFETIME_CURRENT]);
+	json_lifetime("hard", (void *)mhp[SADB_EXT_LIFETIME_HARD]);
+	json_ipsecif((void *)mhp[SADB_X_EXT_IPSECIF]);
+
+	printf(",\"spid\":%lu,\"pid\":%lu,\"refcnt\":%u}\n",
+		(u_long)m_xpl->sadb_x_policy_id,
+		(u_long)m->sadb_msg_pid, m->sadb_msg_reserved);
+}
+
+/*
+ * print ,"name":"s" with s escaped.
+ */
+static void
+json_str(name, s)
+	const char *name, *s;
+{
+	json_strn(name, s, s ? strlen(s) : 0);
+}
+
+/*
+ * the same for a field of at most len bytes, which the kernel does not
+ * always NUL-terminate.  DEL and bytes from 0x80 up are escaped one by
+ * one as the code points of the same value: the names are not known to
+ * be UTF-8, and the line must stay valid JSON whatever they hold.
+ */
+static void
+json_strn(name, s, len)
+	const char *name, *s;
+	size_t len;
+{
+	const u_char *p, *end;
+
+	printf(",\"%s\":\"", name);
+	p = (const u_char *)(s ? s : "");
+	for (end = p + len; p < end && *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\')
+			printf("\\%c", *p);
+		else if (*p < 0x20 || *p >= 0x7f)
+			printf("\\u%04x", *p);
+		else
+			putchar(*p);
+	}
+	putchar('"');
+}
+
+/*
+ * print the address, prefix length and port of an address extension.
+ */
+static void
+json_addr(name, addr)
+	const char *name;
+	struct sadb_address *addr;
+{
+	struct sockaddr *sa;
+	u_int port;
+
+	if (addr == NULL)
+		return;
+	sa = (void *)(addr + 1);
+	switch (sa->sa_family) {
+	case AF_INET:
+		port = ntohs(((struct sockaddr_in *)(void *)sa)->sin_port);
+		break;
+	case AF_INET6:
+		port = ntohs(((struct sockaddr_in6 *)(void *)sa)->sin6_port);
+		break;
+	default:
+		printf(",\"%s\":null", name);
+		return;
+	}
+	json_str(name, str_ipaddr(sa));
+	printf(",\"%s_prefix\":%u,\"%s_port\":%u",
+		name, addr->sadb_address_prefixlen, name, port);
+}
+
+static void
+json_lifetime(name, lft)
+	const char *name;
+	struct sadb_lifetime *lft;
+{
+	if (lft == NULL)
+		return;
+	printf(",\"%s\":{\"allocations\":%lu,\"bytes\":%llu,"
+		"\"addtime\":%llu,\"usetime\":%llu}",
+		name,
+		(u_long)lft->sadb_lifetime_allocations,
+		(unsigned long long)lft->sadb_lifetime_bytes,
+		(unsigned long long)lft->sadb_lifetime_addtime,
+		(unsigned long long)lft->sadb_lifetime_usetime);
+}
+
+static void
+json_ipsecif(ipif)
+	struct sadb_x_ipsecif *ipif;
+{
+	if (ipif == NULL)
+		return;
+	if (ipif->sadb_x_ipsecif_internal_if[0])
+		json_strn("internal_if", ipif->sadb_x_ipsecif_internal_if,
+			sizeof(ipif->sadb_x_ipsecif_internal_if));
+	if (ipif->sadb_x_ipsecif_outgoing_if[0])
+		json_strn("outgoing_if", ipif->sadb_x_ipsecif_outgoing_if,
+			sizeof(ipif->sadb_x_ipsecif_outgoing_if));
+	if (ipif->sadb_x_ipsecif_ipsec_if[0])
+		json_strn("ipsec_if", ipif->sadb_x_ipsecif_ipsec_if,
+			sizeof(ipif->sadb_x_ipsecif_ipsec_if));
+	printf(",\"disabled\":%d", ipif->sadb_x_ipsecif_init_disabled);
+}
+
 /*
  * set "ipaddress" to buffer.
  */
@@ -790,6 +1096,25 @@ str_upperspec(ulp, p1, p2)
 	}
 }
 
+/*
+ * the name of an algorithm, or its number.
+ */
+static const char *
+str_v2s(v2s, num)
+	struct val2str *v2s;
+	u_int num;
+{
+	static char buf[16];
+	struct val2str *p;
+
+	for (p = v2s; p && p->str; p++) {
+		if (p->val == num)
+			return p->str;
+	}
+	snprintf(buf, sizeof(buf), "%u", num);
+	return buf;
+}
+
 /*
  * set "Mon Day Time Year" to buffer
  */
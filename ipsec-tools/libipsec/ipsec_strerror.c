@@ -78,6 +78,8 @@ NULL,						/*EIPSEC_SYSTEM_ERROR*/
 "Priority offset not in valid range [-2147483647, 2147483648]",	/*EIPSEC_INVAL_PRIORITY_OFFSET*/
 "Priority offset from base not in valid range [0, 1073741823] for negative offsets and [0, 1073741824] for positive offsets", /* EIPSEC_INVAL_PRIORITY_OFFSET */
 "Policy priority not compiled in",	/*EIPSEC_PRIORITY_NOT_COMPILED*/
+"Invalid extension length",			/*EIPSEC_INVAL_EXTLEN*/
+"Required extension missing",			/*EIPSEC_NO_EXTENSION*/
 "Unknown error",				/*EIPSEC_MAX*/
 };
 
@@ -66,6 +66,8 @@ extern void __ipsec_set_strerror (const char *);
 #define EIPSEC_INVAL_PRIORITY_BASE_OFFSET	28	/* priority base offset too
                                                    large */
 #define EIPSEC_PRIORITY_NOT_COMPILED	29	/*no priority support in libipsec*/
-#define EIPSEC_MAX		30	/*unknown error*/
+#define EIPSEC_INVAL_EXTLEN	30	/*invalid extension length*/
+#define EIPSEC_NO_EXTENSION	31	/*required extension missing*/
+#define EIPSEC_MAX		32	/*unknown error*/
 
 #endif /* _IPSEC_STRERROR_H */
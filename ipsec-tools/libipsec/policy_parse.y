@@ -68,6 +68,7 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/queue.h>
 
 #include <netinet/in.h>
 #ifdef HAVE_NETINET6_IPSEC
@@ -80,6 +81,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <netdb.h>
+#include <pthread.h>
 
 #include <errno.h>
 
@@ -99,35 +101,52 @@
 #define ATOX(c) \
   (isdigit(c) ? (c - '0') : (isupper(c) ? (c - 'A' + 10) : (c - 'a' + 10) ))
 
-static u_int8_t *pbuf = NULL;		/* sadb_x_policy buffer */
-static int tlen = 0;			/* total length of pbuf */
-static int offset = 0;			/* offset of pbuf */
-static int p_dir, p_type, p_protocol, p_mode, p_level, p_reqid;
-static u_int32_t p_priority = 0;
-static long p_priority_offset = 0;
-static struct sockaddr_storage *p_src = NULL;
-static struct sockaddr_storage *p_dst = NULL;
+/*
+ * everything one parse works on.  Each ipsec_set_policy() call has its
+ * own, and a scanner of its own, so that calls on several threads don't
+ * have to wait for each other.
+ */
+struct policy_parse_state {
+	u_int8_t *pbuf;			/* sadb_x_policy buffer */
+	int tlen;			/* total length of pbuf */
+	int offset;			/* offset of pbuf */
+	int p_dir, p_type, p_protocol, p_mode, p_level, p_reqid;
+	u_int32_t p_priority;
+	long p_priority_offset;
+	struct sockaddr_storage *p_src;
+	struct sockaddr_storage *p_dst;
+	int errcode;			/* __ipsec_errcode, once done */
+	const char *errstr;		/* text of EIPSEC_SYSTEM_ERROR */
+};
 
 struct _val;
-extern void yyerror (char *msg);
-static struct sockaddr_storage *parse_sockaddr (struct _val *addrbuf,
-    struct _val *portbuf);
-static int rule_check (void);
-static int init_x_policy(void);
-static int set_x_request (struct sockaddr_storage *, struct sockaddr_storage *);
-static int set_sockaddr (struct sockaddr_storage *);
-static void policy_parse_request_init (void);
+extern void yyerror (void *, struct policy_parse_state *, char *);
+static struct sockaddr_storage *parse_sockaddr (void *,
+    struct policy_parse_state *, struct _val *, struct _val *);
+static int rule_check (struct policy_parse_state *);
+static int init_x_policy (struct policy_parse_state *);
+static int set_x_request (struct policy_parse_state *,
+    struct sockaddr_storage *, struct sockaddr_storage *);
+static int set_sockaddr (struct policy_parse_state *,
+    struct sockaddr_storage *);
+static void policy_parse_request_init (struct policy_parse_state *);
 static void *policy_parse (const char *, int);
+struct policy_cache_entry;
+static void policy_cache_free (struct policy_cache_entry *);
+static caddr_t policy_cache_lookup (const char *, size_t, u_int32_t);
+static void policy_cache_enter (const char *, size_t, u_int32_t, caddr_t);
 
-extern void __policy__strbuffer__init__ (const char *);
-extern void __policy__strbuffer__free__ (void);
-extern int yyparse (void);
-extern int yylex (void);
-
-extern char *__libipsectext;	/*XXX*/
+extern int __policy__strbuffer__init__ (const char *, void **);
+extern void __policy__strbuffer__free__ (void *);
+extern const char *__policy__strbuffer__text__ (void *);
 
 %}
 
+%pure-parser
+%parse-param { void *scanner }
+%parse-param { struct policy_parse_state *st }
+%lex-param { void *scanner }
+
 %union {
 	u_int num;
 	u_int32_t num32;
@@ -137,6 +156,10 @@ extern char *__libipsectext;	/*XXX*/
 	} val;
 }
 
+%{
+extern int yylex (YYSTYPE *, void *);
+%}
+
 %token DIR 
 %token PRIORITY PLUS
 %token <num32> PRIO_BASE 
@@ -151,16 +174,16 @@ extern char *__libipsectext;	/*XXX*/
 policy_spec
 	:	DIR ACTION
 		{
-			p_dir = $1;
-			p_type = $2;
+			st->p_dir = $1;
+			st->p_type = $2;
 
 #ifdef HAVE_PFKEY_POLICY_PRIORITY
-			p_priority = PRIORITY_DEFAULT;
+			st->p_priority = PRIORITY_DEFAULT;
 #else
-			p_priority = 0;
+			st->p_priority = 0;
 #endif
 
-			if (init_x_policy())
+			if (init_x_policy(st))
 				return -1;
 		}
 		rules
@@ -168,14 +191,14 @@ policy_spec
 		{
 			char *offset_buf;
 
-			p_dir = $1;
-			p_type = $4;
+			st->p_dir = $1;
+			st->p_type = $4;
 
 			/* buffer big enough to hold a prepended negative sign */
 			offset_buf = malloc($3.len + 2);
 			if (offset_buf == NULL) 
 			{
-				__ipsec_errcode = EIPSEC_NO_BUFS;
+				st->errcode = EIPSEC_NO_BUFS;
 				return -1;
 			}
 
@@ -184,107 +207,107 @@ policy_spec
 			snprintf (offset_buf, $3.len + 2, "-%s", $3.buf);
 
 			errno = 0;
-			p_priority_offset = atol(offset_buf);
+			st->p_priority_offset = atol(offset_buf);
 
 			free(offset_buf);
 
-			if (errno != 0 || p_priority_offset < INT32_MIN)
+			if (errno != 0 || st->p_priority_offset < INT32_MIN)
 			{
-				__ipsec_errcode = EIPSEC_INVAL_PRIORITY_OFFSET;
+				st->errcode = EIPSEC_INVAL_PRIORITY_OFFSET;
 				return -1;
 			}
 
-			p_priority = PRIORITY_DEFAULT + (u_int32_t) p_priority_offset;
+			st->p_priority = PRIORITY_DEFAULT + (u_int32_t) st->p_priority_offset;
 
-			if (init_x_policy())
+			if (init_x_policy(st))
 				return -1;
 		}
 		rules
 	|	DIR PRIORITY HYPHEN PRIO_OFFSET ACTION
 		{
-			p_dir = $1;
-			p_type = $5;
+			st->p_dir = $1;
+			st->p_type = $5;
 
 			errno = 0;
-			p_priority_offset = atol($4.buf);
+			st->p_priority_offset = atol($4.buf);
 
-			if (errno != 0 || p_priority_offset > INT32_MAX)
+			if (errno != 0 || st->p_priority_offset > INT32_MAX)
 			{
-				__ipsec_errcode = EIPSEC_INVAL_PRIORITY_OFFSET;
+				st->errcode = EIPSEC_INVAL_PRIORITY_OFFSET;
 				return -1;
 			}
 
 			/* negative input value means lower priority, therefore higher
 			   actual value so that is closer to the end of the list */
-			p_priority = PRIORITY_DEFAULT + (u_int32_t) p_priority_offset;
+			st->p_priority = PRIORITY_DEFAULT + (u_int32_t) st->p_priority_offset;
 
-			if (init_x_policy())
+			if (init_x_policy(st))
 				return -1;
 		}
 		rules
 	|	DIR PRIORITY PRIO_BASE ACTION
 		{
-			p_dir = $1;
-			p_type = $4;
+			st->p_dir = $1;
+			st->p_type = $4;
 
-			p_priority = $3;
+			st->p_priority = $3;
 
-			if (init_x_policy())
+			if (init_x_policy(st))
 				return -1;
 		}
 		rules
 	|	DIR PRIORITY PRIO_BASE PLUS PRIO_OFFSET ACTION
 		{
-			p_dir = $1;
-			p_type = $6;
+			st->p_dir = $1;
+			st->p_type = $6;
 
 			errno = 0;
-			p_priority_offset = atol($5.buf);
+			st->p_priority_offset = atol($5.buf);
 
-			if (errno != 0 || p_priority_offset > PRIORITY_OFFSET_NEGATIVE_MAX)
+			if (errno != 0 || st->p_priority_offset > PRIORITY_OFFSET_NEGATIVE_MAX)
 			{
-				__ipsec_errcode = EIPSEC_INVAL_PRIORITY_BASE_OFFSET;
+				st->errcode = EIPSEC_INVAL_PRIORITY_BASE_OFFSET;
 				return -1;
 			}
 
 			/* adding value means higher priority, therefore lower
 			   actual value so that is closer to the beginning of the list */
-			p_priority = $3 - (u_int32_t) p_priority_offset;
+			st->p_priority = $3 - (u_int32_t) st->p_priority_offset;
 
-			if (init_x_policy())
+			if (init_x_policy(st))
 				return -1;
 		}
 		rules
 	|	DIR PRIORITY PRIO_BASE HYPHEN PRIO_OFFSET ACTION
 		{
-			p_dir = $1;
-			p_type = $6;
+			st->p_dir = $1;
+			st->p_type = $6;
 
 			errno = 0;
-			p_priority_offset = atol($5.buf);
+			st->p_priority_offset = atol($5.buf);
 
-			if (errno != 0 || p_priority_offset > PRIORITY_OFFSET_POSITIVE_MAX)
+			if (errno != 0 || st->p_priority_offset > PRIORITY_OFFSET_POSITIVE_MAX)
 			{
-				__ipsec_errcode = EIPSEC_INVAL_PRIORITY_BASE_OFFSET;
+				st->errcode = EIPSEC_INVAL_PRIORITY_BASE_OFFSET;
 				return -1;
 			}
 
 			/* subtracting value means lower priority, therefore higher
 			   actual value so that is closer to the end of the list */
-			p_priority = $3 + (u_int32_t) p_priority_offset;
+			st->p_priority = $3 + (u_int32_t) st->p_priority_offset;
 
-			if (init_x_policy())
+			if (init_x_policy(st))
 				return -1;
 		}
 		rules
 	|	DIR
 		{
-			p_dir = $1;
-			p_type = 0;	/* ignored it by kernel */
+			st->p_dir = $1;
+			st->p_type = 0;	/* ignored it by kernel */
 
-			p_priority = 0;
+			st->p_priority = 0;
 
-			if (init_x_policy())
+			if (init_x_policy(st))
 				return -1;
 		}
 	;
@@ -292,13 +315,13 @@ policy_spec
 rules
 	:	/*NOTHING*/
 	|	rules rule {
-			if (rule_check() < 0)
+			if (rule_check(st) < 0)
 				return -1;
 
-			if (set_x_request(p_src, p_dst) < 0)
+			if (set_x_request(st, st->p_src, st->p_dst) < 0)
 				return -1;
 
-			policy_parse_request_init();
+			policy_parse_request_init(st);
 		}
 	;
 
@@ -310,66 +333,66 @@ rule
 	|	protocol SLASH mode SLASH SLASH level
 	|	protocol SLASH mode
 	|	protocol SLASH {
-			__ipsec_errcode = EIPSEC_FEW_ARGUMENTS;
+			st->errcode = EIPSEC_FEW_ARGUMENTS;
 			return -1;
 		}
 	|	protocol {
-			__ipsec_errcode = EIPSEC_FEW_ARGUMENTS;
+			st->errcode = EIPSEC_FEW_ARGUMENTS;
 			return -1;
 		}
 	;
 
 protocol
-	:	PROTOCOL { p_protocol = $1; }
+	:	PROTOCOL { st->p_protocol = $1; }
 	;
 
 mode
-	:	MODE { p_mode = $1; }
+	:	MODE { st->p_mode = $1; }
 	;
 
 level
 	:	LEVEL {
-			p_level = $1;
-			p_reqid = 0;
+			st->p_level = $1;
+			st->p_reqid = 0;
 		}
 	|	LEVEL_SPECIFY {
-			p_level = IPSEC_LEVEL_UNIQUE;
-			p_reqid = atol($1.buf);	/* atol() is good. */
+			st->p_level = IPSEC_LEVEL_UNIQUE;
+			st->p_reqid = atol($1.buf);	/* atol() is good. */
 		}
 	;
 
 addresses
 	:	IPADDRESS {
-			p_src = parse_sockaddr(&$1, NULL);
-			if (p_src == NULL)
+			st->p_src = parse_sockaddr(scanner, st, &$1, NULL);
+			if (st->p_src == NULL)
 				return -1;
 		}
 		HYPHEN
 		IPADDRESS {
-			p_dst = parse_sockaddr(&$4, NULL);
-			if (p_dst == NULL)
+			st->p_dst = parse_sockaddr(scanner, st, &$4, NULL);
+			if (st->p_dst == NULL)
 				return -1;
 		}
 	|	IPADDRESS PORT {
-			p_src = parse_sockaddr(&$1, &$2);
-			if (p_src == NULL)
+			st->p_src = parse_sockaddr(scanner, st, &$1, &$2);
+			if (st->p_src == NULL)
 				return -1;
 		}
 		HYPHEN
 		IPADDRESS PORT {
-			p_dst = parse_sockaddr(&$5, &$6);
-			if (p_dst == NULL)
+			st->p_dst = parse_sockaddr(scanner, st, &$5, &$6);
+			if (st->p_dst == NULL)
 				return -1;
 		}
 	|	ME HYPHEN ANY {
-			if (p_dir != IPSEC_DIR_OUTBOUND) {
-				__ipsec_errcode = EIPSEC_INVAL_DIR;
+			if (st->p_dir != IPSEC_DIR_OUTBOUND) {
+				st->errcode = EIPSEC_INVAL_DIR;
 				return -1;
 			}
 		}
 	|	ANY HYPHEN ME {
-			if (p_dir != IPSEC_DIR_INBOUND) {
-				__ipsec_errcode = EIPSEC_INVAL_DIR;
+			if (st->p_dir != IPSEC_DIR_INBOUND) {
+				st->errcode = EIPSEC_INVAL_DIR;
 				return -1;
 			}
 		}
@@ -381,17 +404,21 @@ addresses
 %%
 
 void
-yyerror(msg)
+yyerror(scanner, st, msg)
+	void *scanner;
+	struct policy_parse_state *st;
 	char *msg;
 {
 	fprintf(stderr, "libipsec: %s while parsing \"%s\"\n",
-		msg, __libipsectext);
+		msg, __policy__strbuffer__text__(scanner));
 
 	return;
 }
 
 static struct sockaddr_storage *
-parse_sockaddr(addrbuf, portbuf)
+parse_sockaddr(scanner, st, addrbuf, portbuf)
+	void *scanner;
+	struct policy_parse_state *st;
 	struct _val *addrbuf;
 	struct _val *portbuf;
 {
@@ -405,8 +432,9 @@ parse_sockaddr(addrbuf, portbuf)
 
 	addr_len = addrbuf->len + 1;
 	if ((addr = malloc(addr_len)) == NULL) {
-		yyerror("malloc failed");
-		__ipsec_set_strerror(strerror(errno));
+		yyerror(scanner, st, "malloc failed");
+		st->errcode = EIPSEC_SYSTEM_ERROR;
+		st->errstr = strerror(errno);
 		return NULL;
 	}
 	
@@ -414,8 +442,9 @@ parse_sockaddr(addrbuf, portbuf)
 		serv_len = portbuf->len + 1;
 		if ((serv = malloc(serv_len)) == NULL) {
 			free(addr);
-			yyerror("malloc failed");
-			__ipsec_set_strerror(strerror(errno));
+			yyerror(scanner, st, "malloc failed");
+			st->errcode = EIPSEC_SYSTEM_ERROR;
+			st->errstr = strerror(errno);
 			return NULL;
 		}
 	}
@@ -435,20 +464,22 @@ parse_sockaddr(addrbuf, portbuf)
 	if (serv != NULL)
 		free(serv);
 	if (error != 0) {
-		yyerror("invalid IP address");
-		__ipsec_set_strerror(gai_strerror(error));
+		yyerror(scanner, st, "invalid IP address");
+		st->errcode = EIPSEC_SYSTEM_ERROR;
+		st->errstr = gai_strerror(error);
 		return NULL;
 	}
 
 	if (res->ai_addr == NULL) {
-		yyerror("invalid IP address");
-		__ipsec_set_strerror(gai_strerror(error));
+		yyerror(scanner, st, "invalid IP address");
+		st->errcode = EIPSEC_SYSTEM_ERROR;
+		st->errstr = gai_strerror(error);
 		return NULL;
 	}
 
 	newaddr = malloc(res->ai_addrlen);
 	if (newaddr == NULL) {
-		__ipsec_errcode = EIPSEC_NO_BUFS;
+		st->errcode = EIPSEC_NO_BUFS;
 		freeaddrinfo(res);
 		return NULL;
 	}
@@ -456,84 +487,87 @@ parse_sockaddr(addrbuf, portbuf)
 
 	freeaddrinfo(res);
 
-	__ipsec_errcode = EIPSEC_NO_ERROR;
+	st->errcode = EIPSEC_NO_ERROR;
 	return newaddr;
 }
 
 static int
-rule_check()
+rule_check(st)
+	struct policy_parse_state *st;
 {
-	if (p_type == IPSEC_POLICY_IPSEC) {
-		if (p_protocol == IPPROTO_IP) {
-			__ipsec_errcode = EIPSEC_NO_PROTO;
+	if (st->p_type == IPSEC_POLICY_IPSEC) {
+		if (st->p_protocol == IPPROTO_IP) {
+			st->errcode = EIPSEC_NO_PROTO;
 			return -1;
 		}
 
-		if (p_mode != IPSEC_MODE_TRANSPORT
-		 && p_mode != IPSEC_MODE_TUNNEL) {
-			__ipsec_errcode = EIPSEC_INVAL_MODE;
+		if (st->p_mode != IPSEC_MODE_TRANSPORT
+		 && st->p_mode != IPSEC_MODE_TUNNEL) {
+			st->errcode = EIPSEC_INVAL_MODE;
 			return -1;
 		}
 
-		if (p_src == NULL && p_dst == NULL) {
-			 if (p_mode != IPSEC_MODE_TRANSPORT) {
-				__ipsec_errcode = EIPSEC_INVAL_ADDRESS;
+		if (st->p_src == NULL && st->p_dst == NULL) {
+			 if (st->p_mode != IPSEC_MODE_TRANSPORT) {
+				st->errcode = EIPSEC_INVAL_ADDRESS;
 				return -1;
 			}
 		}
-		else if (p_src->ss_family != p_dst->ss_family) {
-			__ipsec_errcode = EIPSEC_FAMILY_MISMATCH;
+		else if (st->p_src->ss_family != st->p_dst->ss_family) {
+			st->errcode = EIPSEC_FAMILY_MISMATCH;
 			return -1;
 		}
 	}
 
-	__ipsec_errcode = EIPSEC_NO_ERROR;
+	st->errcode = EIPSEC_NO_ERROR;
 	return 0;
 }
 
 static int
-init_x_policy()
+init_x_policy(st)
+	struct policy_parse_state *st;
 {
 	struct sadb_x_policy *p;
 
-	if (pbuf) {
-		free(pbuf);
-		tlen = 0;
+	if (st->pbuf) {
+		free(st->pbuf);
+		st->tlen = 0;
 	}
-	pbuf = malloc(sizeof(struct sadb_x_policy));
-	if (pbuf == NULL) {
-		__ipsec_errcode = EIPSEC_NO_BUFS;
+	st->pbuf = malloc(sizeof(struct sadb_x_policy));
+	if (st->pbuf == NULL) {
+		st->errcode = EIPSEC_NO_BUFS;
 		return -1;
 	}
-	tlen = sizeof(struct sadb_x_policy);
+	st->tlen = sizeof(struct sadb_x_policy);
 
-	memset(pbuf, 0, tlen);
-	p = ALIGNED_CAST(struct sadb_x_policy *)pbuf;
+	memset(st->pbuf, 0, st->tlen);
+	p = ALIGNED_CAST(struct sadb_x_policy *)st->pbuf;
 	p->sadb_x_policy_len = 0;	/* must update later */
 	p->sadb_x_policy_exttype = SADB_X_EXT_POLICY;
-	p->sadb_x_policy_type = p_type;
-	p->sadb_x_policy_dir = p_dir;
+	p->sadb_x_policy_type = st->p_type;
+	p->sadb_x_policy_dir = st->p_dir;
 	p->sadb_x_policy_id = 0;
 #ifdef HAVE_PFKEY_POLICY_PRIORITY
-	p->sadb_x_policy_priority = p_priority;
+	p->sadb_x_policy_priority = st->p_priority;
 #else
     /* fail if given a priority and libipsec was not compiled with 
 	   priority support */
-	if (p_priority != 0)
+	if (st->p_priority != 0)
 	{
-		__ipsec_errcode = EIPSEC_PRIORITY_NOT_COMPILED;
+		st->errcode = EIPSEC_PRIORITY_NOT_COMPILED;
 		return -1;
 	}
 #endif
 
-	offset = tlen;
+	st->offset = st->tlen;
 
-	__ipsec_errcode = EIPSEC_NO_ERROR;
+	st->errcode = EIPSEC_NO_ERROR;
 	return 0;
 }
 
 static int
-set_x_request(src, dst)
+set_x_request(st, src, dst)
+	struct policy_parse_state *st;
 	struct sockaddr_storage *src, *dst;
 {
 	struct sadb_x_ipsecrequest *p;
@@ -543,63 +577,65 @@ set_x_request(src, dst)
 	reqlen = sizeof(*p)
 		+ (src ? sysdep_sa_len((struct sockaddr *)src) : 0)
 		+ (dst ? sysdep_sa_len((struct sockaddr *)dst) : 0);
-	tlen += reqlen;		/* increment to total length */
+	st->tlen += reqlen;		/* increment to total length */
 
-	n = realloc(pbuf, tlen);
+	n = realloc(st->pbuf, st->tlen);
 	if (n == NULL) {
-		__ipsec_errcode = EIPSEC_NO_BUFS;
+		st->errcode = EIPSEC_NO_BUFS;
 		return -1;
 	}
-	pbuf = n;
+	st->pbuf = n;
 
-	p = ALIGNED_CAST(struct sadb_x_ipsecrequest *)&pbuf[offset];    // Wcast-align fix - malloc'd buffer/offset 64 bit multiple
+	p = ALIGNED_CAST(struct sadb_x_ipsecrequest *)&st->pbuf[st->offset];    // Wcast-align fix - malloc'd buffer/offset 64 bit multiple
 	p->sadb_x_ipsecrequest_len = reqlen;
-	p->sadb_x_ipsecrequest_proto = p_protocol;
-	p->sadb_x_ipsecrequest_mode = p_mode;
-	p->sadb_x_ipsecrequest_level = p_level;
-	p->sadb_x_ipsecrequest_reqid = p_reqid;
-	offset += sizeof(*p);
+	p->sadb_x_ipsecrequest_proto = st->p_protocol;
+	p->sadb_x_ipsecrequest_mode = st->p_mode;
+	p->sadb_x_ipsecrequest_level = st->p_level;
+	p->sadb_x_ipsecrequest_reqid = st->p_reqid;
+	st->offset += sizeof(*p);
 
-	if (set_sockaddr(src) || set_sockaddr(dst))
+	if (set_sockaddr(st, src) || set_sockaddr(st, dst))
 		return -1;
 
-	__ipsec_errcode = EIPSEC_NO_ERROR;
+	st->errcode = EIPSEC_NO_ERROR;
 	return 0;
 }
 
 static int
-set_sockaddr(addr)
+set_sockaddr(st, addr)
+	struct policy_parse_state *st;
 	struct sockaddr_storage *addr;
 {
 	if (addr == NULL) {
-		__ipsec_errcode = EIPSEC_NO_ERROR;
+		st->errcode = EIPSEC_NO_ERROR;
 		return 0;
 	}
 
 	/* tlen has already incremented */
 
-	memcpy(&pbuf[offset], addr, sysdep_sa_len((struct sockaddr *)addr));
+	memcpy(&st->pbuf[st->offset], addr, sysdep_sa_len((struct sockaddr *)addr));
 
-	offset += sysdep_sa_len((struct sockaddr *)addr);
+	st->offset += sysdep_sa_len((struct sockaddr *)addr);
 
-	__ipsec_errcode = EIPSEC_NO_ERROR;
+	st->errcode = EIPSEC_NO_ERROR;
 	return 0;
 }
 
 static void
-policy_parse_request_init()
+policy_parse_request_init(st)
+	struct policy_parse_state *st;
 {
-	p_protocol = IPPROTO_IP;
-	p_mode = IPSEC_MODE_ANY;
-	p_level = IPSEC_LEVEL_DEFAULT;
-	p_reqid = 0;
-	if (p_src != NULL) {
-		free(p_src);
-		p_src = NULL;
+	st->p_protocol = IPPROTO_IP;
+	st->p_mode = IPSEC_MODE_ANY;
+	st->p_level = IPSEC_LEVEL_DEFAULT;
+	st->p_reqid = 0;
+	if (st->p_src != NULL) {
+		free(st->p_src);
+		st->p_src = NULL;
 	}
-	if (p_dst != NULL) {
-		free(p_dst);
-		p_dst = NULL;
+	if (st->p_dst != NULL) {
+		free(st->p_dst);
+		st->p_dst = NULL;
 	}
 
 	return;
@@ -610,32 +646,177 @@ policy_parse(msg, msglen)
 	const char *msg;
 	int msglen;
 {
+	struct policy_parse_state st;
+	void *scanner;
 	int error;
 
-	pbuf = NULL;
-	tlen = 0;
+	memset(&st, 0, sizeof(st));
 
 	/* initialize */
-	p_dir = IPSEC_DIR_INVALID;
-	p_type = IPSEC_POLICY_DISCARD;
-	policy_parse_request_init();
-	__policy__strbuffer__init__(msg);
+	st.p_dir = IPSEC_DIR_INVALID;
+	st.p_type = IPSEC_POLICY_DISCARD;
+	policy_parse_request_init(&st);
+	if (__policy__strbuffer__init__(msg, &scanner) != 0) {
+		__ipsec_errcode = EIPSEC_NO_BUFS;
+		return NULL;
+	}
 
-	error = yyparse();	/* it must be set errcode. */
-	__policy__strbuffer__free__();
+	error = yyparse(scanner, &st);	/* it must be set errcode. */
+	__policy__strbuffer__free__(scanner);
+	policy_parse_request_init(&st);	/* addresses of a failed rule */
 
 	if (error) {
-		if (pbuf != NULL)
-			free(pbuf);
+		if (st.pbuf != NULL)
+			free(st.pbuf);
+		if (st.errcode == EIPSEC_SYSTEM_ERROR)
+			__ipsec_set_strerror(st.errstr);
+		else if (st.errcode == EIPSEC_NO_ERROR)
+			__ipsec_errcode = EIPSEC_INVAL_ARGUMENT;
+		else
+			__ipsec_errcode = st.errcode;
 		return NULL;
 	}
 
 	/* update total length */
-	(ALIGNED_CAST(struct sadb_x_policy *)pbuf)->sadb_x_policy_len = PFKEY_UNIT64(tlen);
+	(ALIGNED_CAST(struct sadb_x_policy *)st.pbuf)->sadb_x_policy_len = PFKEY_UNIT64(st.tlen);
 
 	__ipsec_errcode = EIPSEC_NO_ERROR;
 
-	return pbuf;
+	return st.pbuf;
+}
+
+/*
+ * Compiled policies, by policy string.  Applications tend to set the same
+ * few policies on many sockets, so the parser is run once per string and
+ * later calls get a copy.  The entries are kept most recently used first
+ * and the list is short enough to search from the head.
+ */
+#define POLICY_CACHE_MAX	32
+
+struct policy_cache_entry {
+	TAILQ_ENTRY(policy_cache_entry) chain;
+	u_int32_t hash;
+	size_t keylen;
+	char *key;
+	caddr_t policy;
+	int len;
+};
+
+static TAILQ_HEAD(policy_cache_head, policy_cache_entry) policy_cache =
+    TAILQ_HEAD_INITIALIZER(policy_cache);
+static int policy_cache_n = 0;
+static int policy_cache_max = POLICY_CACHE_MAX;
+static pthread_mutex_t policy_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+policy_cache_free(ent)
+	struct policy_cache_entry *ent;
+{
+	TAILQ_REMOVE(&policy_cache, ent, chain);
+	policy_cache_n--;
+	free(ent->key);
+	free(ent->policy);
+	free(ent);
+}
+
+/*
+ * a copy of the compiled policy, or NULL if it isn't cached.
+ */
+static caddr_t
+policy_cache_lookup(key, keylen, hash)
+	const char *key;
+	size_t keylen;
+	u_int32_t hash;
+{
+	struct policy_cache_entry *ent;
+	caddr_t policy = NULL;
+
+	pthread_mutex_lock(&policy_cache_lock);
+	TAILQ_FOREACH(ent, &policy_cache, chain) {
+		if (ent->hash == hash && ent->keylen == keylen &&
+		    memcmp(ent->key, key, keylen) == 0)
+			break;
+	}
+	if (ent != NULL && (policy = malloc(ent->len)) != NULL) {
+		memcpy(policy, ent->policy, ent->len);
+		if (ent != TAILQ_FIRST(&policy_cache)) {
+			TAILQ_REMOVE(&policy_cache, ent, chain);
+			TAILQ_INSERT_HEAD(&policy_cache, ent, chain);
+		}
+	}
+	pthread_mutex_unlock(&policy_cache_lock);
+
+	return policy;
+}
+
+static void
+policy_cache_enter(key, keylen, hash, policy)
+	const char *key;
+	size_t keylen;
+	u_int32_t hash;
+	caddr_t policy;
+{
+	struct policy_cache_entry *ent, *dup;
+	int len = ipsec_get_policylen(policy);
+
+	/* not worth failing the call for */
+	if ((ent = calloc(1, sizeof(*ent))) == NULL)
+		return;
+	ent->key = malloc(keylen);
+	ent->policy = malloc(len);
+	if (ent->key == NULL || ent->policy == NULL) {
+		free(ent->key);
+		free(ent->policy);
+		free(ent);
+		return;
+	}
+	memcpy(ent->key, key, keylen);
+	memcpy(ent->policy, policy, len);
+	ent->keylen = keylen;
+	ent->hash = hash;
+	ent->len = len;
+
+	pthread_mutex_lock(&policy_cache_lock);
+	/* another thread may have compiled the same string meanwhile */
+	TAILQ_FOREACH(dup, &policy_cache, chain) {
+		if (dup->hash == hash && dup->keylen == keylen &&
+		    memcmp(dup->key, key, keylen) == 0)
+			break;
+	}
+	if (dup != NULL || policy_cache_max == 0) {
+		pthread_mutex_unlock(&policy_cache_lock);
+		free(ent->key);
+		free(ent->policy);
+		free(ent);
+		return;
+	}
+	TAILQ_INSERT_HEAD(&policy_cache, ent, chain);
+	policy_cache_n++;
+	while (policy_cache_n > policy_cache_max)
+		policy_cache_free(TAILQ_LAST(&policy_cache, policy_cache_head));
+	pthread_mutex_unlock(&policy_cache_lock);
+}
+
+/*
+ * bound the number of compiled policies kept; 0 disables the cache.
+ * returns the previous bound.
+ */
+int
+ipsec_set_policy_cache(max)
+	int max;
+{
+	int old;
+
+	if (max < 0)
+		max = 0;
+	pthread_mutex_lock(&policy_cache_lock);
+	old = policy_cache_max;
+	policy_cache_max = max;
+	while (policy_cache_n > policy_cache_max)
+		policy_cache_free(TAILQ_LAST(&policy_cache, policy_cache_head));
+	pthread_mutex_unlock(&policy_cache_lock);
+
+	return old;
 }
 
 ipsec_policy_t
@@ -644,14 +825,24 @@ ipsec_set_policy(msg, msglen)
 	int msglen;
 {
 	caddr_t policy;
+	size_t keylen;
+	u_int32_t hash = 2166136261U;	/* FNV-1a */
+	size_t i;
 
-	policy = policy_parse(msg, msglen);
-	if (policy == NULL) {
-		if (__ipsec_errcode == EIPSEC_NO_ERROR)
-			__ipsec_errcode = EIPSEC_INVAL_ARGUMENT;
-		return NULL;
+	/* the parser reads up to the NUL whatever msglen says */
+	keylen = strlen(msg);
+	for (i = 0; i < keylen; i++)
+		hash = (hash ^ (u_char)msg[i]) * 16777619U;
+
+	if ((policy = policy_cache_lookup(msg, keylen, hash)) != NULL) {
+		__ipsec_errcode = EIPSEC_NO_ERROR;
+		return policy;
 	}
 
-	__ipsec_errcode = EIPSEC_NO_ERROR;
+	if ((policy = policy_parse(msg, msglen)) == NULL)
+		return NULL;
+
+	policy_cache_enter(msg, keylen, hash, policy);
+
 	return policy;
 }
@@ -34,6 +34,7 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 
 #include <netinet/in.h>
 #include <net/pfkeyv2.h>
@@ -45,6 +46,7 @@
 #include <string.h>
 #include <errno.h>
 #include <err.h>
+#include <pthread.h>
 
 #include "libpfkey.h"
 
@@ -87,6 +89,15 @@ int test1sub1 (struct req_t *);
 int test1sub2 (char *, int);
 int test2 (void);
 int test2sub (int);
+int test3 (void);
+double test3sub (int);
+void *test3thread (void *);
+int test4 (void);
+int test4check (char *, size_t, int);
+size_t test4msg (char *, int);
+struct sadb_ext *test4ext (char *, size_t *, int, size_t);
+void test4addr (char *, size_t *, int, u_int32_t);
+int test5 (void);
 
 int
 main(ac, av)
@@ -94,6 +105,9 @@ main(ac, av)
 	char **av;
 {
 	test1();
+	test3();
+	test4();
+	test5();
 	test2();
 
 	exit(0);
@@ -328,3 +342,431 @@ test2sub(so)
 	return ((struct sadb_x_policy *)mhp[SADB_X_EXT_POLICY])->sadb_x_policy_id;
 }
 
+/*
+ * ipsec_set_policy() throughput, with and without the cache of
+ * compiled policies.  Both must give the same structures, and so must
+ * uncached calls made on several threads at once.
+ */
+#define TEST3_LOOPS	100000
+#define TEST3_THREADS	8
+
+static char *test3ref[sizeof(reqs)/sizeof(reqs[0])];
+
+int
+test3()
+{
+	double uncached, cached;
+	char *buf1, *buf2;
+	pthread_t threads[TEST3_THREADS];
+	int i, old;
+
+	printf("TEST3\n");
+
+	old = ipsec_set_policy_cache(0);
+	uncached = test3sub(TEST3_LOOPS);
+	ipsec_set_policy_cache(old);
+	cached = test3sub(TEST3_LOOPS);
+
+	printf("uncached: %.0f calls/s\n", uncached);
+	printf("cached:   %.0f calls/s\n", cached);
+
+	for (i = 0; i < sizeof(reqs)/sizeof(reqs[0]); i++) {
+		if (reqs[i].result != 0)
+			continue;
+		ipsec_set_policy_cache(0);
+		buf1 = ipsec_set_policy(reqs[i].str, strlen(reqs[i].str));
+		ipsec_set_policy_cache(old);
+		ipsec_set_policy(reqs[i].str, strlen(reqs[i].str));
+		buf2 = ipsec_set_policy(reqs[i].str, strlen(reqs[i].str));
+		if (buf1 == NULL || buf2 == NULL)
+			warnx("ERROR: #%d: %s", i + 1, ipsec_strerror());
+		else if (ipsec_get_policylen(buf1) != ipsec_get_policylen(buf2)
+		 || memcmp(buf1, buf2, ipsec_get_policylen(buf1)) != 0)
+			warnx("ERROR: #%d: cached policy differs.", i + 1);
+		free(buf1);
+		free(buf2);
+	}
+
+	ipsec_set_policy_cache(0);
+	for (i = 0; i < sizeof(reqs)/sizeof(reqs[0]); i++) {
+		if (reqs[i].result == 0)
+			test3ref[i] = ipsec_set_policy(reqs[i].str,
+			    strlen(reqs[i].str));
+	}
+	for (i = 0; i < TEST3_THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, test3thread,
+		    (void *)(long)i) != 0)
+			errx(1, "ERROR: pthread_create failed.");
+	}
+	for (i = 0; i < TEST3_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	for (i = 0; i < sizeof(reqs)/sizeof(reqs[0]); i++) {
+		free(test3ref[i]);
+		test3ref[i] = NULL;
+	}
+	ipsec_set_policy_cache(old);
+
+	return 0;
+}
+
+/*
+ * one of the threads parsing at once: every structure must match the
+ * one parsed on its own.
+ */
+void *
+test3thread(arg)
+	void *arg;
+{
+	char *buf;
+	int i, j, n;
+
+	n = sizeof(reqs)/sizeof(reqs[0]);
+	for (i = 0; i < TEST3_LOOPS / TEST3_THREADS; i++) {
+		j = (i + (long)arg) % n;
+		if (test3ref[j] == NULL)
+			continue;
+		buf = ipsec_set_policy(reqs[j].str, strlen(reqs[j].str));
+		if (buf == NULL)
+			warnx("ERROR: #%d: failed on a thread.", j + 1);
+		else if (ipsec_get_policylen(buf) !=
+			 ipsec_get_policylen(test3ref[j])
+		 || memcmp(buf, test3ref[j], ipsec_get_policylen(buf)) != 0)
+			warnx("ERROR: #%d: parsed differently on a thread.",
+			    j + 1);
+		free(buf);
+	}
+
+	return NULL;
+}
+
+/*
+ * calls per second, cycling through the valid policies of test1.
+ */
+double
+test3sub(loops)
+	int loops;
+{
+	struct timeval start, end;
+	double secs;
+	char *buf;
+	int i, n, calls = 0;
+
+	n = sizeof(reqs)/sizeof(reqs[0]);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < loops; i++) {
+		if (reqs[i % n].result != 0)
+			continue;
+		buf = ipsec_set_policy(reqs[i % n].str, strlen(reqs[i % n].str));
+		if (buf == NULL)
+			errx(1, "ERROR: %s", ipsec_strerror());
+		free(buf);
+		calls++;
+	}
+	gettimeofday(&end, NULL);
+
+	secs = (end.tv_sec - start.tv_sec) +
+	    (end.tv_usec - start.tv_usec) / 1000000.0;
+	return secs > 0 ? calls / secs : 0;
+}
+
+/*
+ * pfkey_parse() over a corpus of PF_KEY messages: well-formed ones,
+ * hand-broken ones, and random corruptions of the well-formed ones.
+ * Every message sits at the end of a buffer of its exact size, so that
+ * reading past it is caught by the malloc debugging tools.
+ */
+#define TEST4_SA	0		/* SADB_DUMP record of an ESP SA */
+#define TEST4_SP	1		/* SADB_X_SPDDUMP record */
+#define TEST4_ACQUIRE	2
+#define TEST4_ERROR	3		/* failed SADB_ADD: header only */
+#define TEST4_MSGS	4
+#define TEST4_MUTATIONS	100000
+
+struct sadb_ext *
+test4ext(buf, off, type, len)
+	char *buf;
+	size_t *off;
+	int type;
+	size_t len;
+{
+	struct sadb_ext *ext = (struct sadb_ext *)(buf + *off);
+
+	len = PFKEY_ALIGN8(len);
+	memset(ext, 0, len);
+	ext->sadb_ext_len = PFKEY_UNIT64(len);
+	ext->sadb_ext_type = type;
+	*off += len;
+	return ext;
+}
+
+void
+test4addr(buf, off, type, addr)
+	char *buf;
+	size_t *off;
+	int type;
+	u_int32_t addr;
+{
+	struct sadb_address *a;
+	struct sockaddr_in *sin;
+
+	a = (struct sadb_address *)test4ext(buf, off, type,
+	    sizeof(*a) + sizeof(*sin));
+	a->sadb_address_proto = IPSEC_ULPROTO_ANY;
+	a->sadb_address_prefixlen = 32;
+	sin = (struct sockaddr_in *)(a + 1);
+	sin->sin_len = sizeof(*sin);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(addr);
+}
+
+/*
+ * build message `which' into buf; returns its length.
+ */
+size_t
+test4msg(buf, which)
+	char *buf;
+	int which;
+{
+	struct sadb_msg *m = (struct sadb_msg *)buf;
+	struct sadb_sa *sa;
+	struct sadb_x_sa2 *sa2;
+	struct sadb_key *key;
+	struct sadb_x_policy *xpl;
+	size_t off = sizeof(*m);
+
+	memset(m, 0, sizeof(*m));
+	m->sadb_msg_version = PF_KEY_V2;
+	m->sadb_msg_satype = SADB_SATYPE_ESP;
+	m->sadb_msg_pid = 1;
+
+	switch (which) {
+	case TEST4_SA:
+		m->sadb_msg_type = SADB_DUMP;
+		sa = (struct sadb_sa *)test4ext(buf, &off, SADB_EXT_SA, sizeof(*sa));
+		sa->sadb_sa_spi = htonl(0x1000);
+		sa->sadb_sa_state = SADB_SASTATE_MATURE;
+		sa->sadb_sa_auth = SADB_AALG_SHA1HMAC;
+		sa->sadb_sa_encrypt = SADB_X_EALG_AESCBC;
+		sa2 = (struct sadb_x_sa2 *)test4ext(buf, &off, SADB_X_EXT_SA2, sizeof(*sa2));
+		sa2->sadb_x_sa2_mode = IPSEC_MODE_TRANSPORT;
+		test4ext(buf, &off, SADB_EXT_LIFETIME_CURRENT, sizeof(struct sadb_lifetime));
+		test4ext(buf, &off, SADB_EXT_LIFETIME_HARD, sizeof(struct sadb_lifetime));
+		test4ext(buf, &off, SADB_EXT_LIFETIME_SOFT, sizeof(struct sadb_lifetime));
+		test4addr(buf, &off, SADB_EXT_ADDRESS_SRC, 0x0a000001);
+		test4addr(buf, &off, SADB_EXT_ADDRESS_DST, 0x0a000002);
+		key = (struct sadb_key *)test4ext(buf, &off, SADB_EXT_KEY_AUTH, sizeof(*key) + 20);
+		key->sadb_key_bits = 160;
+		key = (struct sadb_key *)test4ext(buf, &off, SADB_EXT_KEY_ENCRYPT, sizeof(*key) + 16);
+		key->sadb_key_bits = 128;
+		break;
+	case TEST4_SP:
+		m->sadb_msg_type = SADB_X_SPDDUMP;
+		m->sadb_msg_satype = SADB_SATYPE_UNSPEC;
+		test4addr(buf, &off, SADB_EXT_ADDRESS_SRC, 0x0a000001);
+		test4addr(buf, &off, SADB_EXT_ADDRESS_DST, 0x0a000002);
+		xpl = (struct sadb_x_policy *)test4ext(buf, &off, SADB_X_EXT_POLICY, sizeof(*xpl));
+		xpl->sadb_x_policy_type = IPSEC_POLICY_IPSEC;
+		xpl->sadb_x_policy_dir = IPSEC_DIR_OUTBOUND;
+		test4ext(buf, &off, SADB_EXT_LIFETIME_CURRENT, sizeof(struct sadb_lifetime));
+		break;
+	case TEST4_ACQUIRE:
+		m->sadb_msg_type = SADB_ACQUIRE;
+		test4addr(buf, &off, SADB_EXT_ADDRESS_SRC, 0x0a000001);
+		test4addr(buf, &off, SADB_EXT_ADDRESS_DST, 0x0a000002);
+		xpl = (struct sadb_x_policy *)test4ext(buf, &off, SADB_X_EXT_POLICY, sizeof(*xpl));
+		xpl->sadb_x_policy_type = IPSEC_POLICY_IPSEC;
+		xpl->sadb_x_policy_dir = IPSEC_DIR_OUTBOUND;
+		break;
+	case TEST4_ERROR:
+		m->sadb_msg_type = SADB_ADD;
+		m->sadb_msg_errno = EEXIST;
+		break;
+	}
+	m->sadb_msg_len = PFKEY_UNIT64(off);
+
+	return off;
+}
+
+/*
+ * parse a copy of msg in a buffer of exactly len bytes.
+ * returns 0 if it parsed, 1 if not; exits if the result can't be right.
+ */
+int
+test4check(msg, len, expect)
+	char *msg;
+	size_t len;
+	int expect;		/* 0: must parse, 1: must not, -1: either */
+{
+	caddr_t mhp[SADB_EXT_MAX + 1];
+	struct sadb_ext *ext;
+	char *buf, *end;
+	int i, result;
+
+	if ((buf = malloc(len ? len : 1)) == NULL)
+		err(1, "malloc");
+	memcpy(buf, msg, len);
+
+	result = pfkey_parse((struct sadb_msg *)buf, len, mhp) == 0 ? 0 : 1;
+	if (expect >= 0 && result != expect)
+		errx(1, "ERROR: pfkey_parse %s: %s", result ? "failed" : "passed",
+		    ipsec_strerror());
+
+	/* what was accepted lies within the message */
+	if (result == 0) {
+		end = buf + PFKEY_UNUNIT64(((struct sadb_msg *)buf)->sadb_msg_len);
+		if (end > buf + len || mhp[0] != buf)
+			errx(1, "ERROR: pfkey_parse accepted a short buffer.");
+		for (i = 1; i <= SADB_EXT_MAX; i++) {
+			if ((ext = (struct sadb_ext *)mhp[i]) == NULL)
+				continue;
+			if ((char *)ext < buf + sizeof(struct sadb_msg)
+			 || (char *)ext + PFKEY_EXTLEN(ext) > end
+			 || ext->sadb_ext_type != i)
+				errx(1, "ERROR: extension %d outside the message.", i);
+		}
+	}
+
+	free(buf);
+	return result;
+}
+
+int
+test4()
+{
+	union {
+		u_int64_t align;
+		char buf[1024];
+	} u;
+	char *buf = u.buf;
+	struct sadb_msg *m = (struct sadb_msg *)buf;
+	struct sadb_ext *ext;
+	struct sadb_address *addr;
+	size_t len, off;
+	int i, n, which, rejected = 0;
+
+	printf("TEST4\n");
+
+	/* well-formed */
+	for (which = 0; which < TEST4_MSGS; which++) {
+		len = test4msg(buf, which);
+		test4check(buf, len, 0);
+	}
+
+	/* broken by hand; the SA record is the base of each */
+	len = test4msg(buf, TEST4_SA);
+	test4check(buf, len - 1, 1);			/* buffer shorter than the message */
+	test4check(buf, sizeof(*m) - 1, 1);		/* not even a header */
+
+	m->sadb_msg_len = PFKEY_UNIT64(len + 8);	/* message longer than the buffer */
+	test4check(buf, len, 1);
+	m->sadb_msg_len = PFKEY_UNIT64(len);
+
+	ext = (struct sadb_ext *)(m + 1);
+	ext->sadb_ext_len = 0;				/* extension without length */
+	test4check(buf, len, 1);
+	ext->sadb_ext_len = PFKEY_UNIT64(len);		/* past the end */
+	test4check(buf, len, 1);
+	ext->sadb_ext_len = 1;				/* shorter than an SA */
+	test4check(buf, len, 1);
+
+	len = test4msg(buf, TEST4_SA);
+	ext = (struct sadb_ext *)(m + 1);
+	ext->sadb_ext_type = SADB_EXT_MAX + 1;		/* unknown type */
+	test4check(buf, len, 1);
+	ext->sadb_ext_type = SADB_X_EXT_SA2;		/* duplicate */
+	test4check(buf, len, 1);
+	ext->sadb_ext_type = SADB_EXT_SPIRANGE;		/* a dump record without SA */
+	test4check(buf, len, 1);
+
+	/* the source address, after SA, SA2 and three lifetimes */
+	len = test4msg(buf, TEST4_SA);
+	off = sizeof(*m) + PFKEY_ALIGN8(sizeof(struct sadb_sa)) +
+	    PFKEY_ALIGN8(sizeof(struct sadb_x_sa2)) +
+	    3 * PFKEY_ALIGN8(sizeof(struct sadb_lifetime));
+	addr = (struct sadb_address *)(buf + off);
+	if (addr->sadb_address_exttype != SADB_EXT_ADDRESS_SRC)
+		errx(1, "ERROR: corpus layout.");
+	((struct sockaddr *)(addr + 1))->sa_family = AF_UNIX;
+	test4check(buf, len, 1);			/* not an IP address */
+	((struct sockaddr *)(addr + 1))->sa_family = AF_INET6;
+	test4check(buf, len, 1);			/* IPv6 in IPv4 room */
+	((struct sockaddr *)(addr + 1))->sa_family = AF_INET;
+	((struct sockaddr *)(addr + 1))->sa_len = 64;
+	test4check(buf, len, 1);			/* longer than the extension */
+
+	/* random corruptions of the well-formed messages */
+	srandom(1);
+	for (i = 0; i < TEST4_MUTATIONS; i++) {
+		which = i % TEST4_MSGS;
+		len = test4msg(buf, which);
+		for (n = random() % 4; n >= 0; n--)
+			buf[random() % len] ^= 1 << (random() % 8);
+		if (random() % 8 == 0)
+			len -= random() % len;
+		rejected += test4check(buf, len, -1);
+	}
+	printf("%d of %d corrupted messages rejected\n", rejected, TEST4_MUTATIONS);
+
+	return 0;
+}
+
+/*
+ * pfkey_parse() throughput over a multi-megabyte SADB dump, compared with
+ * pfkey_align() followed by pfkey_check().
+ */
+#define TEST5_RECORDS	20000
+#define TEST5_LOOPS	20
+
+int
+test5()
+{
+	caddr_t mhp[SADB_EXT_MAX + 1];
+	struct timeval start, end;
+	struct sadb_msg *m, *ep;
+	double secs[2];
+	char *dump;
+	size_t len, total;
+	int i, pass, loop, records;
+
+	printf("TEST5\n");
+
+	/* room for the largest record */
+	if ((dump = malloc(TEST5_RECORDS * 512)) == NULL)
+		err(1, "malloc");
+	for (i = 0, total = 0; i < TEST5_RECORDS; i++) {
+		len = test4msg(dump + total, TEST4_SA);
+		((struct sadb_msg *)(dump + total))->sadb_msg_seq = TEST5_RECORDS - i - 1;
+		total += len;
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		gettimeofday(&start, NULL);
+		for (loop = 0; loop < TEST5_LOOPS; loop++) {
+			m = (struct sadb_msg *)dump;
+			ep = (struct sadb_msg *)(dump + total);
+			for (records = 0; m < ep; records++) {
+				if (pass == 0) {
+					if (pfkey_parse(m, (char *)ep - (char *)m, mhp))
+						errx(1, "ERROR: %s", ipsec_strerror());
+				} else {
+					if (pfkey_align(m, mhp) || pfkey_check(mhp))
+						errx(1, "ERROR: %s", ipsec_strerror());
+				}
+				m = (struct sadb_msg *)((char *)m +
+				    PFKEY_UNUNIT64(m->sadb_msg_len));
+			}
+		}
+		gettimeofday(&end, NULL);
+		secs[pass] = (end.tv_sec - start.tv_sec) +
+		    (end.tv_usec - start.tv_usec) / 1000000.0;
+	}
+
+	printf("%d records, %.1f MB\n", records, total / 1e6);
+	printf("pfkey_parse:             %.0f records/s, %.0f MB/s\n",
+	    records * TEST5_LOOPS / secs[0], total * TEST5_LOOPS / secs[0] / 1e6);
+	printf("pfkey_align+pfkey_check: %.0f records/s, %.0f MB/s\n",
+	    records * TEST5_LOOPS / secs[1], total * TEST5_LOOPS / secs[1] / 1e6);
+
+	free(dump);
+	return 0;
+}
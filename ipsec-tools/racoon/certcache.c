@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <CommonCrypto/CommonDigest.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <Security/SecCertificate.h>
+#include <Security/SecCertificatePriv.h>
+
+#include "var.h"
+#include "misc.h"
+#include "vmbuf.h"
+#include "plog.h"
+#include "debug.h"
+
+#include "localconf.h"
+#include "remoteconf.h"
+#include "isakmp_var.h"
+#include "isakmp.h"
+#include "oakley.h"
+#include "handler.h"
+#include "crypto_cssm.h"
+#include "metrics.h"
+#include "certcache.h"
+
+struct certcache_entry {
+	u_int8_t key[CERTCACHE_KEYLEN];
+	SecKeyRef publicKey;		/* NULL when the slot is free */
+	time_t expires;
+	time_t used;
+};
+
+/* CERTCACHE_WAYS entries per set, only touched from the main queue */
+static struct certcache_entry certcache[CERTCACHE_SIZE];
+static struct certcache_stats certcache_stats;
+
+static void
+certcache_hash_u32(CC_SHA256_CTX *ctx, u_int32_t v)
+{
+	CC_SHA256_Update(ctx, &v, sizeof(v));
+}
+
+static void
+certcache_hash_buf(CC_SHA256_CTX *ctx, const void *buf, size_t len)
+{
+	certcache_hash_u32(ctx, (u_int32_t)len);
+	CC_SHA256_Update(ctx, buf, (CC_LONG)len);
+}
+
+/*
+ * key for the peer's chain as received, for the given certificate
+ * type.  returns -1 when there is nothing to cache or the cache is off.
+ */
+int
+certcache_key(phase1_handle_t *iph1, int certtype, u_int8_t *key)
+{
+	struct remoteconf *rmconf = iph1->rmconf;
+	struct genlist_entry *gpb = NULL;
+	struct idspec *id_spec;
+	CC_SHA256_CTX ctx;
+	cert_t *p;
+
+	if (lcconf->cert_cache_ttl <= 0 ||
+	    iph1->id_p == NULL || iph1->cert_p == NULL)
+		return -1;
+
+	CC_SHA256_Init(&ctx);
+	certcache_hash_u32(&ctx, certtype);
+	certcache_hash_u32(&ctx, rmconf->cert_verification_option);
+	if (rmconf->cert_verification_option ==
+	    VERIFICATION_OPTION_PEERS_IDENTIFIER) {
+		id_spec = genlist_next(rmconf->idvl_p, &gpb);
+		if (id_spec == NULL || id_spec->id == NULL)
+			return -1;
+		certcache_hash_u32(&ctx, id_spec->idtype);
+		certcache_hash_buf(&ctx, id_spec->id->v, id_spec->id->l);
+	}
+	certcache_hash_buf(&ctx, iph1->id_p->v, iph1->id_p->l);
+	for (p = iph1->cert_p; p != NULL; p = p->chain) {
+		certcache_hash_u32(&ctx, p->type);
+		certcache_hash_buf(&ctx, p->cert.v, p->cert.l);
+	}
+	CC_SHA256_Final(key, &ctx);
+
+	return 0;
+}
+
+static struct certcache_entry *
+certcache_set(const u_int8_t *key)
+{
+	u_int32_t h;
+
+	memcpy(&h, key, sizeof(h));
+	return &certcache[(h % (CERTCACHE_SIZE / CERTCACHE_WAYS)) * CERTCACHE_WAYS];
+}
+
+static int
+certcache_live(const struct certcache_entry *e, time_t now)
+{
+	return e->publicKey != NULL && e->expires > now;
+}
+
+static void
+certcache_free(struct certcache_entry *e)
+{
+	if (e->publicKey != NULL)
+		CFRelease(e->publicKey);
+	memset(e, 0, sizeof(*e));
+}
+
+/*
+ * the public key of a chain validated before, retained for the caller,
+ * or NULL.
+ */
+SecKeyRef
+certcache_lookup(const u_int8_t *key)
+{
+	struct certcache_entry *e = certcache_set(key);
+	time_t now = time(NULL);
+	int i;
+
+	for (i = 0; i < CERTCACHE_WAYS; i++, e++) {
+		if (e->publicKey == NULL ||
+		    memcmp(e->key, key, CERTCACHE_KEYLEN) != 0)
+			continue;
+		if (e->expires <= now) {
+			certcache_stats.expired++;
+			certcache_free(e);
+			break;
+		}
+		e->used = now;
+		certcache_stats.hits++;
+		METRICS_INC(METRICS_C_CERTCACHE_HITS);
+		plog(ASL_LEVEL_DEBUG,
+			"peer's certificate chain found in the cache.\n");
+		return (SecKeyRef)CFRetain(e->publicKey);
+	}
+
+	certcache_stats.misses++;
+	METRICS_INC(METRICS_C_CERTCACHE_MISSES);
+	return NULL;
+}
+
+/* remember a chain that has just passed validation */
+void
+certcache_insert(const u_int8_t *key, cert_t *certchain, SecKeyRef publicKey)
+{
+	struct certcache_entry *e, *victim = NULL;
+	SecCertificateRef certRef;
+	time_t now = time(NULL);
+	time_t expires, notafter;
+	cert_t *p;
+	int i;
+
+	if (lcconf->cert_cache_ttl <= 0 || publicKey == NULL)
+		return;
+
+	/* the earliest notAfter in the chain bounds the TTL */
+	expires = now + lcconf->cert_cache_ttl;
+	for (p = certchain; p != NULL; p = p->chain) {
+		CFAbsoluteTime after;
+
+		if ((certRef = crypto_cssm_x509cert_CreateSecCertificateRef(&p->cert)) == NULL)
+			return;
+		after = SecCertificateNotValidAfter(certRef);
+		CFRelease(certRef);
+		if (after == 0)
+			continue;
+		notafter = (time_t)(after + kCFAbsoluteTimeIntervalSince1970);
+		if (notafter < expires)
+			expires = notafter;
+	}
+	if (expires <= now)
+		return;
+
+	/* the same chain, else a free or expired slot, else the LRU one */
+	e = certcache_set(key);
+	for (i = 0; i < CERTCACHE_WAYS; i++, e++) {
+		if (e->publicKey != NULL &&
+		    memcmp(e->key, key, CERTCACHE_KEYLEN) == 0) {
+			victim = e;
+			break;
+		}
+		if (victim == NULL ||
+		    (certcache_live(victim, now) &&
+		     (!certcache_live(e, now) || e->used < victim->used)))
+			victim = e;
+	}
+	if (certcache_live(victim, now) &&
+	    memcmp(victim->key, key, CERTCACHE_KEYLEN) != 0)
+		certcache_stats.evictions++;
+	certcache_free(victim);
+
+	memcpy(victim->key, key, CERTCACHE_KEYLEN);
+	victim->publicKey = (SecKeyRef)CFRetain(publicKey);
+	victim->expires = expires;
+	victim->used = now;
+	certcache_stats.inserts++;
+}
+
+/* forget every chain, e.g. because trust settings may have changed */
+void
+certcache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < CERTCACHE_SIZE; i++)
+		certcache_free(&certcache[i]);
+}
+
+void
+certcache_dump(void)
+{
+	time_t now = time(NULL);
+	int i, live = 0;
+
+	for (i = 0; i < CERTCACHE_SIZE; i++)
+		if (certcache_live(&certcache[i], now))
+			live++;
+	plog(ASL_LEVEL_NOTICE,
+		"certcache: %d/%d entries, %llu hits, %llu misses, %llu inserts, "
+		"%llu expired, %llu evictions\n", live, CERTCACHE_SIZE,
+		(unsigned long long)certcache_stats.hits,
+		(unsigned long long)certcache_stats.misses,
+		(unsigned long long)certcache_stats.inserts,
+		(unsigned long long)certcache_stats.expired,
+		(unsigned long long)certcache_stats.evictions);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _CERTCACHE_H
+#define _CERTCACHE_H
+
+#include <Security/SecBase.h>
+
+#include "oakley.h"
+#include "handler.h"
+
+/*
+ * Cache of peer certificate chains that passed validation.
+ *
+ * Validating a chain through the Security framework dominates the cost
+ * of a signature phase 1, and most peers present the same CA chain,
+ * many of them the same leaf, again and again.  The key is a SHA-256 of
+ * the raw CERT payloads, the peer's ID payload and the remoteconf
+ * settings the validation depends on, so a lookup parses nothing.  A
+ * hit stands for the ID-to-certificate check as well as the trust
+ * evaluation, and gives back the leaf's public key.
+ *
+ * Only successful validations are kept.  An entry expires at the
+ * earliest notAfter of its chain or after the configured TTL, and the
+ * whole cache is dropped when the configuration (and with it the trust
+ * settings) is reloaded.
+ */
+#define CERTCACHE_KEYLEN	32
+#define CERTCACHE_SIZE		256	/* entries, a power of two */
+#define CERTCACHE_WAYS		4
+
+struct certcache_stats {
+	u_int64_t hits;
+	u_int64_t misses;
+	u_int64_t inserts;
+	u_int64_t expired;		/* found but past its expiry */
+	u_int64_t evictions;		/* live entries pushed out */
+};
+
+extern int certcache_key (phase1_handle_t *, int, u_int8_t *);
+extern SecKeyRef certcache_lookup (const u_int8_t *);
+extern void certcache_insert (const u_int8_t *, cert_t *, SecKeyRef);
+extern void certcache_flush (void);
+extern void certcache_dump (void);
+
+#endif /* _CERTCACHE_H */
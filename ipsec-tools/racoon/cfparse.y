@@ -95,6 +95,9 @@
 #include "vendorid.h"
 #include "ipsecConfigTracer.h"
 #include "ipsecMessageTracer.h"
+#include "certcache.h"
+#include "cfsnapshot.h"
+#include "pkttrace.h"
 
 static int num2dhgroup[] = {
 	0,
@@ -175,7 +178,10 @@ static int fix_lifebyte (u_long);
 %token CFG_PFS_GROUP CFG_SAVE_PASSWD
 	/* timer */
 %token RETRY RETRY_COUNTER RETRY_INTERVAL RETRY_PERSEND
-%token RETRY_PHASE1 RETRY_PHASE2 NATT_KA AUTO_EXIT_DELAY
+%token RETRY_PHASE1 RETRY_PHASE2 NATT_KA AUTO_EXIT_DELAY CERT_CACHE
+%token REKEY_JITTER REKEY_RATE
+	/* trace */
+%token TRACE TRACE_FILE TRACE_MAXSIZE TRACE_PEER TRACE_DECRYPTED
 	/* algorithm */
 %token ALGORITHM_CLASS ALGORITHMTYPE STRENGTHTYPE
 	/* sainfo */
@@ -192,7 +198,7 @@ static int fix_lifebyte (u_long);
 %token OPEN_DIR_AUTH_GROUP IN_KEYCHAIN
 %token CERTIFICATE_VERIFICATION VERIFICATION_MODULE VERIFICATION_OPTION
 %token DNSSEC CERT_X509 CERT_PLAINRSA
-%token NONCE_SIZE DH_GROUP KEEPALIVE PASSIVE INITIAL_CONTACT
+%token NONCE_SIZE DH_GROUP KEEPALIVE PASSIVE INITIAL_CONTACT FAST_RECONNECT
 %token NAT_TRAVERSAL REMOTE_FORCE_LEVEL NAT_TRAVERSAL_LEVEL NAT_TRAVERSAL_MULTI_USER NAT_TRAVERSAL_KEEPALIVE 
 %token PROPOSAL_CHECK PROPOSAL_CHECK_LEVEL
 %token GENERATE_POLICY GENERATE_LEVEL SUPPORT_PROXY
@@ -249,6 +255,7 @@ statement
 	|	listen_statement
 	|	modecfg_statement
 	|	timer_statement
+	|	trace_statement
 	|	sainfo_statement
 	|	remote_statement
 	|	special_statement
@@ -611,6 +618,7 @@ modecfg_stmt
 	|	CFG_POOL_SIZE NUMBER
 		{
 #ifdef ENABLE_HYBRID
+			isakmp_cfg_config.pool_conf = $2;
 			if (isakmp_cfg_resize_pool($2) != 0)
 				racoon_yyerror("cannot allocate memory for pool");
 #else /* ENABLE_HYBRID */
@@ -898,6 +906,67 @@ timer_stmt
 #endif
 		}
 		EOS
+	|	CERT_CACHE NUMBER unittype_time
+		{
+			lcconf->cert_cache_ttl = $2 * $3;
+		}
+		EOS
+	|	REKEY_JITTER NUMBER
+		{
+			if ($2 > 50) {
+				racoon_yyerror("rekey_jitter must be at most 50 (percent).");
+				return -1;
+			}
+			lcconf->rekey_jitter = $2;
+		}
+		EOS
+	|	REKEY_RATE NUMBER
+		{
+			lcconf->rekey_rate = $2;
+		}
+		EOS
+	;
+
+	/* trace */
+trace_statement
+	:	TRACE BOC trace_stmts EOC
+	;
+trace_stmts
+	:	/* nothing */
+	|	trace_stmts trace_stmt
+	;
+trace_stmt
+	:	TRACE_FILE QUOTEDSTRING
+		{
+			pkttrace_conf_file($2->v);
+			vfree($2);
+		}
+		EOS
+	|	TRACE_MAXSIZE NUMBER unittype_byte
+		{
+			pkttrace_conf_maxsize((u_int64_t)$2 * $3);
+		}
+		EOS
+	|	TRACE_PEER ADDRSTRING
+		{
+			struct sockaddr_storage *saddr;
+
+			saddr = str2saddr($2->v, NULL);
+			vfree($2);
+			if (saddr == NULL)
+				return -1;
+			if (pkttrace_conf_peer(saddr) != 0) {
+				racoon_free(saddr);
+				return -1;
+			}
+			racoon_free(saddr);
+		}
+		EOS
+	|	TRACE_DECRYPTED SWITCH
+		{
+			pkttrace_conf_decrypted($2);
+		}
+		EOS
 	;
 
 	/* sainfo */
@@ -1639,6 +1708,7 @@ remote_spec
 	|	GENERATE_POLICY GENERATE_LEVEL { cur_rmconf->gen_policy = $2; } EOS
 	|	SUPPORT_PROXY SWITCH { cur_rmconf->support_proxy = $2; } EOS
 	|	INITIAL_CONTACT SWITCH { cur_rmconf->ini_contact = $2; } EOS
+	|	FAST_RECONNECT SWITCH { cur_rmconf->fast_reconnect = $2; } EOS
 	|	NAT_TRAVERSAL SWITCH
 		{
 #ifdef ENABLE_NATT
@@ -2278,6 +2348,7 @@ cfparse()
 	plog(ASL_LEVEL_DEBUG, "===== parsing configuration\n");
 
 	yycf_init_buffer();
+	pkttrace_conf_reset();
 
 	if (yycf_switch_buffer(lcconf->racoon_conf) != 0) {
         IPSECCONFIGTRACEREVENT(CONSTSTR(lcconf->racoon_conf),
@@ -2342,17 +2413,41 @@ cfreparse(int sig)
                                CONSTSTR("Unknown signal"),
                                CONSTSTR("cfreparse: triggered by unknown signal"));
 	}
-	plog(ASL_LEVEL_DEBUG, "==== %s sessions.\n", ignore_estab_or_assert_handles? "flush negotiating" : "flush all");
 
-	ike_session_flush_all_phase2(ignore_estab_or_assert_handles);
-	ike_session_flush_all_phase1(ignore_estab_or_assert_handles);
-	flushrmconf();
-	flushsainfo();
-	check_auto_exit();	/* check/change state of auto exit */
+	/*
+	 * the new remote and sainfo sections are parsed beside the running
+	 * ones; only those it changes or drops are replaced, and only the
+	 * sessions set up under those are flushed.  Those still partly in
+	 * the snapshot are read in full first, to be compared.
+	 */
+	cfsnapshot_release();
+	rmconf_reload_begin();
+	sainfo_reload_begin();
+	certcache_flush();	/* trust settings may have changed too */
 	clean_tmpalgtype();
     savelcconf();
 	result = cfparse();
     restorelcconf();
+	if (result != 0) {
+		rmconf_reload_abort();
+		sainfo_reload_abort();
+		return result;
+	}
+
+	rmconf_reload_commit();
+	sainfo_reload_commit();
+	pkttrace_apply();
+	plog(ASL_LEVEL_DEBUG, "==== %s stale sessions.\n", ignore_estab_or_assert_handles? "flush negotiating" : "flush all");
+	ike_session_flush_stale_phase2(ignore_estab_or_assert_handles);
+	ike_session_flush_stale_phase1(ignore_estab_or_assert_handles);
+	rmconf_reload_release();
+	sainfo_reload_release();
+#ifdef ENABLE_HYBRID
+	if (isakmp_cfg_config.pool_conf == 0)
+		isakmp_cfg_resize_pool(0);	/* no pool any more, but for leases */
+#endif
+	check_auto_exit();	/* check/change state of auto exit */
+	cfsnapshot_write(lcconf->racoon_conf);
     return result;
 }
 
@@ -0,0 +1,1149 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "var.h"
+#include "misc.h"
+#include "vmbuf.h"
+#include "plog.h"
+#include "debug.h"
+#include "sockmisc.h"
+#include "schedule.h"
+#include "gcmalloc.h"
+#include "genlist.h"
+
+#include "localconf.h"
+#include "isakmp_var.h"
+#include "isakmp.h"
+#ifdef ENABLE_HYBRID
+#include "isakmp_xauth.h"
+#endif
+#include "ipsec_doi.h"
+#include "oakley.h"
+#include "remoteconf.h"
+#include "algorithm.h"
+#include "sainfo.h"
+#include "cfsnapshot.h"
+
+#define CFSNAPSHOT_MAGIC	0x52434e46	/* "RCNF" */
+#define CFSNAPSHOT_VERSION	3
+#define CFSNAPSHOT_NULL		0xffffffff	/* length of an absent value */
+
+struct cfsnapshot_hdr {
+	u_int32_t magic;
+	u_int32_t version;
+	u_int32_t layout;		/* cfsnapshot_layout() */
+	u_int32_t nsources;
+	u_int32_t nrmconf;
+	u_int32_t nsainfo;
+	u_int64_t length;		/* of the body, after the header */
+	u_int64_t checksum;		/* cfsnapshot_sum() of the body */
+};
+
+/*
+ * the plain values of each structure, written as they are in memory.
+ * anything else is written field by field below.
+ */
+struct cfsnapshot_field {
+	size_t off;
+	size_t len;
+};
+
+#define RMF(f)	{ offsetof(struct remoteconf, f), sizeof(((struct remoteconf *)0)->f) }
+static const struct cfsnapshot_field rmconf_fields[] = {
+	RMF(remote_prefix), RMF(doitype), RMF(sittype), RMF(idvtype),
+	RMF(identity_in_keychain), RMF(secrettype), RMF(certtype),
+	RMF(getcert_method), RMF(cacerttype), RMF(send_cert), RMF(send_cr),
+	RMF(verify_cert), RMF(cert_verification),
+	RMF(cert_verification_option), RMF(verify_identifier),
+	RMF(nonce_size), RMF(passive), RMF(ike_frag), RMF(esp_frag),
+	RMF(mode_cfg), RMF(support_proxy), RMF(gen_policy), RMF(ini_contact),
+	RMF(fast_reconnect), RMF(pcheck_level), RMF(nat_traversal),
+	RMF(natt_multiple_user), RMF(natt_keepalive), RMF(dh_group),
+	RMF(retry_counter), RMF(retry_interval), RMF(dpd), RMF(dpd_retry),
+	RMF(dpd_interval), RMF(dpd_maxfails), RMF(dpd_algo),
+	RMF(idle_timeout), RMF(idle_timeout_dir), RMF(ph1id),
+	RMF(weak_phase1_check), RMF(initiate_ph1rekey), RMF(ike_version),
+};
+#undef RMF
+
+#define SAF(f)	{ offsetof(struct isakmpsa, f), sizeof(((struct isakmpsa *)0)->f) }
+static const struct cfsnapshot_field isakmpsa_fields[] = {
+	SAF(version), SAF(prop_no), SAF(trns_no), SAF(lifetime),
+	SAF(lifetimegap), SAF(lifebyte), SAF(enctype), SAF(encklen),
+	SAF(authmethod), SAF(hashtype), SAF(vendorid), SAF(dh_group),
+	SAF(prf), SAF(prfklen),
+};
+#undef SAF
+
+#define SIF(f)	{ offsetof(struct sainfo, f), sizeof(((struct sainfo *)0)->f) }
+static const struct cfsnapshot_field sainfo_fields[] = {
+	SIF(lifetime), SIF(lifebyte), SIF(pfs_group),
+};
+#undef SIF
+
+static int cfsnapshot_loaded;
+
+/* the mapped snapshot the sections loaded from it still read from */
+static void *cfsnapshot_map = MAP_FAILED;
+static size_t cfsnapshot_maplen;
+static const u_int8_t *cfsnapshot_end;
+static struct remoteconf **cfsnapshot_rmconfs;	/* in file order */
+static u_int32_t cfsnapshot_nrmconf;
+static struct sainfo **cfsnapshot_sainfos;
+static u_int32_t cfsnapshot_nsainfo;
+
+/* output buffer */
+struct cfsnapshot_buf {
+	u_int8_t *p;
+	size_t len;
+	size_t size;
+	int error;
+};
+
+/* input cursor over the mapped file */
+struct cfsnapshot_cur {
+	const u_int8_t *p;
+	const u_int8_t *end;
+	int error;
+};
+
+static u_int64_t
+cfsnapshot_fnv(const void *data, size_t len, u_int64_t h)
+{
+	const u_int8_t *p = data;
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+#define FNV_INIT	0xcbf29ce484222325ULL
+
+/*
+ * the checksum of the body: FNV-1a a word at a time, as it is summed
+ * in full at every start.
+ */
+static u_int64_t
+cfsnapshot_sum(const u_int8_t *p, size_t len)
+{
+	u_int64_t h = FNV_INIT, w;
+
+	for (; len >= sizeof(w); p += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		h ^= w;
+		h *= 0x100000001b3ULL;
+	}
+	return cfsnapshot_fnv(p, len, h);
+}
+
+static void
+cfsnapshot_layout_table(const struct cfsnapshot_field *t, int n, u_int64_t *h)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		*h = cfsnapshot_fnv(&t[i].off, sizeof(t[i].off), *h);
+		*h = cfsnapshot_fnv(&t[i].len, sizeof(t[i].len), *h);
+	}
+}
+
+/*
+ * changes whenever a structure written by value changes shape.
+ */
+static u_int32_t
+cfsnapshot_layout(void)
+{
+	u_int64_t h = FNV_INIT;
+	size_t sizes[] = {
+		sizeof(struct remoteconf), sizeof(struct isakmpsa),
+		sizeof(struct sainfo), sizeof(struct sockaddr_storage),
+		MAXALGCLASS,
+	};
+
+	h = cfsnapshot_fnv(sizes, sizeof(sizes), h);
+	cfsnapshot_layout_table(rmconf_fields, ARRAYLEN(rmconf_fields), &h);
+	cfsnapshot_layout_table(isakmpsa_fields, ARRAYLEN(isakmpsa_fields), &h);
+	cfsnapshot_layout_table(sainfo_fields, ARRAYLEN(sainfo_fields), &h);
+
+	return (u_int32_t)(h ^ (h >> 32));
+}
+
+/* %%%
+ * writing
+ */
+static void
+put(struct cfsnapshot_buf *b, const void *data, size_t len)
+{
+	u_int8_t *n;
+	size_t size;
+
+	if (b->error)
+		return;
+	if (b->len + len > b->size) {
+		size = b->size ? b->size : 4096;
+		while (size < b->len + len)
+			size *= 2;
+		n = racoon_realloc(b->p, size);
+		if (n == NULL) {
+			b->error = ENOMEM;
+			return;
+		}
+		b->p = n;
+		b->size = size;
+	}
+	memcpy(b->p + b->len, data, len);
+	b->len += len;
+}
+
+static void
+put32(struct cfsnapshot_buf *b, u_int32_t v)
+{
+	put(b, &v, sizeof(v));
+}
+
+static void
+put64(struct cfsnapshot_buf *b, u_int64_t v)
+{
+	put(b, &v, sizeof(v));
+}
+
+static void
+putvchar(struct cfsnapshot_buf *b, const vchar_t *v)
+{
+	if (v == NULL) {
+		put32(b, CFSNAPSHOT_NULL);
+		return;
+	}
+	put32(b, (u_int32_t)v->l);
+	put(b, v->v, v->l);
+}
+
+static void
+putaddr(struct cfsnapshot_buf *b, const struct sockaddr_storage *ss)
+{
+	if (ss == NULL) {
+		put32(b, CFSNAPSHOT_NULL);
+		return;
+	}
+	put32(b, sizeof(*ss));
+	put(b, ss, sizeof(*ss));
+}
+
+static void
+putfields(struct cfsnapshot_buf *b, const void *obj,
+	const struct cfsnapshot_field *t, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		put(b, (const u_int8_t *)obj + t[i].off, t[i].len);
+}
+
+/* for finding the index of the section a remote inherits from */
+struct cfsnapshot_ref {
+	struct remoteconf *rmconf;
+	u_int32_t index;
+};
+
+static int
+cfsnapshot_refcmp(const void *a, const void *b)
+{
+	const struct cfsnapshot_ref *ra = a, *rb = b;
+
+	if (ra->rmconf == rb->rmconf)
+		return 0;
+	return ra->rmconf < rb->rmconf ? -1 : 1;
+}
+
+struct cfsnapshot_walk {
+	struct remoteconf **rmconfs;
+	int nrmconf;
+	struct sainfo **sainfos;
+	int nsainfo;
+	int size;
+	int error;
+};
+
+/* room for one more in *array, of n */
+static int
+cfsnapshot_grow(struct cfsnapshot_walk *w, void **array, int n)
+{
+	void *p;
+	int size;
+
+	if (n < w->size)
+		return 0;
+	size = w->size ? w->size * 2 : 256;
+	p = racoon_realloc(*array, size * sizeof(void *));
+	if (p == NULL) {
+		w->error = ENOMEM;
+		return -1;
+	}
+	*array = p;
+	w->size = size;
+	return 0;
+}
+
+static struct remoteconf *
+cfsnapshot_walk_rmconf(struct remoteconf *rmconf, void *arg)
+{
+	struct cfsnapshot_walk *w = arg;
+
+	if (cfsnapshot_grow(w, (void **)&w->rmconfs, w->nrmconf) != 0)
+		return rmconf;		/* stops the walk */
+	w->rmconfs[w->nrmconf++] = rmconf;
+	return NULL;
+}
+
+static struct sainfo *
+cfsnapshot_walk_sainfo(struct sainfo *si, void *arg)
+{
+	struct cfsnapshot_walk *w = arg;
+
+	if (si->dynamic != 0)
+		return NULL;
+	if (cfsnapshot_grow(w, (void **)&w->sainfos, w->nsainfo) != 0)
+		return si;
+	w->sainfos[w->nsainfo++] = si;
+	return NULL;
+}
+
+static void
+cfsnapshot_put_rmconf(struct cfsnapshot_buf *b, struct remoteconf *p,
+	struct cfsnapshot_ref *refs, int nrefs)
+{
+	struct cfsnapshot_ref key, *ref;
+	struct etypes *e;
+	struct isakmpsa *sa;
+	struct genlist_entry *gpb;
+	struct idspec *id;
+	u_int32_t n;
+
+	if (cfsnapshot_rmconf(p) != 0) {
+		b->error = EIO;
+		return;
+	}
+	putfields(b, p, rmconf_fields, ARRAYLEN(rmconf_fields));
+	putaddr(b, p->remote);
+	putaddr(b, p->forced_local);
+
+	for (n = 0, e = p->etypes; e != NULL; e = e->next)
+		n++;
+	put32(b, n);
+	for (e = p->etypes; e != NULL; e = e->next)
+		put32(b, (u_int32_t)e->type);
+
+	putvchar(b, p->idv);
+	putvchar(b, p->key);
+	putvchar(b, p->keychainCertRef);
+	putvchar(b, p->shared_secret);
+	putvchar(b, p->open_dir_auth_group);
+
+	n = 0;
+	for (id = genlist_next(p->idvl_p, &gpb); id; id = genlist_next(NULL, &gpb))
+		n++;
+	put32(b, n);
+	for (id = genlist_next(p->idvl_p, &gpb); id; id = genlist_next(NULL, &gpb)) {
+		put32(b, (u_int32_t)id->idtype);
+		putvchar(b, id->id);
+	}
+
+	for (n = 0, sa = p->proposal; sa != NULL; sa = sa->next)
+		n++;
+	put32(b, n);
+	for (sa = p->proposal; sa != NULL; sa = sa->next)
+		putfields(b, sa, isakmpsa_fields, ARRAYLEN(isakmpsa_fields));
+
+#ifdef ENABLE_HYBRID
+	if (p->xauth != NULL) {
+		put32(b, 1);
+		putvchar(b, p->xauth->login);
+		putvchar(b, p->xauth->pass);
+	} else
+#endif
+		put32(b, 0);
+
+	n = CFSNAPSHOT_NULL;
+	if (p->inherited_from != NULL) {
+		key.rmconf = p->inherited_from;
+		ref = bsearch(&key, refs, nrefs, sizeof(*refs), cfsnapshot_refcmp);
+		if (ref != NULL)
+			n = ref->index;
+	}
+	put32(b, n);
+}
+
+static void
+cfsnapshot_put_sainfo(struct cfsnapshot_buf *b, struct sainfo *s)
+{
+	struct sainfoalg *a;
+	u_int32_t n;
+	int i;
+
+	if (cfsnapshot_sainfo(s) != 0) {
+		b->error = EIO;
+		return;
+	}
+	putfields(b, s, sainfo_fields, ARRAYLEN(sainfo_fields));
+	putvchar(b, s->idsrc);
+	putvchar(b, s->iddst);
+	putvchar(b, s->id_i);
+#ifdef ENABLE_HYBRID
+	putvchar(b, s->group);
+#else
+	putvchar(b, NULL);
+#endif
+	for (i = 0; i < MAXALGCLASS; i++) {
+		for (n = 0, a = s->algs[i]; a != NULL; a = a->next)
+			n++;
+		put32(b, n);
+		for (a = s->algs[i]; a != NULL; a = a->next) {
+			put32(b, (u_int32_t)a->alg);
+			put32(b, (u_int32_t)a->encklen);
+		}
+	}
+}
+
+static char *
+cfsnapshot_path(const char *conf, const char *suffix)
+{
+	char *path;
+	size_t len;
+
+	len = strlen(conf) + sizeof(CFSNAPSHOT_SUFFIX) + strlen(suffix);
+	path = racoon_malloc(len);
+	if (path != NULL)
+		snprintf(path, len, "%s%s%s", conf, CFSNAPSHOT_SUFFIX, suffix);
+	return path;
+}
+
+/*
+ * write the remote and sainfo sections now configured, as read from
+ * the files recorded since cfsnapshot_reset().
+ */
+int
+cfsnapshot_write(const char *conf)
+{
+	struct cfsnapshot_buf b;
+	struct cfsnapshot_walk w;
+	struct cfsnapshot_ref *refs = NULL;
+	struct cfsnapshot_hdr hdr;
+	char *path = NULL, *tmp = NULL;
+	char dir[MAXPATHLEN];
+	size_t index;
+	u_int64_t off;
+	int fd = -1, i, nrec, error = -1;
+
+	memset(&b, 0, sizeof(b));
+	memset(&w, 0, sizeof(w));
+
+	if (cfsnapshot_nsources() <= 0) {
+		plog(ASL_LEVEL_WARNING,
+			"configuration snapshot not written: "
+			"the files read are not all known.\n");
+		goto end;
+	}
+	if (strcmp(cfsnapshot_source_path(0), conf) != 0)
+		goto end;		/* not what was parsed */
+
+	foreachrmconf(cfsnapshot_walk_rmconf, &w);	/* in file order */
+	w.size = 0;
+	foreachsainfo(cfsnapshot_walk_sainfo, &w);	/* newest first */
+	if (w.error)
+		goto end;
+
+	if (w.nrmconf > 0) {
+		refs = racoon_malloc(w.nrmconf * sizeof(*refs));
+		if (refs == NULL)
+			goto end;
+		for (i = 0; i < w.nrmconf; i++) {
+			refs[i].rmconf = w.rmconfs[i];
+			refs[i].index = i;
+		}
+		qsort(refs, w.nrmconf, sizeof(*refs), cfsnapshot_refcmp);
+	}
+
+	/* the sources come first, to be rewritten in place below */
+	b.size = cfsnapshot_sources_size();
+	if ((b.p = racoon_malloc(b.size)) == NULL) {
+		b.error = ENOMEM;
+		goto end;
+	}
+	cfsnapshot_sources_put(b.p);
+	b.len = b.size;
+
+	/* then where each record starts, filled in as they are written */
+	nrec = w.nrmconf + w.nsainfo;
+	index = b.len;
+	for (i = 0; i < nrec; i++)
+		put64(&b, 0);
+	for (i = 0; i < w.nrmconf && !b.error; i++) {
+		off = b.len;
+		memcpy(b.p + index + i * sizeof(off), &off, sizeof(off));
+		cfsnapshot_put_rmconf(&b, w.rmconfs[i], refs, w.nrmconf);
+	}
+	for (i = w.nsainfo - 1; i >= 0 && !b.error; i--) {	/* back to file order */
+		off = b.len;
+		memcpy(b.p + index + (nrec - 1 - i) * sizeof(off), &off, sizeof(off));
+		cfsnapshot_put_sainfo(&b, w.sainfos[i]);
+	}
+	if (b.error)
+		goto end;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CFSNAPSHOT_MAGIC;
+	hdr.version = CFSNAPSHOT_VERSION;
+	hdr.layout = cfsnapshot_layout();
+	hdr.nsources = cfsnapshot_nsources();
+	hdr.nrmconf = w.nrmconf;
+	hdr.nsainfo = w.nsainfo;
+	hdr.length = b.len;
+	hdr.checksum = cfsnapshot_sum(b.p, b.len);
+
+	/* it holds pre-shared keys: write it aside, owner only, then rename */
+	if ((path = cfsnapshot_path(conf, "")) == NULL
+	 || (tmp = cfsnapshot_path(conf, ".tmp")) == NULL)
+		goto end;
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		plog(ASL_LEVEL_ERR,
+			"cannot create configuration snapshot %s: %s\n",
+			tmp, strerror(errno));
+		goto end;
+	}
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+	 || write(fd, b.p, b.len) != (ssize_t)b.len
+	 || fsync(fd) != 0) {
+		plog(ASL_LEVEL_ERR,
+			"cannot write configuration snapshot %s: %s\n",
+			tmp, strerror(errno));
+		goto end;
+	}
+	if (rename(tmp, path) != 0) {
+		plog(ASL_LEVEL_ERR,
+			"cannot rename configuration snapshot to %s: %s\n",
+			path, strerror(errno));
+		goto end;
+	}
+
+	/*
+	 * that changed the directory it is in: where an include depends
+	 * on that directory, record it as it is now.
+	 */
+	cfsnapshot_dirname(path, dir, sizeof(dir));
+	if (cfsnapshot_refresh(dir) > 0) {
+		cfsnapshot_sources_put(b.p);
+		hdr.checksum = cfsnapshot_sum(b.p, b.len);
+		if (pwrite(fd, b.p, b.len, sizeof(hdr)) != (ssize_t)b.len
+		 || pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+		 || fsync(fd) != 0)
+			plog(ASL_LEVEL_ERR,
+				"cannot write configuration snapshot %s: %s\n",
+				path, strerror(errno));
+	}
+	close(fd);
+	fd = -1;
+
+	plog(ASL_LEVEL_NOTICE,
+		"configuration snapshot %s written: %d remote, %d sainfo, %zu bytes.\n",
+		path, w.nrmconf, w.nsainfo, sizeof(hdr) + b.len);
+	error = 0;
+
+end:
+	if (fd >= 0) {
+		close(fd);
+		unlink(tmp);
+	}
+	if (b.error)
+		plog(ASL_LEVEL_ERR,
+			"cannot build configuration snapshot: %s\n", strerror(b.error));
+	if (b.p)
+		racoon_free(b.p);
+	if (refs)
+		racoon_free(refs);
+	if (w.rmconfs)
+		racoon_free(w.rmconfs);
+	if (w.sainfos)
+		racoon_free(w.sainfos);
+	if (path)
+		racoon_free(path);
+	if (tmp)
+		racoon_free(tmp);
+	return error;
+}
+
+/* %%%
+ * reading
+ */
+static const u_int8_t *
+get(struct cfsnapshot_cur *c, size_t len)
+{
+	const u_int8_t *p;
+
+	if (c->error || (size_t)(c->end - c->p) < len) {
+		c->error = 1;
+		return NULL;
+	}
+	p = c->p;
+	c->p += len;
+	return p;
+}
+
+static u_int32_t
+get32(struct cfsnapshot_cur *c)
+{
+	const u_int8_t *p;
+	u_int32_t v;
+
+	if ((p = get(c, sizeof(v))) == NULL)
+		return 0;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static u_int64_t
+get64(struct cfsnapshot_cur *c)
+{
+	const u_int8_t *p;
+	u_int64_t v;
+
+	if ((p = get(c, sizeof(v))) == NULL)
+		return 0;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* NULL for an absent value as well as on error: check c->error */
+static vchar_t *
+getvchar(struct cfsnapshot_cur *c)
+{
+	const u_int8_t *p;
+	u_int32_t len;
+	vchar_t *v;
+
+	len = get32(c);
+	if (c->error || len == CFSNAPSHOT_NULL)
+		return NULL;
+	if ((p = get(c, len)) == NULL)
+		return NULL;
+	if ((v = vmalloc(len)) == NULL) {
+		c->error = 1;
+		return NULL;
+	}
+	memcpy(v->v, p, len);
+	return v;
+}
+
+static struct sockaddr_storage *
+getaddr(struct cfsnapshot_cur *c)
+{
+	struct sockaddr_storage *ss;
+	const u_int8_t *p;
+	u_int32_t len;
+
+	len = get32(c);
+	if (c->error || len == CFSNAPSHOT_NULL)
+		return NULL;
+	if (len != sizeof(*ss) || (p = get(c, len)) == NULL) {
+		c->error = 1;
+		return NULL;
+	}
+	if ((ss = racoon_malloc(sizeof(*ss))) == NULL) {
+		c->error = 1;
+		return NULL;
+	}
+	memcpy(ss, p, sizeof(*ss));
+	return ss;
+}
+
+static void
+getfields(struct cfsnapshot_cur *c, void *obj,
+	const struct cfsnapshot_field *t, int n)
+{
+	const u_int8_t *p;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if ((p = get(c, t[i].len)) == NULL)
+			return;
+		memcpy((u_int8_t *)obj + t[i].off, p, t[i].len);
+	}
+}
+
+/*
+ * a count of records, each at least min bytes long: refuse one the
+ * rest of the snapshot cannot hold, before allocating for it.
+ */
+static u_int32_t
+getcount(struct cfsnapshot_cur *c, size_t min)
+{
+	u_int32_t n;
+
+	n = get32(c);
+	if (!c->error && min > 0 && n > (size_t)(c->end - c->p) / min)
+		c->error = 1;
+	return c->error ? 0 : n;
+}
+
+/*
+ * a remote section, as far as looking it up needs: its plain values
+ * and addresses.  The rest stays in the snapshot, at p->snapshot, until
+ * cfsnapshot_rmconf().
+ */
+static struct remoteconf *
+cfsnapshot_get_rmconf(struct cfsnapshot_cur *c)
+{
+	struct remoteconf *p;
+
+	if ((p = create_rmconf()) == NULL) {
+		c->error = 1;
+		return NULL;
+	}
+	getfields(c, p, rmconf_fields, ARRAYLEN(rmconf_fields));
+	p->remote = getaddr(c);
+	p->forced_local = getaddr(c);
+
+	if (c->error || p->remote == NULL) {
+		c->error = 1;
+		delrmconf(p);
+		return NULL;
+	}
+	p->snapshot = c->p;
+	return p;
+}
+
+/*
+ * read what cfsnapshot_get_rmconf() left in the snapshot, the first
+ * time p is looked up or dumped.  It is read into a scratch section
+ * and moved over once it is all there, so p is unchanged on failure.
+ * returns 0 once p is complete.
+ */
+int
+cfsnapshot_rmconf(struct remoteconf *p)
+{
+	struct cfsnapshot_cur c;
+	struct remoteconf *t;
+	struct etypes *e, **ep;
+	struct isakmpsa *sa;
+	struct idspec *id;
+	struct genlist *idvl;
+	u_int32_t i, n;
+
+	if (p->snapshot == NULL)
+		return 0;
+	if ((t = create_rmconf()) == NULL)
+		return -1;
+	c.p = p->snapshot;
+	c.end = cfsnapshot_end;
+	c.error = 0;
+
+	n = getcount(&c, sizeof(u_int32_t));
+	for (i = 0, ep = &t->etypes; i < n && !c.error; i++) {
+		if ((e = racoon_calloc(1, sizeof(*e))) == NULL) {
+			c.error = 1;
+			break;
+		}
+		e->type = (int)get32(&c);
+		*ep = e;
+		ep = &e->next;
+	}
+
+	t->idv = getvchar(&c);
+	t->key = getvchar(&c);
+	t->keychainCertRef = getvchar(&c);
+	t->shared_secret = getvchar(&c);
+	t->open_dir_auth_group = getvchar(&c);
+
+	n = getcount(&c, 2 * sizeof(u_int32_t));
+	for (i = 0; i < n && !c.error; i++) {
+		if ((id = newidspec()) == NULL) {
+			c.error = 1;
+			break;
+		}
+		id->idtype = (int)get32(&c);
+		id->id = getvchar(&c);
+		genlist_append(t->idvl_p, id);
+	}
+
+	n = getcount(&c, 1);
+	for (i = 0; i < n && !c.error; i++) {
+		if ((sa = newisakmpsa()) == NULL) {
+			c.error = 1;
+			break;
+		}
+		getfields(&c, sa, isakmpsa_fields, ARRAYLEN(isakmpsa_fields));
+		insisakmpsa(sa, t);
+	}
+
+	if (get32(&c) != 0) {
+#ifdef ENABLE_HYBRID
+		if (xauth_rmconf_used(&t->xauth) != 0)
+			c.error = 1;
+		else {
+			t->xauth->login = getvchar(&c);
+			t->xauth->pass = getvchar(&c);
+		}
+#else
+		c.error = 1;
+#endif
+	}
+
+	n = get32(&c);
+	if (n != CFSNAPSHOT_NULL) {
+		if (n >= cfsnapshot_nrmconf)
+			c.error = 1;
+		else
+			t->inherited_from = cfsnapshot_rmconfs[n];
+	}
+
+	/* as the remote_specs_block rule does */
+	if (!c.error && p->dh_group != 0
+	 && check_etypeok(t, ISAKMP_ETYPE_AGG) != NULL
+	 && oakley_setdhgroup(p->dh_group, &t->dhgrp) < 0)
+		c.error = 1;
+
+	if (c.error || t->proposal == NULL) {
+		plog(ASL_LEVEL_ERR,
+			"cannot read remote %s from the configuration snapshot.\n",
+			saddrwop2str((struct sockaddr *)p->remote));
+		delrmconf(t);
+		return -1;
+	}
+
+	p->etypes = t->etypes;
+	t->etypes = NULL;
+	p->idv = t->idv;
+	t->idv = NULL;
+	p->key = t->key;
+	t->key = NULL;
+	p->keychainCertRef = t->keychainCertRef;
+	t->keychainCertRef = NULL;
+	p->shared_secret = t->shared_secret;
+	t->shared_secret = NULL;
+	p->open_dir_auth_group = t->open_dir_auth_group;
+	t->open_dir_auth_group = NULL;
+	idvl = p->idvl_p;
+	p->idvl_p = t->idvl_p;
+	t->idvl_p = idvl;
+	p->proposal = t->proposal;
+	t->proposal = NULL;
+	memcpy(p->propindex, t->propindex, sizeof(p->propindex));
+	for (sa = p->proposal; sa != NULL; sa = sa->next)
+		sa->rmconf = p;
+#ifdef ENABLE_HYBRID
+	p->xauth = t->xauth;
+	t->xauth = NULL;
+#endif
+	p->dhgrp = t->dhgrp;
+	t->dhgrp = NULL;
+	p->inherited_from = t->inherited_from;
+	p->snapshot = NULL;
+
+	delrmconf(t);
+	return 0;
+}
+
+/*
+ * an sainfo section, with the IDs it is looked up by; its algorithms
+ * stay in the snapshot until cfsnapshot_sainfo().
+ */
+static struct sainfo *
+cfsnapshot_get_sainfo(struct cfsnapshot_cur *c)
+{
+	struct sainfo *s;
+	vchar_t *group;
+
+	if ((s = create_sainfo()) == NULL) {
+		c->error = 1;
+		return NULL;
+	}
+	getfields(c, s, sainfo_fields, ARRAYLEN(sainfo_fields));
+	s->idsrc = getvchar(c);
+	s->iddst = getvchar(c);
+	s->id_i = getvchar(c);
+	group = getvchar(c);
+#ifdef ENABLE_HYBRID
+	s->group = group;
+#else
+	if (group != NULL) {
+		vfree(group);
+		c->error = 1;
+	}
+#endif
+
+	if (c->error) {
+		delsainfo(s);
+		return NULL;
+	}
+	s->snapshot = c->p;
+	return s;
+}
+
+/*
+ * read the algorithms of s, the first time it is looked up.
+ * returns 0 once s is complete.
+ */
+int
+cfsnapshot_sainfo(struct sainfo *s)
+{
+	struct cfsnapshot_cur c;
+	struct sainfoalg *algs[MAXALGCLASS];
+	struct sainfoalg *a;
+	u_int32_t j, n;
+	int i;
+
+	if (s->snapshot == NULL)
+		return 0;
+	c.p = s->snapshot;
+	c.end = cfsnapshot_end;
+	c.error = 0;
+
+	memset(algs, 0, sizeof(algs));
+	for (i = 0; i < MAXALGCLASS && !c.error; i++) {
+		n = getcount(&c, 2 * sizeof(u_int32_t));
+		for (j = 0; j < n && !c.error; j++) {
+			if ((a = newsainfoalg()) == NULL) {
+				c.error = 1;
+				break;
+			}
+			a->alg = (int)get32(&c);
+			a->encklen = (int)get32(&c);
+			inssainfoalg(&algs[i], a);
+		}
+	}
+
+	if (c.error) {
+		plog(ASL_LEVEL_ERR,
+			"cannot read sainfo from the configuration snapshot.\n");
+		for (i = 0; i < MAXALGCLASS; i++)
+			delsainfoalg(algs[i]);
+		return -1;
+	}
+	memcpy(s->algs, algs, sizeof(s->algs));
+	s->snapshot = NULL;
+	return 0;
+}
+
+/*
+ * returns 0 if the remote and sainfo sections were loaded from the
+ * snapshot, in which case the parse that follows must skip them.
+ *
+ * Only what lookups compare is read here, each record found through
+ * the index that follows the sources; the rest is read in place, from
+ * the mapping, when a section is first used.  The mapping stays until
+ * cfsnapshot_release().
+ */
+int
+cfsnapshot_load(const char *conf)
+{
+	struct cfsnapshot_hdr hdr;
+	struct cfsnapshot_cur c, ic;
+	struct sainfo *s;
+	struct stat st;
+	const u_int8_t *body, *index;
+	u_int64_t off, next;
+	char *path = NULL;
+	void *map = MAP_FAILED;
+	u_int32_t i, nrec;
+	int fd = -1, error = -1;
+
+	cfsnapshot_loaded = 0;
+	cfsnapshot_release();
+
+	if ((path = cfsnapshot_path(conf, "")) == NULL)
+		goto end;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto end;		/* none yet */
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(hdr))
+		goto bad;
+	/* it holds secrets: ignore one that others could have written */
+	if (st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+		goto bad;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto bad;
+	memcpy(&hdr, map, sizeof(hdr));
+	if (hdr.magic != CFSNAPSHOT_MAGIC
+	 || hdr.version != CFSNAPSHOT_VERSION
+	 || hdr.layout != cfsnapshot_layout()
+	 || hdr.length != (u_int64_t)st.st_size - sizeof(hdr))
+		goto bad;
+	body = (const u_int8_t *)map + sizeof(hdr);
+	c.p = body;
+	c.end = body + hdr.length;
+	c.error = 0;
+	if (cfsnapshot_sum(c.p, hdr.length) != hdr.checksum)
+		goto bad;
+
+	if (cfsnapshot_sources_check(&c.p, c.end, hdr.nsources, conf) != 0)
+		goto end;		/* stale, not broken */
+
+	nrec = hdr.nrmconf + hdr.nsainfo;
+	if (nrec < hdr.nrmconf
+	 || nrec > (size_t)(c.end - c.p) / sizeof(u_int64_t)
+	 || (index = get(&c, nrec * sizeof(u_int64_t))) == NULL)
+		goto bad;
+
+	if (hdr.nrmconf > 0) {
+		cfsnapshot_rmconfs = racoon_calloc(hdr.nrmconf, sizeof(*cfsnapshot_rmconfs));
+		if (cfsnapshot_rmconfs == NULL)
+			goto end;
+	}
+	if (hdr.nsainfo > 0) {
+		cfsnapshot_sainfos = racoon_calloc(hdr.nsainfo, sizeof(*cfsnapshot_sainfos));
+		if (cfsnapshot_sainfos == NULL)
+			goto undo;
+	}
+	cfsnapshot_map = map;
+	cfsnapshot_maplen = st.st_size;
+	cfsnapshot_end = c.end;
+
+	/* records in order, between the index and the end */
+	ic.p = index;
+	ic.end = c.p;
+	ic.error = 0;
+	off = nrec ? get64(&ic) : 0;
+	if (nrec && off != (u_int64_t)(c.p - body))
+		goto undo;
+	for (i = 0; i < nrec; i++, off = next) {
+		next = i + 1 < nrec ? get64(&ic) : hdr.length;
+		if (next < off || next > hdr.length)
+			goto undo;
+		c.p = body + off;
+		c.end = body + next;
+
+		if (i < hdr.nrmconf) {
+			if ((cfsnapshot_rmconfs[i] = cfsnapshot_get_rmconf(&c)) == NULL)
+				goto undo;
+			insrmconf(cfsnapshot_rmconfs[i]);
+			cfsnapshot_nrmconf = i + 1;
+		} else {
+			if ((s = cfsnapshot_get_sainfo(&c)) == NULL)
+				goto undo;
+			inssainfo(s);
+			cfsnapshot_sainfos[i - hdr.nrmconf] = s;
+			cfsnapshot_nsainfo = i - hdr.nrmconf + 1;
+		}
+	}
+
+	plog(ASL_LEVEL_NOTICE,
+		"loaded %u remote and %u sainfo sections from configuration snapshot %s.\n",
+		hdr.nrmconf, hdr.nsainfo, path);
+	cfsnapshot_loaded = 1;
+	map = MAP_FAILED;		/* cfsnapshot_release() unmaps it */
+	error = 0;
+	goto end;
+
+undo:
+	flushrmconf();
+	flushsainfo();
+	cfsnapshot_nrmconf = 0;
+	cfsnapshot_nsainfo = 0;
+	cfsnapshot_map = MAP_FAILED;
+	cfsnapshot_release();
+bad:
+	plog(ASL_LEVEL_WARNING,
+		"ignoring bad configuration snapshot %s.\n", path);
+end:
+	if (map != MAP_FAILED)
+		munmap(map, st.st_size);
+	if (fd >= 0)
+		close(fd);
+	if (path)
+		racoon_free(path);
+	return error;
+}
+
+/*
+ * read whatever is still left in the snapshot and unmap it, before a
+ * reload compares the sections with the ones it parses.  A section
+ * that cannot be read is left without proposals or algorithms, so the
+ * reload replaces it.
+ */
+void
+cfsnapshot_release(void)
+{
+	u_int32_t i;
+
+	for (i = 0; i < cfsnapshot_nrmconf; i++) {
+		if (cfsnapshot_rmconf(cfsnapshot_rmconfs[i]) != 0)
+			cfsnapshot_rmconfs[i]->snapshot = NULL;
+	}
+	for (i = 0; i < cfsnapshot_nsainfo; i++) {
+		if (cfsnapshot_sainfo(cfsnapshot_sainfos[i]) != 0)
+			cfsnapshot_sainfos[i]->snapshot = NULL;
+	}
+
+	if (cfsnapshot_rmconfs) {
+		racoon_free(cfsnapshot_rmconfs);
+		cfsnapshot_rmconfs = NULL;
+	}
+	if (cfsnapshot_sainfos) {
+		racoon_free(cfsnapshot_sainfos);
+		cfsnapshot_sainfos = NULL;
+	}
+	cfsnapshot_nrmconf = 0;
+	cfsnapshot_nsainfo = 0;
+	if (cfsnapshot_map != MAP_FAILED)
+		munmap(cfsnapshot_map, cfsnapshot_maplen);
+	cfsnapshot_map = MAP_FAILED;
+	cfsnapshot_maplen = 0;
+	cfsnapshot_end = NULL;
+}
+
+/*
+ * the parse that went with cfsnapshot_load() is over.
+ */
+void
+cfsnapshot_done(void)
+{
+	cfsnapshot_loaded = 0;
+}
+
+int
+cfsnapshot_skipping(void)
+{
+	return cfsnapshot_loaded;
+}
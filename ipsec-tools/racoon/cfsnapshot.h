@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _CFSNAPSHOT_H
+#define _CFSNAPSHOT_H
+
+/*
+ * Compiled configuration snapshot.
+ *
+ * After racoon.conf has been parsed in full, its remote and sainfo
+ * sections (proposals included) are written to "<racoon.conf>.snapshot"
+ * in a binary form, with the path, inode, size and modification time of
+ * every file the parse read, and of the directory of every include,
+ * whether it matched any file or not (cfsnapshot_src.c).
+ * At the next start, if none of those changed, the snapshot is mapped
+ * and the parser skips the remote and sainfo sections of the text; the
+ * rest of racoon.conf is parsed as always.  Otherwise the text is
+ * parsed in full and the snapshot written again.  "racoon -c" only
+ * compiles the snapshot.
+ *
+ * A section loaded from the snapshot holds only what lookups compare
+ * (addresses, plain values, sainfo IDs); the rest is read from the
+ * mapping the first time getrmconf() or getsainfo() returns it
+ * (cfsnapshot_rmconf(), cfsnapshot_sainfo()), so start-up does not
+ * pay for sections no peer uses.  A reload reads all of them first
+ * and unmaps the snapshot (cfsnapshot_release()).
+ *
+ * The snapshot is versioned and checksummed, and records the layout of
+ * the structures it was written from, so a racoon built differently
+ * does not use it.
+ */
+#define CFSNAPSHOT_SUFFIX	".snapshot"
+
+extern int cfsnapshot_load (const char *);
+extern int cfsnapshot_write (const char *);
+extern void cfsnapshot_done (void);
+extern int cfsnapshot_skipping (void);
+extern void cfsnapshot_release (void);
+
+struct remoteconf;
+struct sainfo;
+extern int cfsnapshot_rmconf (struct remoteconf *);
+extern int cfsnapshot_sainfo (struct sainfo *);
+
+/* the files and directories the parse depended on */
+extern void cfsnapshot_reset (void);
+extern void cfsnapshot_source (const char *, int);
+extern void cfsnapshot_include (const char *);
+extern int cfsnapshot_nsources (void);
+extern const char *cfsnapshot_source_path (int);
+extern int cfsnapshot_refresh (const char *);
+extern void cfsnapshot_dirname (const char *, char *, size_t);
+extern size_t cfsnapshot_sources_size (void);
+extern void cfsnapshot_sources_put (u_int8_t *);
+extern int cfsnapshot_sources_check (const u_int8_t **, const u_int8_t *,
+	u_int32_t, const char *);
+
+#endif /* _CFSNAPSHOT_H */
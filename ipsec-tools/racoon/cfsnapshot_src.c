@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * The files and directories a configuration snapshot was built from.
+ * Kept apart from cfsnapshot.c so that it can be tested on its own.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glob.h>
+
+#include "var.h"
+#include "plog.h"
+#include "gcmalloc.h"
+#include "cfsnapshot.h"
+
+#define CFSNAPSHOT_FILE		0
+#define CFSNAPSHOT_DIR		1
+#define CFSNAPSHOT_ABSENT	2	/* a directory that does not exist */
+
+/* a file or directory the parse depended on */
+struct cfsnapshot_src {
+	char *path;
+	u_int32_t kind;
+	u_int64_t ino;
+	u_int64_t size;
+	int64_t mtime;
+	int64_t mtime_nsec;
+};
+
+/* length, path, kind, ino, size, mtime, mtime_nsec */
+#define CFSNAPSHOT_SRCLEN(len)	(4 + (len) + 4 + 4 * 8)
+
+static struct cfsnapshot_src *cfsnapshot_srcs;
+static int cfsnapshot_nsrcs;
+
+void
+cfsnapshot_reset(void)
+{
+	int i;
+
+	for (i = 0; i < cfsnapshot_nsrcs; i++)
+		racoon_free(cfsnapshot_srcs[i].path);
+	if (cfsnapshot_srcs)
+		racoon_free(cfsnapshot_srcs);
+	cfsnapshot_srcs = NULL;
+	cfsnapshot_nsrcs = 0;
+}
+
+static void
+cfsnapshot_set(struct cfsnapshot_src *n, const struct stat *st)
+{
+	if (st == NULL) {
+		n->kind = CFSNAPSHOT_ABSENT;
+		n->ino = n->size = 0;
+		n->mtime = n->mtime_nsec = 0;
+		return;
+	}
+	n->kind = S_ISDIR(st->st_mode) ? CFSNAPSHOT_DIR : CFSNAPSHOT_FILE;
+	n->ino = st->st_ino;
+	n->size = st->st_size;
+	n->mtime = st->st_mtimespec.tv_sec;
+	n->mtime_nsec = st->st_mtimespec.tv_nsec;
+}
+
+/* st is NULL for a directory found absent */
+static void
+cfsnapshot_add(const char *path, const struct stat *st)
+{
+	struct cfsnapshot_src *n;
+	int i;
+
+	if (cfsnapshot_nsrcs < 0)
+		return;
+	for (i = 0; i < cfsnapshot_nsrcs; i++) {
+		if (strcmp(cfsnapshot_srcs[i].path, path) == 0)
+			return;
+	}
+	n = racoon_realloc(cfsnapshot_srcs, (cfsnapshot_nsrcs + 1) * sizeof(*n));
+	if (n == NULL)
+		goto fail;
+	cfsnapshot_srcs = n;
+	n = &cfsnapshot_srcs[cfsnapshot_nsrcs];
+	if ((n->path = racoon_strdup(path)) == NULL)
+		goto fail;
+	cfsnapshot_set(n, st);
+	cfsnapshot_nsrcs++;
+	return;
+
+fail:
+	/* without a complete list, a snapshot can't be told current */
+	cfsnapshot_reset();
+	cfsnapshot_nsrcs = -1;
+}
+
+static void
+cfsnapshot_adddir(const char *dir)
+{
+	struct stat st;
+
+	if (stat(dir, &st) == 0)
+		cfsnapshot_add(dir, &st);
+	else if (errno == ENOENT || errno == ENOTDIR)
+		cfsnapshot_add(dir, NULL);
+	else {
+		cfsnapshot_reset();
+		cfsnapshot_nsrcs = -1;
+	}
+}
+
+void
+cfsnapshot_dirname(const char *path, char *dir, size_t len)
+{
+	char *p;
+
+	strlcpy(dir, path, len);
+	if ((p = strrchr(dir, '/')) == NULL)
+		strlcpy(dir, ".", len);
+	else if (p == dir)
+		p[1] = '\0';
+	else
+		*p = '\0';
+}
+
+/*
+ * fd is open on path, a file the parse reads.
+ */
+void
+cfsnapshot_source(const char *path, int fd)
+{
+	struct stat st;
+
+	if (cfsnapshot_nsrcs < 0)
+		return;
+	if (fstat(fd, &st) != 0) {
+		cfsnapshot_reset();
+		cfsnapshot_nsrcs = -1;
+		return;
+	}
+	cfsnapshot_add(path, &st);
+}
+
+/*
+ * an include of pattern, whatever it matched, even nothing: the
+ * directory a new match would be added to is recorded, so that the
+ * snapshot is out of date once one is.  Where the directory part has
+ * wildcards itself, that is the directory before the first of them,
+ * along with every directory they now match.
+ */
+void
+cfsnapshot_include(const char *pattern)
+{
+	char dir[MAXPATHLEN], home[MAXPATHLEN];
+	char *p, *wild;
+	glob_t g;
+	size_t i;
+
+	if (cfsnapshot_nsrcs < 0)
+		return;
+	cfsnapshot_dirname(pattern, dir, sizeof(dir));
+
+	/* ~ and ~user, as the lexer's GLOB_TILDE expands them */
+	if (dir[0] == '~') {
+		strlcpy(home, dir, sizeof(home));
+		if ((p = strchr(home, '/')) != NULL)
+			*p = '\0';
+		memset(&g, 0, sizeof(g));
+		if (glob(home, GLOB_TILDE, NULL, &g) != 0 || g.gl_pathc != 1) {
+			globfree(&g);
+			goto unknown;
+		}
+		p = strchr(dir, '/');
+		strlcpy(home, g.gl_pathv[0], sizeof(home));
+		if (p != NULL)
+			strlcat(home, p, sizeof(home));
+		globfree(&g);
+		strlcpy(dir, home, sizeof(dir));
+	}
+
+	if ((wild = strpbrk(dir, "*?[")) == NULL) {
+		cfsnapshot_adddir(dir);
+		return;
+	}
+
+	memset(&g, 0, sizeof(g));
+	if (glob(dir, 0, NULL, &g) == 0) {
+		for (i = 0; i < g.gl_pathc; i++)
+			cfsnapshot_adddir(g.gl_pathv[i]);
+	}
+	globfree(&g);
+
+	*wild = '\0';
+	if ((p = strrchr(dir, '/')) == NULL)
+		strlcpy(dir, ".", sizeof(dir));
+	else if (p == dir)
+		p[1] = '\0';
+	else
+		*p = '\0';
+	cfsnapshot_adddir(dir);
+	return;
+
+unknown:
+	cfsnapshot_reset();
+	cfsnapshot_nsrcs = -1;
+}
+
+/*
+ * -1 when a source could not be recorded.
+ */
+int
+cfsnapshot_nsources(void)
+{
+	return cfsnapshot_nsrcs;
+}
+
+const char *
+cfsnapshot_source_path(int i)
+{
+	if (i < 0 || i >= cfsnapshot_nsrcs)
+		return NULL;
+	return cfsnapshot_srcs[i].path;
+}
+
+/*
+ * take the directory dir as it is now, for it has been written to
+ * since it was read; returns the number of entries updated.
+ */
+int
+cfsnapshot_refresh(const char *dir)
+{
+	struct stat st;
+	int i, n = 0;
+
+	for (i = 0; i < cfsnapshot_nsrcs; i++) {
+		if (cfsnapshot_srcs[i].kind == CFSNAPSHOT_FILE
+		 || strcmp(cfsnapshot_srcs[i].path, dir) != 0)
+			continue;
+		if (stat(dir, &st) != 0)
+			return -1;
+		cfsnapshot_set(&cfsnapshot_srcs[i], &st);
+		n++;
+	}
+	return n;
+}
+
+/* %%%
+ * in the snapshot, where they come first: the same length whatever
+ * the values, so that they can be rewritten in place
+ */
+size_t
+cfsnapshot_sources_size(void)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < cfsnapshot_nsrcs; i++)
+		len += CFSNAPSHOT_SRCLEN(strlen(cfsnapshot_srcs[i].path));
+	return len;
+}
+
+static u_int8_t *
+put(u_int8_t *p, const void *v, size_t len)
+{
+	memcpy(p, v, len);
+	return p + len;
+}
+
+void
+cfsnapshot_sources_put(u_int8_t *p)
+{
+	struct cfsnapshot_src *s;
+	u_int32_t len;
+	int i;
+
+	for (i = 0; i < cfsnapshot_nsrcs; i++) {
+		s = &cfsnapshot_srcs[i];
+		len = (u_int32_t)strlen(s->path);
+		p = put(p, &len, sizeof(len));
+		p = put(p, s->path, len);
+		p = put(p, &s->kind, sizeof(s->kind));
+		p = put(p, &s->ino, sizeof(s->ino));
+		p = put(p, &s->size, sizeof(s->size));
+		p = put(p, &s->mtime, sizeof(s->mtime));
+		p = put(p, &s->mtime_nsec, sizeof(s->mtime_nsec));
+	}
+}
+
+/*
+ * the snapshot is current if every file and directory it was built
+ * from is still the same.  *pp is moved past the sources; the first
+ * of them must be conf.
+ */
+int
+cfsnapshot_sources_check(const u_int8_t **pp, const u_int8_t *end,
+	u_int32_t nsources, const char *conf)
+{
+	struct cfsnapshot_src s;
+	char path[MAXPATHLEN];
+	const u_int8_t *p = *pp;
+	struct stat st;
+	u_int32_t i, len;
+	int changed;
+
+	for (i = 0; i < nsources; i++) {
+		if ((size_t)(end - p) < sizeof(len))
+			return -1;
+		memcpy(&len, p, sizeof(len));
+		if (len >= sizeof(path) ||
+		    (size_t)(end - p) < CFSNAPSHOT_SRCLEN(len))
+			return -1;
+		p += sizeof(len);
+		memcpy(path, p, len);
+		path[len] = '\0';
+		p += len;
+		memcpy(&s.kind, p, sizeof(s.kind));
+		p += sizeof(s.kind);
+		memcpy(&s.ino, p, sizeof(s.ino));
+		p += sizeof(s.ino);
+		memcpy(&s.size, p, sizeof(s.size));
+		p += sizeof(s.size);
+		memcpy(&s.mtime, p, sizeof(s.mtime));
+		p += sizeof(s.mtime);
+		memcpy(&s.mtime_nsec, p, sizeof(s.mtime_nsec));
+		p += sizeof(s.mtime_nsec);
+
+		if (i == 0 && strcmp(path, conf) != 0)
+			return -1;		/* built from another file */
+		if (stat(path, &st) != 0)
+			changed = s.kind != CFSNAPSHOT_ABSENT;
+		else
+			changed = s.kind == CFSNAPSHOT_ABSENT
+			 || (S_ISDIR(st.st_mode) != 0) != (s.kind == CFSNAPSHOT_DIR)
+			 || (u_int64_t)st.st_ino != s.ino
+			 || (s.kind == CFSNAPSHOT_FILE && (u_int64_t)st.st_size != s.size)
+			 || (int64_t)st.st_mtimespec.tv_sec != s.mtime
+			 || (int64_t)st.st_mtimespec.tv_nsec != s.mtime_nsec;
+		if (changed) {
+			plog(ASL_LEVEL_NOTICE,
+				"configuration snapshot is out of date: %s changed.\n", path);
+			return -1;
+		}
+	}
+	*pp = p;
+	return 0;
+}
@@ -71,6 +71,9 @@
 #include "gcmalloc.h"
 #include "nattraversal.h"
 
+/* 0 is never used, so a zeroed struct sendsock is always stale */
+u_int32_t myaddrs_gen = 1;
+
 #ifndef HAVE_GETIFADDRS
 static unsigned int if_maxindex (void);
 #endif
@@ -80,6 +83,10 @@ static int suitable_ifaddr (const char *, const struct sockaddr *);
 static int suitable_ifaddr6 (const char *, const struct sockaddr *);
 #endif
 
+static dispatch_source_t myaddrs_rescan_source;
+static int myaddrs_settling;		/* a commit is pending */
+static int myaddrs_lost;			/* a change could not be applied */
+
 #ifndef HAVE_GETIFADDRS
 static unsigned int
 if_maxindex()
@@ -97,12 +104,120 @@ if_maxindex()
 }
 #endif
 
+#ifdef INET6
+/*
+ * The address and scope of a link-local address, whether the scope is
+ * in sin6_scope_id or, as the kernel hands it out, in the address.
+ */
+static void
+myaddr_in6(const struct sockaddr_in6 *sin6, struct in6_addr *addr,
+	u_int32_t *scope)
+{
+	*addr = sin6->sin6_addr;
+	*scope = sin6->sin6_scope_id;
+	if (IN6_IS_ADDR_LINKLOCAL(addr) || IN6_IS_ADDR_MC_LINKLOCAL(addr)) {
+		if (*scope == 0)
+			*scope = (addr->s6_addr[2] << 8) | addr->s6_addr[3];
+		addr->s6_addr[2] = addr->s6_addr[3] = 0;
+	}
+}
+#endif
+
+/*
+ * myaddrs are hashed and compared by address alone, never the port.
+ */
+static u_int
+myaddr_hashval(const struct sockaddr *sa)
+{
+	u_int32_t h = 0;
+#ifdef INET6
+	struct in6_addr a6;
+	u_int32_t w[4];
+	int i;
+#endif
+
+	switch (sa->sa_family) {
+	case AF_INET:
+		h = (ALIGNED_CAST(const struct sockaddr_in *)sa)->sin_addr.s_addr;
+		break;
+#ifdef INET6
+	case AF_INET6:
+		myaddr_in6(ALIGNED_CAST(const struct sockaddr_in6 *)sa, &a6, &h);
+		memcpy(w, &a6, sizeof(w));
+		for (i = 0; i < 4; i++)
+			h ^= w[i];
+		break;
+#endif
+	}
+	h ^= h >> 16;
+	h ^= h >> 8;
+
+	return h % LC_MYADDRS_HASHSIZE;
+}
+
+static int
+myaddr_match(const struct sockaddr *a, const struct sockaddr *b)
+{
+#ifdef INET6
+	struct in6_addr a6, b6;
+	u_int32_t ascope, bscope;
+#endif
+
+	if (a->sa_family != b->sa_family)
+		return 0;
+
+	switch (a->sa_family) {
+	case AF_INET:
+		return (ALIGNED_CAST(const struct sockaddr_in *)a)->sin_addr.s_addr ==
+			(ALIGNED_CAST(const struct sockaddr_in *)b)->sin_addr.s_addr;
+#ifdef INET6
+	case AF_INET6:
+		myaddr_in6(ALIGNED_CAST(const struct sockaddr_in6 *)a, &a6, &ascope);
+		myaddr_in6(ALIGNED_CAST(const struct sockaddr_in6 *)b, &b6, &bscope);
+		return ascope == bscope && IN6_ARE_ADDR_EQUAL(&a6, &b6);
+#endif
+	default:
+		return 0;
+	}
+}
+
+static void
+myaddr_hash(struct myaddrs *p)
+{
+	struct myaddrs **head;
+
+	if (p->addr == NULL)
+		return;
+	head = &lcconf->myaddrs_hash[myaddr_hashval((struct sockaddr *)p->addr)];
+	p->hnext = *head;
+	*head = p;
+}
+
+static void
+myaddr_unhash(struct myaddrs *p)
+{
+	struct myaddrs **pp;
+
+	if (p->addr == NULL)
+		return;
+	for (pp = &lcconf->myaddrs_hash[myaddr_hashval((struct sockaddr *)p->addr)];
+	    *pp != NULL; pp = &(*pp)->hnext) {
+		if (*pp == p) {
+			*pp = p->hnext;
+			p->hnext = NULL;
+			return;
+		}
+	}
+}
+
 
 void
 clear_myaddr()
 {
 	struct myaddrs *p, *next;
 
+	myaddrs_gen++;
+
 	for (p = lcconf->myaddrs; p; p = next) {
 		next = p->next;
 
@@ -110,7 +225,7 @@ clear_myaddr()
 	}
 
 	lcconf->myaddrs = NULL;
-
+	memset(lcconf->myaddrs_hash, 0, sizeof(lcconf->myaddrs_hash));
 }
 
 
@@ -120,24 +235,12 @@ find_myaddr(addr, udp_encap)
 	int udp_encap;
 {
 	struct myaddrs *q;
-	char h1[NI_MAXHOST], h2[NI_MAXHOST];
-
-	if (getnameinfo(addr, sysdep_sa_len(addr), h1, sizeof(h1), NULL, 0,
-	    NI_NUMERICHOST | niflags) != 0)
-		return NULL;
 
-	for (q = lcconf->myaddrs; q; q = q->next) {
-		if (!q->addr)
-			continue;
+	for (q = lcconf->myaddrs_hash[myaddr_hashval(addr)]; q; q = q->hnext) {
 		if ((q->udp_encap && !udp_encap)
 			|| (!q->udp_encap && udp_encap))
 			continue;
-		if (addr->sa_family != q->addr->ss_family)
-			continue;
-		if (getnameinfo((struct sockaddr *)q->addr, sysdep_sa_len((struct sockaddr *)q->addr), h2, sizeof(h2),
-		    NULL, 0, NI_NUMERICHOST | niflags) != 0)
-			return NULL;
-		if (strcmp(h1, h2) == 0)
+		if (myaddr_match(addr, (struct sockaddr *)q->addr))
 			return q;
 	}
 
@@ -145,6 +248,85 @@ find_myaddr(addr, udp_encap)
 }
 
 
+/*
+ * mark an interface address in use, adding it (and its NAT-T twin) to
+ * lcconf->myaddrs if it is new.
+ */
+static void
+grab_myaddr(const char *ifname, struct sockaddr *addr)
+{
+	struct myaddrs *p, *q;
+	char addr1[NI_MAXHOST];
+
+	p = find_myaddr(addr, 0);
+	if (p) {
+		p->in_use = 1;
+#ifdef ENABLE_NATT
+		q = find_myaddr(addr, 1);
+		if (q)
+			q->in_use = 1;
+		else if (natt_enabled_in_rmconf ()) {
+			q = dupmyaddr(p);
+			if (q == NULL) {
+				plog(ASL_LEVEL_ERR,
+					"unable to allocate space for natt addr.\n");
+				exit(1);
+			}
+			q->udp_encap = 1;
+		}
+#endif
+		return;
+	}
+
+	p = newmyaddr();
+	if (p == NULL) {
+		plog(ASL_LEVEL_ERR, 
+			"unable to allocate space for addr.\n");
+		exit(1);
+		/*NOTREACHED*/
+	}
+	p->addr = dupsaddr(ALIGNED_CAST(struct sockaddr_storage*)addr);
+	if (p->addr == NULL) {
+		plog(ASL_LEVEL_ERR, 
+			"unable to duplicate addr.\n");
+		exit(1);
+		/*NOTREACHED*/
+	}
+	p->ifname = racoon_strdup(ifname);
+	if (p->ifname == NULL) {
+		plog(ASL_LEVEL_ERR, 
+			"unable to duplicate ifname.\n");
+		exit(1);
+		/*NOTREACHED*/
+	}				
+	p->in_use = 1;
+
+	if (getnameinfo((struct sockaddr *)p->addr, p->addr->ss_len,
+			addr1, sizeof(addr1),
+			NULL, 0,
+			NI_NUMERICHOST | niflags))
+		strlcpy(addr1, "(invalid)", sizeof(addr1));
+	plog(ASL_LEVEL_DEBUG, 
+		"my interface: %s (%s)\n",
+		addr1, ifname);
+
+	p->next = lcconf->myaddrs;
+	lcconf->myaddrs = p;
+	myaddr_hash(p);
+
+#ifdef ENABLE_NATT
+	if (natt_enabled_in_rmconf ()) {
+		q = dupmyaddr(p);
+		if (q == NULL) {
+			plog(ASL_LEVEL_ERR, 
+				"unable to allocate space for natt addr.\n");
+			exit(1);
+		}
+		q->udp_encap = 1;
+	}
+#endif
+}
+
 // modified to avoid closing and opening sockets for
 // all interfaces each time an interface change occurs.
 // on return: 	addrcount = zero indicates address no longer used
@@ -152,11 +334,9 @@ find_myaddr(addr, udp_encap)
 void
 grab_myaddrs()
 {
-	struct myaddrs *p, *q;
+	struct myaddrs *p;
 	struct ifaddrs *ifa0, *ifap;
 
-	char addr1[NI_MAXHOST];
-
 	if (getifaddrs(&ifa0)) {
 		plog(ASL_LEVEL_ERR, 
 			"getifaddrs failed: %s\n", strerror(errno));
@@ -164,6 +344,8 @@ grab_myaddrs()
 		/*NOTREACHED*/
 	}
 
+	myaddrs_gen++;
+
 	// clear the in_use flag for each address in the list
 	for (p = lcconf->myaddrs; p; p = p->next)
 		p->in_use = 0;
@@ -185,72 +367,7 @@ grab_myaddrs()
 			continue;
 		}
 
-		p = find_myaddr(ifap->ifa_addr, 0);
-		if (p) {
-			p->in_use = 1;
-#ifdef ENABLE_NATT
-			q = find_myaddr(ifap->ifa_addr, 1);
-			if (q)
-				q->in_use = 1;
-            else if (natt_enabled_in_rmconf ()) {
-				q = dupmyaddr(p);
-				if (q == NULL) {
-					plog(ASL_LEVEL_ERR,
-                         "unable to allocate space for natt addr.\n");
-					exit(1);
-				}
-				q->udp_encap = 1;
-			}
-#endif				
-		} else {	
-			p = newmyaddr();
-			if (p == NULL) {
-				plog(ASL_LEVEL_ERR, 
-					"unable to allocate space for addr.\n");
-				exit(1);
-				/*NOTREACHED*/
-			}
-			p->addr = dupsaddr(ALIGNED_CAST(struct sockaddr_storage*)ifap->ifa_addr);
-			if (p->addr == NULL) {
-				plog(ASL_LEVEL_ERR, 
-					"unable to duplicate addr.\n");
-				exit(1);
-				/*NOTREACHED*/
-			}
-			p->ifname = racoon_strdup(ifap->ifa_name);
-			if (p->ifname == NULL) {
-				plog(ASL_LEVEL_ERR, 
-					"unable to duplicate ifname.\n");
-				exit(1);
-				/*NOTREACHED*/
-			}				
-			p->in_use = 1;
-
-			if (getnameinfo((struct sockaddr *)p->addr, p->addr->ss_len,
-					addr1, sizeof(addr1),
-					NULL, 0,
-					NI_NUMERICHOST | niflags))
-				strlcpy(addr1, "(invalid)", sizeof(addr1));
-			plog(ASL_LEVEL_DEBUG, 
-				"my interface: %s (%s)\n",
-				addr1, ifap->ifa_name);
-		
-			p->next = lcconf->myaddrs;
-			lcconf->myaddrs = p;
-			
-#ifdef ENABLE_NATT
-			if (natt_enabled_in_rmconf ()) {
-				q = dupmyaddr(p);
-				if (q == NULL) {
-					plog(ASL_LEVEL_ERR, 
-						"unable to allocate space for natt addr.\n");
-					exit(1);
-				}
-				q->udp_encap = 1;
-			}
-#endif
-
-		}
+		grab_myaddr(ifap->ifa_name, ifap->ifa_addr);
 	}
 
 	freeifaddrs(ifa0);
@@ -464,9 +581,11 @@ dupmyaddr(struct myaddrs *old)
 	}
     new->source = NULL;
     new->sock = -1;
+	new->hnext = NULL;
     
 	new->next = old->next;
 	old->next = new;
+	myaddr_hash(new);
 
 	return new;
 }
@@ -478,12 +597,15 @@ insmyaddr(new, head)
 {
 	new->next = *head;
 	*head = new;
+	if (head == &lcconf->myaddrs)
+		myaddr_hash(new);
 }
 
 void
 delmyaddr(myaddr)
 	struct myaddrs *myaddr;
 {
+	myaddr_unhash(myaddr);
 	if (myaddr->addr)
 		racoon_free(myaddr->addr);
 	if (myaddr->ifname)
@@ -518,11 +640,12 @@ initmyaddr(void)
 
 /* select the socket to be sent */
 /* should implement other method. */
-int
-getsockmyaddr(struct sockaddr *my)
+static struct myaddrs *
+lookup_sockmyaddr(struct sockaddr *my, int *exact)
 {
 	struct myaddrs *p, *lastresort = NULL;
 
+	*exact = 0;
 	for (p = lcconf->myaddrs; p; p = p->next) {
 		if (p->addr == NULL)
 			continue;
@@ -531,6 +654,7 @@ getsockmyaddr(struct sockaddr *my)
 		} else continue;
 		if (sysdep_sa_len(my) == sysdep_sa_len((struct sockaddr *)p->addr)
 		 && memcmp(my, p->addr, sysdep_sa_len(my)) == 0) {
+			*exact = 1;
 			break;
 		}
 	}
@@ -540,12 +664,160 @@ getsockmyaddr(struct sockaddr *my)
 		plog(ASL_LEVEL_ERR, 
 			"no socket matches address family %d\n",
 			my->sa_family);
-		return -1;
+		return NULL;
 	}
 
+	return p;
+}
+
+int
+getsockmyaddr(struct sockaddr *my)
+{
+	struct myaddrs *p;
+	int exact;
+
+	if ((p = lookup_sockmyaddr(my, &exact)) == NULL)
+		return -1;
+
 	return p->sock;
 }
 
+/*
+ * same as getsockmyaddr(), but the answer is kept in *ss and reused
+ * until the address list changes or the local address does (NAT-T
+ * port floating).
+ */
+int
+getsockmyaddr_cached(struct sockaddr *my, struct sendsock *ss)
+{
+	struct myaddrs *p;
+	int exact;
+
+	if (ss->gen == myaddrs_gen
+	 && sysdep_sa_len(my) == sysdep_sa_len((struct sockaddr *)&ss->addr)
+	 && memcmp(my, &ss->addr, sysdep_sa_len(my)) == 0)
+		return ss->sock;
+
+	ss->gen = 0;
+	if ((p = lookup_sockmyaddr(my, &exact)) == NULL)
+		return -1;
+
+	ss->sock = p->sock;
+	ss->family = p->addr->ss_family;
+	ss->exact = exact;
+	memcpy(&ss->addr, my, sysdep_sa_len(my));
+	/* an address without a socket yet is looked up again next time */
+	if (ss->sock != -1)
+		ss->gen = myaddrs_gen;
+
+	return ss->sock;
+}
+
+/*
+ * open and close sockets for the address changes of a burst of routing
+ * messages, once it has settled.
+ */
+static void
+myaddrs_commit(void)
+{
+	myaddrs_settling = 0;
+	if (myaddrs_lost) {
+		plog(ASL_LEVEL_DEBUG, 
+			 "address change could not be applied, rescanning\n");
+		myaddrs_lost = 0;
+		update_myaddrs(NULL);
+		return;
+	}
+	isakmp_close_unused();
+	autoconf_myaddrsport();
+	isakmp_open();
+}
+
+static void
+myaddrs_changed(void)
+{
+	if (myaddrs_settling)
+		return;
+	myaddrs_settling = 1;
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW,
+								 MYADDRS_SETTLE_MSEC * NSEC_PER_MSEC),
+				   dispatch_get_main_queue(),
+				   ^{
+					   myaddrs_commit();
+				   });
+}
+
+/* sockaddrs in routing messages are padded to 32 bits */
+#define PFROUTE_ROUNDUP(a) \
+	((a) > 0 ? (1 + (((a) - 1) | (sizeof(u_int32_t) - 1))) : sizeof(u_int32_t))
+
+/*
+ * apply one RTM_NEWADDR or RTM_DELADDR to lcconf->myaddrs.
+ */
+static int
+pfroute_addr(struct ifa_msghdr *ifam, int len)
+{
+	char *cp = (char *)(ifam + 1), *lim = (char *)ifam + len;
+	struct sockaddr *sa = NULL;
+	struct sockaddr_storage addr;
+	char ifname[IF_NAMESIZE];
+	struct myaddrs *p;
+	int i;
+
+	for (i = 0; i < RTAX_MAX; i++) {
+		if ((ifam->ifam_addrs & (1 << i)) == 0)
+			continue;
+		if (cp >= lim)
+			return -1;
+		sa = ALIGNED_CAST(struct sockaddr *)cp;
+		if (cp + PFROUTE_ROUNDUP(sa->sa_len) > lim)
+			return -1;
+		if (i == RTAX_IFA)
+			break;
+		cp += PFROUTE_ROUNDUP(sa->sa_len);
+		sa = NULL;
+	}
+	if (sa == NULL)
+		return -1;
+
+	switch (sa->sa_family) {
+	case AF_INET:
+		if (sa->sa_len < sizeof(struct sockaddr_in))
+			return -1;
+		break;
+#ifdef INET6
+	case AF_INET6:
+		if (sa->sa_len < sizeof(struct sockaddr_in6))
+			return -1;
+		break;
+#endif
+	default:
+		return 0;
+	}
+	memset(&addr, 0, sizeof(addr));
+	memcpy(&addr, sa, sa->sa_len);
+	sa = (struct sockaddr *)&addr;
+
+	if (ifam->ifam_type == RTM_NEWADDR) {
+		if (if_indextoname(ifam->ifam_index, ifname) == NULL)
+			return -1;
+		if (!suitable_ifaddr(ifname, sa)) {
+			plog(ASL_LEVEL_DEBUG, 
+				"unsuitable address: %s %s\n", ifname, saddrwop2str(sa));
+			return 0;
+		}
+		grab_myaddr(ifname, sa);
+	} else {
+		if ((p = find_myaddr(sa, 0)) != NULL)
+			p->in_use = 0;
+		if ((p = find_myaddr(sa, 1)) != NULL)
+			p->in_use = 0;
+	}
+	myaddrs_gen++;
+
+	return 0;
+}
+
 void
 pfroute_handler(void *unused)
 {   
@@ -557,41 +829,45 @@ pfroute_handler(void *unused)
 	
 	int len;
     
-	while((len = read(lcconf->rtsock, &msg, sizeof(msg))) < 0) {
-		if (errno == EINTR)
-			continue;
-		plog(ASL_LEVEL_DEBUG, 
-             "read(PF_ROUTE) failed: %s\n",
-             strerror(errno));
-		return;
-	}
-	if (len < msg.rtm.rtm_msglen) {
-		plog(ASL_LEVEL_DEBUG, 
-             "read(PF_ROUTE) short read\n");
-		return;
-	}
-	switch (msg.rtm.rtm_type) {
-        case RTM_NEWADDR:
-        case RTM_DELADDR:
-        case RTM_DELETE:
-        case RTM_IFINFO:
-            break;
-        case RTM_MISS:
-            /* ignore this message silently */
-            return;
-        default:
-            //plog(ASL_LEVEL_DEBUG,
-            //     "msg %d not interesting\n", msg.rtm.rtm_type);
-            return;
-	}
-	/* XXX more filters here? */
+	/* take all that is queued, a burst is committed once */
+	for (;;) {
+		len = read(lcconf->rtsock, &msg, sizeof(msg));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				plog(ASL_LEVEL_DEBUG, 
+					 "read(PF_ROUTE) failed: %s\n",
+					 strerror(errno));
+			return;
+		}
+		if (len < (int)sizeof(msg.rtm.rtm_msglen) || len < msg.rtm.rtm_msglen) {
+			plog(ASL_LEVEL_DEBUG, 
+				 "read(PF_ROUTE) short read\n");
+			return;
+		}
+		switch (msg.rtm.rtm_type) {
+			case RTM_NEWADDR:
+			case RTM_DELADDR:
+				break;
+			case RTM_DELETE:
+			case RTM_IFINFO:
+				/* no address came or went: left to the periodic rescan */
+				continue;
+			default:
+				//plog(ASL_LEVEL_DEBUG,
+				//     "msg %d not interesting\n", msg.rtm.rtm_type);
+				continue;
+		}
     
-	plog(ASL_LEVEL_DEBUG, 
-         "caught rtm:%d, need update interface address list\n",
-         msg.rtm.rtm_type);
+		plog(ASL_LEVEL_DEBUG, 
+			 "caught rtm:%d, updating interface address list\n",
+			 msg.rtm.rtm_type);
     
-    // Interface changes occurred - update addrs
-    update_myaddrs(NULL);
+		if (pfroute_addr(ALIGNED_CAST(struct ifa_msghdr *)&msg, len) < 0)
+			myaddrs_lost = 1;
+		myaddrs_changed();
+	}
 }
 
 void
@@ -600,6 +876,10 @@ pfroute_close(void)
     
     dispatch_source_cancel(lcconf->rt_source);
     lcconf->rt_source = NULL;
+    if (myaddrs_rescan_source) {
+        dispatch_source_cancel(myaddrs_rescan_source);
+        myaddrs_rescan_source = NULL;
+    }
 }
 
 int
@@ -631,6 +911,18 @@ pfroute_init(void)
                                              close(sock);
                                          });
     dispatch_resume(lcconf->rt_source);
+
+    /* a full rescan now and then, in case a change was missed */
+    myaddrs_rescan_source = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+    if (myaddrs_rescan_source == NULL) {
+        plog(ASL_LEVEL_DEBUG, "could not create address rescan timer.");
+        return 0;
+    }
+    dispatch_source_set_timer(myaddrs_rescan_source,
+                              dispatch_time(DISPATCH_TIME_NOW, MYADDRS_RESCAN_INTERVAL * NSEC_PER_SEC),
+                              MYADDRS_RESCAN_INTERVAL * NSEC_PER_SEC, NSEC_PER_SEC);
+    dispatch_source_set_event_handler_f(myaddrs_rescan_source, update_myaddrs);
+    dispatch_resume(myaddrs_rescan_source);
     return 0;
 }
 
@@ -42,8 +42,22 @@ struct myaddrs {
 	int udp_encap;
 	int	in_use;
 	char *ifname;
+	struct myaddrs *hnext;		/* lcconf->myaddrs_hash chain */
 };
 
+/*
+ * Interface addresses follow the routing socket's RTM_NEWADDR and
+ * RTM_DELADDR messages one by one.  Sockets are opened and closed for
+ * a whole burst of them, MYADDRS_SETTLE_MSEC after its first, and the
+ * whole list is checked against getifaddrs() every
+ * MYADDRS_RESCAN_INTERVAL seconds in case something was missed.
+ */
+#define MYADDRS_SETTLE_MSEC		250
+#define MYADDRS_RESCAN_INTERVAL	60
+
+/* bumped whenever lcconf->myaddrs or its sockets change */
+extern u_int32_t myaddrs_gen;
+
 extern void clear_myaddr (void);
 extern void grab_myaddrs (void);
 extern void update_myaddrs (void*);
@@ -55,6 +69,8 @@ extern void insmyaddr (struct myaddrs *, struct myaddrs **);
 extern void delmyaddr (struct myaddrs *);
 extern int initmyaddr (void);
 extern int getsockmyaddr (struct sockaddr *);
+struct sendsock;
+extern int getsockmyaddr_cached (struct sockaddr *, struct sendsock *);
 extern struct myaddrs *find_myaddr (struct sockaddr *, int);
 extern int pfroute_init(void);
 extern void pfroute_close(void);
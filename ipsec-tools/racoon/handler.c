@@ -72,6 +72,7 @@
 #include "nattraversal.h"
 #include "ike_session.h"
 #include "isakmp_frag.h"
+#include "rekeysched.h"
 
 #include "sainfo.h"
 
@@ -309,7 +310,7 @@ ike_session_newph1(unsigned int version)
 	iph1->dpd_seq = 0;
 	iph1->dpd_fails = 0;
     iph1->peer_sent_ike = 0;
-	iph1->dpd_r_u = NULL;
+	iph1->dpd_due = 0;
 #endif
 #ifdef ENABLE_VPNCONTROL_PORT
 	iph1->ping_sched = NULL;
@@ -328,6 +329,8 @@ ike_session_delph1(phase1_handle_t *iph1)
 	if (iph1 == NULL)
 		return;
     
+	rekeysched_cancel_ph1(iph1);
+
 #ifdef ENABLE_NATT
 	if (iph1->natt_options) {
 		racoon_free(iph1->natt_options);
@@ -342,8 +345,7 @@ ike_session_delph1(phase1_handle_t *iph1)
 #endif
     
 #ifdef ENABLE_DPD
-	if (iph1->dpd_r_u)
-		SCHED_KILL(iph1->dpd_r_u);
+	isakmp_unsched_r_u(iph1);
 #endif
 #ifdef ENABLE_VPNCONTROL_PORT
 	if (iph1->ping_sched)
@@ -358,6 +360,7 @@ ike_session_delph1(phase1_handle_t *iph1)
 		racoon_free(iph1->local);
 		iph1->local = NULL;
 	}
+	ike_session_ikev1_roam_note(iph1, NULL, NULL);
     
 	if (iph1->approval) {
 		delisakmpsa(iph1->approval);
@@ -418,15 +421,22 @@ ike_session_delph1(phase1_handle_t *iph1)
 		iph1->rmconf = NULL;
 	}
     
+	varena_release(&iph1->arena);
 	racoon_free(iph1);
 }
 
-void
-ike_session_flush_all_phase1_for_session(ike_session_t *session, int ignore_estab_or_assert_handles)
+/*
+ * with stale_only, only the handles whose remote configuration was
+ * changed or removed by a reload.
+ */
+static void
+ike_session_flush_phase1_handles(ike_session_t *session, int ignore_estab_or_assert_handles, int stale_only)
 {
 	phase1_handle_t *p, *next;
 		
     LIST_FOREACH_SAFE(p, &session->ph1tree, ph1ofsession_chain, next) {
+        if (stale_only && (p->rmconf == NULL || !p->rmconf->stale))
+            continue;
         if (ignore_estab_or_assert_handles && p->parent_session && !p->parent_session->stopped_by_vpn_controller && p->parent_session->is_asserted) {
             plog(ASL_LEVEL_NOTICE,
                  "Skipping Phase 1 %s that's asserted...\n",
@@ -457,6 +467,12 @@ ike_session_flush_all_phase1_for_session(ike_session_t *session, int ignore_esta
     }
 }
 
+void
+ike_session_flush_all_phase1_for_session(ike_session_t *session, int ignore_estab_or_assert_handles)
+{
+    ike_session_flush_phase1_handles(session, ignore_estab_or_assert_handles, FALSE);
+}
+
 /*
  * flush isakmp-sa
  */
@@ -470,7 +486,25 @@ ike_session_flush_all_phase1(int ignore_estab_or_assert_handles)
 		 "Flushing Phase 1 handles: ignore_estab_or_assert %d...\n", ignore_estab_or_assert_handles);
     
     LIST_FOREACH_SAFE(session, &ike_session_tree, chain, next_session) {
-        ike_session_flush_all_phase1_for_session(session, ignore_estab_or_assert_handles);
+        ike_session_flush_phase1_handles(session, ignore_estab_or_assert_handles, FALSE);
+    }
+}
+
+/*
+ * flush the isakmp-sa negotiated under a remote configuration
+ * that a reload changed or removed.
+ */
+void
+ike_session_flush_stale_phase1(int ignore_estab_or_assert_handles)
+{
+    ike_session_t *session = NULL;
+    ike_session_t *next_session = NULL;
+	
+	plog(ASL_LEVEL_NOTICE,
+		 "Flushing stale Phase 1 handles: ignore_estab_or_assert %d...\n", ignore_estab_or_assert_handles);
+    
+    LIST_FOREACH_SAFE(session, &ike_session_tree, chain, next_session) {
+        ike_session_flush_phase1_handles(session, ignore_estab_or_assert_handles, TRUE);
     }
 }
 
@@ -764,6 +798,7 @@ ike_session_initph2(phase2_handle_t *iph2)
 void
 ike_session_delph2(phase2_handle_t *iph2)
 {
+	rekeysched_cancel_ph2(iph2);
 	ike_session_initph2(iph2);
     
 	if (iph2->src) {
@@ -802,11 +837,16 @@ ike_session_delph2(phase2_handle_t *iph2)
     if (iph2->scr)
         SCHED_KILL(iph2->scr);
     
+	varena_release(&iph2->arena);
 	racoon_free(iph2);
 }
 
-void
-ike_session_flush_all_phase2_for_session(ike_session_t *session, int ignore_estab_or_assert_handles)
+/*
+ * with stale_only, only the handles whose sainfo, or the remote
+ * configuration of whose phase 1, was changed or removed by a reload.
+ */
+static void
+ike_session_flush_phase2_handles(ike_session_t *session, int ignore_estab_or_assert_handles, int stale_only)
 {
     phase2_handle_t *p = NULL;
     phase2_handle_t *next = NULL;
@@ -814,6 +854,11 @@ ike_session_flush_all_phase2_for_session(ike_session_t *session, int ignore_esta
         if (p->is_dying || FSM_STATE_IS_EXPIRED(p->status)) {
             continue;
         }
+        if (stale_only &&
+            !(p->sainfo && p->sainfo->stale) &&
+            !(p->ph1 && p->ph1->rmconf && p->ph1->rmconf->stale)) {
+            continue;
+        }
         if (ignore_estab_or_assert_handles && p->parent_session && !p->parent_session->stopped_by_vpn_controller && p->parent_session->is_asserted) {
             plog(ASL_LEVEL_NOTICE,
                  "skipping phase2 handle that's asserted...\n");
@@ -841,6 +886,12 @@ ike_session_flush_all_phase2_for_session(ike_session_t *session, int ignore_esta
     }
 }
 
+void
+ike_session_flush_all_phase2_for_session(ike_session_t *session, int ignore_estab_or_assert_handles)
+{
+    ike_session_flush_phase2_handles(session, ignore_estab_or_assert_handles, FALSE);
+}
+
 void
 ike_session_flush_all_phase2(int ignore_estab_or_assert_handles)
 {
@@ -851,7 +902,21 @@ ike_session_flush_all_phase2(int ignore_estab_or_assert_handles)
 		 "flushing ph2 handles: ignore_estab_or_assert %d...\n", ignore_estab_or_assert_handles);
     
     LIST_FOREACH_SAFE(session, &ike_session_tree, chain, next_session) {
-        ike_session_flush_all_phase2_for_session(session, ignore_estab_or_assert_handles);
+        ike_session_flush_phase2_handles(session, ignore_estab_or_assert_handles, FALSE);
+    }
+}
+
+void
+ike_session_flush_stale_phase2(int ignore_estab_or_assert_handles)
+{
+    ike_session_t *session = NULL;
+    ike_session_t *next_session = NULL;
+    
+	plog(ASL_LEVEL_NOTICE,
+		 "flushing stale ph2 handles: ignore_estab_or_assert %d...\n", ignore_estab_or_assert_handles);
+    
+    LIST_FOREACH_SAFE(session, &ike_session_tree, chain, next_session) {
+        ike_session_flush_phase2_handles(session, ignore_estab_or_assert_handles, TRUE);
     }
 }
 
@@ -1071,7 +1136,7 @@ vchar_t *rbuf;
 	}
     
 	/* select the socket to be sent */
-	s = getsockmyaddr((struct sockaddr *)r->local);
+	s = getsockmyaddr_cached((struct sockaddr *)r->local, &r->sendsock);
 	if (s == -1)
 		return -1;
     
@@ -1088,18 +1153,18 @@ vchar_t *rbuf;
 	if (r->frag_flags && r->sendbuf->l > ISAKMP_FRAG_MAXLEN) {
 		/* resend the packet if needed */
 		plog(ASL_LEVEL_ERR, "!!! retransmitting frags\n");
-		len = sendfragsfromto(s, r->sendbuf,
+		len = sendfragsfromto(&r->sendsock, r->sendbuf,
 							  r->local, r->remote, lcconf->count_persend,
 							  r->frag_flags);
 	} else {
 		plog(ASL_LEVEL_ERR, "!!! skipped retransmitting frags: frag_flags %x, r->sendbuf->l %zu, max %d\n", r->frag_flags, r->sendbuf->l, ISAKMP_FRAG_MAXLEN);
 		/* resend the packet if needed */
-		len = sendfromto(s, r->sendbuf->v, r->sendbuf->l,
+		len = sendfromto(&r->sendsock, r->sendbuf->v, r->sendbuf->l,
 						 r->local, r->remote, lcconf->count_persend);
 	}
 #else
 	/* resend the packet if needed */
-	len = sendfromto(s, r->sendbuf->v, r->sendbuf->l,
+	len = sendfromto(&r->sendsock, r->sendbuf->v, r->sendbuf->l,
                      r->local, r->remote, lcconf->count_persend);
 #endif
 	if (len == -1) {
@@ -1525,12 +1590,9 @@ sweep_sleepwake(void)
                 }
             }
     #ifdef ENABLE_DPD
-            if (iph1->dpd_r_u) {
-                time_t xtime;
-                if (sched_get_time(iph1->dpd_r_u, &xtime)) {
-                    if (FSM_STATE_IS_EXPIRED(iph1->status) || xtime <= swept_at) {
-                        SCHED_KILL(iph1->dpd_r_u);
-                    }
+            if (iph1->dpd_due) {
+                if (FSM_STATE_IS_EXPIRED(iph1->status) || iph1->dpd_due <= swept_at) {
+                    isakmp_unsched_r_u(iph1);
                 }
             }
     #endif 
@@ -1569,6 +1631,10 @@ sweep_sleepwake(void)
             }
         }
     }
+#ifdef ENABLE_DPD
+	// the DPD tick may have been dropped while asleep
+	isakmp_resume_r_u();
+#endif
     //%%%%%%%%%%%%%%% fix this
 	// do the ike_session last
 	ike_session_sweep_sleepwake();
@@ -52,6 +52,8 @@
 #include <sys/socket.h>
 
 #include <schedule.h>
+#include <netinet/in.h>
+#include "sockmisc.h"
 
 #if __has_include(<nw/private.h>)
 #include <nw/private.h>
@@ -89,6 +91,9 @@ struct phase1handle {
 	nw_nat64_prefix_t nat64_prefix;		/* nat64 prefix to apply to addresses. */
 	struct sockaddr_storage *remote;	/* remote address to negotiate ph1 */
 	struct sockaddr_storage *local;		/* local address to negotiate ph1 */
+	struct sockaddr_storage *roam_remote;	/* fast_reconnect: peer's new address, */
+	struct sockaddr_storage *roam_local;	/* not yet authenticated */
+	struct sendsock sendsock;	/* socket to send from, cached */
     /* XXX copy from rmconf due to anonymous configuration.
      * If anonymous will be forbidden, we do delete them. */
     
@@ -159,6 +164,7 @@ struct phase1handle {
 	struct isakmp_pl_hash *pl_hash;	/* pointer to hash payload */
     
 	time_t created;			/* timestamp for establish */
+	u_int64_t started;		/* metrics_now() at begin, for latency */
 #ifdef ENABLE_STATS
 	struct timeval start;
 	struct timeval end;
@@ -170,7 +176,10 @@ struct phase1handle {
 	u_int16_t	dpd_seq;		/* DPD seq number to receive */
 	u_int8_t	dpd_fails;		/* number of failures */
     u_int8_t        peer_sent_ike;
-	schedule_ref    dpd_r_u;
+	time_t		dpd_due;		/* next DPD check, 0 if none */
+	u_int8_t	dpd_retransmit;	/* that check resends R-U-THERE */
+	u_int8_t	dpd_polled;		/* SA counters asked for that check */
+	LIST_ENTRY(phase1handle) dpd_chain;	/* DPD wheel bucket */
 #endif
     
 #ifdef ENABLE_VPNCONTROL_PORT
@@ -187,6 +196,8 @@ struct phase1handle {
 #endif
 	int                                     is_rekey:1;
 	int                                     is_dying:1;
+	int                                     rekey_queued:1;	/* waiting for the rekey budget */
+	struct vmarena                          arena;	/* exchange temporaries */
 	ike_session_t                           *parent_session;
 	LIST_HEAD(_ph2ofph1_, phase2handle)     bound_ph2tree;
 	LIST_ENTRY(phase1handle)                ph1ofsession_chain;
@@ -275,6 +286,7 @@ struct phase2handle {
     
 	int generated_spidx;	/* mark handlers whith generated policy */
     
+	u_int64_t started;		/* metrics_now() at begin, for latency */
 #ifdef ENABLE_STATS
 	struct timeval start;
 	struct timeval end;
@@ -282,7 +294,9 @@ struct phase2handle {
 	struct phase1handle *ph1;	/* back pointer to isakmp status */
 	int                    is_rekey:1;
 	int                    is_dying:1;
+	int                    rekey_queued:1;	/* waiting for the rekey budget */
     	int		       is_defunct:1;
+	struct vmarena         arena;		/* exchange temporaries */
 	ike_session_t         *parent_session;
 	vchar_t               *ext_nat_id;
 	vchar_t               *ext_nat_id_p;
@@ -304,6 +318,7 @@ struct contacted {
 struct recvdpkt {
 	struct sockaddr_storage *remote;	/* the remote address */
 	struct sockaddr_storage *local;		/* the local address */
+	struct sendsock sendsock;	/* socket to send from, cached */
 	vchar_t *hash;			/* hash of the received packet */
 	vchar_t *sendbuf;		/* buffer for the response */
 	int retry_counter;		/* how many times to send */
@@ -397,6 +412,7 @@ extern int                  ike_session_check_recvdpkt (struct sockaddr_storage
 
 extern void                 ike_session_flush_all_phase1_for_session(ike_session_t *, int);
 extern void                 ike_session_flush_all_phase1 (int);
+extern void                 ike_session_flush_stale_phase1 (int);
 
 extern phase1_handle_t      *ike_session_getph1byindex (ike_session_t *, isakmp_index *);
 extern phase1_handle_t      *ike_session_getph1byindex0 (ike_session_t *, isakmp_index *);
@@ -428,6 +444,7 @@ extern void                 ike_session_initph2 (phase2_handle_t *);
 extern void                 ike_session_delph2 (phase2_handle_t *);
 extern void                 ike_session_flush_all_phase2_for_session(ike_session_t *, int);
 extern void                 ike_session_flush_all_phase2 (int);
+extern void                 ike_session_flush_stale_phase2 (int);
 extern void                 ike_session_deleteallph2 (struct sockaddr_storage *, struct sockaddr_storage *, u_int);
 extern void                 ike_session_deleteallph1 (struct sockaddr_storage *, struct sockaddr_storage *);
 
@@ -767,6 +767,201 @@ ike_session_ikev1_float_ports (phase1_handle_t *iph1)
 	}
 }
 
+/* the ph1 moved to other addresses: follow it with the session id */
+void
+ike_session_ikev1_float_addresses (phase1_handle_t *iph1)
+{
+	ike_session_t *session = iph1->parent_session;
+
+	if (session) {
+		bzero(&session->session_id.local, sizeof(session->session_id.local));
+		bzero(&session->session_id.remote, sizeof(session->session_id.remote));
+		memcpy(&session->session_id.local, iph1->local, sysdep_sa_len((struct sockaddr *)iph1->local));
+		memcpy(&session->session_id.remote, iph1->remote, sysdep_sa_len((struct sockaddr *)iph1->remote));
+		session->ports_floated = 1;
+	} else {
+		plog(ASL_LEVEL_NOTICE, "invalid parent session in %s.\n", __FUNCTION__);
+	}
+}
+
+/*
+ * fast_reconnect roaming.  A phase 2 or informational message for an
+ * established ph1 arriving from other addresses is only a candidate:
+ * ikev1_received_packet() notes it on the ph1, and the exchange moves
+ * the ph1 once the HASH of that same message checked out.  Anyone who
+ * saw the cookies could otherwise redirect the SA.
+ * a NULL remote drops what was noted.
+ */
+void
+ike_session_ikev1_roam_note (phase1_handle_t *iph1,
+							 struct sockaddr_storage *remote,
+							 struct sockaddr_storage *local)
+{
+	if (iph1 == NULL)
+		return;
+	if (iph1->roam_remote) {
+		racoon_free(iph1->roam_remote);
+		iph1->roam_remote = NULL;
+	}
+	if (iph1->roam_local) {
+		racoon_free(iph1->roam_local);
+		iph1->roam_local = NULL;
+	}
+	if (remote == NULL)
+		return;
+	if ((iph1->roam_remote = dupsaddr(remote)) == NULL ||
+		(iph1->roam_local = dupsaddr(local)) == NULL) {
+		plog(ASL_LEVEL_ERR, "failed to duplicate address\n");
+		ike_session_ikev1_roam_note(iph1, NULL, NULL);
+	}
+}
+
+/*
+ * the message being processed for iph1 is authenticated: move iph1,
+ * and iph2 if given, to the addresses it came from.  The other
+ * IPsec-SAs of the session still point at the old addresses; they are
+ * purged, and the peer is told so over the moved ph1.
+ */
+void
+ike_session_ikev1_roam_commit (phase1_handle_t *iph1, phase2_handle_t *iph2)
+{
+	struct sockaddr_storage *dst = NULL, *src = NULL;
+	phase2_handle_t *p, *next;
+
+	if (iph1 == NULL || iph1->roam_remote == NULL)
+		return;
+
+	if (iph2 && ((dst = dupsaddr(iph1->roam_remote)) == NULL ||
+				 (src = dupsaddr(iph1->roam_local)) == NULL)) {
+		plog(ASL_LEVEL_ERR, "failed to duplicate address\n");
+		if (dst)
+			racoon_free(dst);
+		ike_session_ikev1_roam_note(iph1, NULL, NULL);
+		return;
+	}
+
+	racoon_free(iph1->remote);
+	racoon_free(iph1->local);
+	iph1->remote = iph1->roam_remote;
+	iph1->local = iph1->roam_local;
+	iph1->roam_remote = NULL;
+	iph1->roam_local = NULL;
+	ike_session_ikev1_float_addresses(iph1);
+
+	if (iph2) {
+		set_port(dst, 0);
+		set_port(src, 0);
+		racoon_free(iph2->dst);
+		racoon_free(iph2->src);
+		iph2->dst = dst;
+		iph2->src = src;
+	}
+
+	plog(ASL_LEVEL_NOTICE,
+		 "NAT-T: addresses changed to: %s\n",
+		 saddr2str_fromto("%s<->%s", (struct sockaddr *)iph1->remote, (struct sockaddr *)iph1->local));
+
+	if (iph1->parent_session == NULL)
+		return;
+	LIST_FOREACH_SAFE(p, &iph1->parent_session->ph2tree, ph2ofsession_chain, next) {
+		if (p == iph2 || p->is_dying || p->phase2_type != PHASE2_TYPE_SA)
+			continue;
+		if (cmpsaddrwop(p->dst, iph1->remote) == 0 &&
+			cmpsaddrwop(p->src, iph1->local) == 0)
+			continue;
+		SCHED_KILL(p->sce);
+		p->is_dying = 1;
+
+		plog(ASL_LEVEL_NOTICE,
+			 "IPsec-SA needs to be purged: %s\n",
+			 sadbsecas2str(p->src, p->dst,
+						   p->satype, p->spid, 0));
+
+		ike_session_cleanup_ph2(p);
+	}
+}
+
+/*
+ * whether iph1 was negotiated with the peer rmconf names.  When rmconf
+ * lists the peer's identifiers, the phase 1 ID decides; it was checked
+ * against the peer's certificate, if any, when the SA was set up.
+ * Otherwise only the address the session was set up with is known.
+ */
+static int
+ike_session_ikev1_same_peer (phase1_handle_t *iph1,
+							 struct remoteconf *rmconf,
+							 struct sockaddr_storage *remote)
+{
+	if (genlist_next(rmconf->idvl_p, 0))
+		return ipsecdoi_matchid1(rmconf, iph1->id_p);
+	return cmpsaddrwop(&iph1->parent_session->session_id.remote, remote) == 0;
+}
+
+/*
+ * fast reconnect: instead of a new main mode, move a still valid
+ * ISAKMP-SA with the peer to the addresses the client uses now, and let
+ * the VPN controller go straight to quick mode.  The IPsec-SAs of the
+ * old addresses are dropped.  The SA must have been negotiated with
+ * NAT-T, which is what lets the peer follow it to the new address.
+ * returns the floated ph1, or NULL when a full phase 1 is needed.
+ */
+phase1_handle_t *
+ike_session_ikev1_fast_reconnect (struct remoteconf *rmconf,
+								  struct sockaddr_storage *remote,
+								  struct sockaddr_storage *local)
+{
+	ike_session_t *session;
+	phase1_handle_t *iph1;
+	struct sockaddr_storage *newlocal, *newremote;
+	time_t xtime;
+
+	LIST_FOREACH(session, &ike_session_tree, chain) {
+		if (session->is_dying || session->stopped_by_vpn_controller ||
+			session->stop_timestamp.tv_sec || session->stop_timestamp.tv_usec)
+			continue;
+		if ((iph1 = ike_session_get_established_ph1(session)) == NULL)
+			continue;
+		if (iph1->side != INITIATOR || iph1->rmconf != rmconf ||
+			!NATT_AVAILABLE(iph1))
+			continue;
+		if (!ike_session_ikev1_same_peer(iph1, rmconf, remote))
+			continue;
+		if (!sched_get_time(iph1->sce, &xtime) ||
+			xtime - current_time() < IKE_SESSION_FAST_RECONNECT_MINLIFE)
+			continue;
+
+		/* keep the ports, floated or not, on the new addresses */
+		if ((newlocal = dupsaddr(local)) == NULL ||
+			(newremote = dupsaddr(remote)) == NULL) {
+			if (newlocal)
+				racoon_free(newlocal);
+			plog(ASL_LEVEL_ERR, "failed to duplicate address\n");
+			return NULL;
+		}
+		set_port(newlocal, extract_port(iph1->local));
+		set_port(newremote, extract_port(iph1->remote));
+
+		plog(ASL_LEVEL_NOTICE,
+			 "fast reconnect: moving ISAKMP-SA %s to %s.\n",
+			 isakmp_pindex(&iph1->index, 0),
+			 saddr2str_fromto("%s->%s", (struct sockaddr *)newlocal, (struct sockaddr *)newremote));
+
+		ike_session_purge_ph2s_by_ph1(iph1);
+		racoon_free(iph1->local);
+		racoon_free(iph1->remote);
+		iph1->local = newlocal;
+		iph1->remote = newremote;
+		ike_session_ikev1_float_addresses(iph1);
+
+#ifdef ENABLE_VPNCONTROL_PORT
+		vpncontrol_notify_phase_change(0, FROM_LOCAL, iph1, NULL);
+#endif
+		return iph1;
+	}
+
+	return NULL;
+}
+
 static void
 ike_session_traffic_cop (void *arg)
 {
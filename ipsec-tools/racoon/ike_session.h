@@ -111,6 +111,9 @@ struct ike_session {
 	LIST_ENTRY(ike_session)              chain;
 };
 
+/* seconds an ISAKMP-SA must have left to be reused by a fast reconnect */
+#define IKE_SESSION_FAST_RECONNECT_MINLIFE	60
+
 typedef enum ike_session_rekey_type {
 	IKE_SESSION_REKEY_TYPE_NONE = 0,
 	IKE_SESSION_REKEY_TYPE_PH1,
@@ -142,10 +145,15 @@ extern int                ike_session_has_other_negoing_ph2 (ike_session_t *, ph
 extern phase1_handle_t  * ike_session_update_ph1_ph2tree (phase1_handle_t *);
 extern phase1_handle_t  * ike_session_update_ph2_ph1bind (phase2_handle_t *);
 extern void               ike_session_ikev1_float_ports (phase1_handle_t *);
+extern void               ike_session_ikev1_float_addresses (phase1_handle_t *);
+extern void               ike_session_ikev1_roam_note (phase1_handle_t *, struct sockaddr_storage *, struct sockaddr_storage *);
+extern void               ike_session_ikev1_roam_commit (phase1_handle_t *, phase2_handle_t *);
+extern phase1_handle_t  * ike_session_ikev1_fast_reconnect (struct remoteconf *, struct sockaddr_storage *, struct sockaddr_storage *);
 extern void               ike_session_ph2_established (phase2_handle_t *);
 extern void               ike_session_replace_other_ph1 (phase1_handle_t *, phase1_handle_t *);
 extern void               ike_session_cleanup_other_established_ph1s (ike_session_t *, phase1_handle_t *);
 extern void               ike_session_cleanup_other_established_ph2s (ike_session_t *, phase2_handle_t *);
+extern void               ike_session_cleanup_ph2 (phase2_handle_t *);
 extern void				  ike_session_stopped_by_controller (ike_session_t *, const char *);
 extern void				  ike_sessions_stopped_by_controller (struct sockaddr_storage *, int, const char *);
 extern void               ike_session_purge_ph2s_by_ph1 (phase1_handle_t *);
@@ -319,7 +319,27 @@ get_ph1approvalx(p, proposal, sap, check_level)
 	memset(tsap, 0, sizeof(*tsap));
 	if (t2isakmpsa(trns, tsap) < 0)
 		return NULL;
-	for (s = proposal; s != NULL; s = s->next) {
+
+	plog(ASL_LEVEL_DEBUG, "Peer: version = %d, lifetime = %ld, "
+		"lifebyte = %zu, enctype = %s, encklen = %d, hashtype = %s, "
+		"authmethod = %s, dh_group = %s\n",
+		tsap->version, (long)tsap->lifetime, tsap->lifebyte,
+		s_oakley_attr_v(OAKLEY_ATTR_ENC_ALG, tsap->enctype),
+		tsap->encklen,
+		s_oakley_attr_v(OAKLEY_ATTR_HASH_ALG, tsap->hashtype),
+		s_oakley_attr_v(OAKLEY_ATTR_AUTH_METHOD, tsap->authmethod),
+		s_oakley_attr_v(OAKLEY_ATTR_GRP_DESC, tsap->dh_group));
+
+	/*
+	 * only my proposals in the same propindex bucket can match, and
+	 * they are in the bucket in the order of the proposal list.
+	 */
+	s = NULL;
+	if (proposal != NULL && proposal->rmconf != NULL)
+		s = proposal->rmconf->propindex[isakmpsa_index(tsap->version,
+		    tsap->enctype, tsap->encklen, tsap->hashtype,
+		    tsap->dh_group)];
+	for (; s != NULL; s = s->hnext) {
 #ifdef ENABLE_HYBRID
 		authmethod = switch_authmethod(s->authmethod);
         tsap_authmethod = switch_authmethod(tsap->authmethod);
@@ -327,35 +347,6 @@ get_ph1approvalx(p, proposal, sap, check_level)
 		authmethod = s->authmethod;
         tsap_authmethod = tsap->authmethod;
 #endif
-		plog(ASL_LEVEL_DEBUG, "Compared: DB:Peer\n");
-		plog(ASL_LEVEL_DEBUG, "(version = %d:%d)\n",
-			 s->version, tsap->version);
-		plog(ASL_LEVEL_DEBUG, "(lifetime = %ld:%ld)\n",
-			(long)s->lifetime, (long)tsap->lifetime);
-		plog(ASL_LEVEL_DEBUG, "(lifebyte = %zu:%zu)\n",
-			s->lifebyte, tsap->lifebyte);
-		plog(ASL_LEVEL_DEBUG, "enctype = %s:%s\n",
-			s_oakley_attr_v(OAKLEY_ATTR_ENC_ALG,
-					s->enctype),
-			s_oakley_attr_v(OAKLEY_ATTR_ENC_ALG,
-					tsap->enctype));
-		plog(ASL_LEVEL_DEBUG, "(encklen = %d:%d)\n",
-			s->encklen, tsap->encklen);
-		plog(ASL_LEVEL_DEBUG, "hashtype = %s:%s\n",
-			s_oakley_attr_v(OAKLEY_ATTR_HASH_ALG,
-					s->hashtype),
-			s_oakley_attr_v(OAKLEY_ATTR_HASH_ALG,
-					tsap->hashtype));
-		plog(ASL_LEVEL_DEBUG, "authmethod = %s:%s\n",
-			s_oakley_attr_v(OAKLEY_ATTR_AUTH_METHOD,
-					s->authmethod),
-			s_oakley_attr_v(OAKLEY_ATTR_AUTH_METHOD,
-					tsap->authmethod));
-		plog(ASL_LEVEL_DEBUG, "dh_group = %s:%s\n",
-			s_oakley_attr_v(OAKLEY_ATTR_GRP_DESC,
-					s->dh_group),
-			s_oakley_attr_v(OAKLEY_ATTR_GRP_DESC,
-					tsap->dh_group));
 #if 0
 		/* XXX to be considered ? */
 		if (tsap->lifebyte > s->lifebyte) ;
@@ -3465,6 +3456,93 @@ cmpid_invalid:
 }
 #endif
 
+/*
+ * compare a phase 1 ID payload (without general header) with the
+ * peer's identifiers in rmconf.
+ * returns 1 if one of them matches, 0 if none does.
+ */
+int
+ipsecdoi_matchid1(struct remoteconf *rmconf, vchar_t *id_p)
+{
+	struct ipsecdoi_id_b *id_b;
+	struct sockaddr_storage *sa;
+	caddr_t sa1, sa2;
+	vchar_t *ident0 = NULL;
+#ifdef HAVE_OPENSSL
+	vchar_t ident;
+#endif
+	struct idspec *id;
+	struct genlist_entry *gpb;
+	int matched = 0;
+
+	if (id_p == NULL || id_p->l < sizeof(*id_b))
+		return 0;
+	id_b = ALIGNED_CAST(struct ipsecdoi_id_b *)id_p->v;
+
+	for (id = genlist_next (rmconf->idvl_p, &gpb); id; id = genlist_next (0, &gpb)) {
+		/* check the type of both IDs */
+		if (id->idtype != doi2idtype(id_b->type))
+			continue;  /* ID type mismatch */
+		if (id->id == 0)
+			goto matched;
+
+		/* compare defined ID with the ID sent by peer. */
+		if (ident0 != NULL)
+			vfree(ident0);
+		ident0 = getidval(id->idtype, id->id);
+
+		switch (id->idtype) {
+		case IDTYPE_ASN1DN:
+#ifdef HAVE_OPENSSL
+			ident.v = id_p->v + sizeof(*id_b);
+			ident.l = id_p->l - sizeof(*id_b);
+			if (eay_cmp_asn1dn(ident0, &ident) == 0)
+				goto matched;
+#else
+				plog(ASL_LEVEL_WARNING, "ASN1DN ID matching not implemented - passed.\n");
+				goto matched;	//%%%%%% hack for now until we have code to do this.
+#endif
+			break;
+		case IDTYPE_ADDRESS:
+			sa = ALIGNED_CAST(struct sockaddr_storage *)ident0->v;
+			sa2 = (caddr_t)(id_b + 1);
+			switch (sa->ss_family) {
+			case AF_INET:
+				if (id_p->l - sizeof(*id_b) != sizeof(struct in_addr))
+					continue;  /* ID value mismatch */
+				sa1 = (caddr_t)&((struct sockaddr_in *)sa)->sin_addr;
+				if (memcmp(sa1, sa2, sizeof(struct in_addr)) == 0)
+					goto matched;
+				break;
+#ifdef INET6
+			case AF_INET6:
+				if (id_p->l - sizeof(*id_b) != sizeof(struct in6_addr))
+					continue;  /* ID value mismatch */
+				sa1 = (caddr_t)&((struct sockaddr_in6 *)sa)->sin6_addr;
+				if (memcmp(sa1, sa2, sizeof(struct in6_addr)) == 0)
+					goto matched;
+				break;
+#endif
+			default:
+				break;
+			}
+			break;
+		default:
+			if (memcmp(ident0->v, id_b + 1, ident0->l) == 0)
+				goto matched;
+			break;
+		}
+	}
+	goto end;
+
+matched: /* ID value match */
+	matched = 1;
+end:
+	if (ident0 != NULL)
+		vfree(ident0);
+	return matched;
+}
+
 /*
  * check the following:
  * - In main mode with pre-shared key, only address type can be used.
@@ -3480,8 +3558,6 @@ ipsecdoi_checkid1(iph1)
 	phase1_handle_t *iph1;
 {
 	struct ipsecdoi_id_b *id_b;
-	struct sockaddr_storage *sa;
-	caddr_t sa1, sa2;
 
 	if (iph1->id_p == NULL) {
 		plog(ASL_LEVEL_ERR, 
@@ -3575,78 +3651,11 @@ ipsecdoi_checkid1(iph1)
 	}
 
 	/* compare with the ID if specified. */
-	if (genlist_next(iph1->rmconf->idvl_p, 0)) {
-		vchar_t *ident0 = NULL;
-#ifdef HAVE_OPENSSL
-		vchar_t ident;
-#endif
-		struct idspec *id;
-		struct genlist_entry *gpb;
-
-		for (id = genlist_next (iph1->rmconf->idvl_p, &gpb); id; id = genlist_next (0, &gpb)) {
-			/* check the type of both IDs */
-			if (id->idtype != doi2idtype(id_b->type))
-				continue;  /* ID type mismatch */
-			if (id->id == 0)
-				goto matched;
-
-			/* compare defined ID with the ID sent by peer. */
-			if (ident0 != NULL)
-				vfree(ident0);
-			ident0 = getidval(id->idtype, id->id);
-
-			switch (id->idtype) {
-			case IDTYPE_ASN1DN:
-#ifdef HAVE_OPENSSL
-				ident.v = iph1->id_p->v + sizeof(*id_b);
-				ident.l = iph1->id_p->l - sizeof(*id_b);
-				if (eay_cmp_asn1dn(ident0, &ident) == 0)
-					goto matched;
-#else
-					plog(ASL_LEVEL_WARNING, "ASN1DN ID matching not implemented - passed.\n");
-					goto matched;	//%%%%%% hack for now until we have code to do this.
-#endif
-				break;
-			case IDTYPE_ADDRESS:
-				sa = ALIGNED_CAST(struct sockaddr_storage *)ident0->v;
-				sa2 = (caddr_t)(id_b + 1);
-				switch (sa->ss_family) {
-				case AF_INET:
-					if (iph1->id_p->l - sizeof(*id_b) != sizeof(struct in_addr))
-						continue;  /* ID value mismatch */
-					sa1 = (caddr_t)&((struct sockaddr_in *)sa)->sin_addr;
-					if (memcmp(sa1, sa2, sizeof(struct in_addr)) == 0)
-						goto matched;
-					break;
-#ifdef INET6
-				case AF_INET6:
-					if (iph1->id_p->l - sizeof(*id_b) != sizeof(struct in6_addr))
-						continue;  /* ID value mismatch */
-					sa1 = (caddr_t)&((struct sockaddr_in6 *)sa)->sin6_addr;
-					if (memcmp(sa1, sa2, sizeof(struct in6_addr)) == 0)
-						goto matched;
-					break;
-#endif
-				default:
-					break;
-				}
-				break;
-			default:
-				if (memcmp(ident0->v, id_b + 1, ident0->l) == 0)
-					goto matched;
-				break;
-			}
-		}
-		if (ident0 != NULL) {
-			vfree(ident0);
-			ident0 = NULL;
-		}
+	if (genlist_next(iph1->rmconf->idvl_p, 0) &&
+	    ipsecdoi_matchid1(iph1->rmconf, iph1->id_p) == 0) {
 		plog(ASL_LEVEL_DEBUG, "No ID match.\n");
 		if (iph1->rmconf->verify_identifier)
 			return ISAKMP_NTYPE_INVALID_ID_INFORMATION;
-matched: /* ID value match */
-		if (ident0 != NULL)
-			vfree(ident0);
 	}
 
 	return 0;
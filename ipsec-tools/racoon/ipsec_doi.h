@@ -219,6 +219,7 @@ struct saprop;
 struct saproto;
 struct satrns;
 struct prop_pair;
+struct remoteconf;
 
 extern struct isakmpsa *get_ph1approvalx (struct prop_pair *,
 										  struct isakmpsa *, struct isakmpsa *, int);
@@ -231,6 +232,7 @@ extern vchar_t *get_sabyproppair (struct prop_pair *, phase1_handle_t *);
 extern int ipsecdoi_updatespi (phase2_handle_t *iph2);
 extern vchar_t *get_sabysaprop (struct saprop *, vchar_t *);
 extern int ipsecdoi_chkcmpids (const vchar_t *, const vchar_t *, int );
+extern int ipsecdoi_matchid1 (struct remoteconf *, vchar_t *);
 extern int ipsecdoi_checkid1 (phase1_handle_t *);
 extern int ipsecdoi_setid1 (phase1_handle_t *);
 extern int set_identifier (vchar_t **, int, vchar_t *);
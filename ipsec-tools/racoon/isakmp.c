@@ -39,6 +39,7 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/queue.h>
+#include <sys/uio.h>
 
 #include <netinet/in.h>
 #include <net/if_var.h>
@@ -97,6 +98,10 @@
 #include "isakmp_agg.h"
 #include "isakmp_quick.h"
 #include "isakmp_inf.h"
+#include "isakmp_msgbuild.h"
+#include "metrics.h"
+#include "pkttrace.h"
+#include "shard.h"
 #include "vpn_control.h"
 #include "vpn_control_var.h"
 #ifdef ENABLE_HYBRID
@@ -124,6 +129,7 @@
 #include "ipsecSessionTracer.h"
 #include "ipsecMessageTracer.h"
 #include "power_mgmt.h"
+#include "rekeysched.h"
 
 extern caddr_t val2str (const char *, size_t);
 u_char i_ck0[] = { 0,0,0,0,0,0,0,0 }; /* used to verify the i_ck. */
@@ -135,6 +141,8 @@ static void ikev1_received_packet(vchar_t *, struct sockaddr_storage *, struct s
 static int ikev1_ph1begin_r (ike_session_t *session, vchar_t *, struct sockaddr_storage *, struct sockaddr_storage *, u_int8_t);
 static int ikev1_ph2begin_i (phase1_handle_t *, phase2_handle_t *);
 static int ikev1_ph2begin_r (phase1_handle_t *, vchar_t *);
+static void isakmp_ph1rekeybegin (phase1_handle_t *);
+static void ikev1_start_queued_ph2s (phase1_handle_t *);
 
 
 #ifdef ENABLE_FRAG
@@ -162,7 +170,6 @@ isakmp_handler(int so_isakmp)
 	unsigned int local_len = sizeof(local);
 	ssize_t len = 0;
 	int extralen = 0;
-	u_short port;
 	vchar_t *buf = NULL, *tmpbuf = NULL;
 	int error = -1;
 
@@ -209,6 +216,7 @@ isakmp_handler(int so_isakmp)
 	if (len < sizeof(isakmp) || ntohl(isakmp.len) < sizeof(isakmp)) {
 		plog(ASL_LEVEL_ERR,
 			"packet shorter than isakmp header size (size: %zu, minimum expected: %zu)\n", len, sizeof(isakmp));
+		METRICS_INC(METRICS_C_RECV_DROPPED);
 		/* dummy receive */
 		if ((len = recvfrom(so_isakmp, (char *)&isakmp, sizeof(isakmp),
 			    0, (struct sockaddr *)&remote, &remote_len)) < 0) {
@@ -223,6 +231,7 @@ isakmp_handler(int so_isakmp)
 	if (ntohl(isakmp.len) > 0xffff) {
 		plog(ASL_LEVEL_ERR, 
 			"the length in the isakmp header is too big.\n");
+		METRICS_INC(METRICS_C_RECV_DROPPED);
 		if ((len = recvfrom(so_isakmp, (char *)&isakmp, sizeof(isakmp),
 			    0, (struct sockaddr *)&remote, &remote_len)) < 0) {
 			plog(ASL_LEVEL_ERR, 
@@ -237,6 +246,7 @@ isakmp_handler(int so_isakmp)
 		plog(ASL_LEVEL_ERR, 
 			"failed to allocate reading buffer (%u Bytes)\n",
 			ntohl(isakmp.len) + extralen);
+		METRICS_INC(METRICS_C_RECV_DROPPED);
 		/* dummy receive */
 		if ((len = recvfrom(so_isakmp, (char *)&isakmp, sizeof(isakmp),
 			    0, (struct sockaddr *)&remote, &remote_len)) < 0) {
@@ -258,10 +268,13 @@ isakmp_handler(int so_isakmp)
 		goto end;
 	}
 
+	PKTTRACE(PKTTRACE_IN, tmpbuf->v, len, &remote, &local);
+
 	if (len < extralen) {
 		plog(ASL_LEVEL_ERR, 
 			 "invalid len (%zd Bytes) & extralen (%d Bytes)\n",
 			 len, extralen);
+		METRICS_INC(METRICS_C_RECV_DROPPED);
 		goto end;
 	}
 
@@ -269,6 +282,7 @@ isakmp_handler(int so_isakmp)
 		plog(ASL_LEVEL_ERR, 
 			"failed to allocate reading buffer (%lu Bytes)\n",
 			(len - extralen));
+		METRICS_INC(METRICS_C_RECV_DROPPED);
 		goto end;
 	}
 	
@@ -279,6 +293,7 @@ isakmp_handler(int so_isakmp)
 	if (len != buf->l) {
 		plog(ASL_LEVEL_ERR, "received invalid length (%zd != %zu), why ?\n",
 			len, buf->l);
+		METRICS_INC(METRICS_C_RECV_DROPPED);
 		goto end;
 	}
 
@@ -287,25 +302,55 @@ isakmp_handler(int so_isakmp)
 								   (struct sockaddr *)&remote,
 								   (struct sockaddr *)&local));
 
+	/* another shard's phase 1: pass it on */
+	if (shard_steer(buf, &remote, &local))
+		goto end;
+
+	isakmp_input(buf, &remote, &local);
+
+end:
+	if (tmpbuf != NULL)
+		vfree(tmpbuf);
+	if (buf != NULL)
+		vfree(buf);
+
+	return;
+}
+
+/*
+ * process one received isakmp message, without the NON-ESP marker.
+ * the caller keeps ownership of buf.  split out of isakmp_handler()
+ * so captured traffic can be fed in without a socket.
+ */
+void
+isakmp_input(vchar_t *buf, struct sockaddr_storage *remote, struct sockaddr_storage *local)
+{
+	u_int64_t start = metrics_now();
+	u_short port;
+
+	METRICS_INC(METRICS_C_RECV_PACKETS);
+
 	/* avoid packets with malicious port/address */
-	switch (remote.ss_family) {
+	switch (remote->ss_family) {
 	case AF_INET:
-		port = ((struct sockaddr_in *)&remote)->sin_port;
+		port = ((struct sockaddr_in *)remote)->sin_port;
 		break;
 #ifdef INET6
 	case AF_INET6:
-		port = ((struct sockaddr_in6 *)&remote)->sin6_port;
+		port = ((struct sockaddr_in6 *)remote)->sin6_port;
 		break;
 #endif
 	default:
 		plog(ASL_LEVEL_ERR, 
-			"invalid family: %d\n", remote.ss_family);
-		goto end;
+			"invalid family: %d\n", remote->ss_family);
+		METRICS_INC(METRICS_C_RECV_DROPPED);
+		return;
 	}
 	if (port == 0) {
 		plog(ASL_LEVEL_ERR,
 			"src port == 0 (valid as UDP but not with IKE)\n");
-		goto end;
+		METRICS_INC(METRICS_C_RECV_DROPPED);
+		return;
 	}
 
 	/* XXX: check sender whether to be allowed or not to accept */
@@ -314,27 +359,21 @@ isakmp_handler(int so_isakmp)
 
 	/* simply reply if the packet was processed. */
 
-	if (ike_session_check_recvdpkt(&remote, &local, buf)) {
+	if (ike_session_check_recvdpkt(remote, local, buf)) {
 		IPSECLOGASLMSG("Received retransmitted packet from %s.\n",
-					   saddr2str((struct sockaddr *)&remote));
+					   saddr2str((struct sockaddr *)remote));
 
 		plog(ASL_LEVEL_NOTICE, 
 			"the packet is retransmitted by %s.\n",
-			saddr2str((struct sockaddr *)&remote));
-		error = 0;
-		goto end;
+			saddr2str((struct sockaddr *)remote));
+		METRICS_INC(METRICS_C_RECV_RETRANSMIT);
+		return;
 	}
 
 	/* isakmp main routine */
-	isakmp_main(buf, &remote, &local);
-
-end:
-	if (tmpbuf != NULL)
-		vfree(tmpbuf);
-	if (buf != NULL)
-		vfree(buf);
+	isakmp_main(buf, remote, local);
 
-	return;
+	metrics_record(METRICS_H_RECV, start);
 }
 
 /*
@@ -426,6 +465,8 @@ ikev1_received_packet(vchar_t *msg, struct sockaddr_storage *local, struct socka
         
 	iph1 = ike_session_getph1byindex(session, index);
 	if (iph1 != NULL) {
+		ike_session_ikev1_roam_note(iph1, NULL, NULL);	/* from an earlier packet */
+
 		/* validity check */
 		if (memcmp(&isakmp->r_ck, r_ck0, sizeof(cookie_t)) == 0 &&
 		    iph1->side == INITIATOR) {
@@ -484,6 +525,18 @@ ikev1_received_packet(vchar_t *msg, struct sockaddr_storage *local, struct socka
 			      "NAT-T: ports changed to: %s\n",
 			      saddr2str_fromto("%s<->%s", (struct sockaddr *)iph1->remote, (struct sockaddr *)iph1->local));
 		}
+		/*
+		 * With fast_reconnect, a peer that roamed may bring an
+		 * established SA to new addresses.  Nothing moves until the
+		 * phase 2 or informational message is authenticated; see
+		 * ike_session_ikev1_roam_commit().
+		 */
+		else if (NATT_AVAILABLE(iph1) &&
+		    iph1->rmconf && iph1->rmconf->fast_reconnect && isakmp->msgid != 0 &&
+		    FSM_STATE_IS_ESTABLISHED(iph1->status) &&
+		    ((cmpsaddrstrict(iph1->remote, remote) != 0) ||
+		    (cmpsaddrstrict(iph1->local, local) != 0)))
+			ike_session_ikev1_roam_note(iph1, remote, local);
 
 		/* must be same addresses in one stream of a phase at least. */
 		if (cmpsaddrstrict(iph1->remote, remote) != 0) {
@@ -805,6 +858,7 @@ ikev1_ph1begin_i(ike_session_t *session, struct remoteconf *rmconf, struct socka
 		"begin %s mode.\n",
 		s_isakmp_etype(iph1->etype));
 
+	iph1->started = metrics_now();
 #ifdef ENABLE_STATS
 	gettimeofday(&iph1->start, NULL);
 	gettimeofday(&start, NULL);
@@ -934,6 +988,7 @@ ikev1_ph1begin_r(ike_session_t *session, vchar_t *msg, struct sockaddr_storage *
 	plog(ASL_LEVEL_NOTICE,
 		"begin %s mode.\n", s_isakmp_etype(etype));
 
+	iph1->started = metrics_now();
 #ifdef ENABLE_STATS
 	gettimeofday(&iph1->start, NULL);
 	gettimeofday(&start, NULL);
@@ -975,6 +1030,7 @@ ikev1_ph2begin_i(phase1_handle_t *iph1, phase2_handle_t *iph2)
 	racoon_free(a);
     }
 
+	iph2->started = metrics_now();
 #ifdef ENABLE_STATS
 	gettimeofday(&iph2->start, NULL);
 #endif
@@ -1098,6 +1154,7 @@ ikev1_ph2begin_r(phase1_handle_t *iph1, vchar_t *msg)
 	racoon_free(a);
     }
 
+	iph2->started = metrics_now();
 #ifdef ENABLE_STATS
 	gettimeofday(&start, NULL);
 #endif
@@ -1122,6 +1179,9 @@ ikev1_phase1_established(phase1_handle_t *iph1)
     u_int rekey_lifetime;
     int ini_contact = iph1->rmconf->ini_contact;
     
+    metrics_record(METRICS_H_PH1, iph1->started);
+    METRICS_INC(METRICS_C_PH1_ESTABLISHED);
+
 #ifdef ENABLE_STATS
     gettimeofday(&iph1->end, NULL);
     syslog(LOG_NOTICE, "%s(%s): %8.6f",
@@ -1177,6 +1237,8 @@ ikev1_phase1_established(phase1_handle_t *iph1)
         }
         rekey_lifetime = ike_session_get_rekey_lifetime((spi_cmp > 0),
                                                         iph1->approval->lifetime);
+        rekey_lifetime = rekeysched_jitter(rekey_lifetime,
+                                           iph1->approval->lifetime);
         if (rekey_lifetime) {
             iph1->sce_rekey = sched_new(rekey_lifetime,
                                         isakmp_ph1rekeyexpire_stub,
@@ -1233,8 +1295,17 @@ ikev1_phase1_established(phase1_handle_t *iph1)
     log_ph1established(iph1);
     plog(ASL_LEVEL_DEBUG, "===\n");
     
+    plog(ASL_LEVEL_DEBUG,
+         "phase 1 used %u arena buffer(s) in %u chunk(s), peak %zu bytes "
+         "(%llu heap buffers allocated so far).\n",
+         iph1->arena.nallocs, iph1->arena.nchunks, iph1->arena.peak,
+         (unsigned long long)vmbuf_stats.heap_allocs);
+    varena_release(&iph1->arena);
+    
     ike_session_cleanup_other_established_ph1s(iph1->parent_session, iph1);
     
+    ikev1_start_queued_ph2s(iph1);
+    
 #ifdef ENABLE_VPNCONTROL_PORT
     vpncontrol_notify_phase_change(0, FROM_LOCAL, iph1, NULL);
     vpncontrol_notify_peer_resp_ph1(1, iph1);
@@ -1243,8 +1314,45 @@ ikev1_phase1_established(phase1_handle_t *iph1)
     return 0;
 }
 
+/*
+ * start every phase 2 of the session that was queued waiting for an
+ * ISAKMP-SA.  Each would otherwise only notice the new phase 1 on its
+ * next isakmp_chkph1there tick; this way all their quick modes, GETSPIs
+ * included, go out back to back as soon as phase 1 is up.  The tick,
+ * kept in sce while the phase 2 waits, is cancelled first.
+ *
+ * they are not batched into one exchange: a quick mode carries a single
+ * IDci/IDcr pair (RFC 2409 5.5), so policies with different selectors
+ * each need their own.  each one with PFS still does its own DH.
+ */
+static void
+ikev1_start_queued_ph2s(phase1_handle_t *iph1)
+{
+	phase2_handle_t *p, *next;
+	int n = 0;
+
+	if (iph1->parent_session == NULL)
+		return;
+
+	LIST_FOREACH_SAFE(p, &iph1->parent_session->ph2tree, ph2ofsession_chain, next) {
+		if (p->is_dying || p->side != INITIATOR ||
+		    p->version != ISAKMP_VERSION_NUMBER_IKEV1 ||
+		    p->status != IKEV1_STATE_QUICK_I_START)
+			continue;
+		/* its next tick would find it past QUICK_I_START */
+		SCHED_KILL(p->sce);
+		isakmp_chkph1there(p);
+		n++;
+	}
+	if (n)
+		plog(ASL_LEVEL_NOTICE,
+			"started %d queued phase 2 negotiation(s).\n", n);
+}
+
 /*
  * parse ISAKMP payloads, without ISAKMP base header.
+ * whole messages are indexed with isakmp_plindex_parse() instead;
+ * this is kept for the nested proposal/transform chains of an SA.
  */
 vchar_t *
 isakmp_parsewoh(np0, gen, len)
@@ -1285,7 +1393,7 @@ isakmp_parsewoh(np0, gen, len)
 			return NULL;
 		}
 
-		plog(ASL_LEVEL_NOTICE,
+		plog(ASL_LEVEL_DEBUG,
 			"seen nptype=%u(%s)\n", np, s_isakmp_nptype(np));
 
 		p->type = np;
@@ -1329,27 +1437,6 @@ isakmp_parsewoh(np0, gen, len)
 	return result;
 }
 
-/*
- * parse ISAKMP payloads, including ISAKMP base header.
- */
-vchar_t *
-isakmp_parse(buf)
-	vchar_t *buf;
-{
-	struct isakmp *isakmp = (struct isakmp *)buf->v;
-	struct isakmp_gen *gen;
-	int tlen;
-	vchar_t *result;
-	u_char np;
-
-	np = isakmp->np;
-	gen = (struct isakmp_gen *)(buf->v + sizeof(*isakmp));
-	tlen = buf->l - sizeof(struct isakmp);
-	result = isakmp_parsewoh(np, gen, tlen);
-
-	return result;
-}
-
 int
 isakmp_init(void)
 {
@@ -1422,6 +1509,8 @@ isakmp_open(void)
     int tentative_failures = 0;
     int s;
     
+	myaddrs_gen++;
+
 	for (p = lcconf->myaddrs; p; p = p->next) {
 		if (!p->addr)
 			continue;
@@ -1693,6 +1782,8 @@ isakmp_close_sockets()
 {
 	struct myaddrs *p;
 
+	myaddrs_gen++;
+
 	for (p = lcconf->myaddrs; p; p = p->next) {
 
 		if (!p->addr)
@@ -1714,6 +1805,8 @@ isakmp_close_unused()
 {
 	struct myaddrs *p, *next, **prev;
 	
+	myaddrs_gen++;
+
 	prev = &(lcconf->myaddrs);
 	for (p = lcconf->myaddrs; p; p = next) {
 		next = p->next;
@@ -1733,77 +1826,107 @@ int
 isakmp_send(iph1, sbuf)
 	phase1_handle_t *iph1;
 	vchar_t *sbuf;
+{
+	struct iovec iov[2];
+
+	/* iov[0] is headroom for the NON-ESP marker */
+	iov[1].iov_base = sbuf->v;
+	iov[1].iov_len = sbuf->l;
+
+	return isakmp_sendv(iph1, iov, 2);
+}
+
+/*
+ * send a message made of iov[1] .. iov[iovcnt - 1].  iov[0] is headroom
+ * filled in here with the NON-ESP marker when NAT-T port floating is in
+ * use, so the message itself is never copied just to prepend it.
+ */
+int
+isakmp_sendv(iph1, iov, iovcnt)
+	phase1_handle_t *iph1;
+	struct iovec *iov;
+	int iovcnt;
 {
 	int len = 0;
 	int s;
-	vchar_t *vbuf = NULL;
-	
+	int first = 1;
+	size_t msglen = 0, sendlen;
+	int i;
 #ifdef ENABLE_NATT
+	u_int32_t marker = 0;
 	size_t extralen = NON_ESP_MARKER_USE(iph1) ? NON_ESP_MARKER_LEN : 0;
+#endif
+
+	for (i = 1; i < iovcnt; i++)
+		msglen += iov[i].iov_len;
+	sendlen = msglen;
 
+#ifdef ENABLE_NATT
 #ifdef ENABLE_FRAG
 	/* 
 	 * Do not add the non ESP marker for a packet that will
 	 * be fragmented. The non ESP marker should appear in 
 	 * all fragment's packets, but not in the fragmented packet
 	 */
-	if (iph1->frag && sbuf->l > ISAKMP_FRAG_MAXLEN) 
+	if (iph1->frag && msglen > ISAKMP_FRAG_MAXLEN) 
 		extralen = 0;
 #endif
-	if (extralen)
+	if (extralen) {
 		plog (ASL_LEVEL_DEBUG, "Adding NON-ESP marker\n");
 
-	/* If NAT-T port floating is in use, 4 zero bytes (non-ESP marker) 
-	   must added just before the packet itself. For this we must 
-	   allocate a new buffer and release it at the end. */
-	if (extralen) {
-		if ((vbuf = vmalloc (sbuf->l + extralen)) == NULL) {
-			plog(ASL_LEVEL_ERR, 
-			    "vbuf allocation failed\n");
-			return -1;
-		}
-		*ALIGNED_CAST(u_int32_t *)vbuf->v = 0;
-		memcpy (vbuf->v + extralen, sbuf->v, sbuf->l);
-		sbuf = vbuf;
+		/* If NAT-T port floating is in use, 4 zero bytes (non-ESP marker) 
+		   must be sent just before the packet itself. */
+		iov[0].iov_base = &marker;
+		iov[0].iov_len = extralen;
+		sendlen += extralen;
+		first = 0;
 	}
 #endif
 
 	/* select the socket to be sent */
-	s = getsockmyaddr((struct sockaddr *)iph1->local);
-	if (s == -1){
-		if ( vbuf != NULL )
-			vfree(vbuf);
+	s = getsockmyaddr_cached((struct sockaddr *)iph1->local, &iph1->sendsock);
+	if (s == -1)
 		return -1;
-	}
 
-	plog (ASL_LEVEL_DEBUG, "%zu bytes %s\n", sbuf->l, 
+	plog (ASL_LEVEL_DEBUG, "%zu bytes %s\n", sendlen,
 	      saddr2str_fromto("from %s to %s", (struct sockaddr *)iph1->local, (struct sockaddr *)iph1->remote));
 
 #ifdef ENABLE_FRAG
-	if (iph1->frag && sbuf->l > ISAKMP_FRAG_MAXLEN) {
-		if (isakmp_sendfrags(iph1, sbuf) == -1) {
+	if (iph1->frag && msglen > ISAKMP_FRAG_MAXLEN) {
+		vchar_t sbuf, *vbuf = NULL;
+
+		/* fragmenting copies anyway, flatten only when segmented */
+		if (iovcnt == 2) {
+			sbuf.v = iov[1].iov_base;
+			sbuf.l = iov[1].iov_len;
+			sbuf.arena = NULL;
+		} else {
+			if ((vbuf = vgather(&iov[1], iovcnt - 1)) == NULL) {
+				plog(ASL_LEVEL_ERR, 
+				    "vbuf allocation failed\n");
+				return -1;
+			}
+			sbuf = *vbuf;
+		}
+		len = isakmp_sendfrags(iph1, &sbuf);
+		if (vbuf != NULL)
+			vfree(vbuf);
+		if (len == -1) {
 			plog(ASL_LEVEL_ERR, 
 			    "isakmp_sendfrags failed\n");
-			if ( vbuf != NULL )
-				vfree(vbuf);
 			return -1;
 		}
 	} else 
 #endif
 	{
-		len = sendfromto(s, sbuf->v, sbuf->l,
+		len = sendvfromto(&iph1->sendsock, &iov[first], iovcnt - first,
 		    iph1->local, iph1->remote, lcconf->count_persend);
 		if (len == -1) {
 			plog(ASL_LEVEL_ERR, "sendfromto failed\n");
-			if ( vbuf != NULL )
-				vfree(vbuf);
 			return -1;
 		}
 	}
 	
-	if ( vbuf != NULL )
-		vfree(vbuf);
-	
 	return 0;
 }
 
@@ -1856,6 +1979,7 @@ isakmp_ph1resend(iph1)
 		return -1;
 	} else {
 		ike_session_ph1_retransmits(iph1);
+		METRICS_INC(METRICS_C_PH1_RESEND);
 	}
 
 	if (isakmp_send(iph1, iph1->sendbuf) < 0){
@@ -1942,6 +2066,7 @@ isakmp_ph2resend(iph2)
 		return -1;
 	} else {
 		ike_session_ph2_retransmits(iph2);
+		METRICS_INC(METRICS_C_PH2_RESEND);
 	}
 
 	if (isakmp_send(iph2->ph1, iph2->sendbuf) < 0){
@@ -2002,7 +2127,7 @@ isakmp_ph1expire(iph1)
 
 	SCHED_KILL(iph1->sce);
 #ifdef ENABLE_DPD
-    SCHED_KILL(iph1->dpd_r_u);
+    isakmp_unsched_r_u(iph1);
 #endif
 
 	if(!FSM_STATE_IS_EXPIRED(iph1->status)){
@@ -2047,7 +2172,6 @@ phase1_handle_t *iph1;
 int               ignore_sess_drop_policy;
 {
 	char              *src, *dst;
-	struct remoteconf *rmconf;
 
 	SCHED_KILL(iph1->sce_rekey);
 
@@ -2098,6 +2222,27 @@ int               ignore_sess_drop_policy;
 		return;
 	}
 
+	// hold it back if the rekey budget for this second is used up
+	if (!rekeysched_admit_ph1(iph1, isakmp_ph1rekeybegin))
+		return;
+	isakmp_ph1rekeybegin(iph1);
+}
+
+/*
+ * Start the phase 1 rekey, directly or once the rekey budget let it
+ * through.
+ */
+static void
+isakmp_ph1rekeybegin(phase1_handle_t *iph1)
+{
+	struct remoteconf *rmconf;
+
+	if (!FSM_STATE_IS_ESTABLISHED(iph1->status) ||
+		iph1->is_dying ||
+		ike_session_has_other_established_ph1(iph1->parent_session, iph1)) {
+		return;
+	}
+
     // get rmconf to initiate rekey with
     rmconf = iph1->rmconf;
     if (!rmconf)
@@ -2210,7 +2355,7 @@ isakmp_ph1delete(iph1)
 	SCHED_KILL(iph1->sce);
 	SCHED_KILL(iph1->sce_rekey);
 #ifdef ENABLE_DPD
-    SCHED_KILL(iph1->dpd_r_u);
+    isakmp_unsched_r_u(iph1);
 #endif    
 
 	if (LIST_FIRST(&iph1->bound_ph2tree) != NULL) {
@@ -2382,7 +2527,7 @@ isakmp_post_acquire(phase2_handle_t *iph2)
 		iph2->retry_checkph1 = lcconf->retry_checkph1;
         
 		/* start phase 1 negotiation as a initiator. */
-		sched_new(1, isakmp_chkph1there_stub, iph2);
+		iph2->sce = sched_new(1, isakmp_chkph1there_stub, iph2);
 		
 		plog(ASL_LEVEL_NOTICE,
 			 "IPsec-SA request for %s queued due to no Phase 1 found.\n",
@@ -2406,7 +2551,7 @@ isakmp_post_acquire(phase2_handle_t *iph2)
 	/* found ISAKMP-SA, but on negotiation. */
 	if (!FSM_STATE_IS_ESTABLISHED(iph1->status)) {
 		iph2->retry_checkph1 = lcconf->retry_checkph1;
-		sched_new(1, isakmp_chkph1there_stub, iph2);
+		iph2->sce = sched_new(1, isakmp_chkph1there_stub, iph2);
 		plog(ASL_LEVEL_NOTICE,
 			"Request for establishing IPsec-SA was queued due to no phase1 found.\n");
 		return 0;
@@ -2557,7 +2702,7 @@ isakmp_chkph1there(iph2)
 	plog(ASL_LEVEL_NOTICE, "CHKPH1THERE: no established ph1 handler found\n");
 
 	/* no isakmp-sa found */
-	sched_new(1, isakmp_chkph1there_stub, iph2);
+	iph2->sce = sched_new(1, isakmp_chkph1there_stub, iph2);
 
 	return;
 }
@@ -2734,16 +2879,26 @@ isakmp_newcookie(place, remote, local)
 	memcpy(p, (caddr_t)&t, sizeof(t));
 	p += sizeof(t);
 
-	/* copy random value */
-	buf2 = eay_set_random(lcconf->secret_size);
-	if (buf2 == NULL)
-		goto end;
-	memcpy(p, buf2->v, lcconf->secret_size);
-	p += lcconf->secret_size;
-	vfree(buf2);
+	/*
+	 * when sharded, packets are steered by the initiator cookie, so
+	 * draw again until it maps to this shard.
+	 */
+	do {
+		if (buf2 != NULL)
+			vfree(buf2);
+
+		/* copy random value */
+		buf2 = eay_set_random(lcconf->secret_size);
+		if (buf2 == NULL)
+			goto end;
+		memcpy(p, buf2->v, lcconf->secret_size);
+		vfree(buf2);
 
-	buf2 = eay_sha1_one(buf);
-	memcpy(place, buf2->v, sizeof(cookie_t));
+		buf2 = eay_sha1_one(buf);
+		if (buf2 == NULL)
+			goto end;
+		memcpy(place, buf2->v, sizeof(cookie_t));
+	} while (shard_of_cookie(place) != shard_index);
 
 	sa1 = val2str(place, sizeof (cookie_t));
 	plog(ASL_LEVEL_DEBUG, "new cookie:\n%s\n", sa1);
@@ -3179,54 +3334,63 @@ isakmp_plist_append (struct payload_list *plist, vchar_t *payload, int payload_t
 	return plist;
 }
 
-vchar_t * 
-isakmp_plist_set_all (struct payload_list **plist, phase1_handle_t *iph1)
+/*
+ * turn the payload list into a message builder and free the list.
+ */
+static void
+isakmp_plist_build (struct payload_list **plist, phase1_handle_t *iph1,
+    struct isakmp_msgb *mb)
 {
-	struct payload_list *ptr = *plist, *first;
-	size_t tlen = sizeof (struct isakmp), n = 0;
-	vchar_t *buf = NULL;
-	char *p;
+	struct payload_list *ptr = *plist, *next;
 
 	/* Seek to the first item.  */
 	while (ptr->prev) ptr = ptr->prev;
-	first = ptr;
-	
-	/* Compute the whole length.  */
-	while (ptr) {
-		tlen += ptr->payload->l + sizeof (struct isakmp_gen);
-		ptr = ptr->next;
-	}
 
-	buf = vmalloc(tlen);
-	if (buf == NULL) {
-		plog(ASL_LEVEL_ERR, 
-			"failed to get buffer to send.\n");
-		goto end;
+	isakmp_msgb_init(mb, iph1, iph1->etype, iph1->flags, iph1->msgid);
+
+	for (; ptr != NULL; ptr = next) {
+		isakmp_msgb_add(mb, ptr->payload, ptr->payload_type);
+		next = ptr->next;
+		racoon_free(ptr);
 	}
 
-	ptr = first;
+	*plist = NULL;
+}
+
+vchar_t * 
+isakmp_plist_set_all (struct payload_list **plist, phase1_handle_t *iph1)
+{
+	struct isakmp_msgb mb;
 
-	p = set_isakmp_header1(buf, iph1, ptr->payload_type);
-	if (p == NULL)
-		goto end;
+	isakmp_plist_build(plist, iph1, &mb);
 
-	while (ptr)
+	return isakmp_msgb_flatten(&mb);
+}
+
+/*
+ * like isakmp_plist_set_all() but the payloads are encrypted straight
+ * from the list, without building the plain text message first.
+ */
+vchar_t *
+isakmp_plist_encrypt (struct payload_list **plist, phase1_handle_t *iph1,
+    vchar_t *ivep, vchar_t *ivp)
+{
+	struct isakmp_msgb mb;
+
+	isakmp_plist_build(plist, iph1, &mb);
+
+#ifdef HAVE_PRINT_ISAKMP_C
 	{
-		p = set_isakmp_payload (p, ptr->payload, ptr->next ? ptr->next->payload_type : ISAKMP_NPTYPE_NONE);
-		first = ptr;
-		ptr = ptr->next;
-		racoon_free (first);
-		/* ptr->prev = NULL; first = NULL; ... omitted.  */
-		n++;
-	}
+		vchar_t *buf = isakmp_msgb_flatten(&mb);
 
-	*plist = NULL;
+		if (buf != NULL) {
+			isakmp_printpacket(buf, iph1->local, iph1->remote, 1);
+			vfree(buf);
+		}
+	}
+#endif
 
-	return buf;
-end:
-	if (buf != NULL)
-		vfree(buf);
-	return NULL;
+	return isakmp_msgb_encrypt(&mb, iph1, ivep, ivp);
 }
 
 #ifdef ENABLE_FRAG
@@ -3311,7 +3475,7 @@ purge_remote(iph1)
 			continue;
 		}
 
-		if (pfkey_align(msg, mhp) || pfkey_check(mhp)) {
+		if (pfkey_parse(msg, (caddr_t)end - (caddr_t)msg, mhp)) {
 			plog(ASL_LEVEL_ERR, 
 				"pfkey_check (%s)\n", ipsec_strerror());
 			msg = next;
@@ -68,6 +68,7 @@
 #include "isakmp.h"
 #include "oakley.h"
 #include "handler.h"
+#include "isakmp_plindex.h"
 #include "ipsec_doi.h"
 #include "crypto_openssl.h"
 #include "pfkey.h"
@@ -95,6 +96,47 @@
 #include <Security/SecDH.h>
 #endif
 
+/* payloads accepted in each aggressive mode message, besides their order */
+static const struct isakmp_plindex_rule agg_i2_rules[] = {
+	{ ISAKMP_NPTYPE_SA,	1 },
+	{ ISAKMP_NPTYPE_KE,	1 },
+	{ ISAKMP_NPTYPE_NONCE,	1 },
+	{ ISAKMP_NPTYPE_ID,	1 },
+	{ ISAKMP_NPTYPE_HASH,	1 },
+	{ ISAKMP_NPTYPE_CR,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_CERT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_SIG,	1 },
+	{ ISAKMP_NPTYPE_VID,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_N,	ISAKMP_PLINDEX_ANY },
+#ifdef ENABLE_NATT
+	{ ISAKMP_NPTYPE_NATD_DRAFT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NATD_RFC,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NATD_BADDRAFT,	ISAKMP_PLINDEX_ANY },
+#endif
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+static const struct isakmp_plindex_rule agg_r1_rules[] = {
+	{ ISAKMP_NPTYPE_SA,	1 },
+	{ ISAKMP_NPTYPE_KE,	1 },
+	{ ISAKMP_NPTYPE_NONCE,	1 },
+	{ ISAKMP_NPTYPE_ID,	1 },
+	{ ISAKMP_NPTYPE_VID,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_CR,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+static const struct isakmp_plindex_rule agg_r3_rules[] = {
+	{ ISAKMP_NPTYPE_HASH,	1 },
+	{ ISAKMP_NPTYPE_VID,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_CERT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_SIG,	1 },
+	{ ISAKMP_NPTYPE_N,	ISAKMP_PLINDEX_ANY },
+#ifdef ENABLE_NATT
+	{ ISAKMP_NPTYPE_NATD_DRAFT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NATD_RFC,	ISAKMP_PLINDEX_ANY },
+#endif
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+
 /*
  * begin Aggressive Mode as initiator.
  */
@@ -313,8 +355,6 @@ end:
 								CONSTSTR("Initiator, Aggressive-Mode Message 1"),
 								CONSTSTR("Failed to transmit Aggressive-Mode Message 1"));
 	}
-	if (cr)
-		vfree(cr);
 #ifdef ENABLE_FRAG
 	if (vid_frag)
 		vfree(vid_frag);
@@ -350,8 +390,9 @@ agg_i2recv(iph1, msg)
 	phase1_handle_t *iph1;
 	vchar_t *msg;
 {
-	vchar_t *pbuf = NULL;
+	struct isakmp_plindex plidx;
 	struct isakmp_parse_t *pa;
+	struct isakmp_gen *gen;
 	vchar_t *satmp = NULL;
 	int error = -1;
 	int vid_numeric;
@@ -369,6 +410,8 @@ agg_i2recv(iph1, msg)
 	TAILQ_INIT(&natd_tree);
 #endif
 
+	isakmp_plindex_init(&plidx);
+
     /* validity check */
 	if (iph1->status != IKEV1_STATE_AGG_I_MSG1SENT) {
 		plog(ASL_LEVEL_ERR,
@@ -377,167 +420,158 @@ agg_i2recv(iph1, msg)
 	}
 
 	/* validate the type of next payload */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		goto end;
 	}
-	pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
 
-	iph1->pl_hash = NULL;
+	iph1->pl_hash = isakmp_plindex_hash(&plidx);
 
 	/* SA payload is fixed postion */
-	if (pa->type != ISAKMP_NPTYPE_SA) {
+	if (plidx.pl[0].type != ISAKMP_NPTYPE_SA) {
 		plog(ASL_LEVEL_ERR,
 			"received invalid next payload type %d, "
 			"expecting %d.\n",
-			pa->type, ISAKMP_NPTYPE_SA);
+			plidx.pl[0].type, ISAKMP_NPTYPE_SA);
+		goto end;
+	}
+	if ((pa = isakmp_plindex_check(&plidx, agg_i2_rules)) != NULL) {
+		/* don't send information, see isakmp_ident_r1() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
 		goto end;
 	}
 
-	if (isakmp_p2ph(&satmp, pa->ptr) < 0) {
+	if (isakmp_p2ph(&satmp, plidx.pl[0].ptr) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to process SA payload");
 		goto end;
 	}
-	pa++;
-
-	for (/*nothing*/;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_KE)) != NULL &&
+	    isakmp_p2ph(&iph1->dhpub_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process KE payload");
+		goto end;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_NONCE)) != NULL &&
+	    isakmp_p2ph(&iph1->nonce_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process NONCE payload");
+		goto end;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_ID)) != NULL &&
+	    isakmp_p2ph(&iph1->id_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process ID payload");
+		goto end;
+	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_CR);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		if (oakley_savecr(iph1, pa->ptr) < 0) {
+			plog(ASL_LEVEL_ERR, 
+				 "failed to process CR payload");
+			goto end;
+		}
+	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_CERT);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		if (oakley_savecert(iph1, pa->ptr) < 0) {
+			plog(ASL_LEVEL_ERR, 
+				 "failed to process CERT payload");
+			goto end;
+		}
+		received_cert = 1;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_SIG)) != NULL &&
+	    isakmp_p2ph(&iph1->sig_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process SIG payload");
+		goto end;
+	}
 
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_KE:
-			if (isakmp_p2ph(&iph1->dhpub_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process KE payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_NONCE:
-			if (isakmp_p2ph(&iph1->nonce_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process NONCE payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_ID:
-			if (isakmp_p2ph(&iph1->id_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process ID payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_HASH:
-			iph1->pl_hash = (struct isakmp_pl_hash *)pa->ptr;
-			break;
-		case ISAKMP_NPTYPE_CR:
-			if (oakley_savecr(iph1, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process CR payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_CERT:
-			if (oakley_savecert(iph1, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process CERT payload");
-				goto end;
-			}
-			received_cert = 1;
-			break;
-		case ISAKMP_NPTYPE_SIG:
-			if (isakmp_p2ph(&iph1->sig_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process SIG payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_VID:
-			vid_numeric = check_vendorid(pa->ptr);
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_VID);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		vid_numeric = check_vendorid(pa->ptr);
 #ifdef ENABLE_NATT
-			if (iph1->rmconf->nat_traversal && 
-			    natt_vendorid(vid_numeric))
-				natt_handle_vendorid(iph1, vid_numeric);
+		if (iph1->rmconf->nat_traversal && 
+		    natt_vendorid(vid_numeric))
+			natt_handle_vendorid(iph1, vid_numeric);
 #endif
 #ifdef ENABLE_HYBRID
-			switch (vid_numeric) {
-			case VENDORID_XAUTH:
-				iph1->mode_cfg->flags |= 
-				    ISAKMP_CFG_VENDORID_XAUTH;
-				break;
-
-			case VENDORID_UNITY:
-				iph1->mode_cfg->flags |= 
-				    ISAKMP_CFG_VENDORID_UNITY;
-				break;
-			default:
-				break;
-			}
+		switch (vid_numeric) {
+		case VENDORID_XAUTH:
+			iph1->mode_cfg->flags |= 
+			    ISAKMP_CFG_VENDORID_XAUTH;
+			break;
+
+		case VENDORID_UNITY:
+			iph1->mode_cfg->flags |= 
+			    ISAKMP_CFG_VENDORID_UNITY;
+			break;
+		default:
+			break;
+		}
 #endif
 #ifdef ENABLE_DPD
-			if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd) {
-				iph1->dpd_support=1;
-				plog(ASL_LEVEL_DEBUG, 
-					 "remote supports DPD\n");
-			}
+		if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd) {
+			iph1->dpd_support=1;
+			plog(ASL_LEVEL_DEBUG, 
+				 "remote supports DPD\n");
+		}
 #endif
 #ifdef ENABLE_FRAG
-			if ((vid_numeric == VENDORID_FRAG) &&
-				(vendorid_frag_cap(pa->ptr) & VENDORID_FRAG_AGG)) {
-				plog(ASL_LEVEL_DEBUG, 
-					 "remote supports FRAGMENTATION\n");
-				iph1->frag = 1;
-			}
+		if ((vid_numeric == VENDORID_FRAG) &&
+			(vendorid_frag_cap(pa->ptr) & VENDORID_FRAG_AGG)) {
+			plog(ASL_LEVEL_DEBUG, 
+				 "remote supports FRAGMENTATION\n");
+			iph1->frag = 1;
+		}
 #endif
-			break;
-		case ISAKMP_NPTYPE_N:
-			isakmp_check_notify(pa->ptr, iph1);
-			break;
+	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_N);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		isakmp_check_notify(pa->ptr, iph1);
 
 #ifdef ENABLE_NATT
-		case ISAKMP_NPTYPE_NATD_DRAFT:
-		case ISAKMP_NPTYPE_NATD_RFC:
-		case ISAKMP_NPTYPE_NATD_BADDRAFT:
-			if (NATT_AVAILABLE(iph1) && iph1->natt_options != NULL &&
-			    pa->type == iph1->natt_options->payload_nat_d) {
-				struct natd_payload *natd;
-				natd = (struct natd_payload *)racoon_malloc(sizeof(*natd));
-				if (!natd) {
-					plog(ASL_LEVEL_ERR, 
-						 "failed to pre-process NATD payload");
-					goto end;
-				}
-
-				natd->payload = NULL;
-
-				if (isakmp_p2ph (&natd->payload, pa->ptr) < 0) {
-					plog(ASL_LEVEL_ERR, 
-						 "failed to process NATD payload");
-					racoon_free(natd);
-					goto end;
-				}
-
-				natd->seq = natd_seq++;
-
-				TAILQ_INSERT_TAIL(&natd_tree, natd, chain);
-				break;
+	/*
+	 * %%% Be lenient here - some servers send natd payloads
+	 * when nat not detected
+	 */
+	if (NATT_AVAILABLE(iph1) && iph1->natt_options != NULL) {
+		for (pa = isakmp_plindex_first(&plidx,
+			iph1->natt_options->payload_nat_d);
+		     pa != NULL;
+		     pa = isakmp_plindex_next(&plidx, pa)) {
+			struct natd_payload *natd;
+			natd = (struct natd_payload *)racoon_malloc(sizeof(*natd));
+			if (!natd) {
+				plog(ASL_LEVEL_ERR, 
+					 "failed to pre-process NATD payload");
+				goto end;
 			}
-			/* %%% Be lenient here - some servers send natd payloads */
-			/* when nat not detected								 */
-			break;
-#endif
 
-		default:
-			/* don't send information, see isakmp_ident_r1() */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
-			goto end;
+			natd->payload = NULL;
+
+			if (isakmp_p2ph (&natd->payload, pa->ptr) < 0) {
+				plog(ASL_LEVEL_ERR, 
+					 "failed to process NATD payload");
+				racoon_free(natd);
+				goto end;
+			}
+
+			natd->seq = natd_seq++;
+
+			TAILQ_INSERT_TAIL(&natd_tree, natd, chain);
 		}
 	}
+#endif
 
 	if (received_cert) {
 		oakley_verify_certid(iph1);
@@ -691,8 +725,6 @@ end:
 								CONSTSTR("Failure processing Aggressive-Mode Message 2"));
 	}
 
-	if (pbuf)
-		vfree(pbuf);
 	if (satmp)
 		vfree(satmp);
 	if (error) {
@@ -708,6 +740,7 @@ end:
 		iph1->cr_p = NULL;
 	}
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -904,10 +937,13 @@ agg_r1recv(iph1, msg)
 	vchar_t *msg;
 {
 	int error = -1;
-	vchar_t *pbuf = NULL;
+	struct isakmp_plindex plidx;
 	struct isakmp_parse_t *pa;
+	struct isakmp_gen *gen;
 	int vid_numeric;
 
+	isakmp_plindex_init(&plidx);
+
     /* validity check */
 	if (iph1->status != IKEV1_STATE_AGG_R_START) {
 		plog(ASL_LEVEL_ERR,
@@ -916,115 +952,107 @@ agg_r1recv(iph1, msg)
 	}
 
 	/* validate the type of next payload */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		goto end;
 	}
-	pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
 
 	/* SA payload is fixed postion */
-	if (pa->type != ISAKMP_NPTYPE_SA) {
+	if (plidx.pl[0].type != ISAKMP_NPTYPE_SA) {
 		plog(ASL_LEVEL_ERR,
 			"received invalid next payload type %d, "
 			"expecting %d.\n",
-			pa->type, ISAKMP_NPTYPE_SA);
+			plidx.pl[0].type, ISAKMP_NPTYPE_SA);
+		goto end;
+	}
+	for (pa = plidx.pl + 1; pa->type != ISAKMP_NPTYPE_NONE; pa++)
+		plog(ASL_LEVEL_DEBUG, 
+			"received payload of type %s\n",
+			s_isakmp_nptype(pa->type));
+	if ((pa = isakmp_plindex_check(&plidx, agg_r1_rules)) != NULL) {
+		/* don't send information, see isakmp_ident_r1() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
 		goto end;
 	}
-	if (isakmp_p2ph(&iph1->sa, pa->ptr) < 0) {
+
+	if (isakmp_p2ph(&iph1->sa, plidx.pl[0].ptr) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to process SA payload");
 		goto end;
 	}
-	pa++;
-
-	for (/*nothing*/;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_KE)) != NULL &&
+	    isakmp_p2ph(&iph1->dhpub_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process KE payload");
+		goto end;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_NONCE)) != NULL &&
+	    isakmp_p2ph(&iph1->nonce_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process NONCE payload");
+		goto end;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_ID)) != NULL &&
+	    isakmp_p2ph(&iph1->id_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process ID payload");
+		goto end;
+	}
 
-		plog(ASL_LEVEL_DEBUG, 
-			"received payload of type %s\n",
-			s_isakmp_nptype(pa->type));
-
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_KE:
-			if (isakmp_p2ph(&iph1->dhpub_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process KE payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_NONCE:
-			if (isakmp_p2ph(&iph1->nonce_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process NONCE payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_ID:
-			if (isakmp_p2ph(&iph1->id_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process ID payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_VID:
-			vid_numeric = check_vendorid(pa->ptr);
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_VID);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		vid_numeric = check_vendorid(pa->ptr);
 
 #ifdef ENABLE_NATT
-			if (iph1->rmconf->nat_traversal &&
-			    natt_vendorid(vid_numeric)) {
-				natt_handle_vendorid(iph1, vid_numeric);
-				break;
-			}
+		if (iph1->rmconf->nat_traversal &&
+		    natt_vendorid(vid_numeric)) {
+			natt_handle_vendorid(iph1, vid_numeric);
+			continue;
+		}
 #endif
 #ifdef ENABLE_HYBRID
-			switch (vid_numeric) {
-			case VENDORID_XAUTH:
-				iph1->mode_cfg->flags |= 
-				    ISAKMP_CFG_VENDORID_XAUTH;
-				break;
-
-			case VENDORID_UNITY:
-				iph1->mode_cfg->flags |= 
-				    ISAKMP_CFG_VENDORID_UNITY;
-				break;
-			default:
-				break;
-			}
+		switch (vid_numeric) {
+		case VENDORID_XAUTH:
+			iph1->mode_cfg->flags |= 
+			    ISAKMP_CFG_VENDORID_XAUTH;
+			break;
+
+		case VENDORID_UNITY:
+			iph1->mode_cfg->flags |= 
+			    ISAKMP_CFG_VENDORID_UNITY;
+			break;
+		default:
+			break;
+		}
 #endif
 #ifdef ENABLE_DPD
-			if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd) {
-				iph1->dpd_support=1;
-				plog(ASL_LEVEL_DEBUG, 
-					 "remote supports DPD\n");
-			}
+		if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd) {
+			iph1->dpd_support=1;
+			plog(ASL_LEVEL_DEBUG, 
+				 "remote supports DPD\n");
+		}
 #endif
 #ifdef ENABLE_FRAG
-			if ((vid_numeric == VENDORID_FRAG) &&
-				(vendorid_frag_cap(pa->ptr) & VENDORID_FRAG_AGG)) {
-				plog(ASL_LEVEL_DEBUG, 
-					 "remote supports FRAGMENTATION\n");
-				iph1->frag = 1;
-			}
+		if ((vid_numeric == VENDORID_FRAG) &&
+			(vendorid_frag_cap(pa->ptr) & VENDORID_FRAG_AGG)) {
+			plog(ASL_LEVEL_DEBUG, 
+				 "remote supports FRAGMENTATION\n");
+			iph1->frag = 1;
+		}
 #endif
-			break;
-
-		case ISAKMP_NPTYPE_CR:
-			if (oakley_savecr(iph1, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process CR payload");
-				goto end;
-			}
-			break;
+	}
 
-		default:
-			/* don't send information, see isakmp_ident_r1() */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_CR);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		if (oakley_savecr(iph1, pa->ptr) < 0) {
+			plog(ASL_LEVEL_ERR, 
+				 "failed to process CR payload");
 			goto end;
 		}
 	}
@@ -1082,8 +1110,6 @@ end:
 								CONSTSTR("Failed to process Aggressive-Mode Message 1"));
 	}
 
-	if (pbuf)
-		vfree(pbuf);
 	if (error) {
 		VPTRINIT(iph1->sa);
 		VPTRINIT(iph1->dhpub_p);
@@ -1093,6 +1119,7 @@ end:
 		iph1->cr_p = NULL;
 	}
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -1434,8 +1461,6 @@ end:
 								CONSTSTR("Responder, Aggressive-Mode Message 2"),
 								CONSTSTR("Failed to process Aggressive-Mode Message 2"));
 	}
-	if (cr)
-		vfree(cr);
 #ifdef ENABLE_HYBRID
 	if (xauth_vid)
 		vfree(xauth_vid);
@@ -1476,8 +1501,9 @@ agg_r3recv(iph1, msg0)
 	vchar_t *msg0;
 {
 	vchar_t *msg = NULL;
-	vchar_t *pbuf = NULL;
+	struct isakmp_plindex plidx;
 	struct isakmp_parse_t *pa;
+	struct isakmp_gen *gen;
 	int error = -1;
 	int ptype;
 
@@ -1486,6 +1512,8 @@ agg_r3recv(iph1, msg0)
 #endif
 	int received_cert = 0;
 
+	isakmp_plindex_init(&plidx);
+
     /* validity check */
 	if (iph1->status != IKEV1_STATE_AGG_R_MSG2SENT) {
 		plog(ASL_LEVEL_ERR,
@@ -1507,87 +1535,81 @@ agg_r3recv(iph1, msg0)
 		msg = vdup(msg0);
 
 	/* validate the type of next payload */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		goto end;
 	}
 
-	iph1->pl_hash = NULL;
+	iph1->pl_hash = isakmp_plindex_hash(&plidx);
 
-	for (pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
+	if ((pa = isakmp_plindex_check(&plidx, agg_r3_rules)) != NULL) {
+		/* don't send information, see isakmp_ident_r1() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
+		goto end;
+	}
 
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_HASH:
-			iph1->pl_hash = (struct isakmp_pl_hash *)pa->ptr;
-			break;
-		case ISAKMP_NPTYPE_VID:
-			(void)check_vendorid(pa->ptr);
-			break;
-		case ISAKMP_NPTYPE_CERT:
-			if (oakley_savecert(iph1, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process CERT payload");
-				goto end;
-			}
-			received_cert = 1;
-			break;
-		case ISAKMP_NPTYPE_SIG:
-			if (isakmp_p2ph(&iph1->sig_p, pa->ptr) < 0) {
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_VID);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		(void)check_vendorid(pa->ptr);
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_CERT);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		if (oakley_savecert(iph1, pa->ptr) < 0) {
+			plog(ASL_LEVEL_ERR, 
+				 "failed to process CERT payload");
+			goto end;
+		}
+		received_cert = 1;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_SIG)) != NULL &&
+	    isakmp_p2ph(&iph1->sig_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process SIG payload");
+		goto end;
+	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_N);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		isakmp_check_notify(pa->ptr, iph1);
+
+#ifdef ENABLE_NATT
+	/*
+	 * %%%% Be lenient here - some servers send natd payloads
+	 * when no nat is detected
+	 */
+	if (NATT_AVAILABLE(iph1) && iph1->natt_options != NULL) {
+		for (pa = isakmp_plindex_first(&plidx,
+			iph1->natt_options->payload_nat_d);
+		     pa != NULL;
+		     pa = isakmp_plindex_next(&plidx, pa)) {
+			vchar_t *natd_received = NULL;
+			int natd_verified;
+
+			if (isakmp_p2ph (&natd_received, pa->ptr) < 0) {
 				plog(ASL_LEVEL_ERR, 
-					 "failed to process SIG payload");
+					 "failed to process NATD payload");
 				goto end;
 			}
-			break;
-		case ISAKMP_NPTYPE_N:
-			isakmp_check_notify(pa->ptr, iph1);
-			break;
 
-#ifdef ENABLE_NATT
-		case ISAKMP_NPTYPE_NATD_DRAFT:
-		case ISAKMP_NPTYPE_NATD_RFC:
-			if (NATT_AVAILABLE(iph1) && iph1->natt_options != NULL &&
-				pa->type == iph1->natt_options->payload_nat_d)
-			{
-				vchar_t *natd_received = NULL;
-				int natd_verified;
-				
-				if (isakmp_p2ph (&natd_received, pa->ptr) < 0) {
-					plog(ASL_LEVEL_ERR, 
-						 "failed to process NATD payload");
-					goto end;
-				}
-				
-				if (natd_seq == 0)
-					iph1->natt_flags |= NAT_DETECTED;
-				
-				natd_verified = natt_compare_addr_hash (iph1,
-					natd_received, natd_seq++);
-				
-				plog (ASL_LEVEL_NOTICE, "NAT-D payload #%d %s\n",
-					natd_seq - 1,
-					natd_verified ? "verified" : "doesn't match");
-				
-				vfree (natd_received);
-				break;
-			}
-			/* %%%% Be lenient here - some servers send natd payloads */
-			/* when no nat is detected								  */
-			break;
-#endif
+			if (natd_seq == 0)
+				iph1->natt_flags |= NAT_DETECTED;
 
-		default:
-			/* don't send information, see isakmp_ident_r1() */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
-			goto end;
+			natd_verified = natt_compare_addr_hash (iph1,
+				natd_received, natd_seq++);
+
+			plog (ASL_LEVEL_NOTICE, "NAT-D payload #%d %s\n",
+				natd_seq - 1,
+				natd_verified ? "verified" : "doesn't match");
+
+			vfree (natd_received);
 		}
 	}
+#endif
 
 #ifdef ENABLE_NATT
 	if (NATT_AVAILABLE(iph1))
@@ -1637,8 +1659,6 @@ end:
 								CONSTSTR("Responder, Aggressive-Mode Message 3"),
 								CONSTSTR("Failed to process Aggressive-Mode Message 3"));
 	}
-	if (pbuf)
-		vfree(pbuf);
 	if (msg)
 		vfree(msg);
 	if (error) {
@@ -1649,6 +1669,7 @@ end:
 		VPTRINIT(iph1->sig_p);
 	}
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
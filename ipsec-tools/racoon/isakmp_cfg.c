@@ -87,6 +87,7 @@
 #include "isakmp_var.h"
 #include "isakmp.h"
 #include "handler.h"
+#include "isakmp_plindex.h"
 #include "throttle.h"
 #include "remoteconf.h"
 #include "localconf.h"
@@ -102,6 +103,7 @@
 #include "ipsecSessionTracer.h"
 #include "ipsecMessageTracer.h"
 #include "nattraversal.h"
+#include "shard.h"
 
 struct isakmp_cfg_config isakmp_cfg_config;
 
@@ -123,6 +125,13 @@ void isakmp_cfg_iplist_to_str (char *, int, void *, int);
 #define ISAKMP_CFG_LOGIN	1
 #define ISAKMP_CFG_LOGOUT	2
 
+/* payloads handled in a mode config exchange */
+static const struct isakmp_plindex_rule cfg_rules[] = {
+	{ ISAKMP_NPTYPE_HASH,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_ATTR,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+
 /* 
  * Handle an ISAKMP config mode packet
  * We expect HDR, HASH, ATTR
@@ -133,15 +142,15 @@ isakmp_cfg_r(iph1, msg)
 	vchar_t *msg;
 {
 	struct isakmp *packet;
-	struct isakmp_gen *ph;
-	int tlen;
-	char *npp;
-	int np;
+	struct isakmp_plindex plidx;
+	struct isakmp_parse_t *pa;
 	vchar_t *dmsg;
 	struct isakmp_ivm *ivm;
 	phase2_handle_t *iph2;
 	int               error = -1;
 
+	isakmp_plindex_init(&plidx);
+
 	/* Check that the packet is long enough to have a header */
 	if (msg->l < sizeof(*packet)) {
 		IPSECSESSIONTRACEREVENT(iph1->parent_session,
@@ -190,94 +199,60 @@ isakmp_cfg_r(iph1, msg)
 
 	/* Now work with the decrypted packet */
 	packet = (struct isakmp *)dmsg->v;
-	tlen = dmsg->l - sizeof(*packet);
-	ph = (struct isakmp_gen *)(packet + 1);
-
-	np = packet->np;
-	while ((tlen > 0) && (np != ISAKMP_NPTYPE_NONE)) {
-		/* Check that the payload header fits in the packet */
-		if (tlen < sizeof(*ph)) {
-			 plog(ASL_LEVEL_WARNING, 
-			      "Short payload header\n");
-			 goto out;
-		}
+	if (isakmp_plindex_parse(&plidx, dmsg) < 0) {
+		plog(ASL_LEVEL_WARNING, 
+		    "Malformed payload chain\n");
+		goto out;
+	}
+
+	for (pa = plidx.pl; pa->type != ISAKMP_NPTYPE_NONE; pa++)
+		plog(ASL_LEVEL_DEBUG, "Seen payload %d\n", pa->type);
+	/* unexpected payloads are skipped */
+	if ((pa = isakmp_plindex_check(&plidx, cfg_rules)) != NULL)
+		plog(ASL_LEVEL_WARNING, 
+		    "Unexpected next payload %d\n", pa->type);
+
+	/* the hashes are checked before any attribute is acted on */
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_HASH);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		vchar_t *check;
+		vchar_t payload;
 
-		/* Check that the payload fits in the packet */
-		if (tlen < ntohs(ph->len)) {
+		/* The hash covers the payload following it */
+		if ((pa + 1)->type == ISAKMP_NPTYPE_NONE) {
 			plog(ASL_LEVEL_WARNING, 
-			      "Short payload\n");
+				 "Invalid Hash payload. len %d\n",
+				 pa->len);
 			goto out;
 		}
-		
-		plog(ASL_LEVEL_DEBUG, "Seen payload %d\n", np);
-
-		switch(np) {
-		case ISAKMP_NPTYPE_HASH: {
-			vchar_t *check;
-			vchar_t *payload;
-			size_t plen;
-			struct isakmp_gen *nph;
-
-			plen = ntohs(ph->len);
-			nph = (struct isakmp_gen *)((char *)ph + plen);
-			plen = ntohs(nph->len);
-            /* Check that the hash payload fits in the packet */
-			if (tlen < (plen + ntohs(ph->len))) {
-				plog(ASL_LEVEL_WARNING, 
-					 "Invalid Hash payload. len %d, overall-len %d\n",
-					 ntohs(nph->len),
-					 (int)plen);
-				goto out;
-			}
-            
-			if ((payload = vmalloc(plen)) == NULL) {
-				plog(ASL_LEVEL_ERR, 
-				    "Cannot allocate memory\n");
-				goto out;
-			}
-			memcpy(payload->v, nph, plen);
+		memset(&payload, 0, sizeof(payload));
+		payload.v = (caddr_t)(pa + 1)->ptr;
+		payload.l = (pa + 1)->len;
 
-			if ((check = oakley_compute_hash1(iph1, 
-			    packet->msgid, payload)) == NULL) {
-				plog(ASL_LEVEL_ERR, 
-				    "Cannot compute hash\n");
-				vfree(payload);
-				goto out;
-			}
-
-			if (timingsafe_bcmp(ph + 1, check->v, check->l) != 0) {
-				plog(ASL_LEVEL_ERR, 
-				    "Hash verification failed\n");
-				vfree(payload);
-				vfree(check);
-				goto out;
-			}
-			vfree(payload);
-			vfree(check);
-			break;
+		if ((check = oakley_compute_hash1(iph1, 
+		    packet->msgid, &payload)) == NULL) {
+			plog(ASL_LEVEL_ERR, 
+			    "Cannot compute hash\n");
+			goto out;
 		}
-		case ISAKMP_NPTYPE_ATTR: {
-			struct isakmp_pl_attr *attrpl;
 
-			attrpl = (struct isakmp_pl_attr *)ph;
-			isakmp_cfg_attr_r(iph1, packet->msgid, attrpl, msg);
-
-			break;
-		}
-		default:
-			 plog(ASL_LEVEL_WARNING, 
-			      "Unexpected next payload %d\n", np);
-			 /* Skip to the next payload */
-			 break;
+		if (pa->len - sizeof(struct isakmp_gen) < check->l ||
+		    timingsafe_bcmp(pa->ptr + 1, check->v, check->l) != 0) {
+			plog(ASL_LEVEL_ERR, 
+			    "Hash verification failed\n");
+			vfree(check);
+			goto out;
 		}
-
-		/* Move to the next payload */
-		np = ph->np;
-		tlen -= ntohs(ph->len);
-		npp = (char *)ph;
-		ph = (struct isakmp_gen *)(npp + ntohs(ph->len));
+		vfree(check);
 	}
 
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_ATTR);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		isakmp_cfg_attr_r(iph1, packet->msgid,
+		    (struct isakmp_pl_attr *)pa->ptr, msg);
+
 	error = 0;
 	/* find phase 2 in case pkt scheduled for resend */
 	iph2 = ike_session_getph2bymsgid(iph1, packet->msgid);
@@ -298,6 +273,7 @@ out:
 								CONSTSTR("Failed to process Mode-Config packet"));
 	}
 	vfree(dmsg);
+	isakmp_plindex_free(&plidx);
 }
 
 int
@@ -1407,12 +1383,13 @@ isakmp_cfg_getport(iph1)
 		return -1;
 	}
 
-	for (i = 0; i < size; i++) {
+	/* each shard hands out its own share of the pool */
+	for (i = shard_index; i < size; i += shard_count) {
 		if (isakmp_cfg_config.port_pool[i].used == 0)
 			break;
 	}
 
-	if (i == size) {
+	if (i >= size) {
 		plog(ASL_LEVEL_ERR, 
 		    "No more addresses available\n");
 			return -1;
@@ -1669,12 +1646,21 @@ isakmp_cfg_resize_pool(size)
 				    "resize pool from %zu to %d impossible "
 				    "port %d is in use\n", 
 				    isakmp_cfg_config.pool_size, size, i);
-				size = i;
+				size = i + 1;
 				break;
 			}	
 		}
 	}
 
+	/* nothing left in use: no pool at all, rather than realloc(p, 0) */
+	if (size == 0) {
+		if (isakmp_cfg_config.port_pool != NULL)
+			racoon_free(isakmp_cfg_config.port_pool);
+		isakmp_cfg_config.port_pool = NULL;
+		isakmp_cfg_config.pool_size = 0;
+		return 0;
+	}
+
 	len = size * sizeof(*isakmp_cfg_config.port_pool);
 	new_pool = racoon_realloc(isakmp_cfg_config.port_pool, len);
 	if (new_pool == NULL) {
@@ -1719,13 +1705,15 @@ isakmp_cfg_init(cold)
 	for (i = 0; i < MAXWINS; i++)
 		isakmp_cfg_config.nbns4[i] = (in_addr_t)0x00000000;
 	isakmp_cfg_config.nbns4_index = 0;
-	if (cold != ISAKMP_CFG_INIT_COLD) {
-		if (isakmp_cfg_config.port_pool) {
-			racoon_free(isakmp_cfg_config.port_pool);
-		}
+	/*
+	 * addresses leased from the pool outlive a reload: the pool
+	 * statement of the new configuration resizes it in place.
+	 */
+	if (cold == ISAKMP_CFG_INIT_COLD) {
+		isakmp_cfg_config.port_pool = NULL;
+		isakmp_cfg_config.pool_size = 0;
 	}
-	isakmp_cfg_config.port_pool = NULL;
-	isakmp_cfg_config.pool_size = 0;
+	isakmp_cfg_config.pool_conf = 0;
 	isakmp_cfg_config.authsource = ISAKMP_CFG_AUTH_SYSTEM;
 	isakmp_cfg_config.groupsource = ISAKMP_CFG_GROUP_SYSTEM;
 	if (cold != ISAKMP_CFG_INIT_COLD) {
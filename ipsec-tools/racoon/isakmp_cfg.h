@@ -88,6 +88,7 @@ struct isakmp_cfg_config {
 	int			confsource;
 	int			accounting;
 	size_t			pool_size;
+	size_t			pool_conf;	/* pool_size asked for by the config */
 	int			auth_throttle;
 	/* XXX move this to a unity specific sub-structure */
 	char			default_domain[MAXPATHLEN + 1];
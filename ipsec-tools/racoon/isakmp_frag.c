@@ -110,7 +110,7 @@ isakmp_sendfrags(iph1, buf)
 
 
 	/* select the socket to be sent */
-	s = getsockmyaddr((struct sockaddr *)iph1->local);
+	s = getsockmyaddr_cached((struct sockaddr *)iph1->local, &iph1->sendsock);
 	if (s == -1){
 		return -1;
 	}
@@ -183,7 +183,7 @@ isakmp_sendfrags(iph1, buf)
 		}
 #endif
 
-		if (sendfromto(s, frag->v, frag->l,
+		if (sendfromto(&iph1->sendsock, frag->v, frag->l,
 					   iph1->local, iph1->remote, lcconf->count_persend) == -1) {
 			plog(ASL_LEVEL_ERR, "%s: sendfromto failed\n", __FUNCTION__);
 			vfree(frag);
@@ -417,8 +417,8 @@ isakmp_frag_addcap(buf, cap)
 }
 
 int
-sendfragsfromto(s, buf, local, remote, count_persend, frag_flags) 
-	int              s;
+sendfragsfromto(ss, buf, local, remote, count_persend, frag_flags) 
+	const struct sendsock *ss;
 	vchar_t         *buf;
 	struct sockaddr_storage *local;
 	struct sockaddr_storage *remote;
@@ -511,7 +511,7 @@ sendfragsfromto(s, buf, local, remote, count_persend, frag_flags)
 		}
 #endif
 
-		if (sendfromto(s, frag->v, frag->l, local, remote, count_persend) == -1) {
+		if (sendfromto(ss, frag->v, frag->l, local, remote, count_persend) == -1) {
 			plog(ASL_LEVEL_ERR, "sendfromto failed\n");
 			vfree(frag);
 			return -1;
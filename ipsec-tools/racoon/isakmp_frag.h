@@ -64,6 +64,7 @@ unsigned int vendorid_frag_cap (struct isakmp_gen *);
 int isakmp_frag_extract (phase1_handle_t *, vchar_t *);
 vchar_t *isakmp_frag_reassembly (phase1_handle_t *);
 vchar_t *isakmp_frag_addcap (vchar_t *, int);
-int sendfragsfromto (int s, vchar_t *, struct sockaddr_storage *, struct sockaddr_storage *, int, u_int32_t);
+struct sendsock;
+int sendfragsfromto (const struct sendsock *, vchar_t *, struct sockaddr_storage *, struct sockaddr_storage *, int, u_int32_t);
 
 #endif /* _ISAKMP_FRAG_H */
@@ -68,6 +68,7 @@
 #include "isakmp.h"
 #include "oakley.h"
 #include "handler.h"
+#include "isakmp_plindex.h"
 #include "ipsec_doi.h"
 #include "crypto_openssl.h"
 #include "pfkey.h"
@@ -97,6 +98,44 @@
 static vchar_t *ident_ir2mx (phase1_handle_t *);
 static vchar_t *ident_ir3mx (phase1_handle_t *);
 
+/* payloads accepted in each main mode message, besides their order */
+static const struct isakmp_plindex_rule ident_sa_rules[] = {
+	{ ISAKMP_NPTYPE_SA,	1 },
+	{ ISAKMP_NPTYPE_VID,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+static const struct isakmp_plindex_rule ident_kenonce_rules[] = {
+	{ ISAKMP_NPTYPE_KE,	1 },
+	{ ISAKMP_NPTYPE_NONCE,	1 },
+	{ ISAKMP_NPTYPE_VID,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_CR,	ISAKMP_PLINDEX_ANY },
+#ifdef ENABLE_NATT
+	{ ISAKMP_NPTYPE_NATD_DRAFT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NATD_RFC,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NATD_BADDRAFT,	ISAKMP_PLINDEX_ANY },
+#endif
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+static const struct isakmp_plindex_rule ident_auth_rules[] = {
+	{ ISAKMP_NPTYPE_ID,	1 },
+	{ ISAKMP_NPTYPE_HASH,	1 },
+	{ ISAKMP_NPTYPE_CERT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_SIG,	1 },
+	{ ISAKMP_NPTYPE_VID,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_N,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+static const struct isakmp_plindex_rule ident_auth_r_rules[] = {
+	{ ISAKMP_NPTYPE_ID,	1 },
+	{ ISAKMP_NPTYPE_HASH,	1 },
+	{ ISAKMP_NPTYPE_CR,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_CERT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_SIG,	1 },
+	{ ISAKMP_NPTYPE_VID,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_N,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+
 /* %%%
  * begin Identity Protection Mode as initiator.
  */
@@ -275,12 +314,14 @@ ident_i2recv(iph1, msg)
 	phase1_handle_t *iph1;
 	vchar_t *msg;
 {
-	vchar_t *pbuf = NULL;
+	struct isakmp_plindex plidx;
 	struct isakmp_parse_t *pa;
 	vchar_t *satmp = NULL;
 	int error = -1;
 	int vid_numeric;
 
+	isakmp_plindex_init(&plidx);
+
     /* validity check */
 	if (iph1->status != IKEV1_STATE_IDENT_I_MSG1SENT) {
 		plog(ASL_LEVEL_ERR,
@@ -298,77 +339,70 @@ ident_i2recv(iph1, msg)
 	 *	does it matters?
 	 * NOTE: even if there's multiple VID/N, we'll ignore them.
 	 */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		goto end;
 	}
-	pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
 
 	/* SA payload is fixed postion */
-	if (pa->type != ISAKMP_NPTYPE_SA) {
+	if (plidx.pl[0].type != ISAKMP_NPTYPE_SA) {
 		plog(ASL_LEVEL_ERR,
 			"received invalid next payload type %d, "
 			"expecting %d.\n",
-			pa->type, ISAKMP_NPTYPE_SA);
+			plidx.pl[0].type, ISAKMP_NPTYPE_SA);
 		goto end;
 	}
-	if (isakmp_p2ph(&satmp, pa->ptr) < 0) {
+	if ((pa = isakmp_plindex_check(&plidx, ident_sa_rules)) != NULL) {
+		/* don't send information, see ident_r1recv() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
+		goto end;
+	}
+	if (isakmp_p2ph(&satmp, plidx.pl[0].ptr) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to process SA payload");
 		goto end;
 	}
-	pa++;
-
-	for (/*nothing*/;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
 
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_VID:
-			vid_numeric = check_vendorid(pa->ptr);
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_VID);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		vid_numeric = check_vendorid(pa->ptr);
 #ifdef ENABLE_NATT
-			if (iph1->rmconf->nat_traversal && natt_vendorid(vid_numeric))
-			  natt_handle_vendorid(iph1, vid_numeric);
+		if (iph1->rmconf->nat_traversal && natt_vendorid(vid_numeric))
+		  natt_handle_vendorid(iph1, vid_numeric);
 #endif
 #ifdef ENABLE_HYBRID
-			switch (vid_numeric) {
-			case VENDORID_XAUTH:
-				iph1->mode_cfg->flags |=
-				    ISAKMP_CFG_VENDORID_XAUTH;
-				break;
-	
-			case VENDORID_UNITY:
-				iph1->mode_cfg->flags |=
-				    ISAKMP_CFG_VENDORID_UNITY;
-				break;
-	
-			default:
-				break;
-			}
+		switch (vid_numeric) {
+		case VENDORID_XAUTH:
+			iph1->mode_cfg->flags |=
+			    ISAKMP_CFG_VENDORID_XAUTH;
+			break;
+
+		case VENDORID_UNITY:
+			iph1->mode_cfg->flags |=
+			    ISAKMP_CFG_VENDORID_UNITY;
+			break;
+
+		default:
+			break;
+		}
 #endif  
 #ifdef ENABLE_DPD
-			if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd)
-				iph1->dpd_support=1;
+		if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd)
+			iph1->dpd_support=1;
 #endif
 #ifdef ENABLE_FRAG
-			if ((vid_numeric == VENDORID_FRAG) &&
-				(vendorid_frag_cap(pa->ptr) & VENDORID_FRAG_IDENT)) {
-				plog(ASL_LEVEL_DEBUG, 
-					 "remote supports FRAGMENTATION\n");
-				iph1->frag = 1;
-			}
-#endif
-			break;
-		default:
-			/* don't send information, see ident_r1recv() */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
-			goto end;
+		if ((vid_numeric == VENDORID_FRAG) &&
+			(vendorid_frag_cap(pa->ptr) & VENDORID_FRAG_IDENT)) {
+			plog(ASL_LEVEL_DEBUG, 
+				 "remote supports FRAGMENTATION\n");
+			iph1->frag = 1;
 		}
+#endif
 	}
 
 #ifdef ENABLE_NATT
@@ -409,10 +443,9 @@ end:
 								CONSTSTR("Initiator, Main-Mode Message 2"),
 								CONSTSTR("Failed to process Main-Mode Message 2"));
 	}
-	if (pbuf)
-		vfree(pbuf);
 	if (satmp)
 		vfree(satmp);
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -524,8 +557,9 @@ ident_i4recv(iph1, msg)
 	phase1_handle_t *iph1;
 	vchar_t *msg;
 {
-	vchar_t *pbuf = NULL;
+	struct isakmp_plindex plidx;
 	struct isakmp_parse_t *pa;
+	struct isakmp_gen *gen;
 	int error = -1;
 	int vid_numeric;
 #ifdef ENABLE_NATT
@@ -533,6 +567,8 @@ ident_i4recv(iph1, msg)
 	int natd_seq = 0, natd_verified;
 #endif
 
+	isakmp_plindex_init(&plidx);
+
     /* validity check */
 	if (iph1->status != IKEV1_STATE_IDENT_I_MSG3SENT) {
 		plog(ASL_LEVEL_ERR,
@@ -541,108 +577,106 @@ ident_i4recv(iph1, msg)
 	}
 
 	/* validate the type of next payload */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		goto end;
 	}
 
-	for (pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
+	if ((pa = isakmp_plindex_check(&plidx, ident_kenonce_rules)) != NULL) {
+		/* don't send information, see ident_r1recv() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
+		goto end;
+	}
 
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_KE:
-			if (isakmp_p2ph(&iph1->dhpub_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process KE payload");
-				goto end;
-			}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_KE)) != NULL &&
+	    isakmp_p2ph(&iph1->dhpub_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process KE payload");
+		goto end;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_NONCE)) != NULL &&
+	    isakmp_p2ph(&iph1->nonce_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process NONCE payload");
+		goto end;
+	}
+
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_VID);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		vid_numeric = check_vendorid(pa->ptr);
+#ifdef ENABLE_HYBRID
+		switch (vid_numeric) {
+		case VENDORID_XAUTH:
+			iph1->mode_cfg->flags |=
+			    ISAKMP_CFG_VENDORID_XAUTH;
 			break;
-		case ISAKMP_NPTYPE_NONCE:
-			if (isakmp_p2ph(&iph1->nonce_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process NONCE payload");
-				goto end;
-			}
+
+		case VENDORID_UNITY:
+			iph1->mode_cfg->flags |=
+			    ISAKMP_CFG_VENDORID_UNITY;
 			break;
-		case ISAKMP_NPTYPE_VID:
-			vid_numeric = check_vendorid(pa->ptr);
-#ifdef ENABLE_HYBRID
-			switch (vid_numeric) {
-			case VENDORID_XAUTH:
-				iph1->mode_cfg->flags |=
-				    ISAKMP_CFG_VENDORID_XAUTH;
-				break;
-	
-			case VENDORID_UNITY:
-				iph1->mode_cfg->flags |=
-				    ISAKMP_CFG_VENDORID_UNITY;
-				break;
-	
-			default:
-				break;
-			}
+
+		default:
+			break;
+		}
 #endif  
 #ifdef ENABLE_DPD
-			if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd)
-				iph1->dpd_support=1;
+		if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd)
+			iph1->dpd_support=1;
 #endif
-				
-			break;
-		case ISAKMP_NPTYPE_CR:
-			if (oakley_savecr(iph1, pa->ptr) < 0) {
+	}
+
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_CR);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		if (oakley_savecr(iph1, pa->ptr) < 0) {
+			plog(ASL_LEVEL_ERR, 
+				 "failed to process CR payload");
+			goto end;
+		}
+	}
+
+#ifdef ENABLE_NATT
+	/*
+	 * only the NAT-D type of the negotiated version is checked.
+	 * %%%% Be lenient here - some servers send natd payloads
+	 * when no nat is detected
+	 */
+	if (NATT_AVAILABLE(iph1) && iph1->natt_options != NULL) {
+		for (pa = isakmp_plindex_first(&plidx,
+			iph1->natt_options->payload_nat_d);
+		     pa != NULL;
+		     pa = isakmp_plindex_next(&plidx, pa)) {
+			natd_received = NULL;
+			if (isakmp_p2ph (&natd_received, pa->ptr) < 0) {
 				plog(ASL_LEVEL_ERR, 
-					 "failed to process CR payload");
+					 "failed to process NATD payload");
 				goto end;
 			}
-			break;
 
-#ifdef ENABLE_NATT
-		case ISAKMP_NPTYPE_NATD_DRAFT:
-		case ISAKMP_NPTYPE_NATD_RFC:
-		case ISAKMP_NPTYPE_NATD_BADDRAFT:
-			if (NATT_AVAILABLE(iph1) && iph1->natt_options != NULL &&
-			    pa->type == iph1->natt_options->payload_nat_d) {
-				natd_received = NULL;
-				if (isakmp_p2ph (&natd_received, pa->ptr) < 0) {
-					plog(ASL_LEVEL_ERR, 
-						 "failed to process NATD payload");
-					goto end;
-				}
-                        
-				/* set both bits first so that we can clear them
-				   upon verifying hashes */
-				if (natd_seq == 0)
-					iph1->natt_flags |= NAT_DETECTED;
-                        
-				/* this function will clear appropriate bits bits 
-				   from iph1->natt_flags */
-				natd_verified = natt_compare_addr_hash (iph1,
-					natd_received, natd_seq++);
-                        
-				plog (ASL_LEVEL_NOTICE, "NAT-D payload #%d %s\n",
-					natd_seq - 1,
-					natd_verified ? "verified" : "doesn't match");
-                        
-				vfree (natd_received);
-				break;
-			}
-			/* %%%% Be lenient here - some servers send natd payloads */
-			/* when no nat is detected								  */
-			break;
-#endif
+			/* set both bits first so that we can clear them
+			   upon verifying hashes */
+			if (natd_seq == 0)
+				iph1->natt_flags |= NAT_DETECTED;
 
-		default:
-			/* don't send information, see ident_r1recv() */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
-			goto end;
+			/* this function will clear appropriate bits bits 
+			   from iph1->natt_flags */
+			natd_verified = natt_compare_addr_hash (iph1,
+				natd_received, natd_seq++);
+
+			plog (ASL_LEVEL_NOTICE, "NAT-D payload #%d %s\n",
+				natd_seq - 1,
+				natd_verified ? "verified" : "doesn't match");
+
+			vfree (natd_received);
 		}
 	}
+#endif
 
 #ifdef ENABLE_NATT
 	if (NATT_AVAILABLE(iph1)) {
@@ -684,8 +718,6 @@ end:
 								CONSTSTR("Initiator, Main-Mode Message 4"),
 								CONSTSTR("Failed to process Main-Mode Message 4"));
 	}
-	if (pbuf)
-		vfree(pbuf);
 	if (error) {
 		VPTRINIT(iph1->dhpub_p);
 		VPTRINIT(iph1->nonce_p);
@@ -694,6 +726,7 @@ end:
 		iph1->cr_p = NULL;
 	}
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -834,14 +867,17 @@ ident_i6recv(iph1, msg0)
 	phase1_handle_t *iph1;
 	vchar_t *msg0;
 {
-	vchar_t *pbuf = NULL;
+	struct isakmp_plindex plidx;
 	struct isakmp_parse_t *pa;
+	struct isakmp_gen *gen;
 	vchar_t *msg = NULL;
 	int error = -1;
 	int type;
 	int vid_numeric;
 	int received_cert = 0;
 
+	isakmp_plindex_init(&plidx);
+
     /* validity check */
 	if (iph1->status != IKEV1_STATE_IDENT_I_MSG5SENT) {
 		plog(ASL_LEVEL_ERR,
@@ -864,65 +900,59 @@ ident_i6recv(iph1, msg0)
 	}
 
 	/* validate the type of next payload */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		goto end;
 	}
 
-	iph1->pl_hash = NULL;
+	iph1->pl_hash = isakmp_plindex_hash(&plidx);
 
-	for (pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
+	if ((pa = isakmp_plindex_check(&plidx, ident_auth_rules)) != NULL) {
+		/* don't send information, see ident_r1recv() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
+		goto end;
+	}
 
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_ID:
-			if (isakmp_p2ph(&iph1->id_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process ID payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_HASH:
-			iph1->pl_hash = (struct isakmp_pl_hash *)pa->ptr;
-			break;
-		case ISAKMP_NPTYPE_CERT:
-			if (oakley_savecert(iph1, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process CERT payload");
-				goto end;
-			}
-			received_cert = 1;
-			break;
-		case ISAKMP_NPTYPE_SIG:
-			if (isakmp_p2ph(&iph1->sig_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process SIG payload");
-				goto end;
-			}
-			break;
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_ID)) != NULL &&
+	    isakmp_p2ph(&iph1->id_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process ID payload");
+		goto end;
+	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_CERT);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		if (oakley_savecert(iph1, pa->ptr) < 0) {
+			plog(ASL_LEVEL_ERR, 
+				 "failed to process CERT payload");
+			goto end;
+		}
+		received_cert = 1;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_SIG)) != NULL &&
+	    isakmp_p2ph(&iph1->sig_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process SIG payload");
+		goto end;
+	}
 
-		case ISAKMP_NPTYPE_VID:
-				vid_numeric = check_vendorid(pa->ptr);
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_VID);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		vid_numeric = check_vendorid(pa->ptr);
 #ifdef ENABLE_DPD
-				if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd)
-					iph1->dpd_support=1;
+		if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd)
+			iph1->dpd_support=1;
 #endif
-				break;
-		case ISAKMP_NPTYPE_N:
-			isakmp_check_notify(pa->ptr, iph1);
-			break;
-		default:
-			/* don't send information, see ident_r1recv() */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
-			goto end;
-		}
 	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_N);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		isakmp_check_notify(pa->ptr, iph1);
 
 	if (received_cert) {
 		oakley_verify_certid(iph1);
@@ -986,8 +1016,6 @@ end:
 								CONSTSTR("Initiator, Main-Mode Message 6"),
 								CONSTSTR("Failed to transmit Main-Mode Message 6"));
 	}
-	if (pbuf)
-		vfree(pbuf);
 	if (msg)
 		vfree(msg);
 
@@ -1000,6 +1028,7 @@ end:
 		VPTRINIT(iph1->sig_p);
 	}
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -1048,11 +1077,13 @@ ident_r1recv(iph1, msg)
 	phase1_handle_t *iph1;
 	vchar_t *msg;
 {
-	vchar_t *pbuf = NULL;
+	struct isakmp_plindex plidx;
 	struct isakmp_parse_t *pa;
 	int error = -1;
 	int vid_numeric;
 
+	isakmp_plindex_init(&plidx);
+
 	/* validity check */
 	if (iph1->status != IKEV1_STATE_IDENT_R_START) {
 		plog(ASL_LEVEL_ERR,
@@ -1064,83 +1095,76 @@ ident_r1recv(iph1, msg)
 	/*
 	 * NOTE: XXX even if multiple VID, we'll silently ignore those.
 	 */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		goto end;
 	}
-	pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
 
 	/* check the position of SA payload */
-	if (pa->type != ISAKMP_NPTYPE_SA) {
+	if (plidx.pl[0].type != ISAKMP_NPTYPE_SA) {
 		plog(ASL_LEVEL_ERR,
 			"received invalid next payload type %d, "
 			"expecting %d.\n",
-			pa->type, ISAKMP_NPTYPE_SA);
+			plidx.pl[0].type, ISAKMP_NPTYPE_SA);
 		goto end;
 	}
-	if (isakmp_p2ph(&iph1->sa, pa->ptr) < 0) {
+	if ((pa = isakmp_plindex_check(&plidx, ident_sa_rules)) != NULL) {
+		/*
+		 * We don't send information to the peer even
+		 * if we received malformed packet.  Because we
+		 * can't distinguish the malformed packet and
+		 * the re-sent packet.  And we do same behavior
+		 * when we expect encrypted packet.
+		 */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
+		goto end;
+	}
+	if (isakmp_p2ph(&iph1->sa, plidx.pl[0].ptr) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to process SA payload");
 		goto end;
 	}
-	pa++;
 
-	for (/*nothing*/;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
-
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_VID:
-			vid_numeric = check_vendorid(pa->ptr);
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_VID);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		vid_numeric = check_vendorid(pa->ptr);
 #ifdef ENABLE_NATT
-			if (iph1->rmconf->nat_traversal && natt_vendorid(vid_numeric))
-				natt_handle_vendorid(iph1, vid_numeric);
+		if (iph1->rmconf->nat_traversal && natt_vendorid(vid_numeric))
+			natt_handle_vendorid(iph1, vid_numeric);
 #endif
 #ifdef ENABLE_HYBRID
-			switch (vid_numeric) {
-			case VENDORID_XAUTH:
-				iph1->mode_cfg->flags |=
-				    ISAKMP_CFG_VENDORID_XAUTH;
-				break;
-		
-			case VENDORID_UNITY:
-				iph1->mode_cfg->flags |=
-				    ISAKMP_CFG_VENDORID_UNITY;
-				break;
-	
-			default:  
-				break;
-			}
+		switch (vid_numeric) {
+		case VENDORID_XAUTH:
+			iph1->mode_cfg->flags |=
+			    ISAKMP_CFG_VENDORID_XAUTH;
+			break;
+
+		case VENDORID_UNITY:
+			iph1->mode_cfg->flags |=
+			    ISAKMP_CFG_VENDORID_UNITY;
+			break;
+
+		default:  
+			break;
+		}
 #endif
 #ifdef ENABLE_DPD
-			if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd)
-				iph1->dpd_support=1;
+		if (vid_numeric == VENDORID_DPD && iph1->rmconf->dpd)
+			iph1->dpd_support=1;
 #endif
 #ifdef ENABLE_FRAG
-			if ((vid_numeric == VENDORID_FRAG) &&
-				(vendorid_frag_cap(pa->ptr) & VENDORID_FRAG_IDENT)) {
-				plog(ASL_LEVEL_DEBUG, 
-					 "remote supports FRAGMENTATION\n");
-				iph1->frag = 1;
-			}
-#endif
-			break;
-		default:
-			/*
-			 * We don't send information to the peer even
-			 * if we received malformed packet.  Because we
-			 * can't distinguish the malformed packet and
-			 * the re-sent packet.  And we do same behavior
-			 * when we expect encrypted packet.
-			 */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
-			goto end;
+		if ((vid_numeric == VENDORID_FRAG) &&
+			(vendorid_frag_cap(pa->ptr) & VENDORID_FRAG_IDENT)) {
+			plog(ASL_LEVEL_DEBUG, 
+				 "remote supports FRAGMENTATION\n");
+			iph1->frag = 1;
 		}
+#endif
 	}
 
 #ifdef ENABLE_NATT
@@ -1176,12 +1200,11 @@ end:
 								CONSTSTR("Responder, Main-Mode Message 1"),
 								CONSTSTR("Failed to process Main-Mode Message 1"));
 	}
-	if (pbuf)
-		vfree(pbuf);
 	if (error) {
 		VPTRINIT(iph1->sa);
 	}
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -1359,13 +1382,16 @@ ident_r3recv(iph1, msg)
 	phase1_handle_t *iph1;
 	vchar_t *msg;
 {
-	vchar_t *pbuf = NULL;
+	struct isakmp_plindex plidx;
 	struct isakmp_parse_t *pa;
+	struct isakmp_gen *gen;
 	int error = -1;
 #ifdef ENABLE_NATT
 	int natd_seq = 0;
 #endif
 
+	isakmp_plindex_init(&plidx);
+
 	/* validity check */
 	if (iph1->status != IKEV1_STATE_IDENT_R_MSG2SENT) {
 		plog(ASL_LEVEL_ERR,
@@ -1374,83 +1400,75 @@ ident_r3recv(iph1, msg)
 	}
 
 	/* validate the type of next payload */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		goto end;
 	}
 
-	for (pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_KE:
-			if (isakmp_p2ph(&iph1->dhpub_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process KE payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_NONCE:
-			if (isakmp_p2ph(&iph1->nonce_p, pa->ptr) < 0) {
+	if ((pa = isakmp_plindex_check(&plidx, ident_kenonce_rules)) != NULL) {
+		/* don't send information, see ident_r1recv() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
+		goto end;
+	}
+
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_KE)) != NULL &&
+	    isakmp_p2ph(&iph1->dhpub_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process KE payload");
+		goto end;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_NONCE)) != NULL &&
+	    isakmp_p2ph(&iph1->nonce_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process NONCE payload");
+		goto end;
+	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_VID);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		(void)check_vendorid(pa->ptr);
+	if (isakmp_plindex_count(&plidx, ISAKMP_NPTYPE_CR) != 0)
+		plog(ASL_LEVEL_WARNING,
+			"CR received, ignore it. "
+			"It should be in other exchange.\n");
+
+#ifdef ENABLE_NATT
+	/*
+	 * %%%% Be lenient here - some servers send natd payloads
+	 * when no nat is detected
+	 */
+	if (NATT_AVAILABLE(iph1) && iph1->natt_options != NULL) {
+		for (pa = isakmp_plindex_first(&plidx,
+			iph1->natt_options->payload_nat_d);
+		     pa != NULL;
+		     pa = isakmp_plindex_next(&plidx, pa)) {
+			vchar_t *natd_received = NULL;
+			int natd_verified;
+
+			if (isakmp_p2ph (&natd_received, pa->ptr) < 0) {
 				plog(ASL_LEVEL_ERR, 
-					 "failed to process NONCE payload");
+					 "failed to process NATD payload");
 				goto end;
 			}
-			break;
-		case ISAKMP_NPTYPE_VID:
-			(void)check_vendorid(pa->ptr);
-			break;
-		case ISAKMP_NPTYPE_CR:
-			plog(ASL_LEVEL_WARNING,
-				"CR received, ignore it. "
-				"It should be in other exchange.\n");
-			break;
 
-#ifdef ENABLE_NATT
-		case ISAKMP_NPTYPE_NATD_DRAFT:
-		case ISAKMP_NPTYPE_NATD_RFC:
-		case ISAKMP_NPTYPE_NATD_BADDRAFT:
-			if (NATT_AVAILABLE(iph1) && iph1->natt_options != NULL &&
-			    pa->type == iph1->natt_options->payload_nat_d)
-			{
-				vchar_t *natd_received = NULL;
-				int natd_verified;
-				
-				if (isakmp_p2ph (&natd_received, pa->ptr) < 0) {
-					plog(ASL_LEVEL_ERR, 
-						 "failed to process NATD payload");
-					goto end;
-				}
-				
-				if (natd_seq == 0)
-					iph1->natt_flags |= NAT_DETECTED;
-				
-				natd_verified = natt_compare_addr_hash (iph1,
-					natd_received, natd_seq++);
-				
-				plog (ASL_LEVEL_NOTICE, "NAT-D payload #%d %s\n",
-					natd_seq - 1,
-					natd_verified ? "verified" : "doesn't match");
-				
-				vfree (natd_received);
-				break;
-			}
-			/* %%%% Be lenient here - some servers send natd payloads */
-			/* when no nat is detected								  */
-			break;
-#endif
+			if (natd_seq == 0)
+				iph1->natt_flags |= NAT_DETECTED;
 
-		default:
-			/* don't send information, see ident_r1recv() */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
-			goto end;
+			natd_verified = natt_compare_addr_hash (iph1,
+				natd_received, natd_seq++);
+
+			plog (ASL_LEVEL_NOTICE, "NAT-D payload #%d %s\n",
+				natd_seq - 1,
+				natd_verified ? "verified" : "doesn't match");
+
+			vfree (natd_received);
 		}
 	}
+#endif
 
 #ifdef ENABLE_NATT
 	if (NATT_AVAILABLE(iph1))
@@ -1484,8 +1502,6 @@ end:
 								CONSTSTR("Responder, Main-Mode Message 3"),
 								CONSTSTR("Failed to process Main-Mode Message 3"));
 	}
-	if (pbuf)
-		vfree(pbuf);
 
 	if (error) {
 		VPTRINIT(iph1->dhpub_p);
@@ -1493,6 +1509,7 @@ end:
 		VPTRINIT(iph1->id_p);
 	}
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -1634,12 +1651,15 @@ ident_r5recv(iph1, msg0)
 	vchar_t *msg0;
 {
 	vchar_t *msg = NULL;
-	vchar_t *pbuf = NULL;
+	struct isakmp_plindex plidx;
 	struct isakmp_parse_t *pa;
+	struct isakmp_gen *gen;
 	int error = -1;
 	int type;
 	int received_cert = 0;
 
+	isakmp_plindex_init(&plidx);
+
 	/* validity check */
 	if (iph1->status != IKEV1_STATE_IDENT_R_MSG4SENT) {
 		plog(ASL_LEVEL_ERR,
@@ -1662,67 +1682,62 @@ ident_r5recv(iph1, msg0)
 	}
 
 	/* validate the type of next payload */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		goto end;
 	}
 
-	iph1->pl_hash = NULL;
+	iph1->pl_hash = isakmp_plindex_hash(&plidx);
 
-	for (pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
+	if ((pa = isakmp_plindex_check(&plidx, ident_auth_r_rules)) != NULL) {
+		/* don't send information, see ident_r1recv() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
+		goto end;
+	}
 
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_ID:
-			if (isakmp_p2ph(&iph1->id_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process ID payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_HASH:
-			iph1->pl_hash = (struct isakmp_pl_hash *)pa->ptr;
-			break;
-		case ISAKMP_NPTYPE_CR:
-			if (oakley_savecr(iph1, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process CR payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_CERT:
-			if (oakley_savecert(iph1, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process CERT payload");
-				goto end;
-			}
-			received_cert = 1;
-			break;
-		case ISAKMP_NPTYPE_SIG:
-			if (isakmp_p2ph(&iph1->sig_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process SIG payload");
-				goto end;
-			}
-			break;
-		case ISAKMP_NPTYPE_VID:
-			(void)check_vendorid(pa->ptr);
-			break;
-		case ISAKMP_NPTYPE_N:
-			isakmp_check_notify(pa->ptr, iph1);
-			break;
-		default:
-			/* don't send information, see ident_r1recv() */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_ID)) != NULL &&
+	    isakmp_p2ph(&iph1->id_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process ID payload");
+		goto end;
+	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_CR);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		if (oakley_savecr(iph1, pa->ptr) < 0) {
+			plog(ASL_LEVEL_ERR, 
+				 "failed to process CR payload");
 			goto end;
 		}
 	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_CERT);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		if (oakley_savecert(iph1, pa->ptr) < 0) {
+			plog(ASL_LEVEL_ERR, 
+				 "failed to process CERT payload");
+			goto end;
+		}
+		received_cert = 1;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_SIG)) != NULL &&
+	    isakmp_p2ph(&iph1->sig_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process SIG payload");
+		goto end;
+	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_VID);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		(void)check_vendorid(pa->ptr);
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_N);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		isakmp_check_notify(pa->ptr, iph1);
 
 	if (received_cert) {
 		oakley_verify_certid(iph1);
@@ -1828,8 +1843,6 @@ end:
 								CONSTSTR("Responder, Main-Mode Message 5"),
 								CONSTSTR("Failed to process Main-Mode Message 5"));
 	}
-	if (pbuf)
-		vfree(pbuf);
 	if (msg)
 		vfree(msg);
 
@@ -1844,6 +1857,7 @@ end:
 		iph1->cr_p = NULL;
 	}
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -2036,8 +2050,6 @@ end:
 		vfree(buf);
 		buf = NULL;
 	}
-	if (cr)
-		vfree(cr);
 	if (vid)
 		vfree(vid);
 
@@ -2071,7 +2083,7 @@ ident_ir3mx(iph1)
 	phase1_handle_t *iph1;
 {
 	struct payload_list *plist = NULL;
-	vchar_t *buf = NULL, *new = NULL;
+	vchar_t *buf = NULL;
 	int need_cr = 0;
 	int need_cert = 0;
 	vchar_t *cr = NULL;
@@ -2163,29 +2175,17 @@ ident_ir3mx(iph1)
 		notp_ini = isakmp_plist_append_initial_contact(iph1, plist);
 	}
 	
-	buf = isakmp_plist_set_all (&plist, iph1);
-	
-#ifdef HAVE_PRINT_ISAKMP_C
-	isakmp_printpacket(buf, iph1->local, iph1->remote, 1);
-#endif
-
 	/* encoding */
-	new = oakley_do_encrypt(iph1, buf, iph1->ivm->ive, iph1->ivm->iv);
-	if (new == NULL) {
+	buf = isakmp_plist_encrypt (&plist, iph1, iph1->ivm->ive, iph1->ivm->iv);
+	if (buf == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to encrypt");
 		goto end;
 	}
 
-	vfree(buf);
-
-	buf = new;
-
 	error = 0;
 
 end:
-	if (cr)
-		vfree(cr);
 	if (error && buf != NULL) {
 		vfree(buf);
 		buf = NULL;
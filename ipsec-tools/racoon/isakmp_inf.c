@@ -79,6 +79,7 @@
 #include "remoteconf.h"
 #include "sockmisc.h"
 #include "handler.h"
+#include "isakmp_plindex.h"
 #include "policy.h"
 #include "proposal.h"
 #include "isakmp_var.h"
@@ -89,6 +90,7 @@
 #include "isakmp_cfg.h" 
 #endif
 #include "isakmp_inf.h"
+#include "isakmp_msgbuild.h"
 #include "oakley.h"
 #include "ipsec_doi.h"
 #include "crypto_openssl.h"
@@ -105,11 +107,21 @@
 #include "ike_session.h"
 #include "ipsecSessionTracer.h"
 #include "ipsecMessageTracer.h"
+#include "metrics.h"
 
 /* information exchange */
 static int isakmp_info_recv_n (phase1_handle_t *, struct isakmp_pl_n *, u_int32_t, int);
 static int isakmp_info_recv_d (phase1_handle_t *, struct isakmp_pl_d *, u_int32_t, int);
 
+/* payloads handled in an informational exchange; others are logged */
+static const struct isakmp_plindex_rule info_rules[] = {
+	{ ISAKMP_NPTYPE_HASH,	1 },
+	{ ISAKMP_NPTYPE_N,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_D,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NONCE,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+
 #ifdef ENABLE_DPD
 static int isakmp_info_recv_r_u (phase1_handle_t *, struct isakmp_pl_ru *, u_int32_t);
 static int isakmp_info_recv_r_u_ack (phase1_handle_t *, struct isakmp_pl_ru *, u_int32_t);
@@ -183,7 +195,7 @@ int
 isakmp_info_recv(phase1_handle_t *iph1, vchar_t *msg0)
 {
 	vchar_t *msg = NULL;
-	vchar_t *pbuf = NULL;
+	struct isakmp_plindex plidx;
 	u_int32_t msgid = 0;
 	int error = -1;
 	struct isakmp *isakmp;
@@ -194,9 +206,10 @@ isakmp_info_recv(phase1_handle_t *iph1, vchar_t *msg0)
 	struct isakmp_gen *nd;
 	u_int8_t np;
 	int encrypted;
-	int flag = 0;
 	int disconnect = 0;
 
+	isakmp_plindex_init(&plidx);
+
 	plog(ASL_LEVEL_NOTICE, "receive Information.\n");
 
 	encrypted = ISSET(((struct isakmp *)msg0->v)->flags, ISAKMP_FLAG_E);
@@ -336,6 +349,9 @@ isakmp_info_recv(phase1_handle_t *iph1, vchar_t *msg0)
 
 		vfree(hash);
 		vfree(payload);
+
+		/* authenticated: a roaming peer may move the ISAKMP-SA now */
+		ike_session_ikev1_roam_commit(iph1, NULL);
 	} else {
 		/* make sure phase 1 was not yet at encrypted state */
 		switch (iph1->etype) {
@@ -371,7 +387,7 @@ isakmp_info_recv(phase1_handle_t *iph1, vchar_t *msg0)
 		}
 	}
 
-	if (!(pbuf = isakmp_parse(msg))) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		error = -1;
@@ -379,50 +395,42 @@ isakmp_info_recv(phase1_handle_t *iph1, vchar_t *msg0)
 	}
 
 	error = 0;
-	for (pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v; pa->type; pa++) {    // Wcast-align fix (void*) - aligned buffer of aligned (unpacked) structs
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_HASH:
-			/* Handled above */
-			break;
-		case ISAKMP_NPTYPE_N:
-			if ((ntohs(((struct isakmp_pl_n *)pa->ptr)->type) == ISAKMP_NTYPE_NO_PROPOSAL_CHOSEN) &&
-			    !FSM_STATE_IS_ESTABLISHED(iph1->status) &&
-			    (iph1->side == INITIATOR && (iph1->status == IKEV1_STATE_AGG_I_MSG1SENT))) {
-				// proposal rejected by peer, terminate now.
-				disconnect = 1;
-				plog(ASL_LEVEL_ERR,
-				     "%s message with %s notification receveid, status 0x%x, side %d\n",
-				     s_isakmp_nptype(np), s_isakmp_notify_msg(ISAKMP_NTYPE_NO_PROPOSAL_CHOSEN), iph1->status, iph1->side);
-				break;
-			}
-			error = isakmp_info_recv_n(iph1,
-				(struct isakmp_pl_n *)pa->ptr,
-				msgid, encrypted);
-			break;
-		case ISAKMP_NPTYPE_D:
-			error = isakmp_info_recv_d(iph1,
-				(struct isakmp_pl_d *)pa->ptr,
-				msgid, encrypted);
-			break;
-		case ISAKMP_NPTYPE_NONCE:
-			/* XXX to be 6.4.2 ike-01.txt */
-			/* XXX IV is to be synchronized. */
-			plog(ASL_LEVEL_ERR,
-				"ignore Acknowledged Informational\n");
-			break;
-		default:
-			/* don't send information, see isakmp_ident_r1() */
-			error = 0;
+	if ((pa = isakmp_plindex_check(&plidx, info_rules)) != NULL) {
+		/* don't send information, see isakmp_ident_r1() */
+		plog(ASL_LEVEL_ERR,
+			"reject the packet, "
+			"received unexpected payload type %s.\n",
+			s_isakmp_nptype(pa->type));
+	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_N);
+	     pa != NULL && error >= 0;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		if ((ntohs(((struct isakmp_pl_n *)pa->ptr)->type) == ISAKMP_NTYPE_NO_PROPOSAL_CHOSEN) &&
+		    !FSM_STATE_IS_ESTABLISHED(iph1->status) &&
+		    (iph1->side == INITIATOR && (iph1->status == IKEV1_STATE_AGG_I_MSG1SENT))) {
+			// proposal rejected by peer, terminate now.
+			disconnect = 1;
 			plog(ASL_LEVEL_ERR,
-				"reject the packet, "
-				"received unexpected payload type %s.\n",
-				s_isakmp_nptype(gen->np));
-		}
-		if(error < 0) {
-			break;
-		} else {
-			flag |= error;
+			     "%s message with %s notification receveid, status 0x%x, side %d\n",
+			     s_isakmp_nptype(np), s_isakmp_notify_msg(ISAKMP_NTYPE_NO_PROPOSAL_CHOSEN), iph1->status, iph1->side);
+			continue;
 		}
+		error = isakmp_info_recv_n(iph1,
+			(struct isakmp_pl_n *)pa->ptr,
+			msgid, encrypted);
+	}
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_D);
+	     pa != NULL && error >= 0;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		error = isakmp_info_recv_d(iph1,
+			(struct isakmp_pl_d *)pa->ptr,
+			msgid, encrypted);
+	}
+	if (isakmp_plindex_count(&plidx, ISAKMP_NPTYPE_NONCE) != 0) {
+		/* XXX to be 6.4.2 ike-01.txt */
+		/* XXX IV is to be synchronized. */
+		plog(ASL_LEVEL_ERR,
+			"ignore Acknowledged Informational\n");
 	}
 	IPSECSESSIONTRACEREVENT(iph1->parent_session,
 							IPSECSESSIONEVENTCODE_IKE_PACKET_RX_SUCC,
@@ -438,8 +446,6 @@ end:
 	}
 	if (msg != NULL)
 		vfree(msg);
-	if (pbuf != NULL)
-		vfree(pbuf);
 	if (disconnect) {
 		ike_session_t *session = NULL;
 
@@ -451,6 +457,7 @@ end:
 			ike_session_purge_ph1s_by_session(session);
 		}
 	}
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -1214,10 +1221,7 @@ isakmp_info_send_common(phase1_handle_t *iph1, vchar_t *payload, u_int32_t np, i
 {
 	phase2_handle_t *iph2 = NULL;
 	vchar_t *hash = NULL;
-	struct isakmp *isakmp;
-	struct isakmp_gen *gen;
-	char *p;
-	int tlen;
+	struct isakmp_msgb mb;
 	int error = -1;
 
 	/* add new entry to isakmp status table */
@@ -1285,16 +1289,9 @@ isakmp_info_send_common(phase1_handle_t *iph1, vchar_t *payload, u_int32_t np, i
 			ike_session_delph2(iph2);
 			goto end;
 		}
-
-		/* initialized total buffer length */
-		tlen = hash->l;
-		tlen += sizeof(*gen);
 	} else {
 		/* IKE-SA is not established */
 		hash = NULL;
-
-		/* initialized total buffer length */
-		tlen = 0;
 	}
 	if ((flags & ISAKMP_FLAG_A) == 0)
 		iph2->flags = (hash == NULL ? 0 : ISAKMP_FLAG_E);
@@ -1303,65 +1300,44 @@ isakmp_info_send_common(phase1_handle_t *iph1, vchar_t *payload, u_int32_t np, i
 
 	ike_session_link_ph2_to_ph1(iph1, iph2);
 
-	tlen += sizeof(*isakmp) + payload->l;
-
-	/* create buffer for isakmp payload */
-	iph2->sendbuf = vmalloc(tlen);
-	if (iph2->sendbuf == NULL) { 
-		plog(ASL_LEVEL_ERR, 
-			"failed to get buffer to send.\n");
-		goto err;
-	}
-
 	/* create isakmp header */
-	isakmp = (struct isakmp *)iph2->sendbuf->v;
-	memcpy(&isakmp->i_ck, &iph1->index.i_ck, sizeof(cookie_t));
-	memcpy(&isakmp->r_ck, &iph1->index.r_ck, sizeof(cookie_t));
-	isakmp->np = hash == NULL ? (np & 0xff) : ISAKMP_NPTYPE_HASH;
-	isakmp->v = iph1->version;
-	isakmp->etype = ISAKMP_ETYPE_INFO;
-	isakmp->flags = iph2->flags;
-	memcpy(&isakmp->msgid, &iph2->msgid, sizeof(isakmp->msgid));
-	isakmp->len   = htonl(tlen);
-	p = (char *)(isakmp + 1);
+	isakmp_msgb_init(&mb, iph1, ISAKMP_ETYPE_INFO, iph2->flags, iph2->msgid);
 
 	/* create HASH payload */
-	if (hash != NULL) {
-		gen = (struct isakmp_gen *)p;
-		gen->np = np & 0xff;
-		gen->len = htons(sizeof(*gen) + hash->l);
-		p += sizeof(*gen);
-		memcpy(p, hash->v, hash->l);
-		p += hash->l;
-	}
+	if (hash != NULL)
+		isakmp_msgb_add(&mb, hash, ISAKMP_NPTYPE_HASH);
 
 	/* add payload */
-	memcpy(p, payload->v, payload->l);
-	p += payload->l;
+	isakmp_msgb_append(&mb, payload, np & 0xff);
 
 #ifdef HAVE_PRINT_ISAKMP_C
-	isakmp_printpacket(iph2->sendbuf, iph1->local, iph1->remote, 1);
+	iph2->sendbuf = isakmp_msgb_flatten(&mb);
+	if (iph2->sendbuf != NULL)
+		isakmp_printpacket(iph2->sendbuf, iph1->local, iph1->remote, 1);
+	VPTRINIT(iph2->sendbuf);
 #endif
 
-	/* encoding */
-	if (ISSET(isakmp->flags, ISAKMP_FLAG_E)) {
-		vchar_t *tmp;
-
-		tmp = oakley_do_encrypt(iph2->ph1, iph2->sendbuf, iph2->ivm->ive,
-				iph2->ivm->iv);
-		VPTRINIT(iph2->sendbuf);
-		if (tmp == NULL) {
+	/*
+	 * informational messages aren't retransmitted, so unless it has
+	 * to be encrypted the message goes out straight from its segments.
+	 */
+	if (ISSET(mb.hdr.flags, ISAKMP_FLAG_E)) {
+		iph2->sendbuf = isakmp_msgb_encrypt(&mb, iph2->ph1,
+				iph2->ivm->ive, iph2->ivm->iv);
+		if (iph2->sendbuf == NULL) {
 			plog(ASL_LEVEL_ERR, 
 				 "failed to encrypt packet");
 			goto err;
 		}
-		iph2->sendbuf = tmp;
-	}
+		error = isakmp_send(iph2->ph1, iph2->sendbuf);
+	} else
+		error = isakmp_msgb_send(&mb, iph2->ph1);
 
 	/* HDR*, HASH(1), N */
-	if (isakmp_send(iph2->ph1, iph2->sendbuf) < 0) {
+	if (error < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to send packet");
+		error = -1;
 		VPTRINIT(iph2->sendbuf);
 		goto err;
 	}
@@ -1482,7 +1458,7 @@ purge_ipsec_spi(struct sockaddr_storage *dst0, int proto, u_int32_t *spi /*netwo
 			continue;
 		}
 
-		if (pfkey_align(msg, mhp) || pfkey_check(mhp)) {
+		if (pfkey_parse(msg, (caddr_t)end - (caddr_t)msg, mhp)) {
 			plog(ASL_LEVEL_ERR, 
 				"pfkey_check (%s)\n", ipsec_strerror());
 			msg = next;
@@ -1664,7 +1640,7 @@ info_recv_initialcontact(phase1_handle_t *iph1)
 			continue;
 		}
 
-		if (pfkey_align(msg, mhp) || pfkey_check(mhp)) {
+		if (pfkey_parse(msg, (caddr_t)end - (caddr_t)msg, mhp)) {
 			plog(ASL_LEVEL_ERR, 
 				"pfkey_check (%s)\n", ipsec_strerror());
 			msg = next;
@@ -1984,7 +1960,7 @@ isakmp_info_recv_r_u_ack (phase1_handle_t *iph1, struct isakmp_pl_ru *ru, u_int3
 	/* Useless ??? */
 	iph1->dpd_lastack = time(NULL);
 
-	SCHED_KILL(iph1->dpd_r_u);
+	isakmp_unsched_r_u(iph1);
 
 	isakmp_sched_r_u(iph1, 0);
 
@@ -2089,6 +2065,7 @@ isakmp_info_send_r_u(void *arg)
 								IPSECSESSIONEVENTCODE_IKEV1_INFO_NOTICE_TX_SUCC,
 								CONSTSTR("R-U-THERE?"),
 								CONSTSTR(NULL));
+		METRICS_INC(METRICS_C_DPD_SENT);
 	}
 
 	if (iph1->side == INITIATOR) {
@@ -2137,6 +2114,7 @@ isakmp_info_monitor_r_u_algo_inbound_detect (phase1_handle_t *iph1)
         
         /* ike packets received from peer... reschedule dpd */
         isakmp_sched_r_u(iph1, 0);
+        METRICS_INC(METRICS_C_DPD_SUPPRESSED);
         
         plog(ASL_LEVEL_NOTICE,
              "ike packets received from peer... reschedule monitor.\n");
@@ -2149,6 +2127,7 @@ isakmp_info_monitor_r_u_algo_inbound_detect (phase1_handle_t *iph1)
         isakmp_info_send_r_u(iph1);
     } else {
         isakmp_sched_r_u(iph1, 0);
+        METRICS_INC(METRICS_C_DPD_SUPPRESSED);
         
         plog(ASL_LEVEL_NOTICE,
              "rescheduling DPD monitoring (for ALGORITHM_INBOUND_DETECT).\n");
@@ -2206,6 +2185,145 @@ isakmp_info_monitor_r_u(void *arg)
     }
 }
 
+/*
+ * DPD wheel.
+ *
+ * A phase 1 waiting for its next DPD check is kept in the bucket of the
+ * second the check is due, modulo DPD_WHEEL_SIZE, rather than holding a
+ * timer of its own.  One tick a second takes everything that has come
+ * due off the wheel and runs those checks as one batch, so thousands
+ * of tunnels cost one timer instead of one each.
+ *
+ * A check that comes due first polls the kernel for the session's SA
+ * counters and goes back on the wheel for the next tick, which decides
+ * with the answer.  So every algorithm, plain R-U-THERE included, skips
+ * the probe when the peer's ESP arrived since the last check, whether
+ * or not a traffic monitor runs: there is nothing a probe would tell
+ * us that traffic has not.
+ */
+#define DPD_WHEEL_SIZE	64	/* seconds; checks further out go round again */
+
+static LIST_HEAD(_dpd_bucket_, phase1handle) dpd_wheel[DPD_WHEEL_SIZE];
+static u_int dpd_wheel_count;		/* phase 1s with dpd_due set */
+static time_t dpd_scanned;			/* last second taken off the wheel */
+static int dpd_tick_armed;
+static uintptr_t dpd_tick_gen;		/* a tick of an older one stops */
+
+static void isakmp_dpd_tick (void *);
+static void isakmp_dpd_enqueue (phase1_handle_t *, time_t, int);
+
+static void
+isakmp_dpd_arm(void)
+{
+	dpd_tick_gen++;
+	if (sched_new(1, isakmp_dpd_tick, (void *)dpd_tick_gen) != 0)
+		dpd_tick_armed = 1;
+}
+
+/*
+ * ask the kernel for the session's SA counters, so that the check one
+ * tick later knows whether the peer's ESP still arrives, monitor or
+ * not.  returns 0 if nothing was asked.
+ */
+static int
+isakmp_dpd_poll(phase1_handle_t *iph1)
+{
+	ike_session_t *session = iph1->parent_session;
+
+	if (session == NULL || !FSM_STATE_IS_ESTABLISHED(iph1->status))
+		return 0;
+	if (pk_sendget_inbound_sastats(session) <= 0)
+		return 0;
+	if (iph1->rmconf->dpd_algo == DPD_ALGO_BLACKHOLE_DETECT &&
+		pk_sendget_outbound_sastats(session) < 0)
+		plog(ASL_LEVEL_NOTICE, "pk_sendget_outbound_sastats failed in %s.\n", __FUNCTION__);
+
+	isakmp_dpd_enqueue(iph1, 1, 0);
+	iph1->dpd_polled = 1;
+	return 1;
+}
+
+static void
+isakmp_dpd_check(phase1_handle_t *iph1)
+{
+	ike_session_t *session = iph1->parent_session;
+
+	if (iph1->dpd_retransmit) {
+		isakmp_info_send_r_u(iph1);
+		return;
+	}
+	if (!iph1->dpd_polled && isakmp_dpd_poll(iph1))
+		return;
+	iph1->dpd_polled = 0;
+
+	switch (iph1->rmconf->dpd_algo) {
+	case DPD_ALGO_INBOUND_DETECT:
+	case DPD_ALGO_BLACKHOLE_DETECT:
+		isakmp_info_monitor_r_u(iph1);
+		break;
+	default:
+		if (session && session->peer_sent_data_sc_dpd) {
+			session->peer_sent_data_sc_dpd = 0;
+			isakmp_sched_r_u(iph1, 0);
+			METRICS_INC(METRICS_C_DPD_SUPPRESSED);
+			break;
+		}
+		if (session)
+			session->peer_sent_data_sc_dpd = 0;
+		isakmp_info_send_r_u(iph1);
+		break;
+	}
+}
+
+static void
+isakmp_dpd_tick(void *arg)
+{
+	LIST_HEAD(_dpd_batch_, phase1handle) batch;
+	phase1_handle_t *iph1, *next;
+	time_t now = current_time();
+	time_t t;
+	int n, due = 0;
+
+	if ((uintptr_t)arg != dpd_tick_gen)
+		return;
+	dpd_tick_armed = 0;
+	LIST_INIT(&batch);
+
+	/* every bucket once at most, however long since the last tick */
+	n = (int)(now - dpd_scanned);
+	if (n > DPD_WHEEL_SIZE)
+		n = DPD_WHEEL_SIZE;
+	for (t = now - n + 1; t <= now; t++) {
+		LIST_FOREACH_SAFE(iph1, &dpd_wheel[t % DPD_WHEEL_SIZE], dpd_chain, next) {
+			if (iph1->dpd_due > now)
+				continue;
+			LIST_REMOVE(iph1, dpd_chain);
+			LIST_INSERT_HEAD(&batch, iph1, dpd_chain);
+			due++;
+		}
+	}
+	dpd_scanned = now;
+
+	if (due)
+		plog(ASL_LEVEL_DEBUG, "DPD: %d check(s) due, %u waiting.\n",
+			 due, dpd_wheel_count - due);
+
+	/*
+	 * A check may purge other phase 1s of the batch (dead peer), which
+	 * unlinks them from it, so always restart from the head.
+	 */
+	while ((iph1 = LIST_FIRST(&batch)) != NULL) {
+		LIST_REMOVE(iph1, dpd_chain);
+		iph1->dpd_due = 0;
+		dpd_wheel_count--;
+		if (iph1->rmconf)
+			isakmp_dpd_check(iph1);
+	}
+
+	if (dpd_wheel_count && !dpd_tick_armed)
+		isakmp_dpd_arm();
+}
+
 /* Schedule a new R-U-THERE */
 int
 isakmp_sched_r_u(phase1_handle_t *iph1, int retry)
@@ -2219,23 +2337,62 @@ isakmp_sched_r_u(phase1_handle_t *iph1, int retry)
 	   iph1->rmconf->dpd_interval == 0)
 		return 0;
 
-	if(retry) {
-		iph1->dpd_r_u = sched_new(iph1->rmconf->dpd_retry,
-								  isakmp_info_send_r_u, iph1);
-	} else {
-        if (iph1->rmconf->dpd_algo == DPD_ALGO_INBOUND_DETECT ||
-            iph1->rmconf->dpd_algo == DPD_ALGO_BLACKHOLE_DETECT) {
-            iph1->dpd_r_u = sched_new(iph1->rmconf->dpd_interval,
-                                      isakmp_info_monitor_r_u, iph1);
-        } else {
-            iph1->dpd_r_u = sched_new(iph1->rmconf->dpd_interval,
-                                      isakmp_info_send_r_u, iph1);
-        }
-    }
+	iph1->dpd_polled = 0;
+	isakmp_dpd_enqueue(iph1,
+		retry ? iph1->rmconf->dpd_retry : iph1->rmconf->dpd_interval, retry);
 
 	return 0;
 }
 
+/* put iph1 on the wheel, its check due in secs */
+static void
+isakmp_dpd_enqueue(phase1_handle_t *iph1, time_t secs, int retry)
+{
+	time_t now, due;
+
+	isakmp_unsched_r_u(iph1);
+
+	now = current_time();
+	if (dpd_wheel_count == 0 && !dpd_tick_armed)
+		dpd_scanned = now;
+	else if (dpd_tick_armed && now > dpd_scanned + 2)
+		dpd_tick_armed = 0;		/* the tick got lost, e.g. over sleep */
+
+	due = now + secs;
+	if (due <= dpd_scanned)
+		due = dpd_scanned + 1;
+
+	iph1->dpd_due = due;
+	iph1->dpd_retransmit = retry ? 1 : 0;
+	LIST_INSERT_HEAD(&dpd_wheel[due % DPD_WHEEL_SIZE], iph1, dpd_chain);
+	dpd_wheel_count++;
+
+	if (!dpd_tick_armed)
+		isakmp_dpd_arm();
+}
+
+void
+isakmp_unsched_r_u(phase1_handle_t *iph1)
+{
+	if (iph1->dpd_due == 0)
+		return;
+	LIST_REMOVE(iph1, dpd_chain);
+	iph1->dpd_due = 0;
+	dpd_wheel_count--;
+}
+
+/*
+ * Timers that came due around a sleep are dropped, the DPD tick too;
+ * start a new one.
+ */
+void
+isakmp_resume_r_u(void)
+{
+	dpd_tick_armed = 0;
+	if (dpd_wheel_count)
+		isakmp_dpd_arm();
+}
+
 /*
  * punts dpd for later because of some activity that:
  * 1) implicitly does dpd (e.g. phase2 exchanges), or
@@ -2253,7 +2410,7 @@ isakmp_reschedule_info_monitor_if_pending (phase1_handle_t *iph1, char *reason)
     }
 
     if (!iph1->peer_sent_ike) {
-        SCHED_KILL(iph1->dpd_r_u);
+        isakmp_unsched_r_u(iph1);
 
         isakmp_sched_r_u(iph1, 0);
 
@@ -57,6 +57,8 @@ extern void isakmp_check_ph2_notify (struct isakmp_gen *, phase2_handle_t *);
 
 #ifdef ENABLE_DPD
 extern int isakmp_sched_r_u (phase1_handle_t *, int);
+extern void isakmp_unsched_r_u (phase1_handle_t *);
+extern void isakmp_resume_r_u (void);
 extern void isakmp_reschedule_info_monitor_if_pending (phase1_handle_t *, char *);
 extern void isakmp_info_send_r_u (void *);
 #endif
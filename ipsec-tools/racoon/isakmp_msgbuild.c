@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include <string.h>
+
+#include "var.h"
+#include "vmbuf.h"
+#include "plog.h"
+#include "debug.h"
+
+#include "isakmp_var.h"
+#include "isakmp.h"
+#include "oakley.h"
+#include "isakmp_msgbuild.h"
+
+/*
+ * start a message with the ISAKMP header of the given phase 1.
+ */
+void
+isakmp_msgb_init(mb, iph1, etype, flags, msgid)
+	struct isakmp_msgb *mb;
+	phase1_handle_t *iph1;
+	u_int8_t etype;
+	u_int8_t flags;
+	u_int32_t msgid;
+{
+	struct isakmp *isakmp = &mb->hdr;
+
+	memcpy(&isakmp->i_ck, &iph1->index.i_ck, sizeof(cookie_t));
+	memcpy(&isakmp->r_ck, &iph1->index.r_ck, sizeof(cookie_t));
+	isakmp->np = ISAKMP_NPTYPE_NONE;
+	isakmp->v = iph1->version;
+	isakmp->etype = etype;
+	isakmp->flags = flags;
+	isakmp->msgid = msgid;
+
+	mb->len = sizeof(*isakmp);
+	isakmp->len = htonl(mb->len);
+
+	mb->iov[0].iov_base = NULL;
+	mb->iov[0].iov_len = 0;
+	mb->iov[1].iov_base = isakmp;
+	mb->iov[1].iov_len = sizeof(*isakmp);
+	mb->niov = 2;
+	mb->nseg = 0;
+	mb->lastnp = &isakmp->np;
+	mb->error = 0;
+}
+
+/*
+ * add a payload body of the given type.  the generic header is built
+ * here and the previous payload is chained to it.
+ */
+int
+isakmp_msgb_add(mb, body, nptype)
+	struct isakmp_msgb *mb;
+	vchar_t *body;
+	int nptype;
+{
+	struct isakmp_gen *gen;
+	size_t plen = sizeof(*gen) + body->l;
+
+	if (mb->error)
+		return -1;
+	if (mb->lastnp == NULL) {
+		plog(ASL_LEVEL_ERR,
+			"payload added after a raw payload chain.\n");
+		goto fail;
+	}
+	if (mb->nseg == ISAKMP_MSGB_MAXSEG) {
+		plog(ASL_LEVEL_ERR,
+			"too many payloads in message (max %d)\n",
+			ISAKMP_MSGB_MAXSEG);
+		goto fail;
+	}
+	if (plen > 0xffff) {
+		plog(ASL_LEVEL_ERR,
+			"payload too long (%zu)\n", plen);
+		goto fail;
+	}
+
+	plog(ASL_LEVEL_DEBUG, "add payload of len %zu, type %d\n",
+	    body->l, nptype);
+
+	gen = &mb->gen[mb->nseg++];
+	gen->np = ISAKMP_NPTYPE_NONE;
+	gen->reserved = 0;
+	gen->len = htons(plen);
+	*mb->lastnp = nptype;
+	mb->lastnp = &gen->np;
+
+	mb->iov[mb->niov].iov_base = gen;
+	mb->iov[mb->niov].iov_len = sizeof(*gen);
+	mb->niov++;
+	if (body->l != 0) {
+		mb->iov[mb->niov].iov_base = body->v;
+		mb->iov[mb->niov].iov_len = body->l;
+		mb->niov++;
+	}
+
+	mb->len += plen;
+	mb->hdr.len = htonl(mb->len);
+
+	return 0;
+
+fail:
+	mb->error = 1;
+	return -1;
+}
+
+/*
+ * add payloads which already carry their generic headers, such as the
+ * notify and delete payloads handed to isakmp_info_send_common().
+ * nptype is the type of the first one, and nothing can follow them
+ * since their last next payload field isn't ours to patch.
+ */
+int
+isakmp_msgb_append(mb, buf, nptype)
+	struct isakmp_msgb *mb;
+	vchar_t *buf;
+	int nptype;
+{
+	if (mb->error)
+		return -1;
+	if (mb->lastnp == NULL) {
+		plog(ASL_LEVEL_ERR,
+			"payload added after a raw payload chain.\n");
+		mb->error = 1;
+		return -1;
+	}
+	if (mb->niov == ISAKMP_MSGB_MAXIOV) {
+		plog(ASL_LEVEL_ERR,
+			"too many payloads in message (max %d)\n",
+			ISAKMP_MSGB_MAXSEG);
+		mb->error = 1;
+		return -1;
+	}
+
+	*mb->lastnp = nptype;
+	mb->lastnp = NULL;
+
+	mb->iov[mb->niov].iov_base = buf->v;
+	mb->iov[mb->niov].iov_len = buf->l;
+	mb->niov++;
+
+	mb->len += buf->l;
+	mb->hdr.len = htonl(mb->len);
+
+	return 0;
+}
+
+/*
+ * copy the message into a single buffer, for the exchanges which have
+ * to keep it around for retransmission.
+ */
+vchar_t *
+isakmp_msgb_flatten(mb)
+	struct isakmp_msgb *mb;
+{
+	vchar_t *buf;
+
+	if (mb->error)
+		return NULL;
+
+	buf = vgather(&mb->iov[1], mb->niov - 1);
+	if (buf == NULL)
+		plog(ASL_LEVEL_ERR,
+			"failed to get buffer to send.\n");
+
+	return buf;
+}
+
+/*
+ * encrypt the payloads straight from their segments.  the result is
+ * the complete message, header included.
+ */
+vchar_t *
+isakmp_msgb_encrypt(mb, iph1, ivep, ivp)
+	struct isakmp_msgb *mb;
+	phase1_handle_t *iph1;
+	vchar_t *ivep, *ivp;
+{
+	if (mb->error)
+		return NULL;
+
+	return oakley_do_encryptv(iph1, &mb->hdr,
+	    &mb->iov[2], mb->niov - 2, ivep, ivp);
+}
+
+/*
+ * send the message without flattening it.
+ */
+int
+isakmp_msgb_send(mb, iph1)
+	struct isakmp_msgb *mb;
+	phase1_handle_t *iph1;
+{
+	if (mb->error)
+		return -1;
+
+	return isakmp_sendv(iph1, mb->iov, mb->niov);
+}
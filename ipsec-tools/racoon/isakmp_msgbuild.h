@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _ISAKMP_MSGBUILD_H
+#define _ISAKMP_MSGBUILD_H
+
+#include <sys/uio.h>
+
+#include "vmbuf.h"
+#include "isakmp.h"
+#include "handler.h"
+
+/*
+ * Outgoing message builder.  Payloads are not copied: each one is
+ * recorded as a pair of iovecs, its generic header (kept here, with the
+ * next payload and length fields filled in as payloads are added) and
+ * the caller's body buffer, which must stay alive until the message is
+ * sent or flattened.  It is meant to live on the stack of the exchange
+ * handler, like struct isakmp_plindex on the receive side.
+ *
+ * iov[0] is headroom for the NON-ESP marker, see isakmp_sendv().
+ * iov[1] is the ISAKMP header, payload segments follow.
+ */
+#define ISAKMP_MSGB_MAXSEG	64	/* payloads per message */
+#define ISAKMP_MSGB_MAXIOV	(2 * ISAKMP_MSGB_MAXSEG + 2)
+
+struct isakmp_msgb {
+	struct isakmp hdr;
+	struct isakmp_gen gen[ISAKMP_MSGB_MAXSEG];
+	struct iovec iov[ISAKMP_MSGB_MAXIOV];
+	int niov;			/* iovecs used, headroom included */
+	int nseg;			/* payloads added */
+	u_int8_t *lastnp;		/* next payload field to patch */
+	size_t len;			/* message length, without marker */
+	int error;			/* an add failed, refuse to finish */
+};
+
+extern void isakmp_msgb_init (struct isakmp_msgb *, phase1_handle_t *,
+	u_int8_t, u_int8_t, u_int32_t);
+extern int isakmp_msgb_add (struct isakmp_msgb *, vchar_t *, int);
+extern int isakmp_msgb_append (struct isakmp_msgb *, vchar_t *, int);
+extern vchar_t *isakmp_msgb_flatten (struct isakmp_msgb *);
+extern vchar_t *isakmp_msgb_encrypt (struct isakmp_msgb *,
+	phase1_handle_t *, vchar_t *, vchar_t *);
+extern int isakmp_msgb_send (struct isakmp_msgb *, phase1_handle_t *);
+
+#endif /* _ISAKMP_MSGBUILD_H */
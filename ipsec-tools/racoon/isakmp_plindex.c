@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <string.h>
+
+#include "var.h"
+#include "vmbuf.h"
+#include "plog.h"
+#include "debug.h"
+
+#include "isakmp.h"
+#include "ipsec_doi.h"
+#include "isakmp_plindex.h"
+
+/*
+ * minimum length of the payloads which carry a fixed part after the
+ * generic header.  anything not listed only needs the generic header.
+ */
+static size_t
+isakmp_plindex_minlen(u_int8_t type)
+{
+	switch (type) {
+	case ISAKMP_NPTYPE_SA:
+		return sizeof(struct ipsecdoi_pl_sa);
+	case ISAKMP_NPTYPE_ID:
+		return sizeof(struct ipsecdoi_pl_id);
+	case ISAKMP_NPTYPE_CERT:
+		return sizeof(struct isakmp_pl_cert) + 1;	/* encoding */
+	case ISAKMP_NPTYPE_CR:
+		return sizeof(struct isakmp_pl_cr);
+	case ISAKMP_NPTYPE_N:
+		return sizeof(struct isakmp_pl_n);
+	case ISAKMP_NPTYPE_D:
+		return sizeof(struct isakmp_pl_d);
+	case ISAKMP_NPTYPE_ATTR:
+		return sizeof(struct isakmp_pl_attr);
+	case ISAKMP_NPTYPE_NATOA_BADDRAFT:
+	case ISAKMP_NPTYPE_NATOA_RFC:
+	case ISAKMP_NPTYPE_NATOA_DRAFT:
+		return sizeof(struct isakmp_pl_natoa);
+	default:
+		return sizeof(struct isakmp_gen);
+	}
+}
+
+void
+isakmp_plindex_init(idx)
+	struct isakmp_plindex *idx;
+{
+	idx->np = 0;
+	idx->pl = idx->slots;
+	idx->spill = NULL;
+	idx->slots[0].type = ISAKMP_NPTYPE_NONE;
+	idx->slots[0].len = 0;
+	idx->slots[0].ptr = NULL;
+}
+
+void
+isakmp_plindex_free(idx)
+	struct isakmp_plindex *idx;
+{
+	if (idx->spill != NULL)
+		vfree(idx->spill);
+	isakmp_plindex_init(idx);
+}
+
+/*
+ * copy the whole chain, already validated, into a table on the heap.
+ */
+static int
+isakmp_plindex_spill(idx, np, gen, n)
+	struct isakmp_plindex *idx;
+	u_int8_t np;
+	struct isakmp_gen *gen;
+	int n;
+{
+	struct isakmp_parse_t *p;
+	int i;
+
+	idx->spill = vmalloc((n + 1) * sizeof(*p));
+	if (idx->spill == NULL) {
+		plog(ASL_LEVEL_ERR,
+			"failed to get buffer for %d payloads.\n", n);
+		return -1;
+	}
+	p = ALIGNED_CAST(struct isakmp_parse_t *)idx->spill->v;
+	for (i = 0; i < n; i++) {
+		p[i].type = np;
+		p[i].len = ntohs(gen->len);
+		p[i].ptr = gen;
+		np = gen->np;
+		gen = (struct isakmp_gen *)((caddr_t)gen + p[i].len);
+	}
+	p[n].type = ISAKMP_NPTYPE_NONE;
+	p[n].len = 0;
+	p[n].ptr = NULL;
+
+	idx->pl = p;
+	idx->np = n;
+	return 0;
+}
+
+/*
+ * index ISAKMP payloads, without ISAKMP base header.
+ * the length of every payload is validated against the remaining
+ * message and the fixed part of its type in the same pass.  An index
+ * that holds a longer message must be freed before it is used again.
+ */
+int
+isakmp_plindex_parsewoh(idx, np0, gen, len)
+	struct isakmp_plindex *idx;
+	int np0;
+	struct isakmp_gen *gen;
+	int len;
+{
+	u_int8_t np = np0 & 0xff;
+	struct isakmp_gen *gen0 = gen;
+	u_int8_t last[256];
+	struct isakmp_parse_t *p;
+	int tlen, plen, n;
+
+	isakmp_plindex_init(idx);
+	memset(idx->first, ISAKMP_PLINDEX_NOSLOT, sizeof(idx->first));
+	memset(idx->count, 0, sizeof(idx->count));
+
+	n = 0;
+	tlen = len;
+	while (0 < tlen && np != ISAKMP_NPTYPE_NONE) {
+		if (tlen <= sizeof(struct isakmp_gen)) {
+			/* don't send information, see isakmp_ident_r1() */
+			plog(ASL_LEVEL_ERR,
+				"invalid length of payload (1)\n");
+			goto fail;
+		}
+		plen = ntohs(gen->len);
+		if (plen < isakmp_plindex_minlen(np) || plen > tlen) {
+			plog(ASL_LEVEL_ERR,
+				"invalid length of payload type %u (%d)\n",
+				np, plen);
+			goto fail;
+		}
+
+		plog(ASL_LEVEL_DEBUG, "seen nptype=%u\n", np);
+
+		/* past the slots, only validate; the table is built below */
+		if (n < ISAKMP_PLINDEX_MAX) {
+			p = &idx->slots[n];
+			p->type = np;
+			p->len = plen;
+			p->ptr = gen;
+
+			idx->next[n] = ISAKMP_PLINDEX_NOSLOT;
+			if (idx->count[np]++ == 0)
+				idx->first[np] = n;
+			else
+				idx->next[last[np]] = n;
+			last[np] = n;
+		}
+		n++;
+
+		np = gen->np;
+		gen = (struct isakmp_gen *)((caddr_t)gen + plen);
+		tlen -= plen;
+	}
+
+	if (n > ISAKMP_PLINDEX_MAX) {
+		plog(ASL_LEVEL_DEBUG,
+			"%d payloads in message, more than %d indexed.\n",
+			n, ISAKMP_PLINDEX_MAX);
+		if (isakmp_plindex_spill(idx, np0 & 0xff, gen0, n) < 0)
+			goto fail;
+		return 0;
+	}
+
+	idx->np = n;
+	p = &idx->slots[n];
+	p->type = ISAKMP_NPTYPE_NONE;
+	p->len = 0;
+	p->ptr = NULL;
+
+	return 0;
+
+fail:
+	isakmp_plindex_init(idx);
+	memset(idx->first, ISAKMP_PLINDEX_NOSLOT, sizeof(idx->first));
+	memset(idx->count, 0, sizeof(idx->count));
+	return -1;
+}
+
+/*
+ * index ISAKMP payloads, including ISAKMP base header.
+ */
+int
+isakmp_plindex_parse(idx, buf)
+	struct isakmp_plindex *idx;
+	vchar_t *buf;
+{
+	struct isakmp *isakmp = (struct isakmp *)buf->v;
+
+	if (buf->l < sizeof(*isakmp)) {
+		plog(ASL_LEVEL_ERR,
+			"message too short to index (%zu)\n", buf->l);
+		return -1;
+	}
+
+	return isakmp_plindex_parsewoh(idx, isakmp->np,
+		(struct isakmp_gen *)(buf->v + sizeof(*isakmp)),
+		buf->l - sizeof(*isakmp));
+}
+
+/*
+ * NULL if the message holds only payloads listed in rules, each at most
+ * as many times as allowed; otherwise the first payload that is not.
+ * rules ends with an ISAKMP_NPTYPE_NONE entry.
+ */
+struct isakmp_parse_t *
+isakmp_plindex_check(idx, rules)
+	struct isakmp_plindex *idx;
+	const struct isakmp_plindex_rule *rules;
+{
+	const struct isakmp_plindex_rule *r;
+	struct isakmp_parse_t *p;
+	u_int8_t seen[256];
+	int n = 0, ok = 1;
+
+	if (idx->spill == NULL) {
+		for (r = rules; r->type != ISAKMP_NPTYPE_NONE; r++) {
+			n += idx->count[r->type];
+			if (idx->count[r->type] > r->max)
+				ok = 0;
+		}
+		if (ok && n == idx->np)
+			return NULL;
+	}
+
+	/* find the one to blame, in message order */
+	memset(seen, 0, sizeof(seen));
+	for (p = idx->pl; p->type != ISAKMP_NPTYPE_NONE; p++) {
+		for (r = rules; r->type != ISAKMP_NPTYPE_NONE; r++)
+			if (r->type == p->type)
+				break;
+		if (r->type == ISAKMP_NPTYPE_NONE)
+			return p;
+		if (r->max != ISAKMP_PLINDEX_ANY && ++seen[p->type] > r->max)
+			return p;
+	}
+	return NULL;
+}
+
+/*
+ * the slow walks behind the accessors, for a message that did not fit
+ * the slots.
+ */
+int
+isakmp_plindex_walk_count(idx, type)
+	struct isakmp_plindex *idx;
+	u_int8_t type;
+{
+	struct isakmp_parse_t *p;
+	int n = 0;
+
+	for (p = idx->pl; p->type != ISAKMP_NPTYPE_NONE; p++)
+		if (p->type == type)
+			n++;
+	return n;
+}
+
+struct isakmp_parse_t *
+isakmp_plindex_walk_next(idx, p, type)
+	struct isakmp_plindex *idx;
+	struct isakmp_parse_t *p;
+	u_int8_t type;
+{
+	for (; p->type != ISAKMP_NPTYPE_NONE; p++)
+		if (p->type == type)
+			return p;
+	return NULL;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _ISAKMP_PLINDEX_H
+#define _ISAKMP_PLINDEX_H
+
+#include "vmbuf.h"
+#include "isakmp.h"
+#include "handler.h"
+
+/*
+ * Per-message payload index, filled in a single pass over the payload
+ * chain.  It is meant to live on the stack of the exchange handler, so
+ * parsing a message never touches the heap.
+ *
+ * pl[] holds the payloads in message order and is terminated by an
+ * ISAKMP_NPTYPE_NONE entry, so it can be walked exactly like the table
+ * isakmp_parsewoh() returns.  first[]/next[] chain the payloads of the
+ * same type together and count[] holds the number seen per type.
+ *
+ * A message with more than ISAKMP_PLINDEX_MAX payloads is still
+ * accepted: pl[] then points to a table on the heap and the per-type
+ * accessors fall back to walking it.  isakmp_plindex_free() releases
+ * that table; after isakmp_plindex_init() it may be called whether a
+ * message was parsed or not.
+ */
+#define ISAKMP_PLINDEX_MAX	64	/* payloads indexed on the stack */
+#define ISAKMP_PLINDEX_NOSLOT	0xff
+#define ISAKMP_PLINDEX_ANY	0xff	/* any number of a payload type */
+
+struct isakmp_plindex {
+	int np;					/* number of payloads */
+	struct isakmp_parse_t *pl;		/* slots[], or spill->v */
+	vchar_t *spill;				/* table of a longer message */
+	struct isakmp_parse_t slots[ISAKMP_PLINDEX_MAX + 1];
+	u_int8_t next[ISAKMP_PLINDEX_MAX];	/* next slot of same type */
+	u_int8_t first[256];			/* first slot per type */
+	u_int8_t count[256];			/* payloads per type */
+};
+
+/* the payload types a message may carry, and how many of each */
+struct isakmp_plindex_rule {
+	u_int8_t type;
+	u_int8_t max;				/* or ISAKMP_PLINDEX_ANY */
+};
+
+extern void isakmp_plindex_init (struct isakmp_plindex *);
+extern void isakmp_plindex_free (struct isakmp_plindex *);
+extern int isakmp_plindex_parsewoh (struct isakmp_plindex *, int,
+	struct isakmp_gen *, int);
+extern int isakmp_plindex_parse (struct isakmp_plindex *, vchar_t *);
+extern struct isakmp_parse_t *isakmp_plindex_check (struct isakmp_plindex *,
+	const struct isakmp_plindex_rule *);
+
+extern int isakmp_plindex_walk_count (struct isakmp_plindex *, u_int8_t);
+extern struct isakmp_parse_t *isakmp_plindex_walk_next (struct isakmp_plindex *,
+	struct isakmp_parse_t *, u_int8_t);
+
+static inline int
+isakmp_plindex_count(struct isakmp_plindex *idx, u_int8_t type)
+{
+	if (idx->spill != NULL)
+		return isakmp_plindex_walk_count(idx, type);
+	return idx->count[type];
+}
+
+static inline struct isakmp_parse_t *
+isakmp_plindex_first(struct isakmp_plindex *idx, u_int8_t type)
+{
+	if (idx->spill != NULL)
+		return isakmp_plindex_walk_next(idx, idx->pl, type);
+	if (idx->first[type] == ISAKMP_PLINDEX_NOSLOT)
+		return NULL;
+	return &idx->pl[idx->first[type]];
+}
+
+/* the next payload of the same type as pa, or NULL */
+static inline struct isakmp_parse_t *
+isakmp_plindex_next(struct isakmp_plindex *idx, struct isakmp_parse_t *pa)
+{
+	u_int8_t slot;
+
+	if (idx->spill != NULL)
+		return isakmp_plindex_walk_next(idx, pa + 1, pa->type);
+	slot = idx->next[pa - idx->pl];
+	if (slot == ISAKMP_PLINDEX_NOSLOT)
+		return NULL;
+	return &idx->pl[slot];
+}
+
+/* first payload of the given type, or NULL */
+static inline struct isakmp_gen *
+isakmp_plindex_get(struct isakmp_plindex *idx, u_int8_t type)
+{
+	struct isakmp_parse_t *pa = isakmp_plindex_first(idx, type);
+
+	return pa ? pa->ptr : NULL;
+}
+
+#define isakmp_plindex_sa(idx) \
+	((struct ipsecdoi_pl_sa *)isakmp_plindex_get((idx), ISAKMP_NPTYPE_SA))
+#define isakmp_plindex_hash(idx) \
+	((struct isakmp_pl_hash *)isakmp_plindex_get((idx), ISAKMP_NPTYPE_HASH))
+#define isakmp_plindex_ke(idx) \
+	((struct isakmp_pl_ke *)isakmp_plindex_get((idx), ISAKMP_NPTYPE_KE))
+#define isakmp_plindex_nonce(idx) \
+	((struct isakmp_pl_nonce *)isakmp_plindex_get((idx), ISAKMP_NPTYPE_NONCE))
+#define isakmp_plindex_id(idx) \
+	((struct ipsecdoi_pl_id *)isakmp_plindex_get((idx), ISAKMP_NPTYPE_ID))
+#define isakmp_plindex_sig(idx) \
+	((struct isakmp_pl_sig *)isakmp_plindex_get((idx), ISAKMP_NPTYPE_SIG))
+#define isakmp_plindex_n(idx) \
+	((struct isakmp_pl_n *)isakmp_plindex_get((idx), ISAKMP_NPTYPE_N))
+#define isakmp_plindex_d(idx) \
+	((struct isakmp_pl_d *)isakmp_plindex_get((idx), ISAKMP_NPTYPE_D))
+#define isakmp_plindex_attr(idx) \
+	((struct isakmp_pl_attr *)isakmp_plindex_get((idx), ISAKMP_NPTYPE_ATTR))
+
+#endif /* _ISAKMP_PLINDEX_H */
@@ -71,6 +71,7 @@
 #include "localconf.h"
 #include "remoteconf.h"
 #include "handler.h"
+#include "isakmp_plindex.h"
 #include "policy.h"
 #include "proposal.h"
 #include "isakmp_var.h"
@@ -90,6 +91,7 @@
 #include "nattraversal.h"
 #include "ipsecSessionTracer.h"
 #include "ipsecMessageTracer.h"
+#include "ike_session.h"
 #ifndef HAVE_OPENSSL
 #include <Security/SecDH.h>
 #endif
@@ -97,6 +99,47 @@
 /* quick mode */
 static vchar_t *quick_ir1mx (phase2_handle_t *, vchar_t *, vchar_t *);
 static int get_proposal_r_remote (phase2_handle_t *, int);
+#ifdef ENABLE_NATT
+static void quick_natoa (struct isakmp_plindex *, const char *,
+	struct sockaddr_storage **, struct sockaddr_storage **);
+#endif
+
+/* payloads accepted in each quick mode message, besides their order */
+static const struct isakmp_plindex_rule quick_i2_rules[] = {
+	{ ISAKMP_NPTYPE_HASH,	1 },
+	{ ISAKMP_NPTYPE_SA,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NONCE,	1 },
+	{ ISAKMP_NPTYPE_KE,	1 },
+	{ ISAKMP_NPTYPE_ID,	2 },
+	{ ISAKMP_NPTYPE_N,	ISAKMP_PLINDEX_ANY },
+#ifdef ENABLE_NATT
+	{ ISAKMP_NPTYPE_NATOA_DRAFT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NATOA_BADDRAFT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NATOA_RFC,	ISAKMP_PLINDEX_ANY },
+#endif
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+/* too many SA or ID payloads get their own error */
+static const struct isakmp_plindex_rule quick_r1_rules[] = {
+	{ ISAKMP_NPTYPE_HASH,	1 },
+	{ ISAKMP_NPTYPE_SA,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NONCE,	1 },
+	{ ISAKMP_NPTYPE_KE,	1 },
+	{ ISAKMP_NPTYPE_ID,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_N,	ISAKMP_PLINDEX_ANY },
+#ifdef ENABLE_NATT
+	{ ISAKMP_NPTYPE_NATOA_DRAFT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NATOA_BADDRAFT,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NATOA_RFC,	ISAKMP_PLINDEX_ANY },
+#endif
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+static const struct isakmp_plindex_rule quick_i4_rules[] = {
+	{ ISAKMP_NPTYPE_HASH,	1 },
+	{ ISAKMP_NPTYPE_N,	ISAKMP_PLINDEX_ANY },
+	{ ISAKMP_NPTYPE_NONE,	0 },
+};
+#define quick_r3_rules quick_i4_rules
 
 /* %%%
  * Quick Mode
@@ -394,8 +437,9 @@ quick_i2recv(iph2, msg0)
 {
 	vchar_t *msg = NULL;
 	vchar_t *hbuf = NULL;	/* for hash computing. */
-	vchar_t *pbuf = NULL;	/* for payload parsing */
+	struct isakmp_plindex plidx;	/* for payload parsing */
 	struct isakmp_parse_t *pa;
+	struct isakmp_gen *gen;
 	struct isakmp *isakmp = (struct isakmp *)msg0->v;
 	struct isakmp_pl_hash *hash = NULL;
 	int f_id;
@@ -405,6 +449,8 @@ quick_i2recv(iph2, msg0)
 	struct sockaddr_storage *natoa_i = NULL;
 	struct sockaddr_storage *natoa_r = NULL;
 
+	isakmp_plindex_init(&plidx);
+
 	/* validity check */
 	if (iph2->status != IKEV1_STATE_QUICK_I_MSG1SENT) {
 		plog(ASL_LEVEL_ERR,
@@ -432,24 +478,21 @@ quick_i2recv(iph2, msg0)
 	 *	2. the second one must be SA (added in isakmp-oakley-05!)
 	 *	3. two IDs must be considered as IDci, then IDcr
 	 */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg");
 		goto end;
 	}
-	pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
 
 	/* HASH payload is fixed postion */
-	if (pa->type != ISAKMP_NPTYPE_HASH) {
+	if (plidx.pl[0].type != ISAKMP_NPTYPE_HASH) {
 		plog(ASL_LEVEL_ERR,
 			"received invalid next payload type %d, "
 			"expecting %d.\n",
-			pa->type, ISAKMP_NPTYPE_HASH);
+			plidx.pl[0].type, ISAKMP_NPTYPE_HASH);
 		goto end;
 	}
-	hash = (struct isakmp_pl_hash *)pa->ptr;
-	pa++;
+	hash = isakmp_plindex_hash(&plidx);
 
 	/*
 	 * this restriction was introduced in isakmp-oakley-05.
@@ -457,11 +500,20 @@ quick_i2recv(iph2, msg0)
 	 * TODO: command line/config file option to enable/disable this code
 	 */
 	/* HASH payload is fixed postion */
-	if (pa->type != ISAKMP_NPTYPE_SA) {
+	if (plidx.pl[1].type != ISAKMP_NPTYPE_SA) {
 		plog(ASL_LEVEL_WARNING,
 			"received invalid next payload type %d, "
 			"expecting %d.\n",
-			pa->type, ISAKMP_NPTYPE_HASH);
+			plidx.pl[1].type, ISAKMP_NPTYPE_HASH);
+	}
+
+	if ((pa = isakmp_plindex_check(&plidx, quick_i2_rules)) != NULL) {
+		/* don't send information, see ident_r1recv() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
+		goto end;
 	}
 
 	/* allocate buffer for computing HASH(2) */
@@ -473,7 +525,7 @@ quick_i2recv(iph2, msg0)
 			 iph2->nonce->l, ntohl(isakmp->len));
 		goto end;
 	}
-	hbuf = vmalloc(tlen);
+	hbuf = varena_alloc(&iph2->arena, tlen);
 	if (hbuf == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			"failed to get hash buffer.\n");
@@ -482,179 +534,129 @@ quick_i2recv(iph2, msg0)
 	p = hbuf->v + iph2->nonce->l;	/* retain the space for Ni_b */
 
 	/*
-	 * parse the payloads.
-	 * copy non-HASH payloads into hbuf, so that we can validate HASH.
+	 * the payloads after HASH are contiguous in the message, so
+	 * they are copied into hbuf at once to validate HASH.
+	 * count payload length except of HASH payload.
 	 */
-	iph2->sa_ret = NULL;
-	f_id = 0;	/* flag to use checking ID */
-	tlen = 0;	/* count payload length except of HASH payload. */
-	for (; pa->type; pa++) {
-
-		/* copy to buffer for HASH */
-		/* Don't modify the payload */
-		memcpy(p, pa->ptr, pa->len);
-
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_SA:
-			if (iph2->sa_ret != NULL) {
-				plog(ASL_LEVEL_ERR, 
-					"Ignored, multiple SA "
-					"isn't supported.\n");
-				break;
-			}
-			if (isakmp_p2ph(&iph2->sa_ret, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process SA payload");
-				goto end;
-			}
-			break;
+	tlen = (caddr_t)plidx.pl[plidx.np - 1].ptr + plidx.pl[plidx.np - 1].len
+		- ((caddr_t)plidx.pl[0].ptr + plidx.pl[0].len);
+	/* Don't modify the payload */
+	memcpy(p, (caddr_t)plidx.pl[0].ptr + plidx.pl[0].len, tlen);
 
-		case ISAKMP_NPTYPE_NONCE:
-			if (isakmp_p2ph(&iph2->nonce_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process NONCE payload");
-				goto end;
-			}
-			break;
-
-		case ISAKMP_NPTYPE_KE:
-			if (isakmp_p2ph(&iph2->dhpub_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR, 
-					 "failed to process KE payload");
-				goto end;
-			}
-			break;
+	iph2->sa_ret = NULL;
+	if (isakmp_plindex_count(&plidx, ISAKMP_NPTYPE_SA) > 1)
+		plog(ASL_LEVEL_ERR, 
+			"Ignored, multiple SA "
+			"isn't supported.\n");
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_SA)) != NULL &&
+	    isakmp_p2ph(&iph2->sa_ret, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process SA payload");
+		goto end;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_NONCE)) != NULL &&
+	    isakmp_p2ph(&iph2->nonce_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process NONCE payload");
+		goto end;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_KE)) != NULL &&
+	    isakmp_p2ph(&iph2->dhpub_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR, 
+			 "failed to process KE payload");
+		goto end;
+	}
 
-		case ISAKMP_NPTYPE_ID:
-		    {
-				vchar_t *vp;
-
-                if (iph2->id == NULL || iph2->id_p == NULL) {
-                    error = ISAKMP_INTERNAL_ERROR;  // shouldn't happen
-                    goto end;
-                }
-                
-				/* check ID value */
-				if (f_id == 0) {
-					/* for IDci */
-					vp = iph2->id;
-				} else {
-					/* for IDcr */
-					vp = iph2->id_p;
-				}
+	/* two IDs must be considered as IDci, then IDcr */
+	f_id = 0;	/* flag to use checking ID */
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_ID);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa)) {
+		vchar_t *vp;
+
+		if (iph2->id == NULL || iph2->id_p == NULL) {
+		    error = ISAKMP_INTERNAL_ERROR;  // shouldn't happen
+		    goto end;
+		}
+		
+		/* check ID value */
+		if (f_id == 0) {
+			/* for IDci */
+			vp = iph2->id;
+		} else {
+			/* for IDcr */
+			vp = iph2->id_p;
+		}
 
-				/* These ids may not match when natt is used with some devices.
-				 * RFC 2407 says that the protocol and port fields should be ignored
-				 * if they are zero, therefore they need to be checked individually.
+		/* These ids may not match when natt is used with some devices.
+		 * RFC 2407 says that the protocol and port fields should be ignored
+		 * if they are zero, therefore they need to be checked individually.
+		 */
+		struct ipsecdoi_id_b *id_ptr = ALIGNED_CAST(struct ipsecdoi_id_b *)vp->v;
+		struct ipsecdoi_pl_id *idp_ptr = (struct ipsecdoi_pl_id *)pa->ptr;
+		
+		if (id_ptr->type != idp_ptr->b.type
+			|| (idp_ptr->b.proto_id != 0 && idp_ptr->b.proto_id != id_ptr->proto_id)
+			|| (idp_ptr->b.port != 0 && idp_ptr->b.port != id_ptr->port)
+			|| memcmp(vp->v + sizeof(struct ipsecdoi_id_b), (caddr_t)pa->ptr + sizeof(struct ipsecdoi_pl_id), 
+					vp->l - sizeof(struct ipsecdoi_id_b))) {
+			// to support servers that use our external nat address as our ID
+			if (iph2->ph1->natt_flags & NAT_DETECTED) {
+				plog(ASL_LEVEL_WARNING, 
+					"mismatched ID was returned - ignored because nat traversal is being used.\n");
+				/* If I'm behind a nat and the ID is type address - save the address
+				 * and port for when the peer rekeys.
 				 */
-				struct ipsecdoi_id_b *id_ptr = ALIGNED_CAST(struct ipsecdoi_id_b *)vp->v;
-				struct ipsecdoi_pl_id *idp_ptr = (struct ipsecdoi_pl_id *)pa->ptr;
-				
-				if (id_ptr->type != idp_ptr->b.type
-					|| (idp_ptr->b.proto_id != 0 && idp_ptr->b.proto_id != id_ptr->proto_id)
-					|| (idp_ptr->b.port != 0 && idp_ptr->b.port != id_ptr->port)
-					|| memcmp(vp->v + sizeof(struct ipsecdoi_id_b), (caddr_t)pa->ptr + sizeof(struct ipsecdoi_pl_id), 
-							vp->l - sizeof(struct ipsecdoi_id_b))) {
-					// to support servers that use our external nat address as our ID
-					if (iph2->ph1->natt_flags & NAT_DETECTED) {
-						plog(ASL_LEVEL_WARNING, 
-							"mismatched ID was returned - ignored because nat traversal is being used.\n");
-						/* If I'm behind a nat and the ID is type address - save the address
-						 * and port for when the peer rekeys.
-						 */
-						if (f_id == 0 && (iph2->ph1->natt_flags & NAT_DETECTED_ME)) {
-							if (lcconf->ext_nat_id)
-								vfree(lcconf->ext_nat_id);
-							if (idp_ptr->h.len < sizeof(struct isakmp_gen)) {
-								plog(ASL_LEVEL_ERR, "invalid length (%d) while allocating external nat id.\n", idp_ptr->h.len);
-								goto end;
-							}
-							lcconf->ext_nat_id = vmalloc(ntohs(idp_ptr->h.len) - sizeof(struct isakmp_gen));
-							if (lcconf->ext_nat_id == NULL) {
-								plog(ASL_LEVEL_ERR, "memory error while allocating external nat id.\n");
-								goto end;
-							}
-							memcpy(lcconf->ext_nat_id->v, &(idp_ptr->b), lcconf->ext_nat_id->l);
-							if (iph2->ext_nat_id)
-								vfree(iph2->ext_nat_id);
-							iph2->ext_nat_id = vdup(lcconf->ext_nat_id);
-							if (iph2->ext_nat_id == NULL) {
-								plog(ASL_LEVEL_ERR, "memory error while allocating ph2's external nat id.\n");
-								goto end;
-							}
-							plogdump(ASL_LEVEL_DEBUG, iph2->ext_nat_id->v, iph2->ext_nat_id->l, "external nat address saved.\n");
-						} else if (f_id && (iph2->ph1->natt_flags & NAT_DETECTED_PEER)) {
-							if (iph2->ext_nat_id_p)
-								vfree(iph2->ext_nat_id_p);
-							iph2->ext_nat_id_p = vmalloc(ntohs(idp_ptr->h.len) - sizeof(struct isakmp_gen));
-							if (iph2->ext_nat_id_p == NULL) {
-								plog(ASL_LEVEL_ERR, "memory error while allocating peers ph2's external nat id.\n");
-								goto end;
-							}
-							memcpy(iph2->ext_nat_id_p->v, &(idp_ptr->b), iph2->ext_nat_id_p->l);
-							plogdump(ASL_LEVEL_DEBUG, iph2->ext_nat_id_p->v, iph2->ext_nat_id_p->l, "peer's external nat address saved.\n");
-						} 
-					} else {
-						plog(ASL_LEVEL_ERR, "mismatched ID was returned.\n");
-						error = ISAKMP_NTYPE_ATTRIBUTES_NOT_SUPPORTED;
+				if (f_id == 0 && (iph2->ph1->natt_flags & NAT_DETECTED_ME)) {
+					if (lcconf->ext_nat_id)
+						vfree(lcconf->ext_nat_id);
+					if (idp_ptr->h.len < sizeof(struct isakmp_gen)) {
+						plog(ASL_LEVEL_ERR, "invalid length (%d) while allocating external nat id.\n", idp_ptr->h.len);
 						goto end;
 					}
-				}
-				if (f_id == 0)
-					f_id = 1;
-			}
-			break;
-
-		case ISAKMP_NPTYPE_N:
-			isakmp_check_ph2_notify(pa->ptr, iph2);
-			break;
-
-#ifdef ENABLE_NATT
-		case ISAKMP_NPTYPE_NATOA_DRAFT:
-		case ISAKMP_NPTYPE_NATOA_BADDRAFT:
-		case ISAKMP_NPTYPE_NATOA_RFC:
-		    {
-				vchar_t         *vp = NULL;
-				struct sockaddr_storage *daddr;
-
-				isakmp_p2ph(&vp, pa->ptr);
-
-				if (vp) {
-					daddr = process_natoa_payload(vp);
-					if (daddr) {
-						if (natoa_i == NULL) {
-							natoa_i = daddr;
-							plog(ASL_LEVEL_DEBUG, "initiaor rcvd NAT-OA i: %s\n",
-								 saddr2str((struct sockaddr *)natoa_i));
-						} else if (natoa_r == NULL) {
-							natoa_r = daddr;
-							plog(ASL_LEVEL_DEBUG, "initiator rcvd NAT-OA r: %s\n",
-								 saddr2str((struct sockaddr *)natoa_r));
-						} else {
-							racoon_free(daddr);
-						}
+					lcconf->ext_nat_id = vmalloc(ntohs(idp_ptr->h.len) - sizeof(struct isakmp_gen));
+					if (lcconf->ext_nat_id == NULL) {
+						plog(ASL_LEVEL_ERR, "memory error while allocating external nat id.\n");
+						goto end;
 					}
-					vfree(vp);
-				}
-
+					memcpy(lcconf->ext_nat_id->v, &(idp_ptr->b), lcconf->ext_nat_id->l);
+					if (iph2->ext_nat_id)
+						vfree(iph2->ext_nat_id);
+					iph2->ext_nat_id = vdup(lcconf->ext_nat_id);
+					if (iph2->ext_nat_id == NULL) {
+						plog(ASL_LEVEL_ERR, "memory error while allocating ph2's external nat id.\n");
+						goto end;
+					}
+					plogdump(ASL_LEVEL_DEBUG, iph2->ext_nat_id->v, iph2->ext_nat_id->l, "external nat address saved.\n");
+				} else if (f_id && (iph2->ph1->natt_flags & NAT_DETECTED_PEER)) {
+					if (iph2->ext_nat_id_p)
+						vfree(iph2->ext_nat_id_p);
+					iph2->ext_nat_id_p = vmalloc(ntohs(idp_ptr->h.len) - sizeof(struct isakmp_gen));
+					if (iph2->ext_nat_id_p == NULL) {
+						plog(ASL_LEVEL_ERR, "memory error while allocating peers ph2's external nat id.\n");
+						goto end;
+					}
+					memcpy(iph2->ext_nat_id_p->v, &(idp_ptr->b), iph2->ext_nat_id_p->l);
+					plogdump(ASL_LEVEL_DEBUG, iph2->ext_nat_id_p->v, iph2->ext_nat_id_p->l, "peer's external nat address saved.\n");
+				} 
+			} else {
+				plog(ASL_LEVEL_ERR, "mismatched ID was returned.\n");
+				error = ISAKMP_NTYPE_ATTRIBUTES_NOT_SUPPORTED;
+				goto end;
 			}
-			break;
-#endif
-
-		default:
-			/* don't send information, see ident_r1recv() */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
-			goto end;
 		}
+		if (f_id == 0)
+			f_id = 1;
+	}
 
-		p += pa->len;
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_N);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		isakmp_check_ph2_notify(pa->ptr, iph2);
 
-		/* compute true length of payload. */
-		tlen += pa->len;
-	}
+#ifdef ENABLE_NATT
+	quick_natoa(&plidx, "initiator", &natoa_i, &natoa_r);
+#endif
 
 	/* payload existency check */
 	if (hash == NULL || iph2->sa_ret == NULL || iph2->nonce_p == NULL) {
@@ -726,8 +728,6 @@ end:
 	}
 	if (hbuf)
 		vfree(hbuf);
-	if (pbuf)
-		vfree(pbuf);
 	if (msg)
 		vfree(msg);
 
@@ -745,6 +745,7 @@ end:
 		VPTRINIT(iph2->dhpub_p);
 	}
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -778,7 +779,7 @@ quick_i3send(iph2, msg0)
 
 	plog(ASL_LEVEL_DEBUG, "HASH(3) generate\n");
 
-	tmp = vmalloc(iph2->nonce->l + iph2->nonce_p->l);
+	tmp = varena_alloc(&iph2->arena, iph2->nonce->l + iph2->nonce_p->l);
 	if (tmp == NULL) { 
 		plog(ASL_LEVEL_ERR, 
 			"failed to get hash buffer.\n");
@@ -923,13 +924,15 @@ quick_i4recv(iph2, msg0)
 	vchar_t *msg0;
 {
 	vchar_t *msg = NULL;
-	vchar_t *pbuf = NULL;	/* for payload parsing */
+	struct isakmp_plindex plidx;	/* for payload parsing */
 	struct isakmp_parse_t *pa;
 	struct isakmp_pl_hash *hash = NULL;
 	vchar_t *notify = NULL;
 	int error = ISAKMP_INTERNAL_ERROR;
 	int packet_error = -1;
 
+	isakmp_plindex_init(&plidx);
+
 	/* validity check */
 	if (iph2->status != IKEV1_STATE_QUICK_I_MSG3SENT) {
 		plog(ASL_LEVEL_ERR,
@@ -951,44 +954,34 @@ quick_i4recv(iph2, msg0)
 	}
 
 	/* validate the type of next payload */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR,
 			 "failed to parse msg\n");
 		goto end;
 	}
 
-	for (pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
+	if ((pa = isakmp_plindex_check(&plidx, quick_i4_rules)) != NULL) {
+		/* don't send information, see ident_r1recv() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
+		goto end;
+	}
 
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_HASH:
-			hash = (struct isakmp_pl_hash *)pa->ptr;
-			break;
-		case ISAKMP_NPTYPE_N:
-			if (notify != NULL) {
-				plog(ASL_LEVEL_WARNING,
-				    "Ignoring multiple notifications\n");
-				break;
-			}
-			isakmp_check_ph2_notify(pa->ptr, iph2);
-			notify = vmalloc(pa->len);
-			if (notify == NULL) {
-				plog(ASL_LEVEL_ERR,
-					"failed to get notify buffer.\n");
-				goto end;
-			}
-			memcpy(notify->v, pa->ptr, notify->l);
-			break;
-		default:
-			/* don't send information, see ident_r1recv() */
+	hash = isakmp_plindex_hash(&plidx);
+	if ((pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_N)) != NULL) {
+		if (isakmp_plindex_next(&plidx, pa) != NULL)
+			plog(ASL_LEVEL_WARNING,
+			    "Ignoring multiple notifications\n");
+		isakmp_check_ph2_notify(pa->ptr, iph2);
+		notify = vmalloc(pa->len);
+		if (notify == NULL) {
 			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
+				"failed to get notify buffer.\n");
 			goto end;
 		}
+		memcpy(notify->v, pa->ptr, notify->l);
 	}
 
 	/* payload existency check */
@@ -1070,11 +1063,10 @@ end:
 	}
 	if (msg != NULL)
 		vfree(msg);
-	if (pbuf != NULL)
-		vfree(pbuf);
 	if (notify != NULL)
 		vfree(notify);
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -1089,17 +1081,20 @@ quick_r1recv(iph2, msg0)
 {
 	vchar_t *msg = NULL;
 	vchar_t *hbuf = NULL;	/* for hash computing. */
-	vchar_t *pbuf = NULL;	/* for payload parsing */
+	struct isakmp_plindex plidx;	/* for payload parsing */
 	struct isakmp_parse_t *pa;
+	struct isakmp_gen *gen;
 	struct isakmp *isakmp = (struct isakmp *)msg0->v;
 	struct isakmp_pl_hash *hash = NULL;
 	char *p;
 	int tlen;
-	int f_id_order;	/* for ID payload detection */
+	struct isakmp_parse_t *idci = NULL;	/* for ID payload detection */
 	int error = ISAKMP_INTERNAL_ERROR;
 	struct sockaddr_storage *natoa_i = NULL;
 	struct sockaddr_storage *natoa_r = NULL;
 
+	isakmp_plindex_init(&plidx);
+
 	/* validity check */
 	if (iph2->status != IKEV1_STATE_QUICK_R_START) {
 		plog(ASL_LEVEL_ERR,
@@ -1129,25 +1124,22 @@ quick_r1recv(iph2, msg0)
 	 *	2. the second one must be SA (added in isakmp-oakley-05!)
 	 *	3. two IDs must be considered as IDci, then IDcr
 	 */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR,
 			 "failed to parse msg\n");
 		goto end;
 	}
-	pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
 
 	/* HASH payload is fixed postion */
-	if (pa->type != ISAKMP_NPTYPE_HASH) {
+	if (plidx.pl[0].type != ISAKMP_NPTYPE_HASH) {
 		plog(ASL_LEVEL_ERR,
 			"received invalid next payload type %d, "
 			"expecting %d.\n",
-			pa->type, ISAKMP_NPTYPE_HASH);
+			plidx.pl[0].type, ISAKMP_NPTYPE_HASH);
 		error = ISAKMP_NTYPE_BAD_PROPOSAL_SYNTAX;
 		goto end;
 	}
-	hash = (struct isakmp_pl_hash *)pa->ptr;
-	pa++;
+	hash = isakmp_plindex_hash(&plidx);
 
 	/*
 	 * this restriction was introduced in isakmp-oakley-05.
@@ -1155,14 +1147,28 @@ quick_r1recv(iph2, msg0)
 	 * TODO: command line/config file option to enable/disable this code
 	 */
 	/* HASH payload is fixed postion */
-	if (pa->type != ISAKMP_NPTYPE_SA) {
+	if (plidx.pl[1].type != ISAKMP_NPTYPE_SA) {
 		plog(ASL_LEVEL_WARNING,
 			"received invalid next payload type %d, "
 			"expecting %d.\n",
-			pa->type, ISAKMP_NPTYPE_SA);
+			plidx.pl[1].type, ISAKMP_NPTYPE_SA);
 		error = ISAKMP_NTYPE_BAD_PROPOSAL_SYNTAX;
 	}
 
+	if ((pa = isakmp_plindex_check(&plidx, quick_r1_rules)) != NULL) {
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpected payload type %d.\n",
+			pa->type);
+		error = ISAKMP_NTYPE_PAYLOAD_MALFORMED;
+		goto end;
+	}
+	if (isakmp_plindex_count(&plidx, ISAKMP_NPTYPE_SA) > 1) {
+		plog(ASL_LEVEL_ERR,
+			"Multi SAs isn't supported.\n");
+		goto end;
+	}
+
 	/* allocate buffer for computing HASH(1) */
 	tlen = ntohl(isakmp->len) - sizeof(*isakmp);
 	if (tlen < 0) {
@@ -1170,7 +1176,7 @@ quick_r1recv(iph2, msg0)
 			 ntohl(isakmp->len));
 		goto end;
 	}
-	hbuf = vmalloc(tlen);
+	hbuf = varena_alloc(&iph2->arena, tlen);
 	if (hbuf == NULL) {
 		plog(ASL_LEVEL_ERR,
 			"failed to get hash buffer.\n");
@@ -1179,145 +1185,85 @@ quick_r1recv(iph2, msg0)
 	p = hbuf->v;
 
 	/*
-	 * parse the payloads.
-	 * copy non-HASH payloads into hbuf, so that we can validate HASH.
+	 * the payloads after HASH are contiguous in the message, so
+	 * they are copied into hbuf at once to validate HASH.
+	 * count payload length except of HASH payload.
 	 */
+	tlen = (caddr_t)plidx.pl[plidx.np - 1].ptr + plidx.pl[plidx.np - 1].len
+		- ((caddr_t)plidx.pl[0].ptr + plidx.pl[0].len);
+	/* Don't modify the payload */
+	memcpy(p, (caddr_t)plidx.pl[0].ptr + plidx.pl[0].len, tlen);
+
 	iph2->sa = NULL;	/* we don't support multi SAs. */
 	iph2->nonce_p = NULL;
 	iph2->dhpub_p = NULL;
 	iph2->id_p = NULL;
 	iph2->id = NULL;
-	tlen = 0;	/* count payload length except of HASH payload. */
+
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_SA)) != NULL &&
+	    isakmp_p2ph(&iph2->sa, gen) < 0) {
+		plog(ASL_LEVEL_ERR,
+			 "failed to process SA payload\n");
+		goto end;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_NONCE)) != NULL &&
+	    isakmp_p2ph(&iph2->nonce_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR,
+			 "failed to process NONCE payload\n");
+		goto end;
+	}
+	if ((gen = isakmp_plindex_get(&plidx, ISAKMP_NPTYPE_KE)) != NULL &&
+	    isakmp_p2ph(&iph2->dhpub_p, gen) < 0) {
+		plog(ASL_LEVEL_ERR,
+			 "failed to process KE payload\n");
+		goto end;
+	}
 
 	/*
 	 * IDi2 MUST be immediatelly followed by IDr2.  We allowed the
 	 * illegal case, but logged.  First ID payload is to be IDi2.
 	 * And next ID payload is to be IDr2.
 	 */
-	f_id_order = 0;
-
-	for (; pa->type; pa++) {
-
-		/* copy to buffer for HASH */
-		/* Don't modify the payload */
-		memcpy(p, pa->ptr, pa->len);
-
-		if (pa->type != ISAKMP_NPTYPE_ID)
-			f_id_order = 0;
-
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_SA:
-			if (iph2->sa != NULL) {
-				plog(ASL_LEVEL_ERR,
-					"Multi SAs isn't supported.\n");
-				goto end;
-			}
-			if (isakmp_p2ph(&iph2->sa, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR,
-					 "failed to process SA payload\n");
-				goto end;
-			}
-			break;
-
-		case ISAKMP_NPTYPE_NONCE:
-			if (isakmp_p2ph(&iph2->nonce_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR,
-					 "failed to process NONCE payload\n");
-				goto end;
-			}
-			break;
-
-		case ISAKMP_NPTYPE_KE:
-			if (isakmp_p2ph(&iph2->dhpub_p, pa->ptr) < 0) {
-				plog(ASL_LEVEL_ERR,
-					 "failed to process KE payload\n");
-				goto end;
-			}
-			break;
-
-		case ISAKMP_NPTYPE_ID:
-			if (iph2->id_p == NULL) {
-				/* for IDci */
-				f_id_order++;
-
-				if (isakmp_p2ph(&iph2->id_p, pa->ptr) < 0) {
-					plog(ASL_LEVEL_ERR,
-						 "failed to process IDci2 payload\n");
-					goto end;
-				}
-
-			} else if (iph2->id == NULL) {
-				/* for IDcr */
-				if (f_id_order == 0) {
-					plog(ASL_LEVEL_ERR,
-						"IDr2 payload is not "
-						"immediatelly followed "
-						"by IDi2. We allowed.\n");
-					/* XXX we allowed in this case. */
-				}
-
-				if (isakmp_p2ph(&iph2->id, pa->ptr) < 0) {
-					plog(ASL_LEVEL_ERR,
-						 "failed to process IDcr2 payload\n");
-					goto end;
-				}
-			} else {
-				plogdump(ASL_LEVEL_ERR, iph2->id->v, iph2->id->l, "received too many ID payloads");
-				error = ISAKMP_NTYPE_INVALID_ID_INFORMATION;
-				goto end;
-			}
-			break;
-
-		case ISAKMP_NPTYPE_N:
-			isakmp_check_ph2_notify(pa->ptr, iph2);
-			break;
-
-#ifdef ENABLE_NATT
-		case ISAKMP_NPTYPE_NATOA_DRAFT:
-		case ISAKMP_NPTYPE_NATOA_BADDRAFT:
-		case ISAKMP_NPTYPE_NATOA_RFC:
-		    {
-				vchar_t         *vp = NULL;
-				struct sockaddr_storage *daddr;
-				
-				isakmp_p2ph(&vp, pa->ptr);
-				
-				if (vp) {
-					daddr = process_natoa_payload(vp);
-					if (daddr) {
-						if (natoa_i == NULL) {
-							natoa_i = daddr;
-							plog(ASL_LEVEL_DEBUG, "responder rcvd NAT-OA i: %s\n",
-								 saddr2str((struct sockaddr *)natoa_i));
-						} else if (natoa_r == NULL) {
-							natoa_r = daddr;
-							plog(ASL_LEVEL_DEBUG, "responder rcvd NAT-OA r: %s\n",
-								 saddr2str((struct sockaddr *)natoa_r));
-						} else {
-							racoon_free(daddr);
-						}
-					}
-					vfree(vp);
-				}
-				
-			}
-			break;
-#endif
+	if ((pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_ID)) != NULL) {
+		/* for IDci */
+		if (isakmp_p2ph(&iph2->id_p, pa->ptr) < 0) {
+			plog(ASL_LEVEL_ERR,
+				 "failed to process IDci2 payload\n");
+			goto end;
+		}
+		idci = pa;
+	}
+	if (pa != NULL &&
+	    (pa = isakmp_plindex_next(&plidx, pa)) != NULL) {
+		/* for IDcr */
+		if (pa != idci + 1) {
+			plog(ASL_LEVEL_ERR,
+				"IDr2 payload is not "
+				"immediatelly followed "
+				"by IDi2. We allowed.\n");
+			/* XXX we allowed in this case. */
+		}
 
-		default:
+		if (isakmp_p2ph(&iph2->id, pa->ptr) < 0) {
 			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpected payload type %d.\n",
-				pa->type);
-			error = ISAKMP_NTYPE_PAYLOAD_MALFORMED;
+				 "failed to process IDcr2 payload\n");
 			goto end;
 		}
+	}
+	if (isakmp_plindex_count(&plidx, ISAKMP_NPTYPE_ID) > 2) {
+		plogdump(ASL_LEVEL_ERR, iph2->id->v, iph2->id->l, "received too many ID payloads");
+		error = ISAKMP_NTYPE_INVALID_ID_INFORMATION;
+		goto end;
+	}
 
-		p += pa->len;
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_N);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		isakmp_check_ph2_notify(pa->ptr, iph2);
 
-		/* compute true length of payload. */
-		tlen += pa->len;
-	}
+#ifdef ENABLE_NATT
+	quick_natoa(&plidx, "responder", &natoa_i, &natoa_r);
+#endif
 
 	/* payload existency check */
 	if (hash == NULL || iph2->sa == NULL || iph2->nonce_p == NULL) {
@@ -1365,6 +1311,9 @@ quick_r1recv(iph2, msg0)
 	}
     }
 
+	/* authenticated: a roaming peer may move the ISAKMP-SA now */
+	ike_session_ikev1_roam_commit(iph2->ph1, iph2);
+
 	/* get sainfo */
 	error = get_sainfo_r(iph2);
 	if (error) {
@@ -1444,8 +1393,6 @@ end:
 		vfree(hbuf);
 	if (msg)
 		vfree(msg);
-	if (pbuf)
-		vfree(pbuf);
 
 #ifdef ENABLE_NATT
 	if (natoa_i) {
@@ -1464,6 +1411,7 @@ end:
 		VPTRINIT(iph2->id_p);
 	}
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -1717,7 +1665,7 @@ quick_r2send(iph2, msg)
     {
 	vchar_t *tmp;
 
-	tmp = vmalloc(iph2->nonce_p->l + body->l);
+	tmp = varena_alloc(&iph2->arena, iph2->nonce_p->l + body->l);
 	if (tmp == NULL) { 
 		plog(ASL_LEVEL_ERR,
 			"failed to get hash buffer.\n");
@@ -1799,11 +1747,13 @@ quick_r3recv(iph2, msg0)
 	vchar_t *msg0;
 {
 	vchar_t *msg = NULL;
-	vchar_t *pbuf = NULL;	/* for payload parsing */
+	struct isakmp_plindex plidx;	/* for payload parsing */
 	struct isakmp_parse_t *pa;
 	struct isakmp_pl_hash *hash = NULL;
 	int error = ISAKMP_INTERNAL_ERROR;
 
+	isakmp_plindex_init(&plidx);
+
 	/* validity check */
 	if (iph2->status != IKEV1_STATE_QUICK_R_MSG2SENT) {
 		plog(ASL_LEVEL_ERR,
@@ -1825,34 +1775,27 @@ quick_r3recv(iph2, msg0)
 	}
 
 	/* validate the type of next payload */
-	pbuf = isakmp_parse(msg);
-	if (pbuf == NULL) {
+	if (isakmp_plindex_parse(&plidx, msg) < 0) {
 		plog(ASL_LEVEL_ERR, 
 			 "failed to parse msg\n");
 		goto end;
 	}
 
-	for (pa = ALIGNED_CAST(struct isakmp_parse_t *)pbuf->v;
-	     pa->type != ISAKMP_NPTYPE_NONE;
-	     pa++) {
-
-		switch (pa->type) {
-		case ISAKMP_NPTYPE_HASH:
-			hash = (struct isakmp_pl_hash *)pa->ptr;
-			break;
-		case ISAKMP_NPTYPE_N:
-			isakmp_check_ph2_notify(pa->ptr, iph2);
-			break;
-		default:
-			/* don't send information, see ident_r1recv() */
-			plog(ASL_LEVEL_ERR,
-				"ignore the packet, "
-				"received unexpecting payload type %d.\n",
-				pa->type);
-			goto end;
-		}
+	if ((pa = isakmp_plindex_check(&plidx, quick_r3_rules)) != NULL) {
+		/* don't send information, see ident_r1recv() */
+		plog(ASL_LEVEL_ERR,
+			"ignore the packet, "
+			"received unexpecting payload type %d.\n",
+			pa->type);
+		goto end;
 	}
 
+	hash = isakmp_plindex_hash(&plidx);
+	for (pa = isakmp_plindex_first(&plidx, ISAKMP_NPTYPE_N);
+	     pa != NULL;
+	     pa = isakmp_plindex_next(&plidx, pa))
+		isakmp_check_ph2_notify(pa->ptr, iph2);
+
 	/* payload existency check */
 	if (hash == NULL) {
 		plog(ASL_LEVEL_ERR,
@@ -1872,7 +1815,7 @@ quick_r3recv(iph2, msg0)
 
 	//plogdump(ASL_LEVEL_DEBUG, r_hash, ntohs(hash->h.len) - sizeof(*hash), "HASH(3) validate:");
 
-	tmp = vmalloc(iph2->nonce_p->l + iph2->nonce->l);
+	tmp = varena_alloc(&iph2->arena, iph2->nonce_p->l + iph2->nonce->l);
 	if (tmp == NULL) { 
 		plog(ASL_LEVEL_ERR, 
 			"failed to get hash buffer.\n");
@@ -1920,11 +1863,10 @@ end:
 								CONSTSTR("Responder, Quick-Mode Message 3"),
 								CONSTSTR("Failed to process Quick-Mode Message 3"));
 	}
-	if (pbuf != NULL)
-		vfree(pbuf);
 	if (msg != NULL)
 		vfree(msg);
 
+	isakmp_plindex_free(&plidx);
 	return error;
 }
 
@@ -2182,6 +2124,53 @@ end:
 	return error;
 }
 
+#ifdef ENABLE_NATT
+/*
+ * NAT-OA payloads of any draft, in message order: the first one is the
+ * initiator's original address and the second one the responder's.
+ */
+static void
+quick_natoa(struct isakmp_plindex *plidx, const char *who,
+	struct sockaddr_storage **natoa_i, struct sockaddr_storage **natoa_r)
+{
+	struct isakmp_parse_t *pa;
+	vchar_t *vp;
+	struct sockaddr_storage *daddr;
+
+	if (isakmp_plindex_count(plidx, ISAKMP_NPTYPE_NATOA_DRAFT) == 0 &&
+	    isakmp_plindex_count(plidx, ISAKMP_NPTYPE_NATOA_BADDRAFT) == 0 &&
+	    isakmp_plindex_count(plidx, ISAKMP_NPTYPE_NATOA_RFC) == 0)
+		return;
+
+	for (pa = plidx->pl; pa->type != ISAKMP_NPTYPE_NONE; pa++) {
+		if (pa->type != ISAKMP_NPTYPE_NATOA_DRAFT &&
+		    pa->type != ISAKMP_NPTYPE_NATOA_BADDRAFT &&
+		    pa->type != ISAKMP_NPTYPE_NATOA_RFC)
+			continue;
+
+		vp = NULL;
+		isakmp_p2ph(&vp, pa->ptr);
+		if (vp == NULL)
+			continue;
+		daddr = process_natoa_payload(vp);
+		if (daddr) {
+			if (*natoa_i == NULL) {
+				*natoa_i = daddr;
+				plog(ASL_LEVEL_DEBUG, "%s rcvd NAT-OA i: %s\n",
+					 who, saddr2str((struct sockaddr *)*natoa_i));
+			} else if (*natoa_r == NULL) {
+				*natoa_r = daddr;
+				plog(ASL_LEVEL_DEBUG, "%s rcvd NAT-OA r: %s\n",
+					 who, saddr2str((struct sockaddr *)*natoa_r));
+			} else {
+				racoon_free(daddr);
+			}
+		}
+		vfree(vp);
+	}
+}
+#endif
+
 /*
  * create HASH, body (SA, NONCE) payload with isakmp header.
  */
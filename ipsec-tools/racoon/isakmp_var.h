@@ -66,13 +66,13 @@ struct isakmp_pl_ke;	/* XXX */
 struct isakmp_pl_nonce;	/* XXX */
 
 extern void isakmp_handler (int);
+extern void isakmp_input (vchar_t *, struct sockaddr_storage *, struct sockaddr_storage *);
 extern int ikev1_ph1begin_i (ike_session_t *session, struct remoteconf *, struct sockaddr_storage *,
 	struct sockaddr_storage *, int, nw_nat64_prefix_t *);
 extern int get_sainfo_r (phase2_handle_t *);
 extern int get_proposal_r (phase2_handle_t *);
 
 extern vchar_t *isakmp_parsewoh (int, struct isakmp_gen *, int);
-extern vchar_t *isakmp_parse (vchar_t *);
 
 extern int isakmp_init (void);
 extern void isakmp_cleanup (void);
@@ -84,6 +84,8 @@ extern void isakmp_close (void);
 extern void isakmp_close_sockets (void);
 extern void isakmp_close_unused (void);
 extern int isakmp_send (phase1_handle_t *, vchar_t *);
+struct iovec;
+extern int isakmp_sendv (phase1_handle_t *, struct iovec *, int);
 
 extern void isakmp_ph1resend_stub (void *);
 extern int isakmp_ph1resend (phase1_handle_t *);
@@ -126,6 +128,8 @@ extern struct payload_list *isakmp_plist_append (struct payload_list *plist,
 	vchar_t *payload, int payload_type);
 extern vchar_t *isakmp_plist_set_all (struct payload_list **plist,
 	phase1_handle_t *iph1);
+extern vchar_t *isakmp_plist_encrypt (struct payload_list **plist,
+	phase1_handle_t *iph1, vchar_t *ivep, vchar_t *ivp);
 extern vchar_t *isakmp_plist_append_initial_contact (phase1_handle_t *, struct payload_list *);
 
 #ifdef HAVE_PRINT_ISAKMP_C
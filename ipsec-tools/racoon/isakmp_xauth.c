@@ -93,6 +93,7 @@
 #include "vpn_control_var.h"
 #include "ipsecSessionTracer.h"
 #include "ipsecMessageTracer.h"
+#include "metrics.h"
 
 
 void 
@@ -284,6 +285,7 @@ xauth_attr_reply(iph1, attr, id)
 			    "Throttling in action for %s: delay %lds\n",
 			    str, (unsigned long)throttle_delay);
 			res = -1;
+			METRICS_INC(METRICS_C_THROTTLED);
 		} else {
 			throttle_delay = 0;
 		}
@@ -129,6 +129,9 @@ setdefault()
 	lcconf->strict_address = FALSE;
 	lcconf->complex_bundle = TRUE; /*XXX FALSE;*/
 	lcconf->natt_ka_interval = LC_DEFAULT_NATT_KA_INTERVAL;
+	lcconf->cert_cache_ttl = LC_DEFAULT_CERT_CACHE_TTL;
+	lcconf->rekey_jitter = 0;
+	lcconf->rekey_rate = 0;
 	lcconf->auto_exit_delay = 0;
 	lcconf->auto_exit_state &= ~LC_AUTOEXITSTATE_SET;
 	lcconf->auto_exit_state |= LC_AUTOEXITSTATE_CLIENT;				/* always auto exit as default */
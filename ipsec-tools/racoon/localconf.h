@@ -66,9 +66,12 @@
 #define LC_DEFAULT_RETRY_CHECKPH1	30
 #define LC_DEFAULT_WAIT_PH2COMPLETE	30
 #define LC_DEFAULT_NATT_KA_INTERVAL	20
+#define LC_DEFAULT_CERT_CACHE_TTL	3600
 
 #define LC_DEFAULT_SECRETSIZE	16	/* 128 bits */
 
+#define LC_MYADDRS_HASHSIZE	64	/* buckets of myaddrs_hash */
+
 #define	LC_GSSENC_UTF16LE	0	/* GSS ID in UTF-16LE */
 #define	LC_GSSENC_LATIN1	1	/* GSS ID in ISO-Latin-1 */
 #define	LC_GSSENC_MAX		2
@@ -86,6 +89,8 @@ struct vpnctl_socket_elem {
 	uint32_t			pending_bytes_len;
 	uint8_t				*buffer;
 	LIST_HEAD(_bound_addrs, bound_addr) bound_addresses;
+	u_int32_t			id;			/* same in every shard */
+	int					relay;		/* a worker's copy, answers go through shard 0 */
 };
 
 struct bound_addr {
@@ -136,6 +141,7 @@ struct localconf {
 	TAILQ_HEAD(_saved_msg_elem, saved_msg_elem) saved_msg_queue;
 	int autograbaddr;
 	struct myaddrs *myaddrs;
+	struct myaddrs *myaddrs_hash[LC_MYADDRS_HASHSIZE];	/* by address */
 
 	char *logfile_param;		/* from command line */
 	char *pathinfo[LC_PATHTYPE_MAX];
@@ -156,6 +162,9 @@ struct localconf {
 	int wait_ph2complete;
 
 	int natt_ka_interval;		/* NAT-T keepalive interval. */
+	int cert_cache_ttl;		/* validated peer chains, 0 disables */
+	int rekey_jitter;		/* percent of lifetime, 0 disables */
+	int rekey_rate;			/* rekeys started per second, 0 unlimited */
 	vchar_t *ext_nat_id;		/* our address id for our nat address */
 
 	int secret_size;
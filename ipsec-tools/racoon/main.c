@@ -38,6 +38,7 @@
 #include <sys/sysctl.h>
 
 #include <netinet/in.h>
+#include <net/pfkeyv2.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -73,12 +74,18 @@
 #endif
 #include "remoteconf.h"
 #include "localconf.h"
+#include "cfsnapshot.h"
 #include "session.h"
 #include "oakley.h"
 #include "pfkey.h"
+#include "libpfkey.h"
 #include "policy.h"
 #include "crypto_openssl.h"
 #include "vendorid.h"
+#include "metrics.h"
+#include "pkttrace.h"
+#include "vpn_control.h"
+#include "shard.h"
 
 #if !TARGET_OS_EMBEDDED
 #include <sandbox.h>
@@ -94,7 +101,11 @@
 int f_local = 0;	/* local test mode.  behave like a wall. */
 int vflag = 1;		/* for print-isakmp.c */
 static int dump_config = 0;	/* dump parsed config file. */
+static int compile_config = 0;	/* only write the config snapshot. */
 static int exec_done = 0;	/* we've already been exec'd */
+static int f_pfkey_standin = 0;	/* PF_KEY goes to a userspace stand-in. */
+static int shard_workers = 1;	/* processes to shard IKE over. */
+static int shard_self = 0;	/* our index among them, set by shard 0. */
 
 #ifdef TOP_PACKAGE
 static char version[] = "@(#)" TOP_PACKAGE_STRING " (" TOP_PACKAGE_URL ")";
@@ -121,7 +132,7 @@ int print_pid = 1;	/* for racoon only */
 void
 usage()
 {
-	printf("usage: racoon [-BdDFvs%s] %s[-f (file)] [-l (file)] [-p (port)]\n",
+	printf("usage: racoon [-BcdDFvs%s] %s[-f (file)] [-l (file)] [-p (port)] [-K (file)] [-V (file)] [-N (workers)]\n",
 #ifdef INET6
 		"46",
 #else
@@ -132,6 +143,7 @@ usage()
 	printf("   -d: debug level, more -d will generate more debug message.\n");
 	printf("   -D: started by LaunchD (implies daemon mode).\n");
 	printf("   -C: dump parsed config file.\n");
+	printf("   -c: compile the config file into its snapshot and exit.\n");
 	printf("   -L: include location in debug messages\n");
 	printf("   -F: run in foreground, do not become daemon.\n");
 	printf("   -v: be more verbose\n");
@@ -144,6 +156,9 @@ usage()
 	printf("   -l: pathname for log file.\n");
 	printf("   -p: port number for isakmp (default: %d).\n", PORT_ISAKMP);
 	printf("   -P: port number for NAT-T (default: %d).\n", PORT_ISAKMP_NATT);
+	printf("   -K: pathname of a userspace PF_KEY stand-in to use instead of the kernel.\n");
+	printf("   -V: pathname for the VPN control socket.\n");
+	printf("   -N: number of processes to spread IKE sessions over (default: 1).\n");
 	exit(1);
 }
 
@@ -154,15 +169,6 @@ main(ac, av)
 {
 	int error;
 
-#if !TARGET_OS_EMBEDDED
-	char *errorbuf;
-	if (sandbox_init("racoon", SANDBOX_NAMED, &errorbuf) == -1) {
-		plog(ASL_LEVEL_ERR, "initializing sandbox failed %s", errorbuf);
-		sandbox_free_error(errorbuf);
-		return -1;
-	}
-#endif // !TARGET_OS_EMBEDDED
-
 	/*
 	 * Check IPSec plist
 	 */
@@ -194,8 +200,26 @@ main(ac, av)
 	initrmconf();
 	oakley_dhinit();
 	compute_vendorids();
+	metrics_init();
 
 	parse(ac, av);
+	if (shard_setup(shard_workers, shard_self) < 0)
+		errx(1, "invalid number of workers.");
+
+#if !TARGET_OS_EMBEDDED
+	/*
+	 * the PF_KEY stand-in is for tests, which keep it and their other
+	 * sockets in a scratch directory: the sandbox is for the real thing.
+	 */
+	if (!f_pfkey_standin) {
+		char *errorbuf;
+		if (sandbox_init("racoon", SANDBOX_NAMED, &errorbuf) == -1) {
+			plog(ASL_LEVEL_ERR, "initializing sandbox failed %s", errorbuf);
+			sandbox_free_error(errorbuf);
+			return -1;
+		}
+	}
+#endif // !TARGET_OS_EMBEDDED
 
 	plog(ASL_LEVEL_NOTICE, "racoon started: pid=%d  started by: %d, launchdlaunched %d\n", getpid(), getppid(), launchdlaunched);
 	plog(ASL_LEVEL_NOTICE, "%s\n", version);
@@ -207,6 +231,14 @@ main(ac, av)
 	plog(ASL_LEVEL_NOTICE, "Reading configuration from \"%s\"\n", 
 	    lcconf->racoon_conf);
 
+	if (compile_config) {
+		if (cfparse() != 0)
+			errx(1, "failed to parse configuration file.");
+		if (cfsnapshot_write(lcconf->racoon_conf) != 0)
+			errx(1, "failed to write configuration snapshot.");
+		exit(0);
+	}
+
     //%%%%% this sould probably be moved to session()
 	if (pfkey_init() < 0) {
 		errx(1, "failed to initialize pfkey.\n");
@@ -218,10 +250,18 @@ main(ac, av)
 	 * saving some parameters before parsing configuration file.
 	 */
 	save_params();
-	error = cfparse();
+	if (cfsnapshot_load(lcconf->racoon_conf) == 0) {
+		error = cfparse();	/* the rest of it */
+		cfsnapshot_done();
+	} else {
+		error = cfparse();
+		if (error == 0)
+			cfsnapshot_write(lcconf->racoon_conf);
+	}
 	if (error != 0)
 		errx(1, "failed to parse configuration file.");
 	restore_params();
+	pkttrace_apply();
 	
 	if (lcconf->logfile_param == NULL && logFileStr[0] == 0)
 		plogresetfile(lcconf->pathinfo[LC_PATHTYPE_LOGFILE]);
@@ -317,6 +357,9 @@ main(ac, av)
 	}
     
     
+	if (shard_spawn(av) < 0)
+		errx(1, "failed to start the workers.");
+
     /* start the session */
 	session();
 }
@@ -386,7 +429,7 @@ parse(ac, av)
 	else
 		pname = *av;
 
-	while ((c = getopt(ac, av, "dDLFp:P:a:f:l:vsZBCx"
+	while ((c = getopt(ac, av, "cdDLFp:P:a:f:l:vsZBCxK:V:N:S:"
 #ifdef YYDEBUG
 			"y"
 #endif
@@ -435,6 +478,27 @@ parse(ac, av)
 		case 'v':
 			vflag++;
 			break;
+		case 'K':
+			if (pfkey_set_emulator(optarg) < 0) {
+				fprintf(stderr, "%s: invalid PF_KEY stand-in path\n", optarg);
+				exit(1);
+			}
+			f_pfkey_standin = 1;
+			break;
+		case 'V':
+			vpncontrolsock_path = optarg;
+			break;
+		case 'N':
+			shard_workers = atoi(optarg);
+			if (shard_workers <= 0 || shard_workers > SHARD_MAX) {
+				fprintf(stderr, "%s: invalid number of workers\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'S':
+			/* not for users: how shard 0 starts the others */
+			shard_self = atoi(optarg);
+			break;
 		case 's':
 			lcconf->auto_exit_state &= ~LC_AUTOEXITSTATE_CLIENT;	/* override default auto exit state */
 			break;
@@ -471,6 +535,9 @@ parse(ac, av)
 		case 'C':
 			dump_config++;
 			break;
+		case 'c':
+			compile_config = 1;
+			break;
 		default:
 			usage();
 			/* NOTREACHED */
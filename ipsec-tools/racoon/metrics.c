@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+
+#include <net/pfkeyv2.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <mach/mach_time.h>
+#include <arpa/inet.h>
+
+#include "libpfkey.h"
+#include "var.h"
+#include "vmbuf.h"
+#include "plog.h"
+#include "debug.h"
+#include "strnames.h"
+
+#include "vpn_control.h"
+#include "metrics.h"
+
+u_int64_t metrics_counters[METRICS_C_MAX];
+
+static struct metrics_hist metrics_hists[METRICS_H_PFKEY];
+static struct metrics_hist metrics_pfkey_hists[SADB_MAX + 1];
+static mach_timebase_info_data_t metrics_timebase;
+static time_t metrics_started;
+
+static const char *metrics_counter_names[METRICS_C_MAX] = {
+	"recv_packets",
+	"recv_dropped",
+	"recv_retransmit",
+	"throttled",
+	"ph1_resend",
+	"ph2_resend",
+	"ph1_established",
+	"ph2_established",
+	"pfkey_sent",
+	"pfkey_errors",
+	"certcache_hits",
+	"certcache_misses",
+	"rekeys",
+	"rekeys_deferred",
+	"dpd_sent",
+	"dpd_suppressed",
+	"vmbuf_heap",
+	"vmbuf_arena",
+	"vmbuf_chunks",
+	"vmbuf_promotions",
+};
+
+static const char *metrics_hist_names[METRICS_H_PFKEY] = {
+	"recv",
+	"dh_generate",
+	"dh_compute",
+	"sign",
+	"verify",
+	"ph1",
+	"ph2",
+};
+
+/*
+ * PF_KEY requests waiting for their reply, keyed by type and sequence
+ * number.  Requests are sent and replies processed on the main queue
+ * only, so this table needs no atomics.  A request that never gets a
+ * reply is simply overwritten later.
+ */
+#define METRICS_PFKEY_SLOTS	64	/* power of two */
+#define METRICS_PFKEY_PROBE	4
+
+struct metrics_pfkey_pending {
+	u_int64_t sent;			/* 0 when free */
+	u_int32_t seq;
+	u_int8_t type;
+};
+
+static struct metrics_pfkey_pending metrics_pfkey_pending[METRICS_PFKEY_SLOTS];
+
+static void metrics_pfkey_sent (struct sadb_msg *);
+static u_int64_t metrics_counter (int);
+
+void
+metrics_init(void)
+{
+	if (metrics_timebase.denom == 0)
+		mach_timebase_info(&metrics_timebase);
+	metrics_started = time(NULL);
+	pfkey_set_send_hook(metrics_pfkey_sent);
+}
+
+/* monotonic nanoseconds */
+u_int64_t
+metrics_now(void)
+{
+	if (metrics_timebase.denom == 0)
+		mach_timebase_info(&metrics_timebase);
+	return mach_absolute_time() * metrics_timebase.numer /
+		metrics_timebase.denom;
+}
+
+static int
+metrics_bucket(u_int64_t v)
+{
+	int msb;
+
+	if (v < METRICS_SUB)
+		return (int)v;
+	msb = 63 - __builtin_clzll(v);
+	if (msb >= METRICS_MAXBITS)
+		return METRICS_BUCKETS - 1;
+	return (msb - METRICS_SUBBITS + 1) * METRICS_SUB +
+		(int)((v >> (msb - METRICS_SUBBITS)) & (METRICS_SUB - 1));
+}
+
+/* smallest value falling in bucket b */
+static u_int64_t
+metrics_bucket_value(int b)
+{
+	int e = b / METRICS_SUB;
+
+	if (e == 0)
+		return b;
+	return (u_int64_t)(METRICS_SUB + b % METRICS_SUB) << (e - 1);
+}
+
+void
+metrics_hist_add(struct metrics_hist *h, u_int64_t v)
+{
+	u_int64_t max;
+
+	__atomic_fetch_add(&h->buckets[metrics_bucket(v)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (v > max &&
+	    !__atomic_compare_exchange_n(&h->max, &max, v, 1,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * value at quantile q (0 < q <= 1), reported as the top of its bucket
+ * so it errs on the slow side, and never above the recorded maximum.
+ */
+u_int64_t
+metrics_hist_percentile(const struct metrics_hist *h, double q)
+{
+	u_int64_t count, target, seen = 0;
+	u_int64_t max;
+	int b;
+
+	count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	if (count == 0)
+		return 0;
+	target = (u_int64_t)(q * count);
+	if (target == 0)
+		target = 1;
+
+	for (b = 0; b < METRICS_BUCKETS - 1; b++) {
+		seen += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+		if (seen >= target)
+			break;
+	}
+	if (b == METRICS_BUCKETS - 1)
+		return max;
+	return MIN(metrics_bucket_value(b + 1) - 1, max);
+}
+
+/*
+ * the vmbuf allocation counters are kept by vmbuf.c, which is also
+ * linked into the tools, and only read here.
+ */
+static u_int64_t
+metrics_counter(int id)
+{
+	switch (id) {
+	case METRICS_C_VMBUF_HEAP:
+		return vmbuf_stats.heap_allocs;
+	case METRICS_C_VMBUF_ARENA:
+		return vmbuf_stats.arena_allocs;
+	case METRICS_C_VMBUF_CHUNKS:
+		return vmbuf_stats.arena_chunks;
+	case METRICS_C_VMBUF_PROMOTIONS:
+		return vmbuf_stats.promotions;
+	default:
+		return __atomic_load_n(&metrics_counters[id], __ATOMIC_RELAXED);
+	}
+}
+
+/* record the time elapsed since start, as returned by metrics_now() */
+void
+metrics_record(int id, u_int64_t start)
+{
+	if (id < 0 || id >= METRICS_H_PFKEY || start == 0)
+		return;
+	metrics_hist_add(&metrics_hists[id], metrics_now() - start);
+}
+
+static struct metrics_pfkey_pending *
+metrics_pfkey_slot(u_int8_t type, u_int32_t seq, int insert)
+{
+	struct metrics_pfkey_pending *p, *victim = NULL;
+	u_int32_t h = (seq * 2654435761U) ^ type;
+	int i;
+
+	for (i = 0; i < METRICS_PFKEY_PROBE; i++) {
+		p = &metrics_pfkey_pending[(h + i) & (METRICS_PFKEY_SLOTS - 1)];
+		if (p->sent != 0 && p->type == type && p->seq == seq)
+			return p;
+		if (victim == NULL || p->sent < victim->sent)
+			victim = p;
+	}
+	return insert ? victim : NULL;
+}
+
+/* installed as the libipsec send hook by metrics_init() */
+static void
+metrics_pfkey_sent(struct sadb_msg *msg)
+{
+	struct metrics_pfkey_pending *p;
+
+	METRICS_INC(METRICS_C_PFKEY_SENT);
+	if (msg->sadb_msg_type > SADB_MAX)
+		return;
+
+	/* a second message with the same seq keeps the first timestamp */
+	p = metrics_pfkey_slot(msg->sadb_msg_type, msg->sadb_msg_seq, 1);
+	if (p->sent != 0 && p->type == msg->sadb_msg_type &&
+	    p->seq == msg->sadb_msg_seq)
+		return;
+	p->type = msg->sadb_msg_type;
+	p->seq = msg->sadb_msg_seq;
+	p->sent = metrics_now();
+}
+
+/* a PF_KEY message carrying our pid came back */
+void
+metrics_pfkey_recv(u_int8_t type, u_int32_t seq)
+{
+	struct metrics_pfkey_pending *p;
+
+	if (type > SADB_MAX)
+		return;
+	if ((p = metrics_pfkey_slot(type, seq, 0)) == NULL)
+		return;
+	metrics_hist_add(&metrics_pfkey_hists[type], metrics_now() - p->sent);
+	p->sent = 0;
+}
+
+static void
+metrics_hist_export(struct vpnctl_metric_histogram *out, int id, int subtype,
+	const struct metrics_hist *h)
+{
+	u_int64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+	u_int64_t sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+
+	out->id = htons(id);
+	out->subtype = htons(subtype);
+	out->count = htonl((u_int32_t)count);
+	out->mean = htonl((u_int32_t)(count ? sum / count / 1000 : 0));
+	out->p50 = htonl((u_int32_t)(metrics_hist_percentile(h, 0.50) / 1000));
+	out->p90 = htonl((u_int32_t)(metrics_hist_percentile(h, 0.90) / 1000));
+	out->p99 = htonl((u_int32_t)(metrics_hist_percentile(h, 0.99) / 1000));
+	out->p999 = htonl((u_int32_t)(metrics_hist_percentile(h, 0.999) / 1000));
+	out->max = htonl((u_int32_t)(__atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1000));
+}
+
+/*
+ * build the VPNCTL_CMD_GET_METRICS reply, in network byte order.  only
+ * hdr.len is set, the caller fills in the rest of the header.
+ */
+vchar_t *
+metrics_export(void)
+{
+	struct vpnctl_metrics *m;
+	struct vpnctl_metric_counter *c;
+	struct vpnctl_metric_histogram *hp;
+	vchar_t *buf;
+	int i, nhists = 0;
+
+	for (i = 0; i < METRICS_H_PFKEY; i++)
+		if (__atomic_load_n(&metrics_hists[i].count, __ATOMIC_RELAXED))
+			nhists++;
+	for (i = 0; i <= SADB_MAX; i++)
+		if (__atomic_load_n(&metrics_pfkey_hists[i].count, __ATOMIC_RELAXED))
+			nhists++;
+
+	buf = vmalloc(sizeof(*m) +
+	    METRICS_C_MAX * sizeof(*c) + nhists * sizeof(*hp));
+	if (buf == NULL) {
+		plog(ASL_LEVEL_ERR, "failed to allocate metrics buffer.\n");
+		return NULL;
+	}
+
+	m = ALIGNED_CAST(struct vpnctl_metrics *)buf->v;
+	m->hdr.len = htons(buf->l - sizeof(struct vpnctl_hdr));
+	m->uptime = htonl((u_int32_t)(time(NULL) - metrics_started));
+	m->counter_count = htons(METRICS_C_MAX);
+	m->histogram_count = htons(nhists);
+
+	c = ALIGNED_CAST(struct vpnctl_metric_counter *)(m + 1);
+	for (i = 0; i < METRICS_C_MAX; i++, c++) {
+		c->id = htons(i);
+		c->reserved = 0;
+		c->value = htonl((u_int32_t)metrics_counter(i));
+	}
+
+	/* a count seen as zero above is not exported even if it moved since */
+	hp = ALIGNED_CAST(struct vpnctl_metric_histogram *)c;
+	for (i = 0; i < METRICS_H_PFKEY && nhists > 0; i++) {
+		if (__atomic_load_n(&metrics_hists[i].count, __ATOMIC_RELAXED) == 0)
+			continue;
+		metrics_hist_export(hp++, i, 0, &metrics_hists[i]);
+		nhists--;
+	}
+	for (i = 0; i <= SADB_MAX && nhists > 0; i++) {
+		if (__atomic_load_n(&metrics_pfkey_hists[i].count,
+		    __ATOMIC_RELAXED) == 0)
+			continue;
+		metrics_hist_export(hp++, METRICS_H_PFKEY, i,
+		    &metrics_pfkey_hists[i]);
+		nhists--;
+	}
+
+	return buf;
+}
+
+static void
+metrics_hist_dump(const char *name, const struct metrics_hist *h)
+{
+	u_int64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+
+	if (count == 0)
+		return;
+	plog(ASL_LEVEL_NOTICE,
+	    "metrics: %-20s n=%llu mean=%lluus p50=%lluus p90=%lluus "
+	    "p99=%lluus p99.9=%lluus max=%lluus\n", name,
+	    (unsigned long long)count,
+	    (unsigned long long)(__atomic_load_n(&h->sum, __ATOMIC_RELAXED) /
+		count / 1000),
+	    (unsigned long long)(metrics_hist_percentile(h, 0.50) / 1000),
+	    (unsigned long long)(metrics_hist_percentile(h, 0.90) / 1000),
+	    (unsigned long long)(metrics_hist_percentile(h, 0.99) / 1000),
+	    (unsigned long long)(metrics_hist_percentile(h, 0.999) / 1000),
+	    (unsigned long long)(__atomic_load_n(&h->max, __ATOMIC_RELAXED) /
+		1000));
+}
+
+/* text dump to the log, on SIGUSR2 */
+void
+metrics_dump(void)
+{
+	char name[64];
+	int i;
+
+	plog(ASL_LEVEL_NOTICE, "metrics: uptime %lds\n",
+	    (long)(time(NULL) - metrics_started));
+	for (i = 0; i < METRICS_C_MAX; i++)
+		plog(ASL_LEVEL_NOTICE, "metrics: %-20s %llu\n",
+		    metrics_counter_names[i],
+		    (unsigned long long)metrics_counter(i));
+	for (i = 0; i < METRICS_H_PFKEY; i++)
+		metrics_hist_dump(metrics_hist_names[i], &metrics_hists[i]);
+	for (i = 0; i <= SADB_MAX; i++) {
+		snprintf(name, sizeof(name), "pfkey_%s", s_pfkey_type(i));
+		metrics_hist_dump(name, &metrics_pfkey_hists[i]);
+	}
+}
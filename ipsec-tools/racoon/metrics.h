@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <sys/types.h>
+
+#include "vmbuf.h"
+
+/*
+ * Built-in counters and latency histograms.
+ *
+ * Recording is a relaxed atomic add, so it is safe from any queue and
+ * costs a few nanoseconds; there is no lock anywhere on the recording
+ * path.  Histograms are HDR style: log-linear buckets with
+ * METRICS_SUB sub-buckets per power of two, in nanoseconds, so every
+ * recorded value is kept to within 1/METRICS_SUB of its true value
+ * from 1ns up to 2^METRICS_MAXBITS ns (about 18 minutes).
+ *
+ * The snapshot is read through VPNCTL_CMD_GET_METRICS and dumped to
+ * the log on SIGUSR2.  The ids below go on the wire and mirror the
+ * VPNCTL_METRIC_* codes in vpn_control.h.
+ */
+#define METRICS_C_RECV_PACKETS		0	/* isakmp packets received */
+#define METRICS_C_RECV_DROPPED		1	/* malformed or unreadable */
+#define METRICS_C_RECV_RETRANSMIT	2	/* peer retransmits answered from cache */
+#define METRICS_C_THROTTLED			3	/* xauth replies held back */
+#define METRICS_C_PH1_RESEND		4	/* our phase 1 retransmits */
+#define METRICS_C_PH2_RESEND		5	/* our phase 2 retransmits */
+#define METRICS_C_PH1_ESTABLISHED	6
+#define METRICS_C_PH2_ESTABLISHED	7
+#define METRICS_C_PFKEY_SENT		8
+#define METRICS_C_PFKEY_ERRORS		9	/* replies with sadb_msg_errno set */
+#define METRICS_C_CERTCACHE_HITS	10	/* peer chains found validated */
+#define METRICS_C_CERTCACHE_MISSES	11
+#define METRICS_C_REKEYS			12	/* phase 1 and 2 rekeys started */
+#define METRICS_C_REKEYS_DEFERRED	13	/* held back by the rekey budget */
+#define METRICS_C_DPD_SENT			14	/* R-U-THERE probes */
+#define METRICS_C_DPD_SUPPRESSED	15	/* checks answered by recent traffic */
+#define METRICS_C_VMBUF_HEAP		16	/* vmbuf_stats, read at export */
+#define METRICS_C_VMBUF_ARENA		17
+#define METRICS_C_VMBUF_CHUNKS		18
+#define METRICS_C_VMBUF_PROMOTIONS	19
+#define METRICS_C_MAX				20
+
+#define METRICS_H_RECV				0	/* receive to dispatch done */
+#define METRICS_H_DH_GENERATE		1
+#define METRICS_H_DH_COMPUTE		2
+#define METRICS_H_SIGN				3
+#define METRICS_H_VERIFY			4
+#define METRICS_H_PH1				5	/* phase 1 start to established */
+#define METRICS_H_PH2				6	/* phase 2 start to established */
+#define METRICS_H_PFKEY				7	/* PF_KEY round trip, per SADB type */
+
+#define METRICS_SUBBITS		3
+#define METRICS_SUB			(1 << METRICS_SUBBITS)
+#define METRICS_MAXBITS		40
+#define METRICS_BUCKETS		((METRICS_MAXBITS - METRICS_SUBBITS + 1) * METRICS_SUB)
+
+struct metrics_hist {
+	u_int64_t count;
+	u_int64_t sum;			/* ns */
+	u_int64_t max;			/* ns */
+	u_int64_t buckets[METRICS_BUCKETS];
+};
+
+extern u_int64_t metrics_counters[METRICS_C_MAX];
+
+extern void metrics_init (void);
+extern u_int64_t metrics_now (void);
+extern void metrics_hist_add (struct metrics_hist *, u_int64_t);
+extern u_int64_t metrics_hist_percentile (const struct metrics_hist *,
+	double);
+extern void metrics_record (int, u_int64_t);
+extern void metrics_pfkey_recv (u_int8_t, u_int32_t);
+extern vchar_t *metrics_export (void);
+extern void metrics_dump (void);
+
+#define METRICS_INC(c) \
+	__atomic_fetch_add(&metrics_counters[(c)], 1, __ATOMIC_RELAXED)
+
+#endif /* _METRICS_H */
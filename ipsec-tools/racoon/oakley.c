@@ -36,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/socket.h>	/* XXX for subjectaltname */
+#include <sys/uio.h>
 #include <netinet/in.h>	/* XXX for subjectaltname */
 
 #ifdef HAVE_OPENSSL
@@ -81,6 +82,9 @@
 #include "ipsec_doi.h"
 #include "algorithm.h"
 #include "dhgroup.h"
+#include "metrics.h"
+#include "pkttrace.h"
+#include "certcache.h"
 #include "sainfo.h"
 #include "proposal.h"
 #include "crypto_openssl.h"
@@ -100,6 +104,7 @@
 #endif
 #include "vpn_control_var.h"
 #include "extern.h"
+#include <notify.h>
 
 #define OUTBOUND_SA	0
 #define INBOUND_SA	1
@@ -107,6 +112,9 @@
 #define CERT_CHECKID_FROM_PEER 		0
 #define CERT_CHECKID_FROM_RMCONFIG	1
 
+/* posted by the security daemon whenever a keychain item changes */
+#define KEYCHAIN_CHANGED_NOTIFICATION	"com.apple.security.keychainchanged"
+
 #ifdef HAVE_OPENSSL
 #define INITDHVAL(a, s, d, t)                                                  \
 do {                                                                           \
@@ -147,6 +155,10 @@ struct dhgroup dh_modp8192;
 static int oakley_check_dh_pub (vchar_t *, vchar_t **);
 static int oakley_compute_keymat_x (phase2_handle_t *, int, int);
 static int get_cert_fromlocal (phase1_handle_t *, int);
+static cert_t *oakley_mycert_get (struct remoteconf *);
+static void oakley_mycert_set (struct remoteconf *, cert_t *);
+static void oakley_mycert_flush (struct remoteconf *);
+static void oakley_mycert_checkdates (void *);
 static int oakley_check_certid (phase1_handle_t *iph1);
 static int oakley_check_certid_1 (vchar_t *, int, int, void*, cert_status_t *certStatus);
 #ifdef HAVE_OPENSSL
@@ -244,6 +256,7 @@ oakley_check_dh_pub(vchar_t *prime, vchar_t **pub0)
 int
 oakley_dh_compute(const struct dhgroup *dh, vchar_t *pub, vchar_t *priv, vchar_t *pub_p, vchar_t **gxy)
 {
+	u_int64_t started = metrics_now();
 #ifdef ENABLE_STATS
 	struct timeval start, end;
 #endif
@@ -281,6 +294,7 @@ oakley_dh_compute(const struct dhgroup *dh, vchar_t *pub, vchar_t *priv, vchar_t
 		s_attr_isakmp_group(dh->type), dh->prime->l << 3,
 		timedelta(&start, &end));
 #endif
+	metrics_record(METRICS_H_DH_COMPUTE, started);
 
 	plog(ASL_LEVEL_DEBUG, "compute DH's shared.\n");
 
@@ -294,6 +308,7 @@ oakley_dh_compute(const struct dhgroup *dh, vchar_t *pub_p, size_t publicKeySize
 	vchar_t *computed_key = NULL;
 	size_t	computed_keylen;
 	size_t	maxKeyLen;
+	u_int64_t started = metrics_now();
 	
 #ifdef ENABLE_STATS
 	struct timeval start, end;
@@ -321,6 +336,7 @@ oakley_dh_compute(const struct dhgroup *dh, vchar_t *pub_p, size_t publicKeySize
 		   s_attr_isakmp_group(dh->type), dh->prime->l << 3,
 		   timedelta(&start, &end));
 #endif
+	metrics_record(METRICS_H_DH_COMPUTE, started);
 	
 	*gxy = vmalloc(maxKeyLen);
 	if (*gxy == NULL) {
@@ -357,6 +373,7 @@ fail:
 int
 oakley_dh_generate(const struct dhgroup *dh, vchar_t **pub, vchar_t **priv)
 {
+	u_int64_t started = metrics_now();
 #ifdef ENABLE_STATS
 	struct timeval start, end;
 	gettimeofday(&start, NULL);
@@ -387,6 +404,7 @@ oakley_dh_generate(const struct dhgroup *dh, vchar_t **pub, vchar_t **priv)
 		s_attr_isakmp_group(dh->type), dh->prime->l << 3,
 		timedelta(&start, &end));
 #endif
+	metrics_record(METRICS_H_DH_GENERATE, started);
 
 	if (oakley_check_dh_pub(dh->prime, pub) != 0)
 		return -1;
@@ -402,6 +420,7 @@ oakley_dh_generate(const struct dhgroup *dh, vchar_t **pub, size_t *publicKeySiz
 {
 	vchar_t *public = NULL;
 	size_t maxKeyLen; 
+	u_int64_t started = metrics_now();
 	
 #ifdef ENABLE_STATS
 	struct timeval start, end;
@@ -457,6 +476,7 @@ oakley_dh_generate(const struct dhgroup *dh, vchar_t **pub, size_t *publicKeySiz
 		   timedelta(&start, &end));
 #endif
 	
+	metrics_record(METRICS_H_DH_GENERATE, started);
 	if (oakley_check_dh_pub(dh->prime, pub) != 0) {
 		plog(ASL_LEVEL_DEBUG, "failed DH public key size check.\n");
 		goto fail;
@@ -648,7 +668,7 @@ oakley_compute_keymat_x(phase2_handle_t *iph2, int side, int sa_dir)
 		+ sizeof(u_int32_t)	/* XXX SPI size */
 		+ iph2->nonce->l
 		+ iph2->nonce_p->l);
-	buf = vmalloc(len);
+	buf = varena_alloc(&iph2->arena, len);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			"failed to get keymat buffer.\n");
@@ -723,8 +743,8 @@ oakley_compute_keymat_x(phase2_handle_t *iph2, int side, int sa_dir)
 		//	"generating %zu bits of key (dupkeymat=%d)\n",
 		//	dupkeymat * 8 * res->l, dupkeymat);
 		if (0 < --dupkeymat) {
-			vchar_t *prev = res;	/* K(n-1) */
 			vchar_t *seed = NULL;	/* seed for Kn */
+			vchar_t *km = NULL;	/* K1 | K2 | ... */
 			size_t l;
 
 			/*
@@ -736,66 +756,55 @@ oakley_compute_keymat_x(phase2_handle_t *iph2, int side, int sa_dir)
 			 *   K2 = prf(SKEYID_d, K1 | src)
 			 *   K3 = prf(SKEYID_d, K2 | src)
 			 *   Kn = prf(SKEYID_d, K(n-1) | src)
+			 *
+			 * KEYMAT is put together in the arena and promoted
+			 * once complete, so no partial copy is left behind
+			 * by growing it on the heap.
 			 */
 			//plog(ASL_LEVEL_DEBUG,
 			//	"generating K1...K%d for KEYMAT.\n",
 			//	dupkeymat + 1);
 
-			seed = vmalloc(prev->l + buf->l);
-			if (seed == NULL) {
+			km = varena_alloc(&iph2->arena, res->l * (dupkeymat + 1));
+			seed = varena_alloc(&iph2->arena, res->l + buf->l);
+			if (km == NULL || seed == NULL) {
 				plog(ASL_LEVEL_ERR, 
 					"failed to get keymat buffer.\n");
-				if (prev && prev != res)
-					vfree(prev);
+				vwipe(km);
+				vwipe(seed);
 				goto end;
 			}
+			memcpy(km->v, res->v, res->l);
+			l = res->l;
 
 			while (dupkeymat--) {
 				vchar_t *this = NULL;	/* Kn */
-				int update_prev;
 
-				memcpy(seed->v, prev->v, prev->l);
-				memcpy(seed->v + prev->l, buf->v, buf->l);
+				/* K(n-1) is the last block written */
+				memcpy(seed->v, km->v + l - res->l, res->l);
+				memcpy(seed->v + res->l, buf->v, buf->l);
 				this = oakley_prf(iph2->ph1->skeyid_d, seed,
 							iph2->ph1);
-				if (!this) {
+				if (this == NULL || this->l != res->l) {
 					plog(ASL_LEVEL_ERR, 
 						"oakley_prf memory overflow\n");
-					if (prev && prev != res)
-						vfree(prev);
-					vfree(this);
-					vfree(seed);
-					goto end;
-				}
-
-				update_prev = (prev && prev == res) ? 1 : 0;
-
-				l = res->l;
-				res = vrealloc(res, l + this->l);
-
-				if (update_prev)
-					prev = res;
-
-				if (res == NULL) {
-					plog(ASL_LEVEL_ERR, 
-						"failed to get keymat buffer.\n");
-					if (prev && prev != res)
-						vfree(prev);
-					vfree(this);
-					vfree(seed);
+					vwipe(this);
+					vwipe(km);
+					vwipe(seed);
 					goto end;
 				}
-				memcpy(res->v + l, this->v, this->l);
-
-				if (prev && prev != res)
-					vfree(prev);
-				prev = this;
-				this = NULL;
+				memcpy(km->v + l, this->v, this->l);
+				l += this->l;
+				vwipe(this);
 			}
+			vwipe(seed);
 
-			if (prev && prev != res)
-				vfree(prev);
-			vfree(seed);
+			vwipe(res);
+			if ((res = vpromote(km)) == NULL) {
+				plog(ASL_LEVEL_ERR, 
+					"failed to get keymat buffer.\n");
+				goto end;
+			}
 		}
 
 		//plogdump(ASL_LEVEL_DEBUG, res->v, res->l, "");
@@ -823,10 +832,9 @@ end:
 		}
 	}
 
-	if (buf != NULL)
-		vfree(buf);
-	if (res)
-		vfree(res);
+	/* src carries g(qm)^xy with PFS */
+	vwipe(buf);
+	vwipe(res);
 
 	return error;
 }
@@ -845,7 +853,7 @@ oakley_compute_hash3(phase1_handle_t *iph1, u_int32_t msgid, vchar_t *body)
 
 	/* create buffer */
 	len = 1 + sizeof(u_int32_t) + body->l;
-	buf = vmalloc(len);
+	buf = varena_alloc(&iph1->arena, len);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_NOTICE,
 			"failed to get hash buffer\n");
@@ -893,7 +901,7 @@ oakley_compute_hash1(phase1_handle_t *iph1, u_int32_t msgid, vchar_t *body)
 
 	/* create buffer */
 	len = sizeof(u_int32_t) + body->l;
-	buf = vmalloc(len);
+	buf = varena_alloc(&iph1->arena, len);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_NOTICE,
 			"failed to get hash buffer\n");
@@ -944,7 +952,7 @@ oakley_ph1hash_common(phase1_handle_t *iph1, int sw)
 		+ iph1->sa->l
 		+ (sw == GENERATE ? iph1->id->l : iph1->id_p->l);
 
-	buf = vmalloc(len);
+	buf = varena_alloc(&iph1->arena, len);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			"failed to get hash buffer\n");
@@ -1054,7 +1062,7 @@ oakley_ph1hash_base_i(phase1_handle_t *iph1, int sw)
 #endif
 		/* make hash for seed */
 		len = iph1->nonce->l + iph1->nonce_p->l;
-		buf = vmalloc(len);
+		buf = varena_alloc(&iph1->arena, len);
 		if (buf == NULL) {
 			plog(ASL_LEVEL_ERR, 
 				"failed to get hash buffer\n");
@@ -1091,7 +1099,7 @@ oakley_ph1hash_base_i(phase1_handle_t *iph1, int sw)
 		+ sizeof(cookie_t) * 2
 		+ iph1->sa->l
 		+ (sw == GENERATE ? iph1->id->l : iph1->id_p->l);
-	buf = vmalloc(len);
+	buf = varena_alloc(&iph1->arena, len);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			"failed to get hash buffer\n");
@@ -1175,7 +1183,7 @@ oakley_ph1hash_base_r(phase1_handle_t *iph1, int sw)
 
 	/* make hash for seed */
 	len = iph1->nonce->l + iph1->nonce_p->l;
-	buf = vmalloc(len);
+	buf = varena_alloc(&iph1->arena, len);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			"failed to get hash buffer\n");
@@ -1203,7 +1211,7 @@ oakley_ph1hash_base_r(phase1_handle_t *iph1, int sw)
 		+ sizeof(cookie_t) * 2
 		+ iph1->sa->l
 		+ (sw == GENERATE ? iph1->id_p->l : iph1->id->l);
-	buf = vmalloc(len);
+	buf = varena_alloc(&iph1->arena, len);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			"failed to get hash buffer\n");
@@ -1422,6 +1430,8 @@ oakley_validate_auth(phase1_handle_t *iph1)
 	    {
 		int error = 0;
 		int certtype = 0;
+		u_int8_t cachekey[CERTCACHE_KEYLEN];
+		int keyed = 0, cached = 0;
 
 		/* validation */
 		if (iph1->id_p == NULL) {
@@ -1453,8 +1463,28 @@ oakley_validate_auth(phase1_handle_t *iph1)
 			return ISAKMP_INTERNAL_ERROR;
 		}
 
-		/* compare ID payload and certificate name */
+		certtype = iph1->rmconf->certtype;
+#ifdef ENABLE_HYBRID
+		switch (AUTHMETHOD(iph1)) {
+		case OAKLEY_ATTR_AUTH_METHOD_HYBRID_RSA_I:
+			certtype = iph1->cert_p->type;
+			break;
+		default:
+			break;
+		}
+#endif
+
+		/* a chain validated before needs neither check below again */
 		if (iph1->rmconf->verify_cert &&
+		    certtype == ISAKMP_CERT_X509SIGN &&
+		    certcache_key(iph1, certtype, cachekey) == 0) {
+			keyed = 1;
+			publicKeyRef = certcache_lookup(cachekey);
+			cached = publicKeyRef != NULL;
+		}
+
+		/* compare ID payload and certificate name */
+		if (iph1->rmconf->verify_cert && !cached &&
 		    (error = oakley_check_certid(iph1)) != 0)
 			return error;
 
@@ -1462,24 +1492,16 @@ oakley_validate_auth(phase1_handle_t *iph1)
 		/* check cert common name against Open Directory authentication group */
 		if (iph1->rmconf->cert_verification_option == VERIFICATION_OPTION_OPEN_DIR) {
 			if (oakley_verify_userid(iph1)) {
+				if (publicKeyRef)
+					CFRelease(publicKeyRef);
 				return ISAKMP_NTYPE_AUTHENTICATION_FAILED;
 			}
 		}
 #endif /* HAVE_OPENDIR */
 
 		/* verify certificate */
-		if (iph1->rmconf->verify_cert
+		if (iph1->rmconf->verify_cert && !cached
 		 && iph1->rmconf->getcert_method == ISAKMP_GETCERT_PAYLOAD) {
-			certtype = iph1->rmconf->certtype;
-#ifdef ENABLE_HYBRID
-			switch (AUTHMETHOD(iph1)) {
-			case OAKLEY_ATTR_AUTH_METHOD_HYBRID_RSA_I:
-				certtype = iph1->cert_p->type;
-				break;
-			default:
-				break;
-			}
-#endif
 			switch (certtype) {
 			case ISAKMP_CERT_X509SIGN:
 			{
@@ -1528,6 +1550,8 @@ oakley_validate_auth(phase1_handle_t *iph1)
 					"the peer's certificate is not verified.\n");
 				return ISAKMP_NTYPE_INVALID_CERT_AUTHORITY;
 			}
+			if (keyed)
+				certcache_insert(cachekey, iph1->cert_p, publicKeyRef);
 		}
 
 		plog(ASL_LEVEL_DEBUG, "CERT validated\n");
@@ -1554,17 +1578,6 @@ oakley_validate_auth(phase1_handle_t *iph1)
 		if (my_hash == NULL)
 			return ISAKMP_INTERNAL_ERROR;
 
-
-		certtype = iph1->rmconf->certtype;
-#ifdef ENABLE_HYBRID
-		switch (AUTHMETHOD(iph1)) {
-		case OAKLEY_ATTR_AUTH_METHOD_HYBRID_RSA_I:
-			certtype = iph1->cert_p->type;
-			break;
-		default:
-			break;
-		}
-#endif
 		/* check signature */
 		switch (certtype) {
 			case ISAKMP_CERT_X509SIGN:
@@ -1572,7 +1585,10 @@ oakley_validate_auth(phase1_handle_t *iph1)
 					plog(ASL_LEVEL_ERR, "@@@@@@ publicKeyRef is NULL\n");
 				}
 				if (iph1->version == ISAKMP_VERSION_NUMBER_IKEV1) {
+					u_int64_t started = metrics_now();
+
 					error = crypto_cssm_verify_x509sign(publicKeyRef, my_hash, iph1->sig_p, FALSE);
+					metrics_record(METRICS_H_VERIFY, started);
 				}
 				if (error) {
 					plog(ASL_LEVEL_ERR, "error verifying signature %s\n", GetSecurityErrorString(error));
@@ -1732,6 +1748,11 @@ get_cert_fromlocal(phase1_handle_t *iph1, int my)
 		return 0;
 	}
 
+	if (my && (*certpl = oakley_mycert_get(iph1->rmconf)) != NULL) {
+		plog(ASL_LEVEL_DEBUG, "using the cached CERT payload\n");
+		return 0;
+	}
+
 	switch (iph1->rmconf->certtype) {
 	case ISAKMP_CERT_X509SIGN:
 		if (iph1->rmconf->identity_in_keychain) {
@@ -1780,6 +1801,8 @@ get_cert_fromlocal(phase1_handle_t *iph1, int my)
 	(*certpl)->cert.l = (*certpl)->pl->l - 1;
 
 	plog(ASL_LEVEL_DEBUG, "created CERT payload\n");
+	if (my)
+		oakley_mycert_set(iph1->rmconf, *certpl);
 		
 	error = 0;
 
@@ -1790,6 +1813,116 @@ end:
 	return error;
 }
 
+/*
+ * My CERT payload is built from the keychain once per remoteconf and
+ * shared, by reference count, by all the phase 1s using it.  It is
+ * dropped when the keychain changes, and its expiry status is kept
+ * current by a timer set to the next notBefore/notAfter rather than
+ * being checked on every handshake.
+ */
+static int keychain_generation;
+static int keychain_notify_token = NOTIFY_TOKEN_INVALID;
+
+static int
+oakley_watch_keychain(void)
+{
+	if (keychain_notify_token != NOTIFY_TOKEN_INVALID)
+		return 0;
+	if (notify_register_dispatch(KEYCHAIN_CHANGED_NOTIFICATION,
+	    &keychain_notify_token, dispatch_get_main_queue(),
+	    ^(int token) {
+		keychain_generation++;
+	    }) != NOTIFY_STATUS_OK) {
+		plog(ASL_LEVEL_WARNING,
+			"failed to watch the keychain, CERT payloads will not be cached.\n");
+		keychain_notify_token = NOTIFY_TOKEN_INVALID;
+		return -1;
+	}
+	return 0;
+}
+
+static cert_t *
+oakley_mycert_get(struct remoteconf *rmconf)
+{
+	if (rmconf->mycert == NULL)
+		return NULL;
+	if (rmconf->mycert_gen != keychain_generation) {
+		plog(ASL_LEVEL_DEBUG, "keychain changed, rebuilding CERT payload\n");
+		oakley_mycert_flush(rmconf);
+		return NULL;
+	}
+	rmconf->mycert->refcnt++;
+	return rmconf->mycert;
+}
+
+static void
+oakley_mycert_schedule(struct remoteconf *rmconf)
+{
+#ifndef HAVE_OPENSSL
+	SecCertificateRef certRef;
+	CFAbsoluteTime when = 0, now;
+
+	certRef = crypto_cssm_x509cert_CreateSecCertificateRef(&rmconf->mycert->cert);
+	if (certRef == NULL)
+		return;
+	rmconf->mycert->status = crypto_cssm_check_x509cert_dates(certRef);
+	switch (rmconf->mycert->status) {
+	case CERT_STATUS_PREMATURE:
+		when = SecCertificateNotValidBefore(certRef);
+		break;
+	case CERT_STATUS_OK:
+		when = SecCertificateNotValidAfter(certRef);
+		break;
+	default:
+		break;
+	}
+	CFRelease(certRef);
+
+	now = CFAbsoluteTimeGetCurrent();
+	if (when > now)
+		rmconf->mycert_sc = sched_new((time_t)(when - now) + 1,
+		    oakley_mycert_checkdates, rmconf);
+#endif /* HAVE_OPENSSL */
+}
+
+static void
+oakley_mycert_checkdates(void *arg)
+{
+	struct remoteconf *rmconf = (struct remoteconf *)arg;
+
+	rmconf->mycert_sc = 0;
+	if (rmconf->mycert != NULL)
+		oakley_mycert_schedule(rmconf);
+}
+
+static void
+oakley_mycert_set(struct remoteconf *rmconf, cert_t *cert)
+{
+	if (oakley_watch_keychain() != 0)
+		return;
+	oakley_mycert_flush(rmconf);
+	cert->refcnt++;
+	rmconf->mycert = cert;
+	rmconf->mycert_gen = keychain_generation;
+	oakley_mycert_schedule(rmconf);
+}
+
+static void
+oakley_mycert_flush(struct remoteconf *rmconf)
+{
+	SCHED_KILL(rmconf->mycert_sc);
+	oakley_delcert(rmconf->mycert);
+	rmconf->mycert = NULL;
+}
+
+/* release the payloads cached in a remoteconf going away */
+void
+oakley_flushrmconf(struct remoteconf *rmconf)
+{
+	oakley_mycert_flush(rmconf);
+	VPTRINIT(rmconf->mycr);
+}
+
 
 /* get signature */
 int
@@ -1803,10 +1936,13 @@ oakley_getsign(phase1_handle_t *iph1)
 		// cert in keychain - use cssm to sign
 		if (iph1->rmconf->identity_in_keychain) {
 			CFDataRef dataRef;
+			u_int64_t started;
 			
 			if (iph1->rmconf->keychainCertRef == NULL || base64toCFData(iph1->rmconf->keychainCertRef, &dataRef))
 				goto end;
+			started = metrics_now();
 			iph1->sig = crypto_cssm_getsign(dataRef, iph1->hash);
+			metrics_record(METRICS_H_SIGN, started);
 			CFRelease(dataRef);
 			break;
 		} // else fall thru
@@ -2495,12 +2631,17 @@ save_certbuf(struct isakmp_gen *gen)
  * moment. Becuase any certificate authority are accepted without any check.
  * The section 3.10 in RFC2408 says that this field SHOULD not be included,
  * if there is no specific certificate authority requested.
+ * The payload is built once and belongs to the remoteconf; the caller must
+ * not free it.
  */
 vchar_t *
 oakley_getcr(phase1_handle_t *iph1)
 {
 	vchar_t *buf;
 
+	if (iph1->rmconf->mycr != NULL)
+		return iph1->rmconf->mycr;
+
 	buf = vmalloc(1);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_ERR, 
@@ -2519,6 +2660,7 @@ oakley_getcr(phase1_handle_t *iph1)
 	//if (buf->l > 1)
 	//	plogdump(ASL_LEVEL_DEBUG, buf->v, buf->l, "");
 
+	iph1->rmconf->mycr = buf;
 	return buf;
 }
 
@@ -2657,7 +2799,7 @@ oakley_skeyid(phase1_handle_t *iph1)
             plogdump(ASL_LEVEL_DEBUG, key->v, key->l, "psk: ");
             
             len = iph1->nonce->l + iph1->nonce_p->l;
-            buf = vmalloc(len);
+            buf = varena_alloc(&iph1->arena, len);
             if (buf == NULL) {
                 plog(ASL_LEVEL_ERR,
                      "failed to get skeyid buffer\n");
@@ -2689,7 +2831,7 @@ oakley_skeyid(phase1_handle_t *iph1)
         case OAKLEY_ATTR_AUTH_METHOD_XAUTH_RSASIG_R:
 #endif
             len = iph1->nonce->l + iph1->nonce_p->l;
-            buf = vmalloc(len);
+            buf = varena_alloc(&iph1->arena, len);
             if (buf == NULL) {
                 plog(ASL_LEVEL_ERR,
                      "failed to get nonce buffer\n");
@@ -2735,10 +2877,9 @@ oakley_skeyid(phase1_handle_t *iph1)
 	error = 0;
     
 end:
-    if (key != NULL)
-        vfree(key);
-	if (buf != NULL)
-		vfree(buf);
+	/* the pre-shared key and the prf input */
+	vwipe(key);
+	vwipe(buf);
 	return error;
 }
 
@@ -2767,7 +2908,7 @@ oakley_skeyid_dae(phase1_handle_t *iph1)
 	/* SKEYID D */
 	/* SKEYID_d = prf(SKEYID, g^xy | CKY-I | CKY-R | 0) */
 	len = iph1->dhgxy->l + sizeof(cookie_t) * 2 + 1;
-	buf = vmalloc(len);
+	buf = varena_alloc(&iph1->arena, len);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			"failed to get skeyid buffer\n");
@@ -2786,7 +2927,7 @@ oakley_skeyid_dae(phase1_handle_t *iph1)
 	if (iph1->skeyid_d == NULL)
 		goto end;
 
-	vfree(buf);
+	vwipe(buf);
 	buf = NULL;
 
 	//plogdump(ASL_LEVEL_DEBUG, iph1->skeyid_d->v, iph1->skeyid_d->l, "SKEYID_d computed:\n");
@@ -2794,7 +2935,7 @@ oakley_skeyid_dae(phase1_handle_t *iph1)
 	/* SKEYID A */
 	/* SKEYID_a = prf(SKEYID, SKEYID_d | g^xy | CKY-I | CKY-R | 1) */
 	len = iph1->skeyid_d->l + iph1->dhgxy->l + sizeof(cookie_t) * 2 + 1;
-	buf = vmalloc(len);
+	buf = varena_alloc(&iph1->arena, len);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			"failed to get skeyid buffer\n");
@@ -2814,7 +2955,7 @@ oakley_skeyid_dae(phase1_handle_t *iph1)
 	if (iph1->skeyid_a == NULL)
 		goto end;
 
-	vfree(buf);
+	vwipe(buf);
 	buf = NULL;
 
 	//plogdump(ASL_LEVEL_DEBUG, iph1->skeyid_a->v, iph1->skeyid_a->l, "SKEYID_a computed:\n");
@@ -2822,7 +2963,7 @@ oakley_skeyid_dae(phase1_handle_t *iph1)
 	/* SKEYID E */
 	/* SKEYID_e = prf(SKEYID, SKEYID_a | g^xy | CKY-I | CKY-R | 2) */
 	len = iph1->skeyid_a->l + iph1->dhgxy->l + sizeof(cookie_t) * 2 + 1;
-	buf = vmalloc(len);
+	buf = varena_alloc(&iph1->arena, len);
 	if (buf == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			"failed to get skeyid buffer\n");
@@ -2842,7 +2983,7 @@ oakley_skeyid_dae(phase1_handle_t *iph1)
 	if (iph1->skeyid_e == NULL)
 		goto end;
 
-	vfree(buf);
+	vwipe(buf);
 	buf = NULL;
 
 	//plogdump(ASL_LEVEL_DEBUG, iph1->skeyid_e->v, iph1->skeyid_e->l, "SKEYID_e computed:\n");
@@ -2850,8 +2991,8 @@ oakley_skeyid_dae(phase1_handle_t *iph1)
 	error = 0;
 
 end:
-	if (buf != NULL)
-		vfree(buf);
+	/* every input carries g^xy */
+	vwipe(buf);
 	return error;
 }
 
@@ -2876,7 +3017,8 @@ oakley_compute_enckey(phase1_handle_t *iph1)
 			iph1->approval->encklen);
 		goto end;
 	}
-	iph1->key = vmalloc(keylen >> 3);
+	/* built in the arena, promoted once complete */
+	iph1->key = varena_alloc(&iph1->arena, keylen >> 3);
 	if (iph1->key == NULL) {
 		plog(ASL_LEVEL_ERR, 
 			"failed to get key buffer\n");
@@ -2917,7 +3059,7 @@ oakley_compute_enckey(phase1_handle_t *iph1)
 			"generating long key (Ka = K1 | K2 | ...)\n",
 			iph1->skeyid_e->l, iph1->key->l);
 
-		if ((buf = vmalloc(prflen >> 3)) == 0) {
+		if ((buf = varena_alloc(&iph1->arena, prflen >> 3)) == 0) {
 			plog(ASL_LEVEL_ERR, 
 				"failed to get key buffer\n");
 			goto end;
@@ -2934,7 +3076,7 @@ oakley_compute_enckey(phase1_handle_t *iph1)
 			}
 			res = oakley_prf(iph1->skeyid_e, buf, iph1);
 			if (res == NULL) {
-				vfree(buf);
+				vwipe(buf);
 				goto end;
 			}
 			plog(ASL_LEVEL_DEBUG, 
@@ -2952,16 +3094,16 @@ oakley_compute_enckey(phase1_handle_t *iph1)
 				plog(ASL_LEVEL_ERR, 
 					"internal error: res->l=%zu buf->l=%zu\n",
 					res->l, buf->l);
-				vfree(res);
-				vfree(buf);
+				vwipe(res);
+				vwipe(buf);
 				goto end;
 			}
 			memcpy(buf->v, res->v, res->l);
-			vfree(res);
+			vwipe(res);
 			subkey++;
 		}
 
-		vfree(buf);
+		vwipe(buf);
 	}
 
 	/*
@@ -2972,9 +3114,19 @@ oakley_compute_enckey(phase1_handle_t *iph1)
 
 	//plogdump(ASL_LEVEL_DEBUG, iph1->key->v, iph1->key->l, "final encryption key computed:\n");
 
+	if ((iph1->key = vpromote(iph1->key)) == NULL) {
+		plog(ASL_LEVEL_ERR, 
+			"failed to get key buffer\n");
+		goto end;
+	}
+
 	error = 0;
 
 end:
+	if (error && iph1->key != NULL && iph1->key->arena != NULL) {
+		vwipe(iph1->key);
+		iph1->key = NULL;
+	}
 	return error;
 }
 
@@ -2993,6 +3145,7 @@ oakley_newcert(void)
 
 	new->pl = NULL;
 	new->chain = NULL;
+	new->refcnt = 1;
 
 	return new;
 }
@@ -3016,6 +3169,8 @@ oakley_delcert(cert_t *cert)
 
 	if (!cert)
 		return;
+	if (--cert->refcnt > 0)
+		return;		/* still shared */
 
 	for (p = cert; p;) {
 		to_delete = p;
@@ -3310,6 +3465,7 @@ oakley_do_ikev1_decrypt(phase1_handle_t *iph1, vchar_t *msg, vchar_t *ivdp, vcha
 	((struct isakmp *)buf->v)->len = htonl(buf->l);
 
 	plog(ASL_LEVEL_DEBUG, "decrypted.\n");
+	PKTTRACE(PKTTRACE_DECRYPTED, buf->v, buf->l, iph1->remote, iph1->local);
 
 #ifdef HAVE_PRINT_ISAKMP_C
 	isakmp_printpacket(buf, iph1->remote, iph1->local, 1);
@@ -3345,12 +3501,14 @@ oakley_do_decrypt(phase1_handle_t *iph1, vchar_t *msg, vchar_t *ivdp, vchar_t *i
 /*
  * encrypt packet.
  */
-vchar_t *
-oakley_do_ikev1_encrypt(phase1_handle_t *iph1, vchar_t *msg, vchar_t *ivep, vchar_t *ivp)
+static vchar_t *
+oakley_do_ikev1_encryptv(phase1_handle_t *iph1, struct isakmp *hdr,
+    const struct iovec *iov, int iovcnt, vchar_t *ivep, vchar_t *ivp)
 {
 	vchar_t *buf = 0, *new = 0;
-	char *pl;
+	char *p;
 	int len;
+	int i;
 	u_int padlen;
 	int blen;
 	int error = -1;
@@ -3366,8 +3524,9 @@ oakley_do_ikev1_encrypt(phase1_handle_t *iph1, vchar_t *msg, vchar_t *ivep, vcha
 		goto end;
 	}
 
-	pl = msg->v + sizeof(struct isakmp);
-	len = msg->l - sizeof(struct isakmp);
+	len = 0;
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
 
 	/* add padding */
 	padlen = oakley_padlen(len, blen);
@@ -3388,7 +3547,12 @@ oakley_do_ikev1_encrypt(phase1_handle_t *iph1, vchar_t *msg, vchar_t *ivep, vcha
 				*p++ = eay_random() & 0xff;
 		}
         }
-        memcpy(buf->v, pl, len);
+	/* gather the payloads straight into the plaintext buffer */
+	p = buf->v;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(p, iov[i].iov_base, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
 
 	/* make pad into tail */
 	if (lcconf->pad_excltail)
@@ -3429,7 +3593,7 @@ oakley_do_ikev1_encrypt(phase1_handle_t *iph1, vchar_t *msg, vchar_t *ivep, vcha
 			"Failed to get buffer to encrypt.\n");
 		goto end;
 	}
-	memcpy(buf->v, msg->v, sizeof(struct isakmp));
+	memcpy(buf->v, hdr, sizeof(struct isakmp));
 	memcpy(buf->v + sizeof(struct isakmp), new->v, new->l);
 	((struct isakmp *)buf->v)->len = htonl(buf->l);
 
@@ -3453,9 +3617,26 @@ end:
  */
 vchar_t *
 oakley_do_encrypt(phase1_handle_t *iph1, vchar_t *msg, vchar_t *ivep, vchar_t *ivp)
+{
+	struct iovec iov;
+
+	iov.iov_base = msg->v + sizeof(struct isakmp);
+	iov.iov_len = msg->l - sizeof(struct isakmp);
+
+	return oakley_do_encryptv(iph1, (struct isakmp *)msg->v, &iov, 1,
+	    ivep, ivp);
+}
+
+/*
+ * encrypt packet, gathering the payloads from a list of segments.
+ * hdr is copied in front of the cipher text.
+ */
+vchar_t *
+oakley_do_encryptv(phase1_handle_t *iph1, struct isakmp *hdr,
+    const struct iovec *iov, int iovcnt, vchar_t *ivep, vchar_t *ivp)
 {
 	if (iph1->version == ISAKMP_VERSION_NUMBER_IKEV1) {
-		return(oakley_do_ikev1_encrypt(iph1, msg, ivep, ivp));		
+		return(oakley_do_ikev1_encryptv(iph1, hdr, iov, iovcnt, ivep, ivp));
 	}
 
 	plog(ASL_LEVEL_ERR, "Failed to encrypt invalid IKE version");
@@ -201,6 +201,7 @@ typedef struct cert_t_tag {
 	vchar_t *pl;		/* CERT payload minus isakmp general header */
 	cert_status_t status;
 	struct cert_t_tag *chain;
+	int refcnt;		/* holders of the chain, counted at its head */
 } cert_t;
 
 struct isakmp_ivm;
@@ -239,6 +240,8 @@ extern cert_t * oakley_get_peer_cert_from_certchain (phase1_handle_t *);
 extern int oakley_find_status_in_certchain (cert_t *, cert_status_t);
 extern void oakley_verify_certid (phase1_handle_t *);
 extern vchar_t *oakley_getcr (phase1_handle_t *);
+struct remoteconf;
+extern void oakley_flushrmconf (struct remoteconf *);
 extern int oakley_checkcr (phase1_handle_t *);
 extern int oakley_needcr (int);
 struct isakmp_gen;
@@ -257,6 +260,10 @@ extern struct isakmp_ivm *oakley_newiv2 (phase1_handle_t *, u_int32_t);
 extern void oakley_delivm (struct isakmp_ivm *);
 extern vchar_t *oakley_do_decrypt (phase1_handle_t *, vchar_t *, vchar_t *, vchar_t *);
 extern vchar_t *oakley_do_encrypt (phase1_handle_t *, vchar_t *, vchar_t *, vchar_t *);
+struct isakmp;
+struct iovec;
+extern vchar_t *oakley_do_encryptv (phase1_handle_t *, struct isakmp *,
+	const struct iovec *, int, vchar_t *, vchar_t *);
 
 #ifdef ENABLE_HYBRID
 #define AUTHMETHOD(iph1)						     \
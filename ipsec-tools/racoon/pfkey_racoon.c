@@ -101,6 +101,9 @@
 #include "ipsecMessageTracer.h"
 #include "power_mgmt.h"
 #include "session.h"
+#include "metrics.h"
+#include "rekeysched.h"
+#include "shard.h"
 
 #if defined(SADB_X_EALG_RIJNDAELCBC) && !defined(SADB_X_EALG_AESCBC)
 #define SADB_X_EALG_AESCBC  SADB_X_EALG_RIJNDAELCBC
@@ -202,24 +205,40 @@ pfkey_process(msg)
 	//		 s_pfkey_type(msg->sadb_msg_type));
 
 	/* validity check */
-    /* check pfkey message. */
-	if (pfkey_align(msg, mhp)) {
-		plog(ASL_LEVEL_ERR,
-             "libipsec failed pfkey align (%s)\n",
-             ipsec_strerror());
-		goto end;
-	}
-	if (pfkey_check(mhp)) {
+    /* check pfkey message; pk_recv() has read all of it. */
+	if (pfkey_parse(msg, PFKEY_UNUNIT64(msg->sadb_msg_len), mhp)) {
 		plog(ASL_LEVEL_ERR,
              "libipsec failed pfkey check (%s)\n",
              ipsec_strerror());
 		goto end;
 	}
 	msg = ALIGNED_CAST(struct sadb_msg *)mhp[0];             // Wcast-align fix (void*) - mhp contains pointers to aligned structs in malloc'd msg buffer
+
+	/*
+	 * when sharded, the kernel broadcasts the other shards' answers to
+	 * us too; their sequence numbers could match one of ours.
+	 */
+	if (shard_count > 1 && msg->sadb_msg_pid != 0 &&
+	    msg->sadb_msg_pid != getpid()) {
+		switch (msg->sadb_msg_type) {
+		case SADB_GETSPI:
+		case SADB_UPDATE:
+		case SADB_ADD:
+		case SADB_GET:
+		case SADB_X_SPDDUMP:
+		case SADB_GETSASTAT:
+			goto end;
+		}
+	}
     
+	if (msg->sadb_msg_pid == getpid())
+		metrics_pfkey_recv(msg->sadb_msg_type, msg->sadb_msg_seq);
+
 	if (msg->sadb_msg_errno) {
 		int pri;
 
+		METRICS_INC(METRICS_C_PFKEY_ERRORS);
+
 		/* when SPD is empty, treat the state as no error. */
 		if (msg->sadb_msg_type == SADB_X_SPDDUMP &&
 		    msg->sadb_msg_errno == ENOENT)
@@ -1103,6 +1122,13 @@ pk_sendupdate(iph2)
 			"No approved SAs found.\n");
 	}
 
+	/*
+	 * Spread the soft lifetime, and with it our rekey, by the configured
+	 * jitter.  pk_sendadd always follows for the same phase 2 and keeps
+	 * this rate, so both directions expire together.
+	 */
+	(void)pfkey_set_softrate(SADB_X_LIFETIME_ADDTIME, rekeysched_softrate());
+
 	if (iph2->side == INITIATOR)
 		proxy = iph2->ph1->rmconf->support_proxy;
 	else if (iph2->sainfo && iph2->sainfo->id_i)
@@ -1363,6 +1389,15 @@ pk_recvupdate(mhp)
 	}
 
 	ike_session_ph2_established(iph2);
+	metrics_record(METRICS_H_PH2, iph2->started);
+	METRICS_INC(METRICS_C_PH2_ESTABLISHED);
+
+	plog(ASL_LEVEL_DEBUG,
+		 "phase 2 used %u arena buffer(s) in %u chunk(s), peak %zu bytes "
+		 "(%llu heap buffers allocated so far).\n",
+		 iph2->arena.nallocs, iph2->arena.nchunks, iph2->arena.peak,
+		 (unsigned long long)vmbuf_stats.heap_allocs);
+	varena_release(&iph2->arena);
 
 	IPSECLOGASLMSG("IPSec Phase 2 established (Initiated by %s).\n",
 				   (iph2->side == INITIATOR)? "me" : "peer");
@@ -1632,6 +1667,39 @@ pk_recvadd(mhp)
 	return 0;
 }
 
+static int
+pk_rekeyph2(phase2_handle_t *iph2)
+{
+	ike_session_initph2(iph2);
+
+	/* start isakmp initiation by using ident exchange */
+	if (isakmp_post_acquire(iph2) < 0) {
+		plog(ASL_LEVEL_ERR,
+			"failed to begin ipsec sa "
+			"re-negotiation.\n");
+		ike_session_unlink_phase2(iph2);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * A rekey the rekey budget held back: things may have moved on since
+ * the SA expired.
+ */
+static void
+pk_rekeyph2_deferred(phase2_handle_t *iph2)
+{
+	if (iph2->is_dying)
+		return;
+	if (ike_session_has_other_established_ph2(iph2->parent_session, iph2) ||
+		ike_session_drop_rekey(iph2->parent_session, IKE_SESSION_REKEY_TYPE_PH2)) {
+		ike_session_unlink_phase2(iph2);
+		return;
+	}
+	(void)pk_rekeyph2(iph2);
+}
+
 static int
 pk_recvexpire(mhp)
 	caddr_t *mhp;
@@ -1641,6 +1709,7 @@ pk_recvexpire(mhp)
 	struct sockaddr_storage *src, *dst;
 	phase2_handle_t *iph2;
 	u_int proto_id, sa_mode;
+	time_t expiry;
 
 	/* sanity check */
 	if (mhp[0] == NULL
@@ -1706,6 +1775,10 @@ pk_recvexpire(mhp)
 		return 0;
 	}
 
+	/* the hard expiry orders rekeys held back by the rekey budget */
+	if (!sched_get_time(iph2->sce, &expiry))
+		expiry = 0;
+
 	/* turn off the timer for calling isakmp_ph2expire() */ 
 	SCHED_KILL(iph2->sce);
 	
@@ -1717,19 +1790,9 @@ pk_recvexpire(mhp)
 		!ike_session_has_other_established_ph2(iph2->parent_session, iph2) &&
 		!ike_session_drop_rekey(iph2->parent_session, IKE_SESSION_REKEY_TYPE_PH2)) {
 
-		ike_session_initph2(iph2);
-
-		/* start isakmp initiation by using ident exchange */
-		if (isakmp_post_acquire(iph2) < 0) {
-			plog(ASL_LEVEL_ERR,
-				"failed to begin ipsec sa "
-				"re-negotiation.\n");
-			ike_session_unlink_phase2(iph2);
-			return -1;
-		}
-
-		return 0;
-		/*NOTREACHED*/
+		if (!rekeysched_admit_ph2(iph2, expiry, pk_rekeyph2_deferred))
+			return 0;
+		return pk_rekeyph2(iph2);
 	}
 
 
@@ -1771,6 +1834,10 @@ pk_recvacquire(mhp)
 	src = ALIGNED_CAST(struct sockaddr_storage *)PFKEY_ADDR_SADDR(mhp[SADB_EXT_ADDRESS_SRC]);
 	dst = ALIGNED_CAST(struct sockaddr_storage *)PFKEY_ADDR_SADDR(mhp[SADB_EXT_ADDRESS_DST]);
 
+	/* every shard gets it, the one owning the peer negotiates */
+	if (shard_of_addr(dst) != shard_index)
+		return 0;
+
 	/* ignore if type is not IPSEC_POLICY_IPSEC */
 	if (xpl->sadb_x_policy_type != IPSEC_POLICY_IPSEC) {
 		plog(ASL_LEVEL_DEBUG, 
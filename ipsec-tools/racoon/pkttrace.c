@@ -0,0 +1,634 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dispatch/dispatch.h>
+
+#include "var.h"
+#include "misc.h"
+#include "vmbuf.h"
+#include "plog.h"
+#include "debug.h"
+#include "schedule.h"
+#include "sockmisc.h"
+#include "gcmalloc.h"
+
+#include "isakmp_var.h"
+#include "isakmp.h"
+#include "pkttrace.h"
+
+/* pcap-ng block and option codes */
+#define PCAPNG_SHB				0x0A0D0D0A
+#define PCAPNG_IDB				0x00000001
+#define PCAPNG_EPB				0x00000006
+#define PCAPNG_BYTEORDER		0x1A2B3C4D
+#define PCAPNG_OPT_END			0
+#define PCAPNG_OPT_IF_NAME		2
+#define PCAPNG_OPT_EPB_FLAGS	2
+#define PCAPNG_OPT_SHB_USERAPPL	4
+#define PCAPNG_INBOUND			1
+#define PCAPNG_OUTBOUND			2
+#define PCAPNG_LINKTYPE_RAW		101		/* starts with the IP header */
+
+#define PKTTRACE_IF_WIRE		0
+#define PKTTRACE_IF_DECRYPTED	1
+
+#define PKTTRACE_PAD(n)	(((n) + 3) & ~(size_t)3)
+
+/* enhanced packet block without the data: head, flags option, tail */
+#define PKTTRACE_EPBLEN	(28 + 8 + 4 + 4)
+
+struct pkttrace_conf {
+	char *file;
+	u_int64_t maxsize;		/* 0 for no limit */
+	int decrypted;
+	int npeers;				/* 0 for every peer */
+	struct sockaddr_storage peers[PKTTRACE_MAXPEERS];
+};
+
+struct pkttrace_stats {
+	u_int64_t packets;
+	u_int64_t dropped;		/* writer behind, or no memory */
+	u_int64_t bytes;		/* handed to the writer or buffered */
+};
+
+int pkttrace_mask;
+
+static struct pkttrace_conf pkttrace_new;	/* filled by the parser */
+static struct pkttrace_conf pkttrace_conf;	/* in use */
+static struct pkttrace_stats pkttrace_stats;
+
+static dispatch_queue_t pkttrace_queue;
+static int pkttrace_fd = -1;
+static char *pkttrace_buf;
+static size_t pkttrace_len;
+static schedule_ref pkttrace_sc;
+
+/* shared with the writer queue */
+static int pkttrace_inflight;
+static int pkttrace_errno;
+
+static void pkttrace_close (int);
+static void pkttrace_tick (void *);
+
+/*
+ * the buffers are freed on the writer queue, so they come from plain
+ * malloc rather than racoon_malloc.
+ */
+static void
+pkttrace_write(int fd, char *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len > 0 && __atomic_load_n(&pkttrace_errno, __ATOMIC_RELAXED) == 0) {
+		n = write(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			__atomic_store_n(&pkttrace_errno, errno, __ATOMIC_RELAXED);
+			break;
+		}
+		p += n;
+		len -= n;
+	}
+	free(buf);
+	__atomic_fetch_sub(&pkttrace_inflight, 1, __ATOMIC_RELAXED);
+}
+
+static void
+pkttrace_handoff(char *buf, size_t len)
+{
+	int fd = pkttrace_fd;
+
+	__atomic_fetch_add(&pkttrace_inflight, 1, __ATOMIC_RELAXED);
+	dispatch_async(pkttrace_queue, ^{
+		pkttrace_write(fd, buf, len);
+	});
+}
+
+/* hand the buffer to the writer and start a new one */
+static int
+pkttrace_flush(void)
+{
+	char *next;
+
+	if (pkttrace_len == 0)
+		return 0;
+	if (__atomic_load_n(&pkttrace_inflight, __ATOMIC_RELAXED) >=
+	    PKTTRACE_MAXINFLIGHT)
+		return -1;
+	if ((next = malloc(PKTTRACE_BUFSIZ)) == NULL)
+		return -1;
+	pkttrace_handoff(pkttrace_buf, pkttrace_len);
+	pkttrace_buf = next;
+	pkttrace_len = 0;
+	return 0;
+}
+
+/* stop on the first write error the writer saw */
+static int
+pkttrace_failed(void)
+{
+	int error = __atomic_load_n(&pkttrace_errno, __ATOMIC_RELAXED);
+
+	if (error == 0)
+		return 0;
+	plog(ASL_LEVEL_ERR, "failed to write packet trace \"%s\": %s\n",
+		pkttrace_conf.file, strerror(error));
+	pkttrace_close(0);
+	return 1;
+}
+
+static void
+pkttrace_put(const void *p, size_t len)
+{
+	memcpy(pkttrace_buf + pkttrace_len, p, len);
+	pkttrace_len += len;
+}
+
+static void
+pkttrace_put16(u_int16_t v)
+{
+	pkttrace_put(&v, sizeof(v));
+}
+
+static void
+pkttrace_put32(u_int32_t v)
+{
+	pkttrace_put(&v, sizeof(v));
+}
+
+static void
+pkttrace_putpad(size_t len)
+{
+	static const char zero[4];
+
+	pkttrace_put(zero, PKTTRACE_PAD(len) - len);
+}
+
+static void
+pkttrace_putopt(u_int16_t code, const void *p, u_int16_t len)
+{
+	pkttrace_put16(code);
+	pkttrace_put16(len);
+	if (len != 0) {
+		pkttrace_put(p, len);
+		pkttrace_putpad(len);
+	}
+}
+
+/* block type and a length filled in by pkttrace_end() */
+static size_t
+pkttrace_begin(u_int32_t type)
+{
+	size_t start = pkttrace_len;
+
+	pkttrace_put32(type);
+	pkttrace_put32(0);
+	return start;
+}
+
+static void
+pkttrace_end(size_t start)
+{
+	u_int32_t len = (u_int32_t)(pkttrace_len - start + sizeof(len));
+
+	memcpy(pkttrace_buf + start + sizeof(len), &len, sizeof(len));
+	pkttrace_put32(len);
+	pkttrace_stats.bytes += len;
+}
+
+/* section header, then the two interfaces, both raw IP */
+static void
+pkttrace_header(void)
+{
+	static const char *ifnames[] = { "ike", "ike-decrypted" };
+	int64_t seclen = -1;	/* unknown */
+	size_t start;
+	int i;
+
+	start = pkttrace_begin(PCAPNG_SHB);
+	pkttrace_put32(PCAPNG_BYTEORDER);
+	pkttrace_put16(1);
+	pkttrace_put16(0);
+	pkttrace_put(&seclen, sizeof(seclen));
+	pkttrace_putopt(PCAPNG_OPT_SHB_USERAPPL, "racoon", strlen("racoon"));
+	pkttrace_putopt(PCAPNG_OPT_END, NULL, 0);
+	pkttrace_end(start);
+
+	for (i = 0; i < (int)ARRAYLEN(ifnames); i++) {
+		start = pkttrace_begin(PCAPNG_IDB);
+		pkttrace_put16(PCAPNG_LINKTYPE_RAW);
+		pkttrace_put16(0);
+		pkttrace_put32(0);		/* no snap length */
+		pkttrace_putopt(PCAPNG_OPT_IF_NAME, ifnames[i], strlen(ifnames[i]));
+		pkttrace_putopt(PCAPNG_OPT_END, NULL, 0);
+		pkttrace_end(start);
+	}
+}
+
+static u_int16_t
+pkttrace_cksum(const void *p, size_t len)
+{
+	const u_int8_t *b = p;
+	u_int32_t sum = 0;
+
+	for (; len > 1; len -= 2, b += 2)
+		sum += (b[0] << 8) | b[1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return htons(~sum & 0xffff);
+}
+
+/*
+ * make up the IP and UDP headers for a datagram of len bytes.  the UDP
+ * checksum is left out.  returns the header length, 0 if the addresses
+ * cannot be used.
+ */
+static size_t
+pkttrace_iphdr(u_int8_t *p, const struct sockaddr_storage *src,
+	const struct sockaddr_storage *dst, size_t len)
+{
+	struct udphdr uh;
+	size_t hlen;
+
+	if (src == NULL || dst == NULL || src->ss_family != dst->ss_family)
+		return 0;
+
+	switch (src->ss_family) {
+	case AF_INET:
+	    {
+		struct ip ip;
+
+		memset(&ip, 0, sizeof(ip));
+		ip.ip_v = IPVERSION;
+		ip.ip_hl = sizeof(ip) >> 2;
+		ip.ip_len = htons(MIN(sizeof(ip) + sizeof(uh) + len, IP_MAXPACKET));
+		ip.ip_ttl = IPDEFTTL;
+		ip.ip_p = IPPROTO_UDP;
+		ip.ip_src = ((const struct sockaddr_in *)src)->sin_addr;
+		ip.ip_dst = ((const struct sockaddr_in *)dst)->sin_addr;
+		ip.ip_sum = pkttrace_cksum(&ip, sizeof(ip));
+		memcpy(p, &ip, sizeof(ip));
+		hlen = sizeof(ip);
+		uh.uh_sport = ((const struct sockaddr_in *)src)->sin_port;
+		uh.uh_dport = ((const struct sockaddr_in *)dst)->sin_port;
+		break;
+	    }
+#ifdef INET6
+	case AF_INET6:
+	    {
+		struct ip6_hdr ip6;
+
+		memset(&ip6, 0, sizeof(ip6));
+		ip6.ip6_vfc = IPV6_VERSION;
+		ip6.ip6_plen = htons(MIN(sizeof(uh) + len, IP_MAXPACKET));
+		ip6.ip6_nxt = IPPROTO_UDP;
+		ip6.ip6_hlim = IPV6_DEFHLIM;
+		ip6.ip6_src = ((const struct sockaddr_in6 *)src)->sin6_addr;
+		ip6.ip6_dst = ((const struct sockaddr_in6 *)dst)->sin6_addr;
+		memcpy(p, &ip6, sizeof(ip6));
+		hlen = sizeof(ip6);
+		uh.uh_sport = ((const struct sockaddr_in6 *)src)->sin6_port;
+		uh.uh_dport = ((const struct sockaddr_in6 *)dst)->sin6_port;
+		break;
+	    }
+#endif
+	default:
+		return 0;
+	}
+
+	uh.uh_ulen = htons(MIN(sizeof(uh) + len, IP_MAXPACKET));
+	uh.uh_sum = 0;
+	memcpy(p + hlen, &uh, sizeof(uh));
+	return hlen + sizeof(uh);
+}
+
+static int
+pkttrace_match(const struct sockaddr_storage *remote)
+{
+	int i;
+
+	if (pkttrace_conf.npeers == 0)
+		return 1;
+	if (remote == NULL)
+		return 0;
+	for (i = 0; i < pkttrace_conf.npeers; i++)
+		if (cmpsaddrwop(&pkttrace_conf.peers[i], remote) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * append one datagram as an enhanced packet block.  runs on the main
+ * queue, like everything that sends or receives.
+ */
+void
+pkttrace_recordv(int dir, const struct iovec *iov, int iovcnt,
+	const struct sockaddr_storage *remote,
+	const struct sockaddr_storage *local)
+{
+	u_int8_t hdr[sizeof(struct ip6_hdr) + sizeof(struct udphdr)];
+	const struct sockaddr_storage *src, *dst;
+	size_t hlen, len, reclen, start, data;
+	struct timeval tv;
+	u_int64_t ts;
+	u_int32_t flags;
+	int i;
+
+	if (!pkttrace_match(remote))
+		return;
+
+	for (len = 0, i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (dir == PKTTRACE_OUT) {
+		src = local;
+		dst = remote;
+	} else {
+		src = remote;
+		dst = local;
+	}
+	if ((hlen = pkttrace_iphdr(hdr, src, dst, len)) == 0)
+		return;
+	reclen = PKTTRACE_EPBLEN + PKTTRACE_PAD(hlen + len);
+
+	if (pkttrace_conf.maxsize != 0 &&
+	    pkttrace_stats.bytes + reclen > pkttrace_conf.maxsize) {
+		plog(ASL_LEVEL_NOTICE,
+			"packet trace \"%s\" reached its max_size.\n",
+			pkttrace_conf.file);
+		pkttrace_close(0);
+		return;
+	}
+	if (pkttrace_len + reclen > PKTTRACE_BUFSIZ) {
+		if (pkttrace_failed())
+			return;
+		if (reclen > PKTTRACE_BUFSIZ || pkttrace_flush() != 0) {
+			pkttrace_stats.dropped++;
+			return;
+		}
+	}
+
+	gettimeofday(&tv, NULL);
+	ts = (u_int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+	start = pkttrace_begin(PCAPNG_EPB);
+	pkttrace_put32(dir == PKTTRACE_DECRYPTED ?
+		PKTTRACE_IF_DECRYPTED : PKTTRACE_IF_WIRE);
+	pkttrace_put32((u_int32_t)(ts >> 32));
+	pkttrace_put32((u_int32_t)ts);
+	pkttrace_put32((u_int32_t)(hlen + len));
+	pkttrace_put32((u_int32_t)(hlen + len));
+	pkttrace_put(hdr, hlen);
+	data = pkttrace_len;
+	for (i = 0; i < iovcnt; i++)
+		pkttrace_put(iov[i].iov_base, iov[i].iov_len);
+	pkttrace_putpad(hlen + len);
+
+	/* so the payloads are dissected rather than shown as encrypted */
+	if (dir == PKTTRACE_DECRYPTED && len >= sizeof(struct isakmp))
+		pkttrace_buf[data + offsetof(struct isakmp, flags)] &=
+			~ISAKMP_FLAG_E;
+
+	flags = (dir == PKTTRACE_OUT) ? PCAPNG_OUTBOUND : PCAPNG_INBOUND;
+	pkttrace_putopt(PCAPNG_OPT_EPB_FLAGS, &flags, sizeof(flags));
+	pkttrace_putopt(PCAPNG_OPT_END, NULL, 0);
+	pkttrace_end(start);
+	pkttrace_stats.packets++;
+
+	if (pkttrace_sc == 0)
+		pkttrace_sc = sched_new(1, pkttrace_tick, NULL);
+}
+
+void
+pkttrace_record(int dir, const void *buf, size_t len,
+	const struct sockaddr_storage *remote,
+	const struct sockaddr_storage *local)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+	pkttrace_recordv(dir, &iov, 1, remote, local);
+}
+
+/* write out what came in during the last second */
+static void
+pkttrace_tick(void *arg)
+{
+	pkttrace_sc = 0;
+	if (pkttrace_fd == -1 || pkttrace_failed())
+		return;
+	if (pkttrace_flush() != 0)		/* writer busy, try again */
+		pkttrace_sc = sched_new(1, pkttrace_tick, NULL);
+}
+
+static void
+pkttrace_setmask(void)
+{
+	pkttrace_mask = (1 << PKTTRACE_IN) | (1 << PKTTRACE_OUT);
+	if (pkttrace_conf.decrypted)
+		pkttrace_mask |= 1 << PKTTRACE_DECRYPTED;
+}
+
+static int
+pkttrace_open(void)
+{
+	int fd;
+
+	if (pkttrace_queue == NULL) {
+		pkttrace_queue = dispatch_queue_create("racoon.pkttrace",
+			DISPATCH_QUEUE_SERIAL);
+		if (pkttrace_queue == NULL) {
+			plog(ASL_LEVEL_ERR,
+				"failed to create the packet trace queue.\n");
+			return -1;
+		}
+	}
+
+	fd = open(pkttrace_conf.file, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+		S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		plog(ASL_LEVEL_ERR, "failed to open packet trace \"%s\": %s\n",
+			pkttrace_conf.file, strerror(errno));
+		return -1;
+	}
+	if ((pkttrace_buf = malloc(PKTTRACE_BUFSIZ)) == NULL) {
+		plog(ASL_LEVEL_ERR, "failed to allocate packet trace buffer.\n");
+		close(fd);
+		return -1;
+	}
+	pkttrace_fd = fd;
+	pkttrace_len = 0;
+	memset(&pkttrace_stats, 0, sizeof(pkttrace_stats));
+	pkttrace_header();
+	pkttrace_setmask();
+
+	plog(ASL_LEVEL_NOTICE, "packet trace to \"%s\" started.\n",
+		pkttrace_conf.file);
+	return 0;
+}
+
+/*
+ * stop recording and close the file once the writer is done with it.
+ * with wait, only return then.
+ */
+static void
+pkttrace_close(int wait)
+{
+	int fd = pkttrace_fd;
+
+	if (fd == -1)
+		return;
+
+	pkttrace_mask = 0;
+	SCHED_KILL(pkttrace_sc);
+	if (pkttrace_len != 0)
+		pkttrace_handoff(pkttrace_buf, pkttrace_len);
+	else
+		free(pkttrace_buf);
+	pkttrace_buf = NULL;
+	pkttrace_len = 0;
+	pkttrace_fd = -1;
+
+	/* an error belongs to this file only */
+	if (wait) {
+		dispatch_sync(pkttrace_queue, ^{
+			close(fd);
+			__atomic_store_n(&pkttrace_errno, 0, __ATOMIC_RELAXED);
+		});
+	} else {
+		dispatch_async(pkttrace_queue, ^{
+			close(fd);
+			__atomic_store_n(&pkttrace_errno, 0, __ATOMIC_RELAXED);
+		});
+	}
+
+	plog(ASL_LEVEL_NOTICE,
+		"packet trace \"%s\" closed: %llu packets, %llu bytes, "
+		"%llu dropped.\n", pkttrace_conf.file,
+		(unsigned long long)pkttrace_stats.packets,
+		(unsigned long long)pkttrace_stats.bytes,
+		(unsigned long long)pkttrace_stats.dropped);
+}
+
+void
+pkttrace_stop(void)
+{
+	pkttrace_close(1);
+}
+
+/*
+ * the "trace" section.  cfparse() resets it, pkttrace_apply() takes it
+ * once the whole configuration parsed.
+ */
+void
+pkttrace_conf_reset(void)
+{
+	if (pkttrace_new.file != NULL)
+		racoon_free(pkttrace_new.file);
+	memset(&pkttrace_new, 0, sizeof(pkttrace_new));
+}
+
+void
+pkttrace_conf_file(const char *file)
+{
+	if (pkttrace_new.file != NULL)
+		racoon_free(pkttrace_new.file);
+	pkttrace_new.file = racoon_strdup(file);
+	STRDUP_FATAL(pkttrace_new.file);
+}
+
+void
+pkttrace_conf_maxsize(u_int64_t maxsize)
+{
+	pkttrace_new.maxsize = maxsize;
+}
+
+int
+pkttrace_conf_peer(const struct sockaddr_storage *addr)
+{
+	if (pkttrace_new.npeers >= PKTTRACE_MAXPEERS) {
+		plog(ASL_LEVEL_ERR, "too many trace peers (max %d).\n",
+			PKTTRACE_MAXPEERS);
+		return -1;
+	}
+	memcpy(&pkttrace_new.peers[pkttrace_new.npeers++], addr,
+		sizeof(*addr));
+	return 0;
+}
+
+void
+pkttrace_conf_decrypted(int on)
+{
+	pkttrace_new.decrypted = on;
+}
+
+/*
+ * a reload that keeps the file and max_size only changes what is
+ * recorded from now on; anything else starts over.
+ */
+void
+pkttrace_apply(void)
+{
+	if (pkttrace_fd != -1 && pkttrace_new.file != NULL &&
+	    strcmp(pkttrace_new.file, pkttrace_conf.file) == 0 &&
+	    pkttrace_new.maxsize == pkttrace_conf.maxsize) {
+		pkttrace_conf.decrypted = pkttrace_new.decrypted;
+		pkttrace_conf.npeers = pkttrace_new.npeers;
+		memcpy(pkttrace_conf.peers, pkttrace_new.peers,
+			sizeof(pkttrace_conf.peers));
+		pkttrace_setmask();
+		return;
+	}
+
+	pkttrace_close(0);
+	if (pkttrace_conf.file != NULL)
+		racoon_free(pkttrace_conf.file);
+	memcpy(&pkttrace_conf, &pkttrace_new, sizeof(pkttrace_conf));
+	memset(&pkttrace_new, 0, sizeof(pkttrace_new));
+	if (pkttrace_conf.file != NULL)
+		pkttrace_open();
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _PKTTRACE_H
+#define _PKTTRACE_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * Packet trace capture.
+ *
+ * IKE datagrams are written as they cross the socket, with the NON-ESP
+ * marker if any, to a pcap-ng file that Wireshark or tcpdump read
+ * directly.  Each one gets an IPv4 or IPv6 and UDP header made up from
+ * its addresses.  With "decrypted on", phase 1 and 2 messages are also
+ * written once oakley_do_decrypt() has opened them, with the encryption
+ * bit cleared, on a second interface of the file.
+ *
+ * Records are appended to a buffer on the main queue and full buffers
+ * are written out on a serial queue of their own, so the daemon never
+ * waits for the disk.  When PKTTRACE_MAXINFLIGHT buffers are already
+ * waiting for the writer, new records are counted and dropped instead.
+ * Buffers are also written once a second so the file can be followed.
+ *
+ * Configured by the "trace" section of racoon.conf.  A reload starts
+ * the file over when it changes "file" or "max_size", or after
+ * "max_size" stopped the trace; other changes apply from then on.
+ * When tracing is off the hooks cost a single test.
+ */
+#define PKTTRACE_IN			0	/* received */
+#define PKTTRACE_OUT		1	/* sent */
+#define PKTTRACE_DECRYPTED	2	/* received, after decryption */
+
+#define PKTTRACE_BUFSIZ			(256 * 1024)
+#define PKTTRACE_MAXINFLIGHT	8
+#define PKTTRACE_MAXPEERS		64
+
+extern int pkttrace_mask;
+
+extern void pkttrace_conf_reset (void);
+extern void pkttrace_conf_file (const char *);
+extern void pkttrace_conf_maxsize (u_int64_t);
+extern int pkttrace_conf_peer (const struct sockaddr_storage *);
+extern void pkttrace_conf_decrypted (int);
+extern void pkttrace_apply (void);
+extern void pkttrace_stop (void);
+extern void pkttrace_recordv (int, const struct iovec *, int,
+	const struct sockaddr_storage *, const struct sockaddr_storage *);
+extern void pkttrace_record (int, const void *, size_t,
+	const struct sockaddr_storage *, const struct sockaddr_storage *);
+
+/* remote and local are the peer's and our address either way */
+#define PKTTRACE(dir, buf, len, remote, local) \
+do { \
+	if (pkttrace_mask & (1 << (dir))) \
+		pkttrace_record((dir), (buf), (len), (remote), (local)); \
+} while (0)
+
+#define PKTTRACEV(dir, iov, iovcnt, remote, local) \
+do { \
+	if (pkttrace_mask & (1 << (dir))) \
+		pkttrace_recordv((dir), (iov), (iovcnt), (remote), (local)); \
+} while (0)
+
+#endif /* _PKTTRACE_H */
@@ -267,23 +267,28 @@ cmpsaprop_alloc(ph1, pp1, pp2, side)
 	const int ordermatters = 0;
 	int npr1, npr2;
 	int spisizematch;
+	struct {
+		struct saproto *pr1, *pr2;
+		struct satrns *tr1;
+	} match[SAPROP_MAXPROTO];
+	int nmatch = 0, i;
+	time_t lifetime;
+	int lifebyte, pfs_group, claim = 0;
 
-	newpp = newsaprop();
-	if (newpp == NULL) {
-		plog(ASL_LEVEL_ERR, 
-			"failed to allocate saprop.\n");
-		return NULL;
-	}
-	newpp->prop_no = pp1->prop_no;
+	/*
+	 * everything is compared first, and the approval only allocated
+	 * once the bundles are known to match: a responder tries each
+	 * of the peer's bundles against each of its own.
+	 */
 
 	/* see proposal.h about lifetime/key length and PFS selection. */
 
 	/* check time/bytes lifetime and PFS */
 	switch (ph1->rmconf->pcheck_level) {
 	case PROP_CHECK_OBEY:
-		newpp->lifetime = pp1->lifetime;
-		newpp->lifebyte = pp1->lifebyte;
-		newpp->pfs_group = pp1->pfs_group;
+		lifetime = pp1->lifetime;
+		lifebyte = pp1->lifebyte;
+		pfs_group = pp1->pfs_group;
 		break;
 
 	case PROP_CHECK_STRICT:
@@ -301,8 +306,8 @@ cmpsaprop_alloc(ph1, pp1, pp2, side)
 				pp2->lifebyte, pp1->lifebyte);
 			goto err;
 		}
-		newpp->lifetime = pp1->lifetime;
-		newpp->lifebyte = pp1->lifebyte;
+		lifetime = pp1->lifetime;
+		lifebyte = pp1->lifebyte;
 
     prop_pfs_check:
 		if (pp2->pfs_group != 0 && pp1->pfs_group != pp2->pfs_group) {
@@ -312,16 +317,16 @@ cmpsaprop_alloc(ph1, pp1, pp2, side)
 				pp2->pfs_group, pp1->pfs_group);
 			goto err;
 		}
-		newpp->pfs_group = pp1->pfs_group;
+		pfs_group = pp1->pfs_group;
 		break;
 
 	case PROP_CHECK_CLAIM:
 		/* lifetime */
 		if (pp1->lifetime <= pp2->lifetime) {
-			newpp->lifetime = pp1->lifetime;
+			lifetime = pp1->lifetime;
 		} else {
-			newpp->lifetime = pp2->lifetime;
-			newpp->claim |= IPSECDOI_ATTR_SA_LD_TYPE_SEC;
+			lifetime = pp2->lifetime;
+			claim |= IPSECDOI_ATTR_SA_LD_TYPE_SEC;
 			plog(ASL_LEVEL_NOTICE, 
 				"use own lifetime: "
 				"my:%d peer:%d\n",
@@ -330,14 +335,13 @@ cmpsaprop_alloc(ph1, pp1, pp2, side)
 
 		/* lifebyte */
 		if (pp1->lifebyte > pp2->lifebyte) {
-			newpp->lifebyte = pp2->lifebyte;
-			newpp->claim |= IPSECDOI_ATTR_SA_LD_TYPE_SEC;
+			claim |= IPSECDOI_ATTR_SA_LD_TYPE_SEC;
 			plog(ASL_LEVEL_NOTICE, 
 				"use own lifebyte: "
 				"my:%d peer:%d\n",
 				pp2->lifebyte, pp1->lifebyte);
 		}
-		newpp->lifebyte = pp1->lifebyte;
+		lifebyte = pp1->lifebyte;
 
     		goto prop_pfs_check;
 		break;
@@ -365,9 +369,9 @@ cmpsaprop_alloc(ph1, pp1, pp2, side)
 				pp2->pfs_group, pp1->pfs_group);
 			goto err;
 		}
-		newpp->lifetime = pp1->lifetime;
-		newpp->lifebyte = pp1->lifebyte;
-		newpp->pfs_group = pp1->pfs_group;
+		lifetime = pp1->lifetime;
+		lifebyte = pp1->lifebyte;
+		pfs_group = pp1->pfs_group;
 		break;
 
 	default:
@@ -381,7 +385,7 @@ cmpsaprop_alloc(ph1, pp1, pp2, side)
 		npr1++;
 	for (pr2 = pp2->head; pr2; pr2 = pr2->next)
 		npr2++;
-	if (npr1 != npr2)
+	if (npr1 != npr2 || npr1 > SAPROP_MAXPROTO)
 		goto err;
 
 	/* check protocol order */
@@ -478,6 +482,52 @@ cmpsaprop_alloc(ph1, pp1, pp2, side)
 		goto err;
 
 	    found:
+		if (nmatch == SAPROP_MAXPROTO)
+			goto err;
+		match[nmatch].pr1 = pr1;
+		match[nmatch].pr2 = pr2;
+		match[nmatch].tr1 = tr1;
+		nmatch++;
+
+		pr1 = pr1->next;
+		pr2 = pr2->next;
+	}
+
+	/* XXX should check if we have visited all items or not */
+	if (!ordermatters) {
+		switch (side) {
+		case RESPONDER:
+			if (!pr2)
+				pr1 = NULL;
+			break;
+		case INITIATOR:
+			if (!pr1)
+				pr2 = NULL;
+			break;
+		}
+	}
+
+	/* should be matched all protocols in a proposal */
+	if (pr1 != NULL || pr2 != NULL)
+		goto err;
+
+	newpp = newsaprop();
+	if (newpp == NULL) {
+		plog(ASL_LEVEL_ERR, 
+			"failed to allocate saprop.\n");
+		return NULL;
+	}
+	newpp->prop_no = pp1->prop_no;
+	newpp->lifetime = lifetime;
+	newpp->lifebyte = lifebyte;
+	newpp->pfs_group = pfs_group;
+	newpp->claim = claim;
+
+	for (i = 0; i < nmatch; i++) {
+		pr1 = match[i].pr1;
+		pr2 = match[i].pr2;
+		tr1 = match[i].tr1;
+
 		newpr = newsaproto();
 		if (newpr == NULL) {
 			plog(ASL_LEVEL_ERR, 
@@ -509,29 +559,8 @@ cmpsaprop_alloc(ph1, pp1, pp2, side)
 
 		inssatrns(newpr, newtr);
 		inssaproto(newpp, newpr);
-
-		pr1 = pr1->next;
-		pr2 = pr2->next;
 	}
 
-	/* XXX should check if we have visited all items or not */
-	if (!ordermatters) {
-		switch (side) {
-		case RESPONDER:
-			if (!pr2)
-				pr1 = NULL;
-			break;
-		case INITIATOR:
-			if (!pr1)
-				pr2 = NULL;
-			break;
-		}
-	}
-
-	/* should be matched all protocols in a proposal */
-	if (pr1 != NULL || pr2 != NULL)
-		goto err;
-
 	return newpp;
 
 err:
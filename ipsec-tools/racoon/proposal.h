@@ -144,6 +144,7 @@ struct prop_pair {
 				/* (multiple tranform case) */
 };
 #define MAXPROPPAIRLEN	256	/* It's enough because field size is 1 octet. */
+#define SAPROP_MAXPROTO	4	/* protocols in one bundle: AH, ESP, IPComp */
 
 /*
  * Lifetime length selection refered to the section 4.5.4 of RFC2407.  It does
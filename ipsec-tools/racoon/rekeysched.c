@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <net/pfkeyv2.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "var.h"
+#include "misc.h"
+#include "vmbuf.h"
+#include "plog.h"
+#include "debug.h"
+#include "schedule.h"
+#include "gcmalloc.h"
+
+#include "localconf.h"
+#include "isakmp_var.h"
+#include "isakmp.h"
+#include "oakley.h"
+#include "handler.h"
+#include "crypto_openssl.h"
+#include "metrics.h"
+#include "rekeysched.h"
+
+struct rekeysched_entry {
+	phase1_handle_t *iph1;		/* one of these two */
+	phase2_handle_t *iph2;
+	void (*start_ph1) (phase1_handle_t *);
+	void (*start_ph2) (phase2_handle_t *);
+	time_t expiry;				/* hard expiry, 0 if unknown */
+	TAILQ_ENTRY(rekeysched_entry) chain;
+};
+
+/* sorted by expiry, unknown ones last */
+static TAILQ_HEAD(_rekeyq, rekeysched_entry) rekeyq =
+	TAILQ_HEAD_INITIALIZER(rekeyq);
+static schedule_ref rekeysched_sc;
+static time_t rekeysched_second;	/* the second the budget is for */
+static u_int rekeysched_used;		/* rekeys started in it */
+static struct rekeysched_stats rekeysched_stats;
+
+static void rekeysched_drain (void *);
+
+static u_int
+rekeysched_spread(u_int rekey, u_int lifetime, u_int32_t r)
+{
+	u_int span, floor;
+
+	if (lcconf->rekey_jitter <= 0 || rekey == 0)
+		return rekey;
+
+	span = (u_int)(((u_int64_t)lifetime * lcconf->rekey_jitter) / 100);
+	floor = lifetime / 2;
+	if (rekey <= floor)
+		return rekey;
+	if (span > rekey - floor)
+		span = rekey - floor;
+
+	return rekey - r % (span + 1);
+}
+
+/*
+ * Move a phase 1 rekey point, "rekey" seconds into "lifetime", earlier
+ * by a random amount within the configured jitter.
+ */
+u_int
+rekeysched_jitter(u_int rekey, u_int lifetime)
+{
+	return rekeysched_spread(rekey, lifetime, eay_random());
+}
+
+/*
+ * The soft lifetime rate, in percent of the hard one, to hand to PF_KEY
+ * for the SAs of one phase 2.
+ */
+u_int
+rekeysched_softrate(void)
+{
+	return rekeysched_spread(PFKEY_SOFT_LIFETIME_RATE, 100, eay_random());
+}
+
+/*
+ * Take one rekey out of this second's budget.
+ */
+static int
+rekeysched_take(void)
+{
+	time_t now;
+
+	if (lcconf->rekey_rate <= 0)
+		return 1;
+
+	now = current_time();
+	if (now != rekeysched_second) {
+		rekeysched_second = now;
+		rekeysched_used = 0;
+	}
+	if (rekeysched_used >= (u_int)lcconf->rekey_rate)
+		return 0;
+	rekeysched_used++;
+	return 1;
+}
+
+static void
+rekeysched_started(time_t expiry)
+{
+	int slack;
+
+	rekeysched_stats.started++;
+	METRICS_INC(METRICS_C_REKEYS);
+
+	if (expiry == 0)
+		return;
+	slack = (int)(expiry - current_time());
+	if (!rekeysched_stats.have_slack ||
+		slack < rekeysched_stats.worst_slack) {
+		rekeysched_stats.worst_slack = slack;
+		rekeysched_stats.have_slack = 1;
+	}
+}
+
+/*
+ * Start now if the budget allows and nothing is waiting, otherwise
+ * queue a copy of "tmpl" in expiry order.
+ */
+static int
+rekeysched_admit(const struct rekeysched_entry *tmpl)
+{
+	struct rekeysched_entry *new, *e;
+
+	if (TAILQ_EMPTY(&rekeyq) && rekeysched_take()) {
+		rekeysched_started(tmpl->expiry);
+		return 1;
+	}
+
+	new = racoon_malloc(sizeof(*new));
+	if (new == NULL) {
+		plog(ASL_LEVEL_ERR,
+			"failed to queue rekey, starting it now.\n");
+		rekeysched_started(tmpl->expiry);
+		return 1;
+	}
+	*new = *tmpl;
+
+	TAILQ_FOREACH(e, &rekeyq, chain) {
+		if (new->expiry != 0 &&
+			(e->expiry == 0 || new->expiry < e->expiry))
+			break;
+	}
+	if (e != NULL)
+		TAILQ_INSERT_BEFORE(e, new, chain);
+	else
+		TAILQ_INSERT_TAIL(&rekeyq, new, chain);
+
+	rekeysched_stats.deferred++;
+	METRICS_INC(METRICS_C_REKEYS_DEFERRED);
+	if (++rekeysched_stats.queued > rekeysched_stats.peak)
+		rekeysched_stats.peak = rekeysched_stats.queued;
+	plog(ASL_LEVEL_DEBUG,
+		"rekey budget of %d/s used up, phase %d rekey queued (%u waiting).\n",
+		lcconf->rekey_rate, new->iph1 != NULL ? 1 : 2,
+		rekeysched_stats.queued);
+
+	if (rekeysched_sc == 0)
+		rekeysched_sc = sched_new(1, rekeysched_drain, NULL);
+	return 0;
+}
+
+/*
+ * Returns 1 if the caller starts the rekey now, 0 if "start" will be
+ * called for it later.
+ */
+int
+rekeysched_admit_ph1(phase1_handle_t *iph1, void (*start)(phase1_handle_t *))
+{
+	struct rekeysched_entry tmpl;
+
+	if (iph1->rekey_queued)
+		return 0;		/* already waiting */
+
+	memset(&tmpl, 0, sizeof(tmpl));
+	tmpl.iph1 = iph1;
+	tmpl.start_ph1 = start;
+	if (!sched_get_time(iph1->sce, &tmpl.expiry))
+		tmpl.expiry = 0;
+
+	if (rekeysched_admit(&tmpl))
+		return 1;
+	iph1->rekey_queued = 1;
+	return 0;
+}
+
+int
+rekeysched_admit_ph2(phase2_handle_t *iph2, time_t expiry,
+	void (*start)(phase2_handle_t *))
+{
+	struct rekeysched_entry tmpl;
+
+	if (iph2->rekey_queued)
+		return 0;		/* already waiting */
+
+	memset(&tmpl, 0, sizeof(tmpl));
+	tmpl.iph2 = iph2;
+	tmpl.start_ph2 = start;
+	tmpl.expiry = expiry;
+
+	if (rekeysched_admit(&tmpl))
+		return 1;
+	iph2->rekey_queued = 1;
+	return 0;
+}
+
+static void
+rekeysched_remove(struct rekeysched_entry *e)
+{
+	TAILQ_REMOVE(&rekeyq, e, chain);
+	rekeysched_stats.queued--;
+	if (e->iph1)
+		e->iph1->rekey_queued = 0;
+	else
+		e->iph2->rekey_queued = 0;
+}
+
+static void
+rekeysched_drain(void *arg)
+{
+	struct rekeysched_entry *e;
+
+	rekeysched_sc = 0;
+
+	/* the start functions may cancel other entries, so refetch */
+	while ((e = TAILQ_FIRST(&rekeyq)) != NULL && rekeysched_take()) {
+		rekeysched_remove(e);
+		rekeysched_started(e->expiry);
+		if (e->iph1)
+			(e->start_ph1)(e->iph1);
+		else
+			(e->start_ph2)(e->iph2);
+		racoon_free(e);
+	}
+
+	if (!TAILQ_EMPTY(&rekeyq))
+		rekeysched_sc = sched_new(1, rekeysched_drain, NULL);
+}
+
+/*
+ * The handle is going away before its rekey was started.
+ */
+void
+rekeysched_cancel_ph1(phase1_handle_t *iph1)
+{
+	struct rekeysched_entry *e;
+
+	if (!iph1->rekey_queued)
+		return;
+	TAILQ_FOREACH(e, &rekeyq, chain) {
+		if (e->iph1 == iph1) {
+			rekeysched_remove(e);
+			rekeysched_stats.dropped++;
+			racoon_free(e);
+			return;
+		}
+	}
+}
+
+void
+rekeysched_cancel_ph2(phase2_handle_t *iph2)
+{
+	struct rekeysched_entry *e;
+
+	if (!iph2->rekey_queued)
+		return;
+	TAILQ_FOREACH(e, &rekeyq, chain) {
+		if (e->iph2 == iph2) {
+			rekeysched_remove(e);
+			rekeysched_stats.dropped++;
+			racoon_free(e);
+			return;
+		}
+	}
+}
+
+void
+rekeysched_dump(void)
+{
+	char slack[32];
+
+	if (rekeysched_stats.have_slack)
+		snprintf(slack, sizeof(slack), "%ds",
+			rekeysched_stats.worst_slack);
+	else
+		strlcpy(slack, "-", sizeof(slack));
+
+	plog(ASL_LEVEL_NOTICE,
+		"rekey: jitter %d%%, budget %d/s, %u queued (peak %u), "
+		"%llu started, %llu deferred, %llu dropped, "
+		"worst slack to hard expiry %s\n",
+		lcconf->rekey_jitter, lcconf->rekey_rate,
+		rekeysched_stats.queued, rekeysched_stats.peak,
+		(unsigned long long)rekeysched_stats.started,
+		(unsigned long long)rekeysched_stats.deferred,
+		(unsigned long long)rekeysched_stats.dropped, slack);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _REKEYSCHED_H
+#define _REKEYSCHED_H
+
+#include <sys/types.h>
+
+#include "handler.h"
+
+/*
+ * Rekey smoothing.
+ *
+ * Tunnels that came up together, after a restart or a mass reconnect,
+ * would otherwise rekey together every lifetime, all of them at the
+ * same fraction of it.  Two things spread that out:
+ *
+ *   - jitter: every rekey point is moved earlier by a random part of
+ *     "rekey_jitter" percent of the lifetime, never below half of it.
+ *     Phase 1 rekeys are our own timers; phase 2 rekeys follow the
+ *     kernel's soft lifetime, so the jitter goes into the soft rate
+ *     handed to PF_KEY with each SA.
+ *
+ *   - a budget of "rekey_rate" rekeys a second, phase 1 and 2
+ *     together.  A rekey over the budget is queued and started in a
+ *     later second, the ones closest to their hard expiry first.
+ *
+ * Both are off (0) unless configured in the timer section.
+ */
+struct rekeysched_stats {
+	u_int64_t started;
+	u_int64_t deferred;		/* went through the queue */
+	u_int64_t dropped;		/* gone before their turn came */
+	u_int queued;			/* waiting now */
+	u_int peak;				/* most ever waiting */
+	int worst_slack;		/* least seconds to hard expiry at start */
+	int have_slack;
+};
+
+extern u_int rekeysched_jitter (u_int, u_int);
+extern u_int rekeysched_softrate (void);
+extern int rekeysched_admit_ph1 (phase1_handle_t *, void (*)(phase1_handle_t *));
+extern int rekeysched_admit_ph2 (phase2_handle_t *, time_t,
+	void (*)(phase2_handle_t *));
+extern void rekeysched_cancel_ph1 (phase1_handle_t *);
+extern void rekeysched_cancel_ph2 (phase2_handle_t *);
+extern void rekeysched_dump (void);
+
+#endif /* _REKEYSCHED_H */
@@ -81,8 +81,10 @@
 #include "isakmp_frag.h"
 #include "genlist.h"
 #include "vpn_control_var.h"
+#include "cfsnapshot.h"
 
 static TAILQ_HEAD(_rmtree, remoteconf) rmtree;
+static struct _rmtree rmtree_save;	/* running configuration, during a reload */
 
 
 /*%%%*/
@@ -94,8 +96,8 @@ static TAILQ_HEAD(_rmtree, remoteconf) rmtree;
  * OUT:	NULL:	NG
  *	Other:	remote configuration entry.
  */
-struct remoteconf *
-getrmconf_strict(remote, allow_anon)
+static struct remoteconf *
+getrmconf_strict_lookup(remote, allow_anon)
 	struct sockaddr_storage *remote;
 	int allow_anon;
 {
@@ -210,6 +212,18 @@ getrmconf_strict(remote, allow_anon)
 	return NULL;
 }
 
+struct remoteconf *
+getrmconf_strict(struct sockaddr_storage *remote, int allow_anon)
+{
+	struct remoteconf *p;
+
+	p = getrmconf_strict_lookup(remote, allow_anon);
+	/* one loaded from the snapshot is read in full once it is used */
+	if (p != NULL && cfsnapshot_rmconf(p) != 0)
+		return NULL;
+	return p;
+}
+
 int
 no_remote_configs(ignore_anonymous)
 	int ignore_anonymous;
@@ -230,6 +244,7 @@ no_remote_configs(ignore_anonymous)
 		// ignore the default btmm ipv6 config thats always present in racoon.conf
 		if (p->remote->ss_family == AF_INET6 &&
 			p->idvtype == IDTYPE_USERFQDN &&
+			cfsnapshot_rmconf(p) == 0 &&
 			p->idv != NULL &&
 			p->idv->l == default_idv_len &&
 			strncmp(p->idv->v, default_idv, p->idv->l) == 0) {
@@ -293,6 +308,7 @@ create_rmconf()
 	new->ike_frag = ISAKMP_FRAG_ON;
 	new->esp_frag = IP_MAXPACKET;
 	new->ini_contact = TRUE;
+	new->fast_reconnect = FALSE;
 	new->mode_cfg = FALSE;
 	new->pcheck_level = PROP_CHECK_STRICT;
 	new->verify_identifier = FALSE;
@@ -382,11 +398,16 @@ duprmconf (struct remoteconf *rmconf)
     new->remote = NULL;
     new->forced_local = NULL;
     new->keychainCertRef = NULL;	/* peristant keychain ref for cert */
+    new->mycert = NULL;
+    new->mycert_sc = 0;
+    new->mycr = NULL;
     new->shared_secret = NULL;	/* shared secret */
     new->open_dir_auth_group = NULL;	/* group to be used to authorize user */
     new->proposal = NULL;
+    memset(new->propindex, 0, sizeof(new->propindex));
     new->in_list = 0;
     new->refcount = 1;
+    new->stale = 0;
     new->idv = NULL;
     new->key = NULL;
 #ifdef ENABLE_HYBRID
@@ -467,6 +488,7 @@ delrmconf(struct remoteconf *rmconf)
 		vfree(rmconf->shared_secret);
 	if (rmconf->keychainCertRef)
 		vfree(rmconf->keychainCertRef);
+	oakley_flushrmconf(rmconf);
 	if (rmconf->open_dir_auth_group)
 		vfree(rmconf->open_dir_auth_group);
 
@@ -562,6 +584,375 @@ void
 initrmconf()
 {
 	TAILQ_INIT(&rmtree);
+	TAILQ_INIT(&rmtree_save);
+}
+
+/*
+ * configuration reload.
+ *
+ * the new configuration is parsed into an empty rmtree while the running
+ * one waits aside in rmtree_save.  rmconf_reload_commit() then keeps every
+ * old entry the new configuration repeats unchanged, in place of its new
+ * copy, so that phase 1 handles referencing it are not disturbed.  The
+ * old entries left over are marked stale and stay alive, referenced by
+ * their phase 1 handles only, until rmconf_reload_release().
+ */
+static int
+rmconf_cmpaddr(struct sockaddr_storage *a, struct sockaddr_storage *b)
+{
+	if (a == NULL || b == NULL)
+		return a != b;
+	if (a->ss_family == AF_UNSPEC && b->ss_family == AF_UNSPEC)
+		return memcmp(a, b, sizeof(*a)) != 0;	/* anonymous, port only */
+	return cmpsaddrstrict(a, b);
+}
+
+static int
+rmconf_cmpvchar(vchar_t *a, vchar_t *b)
+{
+	if (a == NULL || b == NULL)
+		return a != b;
+	if (a->l != b->l)
+		return 1;
+	return memcmp(a->v, b->v, a->l) != 0;
+}
+
+static int
+rmconf_cmpproposal(struct isakmpsa *a, struct isakmpsa *b)
+{
+	for (; a != NULL && b != NULL; a = a->next, b = b->next) {
+		if (a->version != b->version
+		 || a->prop_no != b->prop_no
+		 || a->trns_no != b->trns_no
+		 || a->lifetime != b->lifetime
+		 || a->lifetimegap != b->lifetimegap
+		 || a->lifebyte != b->lifebyte
+		 || a->enctype != b->enctype
+		 || a->encklen != b->encklen
+		 || a->authmethod != b->authmethod
+		 || a->hashtype != b->hashtype
+		 || a->vendorid != b->vendorid
+		 || a->dh_group != b->dh_group
+		 || a->prf != b->prf
+		 || a->prfklen != b->prfklen)
+			return 1;
+	}
+	return a != b;
+}
+
+static int
+rmconf_cmpidvl(struct genlist *a, struct genlist *b)
+{
+	struct genlist_entry *ga, *gb;
+	struct idspec *ia, *ib;
+
+	ia = genlist_next(a, &ga);
+	ib = genlist_next(b, &gb);
+	for (; ia != NULL && ib != NULL;
+	     ia = genlist_next(NULL, &ga), ib = genlist_next(NULL, &gb)) {
+		if (ia->idtype != ib->idtype || rmconf_cmpvchar(ia->id, ib->id))
+			return 1;
+	}
+	return ia != ib;
+}
+
+/*
+ * clear everything that is not a plain value: pointers, which are
+ * compared by what they point to, and the bookkeeping of a live entry.
+ * a field added later without being listed here can only make two
+ * entries look different, never the same.
+ */
+static void
+rmconf_strip(struct remoteconf *p)
+{
+	p->remote = NULL;
+	p->etypes = NULL;
+	p->idv = NULL;
+	p->key = NULL;
+	p->idvl_p = NULL;
+	p->keychainCertRef = NULL;
+	p->mycert = NULL;
+	p->mycert_gen = 0;
+	p->mycert_sc = 0;
+	p->mycr = NULL;
+	p->shared_secret = NULL;
+	p->open_dir_auth_group = NULL;
+	p->dhgrp = NULL;
+	p->proposal = NULL;
+	memset(p->propindex, 0, sizeof(p->propindex));
+	p->inherited_from = NULL;
+	p->prhead = NULL;
+#ifdef ENABLE_HYBRID
+	p->xauth = NULL;
+#endif
+	p->in_list = 0;
+	p->refcount = 0;
+	p->stale = 0;
+	p->forced_local = NULL;
+	memset(&p->chain, 0, sizeof(p->chain));
+}
+
+static int
+rmconf_equal(struct remoteconf *a, struct remoteconf *b)
+{
+	struct remoteconf sa, sb;
+	struct etypes *ea, *eb;
+
+	/* both come from calloc() and memcpy(), so padding is zero too */
+	memcpy(&sa, a, sizeof(sa));
+	memcpy(&sb, b, sizeof(sb));
+	rmconf_strip(&sa);
+	rmconf_strip(&sb);
+	if (memcmp(&sa, &sb, sizeof(sa)) != 0)
+		return 0;
+
+	if (rmconf_cmpaddr(a->remote, b->remote)
+	 || rmconf_cmpaddr(a->forced_local, b->forced_local))
+		return 0;
+	for (ea = a->etypes, eb = b->etypes; ea && eb; ea = ea->next, eb = eb->next)
+		if (ea->type != eb->type)
+			return 0;
+	if (ea != eb)
+		return 0;
+	if (rmconf_cmpvchar(a->idv, b->idv)
+	 || rmconf_cmpvchar(a->key, b->key)
+	 || rmconf_cmpvchar(a->keychainCertRef, b->keychainCertRef)
+	 || rmconf_cmpvchar(a->shared_secret, b->shared_secret)
+	 || rmconf_cmpvchar(a->open_dir_auth_group, b->open_dir_auth_group))
+		return 0;
+	if (rmconf_cmpidvl(a->idvl_p, b->idvl_p))
+		return 0;
+	if (rmconf_cmpproposal(a->proposal, b->proposal))
+		return 0;
+#ifdef ENABLE_HYBRID
+	if (a->xauth == NULL || b->xauth == NULL) {
+		if (a->xauth != b->xauth)
+			return 0;
+	} else if (rmconf_cmpvchar(a->xauth->login, b->xauth->login)
+		|| rmconf_cmpvchar(a->xauth->pass, b->xauth->pass))
+		return 0;
+#endif
+
+	return 1;
+}
+
+/*
+ * the saved entries, hashed by remote address and prefix, which any two
+ * equal entries share, so that each new entry is looked up once instead
+ * of compared with every saved one.
+ */
+struct rmconf_reload_node {
+	struct remoteconf *rmconf;		/* NULL once kept */
+	struct rmconf_reload_node *next;
+};
+
+struct rmconf_reload_index {
+	struct rmconf_reload_node **bucket;
+	struct rmconf_reload_node *node;
+	u_int32_t mask;
+};
+
+static u_int32_t
+rmconf_reload_hash(struct remoteconf *p)
+{
+	struct sockaddr_storage *ss = p->remote;
+	const u_int8_t *a = NULL;
+	size_t len = 0;
+	u_int32_t h;
+
+	h = (u_int32_t)p->remote_prefix;
+	if (ss != NULL) {
+		h = h * 31 + ss->ss_family;
+		switch (ss->ss_family) {
+		case AF_INET:
+			a = (const u_int8_t *)&((struct sockaddr_in *)ss)->sin_addr;
+			len = sizeof(struct in_addr);
+			break;
+#ifdef INET6
+		case AF_INET6:
+			a = (const u_int8_t *)&((struct sockaddr_in6 *)ss)->sin6_addr;
+			len = sizeof(struct in6_addr);
+			break;
+#endif
+		}
+		while (len-- > 0)
+			h = h * 31 + *a++;
+	}
+	h ^= h >> 11;
+
+	return h;
+}
+
+/*
+ * without memory for the index, lookups walk rmtree_save as they used to.
+ */
+static void
+rmconf_reload_index(struct rmconf_reload_index *idx)
+{
+	struct remoteconf *old;
+	struct rmconf_reload_node **pp;
+	u_int32_t n = 0, size, i;
+
+	memset(idx, 0, sizeof(*idx));
+	TAILQ_FOREACH(old, &rmtree_save, chain)
+		n++;
+	if (n == 0)
+		return;
+	for (size = 1; size < n; size <<= 1)
+		;
+	idx->bucket = racoon_calloc(size, sizeof(*idx->bucket));
+	idx->node = racoon_calloc(n, sizeof(*idx->node));
+	if (idx->bucket == NULL || idx->node == NULL) {
+		plog(ASL_LEVEL_WARNING,
+			"no memory to index remote configurations.\n");
+		if (idx->bucket)
+			racoon_free(idx->bucket);
+		if (idx->node)
+			racoon_free(idx->node);
+		memset(idx, 0, sizeof(*idx));
+		return;
+	}
+	idx->mask = size - 1;
+
+	i = 0;
+	TAILQ_FOREACH(old, &rmtree_save, chain)
+		idx->node[i++].rmconf = old;
+	/* keep each bucket in list order: the first equal entry wins */
+	while (i-- > 0) {
+		pp = &idx->bucket[rmconf_reload_hash(idx->node[i].rmconf) & idx->mask];
+		idx->node[i].next = *pp;
+		*pp = &idx->node[i];
+	}
+}
+
+static struct remoteconf *
+rmconf_reload_find(struct rmconf_reload_index *idx, struct remoteconf *p)
+{
+	struct rmconf_reload_node *n;
+	struct remoteconf *old;
+
+	if (idx->bucket == NULL) {
+		TAILQ_FOREACH(old, &rmtree_save, chain) {
+			if (rmconf_equal(old, p))
+				return old;
+		}
+		return NULL;
+	}
+	for (n = idx->bucket[rmconf_reload_hash(p) & idx->mask]; n; n = n->next) {
+		if (n->rmconf != NULL && rmconf_equal(n->rmconf, p)) {
+			old = n->rmconf;
+			n->rmconf = NULL;
+			return old;
+		}
+	}
+	return NULL;
+}
+
+void
+rmconf_reload_begin(void)
+{
+	struct remoteconf *p;
+
+	while ((p = TAILQ_FIRST(&rmtree)) != NULL) {
+		TAILQ_REMOVE(&rmtree, p, chain);
+		p->in_list = 0;
+		TAILQ_INSERT_TAIL(&rmtree_save, p, chain);
+	}
+}
+
+/*
+ * the new configuration could not be loaded: drop what was parsed of it
+ * and go on with the old one.
+ */
+void
+rmconf_reload_abort(void)
+{
+	struct remoteconf *p;
+
+	flushrmconf();
+	while ((p = TAILQ_FIRST(&rmtree_save)) != NULL) {
+		TAILQ_REMOVE(&rmtree_save, p, chain);
+		TAILQ_INSERT_TAIL(&rmtree, p, chain);
+		p->in_list = 1;
+	}
+}
+
+/*
+ * returns the number of old entries that went stale.
+ */
+int
+rmconf_reload_commit(void)
+{
+	TAILQ_HEAD(, remoteconf) dup;
+	struct rmconf_reload_index idx;
+	struct remoteconf *p, *prev, *old;
+	int kept = 0, added = 0, stale = 0;
+
+	TAILQ_INIT(&dup);
+	rmconf_reload_index(&idx);
+
+	/*
+	 * walk in the order of the file, so that a section is settled
+	 * before any section inheriting from it.
+	 */
+	for (p = TAILQ_LAST(&rmtree, _rmtree); p != NULL; p = prev) {
+		prev = TAILQ_PREV(p, _rmtree, chain);
+
+		/* inherits from a duplicate: follow it to the entry kept */
+		if (p->inherited_from && !p->inherited_from->in_list)
+			p->inherited_from = p->inherited_from->inherited_from;
+
+		if ((old = rmconf_reload_find(&idx, p)) == NULL) {
+			added++;
+			continue;
+		}
+
+		TAILQ_REMOVE(&rmtree_save, old, chain);
+		TAILQ_INSERT_BEFORE(p, old, chain);
+		old->in_list = 1;
+		old->inherited_from = p->inherited_from;
+		remrmconf(p);
+		p->inherited_from = old;
+		TAILQ_INSERT_TAIL(&dup, p, chain);
+		kept++;
+	}
+
+	while ((p = TAILQ_FIRST(&dup)) != NULL) {
+		TAILQ_REMOVE(&dup, p, chain);
+		if (--(p->refcount) <= 0)
+			delrmconf(p);
+	}
+	if (idx.bucket) {
+		racoon_free(idx.bucket);
+		racoon_free(idx.node);
+	}
+
+	TAILQ_FOREACH(old, &rmtree_save, chain) {
+		old->stale = 1;
+		stale++;
+	}
+
+	plog(ASL_LEVEL_NOTICE,
+		"remote configurations: %d unchanged, %d new, %d changed or removed.\n",
+		kept, added, stale);
+
+	return stale;
+}
+
+/*
+ * let go of the stale entries; those still referenced by a phase 1
+ * handle are freed with it.
+ */
+void
+rmconf_reload_release(void)
+{
+	struct remoteconf *p;
+
+	while ((p = TAILQ_FIRST(&rmtree_save)) != NULL) {
+		TAILQ_REMOVE(&rmtree_save, p, chain);
+		if (--(p->refcount) <= 0)
+			delrmconf(p);
+	}
 }
 
 /* check exchange type to be acceptable */
@@ -595,20 +986,51 @@ newisakmpsa()
 	new->vendorid = VENDORID_UNKNOWN;
 
 	new->next = NULL;
+	new->hnext = NULL;
 	new->rmconf = NULL;
 
 	return new;
 }
 
 /*
- * insert into tail of list.
+ * propindex bucket for the attributes a peer's transform must match
+ * exactly: version, encryption algorithm and key length, hash and DH
+ * group.  the authentication method is left out as it is compared
+ * modulo the hybrid/xauth variants.
+ */
+u_int
+isakmpsa_index(int version, int enctype, int encklen, int hashtype,
+    int dh_group)
+{
+	u_int32_t h;
+
+	h = (u_int32_t)version;
+	h = h * 31 + (u_int32_t)enctype;
+	h = h * 31 + (u_int32_t)encklen;
+	h = h * 31 + (u_int32_t)hashtype;
+	h = h * 31 + (u_int32_t)dh_group;
+	h ^= h >> 11;
+
+	return h & (RMCONF_PROPINDEX_SIZE - 1);
+}
+
+/*
+ * insert into tail of list, and of its propindex bucket.
  */
 void
 insisakmpsa(struct isakmpsa *new, struct remoteconf *rmconf)
 {
+	struct isakmpsa **pp;
 	struct isakmpsa *p;
 
 	new->rmconf = rmconf;
+	new->hnext = NULL;
+
+	pp = &rmconf->propindex[isakmpsa_index(new->version, new->enctype,
+	    new->encklen, new->hashtype, new->dh_group)];
+	while (*pp != NULL)
+		pp = &(*pp)->hnext;
+	*pp = new;
 
 	if (rmconf->proposal == NULL) {
 		rmconf->proposal = new;
@@ -653,10 +1075,15 @@ dump_peers_identifiers (void *entry, void *arg)
 static struct remoteconf *
 dump_rmconf_single (struct remoteconf *p, void *data)
 {
-	struct etypes *etype = p->etypes;
-	struct isakmpsa *prop = p->proposal;
+	struct etypes *etype;
+	struct isakmpsa *prop;
 	char buf[1024], *pbuf;
 
+	if (cfsnapshot_rmconf(p) != 0)
+		return NULL;
+	etype = p->etypes;
+	prop = p->proposal;
+
 	pbuf = buf;
     if (p->remote_prefix)
         pbuf += snprintf(pbuf, sizeof(buf) - (pbuf - buf), "remote %s", 
@@ -720,6 +1147,8 @@ dump_rmconf_single (struct remoteconf *p, void *data)
 	plog(ASL_LEVEL_NOTICE, "\tesp_frag %d;\n", p->esp_frag);
 	plog(ASL_LEVEL_NOTICE, "\tinitial_contact %s;\n",
 		s_switch (p->ini_contact));
+	plog(ASL_LEVEL_NOTICE, "\tfast_reconnect %s;\n",
+		s_switch (p->fast_reconnect));
 	plog(ASL_LEVEL_NOTICE, "\tgenerate_policy %s;\n",
 		s_switch (p->gen_policy));
 	plog(ASL_LEVEL_NOTICE, "\tsupport_proxy %s;\n",
@@ -789,6 +1218,7 @@ dupisakmpsa(struct isakmpsa *sa)
 
 	*res = *sa;
 	res->next=NULL;
+	res->hnext=NULL;
 
 	if (sa->dhgrp != NULL)
 		oakley_setdhgroup(sa->dh_group, &(res->dhgrp));
@@ -38,6 +38,7 @@
 
 #include <sys/queue.h>
 #include "genlist.h"
+#include "schedule.h"
 #ifdef ENABLE_HYBRID
 #include "isakmp_var.h"
 #include "isakmp_xauth.h"
@@ -81,6 +82,13 @@ struct etypes {
 	struct etypes *next;
 };
 
+/*
+ * phase 1 proposals are also kept hashed by the attributes that must
+ * match exactly, so that each transform a peer offers is looked up
+ * rather than compared with every proposal.
+ */
+#define RMCONF_PROPINDEX_SIZE	32	/* a power of two */
+
 enum {
     DPD_ALGO_DEFAULT = 0,
     DPD_ALGO_INBOUND_DETECT,
@@ -107,6 +115,10 @@ struct remoteconf {
 
 	int	identity_in_keychain;	/* cert and private key is in the keychain */
 	vchar_t *keychainCertRef;	/* peristant keychain ref for cert */
+	struct cert_t_tag *mycert;	/* my CERT payload, shared by phase 1s */
+	int mycert_gen;			/* keychain generation it was built at */
+	schedule_ref mycert_sc;		/* next change of its expiry status */
+	vchar_t *mycr;			/* my CR payload */
 	int secrettype;			/* type of secret [use, key, keychain] */
 	vchar_t *shared_secret;	/* shared secret */
 	vchar_t *open_dir_auth_group;	/* group to be used to authorize user */
@@ -131,6 +143,7 @@ struct remoteconf {
 #define GENERATE_POLICY_UNIQUE 2
 	int gen_policy;			/* generate policy if no policy found */
 	int ini_contact;		/* initial contact */
+	int fast_reconnect;		/* float an ISAKMP-SA on reconnect */
 	int pcheck_level;		/* level of propocl checking */
 	int nat_traversal;		/* NAT-Traversal */
 	int natt_multiple_user; /* special handling of multiple users behind a nat - for VPN server */
@@ -156,6 +169,9 @@ struct remoteconf {
 	int weak_phase1_check;		/* act on unencrypted deletions ? */
 
 	struct isakmpsa *proposal;	/* proposal list */
+	struct isakmpsa *propindex[RMCONF_PROPINDEX_SIZE];
+					/* the same, hashed by isakmpsa_index(),
+					 * in list order within a bucket */
 	struct remoteconf *inherited_from;	/* the original rmconf 
 						   from which this one 
 						   was inherited */
@@ -167,6 +183,8 @@ struct remoteconf {
     int initiate_ph1rekey;
     int in_list;            // in the linked list
     int refcount;           // ref count - in use
+    int stale;              // replaced by a configuration reload
+    const void *snapshot;   // rest still to be read from the snapshot
     int ike_version;
     
     struct sockaddr_storage *forced_local;	/* forced local IP address */
@@ -195,6 +213,7 @@ struct isakmpsa {
 	int             prfklen;
 
 	struct isakmpsa *next;		/* next transform */
+	struct isakmpsa *hnext;		/* next in the same propindex bucket */
 	struct remoteconf *rmconf;	/* backpointer to remoteconf */
 };
 
@@ -205,6 +224,8 @@ struct idspec {
 
 typedef struct remoteconf *(rmconf_func_t) (struct remoteconf *rmconf, void *data);
 
+extern u_int isakmpsa_index (int, int, int, int, int);
+
 extern struct remoteconf *getrmconf (struct sockaddr_storage *);
 extern struct remoteconf *getrmconf_strict
 	(struct sockaddr_storage *remote, int allow_anon);
@@ -223,6 +244,10 @@ extern void insrmconf (struct remoteconf *);
 extern void remrmconf (struct remoteconf *);
 extern void flushrmconf (void);
 extern void initrmconf (void);
+extern void rmconf_reload_begin (void);
+extern void rmconf_reload_abort (void);
+extern int rmconf_reload_commit (void);
+extern void rmconf_reload_release (void);
 extern struct etypes *check_etypeok
 	(struct remoteconf *, u_int8_t);
 extern struct remoteconf *foreachrmconf (rmconf_func_t rmconf_func,
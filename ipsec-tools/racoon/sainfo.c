@@ -65,8 +65,19 @@
 #include "algorithm.h"
 #include "sainfo.h"
 #include "gcmalloc.h"
+#include "cfsnapshot.h"
 
 static LIST_HEAD(_sitree, sainfo) sitree;
+static struct _sitree sitree_save;	/* running configuration, during a reload */
+
+/* one loaded from the snapshot is read in full once it is used */
+static struct sainfo *
+sainfo_ready(struct sainfo *s)
+{
+	if (s != NULL && cfsnapshot_sainfo(s) != 0)
+		return NULL;
+	return s;
+}
 
 /* %%%
  * modules for ipsec sa info
@@ -116,10 +127,10 @@ getsainfo(const vchar_t *src, const vchar_t *dst, const vchar_t *peer, int use_n
 			if (use_nat_addr) {
 				if (memcmp(lcconf->ext_nat_id->v, s->iddst->v, s->iddst->l) == 0) {
 					plogdump(ASL_LEVEL_DEBUG, lcconf->ext_nat_id->v, lcconf->ext_nat_id->l, "matched external nat address.\n");
-					return s;
+					return sainfo_ready(s);
 				}
 			} else if ((dst->l == s->iddst->l) && memcmp(dst->v, s->iddst->v, s->iddst->l) == 0) {
-				return s;
+				return sainfo_ready(s);
 			}
 		}
 	}
@@ -132,7 +143,7 @@ getsainfo(const vchar_t *src, const vchar_t *dst, const vchar_t *peer, int use_n
 		goto again;
 	}
 
-	return anonymous;
+	return sainfo_ready(anonymous);
 }
 
 /*
@@ -173,7 +184,7 @@ getsainfo_by_dst_id(const vchar_t *dst, const vchar_t *peer)
 		}
 
 		if (memcmp(dst->v, s->iddst->v, s->iddst->l) == 0)
-			return s;
+			return sainfo_ready(s);
 	}
 
 	if (anonymous) {
@@ -181,7 +192,7 @@ getsainfo_by_dst_id(const vchar_t *dst, const vchar_t *peer)
 			 "anonymous sainfo selected.\n");
 	}
 	
-	return anonymous;
+	return sainfo_ready(anonymous);
 }
 
 
@@ -291,6 +302,254 @@ void
 initsainfo()
 {
 	LIST_INIT(&sitree);
+	LIST_INIT(&sitree_save);
+}
+
+/*
+ * configuration reload, the same way as for remote configurations:
+ * sainfos read from the file are parsed into sitree beside the dynamic
+ * ones, the running ones wait aside in sitree_save, and those repeated
+ * unchanged are kept in place of their new copy.
+ */
+static int
+sainfo_cmpvchar(vchar_t *a, vchar_t *b)
+{
+	if (a == NULL || b == NULL)
+		return a != b;
+	if (a->l != b->l)
+		return 1;
+	return memcmp(a->v, b->v, a->l) != 0;
+}
+
+static int
+sainfo_equal(struct sainfo *a, struct sainfo *b)
+{
+	struct sainfoalg *aa, *ab;
+	int i;
+
+	if (sainfo_cmpvchar(a->idsrc, b->idsrc)
+	 || sainfo_cmpvchar(a->iddst, b->iddst)
+	 || sainfo_cmpvchar(a->id_i, b->id_i))
+		return 0;
+#ifdef ENABLE_HYBRID
+	if (sainfo_cmpvchar(a->group, b->group))
+		return 0;
+#endif
+	if (a->lifetime != b->lifetime
+	 || a->lifebyte != b->lifebyte
+	 || a->pfs_group != b->pfs_group)
+		return 0;
+	for (i = 0; i < MAXALGCLASS; i++) {
+		for (aa = a->algs[i], ab = b->algs[i]; aa && ab;
+		     aa = aa->next, ab = ab->next)
+			if (aa->alg != ab->alg || aa->encklen != ab->encklen)
+				return 0;
+		if (aa != ab)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * the saved sainfos, hashed by their identities, which any two equal
+ * ones share, so that each new sainfo is looked up once.
+ */
+struct sainfo_reload_node {
+	struct sainfo *sainfo;			/* NULL once kept */
+	struct sainfo_reload_node *next;
+};
+
+struct sainfo_reload_index {
+	struct sainfo_reload_node **bucket;
+	struct sainfo_reload_node *node;
+	u_int32_t mask;
+};
+
+static u_int32_t
+sainfo_reload_hashid(u_int32_t h, vchar_t *id)
+{
+	const u_int8_t *p;
+	size_t len;
+
+	if (id == NULL)
+		return h * 31;
+	for (p = (const u_int8_t *)id->v, len = id->l; len > 0; len--)
+		h = h * 31 + *p++;
+	return h * 31 + (u_int32_t)id->l;
+}
+
+static u_int32_t
+sainfo_reload_hash(struct sainfo *s)
+{
+	u_int32_t h = 0;
+
+	h = sainfo_reload_hashid(h, s->idsrc);
+	h = sainfo_reload_hashid(h, s->iddst);
+	h = sainfo_reload_hashid(h, s->id_i);
+	h ^= h >> 11;
+
+	return h;
+}
+
+/*
+ * without memory for the index, lookups walk sitree_save as they used to.
+ */
+static void
+sainfo_reload_index(struct sainfo_reload_index *idx)
+{
+	struct sainfo *old;
+	struct sainfo_reload_node **pp;
+	u_int32_t n = 0, size, i;
+
+	memset(idx, 0, sizeof(*idx));
+	LIST_FOREACH(old, &sitree_save, chain)
+		n++;
+	if (n == 0)
+		return;
+	for (size = 1; size < n; size <<= 1)
+		;
+	idx->bucket = racoon_calloc(size, sizeof(*idx->bucket));
+	idx->node = racoon_calloc(n, sizeof(*idx->node));
+	if (idx->bucket == NULL || idx->node == NULL) {
+		plog(ASL_LEVEL_WARNING, "no memory to index sainfos.\n");
+		if (idx->bucket)
+			racoon_free(idx->bucket);
+		if (idx->node)
+			racoon_free(idx->node);
+		memset(idx, 0, sizeof(*idx));
+		return;
+	}
+	idx->mask = size - 1;
+
+	i = 0;
+	LIST_FOREACH(old, &sitree_save, chain)
+		idx->node[i++].sainfo = old;
+	/* keep each bucket in list order: the first equal sainfo wins */
+	while (i-- > 0) {
+		pp = &idx->bucket[sainfo_reload_hash(idx->node[i].sainfo) & idx->mask];
+		idx->node[i].next = *pp;
+		*pp = &idx->node[i];
+	}
+}
+
+static struct sainfo *
+sainfo_reload_find(struct sainfo_reload_index *idx, struct sainfo *s)
+{
+	struct sainfo_reload_node *n;
+	struct sainfo *old;
+
+	if (idx->bucket == NULL) {
+		LIST_FOREACH(old, &sitree_save, chain) {
+			if (sainfo_equal(old, s))
+				return old;
+		}
+		return NULL;
+	}
+	for (n = idx->bucket[sainfo_reload_hash(s) & idx->mask]; n; n = n->next) {
+		if (n->sainfo != NULL && sainfo_equal(n->sainfo, s)) {
+			old = n->sainfo;
+			n->sainfo = NULL;
+			return old;
+		}
+	}
+	return NULL;
+}
+
+void
+sainfo_reload_begin(void)
+{
+	struct sainfo *s, *next;
+
+	LIST_FOREACH_SAFE(s, &sitree, chain, next) {
+		if (s->dynamic == 0) {
+			remsainfo(s);
+			LIST_INSERT_HEAD(&sitree_save, s, chain);
+		}
+	}
+}
+
+void
+sainfo_reload_abort(void)
+{
+	struct sainfo *s;
+
+	flushsainfo();
+	while ((s = LIST_FIRST(&sitree_save)) != NULL) {
+		LIST_REMOVE(s, chain);
+		inssainfo(s);
+	}
+}
+
+/*
+ * returns the number of old sainfos that went stale.
+ */
+int
+sainfo_reload_commit(void)
+{
+	struct sainfo_reload_index idx;
+	struct sainfo *s, *next, *old;
+	int kept = 0, added = 0, stale = 0;
+
+	sainfo_reload_index(&idx);
+	LIST_FOREACH_SAFE(s, &sitree, chain, next) {
+		if (s->dynamic != 0)
+			continue;
+		if ((old = sainfo_reload_find(&idx, s)) == NULL) {
+			added++;
+			continue;
+		}
+		LIST_REMOVE(old, chain);
+		LIST_INSERT_BEFORE(s, old, chain);
+		old->in_list = 1;
+		remsainfo(s);
+		release_sainfo(s);
+		kept++;
+	}
+	if (idx.bucket) {
+		racoon_free(idx.bucket);
+		racoon_free(idx.node);
+	}
+
+	LIST_FOREACH(old, &sitree_save, chain) {
+		old->stale = 1;
+		stale++;
+	}
+
+	plog(ASL_LEVEL_NOTICE,
+		"sainfos: %d unchanged, %d new, %d changed or removed.\n",
+		kept, added, stale);
+
+	return stale;
+}
+
+void
+sainfo_reload_release(void)
+{
+	struct sainfo *s;
+
+	while ((s = LIST_FIRST(&sitree_save)) != NULL) {
+		LIST_REMOVE(s, chain);
+		if (--(s->refcount) <= 0)
+			delsainfo(s);
+	}
+}
+
+/*
+ * newest first.
+ */
+struct sainfo *
+foreachsainfo(sainfo_func_t sainfo_func, void *data)
+{
+	struct sainfo *s, *ret = NULL;
+
+	LIST_FOREACH(s, &sitree, chain) {
+		ret = (*sainfo_func)(s, data);
+		if (ret)
+			break;
+	}
+
+	return ret;
 }
 
 struct sainfoalg *
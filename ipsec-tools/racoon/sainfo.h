@@ -58,6 +58,8 @@ struct sainfo {
     int	dynamic;		/* created through vpn control socket */
     int in_list;
     int refcount;
+    int stale;			/* replaced by a configuration reload */
+    const void *snapshot;	/* algs still to be read from the snapshot */
     LIST_ENTRY(sainfo) chain;
 };
 
@@ -80,6 +82,12 @@ void release_sainfo(struct sainfo *si);
 extern void flushsainfo (void);
 extern void flushsainfo_dynamic (u_int32_t);
 extern void initsainfo (void);
+extern void sainfo_reload_begin (void);
+extern void sainfo_reload_abort (void);
+extern int sainfo_reload_commit (void);
+extern void sainfo_reload_release (void);
+typedef struct sainfo *(sainfo_func_t) (struct sainfo *, void *);
+extern struct sainfo *foreachsainfo (sainfo_func_t, void *);
 extern struct sainfoalg *newsainfoalg (void);
 extern void delsainfoalg (struct sainfoalg *);
 extern void inssainfoalg (struct sainfoalg **, struct sainfoalg *);
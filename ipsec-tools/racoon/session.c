@@ -90,6 +90,11 @@
 #include "isakmp_xauth.h"
 #include "isakmp_cfg.h"
 #include "oakley.h"
+#include "shard.h"
+#include "metrics.h"
+#include "pkttrace.h"
+#include "certcache.h"
+#include "rekeysched.h"
 #include "pfkey.h"
 #include "handler.h"
 #include "localconf.h"
@@ -273,8 +278,13 @@ session(void)
 		plog(ASL_LEVEL_ERR, "failed to initialize isakmp");
 		exit(1);
 	}    
+	if (shard_init()) {
+		plog(ASL_LEVEL_ERR, "failed to initialize the shards.\n");
+		exit(1);
+	}
 #ifdef ENABLE_VPNCONTROL_PORT
-	if (vpncontrol_init()) {
+	/* shard 0 takes the clients for all of them */
+	if (shard_index == 0 && vpncontrol_init()) {
 		plog(ASL_LEVEL_ERR, "failed to initialize vpn control port");
 		//exit(1);
 	}
@@ -289,7 +299,7 @@ session(void)
 		sigreq[i] = 0;
 
 	/* write .pid file */
-	if (!f_foreground) {
+	if (!f_foreground && shard_index == 0) {
 		racoon_pid = getpid();
 		if (lcconf->pathinfo[LC_PATHTYPE_PIDFILE] == NULL) 
 			strlcpy(pid_file, _PATH_VARRUN "racoon.pid", sizeof(pid_file));
@@ -319,7 +329,8 @@ session(void)
 	
 #if !TARGET_OS_EMBEDDED
 	// enable keepalive for recovery (from crashes and bad exits... after init)
-	(void)launchd_update_racoon_keepalive(true);
+	if (shard_index == 0)
+		(void)launchd_update_racoon_keepalive(true);
 #endif // !TARGET_OS_EMBEDDED
 		
     // Off to the races!
@@ -341,12 +352,14 @@ close_session(int error)
 		ike_session_flush_all_phase2(false);
 	ike_session_flush_all_phase1(false);
 	close_sockets();
+	pkttrace_stop();
 
 	xpc_transaction_end();
 	
 #if !TARGET_OS_EMBEDDED
 	// a clean exit, so disable launchd keepalive
-	(void)launchd_update_racoon_keepalive(false);
+	if (shard_index == 0)
+		(void)launchd_update_racoon_keepalive(false);
 #endif // !TARGET_OS_EMBEDDED
 
 	plog(ASL_LEVEL_NOTICE, "racoon shutdown\n");
@@ -395,7 +408,7 @@ check_flushsa()
 			continue;
 		}
 
-		if (pfkey_align(msg, mhp) || pfkey_check(mhp)) {
+		if (pfkey_parse(msg, (caddr_t)end - (caddr_t)msg, mhp)) {
 			plog(ASL_LEVEL_ERR, 
 				"pfkey_check (%s)\n", ipsec_strerror());
 			msg = next;
@@ -497,6 +510,7 @@ check_sigreq()
 			continue;
         
 		sigreq[sig]--;
+		shard_signal(sig);	/* the workers do the same */
 		switch(sig) {
             case 0:
                 return;
@@ -518,15 +532,10 @@ check_sigreq()
                     break;
 				
                 /*
-                 * if we got a HUP... try graceful teardown of sessions before we close and reopen sockets...
-                 * so that info-deletes notifications can make it to the peer.
+                 * Load the new configuration beside the old one; sessions
+                 * whose configuration changed are torn down (with delete
+                 * notifications) by cfreparse, the others are left alone.
                  */
-                if (sig == SIGHUP) {
-                    ike_session_flush_all_phase2(true);
-                    ike_session_flush_all_phase1(true);
-                }		
-
-                /* Save old configuration, load new one...  */
                 if (cfreparse(sig)) {
                     plog(ASL_LEVEL_ERR, 
                          "configuration read failed\n");
@@ -572,6 +581,12 @@ check_sigreq()
 				dying();
 #endif /* ENABLE_NO_SA_FLUSH */
                 break;
+
+            case SIGUSR2:
+                metrics_dump();
+                certcache_dump();
+                rekeysched_dump();
+                break;
                 
             default:
                 plog(ASL_LEVEL_NOTICE, 
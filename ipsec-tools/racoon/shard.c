@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <netinet/in.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <dispatch/dispatch.h>
+
+#include "var.h"
+#include "misc.h"
+#include "vmbuf.h"
+#include "plog.h"
+#include "debug.h"
+
+#include "isakmp_var.h"
+#include "isakmp.h"
+#include "vpn_control.h"
+#include "vpn_control_var.h"
+#include "shard.h"
+
+extern char **environ;
+
+/*
+ * every pair of shards has its own socketpair.  shard 0 makes them all,
+ * and each worker finds its ends at SHARD_FD_BASE + the other shard's
+ * index.  the base is above anything open at startup, so that the
+ * dup2()s done by posix_spawn never clobber each other.
+ */
+#define SHARD_FD_BASE	128
+#define SHARD_SOCKBUF	(256 * 1024)	/* also the largest message */
+#define SHARD_MAXARGS	32
+
+struct shard_hdr {
+	struct sockaddr_storage remote;	/* SHARD_MSG_PACKET */
+	struct sockaddr_storage local;
+	u_int16_t type;			/* SHARD_MSG_* */
+	u_int16_t from;			/* sending shard */
+	u_int32_t id;			/* VPN control client */
+	u_int32_t len;			/* of what follows */
+	u_int32_t reserved;
+};
+
+#define SHARD_MSGMAX	(sizeof(struct shard_hdr) + 0x10000)
+
+int shard_index = 0;
+int shard_count = 1;
+
+static int shard_fds[SHARD_MAX];		/* to each other shard, -1 for us */
+static pid_t shard_pids[SHARD_MAX];	/* the workers, in shard 0 */
+static dispatch_source_t shard_sources[SHARD_MAX];
+static dispatch_source_t shard_watch[SHARD_MAX];
+static char *shard_msgbuf;
+
+static void shard_handler (int);
+static void shard_exited (int);
+static int shard_write (int, struct shard_hdr *, const void *, size_t);
+
+/*
+ * set the number of shards and our own index, from -N and -S.
+ */
+int
+shard_setup(int count, int index)
+{
+	int i;
+
+	if (count < 1 || count > SHARD_MAX || index < 0 || index >= count)
+		return -1;
+
+	shard_count = count;
+	shard_index = index;
+	for (i = 0; i < SHARD_MAX; i++) {
+		shard_fds[i] = -1;
+		if (index != 0 && i < count && i != index)
+			shard_fds[i] = SHARD_FD_BASE + i;
+	}
+	return 0;
+}
+
+/*
+ * in shard 0, start the other shards: the same command line with
+ * "-S index" added, and the ends of the socketpairs to their peers.
+ */
+int
+shard_spawn(char **av)
+{
+	int ends[SHARD_MAX][SHARD_MAX];
+	char *args[SHARD_MAXARGS + 3];
+	char index[16];
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
+	const char *path;
+	int i, j, ac, sv[2];
+	int error = -1;
+
+	if (shard_count == 1 || shard_index != 0)
+		return 0;
+
+	for (i = 0; i < SHARD_MAX; i++)
+		for (j = 0; j < SHARD_MAX; j++)
+			ends[i][j] = -1;
+
+	for (ac = 0; av[ac] != NULL; ac++) {
+		if (ac == SHARD_MAXARGS) {
+			plog(ASL_LEVEL_ERR, "too many arguments to start the shards.\n");
+			goto end;
+		}
+		args[ac] = av[ac];
+	}
+	args[ac] = "-S";
+	args[ac + 1] = index;
+	args[ac + 2] = NULL;
+	path = strchr(av[0], '/') != NULL ? av[0] : PATHRACOON;
+
+	for (i = 0; i < shard_count; i++) {
+		for (j = i + 1; j < shard_count; j++) {
+			if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0) {
+				plog(ASL_LEVEL_ERR,
+					"socketpair for the shards failed: %s\n", strerror(errno));
+				goto end;
+			}
+			ends[i][j] = sv[0];
+			ends[j][i] = sv[1];
+			if (sv[0] >= SHARD_FD_BASE || sv[1] >= SHARD_FD_BASE) {
+				plog(ASL_LEVEL_ERR, "too many descriptors open to start the shards.\n");
+				goto end;
+			}
+			fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+			fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+		}
+	}
+
+	for (i = 1; i < shard_count; i++) {
+		snprintf(index, sizeof(index), "%d", i);
+
+		posix_spawnattr_init(&attr);
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_CLOEXEC_DEFAULT);
+		posix_spawn_file_actions_init(&actions);
+		for (j = STDIN_FILENO; j <= STDERR_FILENO; j++)
+			posix_spawn_file_actions_addinherit_np(&actions, j);
+		for (j = 0; j < shard_count; j++)
+			if (j != i)
+				posix_spawn_file_actions_adddup2(&actions,
+					ends[i][j], SHARD_FD_BASE + j);
+
+		error = posix_spawn(&shard_pids[i], path, &actions, &attr, args, environ);
+		posix_spawn_file_actions_destroy(&actions);
+		posix_spawnattr_destroy(&attr);
+		if (error != 0) {
+			plog(ASL_LEVEL_ERR,
+				"failed to start shard %d: %s\n", i, strerror(error));
+			error = -1;
+			goto end;
+		}
+		plog(ASL_LEVEL_NOTICE, "started shard %d: pid=%d\n", i, shard_pids[i]);
+	}
+
+	for (j = 1; j < shard_count; j++) {
+		shard_fds[j] = ends[0][j];
+		ends[0][j] = -1;
+	}
+	error = 0;
+
+end:
+	for (i = 0; i < SHARD_MAX; i++)
+		for (j = 0; j < SHARD_MAX; j++)
+			if (ends[i][j] != -1)
+				close(ends[i][j]);
+	if (error != 0)
+		shard_signal(SIGTERM);
+	return error;
+}
+
+/*
+ * listen to the other shards, and stop when shard 0 or any worker goes
+ * away: a partial set of shards would drop the sessions of the missing
+ * ones on the floor.
+ */
+int
+shard_init(void)
+{
+	dispatch_source_t source;
+	int bufsiz = SHARD_SOCKBUF;
+	pid_t pid;
+	int i;
+
+	if (shard_count == 1)
+		return 0;
+
+	if ((shard_msgbuf = racoon_malloc(SHARD_MSGMAX)) == NULL) {
+		plog(ASL_LEVEL_ERR, "failed to allocate the shard buffer.\n");
+		return -1;
+	}
+
+	for (i = 0; i < shard_count; i++) {
+		if (shard_fds[i] == -1)
+			continue;
+
+		fcntl(shard_fds[i], F_SETFD, FD_CLOEXEC);
+		fcntl(shard_fds[i], F_SETFL, O_NONBLOCK);
+		/* on a UNIX datagram socket this also bounds the message size */
+		setsockopt(shard_fds[i], SOL_SOCKET, SO_SNDBUF, &bufsiz, sizeof(bufsiz));
+		setsockopt(shard_fds[i], SOL_SOCKET, SO_RCVBUF, &bufsiz, sizeof(bufsiz));
+
+		source = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ,
+			shard_fds[i], 0, dispatch_get_main_queue());
+		if (source == NULL) {
+			plog(ASL_LEVEL_ERR, "could not create shard socket source.\n");
+			return -1;
+		}
+		dispatch_source_set_event_handler(source,
+			^{
+				shard_handler(i);
+			});
+		dispatch_resume(source);
+		shard_sources[i] = source;
+	}
+
+	for (i = 0; i < shard_count; i++) {
+		if (i == shard_index || (shard_index != 0 && i != 0))
+			continue;
+
+		pid = shard_index == 0 ? shard_pids[i] : getppid();
+		if (pid <= 1) {
+			plog(ASL_LEVEL_ERR, "shard %d is already gone.\n", i);
+			return -1;
+		}
+		source = dispatch_source_create(DISPATCH_SOURCE_TYPE_PROC,
+			pid, DISPATCH_PROC_EXIT, dispatch_get_main_queue());
+		if (source == NULL) {
+			plog(ASL_LEVEL_ERR, "could not create shard process source.\n");
+			return -1;
+		}
+		dispatch_source_set_event_handler(source,
+			^{
+				shard_exited(i);
+			});
+		dispatch_resume(source);
+		shard_watch[i] = source;
+	}
+
+	plog(ASL_LEVEL_NOTICE, "running as shard %d of %d.\n",
+		shard_index, shard_count);
+	return 0;
+}
+
+static void
+shard_exited(int shard)
+{
+	dispatch_source_cancel(shard_watch[shard]);
+	shard_watch[shard] = NULL;
+	if (shard_index == 0)
+		shard_pids[shard] = 0;
+
+	plog(ASL_LEVEL_ERR, "shard %d exited, stopping.\n", shard);
+	kill(getpid(), SIGTERM);
+}
+
+/*
+ * in shard 0, pass a signal on to the workers, so that a reload or a
+ * stop applies to all of them.
+ */
+void
+shard_signal(int sig)
+{
+	int i;
+
+	if (shard_index != 0 || sig <= 0)
+		return;
+
+	for (i = 1; i < shard_count; i++)
+		if (shard_pids[i] > 0)
+			kill(shard_pids[i], sig);
+}
+
+/*
+ * FNV-1a, which spreads cookies and addresses well enough, and is the
+ * same in every shard.
+ */
+int
+shard_of_key(const void *key, size_t len)
+{
+	const u_int8_t *p = key;
+	u_int32_t h = 2166136261U;
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= 16777619U;
+	}
+	return h % shard_count;
+}
+
+int
+shard_of_cookie(const void *ck)
+{
+	return shard_of_key(ck, sizeof(cookie_t));
+}
+
+int
+shard_of_addr(const struct sockaddr_storage *addr)
+{
+	switch (addr->ss_family) {
+	case AF_INET:
+		return shard_of_key(&((const struct sockaddr_in *)addr)->sin_addr,
+			sizeof(struct in_addr));
+#ifdef INET6
+	case AF_INET6:
+		return shard_of_key(&((const struct sockaddr_in6 *)addr)->sin6_addr,
+			sizeof(struct in6_addr));
+#endif
+	default:
+		return 0;
+	}
+}
+
+/*
+ * pass a received IKE packet on to the shard its initiator cookie
+ * belongs to.
+ * OUT:
+ *	0: the packet is ours.
+ *	1: it was passed on, or dropped.
+ */
+int
+shard_steer(vchar_t *buf, struct sockaddr_storage *remote, struct sockaddr_storage *local)
+{
+	struct shard_hdr hdr;
+	int to;
+
+	if (shard_count == 1 || buf->l < sizeof(struct isakmp))
+		return 0;
+
+	to = shard_of_cookie(buf->v);	/* i_ck leads the header */
+	if (to == shard_index)
+		return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.type = SHARD_MSG_PACKET;
+	memcpy(&hdr.remote, remote, sizeof(hdr.remote));
+	memcpy(&hdr.local, local, sizeof(hdr.local));
+	(void)shard_write(to, &hdr, buf->v, buf->l);
+	return 1;
+}
+
+/*
+ * send a VPN control message to another shard.
+ */
+int
+shard_send(int to, int type, u_int32_t id, const void *data, size_t len)
+{
+	struct shard_hdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.type = type;
+	hdr.id = id;
+	return shard_write(to, &hdr, data, len);
+}
+
+/*
+ * the socketpairs don't block: when one is full the message is dropped,
+ * which IKE copes with as with any lost packet.
+ */
+static int
+shard_write(int to, struct shard_hdr *hdr, const void *data, size_t len)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	if (to < 0 || to >= shard_count || shard_fds[to] == -1)
+		return -1;
+
+	hdr->from = shard_index;
+	hdr->len = len;
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(*hdr);
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	while (sendmsg(shard_fds[to], &msg, 0) < 0) {
+		if (errno == EINTR)
+			continue;
+		plog(ASL_LEVEL_ERR,
+			"failed to pass a message to shard %d: %s\n", to, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void
+shard_handler(int peer)
+{
+	struct shard_hdr *hdr = ALIGNED_CAST(struct shard_hdr *)shard_msgbuf;
+	vchar_t *buf;
+	ssize_t len;
+
+	while ((len = recv(shard_fds[peer], shard_msgbuf, SHARD_MSGMAX, 0)) < 0) {
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			plog(ASL_LEVEL_ERR,
+				"failed to receive from shard %d: %s\n", peer, strerror(errno));
+		return;
+	}
+
+	if (len < sizeof(*hdr) || hdr->len != len - sizeof(*hdr)) {
+		plog(ASL_LEVEL_ERR,
+			"invalid message from shard %d (%zd bytes)\n", peer, len);
+		return;
+	}
+
+	switch (hdr->type) {
+	case SHARD_MSG_PACKET:
+		if ((buf = vmalloc(hdr->len)) == NULL) {
+			plog(ASL_LEVEL_ERR,
+				"failed to allocate reading buffer (%u Bytes)\n", hdr->len);
+			break;
+		}
+		memcpy(buf->v, hdr + 1, hdr->len);
+		isakmp_input(buf, &hdr->remote, &hdr->local);
+		vfree(buf);
+		break;
+
+#ifdef ENABLE_VPNCONTROL_PORT
+	case SHARD_MSG_VPNCTL:
+		vpncontrol_relay_cmd(hdr->id, (char *)(hdr + 1), hdr->len);
+		break;
+
+	case SHARD_MSG_VPNCTL_OUT:
+		vpncontrol_relay_out(hdr->id, (char *)(hdr + 1), hdr->len);
+		break;
+
+	case SHARD_MSG_VPNCTL_CLOSE:
+		vpncontrol_relay_close(hdr->id);
+		break;
+#endif
+
+	default:
+		plog(ASL_LEVEL_ERR,
+			"unknown message %d from shard %d\n", hdr->type, peer);
+		break;
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _SHARD_H
+#define _SHARD_H
+
+/*
+ * Sharded IKE processing.
+ *
+ * With -N workers, racoon runs as that many processes.  The first one
+ * (shard 0) spawns the others with the same arguments.  Each shard
+ * parses the configuration, opens its own PF_KEY socket and binds its
+ * own SO_REUSEPORT IKE sockets, and owns its phase 1 and phase 2
+ * handles, timers and retransmit cache; nothing is shared but the
+ * kernel.  A phase 1 belongs to the shard picked by its initiator
+ * cookie: a shard reading a packet for another one passes it on over
+ * a socketpair, and our own initiator cookies are drawn so that they
+ * map to the shard that makes them.  Exchanges we start, and SADB
+ * ACQUIREs, go to the shard picked by the peer address.  Only shard 0
+ * listens on the VPN control socket; it passes commands on and relays
+ * the answers and notifications back.
+ */
+#define SHARD_MAX		8
+
+/* messages between shards */
+#define SHARD_MSG_PACKET		1	/* an IKE packet for the shard */
+#define SHARD_MSG_VPNCTL		2	/* a VPN control command */
+#define SHARD_MSG_VPNCTL_OUT	3	/* reply or notification to a client */
+#define SHARD_MSG_VPNCTL_CLOSE	4	/* the client went away */
+
+extern int shard_index;		/* this process */
+extern int shard_count;		/* number of processes, 1 when not sharded */
+
+extern int shard_setup (int, int);
+extern int shard_spawn (char **);
+extern int shard_init (void);
+extern void shard_signal (int);
+extern int shard_of_key (const void *, size_t);
+extern int shard_of_cookie (const void *);
+extern int shard_of_addr (const struct sockaddr_storage *);
+extern int shard_steer (vchar_t *, struct sockaddr_storage *,
+	struct sockaddr_storage *);
+extern int shard_send (int, int, u_int32_t, const void *, size_t);
+
+#endif /* _SHARD_H */
@@ -64,6 +64,7 @@
 #include "debug.h"
 #include "gcmalloc.h"
 #include "libpfkey.h"
+#include "pkttrace.h"
 
 #ifndef IP_IPSEC_POLICY
 #define IP_IPSEC_POLICY 16	/* XXX: from linux/in.h */
@@ -538,16 +539,47 @@ recvfromto(int s,
 	return len;
 }
 
+static sendsink_func_t *sendsink;
+
+void
+setsendsink(func)
+	sendsink_func_t *func;
+{
+	sendsink = func;
+}
+
 /* send packet, with fixing src/dst address pair. */
 int
-sendfromto(s, buf, buflen, src, dst, cnt)
-	int s, cnt;
+sendfromto(ss, buf, buflen, src, dst, cnt)
+	const struct sendsock *ss;
+	int cnt;
 	const void *buf;
 	size_t buflen;
 	struct sockaddr_storage *src;
 	struct sockaddr_storage *dst;
 {
-	struct sockaddr_storage ss;
+	struct iovec iov;
+
+	iov.iov_base = (void *)buf;
+	iov.iov_len = buflen;
+
+	return sendvfromto(ss, &iov, 1, src, dst, cnt);
+}
+
+/*
+ * send packet gathered from a list of segments, with fixing src/dst
+ * address pair.
+ */
+int
+sendvfromto(ss, iov, iovcnt, src, dst, cnt)
+	const struct sendsock *ss;
+	int cnt;
+	struct iovec *iov;
+	int iovcnt;
+	struct sockaddr_storage *src;
+	struct sockaddr_storage *dst;
+{
+	int s = ss->sock;
 	int len;
 	int i;
 
@@ -557,21 +589,16 @@ sendfromto(s, buf, buflen, src, dst, cnt)
 		return -1;
 	}
 
-	len = sizeof(ss);
-	if (getsockname(s, (struct sockaddr *)&ss, (socklen_t*)&len) < 0) {
-		plog(ASL_LEVEL_ERR, 
-			"getsockname (%s)\n", strerror(errno));
-		return -1;
-	}
+	plog(ASL_LEVEL_DEBUG, "send packet %s (fd=%d)\n",
+		saddr2str_fromto("from %s to %s", (struct sockaddr *)src,
+		    (struct sockaddr *)dst), s);
 
-	plog(ASL_LEVEL_DEBUG, 
-		"sockname %s\n", saddr2str((struct sockaddr *)&ss));
-	plog(ASL_LEVEL_DEBUG, 
-		"send packet from %s\n", saddr2str((struct sockaddr *)src));
-	plog(ASL_LEVEL_DEBUG, 
-		"send packet to %s\n", saddr2str((struct sockaddr *)dst));
+	PKTTRACEV(PKTTRACE_OUT, iov, iovcnt, dst, src);
 
-	if (src->ss_family != ss.ss_family) {
+	if (sendsink != NULL)
+		return (*sendsink)(iov, iovcnt, src, dst);
+
+	if (src->ss_family != ss->family) {
 		plog(ASL_LEVEL_ERR, 
 			"address family mismatch\n");
 		return -1;
@@ -583,7 +610,6 @@ sendfromto(s, buf, buflen, src, dst, cnt)
 	    {
 		struct msghdr m;
 		struct cmsghdr *cm;
-		struct iovec iov[2];
         u_int32_t cmsgbuf[256/sizeof(u_int32_t)];   // Wcast-align fix - force 32 bit alignment
 		struct in6_pktinfo *pi;
 		int ifindex;
@@ -607,10 +633,8 @@ sendfromto(s, buf, buflen, src, dst, cnt)
 		memset(&m, 0, sizeof(m));
 		m.msg_name = (caddr_t)&dst6;
 		m.msg_namelen = sizeof(dst6);
-		iov[0].iov_base = (char *)buf;
-		iov[0].iov_len = buflen;
 		m.msg_iov = iov;
-		m.msg_iovlen = 1;
+		m.msg_iovlen = iovcnt;
 
 		memset(cmsgbuf, 0, sizeof(cmsgbuf));
 		cm = (struct cmsghdr *)cmsgbuf;
@@ -656,10 +680,11 @@ sendfromto(s, buf, buflen, src, dst, cnt)
 #endif
 	default:
 	    {
+		struct msghdr m;
 		int needclose = 0;
 		int sendsock;
 
-		if (ss.ss_family == src->ss_family && memcmp(&ss, src, sysdep_sa_len((struct sockaddr *)src)) == 0) {
+		if (ss->exact) {
 			sendsock = s;
 			needclose = 0;
 		} else {
@@ -713,14 +738,22 @@ sendfromto(s, buf, buflen, src, dst, cnt)
 			}
 			needclose = 1;
 		}
- 
-        plogdump(ASL_LEVEL_DEBUG, (void*)buf, buflen, "@@@@@@ data being sent:\n");
-		
-            for (i = 0; i < cnt; i++) {
-			len = sendto(sendsock, buf, buflen, 0, (struct sockaddr *)dst, sysdep_sa_len((struct sockaddr *)dst));
+
+		for (i = 0; i < iovcnt; i++)
+			plogdump(ASL_LEVEL_DEBUG, iov[i].iov_base, iov[i].iov_len,
+			    "@@@@@@ data being sent (segment %d):\n", i);
+
+		memset(&m, 0, sizeof(m));
+		m.msg_name = (caddr_t)dst;
+		m.msg_namelen = sysdep_sa_len((struct sockaddr *)dst);
+		m.msg_iov = iov;
+		m.msg_iovlen = iovcnt;
+
+		for (i = 0; i < cnt; i++) {
+			len = sendmsg(sendsock, &m, 0);
 			if (len < 0) {
 				plog(ASL_LEVEL_ERR, 
-					"sendto (%s)\n", strerror(errno));
+					"sendmsg (%s)\n", strerror(errno));
 				if (errno != EHOSTUNREACH && errno != ENETDOWN && errno != ENETUNREACH) {
 				        if (needclose)
 					        close(sendsock);
@@ -61,8 +61,32 @@ extern struct sockaddr_storage *getlocaladdr (struct sockaddr *);
 
 extern int recvfromto (int, void *, size_t, int,
 	struct sockaddr_storage *, socklen_t *, struct sockaddr_storage *, unsigned int *);
-extern int sendfromto (int, const void *, size_t,
+/*
+ * socket to send from for a local address, resolved once and kept by
+ * its user (see getsockmyaddr_cached()) instead of being looked up and
+ * checked with getsockname() on every send.
+ */
+struct sendsock {
+	int sock;
+	int family;			/* family the socket is bound to */
+	int exact;			/* bound to the local address itself */
+	u_int32_t gen;			/* myaddrs_gen when resolved */
+	struct sockaddr_storage addr;	/* local address it was resolved for */
+};
+
+extern int sendfromto (const struct sendsock *, const void *, size_t,
 	struct sockaddr_storage *, struct sockaddr_storage *, int);
+struct iovec;
+extern int sendvfromto (const struct sendsock *, struct iovec *, int,
+	struct sockaddr_storage *, struct sockaddr_storage *, int);
+
+/*
+ * when a sink is set, sendvfromto() hands every packet to it instead of
+ * the network.  used to replay captured traffic.
+ */
+typedef int (sendsink_func_t) (struct iovec *, int,
+	struct sockaddr_storage *, struct sockaddr_storage *);
+extern void setsendsink (sendsink_func_t *);
 
 extern int setsockopt_bypass (int, int);
 
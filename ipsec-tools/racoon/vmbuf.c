@@ -37,6 +37,7 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
+#include <sys/uio.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -49,6 +50,21 @@
 #include "plog.h"
 #include "gcmalloc.h"
 
+struct vmarena_chunk {
+	struct vmarena_chunk *next;
+	size_t size;		/* length of the data area */
+	size_t used;
+	/* data follows */
+};
+
+#define VMARENA_ALIGN(x)	(((x) + 15) & ~(size_t)15)
+#define VMARENA_HDRLEN		VMARENA_ALIGN(sizeof(struct vmarena_chunk))
+#define VMARENA_DATA(c)		((caddr_t)(c) + VMARENA_HDRLEN)
+
+struct vmbuf_stats vmbuf_stats;
+
+static void varena_put (vchar_t *);
+
 vchar_t *
 vmalloc(size)
 	size_t size;
@@ -58,6 +74,8 @@ vmalloc(size)
 	if ((var = (vchar_t *)racoon_malloc(sizeof(*var))) == NULL)
 		return NULL;
 
+	vmbuf_stats.heap_allocs++;
+	var->arena = NULL;
 	var->l = size;
 	if (size == 0) {
 		var->v = NULL;
@@ -79,6 +97,19 @@ vrealloc(ptr, size)
 {
 	caddr_t v;
 	
+	if (ptr != NULL && ptr->arena != NULL) {
+		vchar_t *new;
+
+		/* grow within the same arena; the tail is zero already */
+		if ((new = varena_alloc(ptr->arena, size)) == NULL) {
+			varena_put(ptr);
+			return NULL;
+		}
+		memcpy(new->v, ptr->v, ptr->l < size ? ptr->l : size);
+		varena_put(ptr);
+		return new;
+	}
+
 	if (ptr != NULL) {
 		if (ptr->l == 0) {
 			(void)vfree(ptr);
@@ -109,6 +140,11 @@ vfree(var)
 	if (var == NULL)
 		return;
 
+	if (var->arena != NULL) {
+		varena_put(var);
+		return;
+	}
+
 	if (var->v)
 		(void)racoon_free(var->v);
 
@@ -136,6 +172,34 @@ vdup(src)
 	return new;
 }
 
+/*
+ * concatenate a list of segments into a new buffer.
+ */
+vchar_t *
+vgather(iov, iovcnt)
+	const struct iovec *iov;
+	int iovcnt;
+{
+	vchar_t *new;
+	size_t len = 0;
+	caddr_t p;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if ((new = vmalloc(len)) == NULL)
+		return NULL;
+
+	p = new->v;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(p, iov[i].iov_base, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
+
+	return new;
+}
+
 vchar_t *
 vnew(in, in_len)
 	u_int8_t *in;
@@ -154,3 +218,185 @@ vnew(in, in_len)
 
 	return new;
 }
+
+/*
+ * allocate a zero-filled buffer from the arena.
+ * the vchar_t header and the value share one bump allocation.
+ */
+vchar_t *
+varena_alloc(arena, size)
+	struct vmarena *arena;
+	size_t size;
+{
+	struct vmarena_chunk *chunk;
+	vchar_t *var;
+	size_t need, csize;
+
+	/* the exchange is over: a chunk would be wiped for every buffer */
+	if (arena->released)
+		return vmalloc(size);
+
+	need = VMARENA_ALIGN(sizeof(*var)) + VMARENA_ALIGN(size);
+
+	chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < need) {
+		csize = need > VMARENA_CHUNKSIZE ? need : VMARENA_CHUNKSIZE;
+		chunk = racoon_calloc(1, VMARENA_HDRLEN + csize);
+		if (chunk == NULL) {
+			plog(ASL_LEVEL_ERR, "failed to get arena chunk.\n");
+			return NULL;
+		}
+		chunk->size = csize;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->nchunks++;
+		vmbuf_stats.arena_chunks++;
+	}
+
+	var = ALIGNED_CAST(vchar_t *)(VMARENA_DATA(chunk) + chunk->used);
+	chunk->used += need;
+
+	var->arena = arena;
+	var->l = size;
+	var->v = size ? (caddr_t)var + VMARENA_ALIGN(sizeof(*var)) : NULL;
+
+	arena->live++;
+	arena->nallocs++;
+	vmbuf_stats.arena_allocs++;
+
+	arena->inuse += need;
+	if (arena->inuse > arena->peak)
+		arena->peak = arena->inuse;
+
+	return var;
+}
+
+vchar_t *
+varena_dup(arena, src)
+	struct vmarena *arena;
+	vchar_t *src;
+{
+	vchar_t *new;
+
+	if (src == NULL) {
+		plog(ASL_LEVEL_ERR, "varena_dup(NULL) called\n");
+		return NULL;
+	}
+
+	if ((new = varena_alloc(arena, src->l)) == NULL)
+		return NULL;
+
+	memcpy(new->v, src->v, src->l);
+
+	return new;
+}
+
+/*
+ * move key material built in an arena onto the heap before it is
+ * stored in a long-lived structure.  the arena copy is wiped right
+ * away rather than when the rest of the chunk goes.  heap buffers
+ * are returned as is.  on failure the arena copy is wiped and freed
+ * all the same.
+ */
+vchar_t *
+vpromote(var)
+	vchar_t *var;
+{
+	vchar_t *new;
+
+	if (var == NULL || var->arena == NULL)
+		return var;
+
+	new = vdup(var);
+	vwipe(var);
+	if (new != NULL)
+		vmbuf_stats.promotions++;
+
+	return new;
+}
+
+/*
+ * zero and free a buffer which held secrets.  arena chunks are only
+ * wiped once nothing in them is live, which can be a while.
+ */
+void
+vwipe(var)
+	vchar_t *var;
+{
+	if (var == NULL)
+		return;
+	if (var->v != NULL)
+		memset(var->v, 0, var->l);
+	vfree(var);
+}
+
+/*
+ * wipe the chunks and keep only the largest one for reuse.
+ */
+static void
+varena_reset(arena)
+	struct vmarena *arena;
+{
+	struct vmarena_chunk *chunk, *next, *keep = NULL;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+		if (keep == NULL || chunk->size > keep->size)
+			keep = chunk;
+	}
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		memset(VMARENA_DATA(chunk), 0, chunk->used);
+		chunk->used = 0;
+		if (chunk != keep)
+			racoon_free(chunk);
+	}
+	if (keep != NULL)
+		keep->next = NULL;
+	arena->chunks = keep;
+	arena->inuse = 0;
+}
+
+static void
+varena_put(var)
+	vchar_t *var;
+{
+	struct vmarena *arena = var->arena;
+
+	if (arena->live == 0) {
+		plog(ASL_LEVEL_ERR, "arena buffer released twice.\n");
+		return;
+	}
+	if (--arena->live == 0)
+		varena_reset(arena);
+}
+
+/*
+ * give all chunks back, wiping them first.  called when the exchange
+ * is over and when its handle is deleted.  the arena stays usable,
+ * handing out heap buffers from then on.
+ * chunks still holding live buffers are kept rather than freed
+ * under their owners.
+ */
+void
+varena_release(arena)
+	struct vmarena *arena;
+{
+	struct vmarena_chunk *chunk, *next;
+
+	if (arena->live != 0) {
+		plog(ASL_LEVEL_ERR,
+			"arena still has %u live buffer(s), not released.\n",
+			arena->live);
+		return;
+	}
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		memset(VMARENA_DATA(chunk), 0, chunk->used);
+		racoon_free(chunk);
+	}
+	arena->chunks = NULL;
+	arena->inuse = 0;
+	arena->released = 1;
+}
@@ -41,6 +41,8 @@
  *	        <--------------> l
  *	<----------------------> bl
  */
+struct vmarena;
+
 typedef struct _vchar_t_ {
 #if notyet
 	u_int32_t t;	/* type of the value */
@@ -50,8 +52,41 @@ typedef struct _vchar_t_ {
 #endif
 	size_t l;	/* length of the value */
 	caddr_t v;	/* place holder to the pointer to the value */
+	struct vmarena *arena;	/* owning arena, NULL if on the heap */
 } vchar_t;
 
+/*
+ * bump allocator for the short-lived buffers of one exchange.
+ * it is embedded in a phase 1/2 handle and needs no initialization
+ * beyond zero-fill.  vfree() of an arena buffer only drops the live
+ * count; once nothing is live the chunk is zeroed and reused.
+ * varena_release() gives the chunks back in bulk, after which
+ * varena_alloc() falls back to vmalloc().
+ */
+struct vmarena_chunk;
+
+struct vmarena {
+	struct vmarena_chunk *chunks;	/* newest first */
+	u_int32_t live;			/* buffers not yet vfree'd */
+	u_int32_t nallocs;		/* buffers handed out */
+	u_int32_t nchunks;		/* chunks malloc'ed */
+	size_t inuse;			/* bytes handed out since the last reset */
+	size_t peak;			/* max bytes in use at once */
+	int released;			/* exchange over, allocate on the heap */
+};
+
+#define VMARENA_CHUNKSIZE	4096
+
+/* allocation counters, for the whole process */
+struct vmbuf_stats {
+	u_int64_t heap_allocs;		/* vmalloc() */
+	u_int64_t arena_allocs;		/* varena_alloc() */
+	u_int64_t arena_chunks;		/* chunk malloc()s by arenas */
+	u_int64_t promotions;		/* vpromote() copies to the heap */
+};
+
+extern struct vmbuf_stats vmbuf_stats;
+
 #define VPTRINIT(p) \
 do { \
 	if (p) { \
@@ -68,5 +103,13 @@ extern vchar_t *vrealloc (vchar_t *, size_t);
 extern void vfree (vchar_t *);
 extern vchar_t *vdup (vchar_t *);
 extern vchar_t *vnew (u_int8_t *, size_t);
+struct iovec;
+extern vchar_t *vgather (const struct iovec *, int);
+
+extern vchar_t *varena_alloc (struct vmarena *, size_t);
+extern vchar_t *varena_dup (struct vmarena *, vchar_t *);
+extern vchar_t *vpromote (vchar_t *);
+extern void vwipe (vchar_t *);
+extern void varena_release (struct vmarena *);
 
 #endif /* _VMBUF_H */
@@ -196,6 +196,14 @@ vpn_connect(struct bound_addr *srv, int oper)
 		"accept a request to establish IKE-SA: "
 		"%s\n", saddrwop2str((struct sockaddr *)remote));
 
+	if (oper == VPN_RESTARTED_BY_API && rmconf->fast_reconnect &&
+		ike_session_ikev1_fast_reconnect(rmconf, remote, local) != NULL) {
+		IPSECLOGASLMSG("IPSec reconnected to server %s\n",
+					   saddrwop2str((struct sockaddr *)remote));
+		error = 0;
+		goto out1;
+	}
+
 	IPSECLOGASLMSG("IPSec connecting to server %s\n",
 				   saddrwop2str((struct sockaddr *)remote));
 	if (ikev1_ph1begin_i(NULL, rmconf, remote, local, oper, &srv->nat64_prefix) < 0)
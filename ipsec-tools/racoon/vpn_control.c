@@ -111,6 +111,8 @@
 #include "gcmalloc.h"
 #include "isakmp_cfg.h"
 #include "sainfo.h"
+#include "metrics.h"
+#include "shard.h"
 
 #ifdef ENABLE_VPNCONTROL_PORT
 char *vpncontrolsock_path = VPNCONTROLSOCK_PATH;
@@ -119,8 +121,13 @@ gid_t vpncontrolsock_group = 0;
 mode_t vpncontrolsock_mode = 0600;
 
 static struct sockaddr_un sunaddr;
+static u_int32_t vpncontrol_next_id;	/* names clients to the shards */
 static int vpncontrol_process (struct vpnctl_socket_elem *, char *, size_t);
-static int vpncontrol_reply (int, char *);
+static int vpncontrol_reply (struct vpnctl_socket_elem *, char *);
+static int vpncontrol_reply_metrics (struct vpnctl_socket_elem *, struct vpnctl_hdr *);
+static ssize_t vpncontrol_send (struct vpnctl_socket_elem *, const void *, size_t);
+static int vpncontrol_owner (char *, size_t);
+static void vpncontrol_relay (struct vpnctl_socket_elem *, char *, size_t);
 static void vpncontrol_close_comm (struct vpnctl_socket_elem *);
 static int checklaunchd (void);
 extern int vpn_get_config (phase1_handle_t *, struct vpnctl_status_phase_change **, size_t *);
@@ -231,6 +238,7 @@ vpncontrol_handler(void *unused)
 		return; //%%%%%% terminate
 	}
 	LIST_INIT(&sock_elem->bound_addresses);
+	sock_elem->id = ++vpncontrol_next_id;
 
 	sock_elem->sock = accept(lcconf->sock_vpncontrol, (struct sockaddr *)&from, &fromlen);
 	if (sock_elem->sock < 0) {
@@ -334,6 +342,7 @@ vpncontrol_comm_handler(struct vpnctl_socket_elem *elem)
 		elem->pending_bytes_len -= len;
 		return;
 	} else {
+		vpncontrol_relay(elem, elem->buffer, elem->read_bytes_len);
 		(void)vpncontrol_process(elem, elem->buffer, elem->read_bytes_len);
 		free(elem->buffer);
 		elem->buffer = NULL;
@@ -347,6 +356,10 @@ vpncontrol_process(struct vpnctl_socket_elem *elem, char *combuf, size_t combuf_
 {
 	u_int16_t	error = 0;
 	struct vpnctl_hdr *hdr = ALIGNED_CAST(struct vpnctl_hdr *)combuf;
+	int owner = vpncontrol_owner(combuf, combuf_len);
+
+	if (owner >= 0 && owner != shard_index)
+		return 0;	/* another shard's, it answers */
 
 	switch (ntohs(hdr->msg_type)) {
 	
@@ -469,6 +482,15 @@ vpncontrol_process(struct vpnctl_socket_elem *elem, char *combuf, size_t combuf_
 		case VPNCTL_CMD_PING:
 			break;	/* just reply for now */
 
+		case VPNCTL_CMD_GET_METRICS:
+			plog(ASL_LEVEL_DEBUG,
+				"received get metrics command on vpn control socket.\n");
+			/* the reply carries the metrics, sent here instead of below */
+			if (vpncontrol_reply_metrics(elem, hdr) == 0)
+				return 0;
+			error = -1;
+			break;
+
 		case VPNCTL_CMD_XAUTH_INFO:
 			{
 				if (combuf_len < sizeof(struct vpnctl_cmd_xauth_info)) {
@@ -704,19 +726,177 @@ vpncontrol_process(struct vpnctl_socket_elem *elem, char *combuf, size_t combuf_
 
 	hdr->len = 0;
 	hdr->result = htons(error);
-	if (vpncontrol_reply(elem->sock, combuf) < 0)
+	if (elem->relay && owner < 0)
+		return 0;	/* seen by every shard, shard 0 answers */
+	if (vpncontrol_reply(elem, combuf) < 0)
 		return -1;
 
 	return 0;
 
 }
 
+/*
+ * the shard that handles a command: the one owning the peer address it
+ * is about, or -1 for the bindings and redirects every shard keeps a
+ * copy of.
+ */
+static int
+vpncontrol_owner(char *combuf, size_t combuf_len)
+{
+	struct vpnctl_hdr *hdr = ALIGNED_CAST(struct vpnctl_hdr *)combuf;
+
+	switch (ntohs(hdr->msg_type)) {
+		case VPNCTL_CMD_BIND:
+		case VPNCTL_CMD_UNBIND:
+		case VPNCTL_CMD_REDIRECT:
+		case VPNCTL_CMD_SET_NAT64_PREFIX:
+			return -1;
+
+		case VPNCTL_CMD_CONNECT:
+		case VPNCTL_CMD_DISCONNECT:
+		case VPNCTL_CMD_RECONNECT:
+		case VPNCTL_CMD_XAUTH_INFO:
+		case VPNCTL_CMD_START_PH2:
+		case VPNCTL_CMD_START_DPD:
+			/* all of them start with the address */
+			if (combuf_len < sizeof(struct vpnctl_cmd_connect))
+				return 0;
+			return shard_of_key(&(ALIGNED_CAST(struct vpnctl_cmd_connect *)combuf)->address,
+				sizeof(u_int32_t));
+
+		case VPNCTL_CMD_ASSERT:
+			if (combuf_len < sizeof(struct vpnctl_cmd_assert))
+				return 0;
+			return shard_of_key(&(ALIGNED_CAST(struct vpnctl_cmd_assert *)combuf)->dst_address,
+				sizeof(u_int32_t));
+
+		default:
+			return 0;	/* ping, metrics: shard 0 alone */
+	}
+}
+
+/*
+ * in shard 0, pass a client's command on to the workers that have to
+ * see it, before handling it ourselves.
+ */
+static void
+vpncontrol_relay(struct vpnctl_socket_elem *elem, char *combuf, size_t combuf_len)
+{
+	int owner;
+	int i;
+
+	if (shard_count == 1 || combuf_len < sizeof(struct vpnctl_hdr))
+		return;
+
+	owner = vpncontrol_owner(combuf, combuf_len);
+	for (i = 1; i < shard_count; i++)
+		if (owner == -1 || owner == i)
+			(void)shard_send(i, SHARD_MSG_VPNCTL, elem->id, combuf, combuf_len);
+}
+
+/*
+ * the copy of a client a worker keeps, created with its first command.
+ */
+static struct vpnctl_socket_elem *
+vpncontrol_relay_elem(u_int32_t id, int create)
+{
+	struct vpnctl_socket_elem *elem;
+
+	LIST_FOREACH(elem, &lcconf->vpnctl_comm_socks, chain)
+		if (elem->id == id)
+			return elem;
+	if (!create)
+		return NULL;
+
+	elem = racoon_calloc(1, sizeof(struct vpnctl_socket_elem));
+	if (elem == NULL) {
+		plog(ASL_LEVEL_ERR,
+			"memory error: %s\n", strerror(errno));
+		return NULL;
+	}
+	LIST_INIT(&elem->bound_addresses);
+	elem->sock = -1;
+	elem->id = id;
+	elem->relay = 1;
+	LIST_INSERT_HEAD(&lcconf->vpnctl_comm_socks, elem, chain);
+	check_auto_exit();
+	return elem;
+}
+
+/*
+ * a command shard 0 has passed on.
+ */
+void
+vpncontrol_relay_cmd(u_int32_t id, char *combuf, size_t combuf_len)
+{
+	struct vpnctl_socket_elem *elem;
+	char *buf;
+
+	if (combuf_len < sizeof(struct vpnctl_hdr))
+		return;
+	if ((elem = vpncontrol_relay_elem(id, 1)) == NULL)
+		return;
+
+	/* vpncontrol_process() writes the reply over it */
+	if ((buf = racoon_malloc(combuf_len)) == NULL) {
+		plog(ASL_LEVEL_ERR,
+			 "failed to alloc buffer for vpn_control command\n");
+		return;
+	}
+	memcpy(buf, combuf, combuf_len);
+	(void)vpncontrol_process(elem, buf, combuf_len);
+	racoon_free(buf);
+}
+
+/*
+ * in shard 0, a reply or notification a worker has for a client.
+ */
+void
+vpncontrol_relay_out(u_int32_t id, char *msg, size_t len)
+{
+	struct vpnctl_socket_elem *elem;
+
+	LIST_FOREACH(elem, &lcconf->vpnctl_comm_socks, chain) {
+		if (elem->id != id || elem->sock == -1)
+			continue;
+		if (send(elem->sock, msg, len, 0) < 0)
+			plog(ASL_LEVEL_ERR,
+				"failed to send vpn_control message: %s\n", strerror(errno));
+		return;
+	}
+}
+
+/*
+ * the client is gone: do what shard 0 does with its own connection.
+ */
+void
+vpncontrol_relay_close(u_int32_t id)
+{
+	struct vpnctl_socket_elem *elem;
+
+	if ((elem = vpncontrol_relay_elem(id, 0)) == NULL)
+		return;
+	vpncontrol_disconnect_all(elem, ike_session_stopped_by_controller_comm_lost);
+	vpncontrol_close_comm(elem);
+}
+
+/*
+ * send to a client, through shard 0 for a worker's copy of it.
+ */
+static ssize_t
+vpncontrol_send(struct vpnctl_socket_elem *elem, const void *msg, size_t len)
+{
+	if (elem->relay)
+		return shard_send(0, SHARD_MSG_VPNCTL_OUT, elem->id, msg, len) < 0 ? -1 : len;
+	return send(elem->sock, msg, len, 0);
+}
+
 static int
-vpncontrol_reply(int so, char *combuf)
+vpncontrol_reply(struct vpnctl_socket_elem *elem, char *combuf)
 {
 	ssize_t tlen;
 
-	tlen = send(so, combuf, sizeof(struct vpnctl_hdr), 0);
+	tlen = vpncontrol_send(elem, combuf, sizeof(struct vpnctl_hdr));
 	if (tlen < 0) {
 		plog(ASL_LEVEL_ERR,
 			"failed to send vpn_control message: %s\n", strerror(errno));
@@ -726,6 +906,34 @@ vpncontrol_reply(int so, char *combuf)
 	return 0;
 }
 
+static int
+vpncontrol_reply_metrics(struct vpnctl_socket_elem *elem, struct vpnctl_hdr *req)
+{
+	struct vpnctl_metrics *msg;
+	vchar_t *buf;
+	ssize_t tlen;
+
+	if ((buf = metrics_export()) == NULL)
+		return -1;
+
+	msg = ALIGNED_CAST(struct vpnctl_metrics *)buf->v;
+	msg->hdr.msg_type = req->msg_type;
+	msg->hdr.flags = 0;
+	msg->hdr.cookie = req->cookie;
+	msg->hdr.reserved = 0;
+	msg->hdr.result = 0;
+
+	tlen = vpncontrol_send(elem, buf->v, buf->l);
+	vfree(buf);
+	if (tlen < 0) {
+		plog(ASL_LEVEL_ERR,
+			"failed to send vpn_control metrics: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
 bool
 vpncontrol_set_nat64_prefix(nw_nat64_prefix_t *prefix)
 {
@@ -789,7 +997,7 @@ vpncontrol_notify_need_authinfo(phase1_handle_t *iph1, void* attr_list, size_t a
 			if (bound_addr->address == 0xFFFFFFFF ||
 				bound_addr->address == address) {
 				plog(ASL_LEVEL_DEBUG, "vpn control writing %zu bytes\n", msg_size);
-				tlen = send(sock_elem->sock, msg, msg_size, 0);
+				tlen = vpncontrol_send(sock_elem, msg, msg_size);
 				if (tlen < 0) {
 					plog(ASL_LEVEL_ERR,
 						"failed to send vpn_control need authinfo status: %s\n", strerror(errno));
@@ -839,7 +1047,7 @@ vpncontrol_notify_ike_failed(u_int16_t notify_code, u_int16_t from, u_int32_t ad
 		LIST_FOREACH(bound_addr, &sock_elem->bound_addresses, chain) {
 			if (bound_addr->address == 0xFFFFFFFF ||
 				bound_addr->address == address) {
-				tlen = send(sock_elem->sock, msg, len, 0);
+				tlen = vpncontrol_send(sock_elem, msg, len);
 				if (tlen < 0) {
 					plog(ASL_LEVEL_ERR,
 						"Unable to send vpn_control ike notify failed: %s\n", strerror(errno));
@@ -937,7 +1145,7 @@ vpncontrol_notify_phase_change(int start, u_int16_t from, phase1_handle_t *iph1,
 			if (bound_addr->address == 0xFFFFFFFF ||
 				bound_addr->address == address) {
 				plog(ASL_LEVEL_DEBUG, "vpn control writing %zu bytes\n", msg_size);
-				tlen = send(sock_elem->sock, msg, msg_size, 0);
+				tlen = vpncontrol_send(sock_elem, msg, msg_size);
 				if (tlen < 0) {
 					plog(ASL_LEVEL_ERR,
 						"failed to send vpn_control phase change status: %s\n", strerror(errno));
@@ -975,7 +1183,7 @@ vpncontrol_notify_peer_resp (u_int16_t notify_code, u_int32_t address)
 		LIST_FOREACH(bound_addr, &sock_elem->bound_addresses, chain) {
 			if (bound_addr->address == 0xFFFFFFFF ||
 				bound_addr->address == address) {
-				tlen = send(sock_elem->sock, &msg, sizeof(msg), 0);
+				tlen = vpncontrol_send(sock_elem, &msg, sizeof(msg));
 				if (tlen < 0) {
 					plog(ASL_LEVEL_ERR,
 						 "unable to send vpn_control status (peer response): %s\n", strerror(errno));
@@ -1134,11 +1342,15 @@ vpncontrol_close_comm(struct vpnctl_socket_elem *elem)
 {
 	struct bound_addr *addr;
 	struct bound_addr *t_addr;
+	int i;
 
 	plog(ASL_LEVEL_NOTICE,
 		"vpncontrol_close_comm.\n");
 	
 	LIST_REMOVE(elem, chain);
+	if (!elem->relay)
+		for (i = 1; i < shard_count; i++)
+			(void)shard_send(i, SHARD_MSG_VPNCTL_CLOSE, elem->id, NULL, 0);
 	if (elem->sock != -1) {
 		dispatch_source_cancel(elem->source);
 		elem->sock = -1;
@@ -81,6 +81,7 @@ extern mode_t vpncontrolsock_mode;
 #define VPNCTL_CMD_UNBIND				0x0002
 #define VPNCTL_CMD_REDIRECT				0x0003
 #define VPNCTL_CMD_PING					0x0004
+#define VPNCTL_CMD_GET_METRICS			0x0005
 #define VPNCTL_CMD_CONNECT				0x0011
 #define VPNCTL_CMD_DISCONNECT			0x0012
 #define VPNCTL_CMD_START_PH2			0x0013
@@ -276,6 +277,68 @@ struct vpnctl_cmd_start_dpd {
 	u_int32_t               address;
 };
 
+/*
+ * Metric ids for get metrics - mirrors codes in metrics.h
+ */
+#define VPNCTL_METRIC_RECV_PACKETS			0
+#define VPNCTL_METRIC_RECV_DROPPED			1
+#define VPNCTL_METRIC_RECV_RETRANSMIT		2
+#define VPNCTL_METRIC_THROTTLED				3
+#define VPNCTL_METRIC_PH1_RESEND			4
+#define VPNCTL_METRIC_PH2_RESEND			5
+#define VPNCTL_METRIC_PH1_ESTABLISHED		6
+#define VPNCTL_METRIC_PH2_ESTABLISHED		7
+#define VPNCTL_METRIC_PFKEY_SENT			8
+#define VPNCTL_METRIC_PFKEY_ERRORS			9
+#define VPNCTL_METRIC_CERTCACHE_HITS		10
+#define VPNCTL_METRIC_CERTCACHE_MISSES		11
+#define VPNCTL_METRIC_REKEYS				12
+#define VPNCTL_METRIC_REKEYS_DEFERRED		13
+#define VPNCTL_METRIC_DPD_SENT				14
+#define VPNCTL_METRIC_DPD_SUPPRESSED		15
+#define VPNCTL_METRIC_VMBUF_HEAP			16	/* buffers malloc'ed one by one */
+#define VPNCTL_METRIC_VMBUF_ARENA			17	/* buffers from exchange arenas */
+#define VPNCTL_METRIC_VMBUF_CHUNKS			18	/* arena chunks malloc'ed */
+#define VPNCTL_METRIC_VMBUF_PROMOTIONS		19	/* arena buffers moved to the heap */
+
+#define VPNCTL_METRIC_LATENCY_RECV			0	/* packet received to processed */
+#define VPNCTL_METRIC_LATENCY_DH_GENERATE	1
+#define VPNCTL_METRIC_LATENCY_DH_COMPUTE	2
+#define VPNCTL_METRIC_LATENCY_SIGN			3
+#define VPNCTL_METRIC_LATENCY_VERIFY		4
+#define VPNCTL_METRIC_LATENCY_PH1			5	/* phase 1 start to established */
+#define VPNCTL_METRIC_LATENCY_PH2			6	/* phase 2 start to established */
+#define VPNCTL_METRIC_LATENCY_PFKEY			7	/* PF_KEY round trip */
+
+/* reply to get metrics */
+struct vpnctl_metrics {
+	struct vpnctl_hdr		hdr;
+	u_int32_t				uptime;		/* seconds since racoon started */
+	u_int16_t				counter_count;
+	u_int16_t				histogram_count;
+	/* array of struct vpnctl_metric_counter */
+	/* array of struct vpnctl_metric_histogram */
+};
+
+struct vpnctl_metric_counter {
+	u_int16_t		id;			/* VPNCTL_METRIC_* */
+	u_int16_t		reserved;
+	u_int32_t		value;		/* low 32 bits */
+};
+
+/* only histograms with samples are sent, latencies in microseconds */
+struct vpnctl_metric_histogram {
+	u_int16_t		id;			/* VPNCTL_METRIC_LATENCY_* */
+	u_int16_t		subtype;	/* SADB message type for LATENCY_PFKEY */
+	u_int32_t		count;
+	u_int32_t		mean;
+	u_int32_t		p50;
+	u_int32_t		p90;
+	u_int32_t		p99;
+	u_int32_t		p999;
+	u_int32_t		max;
+};
+
 /*
  * IKE Notify codes - mirrors codes in isakmp.h
  */
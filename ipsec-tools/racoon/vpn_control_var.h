@@ -80,5 +80,8 @@ extern int vpncontrol_notify_peer_resp_ph1 (u_int16_t, phase1_handle_t*);
 extern int vpncontrol_notify_peer_resp_ph2 (u_int16_t, phase2_handle_t*);
 extern int vpn_assert (struct sockaddr_storage *, struct sockaddr_storage *);
 extern bool vpncontrol_set_nat64_prefix(nw_nat64_prefix_t *prefix);
+extern void vpncontrol_relay_cmd (u_int32_t, char *, size_t);
+extern void vpncontrol_relay_out (u_int32_t, char *, size_t);
+extern void vpncontrol_relay_close (u_int32_t);
 
 #endif /* _VPN_CONTROL_VAR_H */
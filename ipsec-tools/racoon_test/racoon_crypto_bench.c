@@ -0,0 +1,611 @@
+//
+//  racoon_crypto_bench.c
+//  ipsec
+//
+//  Copyright (c) 2026 Apple Inc. All rights reserved.
+//
+
+/*
+ * Crypto and key derivation microbenchmarks.
+ *
+ * This is linked against racoon's own objects, so the code measured is the
+ * code the daemon runs: the PRF, SKEYID, SKEYID_[dae], the phase 1
+ * encryption key, KEYMAT, the phase 1 cipher and Diffie-Hellman, for every
+ * algorithm in algorithm.c.  Results are written to stdout as one JSON
+ * object so runs can be compared by a script.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sysexits.h>
+#include <time.h>
+
+#include "var.h"
+#include "vmbuf.h"
+#include "plog.h"
+#include "isakmp_var.h"
+#include "isakmp.h"
+#include "oakley.h"
+#include "localconf.h"
+#include "remoteconf.h"
+#include "handler.h"
+#include "ipsec_doi.h"
+#include "algorithm.h"
+#include "proposal.h"
+#include "dhgroup.h"
+#include "crypto_openssl.h"
+#include "gcmalloc.h"
+
+/* defined by main.c, which is left out of this target */
+int f_local = 0;
+int vflag = 1;
+pid_t racoon_pid = 0;
+int launchdlaunched = 0;
+int print_pid = 1;
+
+static struct option long_options[] =
+{
+	{"iterations"   , required_argument, 0, 'n'},
+	{"dh_iterations", required_argument, 0, 'd'},
+	{"help"         , no_argument, 0, 'h'},
+	{0, 0, 0, 0}
+};
+
+static const int bench_hashes[] = {
+	OAKLEY_ATTR_HASH_ALG_MD5,
+	OAKLEY_ATTR_HASH_ALG_SHA,
+	OAKLEY_ATTR_HASH_ALG_SHA2_256,
+	OAKLEY_ATTR_HASH_ALG_SHA2_384,
+	OAKLEY_ATTR_HASH_ALG_SHA2_512,
+};
+
+static const struct {
+	int type;
+	int keylen;
+} bench_ciphers[] = {
+	{ OAKLEY_ATTR_ENC_ALG_DES, 0 },
+	{ OAKLEY_ATTR_ENC_ALG_3DES, 0 },
+	{ OAKLEY_ATTR_ENC_ALG_AES, 128 },
+	{ OAKLEY_ATTR_ENC_ALG_AES, 192 },
+	{ OAKLEY_ATTR_ENC_ALG_AES, 256 },
+};
+
+static const int bench_groups[] = {
+	OAKLEY_ATTR_GRP_DESC_MODP768,
+	OAKLEY_ATTR_GRP_DESC_MODP1024,
+	OAKLEY_ATTR_GRP_DESC_MODP1536,
+	OAKLEY_ATTR_GRP_DESC_MODP2048,
+	OAKLEY_ATTR_GRP_DESC_MODP3072,
+	OAKLEY_ATTR_GRP_DESC_MODP4096,
+	OAKLEY_ATTR_GRP_DESC_MODP6144,
+	OAKLEY_ATTR_GRP_DESC_MODP8192,
+};
+
+/* quick mode proposals, see racoon.conf(5) sainfo */
+static const struct {
+	const char *name;
+	int proto_id;
+	int trns_id;
+	int encklen;
+	int authtype;
+	int pfs_group;
+} bench_proposals[] = {
+	{ "esp-3des-hmac_md5", IPSECDOI_PROTO_IPSEC_ESP, IPSECDOI_ESP_3DES, 0,
+	    IPSECDOI_ATTR_AUTH_HMAC_MD5, 0 },
+	{ "esp-aes128-hmac_sha1", IPSECDOI_PROTO_IPSEC_ESP, IPSECDOI_ESP_AES, 128,
+	    IPSECDOI_ATTR_AUTH_HMAC_SHA1, 0 },
+	{ "esp-aes256-hmac_sha2_256", IPSECDOI_PROTO_IPSEC_ESP, IPSECDOI_ESP_AES, 256,
+	    IPSECDOI_ATTR_AUTH_HMAC_SHA2_256, 0 },
+	{ "esp-aes256-hmac_sha2_256-pfs", IPSECDOI_PROTO_IPSEC_ESP, IPSECDOI_ESP_AES, 256,
+	    IPSECDOI_ATTR_AUTH_HMAC_SHA2_256, OAKLEY_ATTR_GRP_DESC_MODP2048 },
+	{ "ah-hmac_sha1", IPSECDOI_PROTO_IPSEC_AH, IPSECDOI_AH_SHA, 0,
+	    IPSECDOI_ATTR_AUTH_HMAC_SHA1, 0 },
+};
+
+/* PRF inputs and phase 1 payloads, around what an exchange sees */
+static const size_t bench_sizes[] = { 64, 512, 1500 };
+
+#define BENCH_NONCE_SIZE	DEFAULT_NONCE_SIZE
+#define BENCH_GXY_SIZE		256		/* modp2048 */
+
+static int bench_nresults;
+
+static double
+crypto_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+crypto_bench_result(const char *bench, const char *alg, const char *variant,
+    size_t bytes, long iterations, double elapsed)
+{
+	fprintf(stdout, "%s\n    {\"bench\": \"%s\", \"alg\": \"%s\"",
+		bench_nresults++ ? "," : "", bench, alg);
+	if (variant != NULL)
+		fprintf(stdout, ", \"variant\": \"%s\"", variant);
+	if (bytes != 0)
+		fprintf(stdout, ", \"bytes\": %zu", bytes);
+	fprintf(stdout, ", \"iterations\": %ld, \"ns_per_op\": %.1f, "
+		"\"ops_per_sec\": %.1f",
+		iterations, elapsed * 1e9 / iterations, iterations / elapsed);
+	if (bytes != 0)
+		fprintf(stdout, ", \"mb_per_sec\": %.1f",
+			(double)bytes * iterations / elapsed / 1e6);
+	fprintf(stdout, "}");
+}
+
+static vchar_t *
+crypto_bench_buf(size_t len, int seed)
+{
+	vchar_t *buf;
+	size_t i;
+
+	if ((buf = vmalloc(len)) == NULL) {
+		fprintf(stderr, "failed to allocate %zu bytes\n", len);
+		exit(EX_OSERR);
+	}
+	for (i = 0; i < len; i++)
+		buf->v[i] = (i * 131 + seed) & 0xff;
+	return buf;
+}
+
+/*
+ * a phase 1 handle as it stands after the KE and nonce payloads have been
+ * exchanged, with a pre-shared key in the remote configuration.
+ */
+static void
+crypto_bench_ph1(phase1_handle_t *iph1, struct isakmpsa *sa,
+    struct remoteconf *rmconf)
+{
+	static const char secret[] = "racoon-crypto-bench";
+
+	memset(iph1, 0, sizeof(*iph1));
+	memset(sa, 0, sizeof(*sa));
+
+	sa->version = ISAKMP_VERSION_NUMBER_IKEV1;
+	sa->authmethod = OAKLEY_ATTR_AUTH_METHOD_PSKEY;
+	sa->hashtype = OAKLEY_ATTR_HASH_ALG_SHA;
+	sa->enctype = OAKLEY_ATTR_ENC_ALG_AES;
+	sa->encklen = 128;
+	sa->dh_group = OAKLEY_ATTR_GRP_DESC_MODP2048;
+
+	rmconf->secrettype = SECRETTYPE_USE;
+	rmconf->shared_secret = crypto_bench_buf(sizeof(secret), 0);
+	memcpy(rmconf->shared_secret->v, secret, sizeof(secret));
+
+	iph1->version = ISAKMP_VERSION_NUMBER_IKEV1;
+	iph1->side = INITIATOR;
+	iph1->etype = ISAKMP_ETYPE_IDENT;
+	iph1->approval = sa;
+	iph1->rmconf = rmconf;
+	memset(&iph1->index.i_ck, 0x11, sizeof(cookie_t));
+	memset(&iph1->index.r_ck, 0x22, sizeof(cookie_t));
+	iph1->nonce = crypto_bench_buf(BENCH_NONCE_SIZE, 1);
+	iph1->nonce_p = crypto_bench_buf(BENCH_NONCE_SIZE, 2);
+	iph1->dhgxy = crypto_bench_buf(BENCH_GXY_SIZE, 3);
+}
+
+static void
+crypto_bench_ph1_keys(phase1_handle_t *iph1)
+{
+	VPTRINIT(iph1->skeyid);
+	VPTRINIT(iph1->skeyid_d);
+	VPTRINIT(iph1->skeyid_a);
+	VPTRINIT(iph1->skeyid_e);
+	VPTRINIT(iph1->key);
+	if (oakley_skeyid(iph1) < 0 || oakley_skeyid_dae(iph1) < 0 ||
+	    oakley_compute_enckey(iph1) < 0) {
+		fprintf(stderr, "failed to derive the phase 1 keys\n");
+		exit(EX_SOFTWARE);
+	}
+}
+
+static void
+crypto_bench_prf(phase1_handle_t *iph1, long iterations)
+{
+	vchar_t *key, *buf, *res;
+	double start, elapsed;
+	long i;
+	int h, s;
+
+	key = crypto_bench_buf(32, 4);
+	for (h = 0; h < sizeof(bench_hashes) / sizeof(bench_hashes[0]); h++) {
+		iph1->approval->hashtype = bench_hashes[h];
+		for (s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+			buf = crypto_bench_buf(bench_sizes[s], 5);
+			start = crypto_bench_now();
+			for (i = 0; i < iterations; i++) {
+				if ((res = oakley_prf(key, buf, iph1)) == NULL) {
+					fprintf(stderr, "oakley_prf failed\n");
+					exit(EX_SOFTWARE);
+				}
+				vfree(res);
+			}
+			elapsed = crypto_bench_now() - start;
+			crypto_bench_result("prf",
+				alg_oakley_hashdef_name(bench_hashes[h]), NULL,
+				bench_sizes[s], iterations, elapsed);
+			vfree(buf);
+		}
+	}
+	vfree(key);
+}
+
+static void
+crypto_bench_skeyid(phase1_handle_t *iph1, long iterations)
+{
+	static const struct {
+		int authmethod;
+		const char *name;
+	} methods[] = {
+		{ OAKLEY_ATTR_AUTH_METHOD_PSKEY, "psk" },
+		{ OAKLEY_ATTR_AUTH_METHOD_RSASIG, "rsasig" },
+	};
+	double start, elapsed;
+	long i;
+	int h, m;
+
+	for (h = 0; h < sizeof(bench_hashes) / sizeof(bench_hashes[0]); h++) {
+		iph1->approval->hashtype = bench_hashes[h];
+		for (m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+			iph1->approval->authmethod = methods[m].authmethod;
+			start = crypto_bench_now();
+			for (i = 0; i < iterations; i++) {
+				VPTRINIT(iph1->skeyid);
+				if (oakley_skeyid(iph1) < 0) {
+					fprintf(stderr, "oakley_skeyid failed\n");
+					exit(EX_SOFTWARE);
+				}
+			}
+			elapsed = crypto_bench_now() - start;
+			crypto_bench_result("skeyid",
+				alg_oakley_hashdef_name(bench_hashes[h]),
+				methods[m].name, 0, iterations, elapsed);
+		}
+		iph1->approval->authmethod = OAKLEY_ATTR_AUTH_METHOD_PSKEY;
+
+		start = crypto_bench_now();
+		for (i = 0; i < iterations; i++) {
+			VPTRINIT(iph1->skeyid_d);
+			VPTRINIT(iph1->skeyid_a);
+			VPTRINIT(iph1->skeyid_e);
+			if (oakley_skeyid_dae(iph1) < 0) {
+				fprintf(stderr, "oakley_skeyid_dae failed\n");
+				exit(EX_SOFTWARE);
+			}
+		}
+		elapsed = crypto_bench_now() - start;
+		crypto_bench_result("skeyid_dae",
+			alg_oakley_hashdef_name(bench_hashes[h]), NULL, 0,
+			iterations, elapsed);
+	}
+	iph1->approval->hashtype = OAKLEY_ATTR_HASH_ALG_SHA;
+}
+
+/*
+ * the encryption key needs more than one PRF round when SKEYID_e is shorter
+ * than the key, e.g. 3des or aes256 with md5 or sha1.
+ */
+static void
+crypto_bench_enckey(phase1_handle_t *iph1, long iterations)
+{
+	char variant[32];
+	double start, elapsed;
+	long i;
+	int h, c;
+
+	for (h = 0; h < sizeof(bench_hashes) / sizeof(bench_hashes[0]); h++) {
+		iph1->approval->hashtype = bench_hashes[h];
+		for (c = 0; c < sizeof(bench_ciphers) / sizeof(bench_ciphers[0]); c++) {
+			iph1->approval->enctype = bench_ciphers[c].type;
+			iph1->approval->encklen = bench_ciphers[c].keylen;
+			crypto_bench_ph1_keys(iph1);
+
+			start = crypto_bench_now();
+			for (i = 0; i < iterations; i++) {
+				VPTRINIT(iph1->key);
+				if (oakley_compute_enckey(iph1) < 0) {
+					fprintf(stderr, "oakley_compute_enckey failed\n");
+					exit(EX_SOFTWARE);
+				}
+			}
+			elapsed = crypto_bench_now() - start;
+			snprintf(variant, sizeof(variant), "%s%d",
+				alg_oakley_encdef_name(bench_ciphers[c].type),
+				(int)iph1->key->l * 8);
+			crypto_bench_result("enckey",
+				alg_oakley_hashdef_name(bench_hashes[h]), variant, 0,
+				iterations, elapsed);
+		}
+	}
+}
+
+static void
+crypto_bench_keymat(phase1_handle_t *iph1, long iterations)
+{
+	phase2_handle_t iph2;
+	struct saprop pp;
+	struct saproto pr;
+	struct satrns tr;
+	double start, elapsed;
+	long i;
+	int p, h;
+
+	for (h = 0; h < sizeof(bench_hashes) / sizeof(bench_hashes[0]); h++) {
+		iph1->approval->hashtype = bench_hashes[h];
+		crypto_bench_ph1_keys(iph1);
+
+		for (p = 0; p < sizeof(bench_proposals) / sizeof(bench_proposals[0]); p++) {
+			memset(&iph2, 0, sizeof(iph2));
+			memset(&pp, 0, sizeof(pp));
+			memset(&pr, 0, sizeof(pr));
+			memset(&tr, 0, sizeof(tr));
+
+			tr.trns_no = 1;
+			tr.trns_id = bench_proposals[p].trns_id;
+			tr.encklen = bench_proposals[p].encklen;
+			tr.authtype = bench_proposals[p].authtype;
+			pr.proto_id = bench_proposals[p].proto_id;
+			pr.spisize = sizeof(pr.spi);
+			pr.spi = htonl(0x1000 + p);
+			pr.spi_p = htonl(0x2000 + p);
+			pr.head = &tr;
+			pp.prop_no = 1;
+			pp.pfs_group = bench_proposals[p].pfs_group;
+			pp.head = &pr;
+
+			iph2.version = ISAKMP_VERSION_NUMBER_IKEV1;
+			iph2.side = INITIATOR;
+			iph2.approval = &pp;
+			iph2.ph1 = iph1;
+			iph2.nonce = crypto_bench_buf(BENCH_NONCE_SIZE, 6);
+			iph2.nonce_p = crypto_bench_buf(BENCH_NONCE_SIZE, 7);
+			/* the shared secret only, the exponentiation is under dh */
+			if (pp.pfs_group)
+				iph2.dhgxy = crypto_bench_buf(BENCH_GXY_SIZE, 8);
+
+			start = crypto_bench_now();
+			for (i = 0; i < iterations; i++) {
+				VPTRINIT(pr.keymat);
+				VPTRINIT(pr.keymat_p);
+				if (oakley_compute_keymat(&iph2, INITIATOR) < 0) {
+					fprintf(stderr, "oakley_compute_keymat failed\n");
+					exit(EX_SOFTWARE);
+				}
+			}
+			elapsed = crypto_bench_now() - start;
+			crypto_bench_result("keymat",
+				alg_oakley_hashdef_name(bench_hashes[h]),
+				bench_proposals[p].name, 0, iterations, elapsed);
+
+			VPTRINIT(pr.keymat);
+			VPTRINIT(pr.keymat_p);
+			VPTRINIT(iph2.nonce);
+			VPTRINIT(iph2.nonce_p);
+			VPTRINIT(iph2.dhgxy);
+			varena_release(&iph2.arena);
+		}
+	}
+	iph1->approval->hashtype = OAKLEY_ATTR_HASH_ALG_SHA;
+}
+
+static void
+crypto_bench_cipher(phase1_handle_t *iph1, long iterations)
+{
+	vchar_t *msg, *enc, *dec, *iv, *ivep, *ivp;
+	char variant[32];
+	double start, elapsed;
+	long i;
+	int c, s, blen;
+
+	for (c = 0; c < sizeof(bench_ciphers) / sizeof(bench_ciphers[0]); c++) {
+		iph1->approval->enctype = bench_ciphers[c].type;
+		iph1->approval->encklen = bench_ciphers[c].keylen;
+		crypto_bench_ph1_keys(iph1);
+		snprintf(variant, sizeof(variant), "%d", (int)iph1->key->l * 8);
+
+		blen = alg_oakley_encdef_blocklen(bench_ciphers[c].type);
+		iv = crypto_bench_buf(blen, 9);
+		ivep = crypto_bench_buf(blen, 0);
+		ivp = crypto_bench_buf(blen, 0);
+
+		for (s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+			msg = crypto_bench_buf(sizeof(struct isakmp) + bench_sizes[s], 10);
+			enc = NULL;
+
+			start = crypto_bench_now();
+			for (i = 0; i < iterations; i++) {
+				VPTRINIT(enc);
+				memcpy(ivep->v, iv->v, blen);
+				if ((enc = oakley_do_encrypt(iph1, msg, ivep, ivp)) == NULL) {
+					fprintf(stderr, "oakley_do_encrypt failed\n");
+					exit(EX_SOFTWARE);
+				}
+			}
+			elapsed = crypto_bench_now() - start;
+			crypto_bench_result("encrypt",
+				alg_oakley_encdef_name(bench_ciphers[c].type), variant,
+				bench_sizes[s], iterations, elapsed);
+
+			start = crypto_bench_now();
+			for (i = 0; i < iterations; i++) {
+				memcpy(ivp->v, iv->v, blen);
+				if ((dec = oakley_do_decrypt(iph1, enc, ivp, ivep)) == NULL) {
+					fprintf(stderr, "oakley_do_decrypt failed\n");
+					exit(EX_SOFTWARE);
+				}
+				vfree(dec);
+			}
+			elapsed = crypto_bench_now() - start;
+			crypto_bench_result("decrypt",
+				alg_oakley_encdef_name(bench_ciphers[c].type), variant,
+				bench_sizes[s], iterations, elapsed);
+
+			vfree(enc);
+			vfree(msg);
+		}
+
+		vfree(iv);
+		vfree(ivep);
+		vfree(ivp);
+	}
+	iph1->approval->enctype = OAKLEY_ATTR_ENC_ALG_AES;
+	iph1->approval->encklen = 128;
+}
+
+/*
+ * one key pair per generate and one shared secret per compute.  the DH
+ * pool is not started here, so every generate is done inline.
+ */
+static void
+crypto_bench_dh(long iterations)
+{
+	struct dhgroup *dh;
+	vchar_t *pub, *pub_p, *gxy;
+#ifdef HAVE_OPENSSL
+	vchar_t *priv, *priv_p;
+#else
+	SecDHContext dhC, dhC_p;
+	size_t publicKeySize, publicKeySize_p;
+#endif
+	double start, gen, comp;
+	long i;
+	int g;
+
+	for (g = 0; g < sizeof(bench_groups) / sizeof(bench_groups[0]); g++) {
+		if (oakley_setdhgroup(bench_groups[g], &dh) < 0 || dh == NULL) {
+			fprintf(stderr, "failed to set up DH group %d\n",
+				bench_groups[g]);
+			exit(EX_SOFTWARE);
+		}
+
+		gen = comp = 0;
+		for (i = 0; i < iterations; i++) {
+			pub = pub_p = gxy = NULL;
+#ifdef HAVE_OPENSSL
+			priv = priv_p = NULL;
+			start = crypto_bench_now();
+			if (oakley_dh_generate(dh, &pub, &priv) < 0)
+				goto fail;
+			gen += crypto_bench_now() - start;
+			if (oakley_dh_generate(dh, &pub_p, &priv_p) < 0)
+				goto fail;
+
+			start = crypto_bench_now();
+			if (oakley_dh_compute(dh, pub, priv, pub_p, &gxy) < 0)
+				goto fail;
+			comp += crypto_bench_now() - start;
+			vfree(priv);
+			vfree(priv_p);
+#else
+			dhC = dhC_p = NULL;
+			start = crypto_bench_now();
+			if (oakley_dh_generate(dh, &pub, &publicKeySize, &dhC) < 0)
+				goto fail;
+			gen += crypto_bench_now() - start;
+			if (oakley_dh_generate(dh, &pub_p, &publicKeySize_p, &dhC_p) < 0)
+				goto fail;
+
+			start = crypto_bench_now();
+			if (oakley_dh_compute(dh, pub_p, publicKeySize_p, &gxy, &dhC) < 0)
+				goto fail;
+			comp += crypto_bench_now() - start;
+			if (dhC_p)
+				SecDHDestroy(dhC_p);
+#endif
+			vfree(pub);
+			vfree(pub_p);
+			vfree(gxy);
+		}
+
+		crypto_bench_result("dh_generate",
+			alg_oakley_dhdef_name(bench_groups[g]), NULL, 0,
+			iterations, gen);
+		crypto_bench_result("dh_compute",
+			alg_oakley_dhdef_name(bench_groups[g]), NULL, 0,
+			iterations, comp);
+		oakley_dhgrp_free(dh);
+	}
+	return;
+
+fail:
+	fprintf(stderr, "DH failed for group %d\n", bench_groups[g]);
+	exit(EX_SOFTWARE);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: racoon_crypto_bench [-iterations=n] "
+		"[-dh_iterations=n]\n");
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	phase1_handle_t iph1;
+	struct isakmpsa sa;
+	struct remoteconf *rmconf;
+	long iterations = 10000, dh_iterations = 20;
+	int ch;
+
+	while ((ch = getopt_long_only(argc, argv, "", long_options, NULL)) != -1) {
+		switch (ch) {
+			case 'n':
+				iterations = strtol(optarg, NULL, 0);
+				break;
+			case 'd':
+				dh_iterations = strtol(optarg, NULL, 0);
+				break;
+			case 'h':
+			default:
+				usage();
+		}
+	}
+	if (iterations <= 0 || dh_iterations <= 0)
+		usage();
+
+	ploginit();
+	plogsetlevel(ASL_LEVEL_ERR);
+#ifdef HAVE_OPENSSL
+	eay_init();
+#endif
+	initlcconf();
+	initrmconf();
+	oakley_dhinit();
+
+	if ((rmconf = create_rmconf()) == NULL) {
+		fprintf(stderr, "failed to allocate the remote configuration\n");
+		exit(EX_OSERR);
+	}
+	crypto_bench_ph1(&iph1, &sa, rmconf);
+	crypto_bench_ph1_keys(&iph1);
+
+	fprintf(stdout, "{\n  \"iterations\": %ld,\n  \"dh_iterations\": %ld,\n"
+		"  \"results\": [", iterations, dh_iterations);
+	crypto_bench_prf(&iph1, iterations);
+	crypto_bench_skeyid(&iph1, iterations);
+	crypto_bench_enckey(&iph1, iterations);
+	crypto_bench_keymat(&iph1, iterations);
+	crypto_bench_cipher(&iph1, iterations);
+	crypto_bench_dh(dh_iterations);
+	fprintf(stdout, "\n  ]\n}\n");
+
+	varena_release(&iph1.arena);
+	return 0;
+}
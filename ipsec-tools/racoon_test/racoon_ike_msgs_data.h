@@ -0,0 +1,309 @@
+//
+//  racoon_ike_msgs_data.h
+//  ipsec
+//
+//  Copyright (c) 2026 Apple Inc. All rights reserved.
+//
+//  Representative IKEv1 messages in wire format, with encrypted
+//  messages stored after decryption, used by the payload index test
+//  and parse benchmark.
+//
+
+#ifndef ike_msgs_data_h
+#define ike_msgs_data_h
+
+unsigned char main_mode_msg1[] = {
+	0x8b, 0x8c, 0xb6, 0xc7, 0x0b, 0x0c, 0x68, 0x37, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x01, 0x10, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x01, 0xe8, 0x0d, 0x00, 0x01, 0x54, 0x00, 0x00, 0x00, 0x01,
+	0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x01, 0x48, 0x01, 0x01, 0x00, 0x08,
+	0x03, 0x00, 0x00, 0x28, 0x01, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07,
+	0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01,
+	0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04,
+	0x00, 0x00, 0x0e, 0x10, 0x03, 0x00, 0x00, 0x28, 0x02, 0x01, 0x00, 0x00,
+	0x80, 0x01, 0x00, 0x07, 0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02,
+	0x80, 0x03, 0x00, 0x01, 0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01,
+	0x00, 0x0c, 0x00, 0x04, 0x00, 0x00, 0x0e, 0x10, 0x03, 0x00, 0x00, 0x28,
+	0x03, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07, 0x80, 0x0e, 0x01, 0x00,
+	0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01, 0x80, 0x04, 0x00, 0x0e,
+	0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04, 0x00, 0x00, 0x0e, 0x10,
+	0x03, 0x00, 0x00, 0x28, 0x04, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07,
+	0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01,
+	0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04,
+	0x00, 0x00, 0x0e, 0x10, 0x03, 0x00, 0x00, 0x28, 0x05, 0x01, 0x00, 0x00,
+	0x80, 0x01, 0x00, 0x07, 0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02,
+	0x80, 0x03, 0x00, 0x01, 0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01,
+	0x00, 0x0c, 0x00, 0x04, 0x00, 0x00, 0x0e, 0x10, 0x03, 0x00, 0x00, 0x28,
+	0x06, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07, 0x80, 0x0e, 0x01, 0x00,
+	0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01, 0x80, 0x04, 0x00, 0x0e,
+	0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04, 0x00, 0x00, 0x0e, 0x10,
+	0x03, 0x00, 0x00, 0x28, 0x07, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07,
+	0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01,
+	0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04,
+	0x00, 0x00, 0x0e, 0x10, 0x00, 0x00, 0x00, 0x28, 0x08, 0x01, 0x00, 0x00,
+	0x80, 0x01, 0x00, 0x07, 0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02,
+	0x80, 0x03, 0x00, 0x01, 0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01,
+	0x00, 0x0c, 0x00, 0x04, 0x00, 0x00, 0x0e, 0x10, 0x0d, 0x00, 0x00, 0x14,
+	0xbf, 0xe8, 0x33, 0xa8, 0x34, 0x6e, 0x99, 0x8b, 0x0e, 0x20, 0xc6, 0xf3,
+	0xc3, 0x7a, 0x0a, 0xba, 0x0d, 0x00, 0x00, 0x14, 0xae, 0x9f, 0x80, 0x2b,
+	0xa2, 0x6d, 0xf4, 0x3e, 0xfc, 0xbf, 0x68, 0xb7, 0xd8, 0x33, 0xc9, 0xb1,
+	0x0d, 0x00, 0x00, 0x14, 0xf8, 0xdb, 0x07, 0xaa, 0xf0, 0xda, 0x38, 0x24,
+	0x21, 0x37, 0x98, 0x7b, 0xd6, 0xc3, 0xf4, 0x63, 0x0d, 0x00, 0x00, 0x14,
+	0x5d, 0x3e, 0xd3, 0x95, 0x07, 0x07, 0xf7, 0xbc, 0x4b, 0xd8, 0x8b, 0x89,
+	0x1f, 0x82, 0x0b, 0xa4, 0x0d, 0x00, 0x00, 0x14, 0x01, 0x76, 0x99, 0xa8,
+	0x8f, 0x50, 0xd0, 0x51, 0xd9, 0xaa, 0x6c, 0x6e, 0xd8, 0xb1, 0x33, 0x0e,
+	0x00, 0x00, 0x00, 0x14, 0xe1, 0xf3, 0x40, 0x32, 0xf0, 0x9f, 0x62, 0xdd,
+	0x6d, 0x9b, 0x84, 0x27, 0x0f, 0x19, 0x13, 0x20,
+};
+
+unsigned char main_mode_msg2[] = {
+	0x5e, 0x98, 0xc7, 0xfd, 0xfd, 0xe9, 0x17, 0xda, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x01, 0x10, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x94, 0x0d, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00, 0x01,
+	0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x30, 0x01, 0x01, 0x00, 0x01,
+	0x00, 0x00, 0x00, 0x28, 0x01, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07,
+	0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01,
+	0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04,
+	0x00, 0x00, 0x0e, 0x10, 0x0d, 0x00, 0x00, 0x14, 0xbf, 0xe8, 0x33, 0xa8,
+	0x34, 0x6e, 0x99, 0x8b, 0x0e, 0x20, 0xc6, 0xf3, 0xc3, 0x7a, 0x0a, 0xba,
+	0x0d, 0x00, 0x00, 0x14, 0xae, 0x9f, 0x80, 0x2b, 0xa2, 0x6d, 0xf4, 0x3e,
+	0xfc, 0xbf, 0x68, 0xb7, 0xd8, 0x33, 0xc9, 0xb1, 0x00, 0x00, 0x00, 0x14,
+	0xf8, 0xdb, 0x07, 0xaa, 0xf0, 0xda, 0x38, 0x24, 0x21, 0x37, 0x98, 0x7b,
+	0xd6, 0xc3, 0xf4, 0x63,
+};
+
+unsigned char main_mode_msg3[] = {
+	0x7f, 0xf9, 0x0c, 0x96, 0xc5, 0x9e, 0x77, 0x1b, 0x72, 0x7b, 0x4c, 0x39,
+	0xb3, 0xd6, 0x71, 0xbe, 0x04, 0x10, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x01, 0x74, 0x0a, 0x00, 0x01, 0x04, 0x8b, 0x53, 0x1a, 0x68,
+	0xc8, 0x0b, 0xf1, 0x6b, 0xb4, 0x75, 0x94, 0x13, 0x0a, 0x5a, 0x18, 0xac,
+	0x3d, 0xcb, 0x14, 0xf6, 0x22, 0xad, 0xf5, 0x46, 0x59, 0xe1, 0xe8, 0xce,
+	0xc2, 0x9a, 0xc6, 0xf5, 0xe9, 0xae, 0xb2, 0x6f, 0x58, 0x85, 0x78, 0x9a,
+	0x63, 0xb6, 0x08, 0xf7, 0x0b, 0x26, 0x91, 0x02, 0x85, 0x1c, 0xf8, 0xf5,
+	0x9e, 0xf1, 0xd1, 0xb0, 0x79, 0x08, 0x94, 0x2e, 0xd0, 0x9c, 0x08, 0xb1,
+	0x04, 0xce, 0x6d, 0x0c, 0x4a, 0xf8, 0x6d, 0x29, 0x10, 0x4a, 0x2b, 0xe6,
+	0x19, 0x11, 0x9b, 0xde, 0x08, 0xe1, 0x05, 0xd8, 0xae, 0xeb, 0x6c, 0x8b,
+	0x05, 0xce, 0xf0, 0x46, 0x7d, 0xd1, 0xef, 0x52, 0xa6, 0xa0, 0x8c, 0xb8,
+	0x65, 0x07, 0x19, 0x1c, 0xf7, 0x34, 0x70, 0x3c, 0x4e, 0x3b, 0x25, 0xd6,
+	0x98, 0x80, 0xfb, 0x62, 0x66, 0x9f, 0xce, 0x50, 0xb3, 0x14, 0x83, 0xeb,
+	0xa7, 0x10, 0xbb, 0x27, 0xed, 0xb0, 0x0b, 0x06, 0x24, 0x65, 0x3e, 0x52,
+	0x11, 0x33, 0x47, 0x52, 0x6f, 0x78, 0x37, 0xa8, 0x7f, 0x3d, 0x01, 0x86,
+	0xe9, 0xf9, 0xb6, 0x19, 0x1a, 0x05, 0x36, 0x36, 0xc1, 0x19, 0x24, 0x8e,
+	0xbb, 0x22, 0x09, 0xf6, 0x9f, 0xf8, 0xae, 0xba, 0x8a, 0x2a, 0xcb, 0x2a,
+	0xf0, 0x86, 0xfc, 0x0e, 0x0d, 0x63, 0x7c, 0x89, 0x1d, 0x6a, 0xbe, 0xbc,
+	0x34, 0x57, 0x2a, 0x3b, 0x0f, 0x8c, 0x03, 0x4d, 0x42, 0x6a, 0x31, 0xac,
+	0x86, 0x70, 0xd1, 0x95, 0xb8, 0x7e, 0x53, 0xf7, 0x41, 0xc2, 0xc7, 0xc9,
+	0x46, 0xe7, 0xa5, 0x4a, 0xf8, 0xd1, 0x94, 0xd4, 0x79, 0xc9, 0x0c, 0xd5,
+	0x43, 0x67, 0xf2, 0xe2, 0x0e, 0xc7, 0x0d, 0xff, 0x9a, 0xcc, 0x4e, 0x2f,
+	0x99, 0x4b, 0x3b, 0xf9, 0x38, 0x91, 0x40, 0x81, 0xb6, 0x6b, 0xb1, 0x9b,
+	0x07, 0x9b, 0xb5, 0x51, 0xc3, 0x35, 0x77, 0x4b, 0x18, 0xd4, 0x03, 0xc3,
+	0x14, 0x00, 0x00, 0x24, 0xfa, 0x83, 0x19, 0xd6, 0x00, 0xdd, 0x0f, 0xbe,
+	0xe8, 0xaf, 0xff, 0x98, 0xc2, 0x95, 0xf0, 0xcc, 0xcf, 0xee, 0x12, 0x22,
+	0x61, 0xae, 0xa4, 0xf4, 0xb0, 0x15, 0xc3, 0xb3, 0xb1, 0x5a, 0x1e, 0x7b,
+	0x14, 0x00, 0x00, 0x18, 0x65, 0x7e, 0xf2, 0xc2, 0xa4, 0xde, 0x30, 0xc6,
+	0x6a, 0x40, 0xf4, 0x98, 0x42, 0xc1, 0x19, 0xa2, 0xcf, 0x7d, 0xa6, 0x11,
+	0x00, 0x00, 0x00, 0x18, 0x5e, 0xd2, 0x77, 0x38, 0x44, 0x24, 0xb0, 0x1b,
+	0x4d, 0xc3, 0x8d, 0x38, 0xec, 0xbb, 0xa8, 0x90, 0x59, 0xfd, 0x22, 0xd3,
+};
+
+unsigned char main_mode_msg5[] = {
+	0x77, 0x56, 0x2a, 0xee, 0x99, 0x44, 0x2d, 0xb9, 0x78, 0xe8, 0x1c, 0x2b,
+	0x6f, 0x68, 0x21, 0x7e, 0x05, 0x10, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x04, 0xd1, 0x06, 0x00, 0x00, 0x0c, 0x01, 0x11, 0x01, 0xf4,
+	0x71, 0x7b, 0x34, 0x29, 0x09, 0x00, 0x03, 0x89, 0x04, 0x14, 0x46, 0x13,
+	0x99, 0x3b, 0x91, 0xbd, 0xd2, 0xa9, 0xce, 0x31, 0xc5, 0x08, 0x1b, 0x45,
+	0xc7, 0xae, 0xa5, 0x3e, 0x92, 0x75, 0xde, 0x1e, 0x2d, 0xca, 0x5a, 0x93,
+	0x69, 0x70, 0xe3, 0xfd, 0x6c, 0x82, 0x32, 0x46, 0x37, 0xaf, 0x19, 0xf3,
+	0xb2, 0x9f, 0xc7, 0xec, 0x21, 0x8d, 0x65, 0x4c, 0x7c, 0xa4, 0xf3, 0x11,
+	0x73, 0xfc, 0x87, 0x80, 0xeb, 0x08, 0xf2, 0x4d, 0x25, 0x9f, 0xa5, 0xda,
+	0xf2, 0xeb, 0xa0, 0x5d, 0xa4, 0xe4, 0x7f, 0x82, 0x5c, 0x92, 0x5a, 0xde,
+	0xa4, 0xb7, 0xdd, 0x90, 0xaa, 0x04, 0xac, 0x56, 0xfb, 0xbe, 0xc3, 0x6a,
+	0xb5, 0x06, 0xbe, 0xdb, 0x02, 0x5c, 0x28, 0xbc, 0xf7, 0x59, 0xfc, 0x5d,
+	0x3d, 0x97, 0x23, 0x83, 0x0f, 0xec, 0xbe, 0x96, 0x82, 0x5a, 0x69, 0x8e,
+	0x14, 0xc0, 0x24, 0xbc, 0xf8, 0x03, 0x3b, 0x85, 0xb4, 0xe4, 0x9c, 0x78,
+	0x7e, 0x28, 0xc8, 0x24, 0x95, 0x88, 0x1a, 0xcf, 0xe7, 0xc3, 0x60, 0x64,
+	0x41, 0x0d, 0xb1, 0x4f, 0x6a, 0x97, 0x4b, 0x7e, 0x94, 0x65, 0x96, 0x34,
+	0x0e, 0x73, 0x46, 0x29, 0xc3, 0xa2, 0x3e, 0x26, 0xc9, 0x26, 0x5e, 0xef,
+	0x90, 0x06, 0xe6, 0x5a, 0x89, 0x7e, 0x9f, 0x1a, 0x29, 0x5c, 0x5a, 0xe2,
+	0xc8, 0xc4, 0xd8, 0x55, 0xa4, 0x63, 0x7c, 0x46, 0x49, 0xd5, 0x6c, 0x50,
+	0x6a, 0xc1, 0xf0, 0xf6, 0x7f, 0x49, 0x4f, 0xa1, 0xd0, 0xd0, 0xa0, 0x89,
+	0x46, 0xed, 0x63, 0x47, 0xeb, 0x78, 0x7c, 0x5b, 0xb0, 0x49, 0xac, 0xf4,
+	0x97, 0x0f, 0xea, 0x5b, 0x66, 0xfc, 0x93, 0x43, 0xcd, 0xab, 0x2e, 0xdf,
+	0xa8, 0x3c, 0x98, 0x36, 0x7a, 0xad, 0x33, 0x10, 0x15, 0x9b, 0x5d, 0xe3,
+	0x27, 0xe7, 0xe0, 0xe8, 0x31, 0x7b, 0x57, 0xd0, 0x0f, 0xf5, 0xb7, 0xb3,
+	0x7e, 0x41, 0xd0, 0xc2, 0x3c, 0x83, 0x4d, 0x6d, 0xbe, 0x2a, 0xfb, 0xd2,
+	0x8b, 0xaa, 0xe4, 0x09, 0x61, 0x33, 0xf4, 0x0a, 0xd1, 0x8b, 0x0e, 0xb8,
+	0xb5, 0x57, 0x57, 0x30, 0x5d, 0x63, 0x68, 0x9c, 0x4a, 0x0c, 0xfb, 0x14,
+	0x14, 0xa9, 0x53, 0xe8, 0x5a, 0x92, 0xc8, 0x13, 0x76, 0x82, 0x00, 0x44,
+	0x07, 0x8a, 0xa0, 0x43, 0x1e, 0x41, 0xc4, 0xf6, 0x77, 0x5c, 0x4d, 0x71,
+	0x4d, 0xfe, 0xf5, 0x71, 0xe2, 0x55, 0x4d, 0x43, 0xa7, 0x28, 0x4e, 0xd5,
+	0x45, 0xf1, 0x7f, 0x98, 0x02, 0x9f, 0x59, 0x1b, 0xef, 0x10, 0xcd, 0x5e,
+	0xe0, 0x0f, 0x17, 0xb6, 0x0b, 0xb5, 0xe6, 0xd9, 0xc0, 0x61, 0x3c, 0x7f,
+	0xb5, 0x0f, 0x92, 0x6a, 0x13, 0xe8, 0x68, 0x38, 0xc1, 0x95, 0x83, 0x8b,
+	0xaa, 0x3b, 0x7d, 0x4b, 0x79, 0x1a, 0xc9, 0xd5, 0x49, 0xdf, 0x94, 0xd7,
+	0x2b, 0xe6, 0x17, 0x05, 0xa6, 0x1a, 0x06, 0x4b, 0xe8, 0x25, 0x95, 0xae,
+	0x27, 0x99, 0xaa, 0x56, 0xc9, 0xfe, 0x4c, 0x04, 0xd8, 0x36, 0x91, 0x2d,
+	0xf5, 0x0d, 0x87, 0x4c, 0xad, 0xab, 0x70, 0xfa, 0xfa, 0x8c, 0xef, 0x39,
+	0x33, 0x84, 0x32, 0x8f, 0x49, 0x2e, 0x12, 0xab, 0x81, 0xe0, 0x1f, 0xad,
+	0xaa, 0x1c, 0x6b, 0x90, 0x00, 0xf7, 0x0f, 0xb8, 0x6d, 0x58, 0x2f, 0x42,
+	0x96, 0xc9, 0xd3, 0x4a, 0x03, 0xf8, 0xf9, 0xf4, 0x64, 0x95, 0x48, 0x25,
+	0x6d, 0x9c, 0x5b, 0x88, 0xf0, 0x02, 0x5a, 0x0e, 0x52, 0x78, 0x6e, 0x73,
+	0x4e, 0x21, 0x36, 0xc5, 0x1c, 0xa4, 0xfa, 0x43, 0xe1, 0xc7, 0x7a, 0x94,
+	0x93, 0x5c, 0x3d, 0xa5, 0x02, 0x20, 0x20, 0x0c, 0x99, 0xae, 0x9d, 0x83,
+	0x10, 0x5d, 0x97, 0x6e, 0x86, 0xa4, 0x86, 0x21, 0x21, 0xa4, 0x95, 0x24,
+	0xaf, 0xed, 0x97, 0x44, 0xbd, 0x9d, 0x4f, 0x9e, 0xc4, 0x16, 0xac, 0x24,
+	0xf0, 0xed, 0x56, 0xf9, 0x83, 0xd9, 0xab, 0xdc, 0x67, 0xec, 0x31, 0x54,
+	0xd9, 0x33, 0xe2, 0x2d, 0xde, 0x57, 0xe8, 0x23, 0xcb, 0x63, 0x79, 0xba,
+	0x80, 0x82, 0x5d, 0x11, 0xaf, 0xd8, 0x66, 0x46, 0x81, 0xe4, 0xc8, 0x13,
+	0x0f, 0x03, 0x61, 0x48, 0x80, 0xa4, 0xe1, 0xed, 0x31, 0x8a, 0xca, 0xc9,
+	0x84, 0x0b, 0x9b, 0x51, 0x19, 0x72, 0x49, 0x39, 0x52, 0x0c, 0xca, 0x0b,
+	0x97, 0x2f, 0x49, 0x31, 0x7d, 0x58, 0xf8, 0x05, 0xf4, 0x97, 0x57, 0xd5,
+	0xec, 0xad, 0x60, 0x47, 0xb7, 0x7d, 0x1c, 0xd6, 0x70, 0x4d, 0x85, 0x94,
+	0xc4, 0x62, 0x38, 0x4e, 0x57, 0x68, 0xbe, 0xd5, 0x39, 0xca, 0xfc, 0x17,
+	0x84, 0xb0, 0x01, 0xcb, 0xa9, 0x9d, 0xaa, 0x21, 0x7c, 0xe6, 0xb2, 0x5e,
+	0xa7, 0x7a, 0x91, 0xa2, 0xb6, 0x3d, 0x48, 0x10, 0x44, 0xf5, 0xaf, 0xa1,
+	0xd2, 0x1a, 0x33, 0x06, 0x36, 0xbd, 0xea, 0x0c, 0x58, 0xfa, 0x60, 0x72,
+	0x8f, 0xb9, 0x8f, 0xa5, 0xa7, 0xf1, 0x0e, 0x6a, 0x7b, 0xe3, 0xa0, 0x7a,
+	0x87, 0x57, 0xc2, 0x7a, 0x37, 0x43, 0xf6, 0x48, 0x71, 0xb2, 0x23, 0xdc,
+	0xfd, 0x22, 0x74, 0x89, 0x21, 0xae, 0xf3, 0x94, 0xa4, 0xbc, 0xad, 0xb9,
+	0x2e, 0x7b, 0x88, 0x0f, 0x32, 0xc8, 0xf4, 0x3a, 0x19, 0x1e, 0x21, 0xe2,
+	0x3b, 0xe1, 0x7d, 0x69, 0x8a, 0x7c, 0xf7, 0x59, 0xcd, 0xc7, 0xe0, 0x81,
+	0xd8, 0xed, 0xdc, 0xe1, 0x6f, 0x3c, 0xe3, 0xb4, 0xd1, 0x8b, 0xe4, 0x87,
+	0xdc, 0x24, 0x5e, 0x0c, 0x28, 0x2b, 0x8b, 0x76, 0x0f, 0x88, 0xaf, 0xe3,
+	0x94, 0xb0, 0x74, 0x2e, 0xc6, 0x65, 0x69, 0xf7, 0xe3, 0x23, 0x5f, 0x35,
+	0xaa, 0x66, 0x53, 0xe6, 0xfc, 0x4b, 0x9f, 0xd5, 0xc2, 0xaa, 0x45, 0x09,
+	0x4c, 0x1d, 0x65, 0xbc, 0xc1, 0x8e, 0x77, 0x3a, 0x30, 0x73, 0x0b, 0x9f,
+	0x6f, 0x34, 0xfd, 0xec, 0x27, 0x80, 0x4e, 0x23, 0x96, 0x3d, 0xfc, 0x12,
+	0xb6, 0x61, 0xcc, 0x73, 0xd4, 0x7a, 0x67, 0xc2, 0xca, 0x58, 0xa0, 0x19,
+	0x15, 0x84, 0x61, 0xff, 0x9b, 0x25, 0x50, 0x92, 0x03, 0x7d, 0x9a, 0xf7,
+	0x62, 0x29, 0x4b, 0xfc, 0x25, 0x58, 0x40, 0x02, 0xca, 0xa4, 0x11, 0x64,
+	0x6e, 0xe2, 0x41, 0xeb, 0x4a, 0xcb, 0xd5, 0xe4, 0x40, 0x72, 0xbf, 0x54,
+	0x75, 0x65, 0xf6, 0xd8, 0x52, 0x17, 0xd0, 0x6f, 0x8a, 0x62, 0x8a, 0xac,
+	0xed, 0xf6, 0xf6, 0x59, 0x34, 0x99, 0x76, 0x4d, 0x75, 0xbf, 0x93, 0x50,
+	0x43, 0x7c, 0xaf, 0xc4, 0x6f, 0x32, 0x67, 0x5b, 0xd6, 0xd1, 0xee, 0xb9,
+	0x85, 0xf4, 0xa4, 0xd6, 0x17, 0x75, 0xe7, 0x9e, 0x01, 0x92, 0xf1, 0x65,
+	0xf4, 0xa8, 0x66, 0xe5, 0xa7, 0x70, 0x57, 0xa2, 0xc7, 0x4a, 0xd9, 0x5c,
+	0x56, 0x08, 0x62, 0x2c, 0x66, 0xd4, 0x7b, 0x9d, 0xc6, 0xe8, 0x39, 0x35,
+	0x35, 0xd9, 0x40, 0xa3, 0xeb, 0xb4, 0x9e, 0x38, 0x67, 0xdb, 0x0b, 0x5b,
+	0xf2, 0xf1, 0x9d, 0x2f, 0x31, 0xdd, 0xe7, 0x48, 0x71, 0x0b, 0x00, 0x01,
+	0x04, 0x6d, 0x9b, 0x07, 0x74, 0xe8, 0x44, 0x52, 0x01, 0xe8, 0x82, 0x76,
+	0x98, 0x9f, 0xd9, 0x27, 0x08, 0x01, 0x98, 0x86, 0x63, 0x91, 0x0f, 0x75,
+	0x7d, 0x16, 0x82, 0xd6, 0xb7, 0x1e, 0xc2, 0xe7, 0xa4, 0x71, 0xbc, 0x31,
+	0xda, 0xf9, 0x6b, 0xb4, 0x17, 0xb8, 0xce, 0xc0, 0x29, 0x72, 0xbe, 0xa8,
+	0x90, 0x5c, 0x99, 0x60, 0xda, 0x31, 0xbe, 0xb3, 0x5f, 0x11, 0xb3, 0x1f,
+	0x6a, 0xff, 0xb7, 0xdc, 0x8d, 0xbc, 0xde, 0x40, 0x0e, 0xf6, 0x9a, 0x77,
+	0xe7, 0xca, 0xa7, 0x65, 0xb0, 0xfe, 0x91, 0x27, 0xa9, 0xc0, 0xd0, 0x08,
+	0xce, 0xd5, 0xea, 0xa7, 0x8c, 0xc4, 0xd3, 0x20, 0x93, 0xef, 0x43, 0x52,
+	0xcd, 0x12, 0x38, 0x59, 0xda, 0x9a, 0xa6, 0xa6, 0xef, 0x08, 0x9c, 0xbe,
+	0xc5, 0xde, 0xc3, 0x8c, 0x18, 0x04, 0x09, 0xa0, 0x24, 0x8a, 0x98, 0x67,
+	0x30, 0xd6, 0x9b, 0xec, 0x85, 0x35, 0x14, 0x34, 0x35, 0x79, 0xc0, 0xc6,
+	0x07, 0x82, 0xae, 0x04, 0x4b, 0xbc, 0xb8, 0xf7, 0x67, 0xe6, 0x10, 0xe4,
+	0x2f, 0x06, 0x24, 0x3e, 0x25, 0x46, 0xeb, 0xbe, 0xa4, 0x20, 0xc7, 0x5e,
+	0xa8, 0x33, 0x01, 0x29, 0x52, 0xd9, 0x5c, 0xe2, 0x7d, 0x29, 0x9b, 0x22,
+	0xe6, 0x4c, 0xda, 0x8f, 0xa2, 0x5f, 0xbf, 0x8a, 0xf1, 0xf7, 0xa1, 0x4c,
+	0x4a, 0xb1, 0x13, 0xef, 0x09, 0x21, 0x28, 0x4f, 0xf7, 0xc1, 0x62, 0x79,
+	0xd9, 0x3a, 0xb1, 0x1f, 0x43, 0xc8, 0x63, 0x42, 0xc3, 0xa5, 0x77, 0x85,
+	0x71, 0xcd, 0xb7, 0x20, 0x63, 0xb9, 0x78, 0x3a, 0x26, 0xdd, 0x7d, 0x3f,
+	0xcf, 0x99, 0x09, 0x89, 0x6d, 0x21, 0x02, 0x89, 0x60, 0x8f, 0x56, 0xf5,
+	0x8f, 0x93, 0xee, 0x29, 0xdf, 0x84, 0x2c, 0x0f, 0x8e, 0xb9, 0x79, 0xb2,
+	0x2c, 0xbc, 0x93, 0x05, 0xcd, 0x36, 0xc1, 0x64, 0x5b, 0xeb, 0xf5, 0x05,
+	0x07, 0xa0, 0x24, 0x60, 0x96, 0x00, 0x00, 0x00, 0x1c, 0x00, 0x00, 0x00,
+	0x01, 0x01, 0x10, 0x60, 0x02, 0xc5, 0xa2, 0x72, 0xcc, 0xf9, 0x5f, 0x91,
+	0x49, 0x12, 0x36, 0x61, 0x07, 0x7f, 0x94, 0x79, 0x1f,
+};
+
+unsigned char aggr_mode_msg1[] = {
+	0x35, 0x45, 0x83, 0x49, 0xd3, 0x0d, 0x8c, 0xce, 0x2a, 0x61, 0x33, 0xb7,
+	0x90, 0xac, 0xbf, 0x93, 0x01, 0x10, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x01, 0xfa, 0x04, 0x00, 0x00, 0xb4, 0x00, 0x00, 0x00, 0x01,
+	0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0xa8, 0x01, 0x01, 0x00, 0x04,
+	0x03, 0x00, 0x00, 0x28, 0x01, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07,
+	0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01,
+	0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04,
+	0x00, 0x00, 0x0e, 0x10, 0x03, 0x00, 0x00, 0x28, 0x02, 0x01, 0x00, 0x00,
+	0x80, 0x01, 0x00, 0x07, 0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02,
+	0x80, 0x03, 0x00, 0x01, 0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01,
+	0x00, 0x0c, 0x00, 0x04, 0x00, 0x00, 0x0e, 0x10, 0x03, 0x00, 0x00, 0x28,
+	0x03, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07, 0x80, 0x0e, 0x01, 0x00,
+	0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01, 0x80, 0x04, 0x00, 0x0e,
+	0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04, 0x00, 0x00, 0x0e, 0x10,
+	0x00, 0x00, 0x00, 0x28, 0x04, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07,
+	0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01,
+	0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04,
+	0x00, 0x00, 0x0e, 0x10, 0x0a, 0x00, 0x00, 0x84, 0x30, 0xef, 0xec, 0x76,
+	0x82, 0x97, 0xb3, 0xdf, 0xe5, 0xed, 0x66, 0xc2, 0xa5, 0xf5, 0xf2, 0x79,
+	0x5d, 0x83, 0xf8, 0xc3, 0x80, 0x6e, 0xee, 0xae, 0x39, 0xa2, 0xd2, 0xea,
+	0x70, 0xa4, 0x79, 0xac, 0x8a, 0xbc, 0x91, 0xb4, 0xf6, 0xc2, 0x84, 0xbf,
+	0x3e, 0x85, 0xcc, 0x24, 0xdb, 0xbe, 0x9f, 0xcc, 0x43, 0x15, 0xda, 0x9e,
+	0x92, 0xd3, 0x3d, 0x86, 0xf5, 0x7f, 0x93, 0xe9, 0x01, 0x8d, 0x24, 0xda,
+	0x46, 0x9b, 0xc7, 0x4a, 0x73, 0xa5, 0xca, 0x8c, 0x74, 0x5c, 0x2c, 0xf6,
+	0xf9, 0x34, 0xa8, 0x7f, 0xd6, 0xf1, 0x70, 0x18, 0x2c, 0x2d, 0x50, 0x15,
+	0x29, 0x66, 0x90, 0x14, 0x20, 0x61, 0x52, 0x5c, 0xed, 0xc7, 0x45, 0x62,
+	0x1d, 0x94, 0xda, 0xc1, 0x13, 0x9c, 0x24, 0xc8, 0x91, 0xe7, 0xb6, 0xd2,
+	0xc3, 0x6a, 0x8f, 0xdd, 0xb1, 0xc0, 0x28, 0x20, 0xee, 0x8f, 0x20, 0x89,
+	0x49, 0x7f, 0x65, 0xcb, 0x05, 0x00, 0x00, 0x14, 0x88, 0x7a, 0xef, 0x69,
+	0x5b, 0xef, 0xc6, 0x48, 0xc7, 0x9e, 0xa5, 0x34, 0x80, 0xb0, 0xe5, 0x9c,
+	0x0d, 0x00, 0x00, 0x1a, 0x02, 0x11, 0x01, 0xf4, 0x63, 0x6c, 0x69, 0x65,
+	0x6e, 0x74, 0x2e, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x2e, 0x63,
+	0x6f, 0x6d, 0x0d, 0x00, 0x00, 0x14, 0xbf, 0xe8, 0x33, 0xa8, 0x34, 0x6e,
+	0x99, 0x8b, 0x0e, 0x20, 0xc6, 0xf3, 0xc3, 0x7a, 0x0a, 0xba, 0x0d, 0x00,
+	0x00, 0x14, 0xae, 0x9f, 0x80, 0x2b, 0xa2, 0x6d, 0xf4, 0x3e, 0xfc, 0xbf,
+	0x68, 0xb7, 0xd8, 0x33, 0xc9, 0xb1, 0x0d, 0x00, 0x00, 0x14, 0xf8, 0xdb,
+	0x07, 0xaa, 0xf0, 0xda, 0x38, 0x24, 0x21, 0x37, 0x98, 0x7b, 0xd6, 0xc3,
+	0xf4, 0x63, 0x0d, 0x00, 0x00, 0x14, 0x5d, 0x3e, 0xd3, 0x95, 0x07, 0x07,
+	0xf7, 0xbc, 0x4b, 0xd8, 0x8b, 0x89, 0x1f, 0x82, 0x0b, 0xa4, 0x0d, 0x00,
+	0x00, 0x14, 0x01, 0x76, 0x99, 0xa8, 0x8f, 0x50, 0xd0, 0x51, 0xd9, 0xaa,
+	0x6c, 0x6e, 0xd8, 0xb1, 0x33, 0x0e, 0x00, 0x00, 0x00, 0x14, 0xe1, 0xf3,
+	0x40, 0x32, 0xf0, 0x9f, 0x62, 0xdd, 0x6d, 0x9b, 0x84, 0x27, 0x0f, 0x19,
+	0x13, 0x20,
+};
+
+unsigned char quick_mode_msg1[] = {
+	0x9b, 0x92, 0xa5, 0x95, 0x43, 0x3e, 0x0b, 0x6c, 0xdc, 0x0c, 0xe4, 0x1e,
+	0xc8, 0x93, 0x2d, 0x42, 0x08, 0x10, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x01, 0xa4, 0x01, 0x00, 0x00, 0x18, 0x09, 0x93, 0x2e, 0x87,
+	0x15, 0x63, 0x52, 0x10, 0xc6, 0xb2, 0xf7, 0x5b, 0xec, 0xfc, 0x53, 0xcb,
+	0x87, 0xdb, 0x0a, 0xcd, 0x0a, 0x00, 0x00, 0xb8, 0x00, 0x00, 0x00, 0x01,
+	0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0xac, 0x01, 0x03, 0x04, 0x04,
+	0xca, 0x44, 0x58, 0xb7, 0x03, 0x00, 0x00, 0x28, 0x01, 0x01, 0x00, 0x00,
+	0x80, 0x01, 0x00, 0x07, 0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02,
+	0x80, 0x03, 0x00, 0x01, 0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01,
+	0x00, 0x0c, 0x00, 0x04, 0x00, 0x00, 0x0e, 0x10, 0x03, 0x00, 0x00, 0x28,
+	0x02, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07, 0x80, 0x0e, 0x01, 0x00,
+	0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01, 0x80, 0x04, 0x00, 0x0e,
+	0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04, 0x00, 0x00, 0x0e, 0x10,
+	0x03, 0x00, 0x00, 0x28, 0x03, 0x01, 0x00, 0x00, 0x80, 0x01, 0x00, 0x07,
+	0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02, 0x80, 0x03, 0x00, 0x01,
+	0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01, 0x00, 0x0c, 0x00, 0x04,
+	0x00, 0x00, 0x0e, 0x10, 0x00, 0x00, 0x00, 0x28, 0x04, 0x01, 0x00, 0x00,
+	0x80, 0x01, 0x00, 0x07, 0x80, 0x0e, 0x01, 0x00, 0x80, 0x02, 0x00, 0x02,
+	0x80, 0x03, 0x00, 0x01, 0x80, 0x04, 0x00, 0x0e, 0x80, 0x0b, 0x00, 0x01,
+	0x00, 0x0c, 0x00, 0x04, 0x00, 0x00, 0x0e, 0x10, 0x04, 0x00, 0x00, 0x14,
+	0xb1, 0x39, 0xfd, 0x75, 0xd8, 0x9e, 0xf7, 0x24, 0xa5, 0x77, 0x39, 0xf9,
+	0x3b, 0x86, 0x26, 0x96, 0x05, 0x00, 0x00, 0x84, 0x5c, 0x58, 0xf3, 0x9b,
+	0xa0, 0x6f, 0xea, 0x88, 0x7d, 0x24, 0x36, 0xba, 0x42, 0x69, 0x13, 0x73,
+	0x4e, 0x4b, 0x77, 0x32, 0x1d, 0xc0, 0xd5, 0x51, 0x05, 0xba, 0x7f, 0x3d,
+	0x24, 0x2e, 0xaf, 0xe8, 0x15, 0x76, 0x41, 0x9a, 0xe8, 0xad, 0x44, 0xae,
+	0xcc, 0xb5, 0x65, 0x6f, 0x5e, 0x10, 0x3b, 0xfb, 0x5d, 0xd4, 0xcf, 0xc2,
+	0x38, 0xdd, 0x5a, 0xd4, 0x1d, 0x98, 0xfe, 0xdd, 0x0d, 0x23, 0x55, 0x25,
+	0x9d, 0x01, 0xd2, 0xfb, 0xe3, 0xe3, 0x96, 0xfd, 0x71, 0xcc, 0xa2, 0x00,
+	0x16, 0x6e, 0x4b, 0x9f, 0x8b, 0x45, 0xfd, 0x5a, 0xd7, 0x74, 0x43, 0x77,
+	0x88, 0xa4, 0xa6, 0x7a, 0xb4, 0xc7, 0x1e, 0x19, 0xe3, 0xad, 0x91, 0x19,
+	0x66, 0xde, 0x58, 0x1f, 0x9d, 0xb3, 0x6c, 0xc3, 0x0f, 0x8a, 0x6f, 0x4d,
+	0x6b, 0xa8, 0xb3, 0xbc, 0x68, 0x6f, 0x45, 0x27, 0x9e, 0x26, 0xfd, 0xd3,
+	0x89, 0xa0, 0xef, 0x8d, 0x05, 0x00, 0x00, 0x10, 0x04, 0x11, 0x01, 0xf4,
+	0x37, 0x4b, 0x16, 0xcd, 0x3f, 0xef, 0xf8, 0x06, 0x00, 0x00, 0x00, 0x10,
+	0x04, 0x11, 0x01, 0xf4, 0x8f, 0xca, 0xd1, 0x4e, 0x42, 0x39, 0x19, 0xd7,
+};
+
+unsigned char info_dpd[] = {
+	0xf4, 0x2d, 0x0d, 0x9f, 0x49, 0xfa, 0x65, 0x5b, 0x2d, 0x1e, 0xca, 0xf9,
+	0x27, 0x32, 0xc1, 0x6e, 0x08, 0x10, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x54, 0x0b, 0x00, 0x00, 0x18, 0xdd, 0x04, 0x6c, 0xa4,
+	0x92, 0x0c, 0xc0, 0xb2, 0x46, 0xda, 0x69, 0xa0, 0xf4, 0xc3, 0xd1, 0xb0,
+	0xa5, 0xcc, 0x7b, 0xfa, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00, 0x01,
+	0x01, 0x10, 0x8d, 0x28, 0xa5, 0xd6, 0xcc, 0xfa, 0x28, 0xf2, 0x00, 0xbb,
+	0xa7, 0xa9, 0xea, 0x01, 0xd5, 0x8f, 0xec, 0x39, 0x50, 0x7b, 0x47, 0x9f,
+};
+
+#endif /* ike_msgs_data_h */
@@ -0,0 +1,967 @@
+//
+//  racoon_loadgen.c
+//  ipsec
+//
+//  Copyright (c) 2026 Apple Inc. All rights reserved.
+//
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <net/pfkeyv2.h>
+#include <netinet6/ipsec.h>
+#include <netinet/in_var.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <libproc.h>
+#endif
+
+#include "isakmp.h"
+#include "isakmp_xauth.h"
+#include "vpn_control.h"
+#include "racoon_loadgen.h"
+#include "racoon_pfkeyemu.h"
+
+#define LOADGEN_LOCAL		"127.0.0.1"
+#define LOADGEN_PEERBASE	0x7f010000	/* session i talks to 127.1.x.y, i + 1 */
+#define LOADGEN_PSK			"racoon-loadgen"
+#define LOADGEN_STARTUP		10.0		/* seconds to wait for racoon */
+#define LOADGEN_TIMEOUT		30.0		/* seconds before a handshake is given up */
+#define LOADGEN_BUFSIZE		8192		/* VPN control messages are much smaller */
+#define LOADGEN_LOOPBACK	"lo0"
+
+extern char **environ;
+
+enum {
+	LOADGEN_IDLE,
+	LOADGEN_PH1,
+	LOADGEN_PH2,
+};
+
+struct loadgen_slot {
+	u_int32_t address;		/* network byte order */
+	int aliased;			/* address added to the loopback by us */
+	int state;
+	double start;			/* connect sent */
+	double ph1;				/* phase 1 established */
+};
+
+struct loadgen_samples {
+	double *v;
+	size_t n;
+};
+
+struct loadgen_run {
+	const struct loadgen_config *cf;
+	char dir[sizeof("/tmp/racoon_loadgen.XXXXXX")];
+	pid_t responder;
+	pid_t initiator;
+	int sock;				/* initiator's VPN control socket */
+	pid_t pfkey_responder;	/* PF_KEY stand-ins */
+	pid_t pfkey_initiator;
+	int pfkey;				/* socket on the initiator's stand-in */
+	struct loadgen_slot *slots;
+	struct loadgen_samples ph1;
+	struct loadgen_samples ph2;
+	unsigned long started;
+	unsigned long completed;
+	unsigned long failed;
+	unsigned long timedout;
+	int metrics;			/* initiator metrics reply seen */
+	size_t inlen;
+	char inbuf[LOADGEN_BUFSIZE];
+	u_int32_t msg[LOADGEN_BUFSIZE / sizeof(u_int32_t)];	/* aligned copy */
+};
+
+static double
+loadgen_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *
+loadgen_addr2str(u_int32_t address, char *buf, size_t len)
+{
+	struct in_addr in;
+
+	in.s_addr = address;
+	return inet_ntop(AF_INET, &in, buf, len);
+}
+
+static void
+loadgen_sockaddr(struct sockaddr_in *sin, u_int32_t address)
+{
+	memset(sin, 0, sizeof(*sin));
+#ifdef __APPLE__
+	sin->sin_len = sizeof(*sin);
+#endif
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = address;
+}
+
+/*
+ * only 127.0.0.1 is on the loopback out of the box, so the peer
+ * addresses are added as aliases unless they can be bound already.
+ * the ones added here are removed again by loadgen_unalias().
+ */
+static int
+loadgen_alias(struct loadgen_run *run)
+{
+	struct sockaddr_in sin;
+	struct in_aliasreq ifra;
+	char addr[INET_ADDRSTRLEN];
+	int s, so, i, n = 0;
+
+	if ((s = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		fprintf(stdout, "socket: %s\n", strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < run->cf->sessions; i++) {
+		struct loadgen_slot *sl = &run->slots[i];
+
+		loadgen_sockaddr(&sin, sl->address);
+		if ((so = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+			break;
+		if (bind(so, (struct sockaddr *)&sin, sizeof(sin)) == 0) {
+			close(so);
+			continue;
+		}
+		close(so);
+		if (errno != EADDRNOTAVAIL)
+			break;
+
+		memset(&ifra, 0, sizeof(ifra));
+		strlcpy(ifra.ifra_name, LOADGEN_LOOPBACK, sizeof(ifra.ifra_name));
+		memcpy(&ifra.ifra_addr, &sin, sizeof(sin));
+		loadgen_sockaddr(&ifra.ifra_mask, htonl(INADDR_BROADCAST));
+		if (ioctl(s, SIOCAIFADDR, &ifra) < 0) {
+			fprintf(stdout, "cannot add %s to %s: %s\n",
+				loadgen_addr2str(sl->address, addr, sizeof(addr)),
+				LOADGEN_LOOPBACK, strerror(errno));
+			close(s);
+			return -1;
+		}
+		sl->aliased = 1;
+		n++;
+	}
+	close(s);
+	if (i < run->cf->sessions) {
+		fprintf(stdout, "cannot bind %s: %s\n",
+			loadgen_addr2str(run->slots[i].address, addr, sizeof(addr)),
+			strerror(errno));
+		return -1;
+	}
+	if (n && !run->cf->quiet)
+		fprintf(stdout, "added %d address(es) to %s\n", n, LOADGEN_LOOPBACK);
+
+	return 0;
+}
+
+static void
+loadgen_unalias(struct loadgen_run *run)
+{
+	struct ifreq ifr;
+	int s, i;
+
+	if (run->slots == NULL ||
+	    (s = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		return;
+	for (i = 0; i < run->cf->sessions; i++) {
+		if (!run->slots[i].aliased)
+			continue;
+		memset(&ifr, 0, sizeof(ifr));
+		strlcpy(ifr.ifr_name, LOADGEN_LOOPBACK, sizeof(ifr.ifr_name));
+		loadgen_sockaddr((struct sockaddr_in *)&ifr.ifr_addr,
+			run->slots[i].address);
+		(void)ioctl(s, SIOCDIFADDR, &ifr);
+		run->slots[i].aliased = 0;
+	}
+	close(s);
+}
+
+static int
+loadgen_write_psk(struct loadgen_run *run)
+{
+	char path[MAXPATHLEN], addr[INET_ADDRSTRLEN];
+	FILE *fp;
+	int fd, i;
+
+	snprintf(path, sizeof(path), "%s/psk.txt", run->dir);
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+	    (fp = fdopen(fd, "w")) == NULL) {
+		fprintf(stdout, "cannot create %s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	fprintf(fp, "%s\t%s\n", LOADGEN_LOCAL, LOADGEN_PSK);
+	for (i = 0; i < run->cf->sessions; i++)
+		fprintf(fp, "%s\t%s\n",
+			loadgen_addr2str(run->slots[i].address, addr, sizeof(addr)),
+			LOADGEN_PSK);
+	fclose(fp);
+
+	return 0;
+}
+
+static int
+loadgen_write_conf(struct loadgen_run *run, const char *name, int responder)
+{
+	const struct loadgen_config *cf = run->cf;
+	char path[MAXPATHLEN], addr[INET_ADDRSTRLEN];
+	const char *ameth;
+	FILE *fp;
+	int i;
+
+	switch (cf->mode) {
+	case LOADGEN_MODE_XAUTH:
+		ameth = responder ? "xauth_psk_server" : "xauth_psk_client";
+		break;
+	case LOADGEN_MODE_CERT:
+		ameth = "rsasig";
+		break;
+	default:
+		ameth = "pre_shared_key";
+		break;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s.conf", run->dir, name);
+	if ((fp = fopen(path, "w")) == NULL) {
+		fprintf(stdout, "cannot create %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	fprintf(fp, "path pre_shared_key \"%s/psk.txt\";\n", run->dir);
+	fprintf(fp, "path pidfile \"%s/%s.pid\";\n", run->dir, name);
+	/* retransmits are logged at notify level */
+	fprintf(fp, "log notify;\n\n");
+
+	fprintf(fp, "listen\n{\n");
+	if (responder) {
+		for (i = 0; i < cf->sessions; i++)
+			fprintf(fp, "\tisakmp %s [%d];\n",
+				loadgen_addr2str(run->slots[i].address, addr, sizeof(addr)),
+				PORT_ISAKMP);
+	} else
+		fprintf(fp, "\tisakmp %s [%d];\n", LOADGEN_LOCAL, PORT_ISAKMP);
+	fprintf(fp, "}\n\n");
+
+	fprintf(fp, "timer\n{\n\tcounter 5;\n\tinterval 2 sec;\n"
+		"\tphase1 %d sec;\n\tphase2 %d sec;\n}\n\n",
+		(int)LOADGEN_TIMEOUT, (int)LOADGEN_TIMEOUT);
+
+	fprintf(fp, "remote anonymous\n{\n");
+	fprintf(fp, "\texchange_mode %s;\n",
+		cf->mode == LOADGEN_MODE_AGGRESSIVE ? "aggressive" : "main");
+	fprintf(fp, "\tmy_identifier address;\n");
+	fprintf(fp, "\tproposal_check obey;\n");
+	fprintf(fp, "\tnat_traversal off;\n");
+	fprintf(fp, "\tdpd_delay 0;\n");
+	if (responder) {
+		fprintf(fp, "\tpassive on;\n");
+		fprintf(fp, "\tgenerate_policy on;\n");
+	} else if (cf->mode == LOADGEN_MODE_XAUTH)
+		fprintf(fp, "\tmode_cfg on;\n");
+	if (cf->mode == LOADGEN_MODE_CERT) {
+		fprintf(fp, "\tcertificate_type x509 in_keychain \"%s\";\n",
+			cf->certref);
+		fprintf(fp, "\tverify_cert off;\n");
+	}
+	fprintf(fp, "\tproposal {\n"
+		"\t\tencryption_algorithm aes;\n"
+		"\t\thash_algorithm sha1;\n"
+		"\t\tauthentication_method %s;\n"
+		"\t\tdh_group modp2048;\n"
+		"\t}\n}\n\n", ameth);
+
+	fprintf(fp, "sainfo anonymous\n{\n"
+		"\tlifetime time 1 hour;\n"
+		"\tencryption_algorithm aes;\n"
+		"\tauthentication_algorithm hmac_sha1;\n"
+		"\tcompression_algorithm deflate;\n}\n");
+
+	if (responder && cf->mode == LOADGEN_MODE_XAUTH)
+		fprintf(fp, "\nmode_cfg\n{\n"
+			"\tauth_source system;\n"
+			"\tnetwork4 10.255.0.1;\n"
+			"\tnetmask4 255.255.0.0;\n"
+			"\tpool_size %d;\n}\n", cf->sessions);
+
+	fclose(fp);
+	return 0;
+}
+
+static pid_t
+loadgen_spawn(struct loadgen_run *run, const char *name)
+{
+	char conf[MAXPATHLEN], log[MAXPATHLEN], sock[MAXPATHLEN], pfkey[MAXPATHLEN];
+	char workers[16];
+	char *argv[] = { (char *)run->cf->racoon, "-F", "-f", conf, "-l", log,
+		"-V", sock, "-K", pfkey, NULL, NULL, NULL };
+	pid_t pid;
+	int error;
+
+	snprintf(conf, sizeof(conf), "%s/%s.conf", run->dir, name);
+	snprintf(log, sizeof(log), "%s/%s.log", run->dir, name);
+	snprintf(sock, sizeof(sock), "%s/%s.sock", run->dir, name);
+	snprintf(pfkey, sizeof(pfkey), "%s/%s.pfkey", run->dir, name);
+	if (run->cf->workers > 0) {
+		snprintf(workers, sizeof(workers), "%d", run->cf->workers);
+		argv[10] = "-N";
+		argv[11] = workers;
+	}
+
+	if ((error = posix_spawn(&pid, run->cf->racoon, NULL, NULL, argv, environ)) != 0) {
+		fprintf(stdout, "cannot start %s: %s\n", run->cf->racoon, strerror(error));
+		return -1;
+	}
+
+	return pid;
+}
+
+/*
+ * each racoon gets a PF_KEY stand-in of its own, as two daemons sharing
+ * one SAD would step on each other's larval SAs; with one, racoon also
+ * leaves its sandbox alone, which has no business with our scratch
+ * directory.  for phase 2, the initiator's is given the policies the
+ * acquires are raised for.
+ */
+static int
+loadgen_pfkey(struct loadgen_run *run)
+{
+	char path[MAXPATHLEN];
+	struct sockaddr_in local, peer;
+	struct sadb_msg *msg;
+	int i, dir, error;
+
+	snprintf(path, sizeof(path), "%s/responder.pfkey", run->dir);
+	if ((run->pfkey_responder = pfkeyemu_spawn(path, run->cf->pfkey_latency)) < 0)
+		return -1;
+	snprintf(path, sizeof(path), "%s/initiator.pfkey", run->dir);
+	if ((run->pfkey_initiator = pfkeyemu_spawn(path, run->cf->pfkey_latency)) < 0)
+		return -1;
+	if ((run->pfkey = pfkeyemu_open(path)) < 0) {
+		fprintf(stdout, "cannot connect to %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (!run->cf->ph2)
+		return 0;
+	loadgen_sockaddr(&local, inet_addr(LOADGEN_LOCAL));
+	for (i = 0; i < run->cf->sessions; i++) {
+		loadgen_sockaddr(&peer, run->slots[i].address);
+		for (dir = IPSEC_DIR_INBOUND; dir <= IPSEC_DIR_OUTBOUND; dir++) {
+			if (dir == IPSEC_DIR_OUTBOUND)
+				error = pfkeyemu_spdadd(run->pfkey, (struct sockaddr *)&local,
+					(struct sockaddr *)&peer, dir);
+			else
+				error = pfkeyemu_spdadd(run->pfkey, (struct sockaddr *)&peer,
+					(struct sockaddr *)&local, dir);
+			if (error < 0 || (msg = pfkeyemu_recv(run->pfkey, 1000)) == NULL)
+				return -1;
+			error = msg->sadb_msg_errno;
+			free(msg);
+			if (error != 0) {
+				fprintf(stdout, "cannot add a policy: %s\n", strerror(error));
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int
+loadgen_send(struct loadgen_run *run, void *msg, size_t len)
+{
+	ssize_t n;
+
+	n = send(run->sock, msg, len, 0);
+	if (n != len) {
+		fprintf(stdout, "vpn control send failed: %s\n",
+			n < 0 ? strerror(errno) : "short write");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+loadgen_cmd(struct loadgen_run *run, u_int16_t type, int slot)
+{
+	struct vpnctl_cmd_connect cmd;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.hdr.msg_type = htons(type);
+	cmd.hdr.cookie = htonl(slot + 1);
+	cmd.hdr.len = htons(sizeof(cmd) - sizeof(cmd.hdr));
+	cmd.address = run->slots[slot].address;
+
+	return loadgen_send(run, &cmd, sizeof(cmd));
+}
+
+static int
+loadgen_bind(struct loadgen_run *run, int slot)
+{
+	static const char vers[] = "racoon_loadgen";
+	struct {
+		struct vpnctl_cmd_bind cmd;
+		char vers[sizeof(vers) - 1];
+	} __attribute__((__packed__)) msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.cmd.hdr.msg_type = htons(VPNCTL_CMD_BIND);
+	msg.cmd.hdr.cookie = htonl(slot + 1);
+	msg.cmd.hdr.len = htons(sizeof(msg) - sizeof(msg.cmd.hdr));
+	msg.cmd.address = run->slots[slot].address;
+	msg.cmd.vers_len = htons(sizeof(msg.vers));
+	memcpy(msg.vers, vers, sizeof(msg.vers));
+
+	return loadgen_send(run, &msg, sizeof(msg));
+}
+
+static int
+loadgen_xauth(struct loadgen_run *run, int slot)
+{
+	struct vpnctl_cmd_xauth_info *cmd;
+	struct isakmp_data *attr;
+	const char *pass;
+	size_t ulen, plen, len;
+	char buf[512];
+
+	if ((pass = strchr(run->cf->xauth, ':')) == NULL)
+		return -1;
+	ulen = pass - run->cf->xauth;
+	plen = strlen(++pass);
+	len = sizeof(*cmd) + 2 * sizeof(*attr) + ulen + plen;
+	if (len > sizeof(buf))
+		return -1;
+
+	memset(buf, 0, sizeof(buf));
+	cmd = (struct vpnctl_cmd_xauth_info *)buf;
+	cmd->hdr.msg_type = htons(VPNCTL_CMD_XAUTH_INFO);
+	cmd->hdr.cookie = htonl(slot + 1);
+	cmd->hdr.len = htons(len - sizeof(cmd->hdr));
+	cmd->address = run->slots[slot].address;
+
+	attr = (struct isakmp_data *)(cmd + 1);
+	attr->type = htons(XAUTH_USER_NAME);
+	attr->lorv = htons(ulen);
+	memcpy(attr + 1, run->cf->xauth, ulen);
+
+	attr = (struct isakmp_data *)((char *)(attr + 1) + ulen);
+	attr->type = htons(XAUTH_USER_PASSWORD);
+	attr->lorv = htons(plen);
+	memcpy(attr + 1, pass, plen);
+
+	return loadgen_send(run, buf, len);
+}
+
+static void
+loadgen_sample(struct loadgen_samples *s, double v)
+{
+	/* both arrays are sized for every handshake up front */
+	s->v[s->n++] = v;
+}
+
+static int
+loadgen_start(struct loadgen_run *run, int slot)
+{
+	struct loadgen_slot *sl = &run->slots[slot];
+
+	sl->state = LOADGEN_PH1;
+	sl->start = loadgen_now();
+	run->started++;
+
+	return loadgen_cmd(run, VPNCTL_CMD_CONNECT, slot);
+}
+
+/* tear the session down so the slot can run its next handshake */
+static int
+loadgen_finish(struct loadgen_run *run, int slot)
+{
+	run->slots[slot].state = LOADGEN_IDLE;
+	return loadgen_cmd(run, VPNCTL_CMD_DISCONNECT, slot);
+}
+
+static int
+loadgen_ph1_established(struct loadgen_run *run, int slot)
+{
+	struct loadgen_slot *sl = &run->slots[slot];
+	struct sockaddr_in local, peer;
+
+	sl->ph1 = loadgen_now();
+	loadgen_sample(&run->ph1, sl->ph1 - sl->start);
+
+	if (!run->cf->ph2) {
+		run->completed++;
+		return loadgen_finish(run, slot);
+	}
+
+	/* as if the outbound policy had caught a packet */
+	sl->state = LOADGEN_PH2;
+	loadgen_sockaddr(&local, inet_addr(LOADGEN_LOCAL));
+	loadgen_sockaddr(&peer, sl->address);
+
+	return pfkeyemu_acquire(run->pfkey, (struct sockaddr *)&local,
+		(struct sockaddr *)&peer);
+}
+
+static int
+loadgen_ph2_established(struct loadgen_run *run, int slot)
+{
+	struct loadgen_slot *sl = &run->slots[slot];
+
+	loadgen_sample(&run->ph2, loadgen_now() - sl->ph1);
+	run->completed++;
+
+	return loadgen_finish(run, slot);
+}
+
+static const char *
+loadgen_metricname(int id, int subtype)
+{
+	static char name[32];
+
+	switch (id) {
+	case VPNCTL_METRIC_LATENCY_RECV:
+		return "recv";
+	case VPNCTL_METRIC_LATENCY_DH_GENERATE:
+		return "dh generate";
+	case VPNCTL_METRIC_LATENCY_DH_COMPUTE:
+		return "dh compute";
+	case VPNCTL_METRIC_LATENCY_SIGN:
+		return "sign";
+	case VPNCTL_METRIC_LATENCY_VERIFY:
+		return "verify";
+	case VPNCTL_METRIC_LATENCY_PH1:
+		return "phase 1";
+	case VPNCTL_METRIC_LATENCY_PH2:
+		return "phase 2";
+	case VPNCTL_METRIC_LATENCY_PFKEY:
+		snprintf(name, sizeof(name), "pfkey %d", subtype);
+		return name;
+	default:
+		snprintf(name, sizeof(name), "metric %d", id);
+		return name;
+	}
+}
+
+/* the initiator's own view, as returned by VPNCTL_CMD_GET_METRICS */
+static void
+loadgen_print_metrics(struct vpnctl_metrics *m, size_t len)
+{
+	struct vpnctl_metric_counter *c;
+	struct vpnctl_metric_histogram *h;
+	int nc, nh, i;
+
+	nc = ntohs(m->counter_count);
+	nh = ntohs(m->histogram_count);
+	if (len < sizeof(*m) + nc * sizeof(*c) + nh * sizeof(*h))
+		return;
+
+	c = (struct vpnctl_metric_counter *)(m + 1);
+	h = (struct vpnctl_metric_histogram *)(c + nc);
+	fprintf(stdout, "\n%-12s %10s %10s %10s %10s %10s\n", "initiator (us)",
+		"count", "p50", "p99", "p999", "max");
+	for (i = 0; i < nh; i++, h++)
+		fprintf(stdout, "%-12s %10u %10u %10u %10u %10u\n",
+			loadgen_metricname(ntohs(h->id), ntohs(h->subtype)),
+			ntohl(h->count), ntohl(h->p50), ntohl(h->p99),
+			ntohl(h->p999), ntohl(h->max));
+}
+
+static int
+loadgen_dispatch(struct loadgen_run *run, struct vpnctl_hdr *hdr, size_t len)
+{
+	u_int32_t address;
+	int slot;
+
+	if (ntohs(hdr->msg_type) == VPNCTL_CMD_GET_METRICS) {
+		if (hdr->result == 0)
+			loadgen_print_metrics((struct vpnctl_metrics *)hdr, len);
+		run->metrics = 1;
+		return 0;
+	}
+
+	/* replies to our commands echo the cookie, which is the slot + 1 */
+	if ((ntohs(hdr->msg_type) & 0x8000) == 0) {
+		if (hdr->result == 0)
+			return 0;
+		slot = ntohl(hdr->cookie) - 1;
+		if (slot < 0 || slot >= run->cf->sessions)
+			return 0;
+		fprintf(stdout, "command 0x%04x failed for session %d\n",
+			ntohs(hdr->msg_type), slot);
+		if (run->slots[slot].state != LOADGEN_IDLE) {
+			run->failed++;
+			run->slots[slot].state = LOADGEN_IDLE;
+		}
+		return 0;
+	}
+
+	if (len < sizeof(*hdr) + sizeof(address))
+		return 0;
+	memcpy(&address, hdr + 1, sizeof(address));
+	slot = ntohl(address) - LOADGEN_PEERBASE - 1;
+	if (slot < 0 || slot >= run->cf->sessions ||
+	    run->slots[slot].state == LOADGEN_IDLE)
+		return 0;
+
+	switch (ntohs(hdr->msg_type)) {
+	case VPNCTL_STATUS_PH1_ESTABLISHED:
+		if (run->slots[slot].state == LOADGEN_PH1)
+			return loadgen_ph1_established(run, slot);
+		break;
+	case VPNCTL_STATUS_PH2_ESTABLISHED:
+		if (run->slots[slot].state == LOADGEN_PH2)
+			return loadgen_ph2_established(run, slot);
+		break;
+	case VPNCTL_STATUS_NEED_AUTHINFO:
+	case VPNCTL_STATUS_NEED_REAUTHINFO:
+		if (run->cf->xauth != NULL && loadgen_xauth(run, slot) == 0)
+			break;
+		/* FALLTHROUGH */
+	case VPNCTL_STATUS_IKE_FAILED:
+		run->failed++;
+		return loadgen_finish(run, slot);
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int
+loadgen_read(struct loadgen_run *run)
+{
+	struct vpnctl_hdr hdr;
+	size_t off, mlen;
+	ssize_t n;
+
+	n = recv(run->sock, run->inbuf + run->inlen,
+		sizeof(run->inbuf) - run->inlen, 0);
+	if (n <= 0) {
+		fprintf(stdout, "vpn control socket closed: %s\n",
+			n < 0 ? strerror(errno) : "EOF");
+		return -1;
+	}
+	run->inlen += n;
+
+	for (off = 0; run->inlen - off >= sizeof(hdr); off += mlen) {
+		memcpy(&hdr, run->inbuf + off, sizeof(hdr));
+		mlen = sizeof(hdr) + ntohs(hdr.len);
+		if (mlen > sizeof(run->inbuf))
+			return -1;
+		if (run->inlen - off < mlen)
+			break;
+		memcpy(run->msg, run->inbuf + off, mlen);
+		if (loadgen_dispatch(run, (struct vpnctl_hdr *)run->msg, mlen) < 0)
+			return -1;
+	}
+	memmove(run->inbuf, run->inbuf + off, run->inlen - off);
+	run->inlen -= off;
+
+	return 0;
+}
+
+static int
+loadgen_connect(struct loadgen_run *run)
+{
+	struct sockaddr_un sun;
+	double deadline = loadgen_now() + LOADGEN_STARTUP;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/initiator.sock", run->dir);
+
+	do {
+		if ((run->sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			return -1;
+		if (connect(run->sock, (struct sockaddr *)&sun, sizeof(sun)) == 0)
+			return 0;
+		close(run->sock);
+		run->sock = -1;
+		usleep(100000);
+	} while (loadgen_now() < deadline);
+
+	fprintf(stdout, "cannot connect to %s\n", sun.sun_path);
+	return -1;
+}
+
+/* resident set size in KiB, or 0 when it cannot be read */
+static unsigned long
+loadgen_rss(pid_t pid)
+{
+#ifdef __APPLE__
+	struct proc_taskinfo ti;
+
+	if (proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &ti, sizeof(ti)) != sizeof(ti))
+		return 0;
+	return ti.pti_resident_size / 1024;
+#else
+	char path[64], line[128];
+	unsigned long kb = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (sscanf(line, "VmRSS: %lu", &kb) == 1)
+			break;
+	fclose(fp);
+	return kb;
+#endif
+}
+
+/* retransmits sent by either side, as logged by racoon */
+static unsigned long
+loadgen_retransmits(struct loadgen_run *run, const char *name)
+{
+	char path[MAXPATHLEN], line[1024];
+	unsigned long count = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s.log", run->dir, name);
+	if ((fp = fopen(path, "r")) == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (strstr(line, "Resend Phase 1 packet") != NULL ||
+		    strstr(line, "Resend Phase 2 packet") != NULL)
+			count++;
+	fclose(fp);
+	return count;
+}
+
+static int
+loadgen_cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+loadgen_print_latency(const char *name, struct loadgen_samples *s)
+{
+	if (s->n == 0) {
+		fprintf(stdout, "%-12s %10s %10s %10s %10s\n", name, "-", "-", "-", "-");
+		return;
+	}
+	qsort(s->v, s->n, sizeof(double), loadgen_cmpdouble);
+	fprintf(stdout, "%-12s %10.2f %10.2f %10.2f %10.2f\n", name,
+		s->v[(s->n - 1) * 50 / 100] * 1e3,
+		s->v[(s->n - 1) * 99 / 100] * 1e3,
+		s->v[(s->n - 1) * 999 / 1000] * 1e3,
+		s->v[s->n - 1] * 1e3);
+}
+
+static const char *
+loadgen_modename(int mode)
+{
+	switch (mode) {
+	case LOADGEN_MODE_AGGRESSIVE:
+		return "aggressive";
+	case LOADGEN_MODE_XAUTH:
+		return "main+xauth";
+	case LOADGEN_MODE_CERT:
+		return "main+cert";
+	default:
+		return "main";
+	}
+}
+
+static void
+loadgen_stop(pid_t pid)
+{
+	int status;
+
+	if (pid <= 0)
+		return;
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+}
+
+/*
+ * res, if not NULL, gets the counts and the time taken.
+ */
+int
+racoon_loadgen(const struct loadgen_config *cf, struct loadgen_result *res)
+{
+	struct loadgen_run run;
+	unsigned long rss_r0, rss_i0, rss_r1, rss_i1;
+	double start, elapsed, now;
+	struct pollfd pfd[2];
+	struct sadb_msg *msg;
+	struct vpnctl_hdr cmd;
+	int i, error = -1;
+
+	if (cf->sessions <= 0 || cf->sessions > LOADGEN_MAXSESSIONS ||
+	    cf->handshakes <= 0 ||
+	    (cf->mode == LOADGEN_MODE_CERT && cf->certref == NULL) ||
+	    (cf->mode == LOADGEN_MODE_XAUTH &&
+	     (cf->xauth == NULL || strchr(cf->xauth, ':') == NULL))) {
+		fprintf(stdout, "invalid load generator configuration\n");
+		return -1;
+	}
+
+	memset(&run, 0, sizeof(run));
+	run.cf = cf;
+	run.sock = run.pfkey = -1;
+	run.slots = calloc(cf->sessions, sizeof(*run.slots));
+	run.ph1.v = calloc(cf->handshakes, sizeof(double));
+	run.ph2.v = calloc(cf->handshakes, sizeof(double));
+	if (run.slots == NULL || run.ph1.v == NULL || run.ph2.v == NULL)
+		goto end;
+	for (i = 0; i < cf->sessions; i++)
+		run.slots[i].address = htonl(LOADGEN_PEERBASE + i + 1);
+
+	strlcpy(run.dir, "/tmp/racoon_loadgen.XXXXXX", sizeof(run.dir));
+	if (mkdtemp(run.dir) == NULL) {
+		fprintf(stdout, "cannot create a work directory: %s\n", strerror(errno));
+		goto end;
+	}
+	if (loadgen_alias(&run) < 0)
+		goto end;
+	if (loadgen_write_psk(&run) < 0 ||
+	    loadgen_write_conf(&run, "responder", 1) < 0 ||
+	    loadgen_write_conf(&run, "initiator", 0) < 0)
+		goto end;
+
+	if (loadgen_pfkey(&run) < 0)
+		goto end;
+
+	if ((run.responder = loadgen_spawn(&run, "responder")) < 0 ||
+	    (run.initiator = loadgen_spawn(&run, "initiator")) < 0 ||
+	    loadgen_connect(&run) < 0)
+		goto end;
+
+	for (i = 0; i < cf->sessions; i++)
+		if (loadgen_bind(&run, i) < 0)
+			goto end;
+
+	rss_r0 = loadgen_rss(run.responder);
+	rss_i0 = loadgen_rss(run.initiator);
+
+	start = loadgen_now();
+	while (run.completed + run.failed + run.timedout < cf->handshakes) {
+		now = loadgen_now();
+		for (i = 0; i < cf->sessions; i++) {
+			struct loadgen_slot *sl = &run.slots[i];
+
+			if (sl->state == LOADGEN_IDLE) {
+				if (run.started < cf->handshakes &&
+				    loadgen_start(&run, i) < 0)
+					goto end;
+			} else if (now - sl->start > LOADGEN_TIMEOUT) {
+				run.timedout++;
+				if (loadgen_finish(&run, i) < 0)
+					goto end;
+			}
+		}
+
+		pfd[0].fd = run.sock;
+		pfd[1].fd = run.pfkey;
+		pfd[0].events = pfd[1].events = POLLIN;
+		pfd[0].revents = pfd[1].revents = 0;
+		if (poll(pfd, 2, 100) < 0 && errno != EINTR)
+			goto end;
+		if ((pfd[0].revents & (POLLIN | POLLHUP)) && loadgen_read(&run) < 0)
+			goto end;
+
+		/* only the control socket reports progress; drop the broadcasts */
+		if (pfd[1].revents & POLLIN)
+			while ((msg = pfkeyemu_recv(run.pfkey, 0)) != NULL)
+				free(msg);
+	}
+	elapsed = loadgen_now() - start;
+
+	if (res != NULL) {
+		res->completed = run.completed;
+		res->failed = run.failed;
+		res->timedout = run.timedout;
+		res->elapsed = elapsed;
+	}
+	if (cf->quiet) {
+		error = 0;
+		goto end;
+	}
+
+	rss_r1 = loadgen_rss(run.responder);
+	rss_i1 = loadgen_rss(run.initiator);
+
+	fprintf(stdout, "mode %s, %d sessions, %lu handshakes in %.2f s\n",
+		loadgen_modename(cf->mode), cf->sessions, run.completed, elapsed);
+	fprintf(stdout, "%-12s %10.1f\n", "handshakes/s", run.completed / elapsed);
+	fprintf(stdout, "%-12s %10lu\n", "failed", run.failed);
+	fprintf(stdout, "%-12s %10lu\n", "timed out", run.timedout);
+	fprintf(stdout, "%-12s %10lu\n", "retransmits",
+		loadgen_retransmits(&run, "initiator") +
+		loadgen_retransmits(&run, "responder"));
+	fprintf(stdout, "\n%-12s %10s %10s %10s %10s\n",
+		"latency (ms)", "p50", "p99", "p999", "max");
+	loadgen_print_latency("phase 1", &run.ph1);
+	loadgen_print_latency("phase 2", &run.ph2);
+
+	/* an older racoon does not know the command and replies with an error */
+	cmd.msg_type = htons(VPNCTL_CMD_GET_METRICS);
+	cmd.flags = cmd.cookie = cmd.reserved = cmd.result = cmd.len = 0;
+	if (loadgen_send(&run, &cmd, sizeof(cmd)) == 0) {
+		now = loadgen_now();
+		while (!run.metrics && loadgen_now() - now < LOADGEN_STARTUP) {
+			pfd[0].fd = run.sock;
+			pfd[0].events = POLLIN;
+			pfd[0].revents = 0;
+			if (poll(pfd, 1, 100) < 0 && errno != EINTR)
+				break;
+			if ((pfd[0].revents & (POLLIN | POLLHUP)) && loadgen_read(&run) < 0)
+				break;
+		}
+	}
+
+	fprintf(stdout, "\n%-12s %10s %10s %10s\n", "rss (KiB)", "start", "end", "growth");
+	fprintf(stdout, "%-12s %10lu %10lu %10ld\n", "responder",
+		rss_r0, rss_r1, (long)(rss_r1 - rss_r0));
+	fprintf(stdout, "%-12s %10lu %10lu %10ld\n", "initiator",
+		rss_i0, rss_i1, (long)(rss_i1 - rss_i0));
+	fprintf(stdout, "\nconfiguration and logs in %s\n", run.dir);
+
+	error = 0;
+
+end:
+	if (run.sock >= 0)
+		close(run.sock);
+	if (run.pfkey >= 0)
+		pfkeyemu_close(run.pfkey);
+	loadgen_stop(run.initiator);
+	loadgen_stop(run.responder);
+	pfkeyemu_stop(run.pfkey_initiator);
+	pfkeyemu_stop(run.pfkey_responder);
+	loadgen_unalias(&run);
+	free(run.slots);
+	free(run.ph1.v);
+	free(run.ph2.v);
+	return error;
+}
@@ -0,0 +1,50 @@
+//
+//  racoon_loadgen.h
+//  ipsec
+//
+//  Copyright (c) 2026 Apple Inc. All rights reserved.
+//
+
+#ifndef _RACOON_LOADGEN_H
+#define _RACOON_LOADGEN_H
+
+/*
+ * Loopback IKEv1 load generator.
+ *
+ * Two racoon instances are started on the local host: a responder
+ * listening on one loopback address per session and an initiator driven
+ * through its VPN control socket, the same way the VPN client drives it.
+ * Every session runs handshakes back to back until the requested number
+ * has completed.  With phase 2, each racoon runs against a PF_KEY
+ * stand-in of its own and acquires are raised through the initiator's.
+ */
+#define LOADGEN_MODE_MAIN		0
+#define LOADGEN_MODE_AGGRESSIVE	1
+#define LOADGEN_MODE_XAUTH		2	/* main mode, XAuth and mode-cfg */
+#define LOADGEN_MODE_CERT		3	/* main mode, RSA signatures */
+
+#define LOADGEN_MAXSESSIONS		1024
+
+struct loadgen_config {
+	int sessions;			/* concurrent initiators */
+	int handshakes;			/* total handshakes to complete */
+	int mode;				/* LOADGEN_MODE_* */
+	int ph2;				/* also negotiate phase 2 */
+	const char *racoon;		/* racoon binary */
+	const char *certref;	/* keychain identity for LOADGEN_MODE_CERT */
+	const char *xauth;		/* "user:password" for LOADGEN_MODE_XAUTH */
+	int pfkey_latency;		/* usec per PF_KEY request, for phase 2 */
+	int workers;			/* racoon -N, 0 for a single process */
+	int quiet;				/* no report, only errors */
+};
+
+struct loadgen_result {
+	unsigned long completed;
+	unsigned long failed;
+	unsigned long timedout;
+	double elapsed;			/* seconds */
+};
+
+extern int racoon_loadgen (const struct loadgen_config *, struct loadgen_result *);
+
+#endif /* _RACOON_LOADGEN_H */
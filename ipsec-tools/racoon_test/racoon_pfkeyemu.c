@@ -0,0 +1,1485 @@
+//
+//  racoon_pfkeyemu.c
+//  ipsec
+//
+//  Copyright (c) 2026 Apple Inc. All rights reserved.
+//
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <net/pfkeyv2.h>
+#include <netinet6/ipsec.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "racoon_pfkeyemu.h"
+
+#if defined(SADB_X_EALG_RIJNDAELCBC) && !defined(SADB_X_EALG_AESCBC)
+#define SADB_X_EALG_AESCBC  SADB_X_EALG_RIJNDAELCBC
+#endif
+
+#define PFKEYEMU_HASHSIZE	1024
+#define PFKEYEMU_TICK		100		/* ms between lifetime checks */
+#define PFKEYEMU_STARTUP	5.0		/* seconds to wait for a spawned stand-in */
+#define PFKEYEMU_SPIMIN		0x100
+#define PFKEYEMU_SPIMAX		0x0fffffff
+#define PFKEYEMU_SOCKBUF	233016	/* what pfkey_open() asks of the kernel */
+
+#define PFKEYEMU_ALIGN8(n)	(((n) + 7) & ~7)
+#define PFKEYEMU_UNIT64(n)	((n) >> 3)
+#define PFKEYEMU_UNUNIT64(n)	((size_t)(n) << 3)
+
+#ifdef __APPLE__
+#define PFKEYEMU_SALEN(sa)	((sa)->sa_len)
+#else
+#define PFKEYEMU_SALEN(sa)	((sa)->sa_family == AF_INET6 ? \
+	sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in))
+#endif
+
+/* where a message is delivered, as the kernel's KEY_SENDUP_* */
+enum {
+	PFKEYEMU_SENDUP_ONE,
+	PFKEYEMU_SENDUP_ALL,
+	PFKEYEMU_SENDUP_REGISTERED,
+};
+
+/* what pfkeyemu_sa_emit() includes besides SA, SA2 and addresses */
+#define PFKEYEMU_EMIT_KEYS		0x01
+#define PFKEYEMU_EMIT_LIFETIMES	0x02
+
+struct pfkeyemu_buf {
+	size_t len;
+	u_int64_t v[PFKEYEMU_MSGSIZE / sizeof(u_int64_t)];
+};
+
+struct pfkeyemu_client {
+	struct sockaddr_un addr;
+	socklen_t addrlen;		/* 0 once the socket has gone away */
+	u_int32_t registered;	/* bit per registered satype */
+};
+
+struct pfkeyemu_sa {
+	LIST_ENTRY(pfkeyemu_sa) chain;
+	u_int8_t satype;
+	u_int8_t state;
+	u_int32_t spi;			/* network byte order */
+	struct sockaddr_storage dst;
+	time_t created;
+	u_int64_t soft;			/* add time lifetimes, 0 for none */
+	u_int64_t hard;
+	int soft_sent;
+	size_t extlen;
+	caddr_t ext;			/* extensions as last installed */
+};
+
+struct pfkeyemu_sp {
+	TAILQ_ENTRY(pfkeyemu_sp) chain;
+	u_int32_t id;
+	size_t extlen;
+	caddr_t ext;			/* src, dst and policy, in that order */
+	struct sadb_address *src;
+	struct sadb_address *dst;
+	struct sadb_x_policy *policy;
+};
+
+struct pfkeyemu {
+	int so;
+	u_int32_t seq;
+	u_int32_t spid;
+	int nclients;
+	struct pfkeyemu_client clients[PFKEYEMU_MAXCLIENTS];
+	struct pfkeyemu_client *from;	/* sender of the current request */
+	LIST_HEAD(, pfkeyemu_sa) sad[PFKEYEMU_HASHSIZE];
+	u_int ntimed;			/* SAs with a lifetime */
+	TAILQ_HEAD(, pfkeyemu_sp) spd;
+	struct pfkeyemu_buf out;
+	u_int64_t in[PFKEYEMU_MSGSIZE / sizeof(u_int64_t)];
+};
+
+static const struct sadb_alg pfkeyemu_aalgs[] = {
+	{ SADB_AALG_MD5HMAC, 0, 128, 128, 0 },
+	{ SADB_AALG_SHA1HMAC, 0, 160, 160, 0 },
+#ifdef SADB_X_AALG_SHA2_256
+	{ SADB_X_AALG_SHA2_256, 0, 256, 256, 0 },
+#endif
+#ifdef SADB_X_AALG_SHA2_384
+	{ SADB_X_AALG_SHA2_384, 0, 384, 384, 0 },
+#endif
+#ifdef SADB_X_AALG_SHA2_512
+	{ SADB_X_AALG_SHA2_512, 0, 512, 512, 0 },
+#endif
+};
+
+static const struct sadb_alg pfkeyemu_ealgs[] = {
+	{ SADB_EALG_3DESCBC, 8, 192, 192, 0 },
+#ifdef SADB_X_EALG_AESCBC
+	{ SADB_X_EALG_AESCBC, 16, 128, 256, 0 },
+#endif
+	{ SADB_EALG_NULL, 0, 0, 2048, 0 },
+};
+
+/* extensions kept with an SA */
+static const u_int16_t pfkeyemu_sa_exttypes[] = {
+	SADB_EXT_SA,
+	SADB_X_EXT_SA2,
+	SADB_EXT_LIFETIME_HARD,
+	SADB_EXT_LIFETIME_SOFT,
+	SADB_EXT_ADDRESS_SRC,
+	SADB_EXT_ADDRESS_DST,
+	SADB_EXT_KEY_AUTH,
+	SADB_EXT_KEY_ENCRYPT,
+	SADB_EXT_IDENTITY_SRC,
+	SADB_EXT_IDENTITY_DST,
+};
+
+static double
+pfkeyemu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * message construction, shared by the stand-in and its clients.
+ */
+static struct sadb_msg *
+pfkeyemu_msg(struct pfkeyemu_buf *b, u_int8_t type, u_int8_t satype,
+	u_int32_t seq, u_int32_t pid)
+{
+	struct sadb_msg *msg = (struct sadb_msg *)b->v;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->sadb_msg_version = PF_KEY_V2;
+	msg->sadb_msg_type = type;
+	msg->sadb_msg_satype = satype;
+	msg->sadb_msg_seq = seq;
+	msg->sadb_msg_pid = pid;
+	msg->sadb_msg_len = PFKEYEMU_UNIT64(sizeof(*msg));
+	b->len = sizeof(*msg);
+
+	return msg;
+}
+
+/* append a zeroed extension of the given length, or NULL if it won't fit */
+static void *
+pfkeyemu_ext(struct pfkeyemu_buf *b, u_int16_t type, size_t len)
+{
+	struct sadb_msg *msg = (struct sadb_msg *)b->v;
+	struct sadb_ext *ext;
+
+	len = PFKEYEMU_ALIGN8(len);
+	if (b->len + len > sizeof(b->v))
+		return NULL;
+
+	ext = (struct sadb_ext *)((caddr_t)b->v + b->len);
+	memset(ext, 0, len);
+	ext->sadb_ext_len = PFKEYEMU_UNIT64(len);
+	ext->sadb_ext_type = type;
+	b->len += len;
+	msg->sadb_msg_len = PFKEYEMU_UNIT64(b->len);
+
+	return ext;
+}
+
+static void *
+pfkeyemu_copy(struct pfkeyemu_buf *b, const struct sadb_ext *ext)
+{
+	size_t len;
+	void *p;
+
+	if (ext == NULL)
+		return NULL;
+	len = PFKEYEMU_UNUNIT64(ext->sadb_ext_len);
+	if ((p = pfkeyemu_ext(b, ext->sadb_ext_type, len)) != NULL)
+		memcpy(p, ext, len);
+
+	return p;
+}
+
+static void
+pfkeyemu_addr(struct pfkeyemu_buf *b, u_int16_t type, const struct sockaddr *sa)
+{
+	struct sadb_address *addr;
+
+	addr = pfkeyemu_ext(b, type,
+		sizeof(*addr) + PFKEYEMU_ALIGN8(PFKEYEMU_SALEN(sa)));
+	if (addr == NULL)
+		return;
+	addr->sadb_address_proto = IPSEC_ULPROTO_ANY;
+	addr->sadb_address_prefixlen = sa->sa_family == AF_INET6 ? 128 : 32;
+	memcpy(addr + 1, sa, PFKEYEMU_SALEN(sa));
+}
+
+static struct sockaddr *
+pfkeyemu_saddr(const struct sadb_ext *ext)
+{
+	return (struct sockaddr *)((caddr_t)ext + sizeof(struct sadb_address));
+}
+
+/* split a message into its extensions, the way pfkey_align() does */
+static int
+pfkeyemu_align(struct sadb_msg *msg, size_t len, struct sadb_ext **mhp)
+{
+	caddr_t p, ep;
+	struct sadb_ext *ext;
+	size_t extlen;
+
+	memset(mhp, 0, sizeof(*mhp) * (SADB_EXT_MAX + 1));
+	if (len < sizeof(*msg) || PFKEYEMU_UNUNIT64(msg->sadb_msg_len) != len ||
+	    msg->sadb_msg_version != PF_KEY_V2)
+		return EINVAL;
+	mhp[0] = (struct sadb_ext *)msg;
+
+	ep = (caddr_t)msg + len;
+	for (p = (caddr_t)(msg + 1); p < ep; p += extlen) {
+		ext = (struct sadb_ext *)p;
+		if (ep - p < sizeof(*ext))
+			return EINVAL;
+		extlen = PFKEYEMU_UNUNIT64(ext->sadb_ext_len);
+		if (extlen < sizeof(*ext) || extlen > ep - p ||
+		    ext->sadb_ext_type == 0 || ext->sadb_ext_type > SADB_EXT_MAX ||
+		    mhp[ext->sadb_ext_type] != NULL)
+			return EINVAL;
+		mhp[ext->sadb_ext_type] = ext;
+	}
+
+	return 0;
+}
+
+/* compare address and family only; SAs don't care about ports */
+static int
+pfkeyemu_addrcmp(const struct sockaddr *a, const struct sockaddr *b)
+{
+	if (a->sa_family != b->sa_family)
+		return 1;
+	switch (a->sa_family) {
+	case AF_INET:
+		return memcmp(&((struct sockaddr_in *)a)->sin_addr,
+			&((struct sockaddr_in *)b)->sin_addr, sizeof(struct in_addr));
+	case AF_INET6:
+		return memcmp(&((struct sockaddr_in6 *)a)->sin6_addr,
+			&((struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
+	default:
+		return 1;
+	}
+}
+
+/* does the policy selector cover this address */
+static int
+pfkeyemu_selmatch(const struct sadb_address *sel, const struct sadb_address *addr)
+{
+	const struct sockaddr *ss = pfkeyemu_saddr((struct sadb_ext *)sel);
+	const struct sockaddr *sa = pfkeyemu_saddr((struct sadb_ext *)addr);
+	const u_int8_t *p, *q;
+	u_int16_t sport, port;
+	int bits = sel->sadb_address_prefixlen;
+
+	if (ss->sa_family != sa->sa_family)
+		return 0;
+	if (sel->sadb_address_proto != IPSEC_ULPROTO_ANY &&
+	    addr->sadb_address_proto != IPSEC_ULPROTO_ANY &&
+	    sel->sadb_address_proto != addr->sadb_address_proto)
+		return 0;
+
+	switch (ss->sa_family) {
+	case AF_INET:
+		p = (const u_int8_t *)&((struct sockaddr_in *)ss)->sin_addr;
+		q = (const u_int8_t *)&((struct sockaddr_in *)sa)->sin_addr;
+		sport = ((struct sockaddr_in *)ss)->sin_port;
+		port = ((struct sockaddr_in *)sa)->sin_port;
+		break;
+	case AF_INET6:
+		p = (const u_int8_t *)&((struct sockaddr_in6 *)ss)->sin6_addr;
+		q = (const u_int8_t *)&((struct sockaddr_in6 *)sa)->sin6_addr;
+		sport = ((struct sockaddr_in6 *)ss)->sin6_port;
+		port = ((struct sockaddr_in6 *)sa)->sin6_port;
+		break;
+	default:
+		return 0;
+	}
+	if (sport != 0 && port != 0 && sport != port)
+		return 0;
+
+	for (; bits >= 8; bits -= 8)
+		if (*p++ != *q++)
+			return 0;
+	if (bits > 0 && ((*p ^ *q) & (0xff << (8 - bits))) != 0)
+		return 0;
+
+	return 1;
+}
+
+/*
+ * delivery
+ */
+static void
+pfkeyemu_sendup(struct pfkeyemu *emu, int target, u_int8_t satype)
+{
+	struct pfkeyemu_client *c;
+	int i;
+
+	for (i = 0; i < emu->nclients; i++) {
+		c = &emu->clients[i];
+		if (c->addrlen == 0)
+			continue;
+		if (target == PFKEYEMU_SENDUP_ONE && c != emu->from)
+			continue;
+		if (target == PFKEYEMU_SENDUP_REGISTERED &&
+		    (c->registered & (1U << satype)) == 0)
+			continue;
+
+		/* a full receive buffer drops the message, as the kernel does */
+		if (sendto(emu->so, emu->out.v, emu->out.len, MSG_DONTWAIT,
+		    (struct sockaddr *)&c->addr, c->addrlen) < 0 &&
+		    (errno == ECONNREFUSED || errno == ENOENT))
+			c->addrlen = 0;
+	}
+}
+
+static struct pfkeyemu_client *
+pfkeyemu_client(struct pfkeyemu *emu, struct sockaddr_un *addr, socklen_t addrlen)
+{
+	struct pfkeyemu_client *c;
+	int i;
+
+	if (addrlen <= offsetof(struct sockaddr_un, sun_path) ||
+	    addr->sun_path[0] == '\0')
+		return NULL;
+
+	for (i = 0; i < emu->nclients; i++) {
+		c = &emu->clients[i];
+		if (c->addrlen == addrlen && memcmp(&c->addr, addr, addrlen) == 0)
+			return c;
+	}
+	if (emu->nclients == PFKEYEMU_MAXCLIENTS)
+		return NULL;
+
+	c = &emu->clients[emu->nclients++];
+	memset(c, 0, sizeof(*c));
+	memcpy(&c->addr, addr, addrlen);
+	c->addrlen = addrlen;
+
+	return c;
+}
+
+/* forget the sockets that went away */
+static void
+pfkeyemu_reap(struct pfkeyemu *emu)
+{
+	int i, j;
+
+	for (i = j = 0; i < emu->nclients; i++)
+		if (emu->clients[i].addrlen != 0)
+			emu->clients[j++] = emu->clients[i];
+	emu->nclients = j;
+}
+
+static void
+pfkeyemu_error(struct pfkeyemu *emu, struct sadb_msg *req, int error)
+{
+	struct sadb_msg *msg;
+
+	msg = pfkeyemu_msg(&emu->out, req->sadb_msg_type, req->sadb_msg_satype,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	msg->sadb_msg_errno = error;
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ONE, 0);
+}
+
+/*
+ * SAD
+ */
+static u_int
+pfkeyemu_hash(u_int32_t spi)
+{
+	spi = ntohl(spi);
+	return (spi ^ (spi >> 16)) % PFKEYEMU_HASHSIZE;
+}
+
+static struct pfkeyemu_sa *
+pfkeyemu_sa_find(struct pfkeyemu *emu, u_int8_t satype, u_int32_t spi,
+	const struct sockaddr *dst)
+{
+	struct pfkeyemu_sa *sa;
+
+	LIST_FOREACH(sa, &emu->sad[pfkeyemu_hash(spi)], chain)
+		if (sa->spi == spi && sa->satype == satype &&
+		    pfkeyemu_addrcmp((struct sockaddr *)&sa->dst, dst) == 0)
+			return sa;
+
+	return NULL;
+}
+
+static struct sadb_ext *
+pfkeyemu_sa_ext(struct pfkeyemu_sa *sa, u_int16_t type)
+{
+	struct sadb_ext *ext;
+	caddr_t p;
+
+	for (p = sa->ext; p < sa->ext + sa->extlen;
+	    p += PFKEYEMU_UNUNIT64(ext->sadb_ext_len)) {
+		ext = (struct sadb_ext *)p;
+		if (ext->sadb_ext_type == type)
+			return ext;
+	}
+
+	return NULL;
+}
+
+/* keep the extensions of an UPDATE, ADD or GETSPI with the SA */
+static int
+pfkeyemu_sa_store(struct pfkeyemu *emu, struct pfkeyemu_sa *sa, struct sadb_ext **mhp)
+{
+	struct sadb_lifetime *lt;
+	size_t len = 0;
+	caddr_t ext, p;
+	int i;
+
+	for (i = 0; i < sizeof(pfkeyemu_sa_exttypes) / sizeof(pfkeyemu_sa_exttypes[0]); i++)
+		if (mhp[pfkeyemu_sa_exttypes[i]] != NULL)
+			len += PFKEYEMU_UNUNIT64(mhp[pfkeyemu_sa_exttypes[i]]->sadb_ext_len);
+	if ((ext = malloc(len)) == NULL)
+		return ENOBUFS;
+	for (p = ext, i = 0; i < sizeof(pfkeyemu_sa_exttypes) / sizeof(pfkeyemu_sa_exttypes[0]); i++) {
+		struct sadb_ext *e = mhp[pfkeyemu_sa_exttypes[i]];
+
+		if (e == NULL)
+			continue;
+		memcpy(p, e, PFKEYEMU_UNUNIT64(e->sadb_ext_len));
+		p += PFKEYEMU_UNUNIT64(e->sadb_ext_len);
+	}
+
+	free(sa->ext);
+	sa->ext = ext;
+	sa->extlen = len;
+
+	if (sa->soft != 0 || sa->hard != 0)
+		emu->ntimed--;
+	lt = (struct sadb_lifetime *)mhp[SADB_EXT_LIFETIME_SOFT];
+	sa->soft = lt != NULL ? lt->sadb_lifetime_addtime : 0;
+	lt = (struct sadb_lifetime *)mhp[SADB_EXT_LIFETIME_HARD];
+	sa->hard = lt != NULL ? lt->sadb_lifetime_addtime : 0;
+	if (sa->soft != 0 || sa->hard != 0)
+		emu->ntimed++;
+	sa->soft_sent = 0;
+	sa->created = time(NULL);
+
+	return 0;
+}
+
+static struct pfkeyemu_sa *
+pfkeyemu_sa_new(struct pfkeyemu *emu, u_int8_t satype, u_int32_t spi,
+	const struct sockaddr *dst)
+{
+	struct pfkeyemu_sa *sa;
+
+	if ((sa = calloc(1, sizeof(*sa))) == NULL)
+		return NULL;
+	sa->satype = satype;
+	sa->spi = spi;
+	memcpy(&sa->dst, dst, PFKEYEMU_SALEN(dst));
+	LIST_INSERT_HEAD(&emu->sad[pfkeyemu_hash(spi)], sa, chain);
+
+	return sa;
+}
+
+static void
+pfkeyemu_sa_free(struct pfkeyemu *emu, struct pfkeyemu_sa *sa)
+{
+	if (sa->soft != 0 || sa->hard != 0)
+		emu->ntimed--;
+	LIST_REMOVE(sa, chain);
+	free(sa->ext);
+	free(sa);
+}
+
+static void
+pfkeyemu_sa_emit(struct pfkeyemu_buf *b, struct pfkeyemu_sa *sa, int flags)
+{
+	struct sadb_lifetime *cur;
+	struct sadb_ext *ext;
+	struct sadb_sa *ssa;
+	caddr_t p;
+
+	for (p = sa->ext; p < sa->ext + sa->extlen;
+	    p += PFKEYEMU_UNUNIT64(ext->sadb_ext_len)) {
+		ext = (struct sadb_ext *)p;
+		switch (ext->sadb_ext_type) {
+		case SADB_EXT_SA:
+			if ((ssa = pfkeyemu_copy(b, ext)) != NULL)
+				ssa->sadb_sa_state = sa->state;
+			continue;
+		case SADB_EXT_KEY_AUTH:
+		case SADB_EXT_KEY_ENCRYPT:
+			if ((flags & PFKEYEMU_EMIT_KEYS) == 0)
+				continue;
+			break;
+		case SADB_EXT_LIFETIME_HARD:
+		case SADB_EXT_LIFETIME_SOFT:
+			if ((flags & PFKEYEMU_EMIT_LIFETIMES) == 0)
+				continue;
+			break;
+		}
+		pfkeyemu_copy(b, ext);
+	}
+
+	if ((flags & PFKEYEMU_EMIT_LIFETIMES) != 0 &&
+	    (cur = pfkeyemu_ext(b, SADB_EXT_LIFETIME_CURRENT, sizeof(*cur))) != NULL)
+		cur->sadb_lifetime_addtime = sa->created;
+}
+
+/* tell the registered sockets an SA expired; a hard expire also removes it */
+static void
+pfkeyemu_sa_expire(struct pfkeyemu *emu, struct pfkeyemu_sa *sa, int hard)
+{
+	u_int16_t type = hard ? SADB_EXT_LIFETIME_HARD : SADB_EXT_LIFETIME_SOFT;
+	struct sadb_lifetime *cur;
+	struct sadb_ext *lt;
+
+	pfkeyemu_msg(&emu->out, SADB_EXPIRE, sa->satype, 0, 0);
+	pfkeyemu_sa_emit(&emu->out, sa, 0);
+	if ((cur = pfkeyemu_ext(&emu->out, SADB_EXT_LIFETIME_CURRENT, sizeof(*cur))) != NULL)
+		cur->sadb_lifetime_addtime = sa->created;
+	if ((lt = pfkeyemu_sa_ext(sa, type)) != NULL)
+		pfkeyemu_copy(&emu->out, lt);
+	else
+		pfkeyemu_ext(&emu->out, type, sizeof(struct sadb_lifetime));
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_REGISTERED, sa->satype);
+
+	if (hard)
+		pfkeyemu_sa_free(emu, sa);
+	else
+		sa->soft_sent = 1;
+}
+
+static void
+pfkeyemu_tick(struct pfkeyemu *emu)
+{
+	struct pfkeyemu_sa *sa, *next;
+	time_t now = time(NULL);
+	int i;
+
+	if (emu->ntimed == 0)
+		return;
+
+	for (i = 0; i < PFKEYEMU_HASHSIZE; i++) {
+		for (sa = LIST_FIRST(&emu->sad[i]); sa != NULL; sa = next) {
+			next = LIST_NEXT(sa, chain);
+			if (sa->state != SADB_SASTATE_MATURE &&
+			    sa->state != SADB_SASTATE_DYING)
+				continue;
+			if (sa->hard != 0 && now - sa->created >= sa->hard)
+				pfkeyemu_sa_expire(emu, sa, 1);
+			else if (sa->soft != 0 && !sa->soft_sent &&
+			    now - sa->created >= sa->soft) {
+				sa->state = SADB_SASTATE_DYING;
+				pfkeyemu_sa_expire(emu, sa, 0);
+			}
+		}
+	}
+}
+
+/*
+ * SPD
+ */
+static struct pfkeyemu_sp *
+pfkeyemu_sp_find(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_ext *src = mhp[SADB_EXT_ADDRESS_SRC];
+	struct sadb_ext *dst = mhp[SADB_EXT_ADDRESS_DST];
+	struct sadb_x_policy *xpl = (struct sadb_x_policy *)mhp[SADB_X_EXT_POLICY];
+	struct pfkeyemu_sp *sp;
+
+	TAILQ_FOREACH(sp, &emu->spd, chain)
+		if (sp->policy->sadb_x_policy_dir == xpl->sadb_x_policy_dir &&
+		    sp->src->sadb_address_len == src->sadb_ext_len &&
+		    sp->dst->sadb_address_len == dst->sadb_ext_len &&
+		    memcmp(sp->src, src, PFKEYEMU_UNUNIT64(src->sadb_ext_len)) == 0 &&
+		    memcmp(sp->dst, dst, PFKEYEMU_UNUNIT64(dst->sadb_ext_len)) == 0)
+			return sp;
+
+	return NULL;
+}
+
+static struct pfkeyemu_sp *
+pfkeyemu_sp_byid(struct pfkeyemu *emu, u_int32_t id)
+{
+	struct pfkeyemu_sp *sp;
+
+	TAILQ_FOREACH(sp, &emu->spd, chain)
+		if (sp->id == id)
+			return sp;
+
+	return NULL;
+}
+
+static int
+pfkeyemu_sp_store(struct pfkeyemu_sp *sp, struct sadb_ext **mhp)
+{
+	size_t slen = PFKEYEMU_UNUNIT64(mhp[SADB_EXT_ADDRESS_SRC]->sadb_ext_len);
+	size_t dlen = PFKEYEMU_UNUNIT64(mhp[SADB_EXT_ADDRESS_DST]->sadb_ext_len);
+	size_t plen = PFKEYEMU_UNUNIT64(mhp[SADB_X_EXT_POLICY]->sadb_ext_len);
+	caddr_t ext;
+
+	if ((ext = malloc(slen + dlen + plen)) == NULL)
+		return ENOBUFS;
+	memcpy(ext, mhp[SADB_EXT_ADDRESS_SRC], slen);
+	memcpy(ext + slen, mhp[SADB_EXT_ADDRESS_DST], dlen);
+	memcpy(ext + slen + dlen, mhp[SADB_X_EXT_POLICY], plen);
+
+	free(sp->ext);
+	sp->ext = ext;
+	sp->extlen = slen + dlen + plen;
+	sp->src = (struct sadb_address *)ext;
+	sp->dst = (struct sadb_address *)(ext + slen);
+	sp->policy = (struct sadb_x_policy *)(ext + slen + dlen);
+	sp->policy->sadb_x_policy_id = sp->id;
+
+	return 0;
+}
+
+static void
+pfkeyemu_sp_emit(struct pfkeyemu_buf *b, struct pfkeyemu_sp *sp)
+{
+	pfkeyemu_copy(b, (struct sadb_ext *)sp->src);
+	pfkeyemu_copy(b, (struct sadb_ext *)sp->dst);
+	pfkeyemu_copy(b, (struct sadb_ext *)sp->policy);
+}
+
+static void
+pfkeyemu_sp_free(struct pfkeyemu *emu, struct pfkeyemu_sp *sp)
+{
+	TAILQ_REMOVE(&emu->spd, sp, chain);
+	free(sp->ext);
+	free(sp);
+}
+
+/*
+ * requests.  a handler returns an errno to be sent back to the requester,
+ * or 0 once it has sent whatever the request calls for.
+ */
+static int
+pfkeyemu_getspi_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct sadb_spirange *range = (struct sadb_spirange *)mhp[SADB_EXT_SPIRANGE];
+	struct sadb_ext *emhp[SADB_EXT_MAX + 1];
+	struct sadb_sa ssa;
+	struct pfkeyemu_sa *sa;
+	struct sockaddr *dst;
+	u_int32_t min = PFKEYEMU_SPIMIN, max = PFKEYEMU_SPIMAX, spi;
+	int tries, error;
+
+	if (mhp[SADB_EXT_ADDRESS_SRC] == NULL || mhp[SADB_EXT_ADDRESS_DST] == NULL)
+		return EINVAL;
+	dst = pfkeyemu_saddr(mhp[SADB_EXT_ADDRESS_DST]);
+
+	if (range != NULL) {
+		min = MAX(range->sadb_spirange_min, PFKEYEMU_SPIMIN);
+		max = range->sadb_spirange_max;
+		if (min > max)
+			return EINVAL;
+	}
+	for (tries = 0; ; tries++) {
+		if (tries == 1000)
+			return EEXIST;
+		spi = htonl(min + arc4random_uniform(max - min + 1));
+		if (pfkeyemu_sa_find(emu, req->sadb_msg_satype, spi, dst) == NULL)
+			break;
+	}
+
+	memset(&ssa, 0, sizeof(ssa));
+	ssa.sadb_sa_len = PFKEYEMU_UNIT64(sizeof(ssa));
+	ssa.sadb_sa_exttype = SADB_EXT_SA;
+	ssa.sadb_sa_spi = spi;
+	ssa.sadb_sa_state = SADB_SASTATE_LARVAL;
+	memcpy(emhp, mhp, sizeof(emhp));
+	emhp[SADB_EXT_SA] = (struct sadb_ext *)&ssa;
+	emhp[SADB_EXT_LIFETIME_HARD] = emhp[SADB_EXT_LIFETIME_SOFT] = NULL;
+
+	if ((sa = pfkeyemu_sa_new(emu, req->sadb_msg_satype, spi, dst)) == NULL)
+		return ENOBUFS;
+	sa->state = SADB_SASTATE_LARVAL;
+	if ((error = pfkeyemu_sa_store(emu, sa, emhp)) != 0) {
+		pfkeyemu_sa_free(emu, sa);
+		return error;
+	}
+
+	pfkeyemu_msg(&emu->out, SADB_GETSPI, req->sadb_msg_satype,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	pfkeyemu_sa_emit(&emu->out, sa, 0);
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ONE, 0);
+
+	return 0;
+}
+
+/* UPDATE completes a larval SA, ADD installs a new one */
+static int
+pfkeyemu_install_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct sadb_sa *ssa = (struct sadb_sa *)mhp[SADB_EXT_SA];
+	struct pfkeyemu_sa *sa;
+	struct sockaddr *dst;
+	int error;
+
+	if (ssa == NULL || mhp[SADB_EXT_ADDRESS_SRC] == NULL ||
+	    mhp[SADB_EXT_ADDRESS_DST] == NULL)
+		return EINVAL;
+	dst = pfkeyemu_saddr(mhp[SADB_EXT_ADDRESS_DST]);
+
+	sa = pfkeyemu_sa_find(emu, req->sadb_msg_satype, ssa->sadb_sa_spi, dst);
+	if (req->sadb_msg_type == SADB_UPDATE) {
+		if (sa == NULL || sa->state != SADB_SASTATE_LARVAL)
+			return ENOENT;
+	} else {
+		if (sa != NULL)
+			return EEXIST;
+		sa = pfkeyemu_sa_new(emu, req->sadb_msg_satype, ssa->sadb_sa_spi, dst);
+		if (sa == NULL)
+			return ENOBUFS;
+	}
+	if ((error = pfkeyemu_sa_store(emu, sa, mhp)) != 0) {
+		if (req->sadb_msg_type == SADB_ADD)
+			pfkeyemu_sa_free(emu, sa);
+		return error;
+	}
+	sa->state = SADB_SASTATE_MATURE;
+
+	pfkeyemu_msg(&emu->out, req->sadb_msg_type, req->sadb_msg_satype,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	pfkeyemu_sa_emit(&emu->out, sa, PFKEYEMU_EMIT_LIFETIMES);
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ALL, 0);
+
+	return 0;
+}
+
+static int
+pfkeyemu_delete_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct sadb_sa *ssa = (struct sadb_sa *)mhp[SADB_EXT_SA];
+	struct pfkeyemu_sa *sa, *next;
+	struct sockaddr *src, *dst;
+	int i;
+
+	if (mhp[SADB_EXT_ADDRESS_SRC] == NULL || mhp[SADB_EXT_ADDRESS_DST] == NULL)
+		return EINVAL;
+	src = pfkeyemu_saddr(mhp[SADB_EXT_ADDRESS_SRC]);
+	dst = pfkeyemu_saddr(mhp[SADB_EXT_ADDRESS_DST]);
+
+	if (ssa != NULL) {
+		sa = pfkeyemu_sa_find(emu, req->sadb_msg_satype, ssa->sadb_sa_spi, dst);
+		if (sa == NULL)
+			return ENOENT;
+		pfkeyemu_sa_free(emu, sa);
+	} else {
+		/* delete all between src and dst */
+		for (i = 0; i < PFKEYEMU_HASHSIZE; i++) {
+			for (sa = LIST_FIRST(&emu->sad[i]); sa != NULL; sa = next) {
+				next = LIST_NEXT(sa, chain);
+				if (sa->satype == req->sadb_msg_satype &&
+				    pfkeyemu_addrcmp((struct sockaddr *)&sa->dst, dst) == 0 &&
+				    pfkeyemu_addrcmp(pfkeyemu_saddr(
+					pfkeyemu_sa_ext(sa, SADB_EXT_ADDRESS_SRC)), src) == 0)
+					pfkeyemu_sa_free(emu, sa);
+			}
+		}
+	}
+
+	pfkeyemu_msg(&emu->out, SADB_DELETE, req->sadb_msg_satype,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	pfkeyemu_copy(&emu->out, (struct sadb_ext *)ssa);
+	pfkeyemu_copy(&emu->out, mhp[SADB_EXT_ADDRESS_SRC]);
+	pfkeyemu_copy(&emu->out, mhp[SADB_EXT_ADDRESS_DST]);
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ALL, 0);
+
+	return 0;
+}
+
+static int
+pfkeyemu_get_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct sadb_sa *ssa = (struct sadb_sa *)mhp[SADB_EXT_SA];
+	struct pfkeyemu_sa *sa;
+
+	if (ssa == NULL || mhp[SADB_EXT_ADDRESS_DST] == NULL)
+		return EINVAL;
+	sa = pfkeyemu_sa_find(emu, req->sadb_msg_satype, ssa->sadb_sa_spi,
+		pfkeyemu_saddr(mhp[SADB_EXT_ADDRESS_DST]));
+	if (sa == NULL)
+		return ENOENT;
+
+	pfkeyemu_msg(&emu->out, SADB_GET, sa->satype,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	pfkeyemu_sa_emit(&emu->out, sa, PFKEYEMU_EMIT_KEYS | PFKEYEMU_EMIT_LIFETIMES);
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ONE, 0);
+
+	return 0;
+}
+
+static int
+pfkeyemu_dump_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct pfkeyemu_sa *sa;
+	u_int32_t n = 0;
+	int i;
+
+	for (i = 0; i < PFKEYEMU_HASHSIZE; i++)
+		LIST_FOREACH(sa, &emu->sad[i], chain)
+			if (req->sadb_msg_satype == SADB_SATYPE_UNSPEC ||
+			    sa->satype == req->sadb_msg_satype)
+				n++;
+	if (n == 0)
+		return ENOENT;
+
+	/* the last message of a dump carries sequence number 0 */
+	for (i = 0; i < PFKEYEMU_HASHSIZE; i++) {
+		LIST_FOREACH(sa, &emu->sad[i], chain) {
+			if (req->sadb_msg_satype != SADB_SATYPE_UNSPEC &&
+			    sa->satype != req->sadb_msg_satype)
+				continue;
+			pfkeyemu_msg(&emu->out, SADB_DUMP, sa->satype, --n,
+				req->sadb_msg_pid);
+			pfkeyemu_sa_emit(&emu->out, sa,
+				PFKEYEMU_EMIT_KEYS | PFKEYEMU_EMIT_LIFETIMES);
+			pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ONE, 0);
+		}
+	}
+
+	return 0;
+}
+
+static int
+pfkeyemu_flush_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct pfkeyemu_sa *sa, *next;
+	int i;
+
+	for (i = 0; i < PFKEYEMU_HASHSIZE; i++) {
+		for (sa = LIST_FIRST(&emu->sad[i]); sa != NULL; sa = next) {
+			next = LIST_NEXT(sa, chain);
+			if (req->sadb_msg_satype == SADB_SATYPE_UNSPEC ||
+			    sa->satype == req->sadb_msg_satype)
+				pfkeyemu_sa_free(emu, sa);
+		}
+	}
+
+	pfkeyemu_msg(&emu->out, SADB_FLUSH, req->sadb_msg_satype,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ALL, 0);
+
+	return 0;
+}
+
+static void
+pfkeyemu_supported(struct pfkeyemu_buf *b, u_int16_t type,
+	const struct sadb_alg *algs, size_t n)
+{
+	struct sadb_supported *sup;
+
+	if ((sup = pfkeyemu_ext(b, type, sizeof(*sup) + n * sizeof(*algs))) != NULL)
+		memcpy(sup + 1, algs, n * sizeof(*algs));
+}
+
+static int
+pfkeyemu_register_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	u_int8_t satype = req->sadb_msg_satype;
+
+	if (satype == SADB_SATYPE_UNSPEC || satype >= 32)
+		return EINVAL;
+	emu->from->registered |= 1U << satype;
+
+	pfkeyemu_msg(&emu->out, SADB_REGISTER, satype,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	if (satype == SADB_SATYPE_AH || satype == SADB_SATYPE_ESP)
+		pfkeyemu_supported(&emu->out, SADB_EXT_SUPPORTED_AUTH, pfkeyemu_aalgs,
+			sizeof(pfkeyemu_aalgs) / sizeof(pfkeyemu_aalgs[0]));
+	if (satype == SADB_SATYPE_ESP)
+		pfkeyemu_supported(&emu->out, SADB_EXT_SUPPORTED_ENCRYPT, pfkeyemu_ealgs,
+			sizeof(pfkeyemu_ealgs) / sizeof(pfkeyemu_ealgs[0]));
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_REGISTERED, satype);
+
+	return 0;
+}
+
+/* injected ACQUIRE: raise one for the outbound policy covering src and dst */
+static int
+pfkeyemu_acquire_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct sadb_x_ipsecrequest *xisr;
+	struct pfkeyemu_sp *sp;
+	u_int8_t satype;
+
+	/* an IKE daemon reporting a failed negotiation */
+	if (req->sadb_msg_errno != 0)
+		return 0;
+
+	if (mhp[SADB_EXT_ADDRESS_SRC] == NULL || mhp[SADB_EXT_ADDRESS_DST] == NULL)
+		return EINVAL;
+	TAILQ_FOREACH(sp, &emu->spd, chain)
+		if (sp->policy->sadb_x_policy_dir == IPSEC_DIR_OUTBOUND &&
+		    sp->policy->sadb_x_policy_type == IPSEC_POLICY_IPSEC &&
+		    pfkeyemu_selmatch(sp->src,
+			(struct sadb_address *)mhp[SADB_EXT_ADDRESS_SRC]) &&
+		    pfkeyemu_selmatch(sp->dst,
+			(struct sadb_address *)mhp[SADB_EXT_ADDRESS_DST]))
+			break;
+	if (sp == NULL)
+		return ENOENT;
+
+	if (PFKEYEMU_UNUNIT64(sp->policy->sadb_x_policy_len) <
+	    sizeof(*sp->policy) + sizeof(*xisr))
+		return EINVAL;
+	xisr = (struct sadb_x_ipsecrequest *)(sp->policy + 1);
+	switch (xisr->sadb_x_ipsecrequest_proto) {
+	case IPPROTO_ESP:
+		satype = SADB_SATYPE_ESP;
+		break;
+	case IPPROTO_AH:
+		satype = SADB_SATYPE_AH;
+		break;
+	case IPPROTO_IPCOMP:
+		satype = SADB_X_SATYPE_IPCOMP;
+		break;
+	default:
+		return EINVAL;
+	}
+
+	pfkeyemu_msg(&emu->out, SADB_ACQUIRE, satype, ++emu->seq, 0);
+	pfkeyemu_copy(&emu->out, mhp[SADB_EXT_ADDRESS_SRC]);
+	pfkeyemu_copy(&emu->out, mhp[SADB_EXT_ADDRESS_DST]);
+	pfkeyemu_copy(&emu->out, (struct sadb_ext *)sp->policy);
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_REGISTERED, satype);
+
+	return 0;
+}
+
+/* injected EXPIRE: soft, or hard when a hard lifetime is attached */
+static int
+pfkeyemu_expire_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct sadb_sa *ssa = (struct sadb_sa *)mhp[SADB_EXT_SA];
+	struct pfkeyemu_sa *sa;
+
+	if (ssa == NULL || mhp[SADB_EXT_ADDRESS_DST] == NULL)
+		return EINVAL;
+	sa = pfkeyemu_sa_find(emu, req->sadb_msg_satype, ssa->sadb_sa_spi,
+		pfkeyemu_saddr(mhp[SADB_EXT_ADDRESS_DST]));
+	if (sa == NULL)
+		return ENOENT;
+
+	if (mhp[SADB_EXT_LIFETIME_HARD] == NULL)
+		sa->state = SADB_SASTATE_DYING;
+	pfkeyemu_sa_expire(emu, sa, mhp[SADB_EXT_LIFETIME_HARD] != NULL);
+
+	return 0;
+}
+
+static int
+pfkeyemu_spdadd_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct pfkeyemu_sp *sp;
+	int error;
+
+	if (mhp[SADB_EXT_ADDRESS_SRC] == NULL || mhp[SADB_EXT_ADDRESS_DST] == NULL ||
+	    mhp[SADB_X_EXT_POLICY] == NULL)
+		return EINVAL;
+
+	sp = pfkeyemu_sp_find(emu, mhp);
+	if (req->sadb_msg_type == SADB_X_SPDUPDATE) {
+		if (sp == NULL)
+			return ENOENT;
+	} else {
+		if (sp != NULL)
+			return EEXIST;
+		if ((sp = calloc(1, sizeof(*sp))) == NULL)
+			return ENOBUFS;
+		sp->id = ++emu->spid;
+		TAILQ_INSERT_TAIL(&emu->spd, sp, chain);
+	}
+	if ((error = pfkeyemu_sp_store(sp, mhp)) != 0) {
+		if (sp->ext == NULL)
+			pfkeyemu_sp_free(emu, sp);
+		return error;
+	}
+
+	pfkeyemu_msg(&emu->out, req->sadb_msg_type, SADB_SATYPE_UNSPEC,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	pfkeyemu_sp_emit(&emu->out, sp);
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ALL, 0);
+
+	return 0;
+}
+
+/* SPDDELETE by selector, SPDDELETE2 by id */
+static int
+pfkeyemu_spddelete_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct sadb_x_policy *xpl = (struct sadb_x_policy *)mhp[SADB_X_EXT_POLICY];
+	struct pfkeyemu_sp *sp;
+
+	if (xpl == NULL)
+		return EINVAL;
+	if (req->sadb_msg_type == SADB_X_SPDDELETE2)
+		sp = pfkeyemu_sp_byid(emu, xpl->sadb_x_policy_id);
+	else if (mhp[SADB_EXT_ADDRESS_SRC] != NULL && mhp[SADB_EXT_ADDRESS_DST] != NULL)
+		sp = pfkeyemu_sp_find(emu, mhp);
+	else
+		return EINVAL;
+	if (sp == NULL)
+		return ENOENT;
+
+	pfkeyemu_msg(&emu->out, req->sadb_msg_type, SADB_SATYPE_UNSPEC,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	pfkeyemu_sp_emit(&emu->out, sp);
+	pfkeyemu_sp_free(emu, sp);
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ALL, 0);
+
+	return 0;
+}
+
+static int
+pfkeyemu_spdget_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct sadb_x_policy *xpl = (struct sadb_x_policy *)mhp[SADB_X_EXT_POLICY];
+	struct pfkeyemu_sp *sp;
+
+	if (xpl == NULL)
+		return EINVAL;
+	if ((sp = pfkeyemu_sp_byid(emu, xpl->sadb_x_policy_id)) == NULL)
+		return ENOENT;
+
+	pfkeyemu_msg(&emu->out, SADB_X_SPDGET, SADB_SATYPE_UNSPEC,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	pfkeyemu_sp_emit(&emu->out, sp);
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ONE, 0);
+
+	return 0;
+}
+
+static int
+pfkeyemu_spddump_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+	struct pfkeyemu_sp *sp;
+	u_int32_t n = 0;
+
+	TAILQ_FOREACH(sp, &emu->spd, chain)
+		n++;
+	if (n == 0)
+		return ENOENT;
+
+	TAILQ_FOREACH(sp, &emu->spd, chain) {
+		pfkeyemu_msg(&emu->out, SADB_X_SPDDUMP, SADB_SATYPE_UNSPEC, --n,
+			req->sadb_msg_pid);
+		pfkeyemu_sp_emit(&emu->out, sp);
+		pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ONE, 0);
+	}
+
+	return 0;
+}
+
+static int
+pfkeyemu_spdflush_in(struct pfkeyemu *emu, struct sadb_ext **mhp)
+{
+	struct sadb_msg *req = (struct sadb_msg *)mhp[0];
+
+	while (!TAILQ_EMPTY(&emu->spd))
+		pfkeyemu_sp_free(emu, TAILQ_FIRST(&emu->spd));
+
+	pfkeyemu_msg(&emu->out, SADB_X_SPDFLUSH, SADB_SATYPE_UNSPEC,
+		req->sadb_msg_seq, req->sadb_msg_pid);
+	pfkeyemu_sendup(emu, PFKEYEMU_SENDUP_ALL, 0);
+
+	return 0;
+}
+
+static void
+pfkeyemu_input(struct pfkeyemu *emu, size_t len)
+{
+	struct sadb_msg *req = (struct sadb_msg *)emu->in;
+	struct sadb_ext *mhp[SADB_EXT_MAX + 1];
+	int error;
+
+	if (len < sizeof(*req))
+		return;
+	if ((error = pfkeyemu_align(req, len, mhp)) != 0) {
+		pfkeyemu_error(emu, req, error);
+		return;
+	}
+
+	switch (req->sadb_msg_type) {
+	case SADB_GETSPI:
+		error = pfkeyemu_getspi_in(emu, mhp);
+		break;
+	case SADB_UPDATE:
+	case SADB_ADD:
+		error = pfkeyemu_install_in(emu, mhp);
+		break;
+	case SADB_DELETE:
+		error = pfkeyemu_delete_in(emu, mhp);
+		break;
+	case SADB_GET:
+		error = pfkeyemu_get_in(emu, mhp);
+		break;
+	case SADB_DUMP:
+		error = pfkeyemu_dump_in(emu, mhp);
+		break;
+	case SADB_FLUSH:
+		error = pfkeyemu_flush_in(emu, mhp);
+		break;
+	case SADB_REGISTER:
+		error = pfkeyemu_register_in(emu, mhp);
+		break;
+	case SADB_ACQUIRE:
+		error = pfkeyemu_acquire_in(emu, mhp);
+		break;
+	case SADB_EXPIRE:
+		error = pfkeyemu_expire_in(emu, mhp);
+		break;
+	case SADB_X_SPDADD:
+	case SADB_X_SPDUPDATE:
+		error = pfkeyemu_spdadd_in(emu, mhp);
+		break;
+	case SADB_X_SPDDELETE:
+	case SADB_X_SPDDELETE2:
+		error = pfkeyemu_spddelete_in(emu, mhp);
+		break;
+	case SADB_X_SPDGET:
+		error = pfkeyemu_spdget_in(emu, mhp);
+		break;
+	case SADB_X_SPDDUMP:
+		error = pfkeyemu_spddump_in(emu, mhp);
+		break;
+	case SADB_X_SPDFLUSH:
+		error = pfkeyemu_spdflush_in(emu, mhp);
+		break;
+	default:
+		error = EOPNOTSUPP;
+		break;
+	}
+
+	if (error != 0)
+		pfkeyemu_error(emu, req, error);
+}
+
+/*
+ * serve PF_KEY on a UNIX datagram socket at path until killed.
+ * latency, in microseconds, is spent before each request is handled.
+ */
+int
+pfkeyemu_serve(const char *path, int latency)
+{
+	struct pfkeyemu *emu;
+	struct sockaddr_un sun, from;
+	socklen_t fromlen;
+	struct pollfd pfd;
+	double next = pfkeyemu_now();
+	int bufsiz = PFKEYEMU_SOCKBUF;
+	ssize_t len;
+	int i;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "%s: path too long\n", path);
+		return -1;
+	}
+	if ((emu = calloc(1, sizeof(*emu))) == NULL)
+		return -1;
+	for (i = 0; i < PFKEYEMU_HASHSIZE; i++)
+		LIST_INIT(&emu->sad[i]);
+	TAILQ_INIT(&emu->spd);
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+	if ((emu->so = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		free(emu);
+		return -1;
+	}
+	(void)unlink(path);
+	if (bind(emu->so, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		close(emu->so);
+		free(emu);
+		return -1;
+	}
+	setsockopt(emu->so, SOL_SOCKET, SO_SNDBUF, &bufsiz, sizeof(bufsiz));
+	setsockopt(emu->so, SOL_SOCKET, SO_RCVBUF, &bufsiz, sizeof(bufsiz));
+
+	for (;;) {
+		pfd.fd = emu->so;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, PFKEYEMU_TICK) < 0 && errno != EINTR)
+			break;
+
+		if (pfd.revents & POLLIN) {
+			fromlen = sizeof(from);
+			len = recvfrom(emu->so, emu->in, sizeof(emu->in), 0,
+				(struct sockaddr *)&from, &fromlen);
+			if (len >= 0 &&
+			    (emu->from = pfkeyemu_client(emu, &from, fromlen)) != NULL) {
+				if (latency > 0)
+					usleep(latency);
+				pfkeyemu_input(emu, len);
+				pfkeyemu_reap(emu);
+			}
+		}
+
+		if (pfkeyemu_now() >= next) {
+			pfkeyemu_tick(emu);
+			pfkeyemu_reap(emu);
+			next = pfkeyemu_now() + PFKEYEMU_TICK / 1e3;
+		}
+	}
+
+	fprintf(stderr, "poll: %s\n", strerror(errno));
+	close(emu->so);
+	return -1;
+}
+
+/* run a stand-in in a child process, once its socket is there */
+pid_t
+pfkeyemu_spawn(const char *path, int latency)
+{
+	struct stat st;
+	double deadline = pfkeyemu_now() + PFKEYEMU_STARTUP;
+	int status;
+	pid_t pid;
+
+	if ((pid = fork()) < 0) {
+		fprintf(stdout, "fork: %s\n", strerror(errno));
+		return -1;
+	}
+	if (pid == 0)
+		_exit(pfkeyemu_serve(path, latency) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+
+	while (stat(path, &st) < 0 || !S_ISSOCK(st.st_mode)) {
+		if (waitpid(pid, &status, WNOHANG) == pid ||
+		    pfkeyemu_now() > deadline) {
+			fprintf(stdout, "PF_KEY stand-in at %s did not start\n", path);
+			pfkeyemu_stop(pid);
+			return -1;
+		}
+		usleep(10000);
+	}
+
+	return pid;
+}
+
+void
+pfkeyemu_stop(pid_t pid)
+{
+	int status;
+
+	if (pid <= 0)
+		return;
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+}
+
+/*
+ * client side
+ */
+int
+pfkeyemu_open(const char *path)
+{
+	static u_int socks = 0;
+	struct sockaddr_un local, remote;
+	int bufsiz = PFKEYEMU_SOCKBUF;
+	int so;
+
+	memset(&remote, 0, sizeof(remote));
+	remote.sun_family = AF_UNIX;
+	strlcpy(remote.sun_path, path, sizeof(remote.sun_path));
+	memset(&local, 0, sizeof(local));
+	local.sun_family = AF_UNIX;
+	snprintf(local.sun_path, sizeof(local.sun_path), "%s.%d.%u",
+		path, (int)getpid(), socks++);
+
+	if ((so = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+		return -1;
+	(void)unlink(local.sun_path);
+	if (bind(so, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+	    connect(so, (struct sockaddr *)&remote, sizeof(remote)) < 0) {
+		(void)unlink(local.sun_path);
+		close(so);
+		return -1;
+	}
+	setsockopt(so, SOL_SOCKET, SO_SNDBUF, &bufsiz, sizeof(bufsiz));
+	setsockopt(so, SOL_SOCKET, SO_RCVBUF, &bufsiz, sizeof(bufsiz));
+
+	return so;
+}
+
+void
+pfkeyemu_close(int so)
+{
+	struct sockaddr_un local;
+	socklen_t len = sizeof(local);
+
+	if (getsockname(so, (struct sockaddr *)&local, &len) == 0 &&
+	    local.sun_family == AF_UNIX && local.sun_path[0] != '\0')
+		(void)unlink(local.sun_path);
+	close(so);
+}
+
+/* next message within timeout ms, to be freed by the caller */
+struct sadb_msg *
+pfkeyemu_recv(int so, int timeout)
+{
+	struct pollfd pfd;
+	struct sadb_msg *msg;
+	ssize_t len;
+
+	pfd.fd = so;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, timeout) <= 0)
+		return NULL;
+
+	if ((msg = malloc(PFKEYEMU_MSGSIZE)) == NULL)
+		return NULL;
+	len = recv(so, msg, PFKEYEMU_MSGSIZE, 0);
+	if (len < (ssize_t)sizeof(*msg) ||
+	    PFKEYEMU_UNUNIT64(msg->sadb_msg_len) != len) {
+		free(msg);
+		return NULL;
+	}
+
+	return msg;
+}
+
+static int
+pfkeyemu_send(int so, struct pfkeyemu_buf *b)
+{
+	return send(so, b->v, b->len, 0) == b->len ? 0 : -1;
+}
+
+int
+pfkeyemu_register(int so, u_int satype)
+{
+	struct pfkeyemu_buf b;
+
+	pfkeyemu_msg(&b, SADB_REGISTER, satype, 0, getpid());
+	return pfkeyemu_send(so, &b);
+}
+
+/* require transport mode ESP between src and dst */
+int
+pfkeyemu_spdadd(int so, struct sockaddr *src, struct sockaddr *dst, u_int dir)
+{
+	struct pfkeyemu_buf b;
+	struct sadb_x_policy *xpl;
+	struct sadb_x_ipsecrequest *xisr;
+
+	pfkeyemu_msg(&b, SADB_X_SPDADD, SADB_SATYPE_UNSPEC, 0, getpid());
+	pfkeyemu_addr(&b, SADB_EXT_ADDRESS_SRC, src);
+	pfkeyemu_addr(&b, SADB_EXT_ADDRESS_DST, dst);
+	xpl = pfkeyemu_ext(&b, SADB_X_EXT_POLICY, sizeof(*xpl) + sizeof(*xisr));
+	if (xpl == NULL)
+		return -1;
+	xpl->sadb_x_policy_type = IPSEC_POLICY_IPSEC;
+	xpl->sadb_x_policy_dir = dir;
+	xisr = (struct sadb_x_ipsecrequest *)(xpl + 1);
+	xisr->sadb_x_ipsecrequest_len = sizeof(*xisr);
+	xisr->sadb_x_ipsecrequest_proto = IPPROTO_ESP;
+	xisr->sadb_x_ipsecrequest_mode = IPSEC_MODE_TRANSPORT;
+	xisr->sadb_x_ipsecrequest_level = IPSEC_LEVEL_REQUIRE;
+
+	return pfkeyemu_send(so, &b);
+}
+
+/* a transport mode ESP SA with AES and HMAC-SHA1 */
+int
+pfkeyemu_add(int so, u_int32_t spi, struct sockaddr *src, struct sockaddr *dst,
+	u_int32_t hard)
+{
+	struct pfkeyemu_buf b;
+	struct sadb_sa *sa;
+	struct sadb_x_sa2 *sa2;
+	struct sadb_lifetime *lt;
+	struct sadb_key *key;
+
+	pfkeyemu_msg(&b, SADB_ADD, SADB_SATYPE_ESP, 0, getpid());
+	if ((sa = pfkeyemu_ext(&b, SADB_EXT_SA, sizeof(*sa))) == NULL)
+		return -1;
+	sa->sadb_sa_spi = spi;
+	sa->sadb_sa_replay = 4;
+	sa->sadb_sa_state = SADB_SASTATE_MATURE;
+	sa->sadb_sa_auth = SADB_AALG_SHA1HMAC;
+	sa->sadb_sa_encrypt = SADB_X_EALG_AESCBC;
+	if ((sa2 = pfkeyemu_ext(&b, SADB_X_EXT_SA2, sizeof(*sa2))) != NULL)
+		sa2->sadb_x_sa2_mode = IPSEC_MODE_TRANSPORT;
+	if (hard != 0 &&
+	    (lt = pfkeyemu_ext(&b, SADB_EXT_LIFETIME_HARD, sizeof(*lt))) != NULL)
+		lt->sadb_lifetime_addtime = hard;
+	pfkeyemu_addr(&b, SADB_EXT_ADDRESS_SRC, src);
+	pfkeyemu_addr(&b, SADB_EXT_ADDRESS_DST, dst);
+	if ((key = pfkeyemu_ext(&b, SADB_EXT_KEY_AUTH, sizeof(*key) + 20)) != NULL)
+		key->sadb_key_bits = 160;
+	if ((key = pfkeyemu_ext(&b, SADB_EXT_KEY_ENCRYPT, sizeof(*key) + 16)) != NULL)
+		key->sadb_key_bits = 128;
+
+	return pfkeyemu_send(so, &b);
+}
+
+int
+pfkeyemu_acquire(int so, struct sockaddr *src, struct sockaddr *dst)
+{
+	struct pfkeyemu_buf b;
+
+	pfkeyemu_msg(&b, SADB_ACQUIRE, SADB_SATYPE_ESP, 0, getpid());
+	pfkeyemu_addr(&b, SADB_EXT_ADDRESS_SRC, src);
+	pfkeyemu_addr(&b, SADB_EXT_ADDRESS_DST, dst);
+
+	return pfkeyemu_send(so, &b);
+}
+
+int
+pfkeyemu_expire(int so, u_int32_t spi, struct sockaddr *src, struct sockaddr *dst,
+	int hard)
+{
+	struct pfkeyemu_buf b;
+	struct sadb_sa *sa;
+
+	pfkeyemu_msg(&b, SADB_EXPIRE, SADB_SATYPE_ESP, 0, getpid());
+	if ((sa = pfkeyemu_ext(&b, SADB_EXT_SA, sizeof(*sa))) == NULL)
+		return -1;
+	sa->sadb_sa_spi = spi;
+	pfkeyemu_ext(&b, hard ? SADB_EXT_LIFETIME_HARD : SADB_EXT_LIFETIME_SOFT,
+		sizeof(struct sadb_lifetime));
+	pfkeyemu_addr(&b, SADB_EXT_ADDRESS_SRC, src);
+	pfkeyemu_addr(&b, SADB_EXT_ADDRESS_DST, dst);
+
+	return pfkeyemu_send(so, &b);
+}
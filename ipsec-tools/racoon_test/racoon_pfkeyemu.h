@@ -0,0 +1,48 @@
+//
+//  racoon_pfkeyemu.h
+//  ipsec
+//
+//  Copyright (c) 2026 Apple Inc. All rights reserved.
+//
+
+#ifndef _RACOON_PFKEYEMU_H
+#define _RACOON_PFKEYEMU_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * Userspace PF_KEY stand-in.
+ *
+ * The stand-in keeps its own SAD and SPD and speaks PF_KEY v2 over a UNIX
+ * datagram socket, so racoon (started with -K) and setkey can be exercised
+ * without an IPsec stack.  Every client socket is bound to a path of its
+ * own, which is how replies, broadcasts and registered-only messages are
+ * addressed, the same way the kernel uses its per-socket flags.
+ *
+ * Two messages that normally only come from the kernel are accepted from
+ * clients to drive benchmarks:
+ *	SADB_ACQUIRE	with src and dst, looks up the outbound policy covering
+ *			them and sends an ACQUIRE for it to registered sockets.
+ *	SADB_EXPIRE	with an SA, sends a soft expire for it, or a hard one
+ *			and deletes it when a hard lifetime is attached.
+ * Lifetimes installed with UPDATE and ADD expire on their own as well.
+ */
+#define PFKEYEMU_MAXCLIENTS	64
+#define PFKEYEMU_MSGSIZE	65536
+
+extern int pfkeyemu_serve (const char *, int);
+extern pid_t pfkeyemu_spawn (const char *, int);
+extern void pfkeyemu_stop (pid_t);
+
+/* client side, for benchmarks and the load generator */
+extern int pfkeyemu_open (const char *);
+extern void pfkeyemu_close (int);
+extern struct sadb_msg *pfkeyemu_recv (int, int);
+extern int pfkeyemu_register (int, u_int);
+extern int pfkeyemu_spdadd (int, struct sockaddr *, struct sockaddr *, u_int);
+extern int pfkeyemu_add (int, u_int32_t, struct sockaddr *, struct sockaddr *, u_int32_t);
+extern int pfkeyemu_acquire (int, struct sockaddr *, struct sockaddr *);
+extern int pfkeyemu_expire (int, u_int32_t, struct sockaddr *, struct sockaddr *, int);
+
+#endif /* _RACOON_PFKEYEMU_H */
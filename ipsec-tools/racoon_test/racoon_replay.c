@@ -0,0 +1,655 @@
+//
+//  racoon_replay.c
+//  ipsec
+//
+//  Copyright (c) 2026 Apple Inc. All rights reserved.
+//
+
+/*
+ * Captured traffic replay.
+ *
+ * IKE datagrams are read from a pcap file and handed straight to
+ * isakmp_input(), the same entry point isakmp_handler() uses once a
+ * packet is off the socket, either as fast as possible or at a fixed
+ * rate.  Everything racoon sends goes to a sink that only counts it and
+ * PF_KEY is served by the userspace stand-in, so no packet ever leaves
+ * the host and no SA is installed.
+ *
+ * The datagrams are replayed as captured: racoon's own replies carry new
+ * cookies, nonces and keys, so an exchange only gets as far as the peer's
+ * messages allow without them.  First messages, informational exchanges,
+ * retransmits and malformed traffic are processed in full, which covers
+ * the parser, the retransmit cache and the session lookup.  With -loop,
+ * every pass after the first finds the sessions of the one before.
+ *
+ * The cost of every message is reported by exchange type, along with the
+ * number of vchar_t allocations it made.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <libkern/OSByteOrder.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sysexits.h>
+#include <time.h>
+#include <dispatch/dispatch.h>
+
+#include "var.h"
+#include "misc.h"
+#include "vmbuf.h"
+#include "plog.h"
+#include "cfparse_proto.h"
+#include "isakmp_var.h"
+#include "isakmp.h"
+#include "localconf.h"
+#include "remoteconf.h"
+#include "handler.h"
+#include "oakley.h"
+#include "grabmyaddr.h"
+#include "sockmisc.h"
+#include "nattraversal.h"
+#include "schedule.h"
+#include "pfkey.h"
+#include "libpfkey.h"
+#include "strnames.h"
+#include "vendorid.h"
+#include "crypto_openssl.h"
+#include "gcmalloc.h"
+#include "racoon_pfkeyemu.h"
+
+/* defined by main.c, which is left out of this target */
+int f_local = 0;
+int vflag = 1;
+pid_t racoon_pid = 0;
+int launchdlaunched = 0;
+int print_pid = 1;
+
+static struct option long_options[] =
+{
+	{"config"       , required_argument, 0, 'f'},
+	{"read"         , required_argument, 0, 'r'},
+	{"rate"         , required_argument, 0, 'R'},
+	{"loop"         , required_argument, 0, 'n'},
+	{"local"        , required_argument, 0, 'a'},
+	{"pfkey_latency", required_argument, 0, 'L'},
+	{"help"         , no_argument, 0, 'h'},
+	{0, 0, 0, 0}
+};
+
+/* pcap file format, see pcap-savefile(5) */
+#define PCAP_MAGIC			0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+
+#define PCAP_LINKTYPE_NULL		0
+#define PCAP_LINKTYPE_ETHERNET	1
+#define PCAP_LINKTYPE_RAW		101
+#define PCAP_LINKTYPE_LOOP		108
+#define PCAP_LINKTYPE_LINUX_SLL	113
+
+struct pcap_file_header {
+	u_int32_t magic;
+	u_int16_t version_major;
+	u_int16_t version_minor;
+	int32_t thiszone;
+	u_int32_t sigfigs;
+	u_int32_t snaplen;
+	u_int32_t linktype;
+};
+
+struct pcap_record_header {
+	u_int32_t ts_sec;
+	u_int32_t ts_frac;
+	u_int32_t caplen;
+	u_int32_t len;
+};
+
+struct replay_packet {
+	struct sockaddr_storage remote;
+	struct sockaddr_storage local;
+	vchar_t *msg;
+};
+
+struct replay_etype {
+	u_int64_t packets;
+	u_int64_t bytes;
+	double time;
+	double max;
+	u_int64_t heap_allocs;
+	u_int64_t arena_allocs;
+	u_int64_t sent;
+};
+
+static struct {
+	struct replay_packet *pkts;
+	int npkts;
+	int next;
+	int loops;
+	int rate;
+	int skipped;			/* not IKE, fragments, ESP */
+	struct replay_etype etype[256];
+	u_int64_t sent;			/* packets handed to the sink */
+	u_int64_t sent_bytes;
+	double start;
+	dispatch_source_t timer;
+	pid_t pfkey;			/* PF_KEY stand-in */
+	char dir[MAXPATHLEN];
+	char path[MAXPATHLEN];
+} replay;
+
+static double
+replay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+replay_sink(struct iovec *iov, int iovcnt, struct sockaddr_storage *src,
+    struct sockaddr_storage *dst)
+{
+	int i, len = 0;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	replay.sent++;
+	replay.sent_bytes += len;
+	return len;
+}
+
+static u_int32_t
+replay_get32(const u_char *p, int swap)
+{
+	u_int32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return swap ? OSSwapInt32(v) : v;
+}
+
+/*
+ * take one UDP datagram out of an IP packet.  only the first fragment
+ * could carry the UDP header, so fragmented packets are skipped.
+ */
+static int
+replay_udp(const u_char *p, size_t len, struct sockaddr_storage *src,
+    struct sockaddr_storage *dst, const u_char **data, size_t *datalen)
+{
+	const u_char *udp;
+	size_t hlen;
+	u_int16_t sport, dport, ulen;
+
+	memset(src, 0, sizeof(*src));
+	memset(dst, 0, sizeof(*dst));
+	if (len < 1)
+		return -1;
+
+	switch (p[0] >> 4) {
+	case 4:
+	    {
+		struct sockaddr_in *sin;
+
+		if (len < 20)
+			return -1;
+		hlen = (p[0] & 0x0f) * 4;
+		if (hlen < 20 || len < hlen || p[9] != IPPROTO_UDP)
+			return -1;
+		/* MF set or non-zero offset */
+		if ((p[6] & 0x3f) != 0 || p[7] != 0)
+			return -1;
+		sin = (struct sockaddr_in *)src;
+		sin->sin_family = AF_INET;
+		sin->sin_len = sizeof(*sin);
+		memcpy(&sin->sin_addr, p + 12, sizeof(sin->sin_addr));
+		sin = (struct sockaddr_in *)dst;
+		sin->sin_family = AF_INET;
+		sin->sin_len = sizeof(*sin);
+		memcpy(&sin->sin_addr, p + 16, sizeof(sin->sin_addr));
+		break;
+	    }
+#ifdef INET6
+	case 6:
+	    {
+		struct sockaddr_in6 *sin6;
+
+		/* extension headers aren't followed */
+		hlen = 40;
+		if (len < hlen || p[6] != IPPROTO_UDP)
+			return -1;
+		sin6 = (struct sockaddr_in6 *)src;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_len = sizeof(*sin6);
+		memcpy(&sin6->sin6_addr, p + 8, sizeof(sin6->sin6_addr));
+		sin6 = (struct sockaddr_in6 *)dst;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_len = sizeof(*sin6);
+		memcpy(&sin6->sin6_addr, p + 24, sizeof(sin6->sin6_addr));
+		break;
+	    }
+#endif
+	default:
+		return -1;
+	}
+
+	udp = p + hlen;
+	if (len < hlen + 8)
+		return -1;
+	sport = (udp[0] << 8) | udp[1];
+	dport = (udp[2] << 8) | udp[3];
+	ulen = (udp[4] << 8) | udp[5];
+	if (ulen < 8 || hlen + ulen > len)
+		return -1;
+
+	set_port(src, sport);
+	set_port(dst, dport);
+	*data = udp + 8;
+	*datalen = ulen - 8;
+	return 0;
+}
+
+static int
+replay_local(struct sockaddr_storage *addr, struct sockaddr_storage *local)
+{
+	if (local->ss_family == AF_UNSPEC)
+		return 1;
+	return cmpsaddrwop(addr, local) == 0;
+}
+
+/* read the IKE datagrams sent to the local address out of a capture */
+static int
+replay_read(const char *path, struct sockaddr_storage *local)
+{
+	struct pcap_file_header fh;
+	struct pcap_record_header rh;
+	struct sockaddr_storage src, dst;
+	const u_char *p, *data;
+	u_char *file = NULL;
+	size_t off, len, datalen, skip;
+	struct stat st;
+	FILE *fp;
+	int swap, max = 0;
+	u_int16_t dport, ethertype;
+
+	if ((fp = fopen(path, "r")) == NULL || fstat(fileno(fp), &st) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto fail;
+	}
+	if ((file = malloc(st.st_size)) == NULL ||
+	    fread(file, 1, st.st_size, fp) != st.st_size) {
+		fprintf(stderr, "%s: failed to read the capture\n", path);
+		goto fail;
+	}
+	if (st.st_size < sizeof(fh)) {
+		fprintf(stderr, "%s: not a pcap file\n", path);
+		goto fail;
+	}
+	memcpy(&fh, file, sizeof(fh));
+	if (fh.magic == PCAP_MAGIC || fh.magic == PCAP_MAGIC_NSEC)
+		swap = 0;
+	else if (OSSwapInt32(fh.magic) == PCAP_MAGIC ||
+	    OSSwapInt32(fh.magic) == PCAP_MAGIC_NSEC)
+		swap = 1;
+	else {
+		fprintf(stderr, "%s: not a pcap file (pcap-ng isn't read)\n", path);
+		goto fail;
+	}
+	fh.linktype = swap ? OSSwapInt32(fh.linktype) : fh.linktype;
+
+	for (off = sizeof(fh); off + sizeof(rh) <= st.st_size; off += rh.caplen) {
+		rh.caplen = replay_get32(file + off + 8, swap);
+		off += sizeof(rh);
+		if (rh.caplen > st.st_size - off)
+			break;
+		p = file + off;
+		len = rh.caplen;
+
+		switch (fh.linktype) {
+		case PCAP_LINKTYPE_NULL:
+		case PCAP_LINKTYPE_LOOP:
+			skip = 4;
+			break;
+		case PCAP_LINKTYPE_ETHERNET:
+			if (len < 14)
+				goto skip;
+			skip = 14;
+			ethertype = (p[12] << 8) | p[13];
+			if (ethertype == 0x8100 && len >= 18) {	/* 802.1Q */
+				skip = 18;
+				ethertype = (p[16] << 8) | p[17];
+			}
+			if (ethertype != 0x0800 && ethertype != 0x86dd)
+				goto skip;
+			break;
+		case PCAP_LINKTYPE_LINUX_SLL:
+			skip = 16;
+			break;
+		case PCAP_LINKTYPE_RAW:
+			skip = 0;
+			break;
+		default:
+			fprintf(stderr, "%s: link type %u isn't supported\n",
+				path, fh.linktype);
+			goto fail;
+		}
+		if (len < skip ||
+		    replay_udp(p + skip, len - skip, &src, &dst, &data, &datalen) < 0)
+			goto skip;
+
+		dport = extract_port(&dst);
+		if (dport == PORT_ISAKMP_NATT) {
+			/* keep-alives and ESP in UDP aren't IKE */
+			if (datalen < NON_ESP_MARKER_LEN ||
+			    memcmp(data, "\0\0\0\0", NON_ESP_MARKER_LEN) != 0)
+				goto skip;
+			data += NON_ESP_MARKER_LEN;
+			datalen -= NON_ESP_MARKER_LEN;
+		} else if (dport != PORT_ISAKMP)
+			goto skip;
+		if (datalen < sizeof(struct isakmp))
+			goto skip;
+
+		/* the first IKE packet decides which side is replayed */
+		if (local->ss_family == AF_UNSPEC)
+			memcpy(local, &dst, sysdep_sa_len((struct sockaddr *)&dst));
+		if (!replay_local(&dst, local))
+			continue;
+
+		if (replay.npkts == max) {
+			max = max ? max * 2 : 1024;
+			replay.pkts = realloc(replay.pkts,
+			    max * sizeof(*replay.pkts));
+			if (replay.pkts == NULL) {
+				fprintf(stderr, "out of memory\n");
+				goto fail;
+			}
+		}
+		memcpy(&replay.pkts[replay.npkts].remote, &src, sizeof(src));
+		memcpy(&replay.pkts[replay.npkts].local, &dst, sizeof(dst));
+		if ((replay.pkts[replay.npkts].msg = vmalloc(datalen)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			goto fail;
+		}
+		memcpy(replay.pkts[replay.npkts].msg->v, data, datalen);
+		replay.npkts++;
+		continue;
+
+	skip:
+		replay.skipped++;
+	}
+
+	free(file);
+	fclose(fp);
+	return 0;
+
+fail:
+	free(file);
+	if (fp != NULL)
+		fclose(fp);
+	return -1;
+}
+
+/*
+ * racoon sends from the socket of a local address.  the sink takes the
+ * packets before they get to it, but every address the capture was sent
+ * to still needs an entry.
+ */
+static int
+replay_myaddrs(void)
+{
+	struct myaddrs *p;
+	int i;
+
+	for (i = 0; i < replay.npkts; i++) {
+		for (p = lcconf->myaddrs; p; p = p->next)
+			if (cmpsaddrstrict(p->addr, &replay.pkts[i].local) == 0)
+				break;
+		if (p != NULL)
+			continue;
+
+		if ((p = newmyaddr()) == NULL ||
+		    (p->addr = dupsaddr(&replay.pkts[i].local)) == NULL)
+			return -1;
+		p->sock = socket(p->addr->ss_family, SOCK_DGRAM, 0);
+		if (p->sock < 0) {
+			fprintf(stderr, "socket: %s\n", strerror(errno));
+			return -1;
+		}
+		p->udp_encap = extract_port(p->addr) == PORT_ISAKMP_NATT;
+		p->in_use = 1;
+		insmyaddr(p, &lcconf->myaddrs);
+	}
+	myaddrs_gen++;
+
+	return 0;
+}
+
+static void
+replay_cleanup(void)
+{
+	if (lcconf->sock_pfkey >= 0)
+		pfkey_close_sock(lcconf->sock_pfkey);
+	if (replay.pfkey > 0)
+		pfkeyemu_stop(replay.pfkey);
+	unlink(replay.path);
+	rmdir(replay.dir);
+}
+
+static void
+replay_report(void)
+{
+	struct replay_etype total;
+	double elapsed = replay_now() - replay.start;
+	int i;
+
+	memset(&total, 0, sizeof(total));
+	fprintf(stdout, "%d packets replayed %d times in %.3f s, %d skipped\n",
+		replay.npkts, replay.loops, elapsed, replay.skipped);
+	fprintf(stdout, "%-16s %10s %10s %10s %10s %10s %10s %8s\n",
+		"exchange", "packets", "bytes", "us/pkt", "max us",
+		"vmallocs", "arena", "sent");
+	for (i = 0; i < 256; i++) {
+		struct replay_etype *e = &replay.etype[i];
+
+		if (e->packets == 0)
+			continue;
+		fprintf(stdout, "%-16s %10llu %10llu %10.1f %10.1f %10.1f %10.1f %8llu\n",
+			s_isakmp_etype(i), e->packets, e->bytes,
+			e->time * 1e6 / e->packets, e->max * 1e6,
+			(double)e->heap_allocs / e->packets,
+			(double)e->arena_allocs / e->packets, e->sent);
+		total.packets += e->packets;
+		total.bytes += e->bytes;
+		total.time += e->time;
+		total.heap_allocs += e->heap_allocs;
+		total.arena_allocs += e->arena_allocs;
+		total.sent += e->sent;
+	}
+	if (total.packets == 0)
+		return;
+	fprintf(stdout, "%-16s %10llu %10llu %10.1f %10s %10.1f %10.1f %8llu\n",
+		"all", total.packets, total.bytes,
+		total.time * 1e6 / total.packets, "",
+		(double)total.heap_allocs / total.packets,
+		(double)total.arena_allocs / total.packets, total.sent);
+	fprintf(stdout, "%.0f packets/s in isakmp_input, %llu bytes sent\n",
+		total.packets / total.time, replay.sent_bytes);
+}
+
+static void
+replay_one(void)
+{
+	struct replay_packet *pkt = &replay.pkts[replay.next];
+	struct isakmp *isakmp = (struct isakmp *)pkt->msg->v;
+	struct replay_etype *e = &replay.etype[isakmp->etype];
+	struct vmbuf_stats before;
+	u_int64_t sent = replay.sent;
+	double start, elapsed;
+
+	before = vmbuf_stats;
+	start = replay_now();
+	isakmp_input(pkt->msg, &pkt->remote, &pkt->local);
+	elapsed = replay_now() - start;
+
+	e->packets++;
+	e->bytes += pkt->msg->l;
+	e->time += elapsed;
+	if (elapsed > e->max)
+		e->max = elapsed;
+	e->heap_allocs += vmbuf_stats.heap_allocs - before.heap_allocs;
+	e->arena_allocs += vmbuf_stats.arena_allocs - before.arena_allocs;
+	e->sent += replay.sent - sent;
+
+	if (++replay.next == replay.npkts) {
+		replay.next = 0;
+		replay.loops--;
+	}
+}
+
+/*
+ * packets are fed from the main queue, one per block, so the PF_KEY
+ * socket and racoon's timers get their turn in between.
+ */
+static void
+replay_next(void *unused)
+{
+	if (replay.loops == 0) {
+		if (replay.timer != NULL)
+			dispatch_source_cancel(replay.timer);
+		replay_report();
+		replay_cleanup();
+		exit(0);
+	}
+
+	replay_one();
+	if (replay.rate == 0)
+		dispatch_async_f(dispatch_get_main_queue(), NULL, replay_next);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: racoon_replay -config=racoon.conf -read=file.pcap "
+		"[-rate=pps] [-loop=n]\n"
+		"                     [-local=address] [-pfkey_latency=usec]\n");
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_storage local;
+	const char *config = NULL, *capture = NULL;
+	struct addrinfo hints, *res;
+	int ch, loops = 1, latency = 0;
+
+	memset(&local, 0, sizeof(local));
+	while ((ch = getopt_long_only(argc, argv, "", long_options, NULL)) != -1) {
+		switch (ch) {
+			case 'f':
+				config = optarg;
+				break;
+			case 'r':
+				capture = optarg;
+				break;
+			case 'R':
+				replay.rate = atoi(optarg);
+				break;
+			case 'n':
+				loops = atoi(optarg);
+				break;
+			case 'a':
+				memset(&hints, 0, sizeof(hints));
+				hints.ai_flags = AI_NUMERICHOST;
+				if (getaddrinfo(optarg, NULL, &hints, &res) != 0) {
+					fprintf(stderr, "%s: invalid address\n", optarg);
+					exit(EX_USAGE);
+				}
+				memcpy(&local, res->ai_addr, res->ai_addrlen);
+				freeaddrinfo(res);
+				break;
+			case 'L':
+				latency = atoi(optarg);
+				break;
+			case 'h':
+			default:
+				usage();
+		}
+	}
+	if (config == NULL || capture == NULL || loops <= 0 || replay.rate < 0)
+		usage();
+
+	ploginit();
+#ifdef HAVE_OPENSSL
+	eay_init();
+#endif
+	initlcconf();
+	initrmconf();
+	oakley_dhinit();
+	compute_vendorids();
+	lcconf->racoon_conf = (char *)config;
+	lcconf->sock_pfkey = -1;
+
+	if (replay_read(capture, &local) < 0)
+		exit(EX_DATAERR);
+	if (replay.npkts == 0) {
+		fprintf(stderr, "%s: no IKE packets for the local address\n", capture);
+		exit(EX_DATAERR);
+	}
+
+	strlcpy(replay.dir, "/tmp/racoon_replay.XXXXXX", sizeof(replay.dir));
+	if (mkdtemp(replay.dir) == NULL) {
+		fprintf(stderr, "cannot create a work directory: %s\n", strerror(errno));
+		exit(EX_OSERR);
+	}
+	snprintf(replay.path, sizeof(replay.path), "%s/pfkey", replay.dir);
+	if ((replay.pfkey = pfkeyemu_spawn(replay.path, latency)) < 0)
+		goto fail;
+	if (pfkey_set_emulator(replay.path) < 0 || pfkey_init() < 0) {
+		fprintf(stderr, "failed to open the PF_KEY stand-in\n");
+		goto fail;
+	}
+	if (cfparse() != 0) {
+		fprintf(stderr, "%s: failed to parse the configuration\n", config);
+		goto fail;
+	}
+
+	sched_init();
+	ike_session_initctdtree();
+	ike_session_init_recvdpkt();
+	if (replay_myaddrs() < 0)
+		goto fail;
+	setsendsink(replay_sink);
+
+	replay.loops = loops;
+	replay.start = replay_now();
+	if (replay.rate != 0) {
+		replay.timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER,
+		    0, 0, dispatch_get_main_queue());
+		dispatch_source_set_timer(replay.timer, DISPATCH_TIME_NOW,
+		    NSEC_PER_SEC / replay.rate, 0);
+		dispatch_source_set_event_handler_f(replay.timer, replay_next);
+		dispatch_resume(replay.timer);
+	} else
+		dispatch_async_f(dispatch_get_main_queue(), NULL, replay_next);
+
+	dispatch_main();
+	/* NOTREACHED */
+
+fail:
+	replay_cleanup();
+	exit(EX_SOFTWARE);
+}
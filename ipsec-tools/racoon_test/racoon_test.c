@@ -7,27 +7,82 @@
 
 #include "oakley.h"
 #include "crypto_cssm.h"
+#include "isakmp_plindex.h"
+#include "isakmp_msgbuild.h"
+#include "shard.h"
+#include "racoon_loadgen.h"
+#include "racoon_pfkeyemu.h"
+#include "cfsnapshot.h"
 #include "racoon_certs_data.h"
+#include "racoon_ike_msgs_data.h"
 
 #include <TargetConditionals.h>
 #include <Security/SecCertificate.h>
 #include <sysexits.h>
 #include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <net/pfkeyv2.h>
+#include <netinet6/ipsec.h>
 
 #define racoon_test_pass    0
 #define racoon_test_failure 1
 
 static struct option long_options[] =
 {
-	{"unit_test", no_argument, 0, 'u'},
-	{"help"     , no_argument, 0, 'h'}
+	{"unit_test"  , no_argument, 0, 'u'},
+	{"parse_bench", optional_argument, 0, 'p'},
+	{"shard_bench", optional_argument, 0, 'd'},
+	{"load_bench" , optional_argument, 0, 'l'},
+	{"load_count" , required_argument, 0, 'n'},
+	{"load_mode"  , required_argument, 0, 'm'},
+	{"load_ph2"   , no_argument, 0, '2'},
+	{"load_racoon", required_argument, 0, 'r'},
+	{"load_cert"  , required_argument, 0, 'c'},
+	{"load_xauth" , required_argument, 0, 'x'},
+	{"pfkey_bench", optional_argument, 0, 'k'},
+	{"pfkey_emu"  , required_argument, 0, 'e'},
+	{"pfkey_latency", required_argument, 0, 'L'},
+	{"help"       , no_argument, 0, 'h'},
+	{0, 0, 0, 0}
 };
 
+#define IKE_MSG(m)	{ #m, m, sizeof(m) }
+
+static struct ike_msg {
+	const char *name;
+	unsigned char *data;
+	size_t len;
+} ike_msgs[] = {
+	IKE_MSG(main_mode_msg1),
+	IKE_MSG(main_mode_msg2),
+	IKE_MSG(main_mode_msg3),
+	IKE_MSG(main_mode_msg5),
+	IKE_MSG(aggr_mode_msg1),
+	IKE_MSG(quick_mode_msg1),
+	IKE_MSG(info_dpd),
+};
+
+#define IKE_MSG_COUNT	(sizeof(ike_msgs) / sizeof(ike_msgs[0]))
+
 static void
 print_usage(char *name)
 {
 	printf("Usage: %s\n", name);
 	printf("     -unit_test\n");
+	printf("     -parse_bench[=iterations]\n");
+	printf("     -shard_bench[=sessions] [-load_count=handshakes] [-load_mode=...]\n");
+	printf("         [-load_racoon=path]: phase 1 handshakes/s with racoon -N 1 to 8\n");
+	printf("     -load_bench[=sessions] [-load_count=handshakes] [-load_ph2]\n");
+	printf("         [-load_mode=main|aggressive|xauth|cert] [-load_racoon=path]\n");
+	printf("         [-load_cert=keychain-ref] [-load_xauth=user:password]\n");
+	printf("         peers use 127.1.0.1 and up, added to lo0 for the run if missing\n");
+	printf("     -pfkey_bench[=sas] [-pfkey_latency=usec]\n");
+	printf("     -pfkey_emu=path [-pfkey_latency=usec]\n");
+	printf("         serve PF_KEY at path for racoon -K until killed\n");
 }
 
 static int
@@ -84,6 +139,488 @@ racoon_cert_validity_test(void)
 	return result;
 }
 
+static int
+racoon_plindex_test(void)
+{
+	int result = racoon_test_pass;
+	struct isakmp_plindex idx;
+	struct isakmp_parse_t *pa;
+	static const struct isakmp_plindex_rule mm1_rules[] = {
+		{ ISAKMP_NPTYPE_SA, 1 },
+		{ ISAKMP_NPTYPE_VID, ISAKMP_PLINDEX_ANY },
+		{ ISAKMP_NPTYPE_NONE, 0 }
+	};
+	static const struct isakmp_plindex_rule mm1_onevid[] = {
+		{ ISAKMP_NPTYPE_SA, 1 },
+		{ ISAKMP_NPTYPE_VID, 1 },
+		{ ISAKMP_NPTYPE_NONE, 0 }
+	};
+	unsigned char buf[sizeof(quick_mode_msg1)];
+	unsigned char *big;
+	struct isakmp *isakmp;
+	struct isakmp_gen *gen;
+	vchar_t msg;
+	int i, n, nvid;
+
+	fprintf(stdout, "[TEST] RacoonPayloadIndex\n");
+
+	isakmp_plindex_init(&idx);
+
+	fprintf(stdout, "[BEGIN] PayloadIndexCountTest\n");
+	msg.v = (caddr_t)main_mode_msg1;
+	msg.l = sizeof(main_mode_msg1);
+	n = 0;
+	if (isakmp_plindex_parse(&idx, &msg) == 0) {
+		for (pa = isakmp_plindex_first(&idx, ISAKMP_NPTYPE_VID);
+		     pa != NULL;
+		     pa = isakmp_plindex_next(&idx, pa))
+			n++;
+	}
+	if (idx.np != 7 ||
+	    isakmp_plindex_count(&idx, ISAKMP_NPTYPE_SA) != 1 ||
+	    isakmp_plindex_count(&idx, ISAKMP_NPTYPE_VID) != 6 || n != 6 ||
+	    idx.pl[0].type != ISAKMP_NPTYPE_SA ||
+	    idx.pl[idx.np].type != ISAKMP_NPTYPE_NONE ||
+	    isakmp_plindex_sa(&idx) == NULL ||
+	    isakmp_plindex_hash(&idx) != NULL) {
+		fprintf(stdout, "[FAIL]  PayloadIndexCountTest\n");
+		result = racoon_test_failure;
+	} else {
+		fprintf(stdout, "[PASS]  PayloadIndexCountTest\n");
+	}
+
+	fprintf(stdout, "[BEGIN] PayloadIndexCheckTest\n");
+	if (isakmp_plindex_check(&idx, mm1_rules) != NULL ||
+	    (pa = isakmp_plindex_check(&idx, mm1_onevid)) == NULL ||
+	    pa != isakmp_plindex_next(&idx, isakmp_plindex_first(&idx, ISAKMP_NPTYPE_VID))) {
+		fprintf(stdout, "[FAIL]  PayloadIndexCheckTest\n");
+		result = racoon_test_failure;
+	} else {
+		fprintf(stdout, "[PASS]  PayloadIndexCheckTest\n");
+	}
+
+	fprintf(stdout, "[BEGIN] PayloadIndexTruncatedTest\n");
+	msg.v = (caddr_t)quick_mode_msg1;
+	msg.l = sizeof(quick_mode_msg1) - 1;
+	if (isakmp_plindex_parse(&idx, &msg) == 0 ||
+	    idx.np != 0 || isakmp_plindex_count(&idx, ISAKMP_NPTYPE_HASH) != 0) {
+		fprintf(stdout, "[FAIL]  PayloadIndexTruncatedTest\n");
+		result = racoon_test_failure;
+	} else {
+		fprintf(stdout, "[PASS]  PayloadIndexTruncatedTest\n");
+	}
+
+	/* shrink the ID payload below its fixed part */
+	fprintf(stdout, "[BEGIN] PayloadIndexShortPayloadTest\n");
+	memcpy(buf, quick_mode_msg1, sizeof(buf));
+	msg.v = (caddr_t)buf;
+	msg.l = sizeof(buf);
+	if (isakmp_plindex_parse(&idx, &msg) < 0 ||
+	    (pa = isakmp_plindex_first(&idx, ISAKMP_NPTYPE_ID)) == NULL) {
+		fprintf(stdout, "[FAIL]  PayloadIndexShortPayloadTest\n");
+		result = racoon_test_failure;
+	} else {
+		pa->ptr->len = htons(sizeof(struct isakmp_gen) + 1);
+		if (isakmp_plindex_parse(&idx, &msg) == 0) {
+			fprintf(stdout, "[FAIL]  PayloadIndexShortPayloadTest\n");
+			result = racoon_test_failure;
+		} else {
+			fprintf(stdout, "[PASS]  PayloadIndexShortPayloadTest\n");
+		}
+	}
+
+	/* main mode message 1 with its VIDs repeated past the slots */
+	fprintf(stdout, "[BEGIN] PayloadIndexSpillTest\n");
+	nvid = ISAKMP_PLINDEX_MAX * 2;
+	big = calloc(1, sizeof(main_mode_msg1) + nvid * 2 * sizeof(*gen));
+	if (big == NULL) {
+		fprintf(stdout, "[FAIL]  PayloadIndexSpillTest\n");
+		result = racoon_test_failure;
+	} else {
+		memcpy(big, main_mode_msg1, sizeof(main_mode_msg1));
+		msg.v = (caddr_t)big;
+		msg.l = sizeof(main_mode_msg1);
+		gen = NULL;
+		if (isakmp_plindex_parse(&idx, &msg) == 0 && idx.np == 7)
+			gen = idx.pl[idx.np - 1].ptr;
+		if (gen != NULL) {
+			/* the last payload now leads on to the extra VIDs */
+			gen->np = ISAKMP_NPTYPE_VID;
+			gen = (struct isakmp_gen *)(big + sizeof(main_mode_msg1));
+			/* each VID carries a gen header worth of data */
+			for (i = 0; i < nvid; i++) {
+				gen[2 * i].np = i + 1 < nvid ? ISAKMP_NPTYPE_VID : ISAKMP_NPTYPE_NONE;
+				gen[2 * i].len = htons(2 * sizeof(*gen));
+			}
+			msg.l += nvid * 2 * sizeof(*gen);
+			isakmp = (struct isakmp *)big;
+			isakmp->len = htonl(msg.l);
+		}
+		n = 0;
+		if (gen != NULL && isakmp_plindex_parse(&idx, &msg) == 0) {
+			for (pa = isakmp_plindex_first(&idx, ISAKMP_NPTYPE_VID);
+			     pa != NULL;
+			     pa = isakmp_plindex_next(&idx, pa))
+				n++;
+		}
+		if (gen == NULL || idx.np != 7 + nvid || idx.spill == NULL ||
+		    n != 6 + nvid ||
+		    isakmp_plindex_count(&idx, ISAKMP_NPTYPE_VID) != 6 + nvid ||
+		    isakmp_plindex_sa(&idx) == NULL ||
+		    idx.pl[idx.np].type != ISAKMP_NPTYPE_NONE ||
+		    isakmp_plindex_check(&idx, mm1_rules) != NULL ||
+		    isakmp_plindex_check(&idx, mm1_onevid) == NULL) {
+			fprintf(stdout, "[FAIL]  PayloadIndexSpillTest\n");
+			result = racoon_test_failure;
+		} else {
+			fprintf(stdout, "[PASS]  PayloadIndexSpillTest\n");
+		}
+		isakmp_plindex_free(&idx);
+		free(big);
+	}
+
+	return result;
+}
+
+static int
+racoon_msgbuild_test(void)
+{
+	int result = racoon_test_pass;
+	phase1_handle_t iph1;
+	struct isakmp_msgb mb;
+	struct isakmp_plindex idx;
+	u_int8_t data[4] = { 1, 2, 3, 4 };
+	vchar_t body, raw, *msg;
+	int i, ret;
+
+	memset(&iph1, 0, sizeof(iph1));
+	iph1.version = ISAKMP_VERSION_NUMBER_IKEV1;
+	memset(&body, 0, sizeof(body));
+	body.v = (caddr_t)data;
+	body.l = sizeof(data);
+
+	fprintf(stdout, "[TEST] RacoonMessageBuilder\n");
+
+	/* the generic headers chain the bodies together */
+	fprintf(stdout, "[BEGIN] MessageBuildFullTest\n");
+	isakmp_msgb_init(&mb, &iph1, ISAKMP_ETYPE_INFO, 0, 0);
+	ret = 0;
+	for (i = 0; i < ISAKMP_MSGB_MAXSEG; i++)
+		ret |= isakmp_msgb_add(&mb, &body, ISAKMP_NPTYPE_VID);
+	isakmp_plindex_init(&idx);
+	msg = isakmp_msgb_flatten(&mb);
+	if (ret != 0 || mb.niov != ISAKMP_MSGB_MAXIOV || msg == NULL ||
+	    msg->l != sizeof(struct isakmp) +
+	    ISAKMP_MSGB_MAXSEG * (sizeof(struct isakmp_gen) + sizeof(data)) ||
+	    isakmp_plindex_parse(&idx, msg) < 0 ||
+	    isakmp_plindex_count(&idx, ISAKMP_NPTYPE_VID) != ISAKMP_MSGB_MAXSEG) {
+		fprintf(stdout, "[FAIL]  MessageBuildFullTest\n");
+		result = racoon_test_failure;
+	} else {
+		fprintf(stdout, "[PASS]  MessageBuildFullTest\n");
+	}
+	isakmp_plindex_free(&idx);
+	vfree(msg);
+
+	/* past the last iovec, payloads are refused instead of written */
+	fprintf(stdout, "[BEGIN] MessageBuildOverflowTest\n");
+	memset(&raw, 0, sizeof(raw));
+	raw.v = (caddr_t)data;
+	raw.l = sizeof(data);
+	if (isakmp_msgb_append(&mb, &raw, ISAKMP_NPTYPE_N) == 0 ||
+	    mb.niov != ISAKMP_MSGB_MAXIOV ||
+	    isakmp_msgb_flatten(&mb) != NULL) {
+		fprintf(stdout, "[FAIL]  MessageBuildOverflowTest\n");
+		result = racoon_test_failure;
+	} else {
+		isakmp_msgb_init(&mb, &iph1, ISAKMP_ETYPE_INFO, 0, 0);
+		ret = 0;
+		for (i = 0; i <= ISAKMP_MSGB_MAXSEG; i++)
+			ret = isakmp_msgb_add(&mb, &body, ISAKMP_NPTYPE_VID);
+		if (ret == 0 || mb.niov != ISAKMP_MSGB_MAXIOV ||
+		    isakmp_msgb_append(&mb, &raw, ISAKMP_NPTYPE_N) == 0) {
+			fprintf(stdout, "[FAIL]  MessageBuildOverflowTest\n");
+			result = racoon_test_failure;
+		} else {
+			fprintf(stdout, "[PASS]  MessageBuildOverflowTest\n");
+		}
+	}
+
+	return result;
+}
+
+static int
+racoon_arena_test(void)
+{
+	int result = racoon_test_pass;
+	struct vmarena arena;
+	vchar_t *a, *b, *c;
+	caddr_t first;
+
+	memset(&arena, 0, sizeof(arena));
+
+	fprintf(stdout, "[TEST] RacoonArena\n");
+
+	fprintf(stdout, "[BEGIN] ArenaReuseTest\n");
+	a = varena_alloc(&arena, 20);
+	b = varena_alloc(&arena, 64);
+	first = a ? a->v : NULL;
+	if (a == NULL || b == NULL || a->arena != &arena ||
+	    arena.live != 2 || arena.nchunks != 1) {
+		fprintf(stdout, "[FAIL]  ArenaReuseTest\n");
+		result = racoon_test_failure;
+	} else {
+		memset(a->v, 0xa5, a->l);
+		vfree(a);
+		vfree(b);
+		/* nothing live: the chunk is wiped and handed out again */
+		a = varena_alloc(&arena, 20);
+		if (a == NULL || a->v != first || a->v[0] != 0 ||
+		    arena.nchunks != 1) {
+			fprintf(stdout, "[FAIL]  ArenaReuseTest\n");
+			result = racoon_test_failure;
+		} else {
+			fprintf(stdout, "[PASS]  ArenaReuseTest\n");
+		}
+		vfree(a);
+	}
+
+	fprintf(stdout, "[BEGIN] ArenaPeakTest\n");
+	a = varena_alloc(&arena, 8);
+	c = varena_alloc(&arena, VMARENA_CHUNKSIZE * 2);
+	if (a == NULL || c == NULL) {
+		fprintf(stdout, "[FAIL]  ArenaPeakTest\n");
+		result = racoon_test_failure;
+	} else {
+		memcpy(a->v, "keymatkm", 8);
+		c = vrealloc(c, VMARENA_CHUNKSIZE * 3);
+		if (c == NULL || c->arena != &arena || arena.live != 2 ||
+		    memcmp(a->v, "keymatkm", 8) ||
+		    arena.peak != arena.inuse ||
+		    arena.peak < VMARENA_CHUNKSIZE * 5) {
+			fprintf(stdout, "[FAIL]  ArenaPeakTest\n");
+			result = racoon_test_failure;
+		} else {
+			fprintf(stdout, "[PASS]  ArenaPeakTest\n");
+		}
+		vfree(a);
+		vfree(c);
+	}
+
+	fprintf(stdout, "[BEGIN] ArenaPromoteTest\n");
+	a = varena_alloc(&arena, 8);
+	b = varena_alloc(&arena, 16);
+	if (a == NULL || b == NULL) {
+		fprintf(stdout, "[FAIL]  ArenaPromoteTest\n");
+		result = racoon_test_failure;
+	} else {
+		u_int64_t promotions = vmbuf_stats.promotions;
+
+		memcpy(b->v, "skeyid-skeyid-sk", 16);
+		first = b->v;
+		/* a stays live, so only the explicit wipe clears b's bytes */
+		c = vpromote(b);
+		if (c == NULL || c->arena != NULL || c->l != 16 ||
+		    memcmp(c->v, "skeyid-skeyid-sk", 16) ||
+		    first[0] != 0 || first[15] != 0 || arena.live != 1 ||
+		    vmbuf_stats.promotions != promotions + 1 ||
+		    vpromote(c) != c) {
+			fprintf(stdout, "[FAIL]  ArenaPromoteTest\n");
+			result = racoon_test_failure;
+		} else {
+			fprintf(stdout, "[PASS]  ArenaPromoteTest\n");
+		}
+		vfree(a);
+		vfree(c);
+	}
+
+	fprintf(stdout, "[BEGIN] ArenaReleaseTest\n");
+	varena_release(&arena);
+	if (arena.chunks != NULL || arena.live != 0 || arena.inuse != 0) {
+		fprintf(stdout, "[FAIL]  ArenaReleaseTest\n");
+		result = racoon_test_failure;
+	} else {
+		/* once released, buffers come from the heap */
+		a = varena_alloc(&arena, 20);
+		if (a == NULL || a->arena != NULL || arena.chunks != NULL ||
+		    arena.live != 0) {
+			fprintf(stdout, "[FAIL]  ArenaReleaseTest\n");
+			result = racoon_test_failure;
+		} else {
+			fprintf(stdout, "[PASS]  ArenaReleaseTest\n");
+		}
+		vfree(a);
+	}
+
+	return result;
+}
+
+static int
+racoon_shard_test(void)
+{
+	int result = racoon_test_pass;
+	int counts[SHARD_MAX];
+	u_int8_t ck[sizeof(cookie_t)];
+	struct sockaddr_in a, b;
+	int i;
+
+	fprintf(stdout, "[TEST] RacoonShard\n");
+
+	/* each shard gets its share of the initiator cookies */
+	fprintf(stdout, "[BEGIN] ShardCookieSpreadTest\n");
+	shard_setup(4, 0);
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < 4096; i++) {
+		arc4random_buf(ck, sizeof(ck));
+		counts[shard_of_cookie(ck)]++;
+	}
+	for (i = 0; i < 4; i++)
+		if (counts[i] < 768 || counts[i] > 1280)
+			break;
+	if (i < 4) {
+		fprintf(stdout, "[FAIL]  ShardCookieSpreadTest\n");
+		result = racoon_test_failure;
+	} else {
+		fprintf(stdout, "[PASS]  ShardCookieSpreadTest\n");
+	}
+
+	/* NAT-T moves a peer to port 4500, it must stay on its shard */
+	fprintf(stdout, "[BEGIN] ShardAddressTest\n");
+	memset(&a, 0, sizeof(a));
+	a.sin_len = sizeof(a);
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(0xc0000201);	/* 192.0.2.1 */
+	a.sin_port = htons(PORT_ISAKMP);
+	b = a;
+	b.sin_port = htons(PORT_ISAKMP_NATT);
+	if (shard_of_addr((struct sockaddr_storage *)&a) !=
+	    shard_of_addr((struct sockaddr_storage *)&b) ||
+	    shard_of_addr((struct sockaddr_storage *)&a) !=
+	    shard_of_key(&a.sin_addr, sizeof(a.sin_addr))) {
+		fprintf(stdout, "[FAIL]  ShardAddressTest\n");
+		result = racoon_test_failure;
+	} else {
+		fprintf(stdout, "[PASS]  ShardAddressTest\n");
+	}
+
+	/* not sharded, everything is ours */
+	fprintf(stdout, "[BEGIN] ShardSingleTest\n");
+	shard_setup(1, 0);
+	if (shard_of_cookie(ck) != 0 ||
+	    shard_of_addr((struct sockaddr_storage *)&a) != 0) {
+		fprintf(stdout, "[FAIL]  ShardSingleTest\n");
+		result = racoon_test_failure;
+	} else {
+		fprintf(stdout, "[PASS]  ShardSingleTest\n");
+	}
+
+	return result;
+}
+
+/* the sources recorded so far, as the snapshot holds them */
+static u_int8_t *
+racoon_cfsnapshot_sources(size_t *len)
+{
+	u_int8_t *buf;
+
+	*len = cfsnapshot_sources_size();
+	if (cfsnapshot_nsources() <= 0 || (buf = malloc(*len)) == NULL)
+		return NULL;
+	cfsnapshot_sources_put(buf);
+	return buf;
+}
+
+static int
+racoon_cfsnapshot_current(const u_int8_t *buf, size_t len, const char *conf)
+{
+	const u_int8_t *p = buf;
+
+	if (cfsnapshot_sources_check(&p, buf + len, cfsnapshot_nsources(),
+	    conf) != 0 || p != buf + len)
+		return 0;
+	return 1;
+}
+
+static int
+racoon_cfsnapshot_test(void)
+{
+	int result = racoon_test_pass;
+	char dir[] = "/tmp/racoon_test.XXXXXX";
+	char conf[MAXPATHLEN], inc[MAXPATHLEN], pattern[MAXPATHLEN];
+	char added[MAXPATHLEN], snapshot[MAXPATHLEN];
+	u_int8_t *buf = NULL;
+	size_t len;
+	int fd = -1;
+
+	fprintf(stdout, "[TEST] RacoonCfSnapshot\n");
+
+	if (mkdtemp(dir) == NULL) {
+		fprintf(stdout, "[FAIL]  mkdtemp: %s\n", strerror(errno));
+		return racoon_test_failure;
+	}
+	snprintf(conf, sizeof(conf), "%s/racoon.conf", dir);
+	snprintf(inc, sizeof(inc), "%s/inc", dir);
+	if (mkdir(inc, 0700) != 0 ||
+	    (fd = open(conf, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+		fprintf(stdout, "[FAIL]  %s: %s\n", conf, strerror(errno));
+		result = racoon_test_failure;
+		goto end;
+	}
+
+	/* an include of every .conf file in an empty directory */
+	fprintf(stdout, "[BEGIN] CfSnapshotEmptyIncludeTest\n");
+	snprintf(pattern, sizeof(pattern), "%s/*.conf", inc);
+	snprintf(added, sizeof(added), "%s/peer.conf", inc);
+	cfsnapshot_reset();
+	cfsnapshot_source(conf, fd);
+	cfsnapshot_include(pattern);
+	buf = racoon_cfsnapshot_sources(&len);
+	if (buf == NULL || cfsnapshot_nsources() != 2 ||
+	    !racoon_cfsnapshot_current(buf, len, conf) ||
+	    close(open(added, O_WRONLY | O_CREAT, 0600)) != 0 ||
+	    racoon_cfsnapshot_current(buf, len, conf)) {
+		fprintf(stdout, "[FAIL]  CfSnapshotEmptyIncludeTest\n");
+		result = racoon_test_failure;
+	} else {
+		fprintf(stdout, "[PASS]  CfSnapshotEmptyIncludeTest\n");
+	}
+	unlink(added);
+	free(buf);
+
+	/* an include of the directory the snapshot is written to */
+	fprintf(stdout, "[BEGIN] CfSnapshotConfDirIncludeTest\n");
+	snprintf(pattern, sizeof(pattern), "%s/*.peer", dir);
+	snprintf(added, sizeof(added), "%s/added.peer", dir);
+	snprintf(snapshot, sizeof(snapshot), "%s%s", conf, CFSNAPSHOT_SUFFIX);
+	cfsnapshot_reset();
+	cfsnapshot_source(conf, fd);
+	cfsnapshot_include(pattern);
+	close(open(snapshot, O_WRONLY | O_CREAT, 0600));
+	buf = NULL;
+	if (cfsnapshot_refresh(dir) != 1 ||
+	    (buf = racoon_cfsnapshot_sources(&len)) == NULL ||
+	    !racoon_cfsnapshot_current(buf, len, conf) ||
+	    close(open(added, O_WRONLY | O_CREAT, 0600)) != 0 ||
+	    racoon_cfsnapshot_current(buf, len, conf)) {
+		fprintf(stdout, "[FAIL]  CfSnapshotConfDirIncludeTest\n");
+		result = racoon_test_failure;
+	} else {
+		fprintf(stdout, "[PASS]  CfSnapshotConfDirIncludeTest\n");
+	}
+	unlink(added);
+	unlink(snapshot);
+	free(buf);
+	cfsnapshot_reset();
+
+end:
+	if (fd >= 0)
+		close(fd);
+	unlink(conf);
+	rmdir(inc);
+	rmdir(dir);
+	return result;
+}
+
 static void
 racoon_unit_test(void)
 {
@@ -93,16 +630,249 @@ racoon_unit_test(void)
 		result = racoon_test_failure;
 	}
 
+	if (racoon_plindex_test() == racoon_test_failure) {
+		result = racoon_test_failure;
+	}
+
+	if (racoon_msgbuild_test() == racoon_test_failure) {
+		result = racoon_test_failure;
+	}
+
+	if (racoon_arena_test() == racoon_test_failure) {
+		result = racoon_test_failure;
+	}
+
+	if (racoon_shard_test() == racoon_test_failure) {
+		result = racoon_test_failure;
+	}
+
+	if (racoon_cfsnapshot_test() == racoon_test_failure) {
+		result = racoon_test_failure;
+	}
+
 	if (result == racoon_test_pass) {
 		fprintf(stdout, "\nAll Tests Passed\n\n");
 	}
 }
 
+static double
+racoon_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+racoon_parse_bench(long iterations)
+{
+	struct isakmp_plindex idx;
+	vchar_t msg;
+	double start, elapsed, total_time = 0, total_bytes = 0;
+	long i;
+	int j;
+
+	isakmp_plindex_init(&idx);
+	fprintf(stdout, "%-18s %12s %14s %10s\n",
+		"message", "bytes", "msgs/s", "ns/msg");
+	for (j = 0; j < IKE_MSG_COUNT; j++) {
+		msg.v = (caddr_t)ike_msgs[j].data;
+		msg.l = ike_msgs[j].len;
+
+		start = racoon_bench_now();
+		for (i = 0; i < iterations; i++) {
+			if (isakmp_plindex_parse(&idx, &msg) < 0) {
+				fprintf(stdout, "failed to index %s\n", ike_msgs[j].name);
+				return;
+			}
+		}
+		elapsed = racoon_bench_now() - start;
+
+		fprintf(stdout, "%-18s %12zu %14.0f %10.1f\n",
+			ike_msgs[j].name, ike_msgs[j].len,
+			iterations / elapsed, elapsed * 1e9 / iterations);
+		total_time += elapsed;
+		total_bytes += (double)iterations * ike_msgs[j].len;
+
+		/* keep the compiler from discarding the loop */
+		if (idx.np == 0)
+			fprintf(stdout, "%s has no payloads\n", ike_msgs[j].name);
+	}
+	fprintf(stdout, "%-18s %12s %14.0f %10.1f  (%.1f MB/s)\n", "all", "",
+		iterations * IKE_MSG_COUNT / total_time,
+		total_time * 1e9 / (iterations * IKE_MSG_COUNT),
+		total_bytes / total_time / 1e6);
+}
+
+/*
+ * phase 1 handshakes per second between two racoons on the loopback,
+ * each sharded over 1 to 8 processes with -N.
+ */
+static void
+racoon_shard_bench(const struct loadgen_config *load)
+{
+	static const int workers[] = { 1, 2, 4, 8 };
+	struct loadgen_config cf = *load;
+	struct loadgen_result res;
+	double rate, base = 0;
+	int i;
+
+	cf.ph2 = 0;
+	cf.quiet = 1;
+
+	fprintf(stdout, "%d sessions, %d handshakes per run\n",
+		cf.sessions, cf.handshakes);
+	fprintf(stdout, "%-8s %10s %8s %14s %8s\n",
+		"workers", "completed", "failed", "handshakes/s", "speedup");
+	for (i = 0; i < sizeof(workers) / sizeof(workers[0]); i++) {
+		cf.workers = workers[i];
+		if (racoon_loadgen(&cf, &res) < 0)
+			return;
+
+		rate = res.completed / res.elapsed;
+		if (i == 0)
+			base = rate;
+		fprintf(stdout, "%-8d %10lu %8lu %14.1f %8.2f\n", workers[i],
+			res.completed, res.failed + res.timedout, rate,
+			base > 0 ? rate / base : 0);
+	}
+}
+
+#define PFKEY_BENCH_WINDOW	32		/* requests in flight */
+
+enum {
+	PFKEY_BENCH_ADD,
+	PFKEY_BENCH_ACQUIRE,
+	PFKEY_BENCH_EXPIRE,
+	PFKEY_BENCH_MAX
+};
+
+static void
+racoon_pfkey_bench_sockaddr(struct sockaddr_in *sin, u_int32_t address)
+{
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_len = sizeof(*sin);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(address);
+}
+
+/* the next message of the given type, skipping broadcasts meant for others */
+static int
+racoon_pfkey_bench_wait(int so, u_int8_t type)
+{
+	struct sadb_msg *msg;
+	int error;
+
+	while ((msg = pfkeyemu_recv(so, 1000)) != NULL) {
+		if (msg->sadb_msg_type == type) {
+			error = msg->sadb_msg_errno;
+			free(msg);
+			return error == 0 ? 0 : -1;
+		}
+		free(msg);
+	}
+
+	return -1;
+}
+
+/*
+ * PF_KEY requests per second through the userspace stand-in: SA installs,
+ * acquire storms raised for one policy and hard expire storms, each
+ * completed by the message the stand-in sends for it.
+ */
+static void
+racoon_pfkey_bench(int sas, int latency)
+{
+	static const char *names[PFKEY_BENCH_MAX] = { "add", "acquire", "expire" };
+	char dir[] = "/tmp/racoon_pfkeyemu.XXXXXX";
+	char path[MAXPATHLEN];
+	struct sockaddr_in src, dst;
+	double start, elapsed;
+	pid_t pid = -1;
+	int so = -1, listener = -1;
+	int bench, sent, done, error, wso;
+	u_int8_t wtype;
+
+	if (mkdtemp(dir) == NULL) {
+		fprintf(stdout, "cannot create a work directory: %s\n", strerror(errno));
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/pfkey", dir);
+	if ((pid = pfkeyemu_spawn(path, latency)) < 0 ||
+	    (so = pfkeyemu_open(path)) < 0)
+		goto end;
+	racoon_pfkey_bench_sockaddr(&src, INADDR_LOOPBACK);
+	racoon_pfkey_bench_sockaddr(&dst, INADDR_LOOPBACK + 1);
+
+	fprintf(stdout, "%-10s %10s %14s %10s\n", "request", "count", "requests/s", "us/req");
+	for (bench = 0; bench < PFKEY_BENCH_MAX; bench++) {
+		/* registered sockets hear about acquires and expires */
+		if (bench == PFKEY_BENCH_ACQUIRE) {
+			if (pfkeyemu_spdadd(so, (struct sockaddr *)&src,
+			    (struct sockaddr *)&dst, IPSEC_DIR_OUTBOUND) < 0 ||
+			    racoon_pfkey_bench_wait(so, SADB_X_SPDADD) < 0 ||
+			    (listener = pfkeyemu_open(path)) < 0 ||
+			    pfkeyemu_register(listener, SADB_SATYPE_ESP) < 0 ||
+			    racoon_pfkey_bench_wait(listener, SADB_REGISTER) < 0) {
+				fprintf(stdout, "failed to set up the acquire benchmark\n");
+				goto end;
+			}
+		}
+		wso = bench == PFKEY_BENCH_ADD ? so : listener;
+		wtype = bench == PFKEY_BENCH_ADD ? SADB_ADD :
+			bench == PFKEY_BENCH_ACQUIRE ? SADB_ACQUIRE : SADB_EXPIRE;
+
+		start = racoon_bench_now();
+		for (sent = done = 0; done < sas; done++) {
+			for (; sent < sas && sent - done < PFKEY_BENCH_WINDOW; sent++) {
+				switch (bench) {
+				case PFKEY_BENCH_ADD:
+					error = pfkeyemu_add(so, htonl(0x1000 + sent),
+						(struct sockaddr *)&src, (struct sockaddr *)&dst, 0);
+					break;
+				case PFKEY_BENCH_ACQUIRE:
+					error = pfkeyemu_acquire(so,
+						(struct sockaddr *)&src, (struct sockaddr *)&dst);
+					break;
+				default:
+					error = pfkeyemu_expire(so, htonl(0x1000 + sent),
+						(struct sockaddr *)&src, (struct sockaddr *)&dst, 1);
+					break;
+				}
+				if (error < 0)
+					break;
+			}
+			if (racoon_pfkey_bench_wait(wso, wtype) < 0) {
+				fprintf(stdout, "%s failed after %d requests\n", names[bench], done);
+				goto end;
+			}
+		}
+		elapsed = racoon_bench_now() - start;
+
+		fprintf(stdout, "%-10s %10d %14.0f %10.1f\n", names[bench], sas,
+			sas / elapsed, elapsed * 1e6 / sas);
+	}
+
+end:
+	if (listener >= 0)
+		pfkeyemu_close(listener);
+	if (so >= 0)
+		pfkeyemu_close(so);
+	pfkeyemu_stop(pid);
+	unlink(path);
+	rmdir(dir);
+}
+
 int
 main(int argc, char *argv[])
 {
 	int opt = 0;
 	int opt_index = 0;
+	struct loadgen_config loadgen = { 0, 0, LOADGEN_MODE_MAIN, 0, "/usr/sbin/racoon", NULL, NULL, 0, 0, 0 };
+	const char *pfkey_emu = NULL;
+	int shard_sessions = 0;
+	int pfkey_sas = 0;
 
 	if (argc < 2) {
 		print_usage(argv[0]);
@@ -116,6 +886,93 @@ main(int argc, char *argv[])
 				racoon_unit_test();
 				break;
 			}
+			case 'p':
+			{
+				long iterations = 1000000;
+
+				if (optarg != NULL && (iterations = strtol(optarg, NULL, 10)) <= 0) {
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				racoon_parse_bench(iterations);
+				break;
+			}
+			case 'd':
+			{
+				shard_sessions = 16;
+				if (optarg != NULL && ((shard_sessions = (int)strtol(optarg, NULL, 10)) <= 0 ||
+				    shard_sessions > LOADGEN_MAXSESSIONS)) {
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
+			case 'l':
+			{
+				loadgen.sessions = 16;
+				if (optarg != NULL && ((loadgen.sessions = (int)strtol(optarg, NULL, 10)) <= 0 ||
+				    loadgen.sessions > LOADGEN_MAXSESSIONS)) {
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
+			case 'n':
+			{
+				if ((loadgen.handshakes = (int)strtol(optarg, NULL, 10)) <= 0) {
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
+			case 'm':
+			{
+				if (strcmp(optarg, "main") == 0)
+					loadgen.mode = LOADGEN_MODE_MAIN;
+				else if (strcmp(optarg, "aggressive") == 0)
+					loadgen.mode = LOADGEN_MODE_AGGRESSIVE;
+				else if (strcmp(optarg, "xauth") == 0)
+					loadgen.mode = LOADGEN_MODE_XAUTH;
+				else if (strcmp(optarg, "cert") == 0)
+					loadgen.mode = LOADGEN_MODE_CERT;
+				else {
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
+			case '2':
+				loadgen.ph2 = 1;
+				break;
+			case 'r':
+				loadgen.racoon = optarg;
+				break;
+			case 'c':
+				loadgen.certref = optarg;
+				break;
+			case 'x':
+				loadgen.xauth = optarg;
+				break;
+			case 'k':
+			{
+				pfkey_sas = 10000;
+				if (optarg != NULL && (pfkey_sas = (int)strtol(optarg, NULL, 10)) <= 0) {
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
+			case 'e':
+				pfkey_emu = optarg;
+				break;
+			case 'L':
+			{
+				if ((loadgen.pfkey_latency = (int)strtol(optarg, NULL, 10)) < 0) {
+					print_usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
 			case 'h':
 			default:
 			{
@@ -125,5 +982,25 @@ main(int argc, char *argv[])
 		}
 	}
 
+	/* these run once all of their options are known */
+	if (loadgen.sessions > 0) {
+		if (loadgen.handshakes == 0)
+			loadgen.handshakes = loadgen.sessions * 10;
+		if (racoon_loadgen(&loadgen, NULL) < 0)
+			exit(EXIT_FAILURE);
+	}
+	if (shard_sessions > 0) {
+		struct loadgen_config sh = loadgen;
+
+		sh.sessions = shard_sessions;
+		if (sh.handshakes == 0)
+			sh.handshakes = sh.sessions * 10;
+		racoon_shard_bench(&sh);
+	}
+	if (pfkey_sas > 0)
+		racoon_pfkey_bench(pfkey_sas, loadgen.pfkey_latency);
+	if (pfkey_emu != NULL && pfkeyemu_serve(pfkey_emu, loadgen.pfkey_latency) < 0)
+		exit(EXIT_FAILURE);
+
 	return (0);
 }
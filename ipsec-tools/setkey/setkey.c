@@ -59,6 +59,7 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <time.h>
+#include <poll.h>
 
 #ifdef HAVE_READLINE
 #include <readline/readline.h>
@@ -85,10 +86,15 @@ int verifypriority (struct sadb_msg *m);
 int fileproc (const char *);
 const char *numstr (int);
 void shortdump_hdr (void);
-void shortdump (struct sadb_msg *);
+void shortdump (struct sadb_msg *, caddr_t *);
 static void printdate (void);
 static int32_t gmt2local (time_t);
 void stdin_loop (void);
+static ssize_t recvkeymsg (struct sadb_msg **);
+static const char *msgerror (struct sadb_msg *);
+static int bulk_queue (char *, size_t);
+static void bulk_flush (void);
+static int bulk_report (void);
 
 #define MODE_SCRIPT	1
 #define MODE_CMDDUMP	2
@@ -96,6 +102,9 @@ void stdin_loop (void);
 #define MODE_PROMISC	4
 #define MODE_STDIN	5
 
+#define RECV_BUFSIZ	(1024 * 32)	/* grown to the largest message */
+#define DUMP_BUFSIZ	(1024 * 1024)
+
 int so;
 
 int f_forever = 0;
@@ -108,6 +117,8 @@ int f_hexdump = 0;
 int f_tflag = 0;
 int f_notreally = 0;
 int f_withports = 0;
+int f_bulk = 0;
+int f_json = 0;
 #ifdef HAVE_POLICY_FWD
 int f_rfcmode = 1;
 #define RK_OPTS "rk"
@@ -134,8 +145,8 @@ usage(/*int only_version*/)
 	//if (! only_version) {
 		printf("usage: setkey [-v" RK_OPTS "] file ...\n");
 		printf("       setkey [-nv" RK_OPTS "] -c\n");
-		printf("       setkey [-nv" RK_OPTS "] -f filename\n");
-		printf("       setkey [-Palpv" RK_OPTS "] -D\n");
+		printf("       setkey [-bnv" RK_OPTS "] -f filename\n");
+		printf("       setkey [-Palpjv" RK_OPTS "] -D\n");
 		printf("       setkey [-Pv] -F\n");
 		printf("       setkey [-H] -x\n");
 		printf("       setkey [-V] [-h]\n");
@@ -158,8 +169,11 @@ main(argc, argv)
 
 	thiszone = gmt2local(0);
 
-	while ((c = getopt(argc, argv, "acdf:HlnvxDFPphVrk?")) != -1) {
+	while ((c = getopt(argc, argv, "abcdf:HjlnvxDFPphVrk?")) != -1) {
 		switch (c) {
+		case 'b':
+			f_bulk = 1;
+			break;
 		case 'c':
 			f_mode = MODE_STDIN;
 #ifdef HAVE_READLINE
@@ -187,6 +201,9 @@ main(argc, argv)
 		case 'a':
 			f_all = 1;
 			break;
+		case 'j':
+			f_json = 1;
+			break;
 		case 'l':
 			f_forever = 1;
 			break;
@@ -243,6 +260,11 @@ main(argc, argv)
 	argc -= optind;
 	argv += optind;
 
+	if (f_bulk && f_mode != MODE_SCRIPT)
+		usage();
+	if (f_json && (f_mode != MODE_CMDDUMP || f_forever))
+		usage();
+
 	if (argc > 0) {
 		while (argc--)
 			if (fileproc(*argv++) < 0) {
@@ -268,6 +290,9 @@ main(argc, argv)
 
 	switch (f_mode) {
 	case MODE_CMDDUMP:
+		/* one write per DUMP_BUFSIZ, not per field */
+		if (!f_forever)
+			setvbuf(stdout, NULL, _IOFBF, DUMP_BUFSIZ);
 		sendkeyshort(f_policy ? SADB_X_SPDDUMP : SADB_DUMP);
 		break;
 	case MODE_CMDFLUSH:
@@ -280,6 +305,11 @@ main(argc, argv)
 		}
 		if (parse(&fp))
 			exit (1);
+		if (f_bulk) {
+			bulk_flush();
+			if (bulk_report() != 0)
+				exit(1);
+		}
 		break;
 	case MODE_STDIN:
 		if (get_supported() < 0) {
@@ -467,31 +497,70 @@ promisc()
 	}
 }
 
+/*
+ * receive one message into a buffer sized from its header, so that a
+ * record of any size comes in whole.  The buffer is reused by the next
+ * call.
+ */
+static ssize_t
+recvkeymsg(msgp)
+	struct sadb_msg **msgp;
+{
+	static u_int64_t *rbuf = NULL;	/* aligned for the extensions */
+	static size_t rbuflen = 0;
+	struct sadb_msg hdr;
+	size_t need;
+	ssize_t l;
+
+	if ((l = recv(so, &hdr, sizeof(hdr), MSG_PEEK)) < 0)
+		return -1;
+	need = sizeof(hdr);
+	if (l == sizeof(hdr) && PFKEY_UNUNIT64(hdr.sadb_msg_len) > need)
+		need = PFKEY_UNUNIT64(hdr.sadb_msg_len);
+	if (need > rbuflen) {
+		size_t newlen = rbuflen ? rbuflen : RECV_BUFSIZ;
+
+		while (newlen < need)
+			newlen *= 2;
+		if ((rbuf = realloc(rbuf, newlen)) == NULL)
+			err(1, "realloc");
+		rbuflen = newlen;
+	}
+
+	*msgp = (struct sadb_msg *)rbuf;
+	return recv(so, rbuf, rbuflen, 0);
+}
+
 int
 sendkeymsg(buf, len)
 	char *buf;
 	size_t len;
 {
-    union {                             // Wcast-align fix - force alignment
-        u_int64_t force_align;
-        u_char rbuf[1024 * 32];	/* XXX: Enough ? Should I do MSG_PEEK ? */
-    } u_buf;
 	ssize_t l;
 	struct sadb_msg *msg;
+	static int rcvtimeo_set = 0;
 
 	if (f_notreally) {
 		goto end;
 	}
 
-    {
-	struct timeval tv;
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
-	if (setsockopt(so, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-		perror("setsockopt");
-		goto end;
+	if (f_bulk) {
+		if (bulk_queue(buf, len) == 0)
+			goto end;
+		/* a command with output: what was queued goes first */
+		bulk_flush();
+	}
+
+	if (!rcvtimeo_set) {
+		struct timeval tv;
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		if (setsockopt(so, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+			perror("setsockopt");
+			goto end;
+		}
+		rcvtimeo_set = 1;
 	}
-    }
 
 	if (f_forever)
 		shortdump_hdr();
@@ -518,9 +587,8 @@ again:
 		goto end;
 	}
 
-	msg = (struct sadb_msg *)&u_buf;
 	do {
-		if ((l = recv(so, u_buf.rbuf, sizeof(u_buf.rbuf), 0)) < 0) {
+		if ((l = recvkeymsg(&msg)) < 0) {
 			perror("recv");
 			goto end;
 		}
@@ -531,7 +599,7 @@ again:
 		}
 
 		if (f_verbose) {
-			kdebug_sadb((struct sadb_msg *)&u_buf);
+			kdebug_sadb(msg);
 			printf("\n");
 		}
 		if (postproc(msg, l) < 0)
@@ -548,76 +616,293 @@ end:
 	return (0);
 }
 
+/*
+ * bulk mode (-b, with -f).
+ * The whole file is parsed before anything is sent.  The messages that
+ * only report success or failure are queued; they are then streamed to
+ * the kernel with up to BULK_WINDOW of them waiting for their reply,
+ * which is found by its sequence number.  Failures are listed by line
+ * at the end.  A command with output (get, dump) is run in its place,
+ * once the messages queued before it are answered.
+ */
+#define BULK_WINDOW	128
+#define BULK_RCVBUF	(1024 * 1024)	/* room for the replies in flight */
+#define BULK_TIMEOUT	1000		/* msec, as SO_RCVTIMEO otherwise */
+
+struct bulkmsg {
+	char *buf;			/* freed once sent */
+	size_t len;
+	int lineno;
+	int error;			/* of the reply, -1 while none */
+};
+
+static struct bulkmsg *bulk;
+static u_int32_t bulk_n;		/* queued */
+static u_int32_t bulk_size;
+static u_int32_t bulk_sent;		/* bulk[0 .. bulk_sent - 1] sent */
+static u_int32_t bulk_done;		/* answered, among those */
+static u_int32_t bulk_failed;
+static struct timeval bulk_start;
+
+static int
+bulk_queue(buf, len)
+	char *buf;
+	size_t len;
+{
+	struct sadb_msg *msg = ALIGNED_CAST(struct sadb_msg *)buf;
+	struct bulkmsg *b;
+
+	switch (msg->sadb_msg_type) {
+	case SADB_ADD:
+	case SADB_UPDATE:
+	case SADB_DELETE:
+	case SADB_FLUSH:
+	case SADB_X_SPDADD:
+	case SADB_X_SPDUPDATE:
+	case SADB_X_SPDDELETE:
+	case SADB_X_SPDFLUSH:
+		break;
+	default:
+		return -1;
+	}
+
+	if (bulk_n == bulk_size) {
+		bulk_size = bulk_size ? bulk_size * 2 : 1024;
+		bulk = realloc(bulk, bulk_size * sizeof(*bulk));
+		if (bulk == NULL)
+			err(1, "realloc");
+	}
+	b = &bulk[bulk_n];
+	if ((b->buf = malloc(len)) == NULL)
+		err(1, "malloc");
+	memcpy(b->buf, buf, len);
+	b->len = len;
+	b->lineno = lineno;
+	b->error = -1;
+	if (bulk_n == 0)
+		gettimeofday(&bulk_start, NULL);
+
+	/* the reply is told by its sequence number: the index, plus one */
+	msg = ALIGNED_CAST(struct sadb_msg *)b->buf;
+	msg->sadb_msg_seq = ++bulk_n;
+
+	return 0;
+}
+
+static void
+bulk_answer(b, error)
+	struct bulkmsg *b;
+	int error;
+{
+	b->error = error;
+	if (error != 0)
+		bulk_failed++;
+	bulk_done++;
+}
+
+/*
+ * send everything queued and wait for all the replies.
+ */
+static void
+bulk_flush()
+{
+	struct sadb_msg *msg;
+	struct pollfd pfd;
+	struct bulkmsg *b;
+	u_int32_t i, oldest = bulk_done;
+	pid_t pid = getpid();
+	ssize_t l;
+	int n, rcvbuf = BULK_RCVBUF;
+	static int rcvbuf_set = 0;
+
+	if (!rcvbuf_set) {
+		/* not fatal: more replies would be dropped, then timed out */
+		(void)setsockopt(so, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		rcvbuf_set = 1;
+	}
+
+	while (bulk_done < bulk_n) {
+		/* fill the window */
+		while (bulk_sent < bulk_n && bulk_sent - bulk_done < BULK_WINDOW) {
+			b = &bulk[bulk_sent];
+			if (f_verbose) {
+				kdebug_sadb(ALIGNED_CAST(struct sadb_msg *)b->buf);
+				printf("\n");
+			}
+			if (send(so, b->buf, b->len, 0) < 0) {
+				if (errno == ENOBUFS && bulk_sent > bulk_done)
+					break;		/* retried once some replies are in */
+				bulk_sent++;
+				bulk_answer(b, errno);
+			} else
+				bulk_sent++;
+			free(b->buf);
+			b->buf = NULL;
+		}
+		if (bulk_done == bulk_n)
+			break;
+
+		pfd.fd = so;
+		pfd.events = POLLIN;
+		n = poll(&pfd, 1, BULK_TIMEOUT);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+		if (n == 0) {
+			/* the replies still missing were dropped */
+			for (i = oldest; i < bulk_sent; i++) {
+				if (bulk[i].error < 0)
+					bulk_answer(&bulk[i], ETIMEDOUT);
+			}
+			continue;
+		}
+
+		if ((l = recvkeymsg(&msg)) < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			err(1, "recv");
+		}
+		if (l < (ssize_t)sizeof(*msg) || PFKEY_UNUNIT64(msg->sadb_msg_len) != l)
+			continue;
+		if (msg->sadb_msg_pid != (u_int32_t)pid
+		 || msg->sadb_msg_seq == 0 || msg->sadb_msg_seq > bulk_sent)
+			continue;		/* not a reply to us */
+		b = &bulk[msg->sadb_msg_seq - 1];
+		if (b->error >= 0)
+			continue;		/* seen it already */
+		if (f_verbose) {
+			kdebug_sadb(msg);
+			printf("\n");
+		}
+		bulk_answer(b, msg->sadb_msg_errno);
+		if (msg->sadb_msg_errno != 0) {
+			/* keep the message, for its text at the end */
+			b->buf = malloc(sizeof(*msg));
+			if (b->buf != NULL)
+				memcpy(b->buf, msg, sizeof(*msg));
+		}
+		while (oldest < bulk_sent && bulk[oldest].error >= 0)
+			oldest++;
+	}
+}
+
+/*
+ * list the failures by line, then the throughput.
+ * returns the number of failures.
+ */
+static int
+bulk_report()
+{
+	struct timeval end;
+	struct bulkmsg *b;
+	struct sadb_msg *msg;
+	double secs;
+	u_int32_t i;
+
+	for (i = 0; i < bulk_n; i++) {
+		b = &bulk[i];
+		if (b->error <= 0)
+			continue;
+		msg = ALIGNED_CAST(struct sadb_msg *)b->buf;
+		if (msg != NULL) {
+			printf("The result of line %d: %s.\n", b->lineno, msgerror(msg));
+			free(b->buf);
+			b->buf = NULL;
+		} else if (b->error == ETIMEDOUT)
+			printf("The result of line %d: no reply.\n", b->lineno);
+		else
+			printf("The result of line %d: %s.\n", b->lineno, strerror(b->error));
+	}
+
+	if (bulk_n == 0)
+		return 0;
+	gettimeofday(&end, NULL);
+	secs = (end.tv_sec - bulk_start.tv_sec) +
+	    (end.tv_usec - bulk_start.tv_usec) / 1000000.0;
+	printf("%u messages, %u failed, in %.3f seconds (%.0f/s).\n",
+	    bulk_n, bulk_failed, secs, secs > 0 ? bulk_n / secs : 0.0);
+
+	return bulk_failed;
+}
+
+/*
+ * the text of the error a reply carries.
+ */
+static const char *
+msgerror(msg)
+	struct sadb_msg *msg;
+{
+	switch (msg->sadb_msg_errno) {
+	case ENOENT:
+		switch (msg->sadb_msg_type) {
+		case SADB_DELETE:
+		case SADB_GET:
+		case SADB_X_SPDDELETE:
+			return "No entry";
+		case SADB_DUMP:
+			return "No SAD entries";
+		case SADB_X_SPDDUMP:
+			return "No SPD entries";
+		}
+		/* FALLTHROUGH */
+	default:
+		return strerror(msg->sadb_msg_errno);
+	}
+}
+
 int
 postproc(msg, len)
 	struct sadb_msg *msg;
 	int len;
 {
+	caddr_t mhp[SADB_EXT_MAX + 1];
+	caddr_t *parsed;
+	struct sadb_sa *sa;
 #ifdef HAVE_PFKEY_POLICY_PRIORITY
 	static int priority_support_check = 0;
 #endif
 
 	if (msg->sadb_msg_errno != 0) {
 		char inf[80];
-		const char *errmsg = NULL;
 
 		if (f_mode == MODE_SCRIPT)
 			snprintf(inf, sizeof(inf), "The result of line %d: ", lineno);
 		else
 			inf[0] = '\0';
 
-		switch (msg->sadb_msg_errno) {
-		case ENOENT:
-			switch (msg->sadb_msg_type) {
-			case SADB_DELETE:
-			case SADB_GET:
-			case SADB_X_SPDDELETE:
-				errmsg = "No entry";
-				break;
-			case SADB_DUMP:
-				errmsg = "No SAD entries";
-				break;
-			case SADB_X_SPDDUMP:
-				errmsg = "No SPD entries";
-				break;
-			}
-			break;
-		default:
-			errmsg = strerror(msg->sadb_msg_errno);
-		}
-		printf("%s%s.\n", inf, errmsg);
+		printf("%s%s.\n", inf, msgerror(msg));
 		return (-1);
 	}
 
 	switch (msg->sadb_msg_type) {
 	case SADB_GET:
-		if (f_withports)
+		if (f_json)
+			pfkey_sadump_json(msg);
+		else if (f_withports)
 			pfkey_sadump_withports(msg);
 		else
 			pfkey_sadump(msg);
 		break;
 
 	case SADB_DUMP:
+		/* parsed once, for the filter and the dump alike */
+		parsed = pfkey_parse(msg, len, mhp) == 0 ? mhp : NULL;
+
 		/* filter out DEAD SAs */
-		if (!f_all) {
-			caddr_t mhp[SADB_EXT_MAX + 1];
-			struct sadb_sa *sa;
-			pfkey_align(msg, mhp);
-			pfkey_check(mhp);
-			if ((sa = ALIGNED_CAST(struct sadb_sa *)mhp[SADB_EXT_SA]) != NULL) {     // Wcast-align (void*) - buffer of pointers to aligned structs in malloc'd buffer
-				if (sa->sadb_sa_state == SADB_SASTATE_DEAD)
-					break;
-			}
+		if (!f_all && parsed != NULL &&
+		    (sa = ALIGNED_CAST(struct sadb_sa *)mhp[SADB_EXT_SA]) != NULL) {     // Wcast-align (void*) - buffer of pointers to aligned structs in malloc'd buffer
+			if (sa->sadb_sa_state == SADB_SASTATE_DEAD)
+				break;
 		}
-		if (f_forever) {
+		if (f_json)
+			pfkey_sadump_json_parsed(parsed);
+		else if (f_forever) {
 			/* TODO: f_withports */
-			shortdump(msg);
-		} else {
-			if (f_withports)
-				pfkey_sadump_withports(msg);
-			else
-				pfkey_sadump(msg);
-		}
+			shortdump(msg, mhp);
+		} else
+			pfkey_sadump_parsed(parsed, f_withports);
 		msg = ALIGNED_CAST(struct sadb_msg *)((caddr_t)msg +
 				     PFKEY_UNUNIT64(msg->sadb_msg_len));           // Wcast-align fix (void*) - aligned msg buffer passed into function
 		if (f_verbose) {
@@ -634,7 +919,9 @@ postproc(msg, len)
 		break;
 
 	case SADB_X_SPDDUMP:
-		if (f_withports) 
+		if (f_json)
+			pfkey_spdump_json(msg);
+		else if (f_withports)
 			pfkey_spdump_withports(msg);
 		else
 			pfkey_spdump(msg);
@@ -670,11 +957,7 @@ verifypriority(m)
 	struct sadb_x_policy *xpl;
 
 	/* check pfkey message. */
-	if (pfkey_align(m, mhp)) {
-		printf("(%s\n", ipsec_strerror());
-		return 0;
-	}
-	if (pfkey_check(mhp)) {
+	if (pfkey_parse(m, PFKEY_UNUNIT64(m->sadb_msg_len), mhp)) {
 		printf("%s\n", ipsec_strerror());
 		return 0;
 	}
@@ -783,10 +1066,10 @@ shortdump_hdr()
 }
 
 void
-shortdump(msg)
+shortdump(msg, mhp)
 	struct sadb_msg *msg;
+	caddr_t *mhp;
 {
-	caddr_t mhp[SADB_EXT_MAX + 1];
 	char buf[NI_MAXHOST], pbuf[NI_MAXSERV];
 	struct sadb_sa *sa;
 	struct sadb_address *saddr;
@@ -795,9 +1078,10 @@ shortdump(msg)
 	u_int t;
 	time_t cur = time(0);
 
-	pfkey_align(msg, mhp);
-	pfkey_check(mhp);
-
+	/*
+	 * mhp is as pfkey_parse() left it: what doesn't parse shows up
+	 * as missing fields.
+	 */
 	printf("%02lu%02lu", (u_long)(cur % 3600) / 60, (u_long)(cur % 60));
 
 	printf(" %-3s", STR_OR_ID(msg->sadb_msg_satype, satype));